@@ -91,11 +91,62 @@ namespace
 		value.cert = fl::security_configuration::cert_type::from_trusted_certificate(file);
 	}
 
+	void from_file(std::vector<fl::security_configuration::cert_type>& value, const cryptoplus::file& file)
+	{
+		fl::security_configuration::cert_type::from_trusted_certificate_bundle(file, value);
+	}
+
 	void from_file(fl::security_configuration::crl_type& value, const cryptoplus::file& file)
 	{
 		value = fl::security_configuration::crl_type::from_certificate_revocation_list(file);
 	}
 
+	fl::fscp_configuration::scheduling_class_type parse_scheduling_class(const std::string& name, const std::string& str)
+	{
+		fl::fscp_configuration::scheduling_class_type result;
+
+		const size_t equal_pos = str.find_last_of('=');
+
+		bool valid = (equal_pos != std::string::npos);
+
+		if (valid)
+		{
+			try
+			{
+				result.weight = boost::lexical_cast<unsigned int>(str.substr(equal_pos + 1));
+
+				const std::string selector = str.substr(0, equal_pos);
+
+				if (selector.compare(0, 3, "cn:") == 0)
+				{
+					result.common_name = selector.substr(3);
+				}
+				else if (selector.compare(0, 4, "net:") == 0)
+				{
+					result.network = boost::lexical_cast<asiotap::ip_network_address>(selector.substr(4));
+				}
+				else
+				{
+					valid = false;
+				}
+			}
+			catch (const boost::bad_lexical_cast&)
+			{
+				valid = false;
+			}
+		}
+
+		if (!valid)
+		{
+			po::error_with_option_name error("in %canonical_option%: invalid scheduling class \"%value%\", expected cn:<common name>=<weight> or net:<network address>=<weight>", name);
+			error.set_substitute("value", str);
+
+			throw error;
+		}
+
+		return result;
+	}
+
 	template <typename ValueType>
 	bool load_file(const std::string& file_type, ValueType& value, const std::string& name, const fs::path& filename)
 	{
@@ -188,13 +239,27 @@ namespace
 
 	bool load_trusted_certificate_list(std::vector<fl::security_configuration::cert_type>& value, const std::string& name, const po::variables_map& vm)
 	{
-		std::vector<trusted_cert_type> xvalue;
+		// Each listed file may be a PEM bundle: load every certificate it contains in one pass.
+		value.clear();
 
-		const bool result = load_file_list("trusted certificate", xvalue, name, vm);
+		const auto paths = vm[name].as<std::vector<fs::path> >();
 
-		value.assign(xvalue.begin(), xvalue.end());
+		for (auto&& path : paths)
+		{
+			if (path.native().empty())
+			{
+				continue;
+			}
 
-		return result;
+			std::vector<fl::security_configuration::cert_type> bundle;
+
+			if (load_file("trusted certificate", bundle, name, path))
+			{
+				value.insert(value.end(), bundle.begin(), bundle.end());
+			}
+		}
+
+		return !value.empty();
 	}
 
 	bool load_crl_list(std::vector<fl::security_configuration::crl_type>& value, const std::string& name, const po::variables_map& vm)
@@ -285,6 +350,9 @@ po::options_description get_fscp_options()
 	("fscp.listen_on_device", po::value<std::string>()->default_value(std::string()), "The endpoint to listen on.")
 	("fscp.hello_timeout", po::value<millisecond_duration>()->default_value(3000), "The default timeout for HELLO messages, in milliseconds.")
 	("fscp.contact", po::value<std::vector<asiotap::endpoint> >()->multitoken()->zero_tokens()->default_value(std::vector<asiotap::endpoint>(), ""), "The address of an host to contact.")
+	("fscp.tcp_enabled", po::value<bool>()->default_value(false, "no"), "Enable the TCP fallback transport for networks that block UDP.")
+	("fscp.tcp_contact", po::value<std::vector<asiotap::endpoint> >()->multitoken()->zero_tokens()->default_value(std::vector<asiotap::endpoint>(), ""), "The address of an host to contact over TCP.")
+	("fscp.relay_enabled", po::value<bool>()->default_value(false, "no"), "Enable relaying traffic between non-connected peers.")
 	("fscp.accept_contact_requests", po::value<bool>()->default_value(true, "yes"), "Whether to accept CONTACT-REQUEST messages.")
 	("fscp.accept_contacts", po::value<bool>()->default_value(true, "yes"), "Whether to accept CONTACT messages.")
 	("fscp.dynamic_contact_file", po::value<std::vector<fs::path> >()->multitoken()->zero_tokens()->default_value(std::vector<fs::path>(), ""), "The certificate of an host to dynamically contact.")
@@ -292,6 +360,15 @@ po::options_description get_fscp_options()
 	("fscp.cipher_suite_capability", po::value<std::vector<fscp::cipher_suite_type> >()->multitoken()->zero_tokens()->default_value(fscp::get_default_cipher_suites(), ""), "A cipher suite to allow.")
 	("fscp.elliptic_curve_capability", po::value<std::vector<fscp::elliptic_curve_type> >()->multitoken()->zero_tokens()->default_value(fscp::get_default_elliptic_curves(), ""), "A elliptic curve to allow.")
 	("fscp.upnp_enabled", po::value<bool>()->default_value(true, "yes"), "Enable UPnP.")
+	("fscp.presentation_cache_file", po::value<fs::path>()->default_value(""), "The persistent presentation cache file. An empty value disables the cache.")
+	("fscp.busy_poll_us", po::value<unsigned int>()->default_value(0), "The busy-poll duration, in microseconds. 0 disables busy-polling.")
+	("fscp.max_queue_sojourn_ms", po::value<unsigned int>()->default_value(0), "The maximum time, in milliseconds, a datagram may wait in a congested send queue before being dropped. 0 disables the limit.")
+	("fscp.reorder_hold_ms", po::value<unsigned int>()->default_value(0), "The maximum time, in milliseconds, an out-of-order data message may be held back waiting for the missing one. 0 disables the hold.")
+	("fscp.receive_steering_workers", po::value<unsigned int>()->default_value(0), "The count of extra receive sockets to steer inbound peers over. 0 disables receive steering.")
+	("fscp.latency_tracing", po::value<bool>()->default_value(false, "no"), "Whether to trace the packet-path latency.")
+	("fscp.mtu_discovery", po::value<bool>()->default_value(false, "no"), "Whether to discover the path MTU towards the peers.")
+	("fscp.data_coalescing", po::value<bool>()->default_value(false, "no"), "Whether to coalesce small data frames. All the peers must have the option enabled.")
+	("fscp.scheduling_class", po::value<std::vector<std::string> >()->multitoken()->zero_tokens()->default_value(std::vector<std::string>(), ""), "A peer scheduling class, as cn:<common name>=<weight> or net:<network address>=<weight>.")
 	;
 
 	return result;
@@ -312,6 +389,7 @@ po::options_description get_security_options()
 	("security.authority_certificate_file", po::value<std::vector<fs::path> >()->multitoken()->zero_tokens()->default_value(std::vector<fs::path>(), ""), "An authority certificate file to use.")
 	("security.certificate_revocation_validation_method", po::value<fl::security_configuration::certificate_revocation_validation_method_type>()->default_value(fl::security_configuration::CRVM_NONE), "The certificate revocation validation method.")
 	("security.certificate_revocation_list_file", po::value<std::vector<fs::path> >()->multitoken()->zero_tokens()->default_value(std::vector<fs::path>(), ""), "A certificate revocation list file to use.")
+	("security.crypto_engine", po::value<std::string>()->default_value(""), "The OpenSSL engine to pin, if any.")
 	;
 
 	return result;
@@ -330,6 +408,7 @@ po::options_description get_tap_adapter_options()
 	("tap_adapter.type", po::value<fl::tap_adapter_configuration::tap_adapter_type>()->default_value(fl::tap_adapter_configuration::tap_adapter_type::tap, "tap"), "The TAP adapter type.")
 	("tap_adapter.enabled", po::value<bool>()->default_value(true, "yes"), "Whether to enable the tap adapter.")
 	("tap_adapter.name", po::value<std::string>(), "The name of the tap adapter to use or create.")
+	("tap_adapter.queue_count", po::value<size_t>()->default_value(1), "The number of read queues to open on the tap adapter, on systems that support multi-queue.")
 	("tap_adapter.mtu", po::value<fl::mtu_type>()->default_value(fl::auto_mtu_type()), "The MTU of the tap adapter.")
 	("tap_adapter.mss_override", po::value<fl::mss_type>()->default_value(fl::mss_type()), "The MSS override.")
 	("tap_adapter.metric", po::value<fl::metric_type>()->default_value(fl::auto_metric_type()), "The metric of the tap adapter.")
@@ -355,6 +434,7 @@ po::options_description get_switch_options()
 	result.add_options()
 	("switch.routing_method", po::value<fl::switch_configuration::routing_method_type>()->default_value(fl::switch_configuration::RM_SWITCH), "The routing method for messages.")
 	("switch.relay_mode_enabled", po::value<bool>()->default_value(false, "no"), "Whether to enable the relay mode.")
+	("switch.mac_gossip_enabled", po::value<bool>()->default_value(true, "yes"), "Whether to gossip learned ethernet addresses to the other hosts.")
 	;
 
 	return result;
@@ -379,6 +459,19 @@ po::options_description get_router_options()
 	return result;
 }
 
+po::options_description get_threads_options()
+{
+	po::options_description result("Threads options");
+
+	result.add_options()
+	("threads.worker_count", po::value<unsigned int>()->default_value(0), "The number of worker threads to use (0 means one per processor core).")
+	("threads.certificate_verification_count", po::value<unsigned int>()->default_value(0), "The number of certificate verification threads to use (0 means the built-in default).")
+	("threads.worker_affinity", po::value<std::vector<unsigned int> >()->multitoken()->zero_tokens()->default_value(std::vector<unsigned int>(), ""), "A CPU to pin the worker threads to (worker i is pinned to the i-th value, wrapping around).")
+	;
+
+	return result;
+}
+
 void make_paths_absolute(boost::program_options::variables_map& vm, const boost::filesystem::path& root)
 {
 	make_path_absolute("server.server_certificate_file", vm, root);
@@ -387,6 +480,7 @@ void make_paths_absolute(boost::program_options::variables_map& vm, const boost:
 	make_path_absolute("server.certification_authority_private_key_file", vm, root);
 	make_path_absolute("server.authentication_script", vm, root);
 	make_path_list_absolute("fscp.dynamic_contact_file", vm, root);
+	make_path_absolute("fscp.presentation_cache_file", vm, root);
 	make_path_absolute("security.signature_certificate_file", vm, root);
 	make_path_absolute("security.signature_private_key_file", vm, root);
 	make_path_absolute("security.certificate_validation_script", vm, root);
@@ -449,6 +543,16 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	const std::vector<asiotap::endpoint> contact = vm["fscp.contact"].as<std::vector<asiotap::endpoint> >();
 	configuration.fscp.contact_list.insert(contact.begin(), contact.end());
 
+	configuration.fscp.tcp_enabled = vm["fscp.tcp_enabled"].as<bool>();
+
+	const std::vector<asiotap::endpoint> tcp_contact = vm["fscp.tcp_contact"].as<std::vector<asiotap::endpoint> >();
+	configuration.fscp.tcp_contact_list.insert(tcp_contact.begin(), tcp_contact.end());
+
+	// The TCP contacts get contacted like any other.
+	configuration.fscp.contact_list.insert(tcp_contact.begin(), tcp_contact.end());
+
+	configuration.fscp.relay_enabled = vm["fscp.relay_enabled"].as<bool>();
+
 	configuration.fscp.accept_contact_requests = vm["fscp.accept_contact_requests"].as<bool>();
 	configuration.fscp.accept_contacts = vm["fscp.accept_contacts"].as<bool>();
 
@@ -463,6 +567,19 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	configuration.fscp.never_contact_list = vm["fscp.never_contact"].as<std::vector<asiotap::ip_network_address>>();
 	configuration.fscp.cipher_suite_capabilities = vm["fscp.cipher_suite_capability"].as<std::vector<fscp::cipher_suite_type>>();
 	configuration.fscp.elliptic_curve_capabilities = vm["fscp.elliptic_curve_capability"].as<std::vector<fscp::elliptic_curve_type>>();
+	configuration.fscp.presentation_cache_file = vm["fscp.presentation_cache_file"].as<fs::path>().string();
+	configuration.fscp.busy_poll_us = vm["fscp.busy_poll_us"].as<unsigned int>();
+	configuration.fscp.max_queue_sojourn_ms = vm["fscp.max_queue_sojourn_ms"].as<unsigned int>();
+	configuration.fscp.reorder_hold_ms = vm["fscp.reorder_hold_ms"].as<unsigned int>();
+	configuration.fscp.receive_steering_workers = vm["fscp.receive_steering_workers"].as<unsigned int>();
+	configuration.fscp.latency_tracing = vm["fscp.latency_tracing"].as<bool>();
+	configuration.fscp.mtu_discovery = vm["fscp.mtu_discovery"].as<bool>();
+	configuration.fscp.data_coalescing = vm["fscp.data_coalescing"].as<bool>();
+
+	for (auto&& scheduling_class : vm["fscp.scheduling_class"].as<std::vector<std::string>>())
+	{
+		configuration.fscp.scheduling_classes.push_back(parse_scheduling_class("fscp.scheduling_class", scheduling_class));
+	}
 
 	// Security options
 	const std::string passphrase = vm["security.passphrase"].as<std::string>();
@@ -517,6 +634,8 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 		}
 	}
 
+	configuration.security.crypto_engine = vm["security.crypto_engine"].as<std::string>();
+
 	// Tap adapter options
 	configuration.tap_adapter.type = vm["tap_adapter.type"].as<fl::tap_adapter_configuration::tap_adapter_type>();
 	configuration.tap_adapter.enabled = vm["tap_adapter.enabled"].as<bool>();
@@ -526,6 +645,7 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 		configuration.tap_adapter.name = vm["tap_adapter.name"].as<std::string>();
 	}
 
+	configuration.tap_adapter.queue_count = vm["tap_adapter.queue_count"].as<size_t>();
 	configuration.tap_adapter.mtu = vm["tap_adapter.mtu"].as<fl::mtu_type>();
 	configuration.tap_adapter.mss_override = vm["tap_adapter.mss_override"].as<fl::mss_type>();
 	configuration.tap_adapter.metric = vm["tap_adapter.metric"].as<fl::metric_type>();
@@ -556,6 +676,7 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	// Switch options
 	configuration.switch_.routing_method = vm["switch.routing_method"].as<fl::switch_configuration::routing_method_type>();
 	configuration.switch_.relay_mode_enabled = vm["switch.relay_mode_enabled"].as<bool>();
+	configuration.switch_.mac_gossip_enabled = vm["switch.mac_gossip_enabled"].as<bool>();
 
 	// Router
 	const auto local_ip_routes = vm["router.local_ip_route"].as<std::vector<freelan::ip_route> >();
@@ -570,4 +691,9 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	configuration.router.maximum_routes_limit = vm["router.maximum_routes_limit"].as<unsigned int>();
 	configuration.router.dns_servers_acceptance_policy = vm["router.dns_servers_acceptance_policy"].as<fl::router_configuration::dns_servers_scope_type>();
 	configuration.router.dns_script = vm["router.dns_script"].as<fs::path>();
+
+	// Threads options
+	configuration.threads.worker_count = vm["threads.worker_count"].as<unsigned int>();
+	configuration.threads.certificate_verification_count = vm["threads.certificate_verification_count"].as<unsigned int>();
+	configuration.threads.worker_affinity = vm["threads.worker_affinity"].as<std::vector<unsigned int> >();
 }
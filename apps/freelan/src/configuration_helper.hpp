@@ -96,6 +96,12 @@ boost::program_options::options_description get_switch_options();
  */
 boost::program_options::options_description get_router_options();
 
+/**
+ * \brief Get the threads options.
+ * \return The threads options.
+ */
+boost::program_options::options_description get_threads_options();
+
 /**
  * \brief Set the paths options relative to the specified root.
  * \param vm The variables map.
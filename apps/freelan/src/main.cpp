@@ -45,15 +45,19 @@
  */
 
 #include <iostream>
+#include <iterator>
+#include <chrono>
 #include <cstdlib>
 #include <csignal>
 
 #include <boost/asio.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/function.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/thread/thread.hpp>
 
 #include <cryptoplus/cryptoplus.hpp>
@@ -61,12 +65,19 @@
 
 #include <freelan/freelan.hpp>
 
+#include <fscp/async_logger.hpp>
+#include <fscp/frame_recorder.hpp>
+
 #ifdef WINDOWS
 #include "windows/service.hpp"
 #else
 #include "posix/daemon.hpp"
 #include "posix/locked_pid_file.hpp"
 #include <unistd.h>
+#ifdef LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
 #endif
 
 #include "tools.hpp"
@@ -87,6 +98,24 @@ namespace fl = freelan;
 namespace
 {
 	boost::mutex log_mutex;
+
+	bool pin_current_thread(unsigned int cpu)
+	{
+#if defined(WINDOWS)
+		return (::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0);
+#elif defined(LINUX)
+		cpu_set_t cpu_set;
+
+		CPU_ZERO(&cpu_set);
+		CPU_SET(cpu, &cpu_set);
+
+		return (::pthread_setaffinity_np(::pthread_self(), sizeof(cpu_set), &cpu_set) == 0);
+#else
+		static_cast<void>(cpu);
+
+		return false;
+#endif
+	}
 }
 
 struct cli_configuration
@@ -96,17 +125,23 @@ struct cli_configuration
 		debug(false),
 #ifndef WINDOWS
 		thread_count(0),
+		configuration_file(),
+		configuration_digest(0),
 		foreground(false),
 		syslog(false),
 		pid_file()
 #else
-		thread_count(0)
+		thread_count(0),
+		configuration_file(),
+		configuration_digest(0)
 #endif
 	{}
 
 	fl::configuration fl_configuration;
 	bool debug;
 	unsigned int thread_count;
+	fs::path configuration_file;
+	size_t configuration_digest;
 #ifndef WINDOWS
 	bool foreground;
 	bool syslog;
@@ -130,6 +165,32 @@ std::vector<fs::path> get_configuration_files(fscp::logger& logger)
 	return configuration_files;
 }
 
+size_t configuration_file_digest(const fs::path& path)
+{
+	// A zero digest means "unknown": a caller must never skip a parse
+	// because two digests are both zero.
+	try
+	{
+		fs::basic_ifstream<char> ifs(path);
+
+		if (!ifs)
+		{
+			return 0;
+		}
+
+		const std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+		size_t digest = boost::hash_range(content.begin(), content.end());
+		boost::hash_combine(digest, static_cast<long long>(fs::last_write_time(path)));
+
+		return (digest != 0) ? digest : 1;
+	}
+	catch (const std::exception&)
+	{
+		return 0;
+	}
+}
+
 static bool DISABLE_COLOR = false;
 
 std::string log_level_to_string_extended(fscp::log_level level)
@@ -169,6 +230,39 @@ void signal_handler(const boost::system::error_code& error, int signal_number, f
 	}
 }
 
+void benchmark_configuration_parsing(const fscp::logger& logger, const boost::program_options::options_description& configuration_options, const fs::path& configuration_file)
+{
+	namespace po = boost::program_options;
+
+	if (configuration_file.empty())
+	{
+		logger(fscp::log_level::error) << "No configuration file to benchmark.";
+
+		return;
+	}
+
+	static const unsigned int iterations = 100;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (unsigned int i = 0; i < iterations; ++i)
+	{
+		fs::basic_ifstream<char> ifs(configuration_file);
+
+		po::variables_map vm;
+		po::store(po::parse_config_file(ifs, configuration_options, true), vm);
+		make_paths_absolute(vm, configuration_file.parent_path());
+		po::notify(vm);
+
+		fl::configuration fl_configuration;
+		setup_configuration(logger, fl_configuration, vm);
+	}
+
+	const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+	logger(fscp::log_level::important) << "Parsed " << configuration_file << " " << iterations << " times in " << (elapsed.count() / 1000.0) << " ms (" << (elapsed.count() / iterations) << " microseconds per parse).";
+}
+
 bool parse_options(fscp::logger& logger, int argc, char** argv, cli_configuration& configuration)
 {
 	namespace po = boost::program_options;
@@ -183,6 +277,7 @@ bool parse_options(fscp::logger& logger, int argc, char** argv, cli_configuratio
 	("debug,d", "Enables debug output.")
 	("threads,t", po::value<unsigned int>(&configuration.thread_count)->default_value(0), "The number of threads to use.")
 	("configuration_file,c", po::value<std::string>(), "The configuration file to use.")
+	("benchmark-configuration-parsing", "Measure the configuration parsing time, then exit.")
 	;
 
 	visible_options.add(generic_options);
@@ -196,6 +291,7 @@ bool parse_options(fscp::logger& logger, int argc, char** argv, cli_configuratio
 	configuration_options.add(get_tap_adapter_options());
 	configuration_options.add(get_switch_options());
 	configuration_options.add(get_router_options());
+	configuration_options.add(get_threads_options());
 	configuration_options.add(get_client_options());
 
 	configuration_visible_options.add(configuration_options);
@@ -425,6 +521,11 @@ bool parse_options(fscp::logger& logger, int argc, char** argv, cli_configuratio
 	make_paths_absolute(vm, configuration_file.parent_path());
 	po::notify(vm);
 
+	// The file and its digest let a reload detect an unchanged
+	// configuration and skip the whole parse.
+	configuration.configuration_file = configuration_file;
+	configuration.configuration_digest = configuration_file.empty() ? 0 : configuration_file_digest(configuration_file);
+
 	configuration.debug = vm.count("debug") > 0;
 
 	if (configuration.debug)
@@ -434,10 +535,17 @@ bool parse_options(fscp::logger& logger, int argc, char** argv, cli_configuratio
 
 	setup_configuration(logger, configuration.fl_configuration, vm);
 
+	if (vm.count("benchmark-configuration-parsing"))
+	{
+		benchmark_configuration_parsing(logger, configuration_options, configuration_file);
+
+		return false;
+	}
+
 	return true;
 }
 
-void run(fscp::logger& logger, const cli_configuration& configuration, int& exit_signal)
+void run(fscp::logger& logger, int argc, char** argv, const cli_configuration& configuration, int& exit_signal)
 {
 #ifndef WINDOWS
 	boost::shared_ptr<posix::locked_pid_file> pid_file;
@@ -468,10 +576,43 @@ void run(fscp::logger& logger, const cli_configuration& configuration, int& exit
 	}
 #endif
 
-	boost::asio::io_service io_service;
+	// The actual writing happens on the sink's own thread, so the worker
+	// threads never block on the console or on syslog.
+	fscp::async_logger async_log(log_func);
+
+	log_func = boost::bind(&fscp::async_logger::log, &async_log, _1, _2, _3);
+
+	unsigned int thread_count = configuration.thread_count;
+
+	if (thread_count == 0)
+	{
+		// The command line takes precedence over the configuration file.
+		thread_count = configuration.fl_configuration.threads.worker_count;
+	}
+
+	if (thread_count == 0)
+	{
+		thread_count = boost::thread::hardware_concurrency();
+
+		// Some implementation can return 0.
+		if (thread_count == 0)
+		{
+			// We create 2 threads.
+			thread_count = 2;
+		}
+	}
+
+	// The concurrency hint lets asio size its internal structures for the
+	// actual thread count instead of assuming a single-threaded run.
+	boost::asio::io_service io_service(thread_count);
 
 	boost::asio::signal_set signals(io_service, SIGINT, SIGTERM);
 
+#ifndef WINDOWS
+	signals.add(SIGHUP);
+	signals.add(SIGUSR1);
+#endif
+
 	fl::core core(io_service, configuration.fl_configuration);
 
 	core.set_log_level(logger.level());
@@ -479,12 +620,12 @@ void run(fscp::logger& logger, const cli_configuration& configuration, int& exit
 
 	if (!configuration.fl_configuration.tap_adapter.up_script.empty())
 	{
-		core.set_tap_adapter_up_callback(boost::bind(&execute_tap_adapter_up_script, configuration.fl_configuration.tap_adapter.up_script, logger, _1));
+		core.set_tap_adapter_up_callback(boost::bind(&execute_tap_adapter_up_script, configuration.fl_configuration.tap_adapter.up_script, boost::ref(io_service), logger, _1));
 	}
 
 	if (!configuration.fl_configuration.tap_adapter.down_script.empty())
 	{
-		core.set_tap_adapter_down_callback(boost::bind(&execute_tap_adapter_down_script, configuration.fl_configuration.tap_adapter.down_script, logger, _1));
+		core.set_tap_adapter_down_callback(boost::bind(&execute_tap_adapter_down_script, configuration.fl_configuration.tap_adapter.down_script, boost::ref(io_service), logger, _1));
 	}
 
 	if (!configuration.fl_configuration.security.certificate_validation_script.empty())
@@ -504,30 +645,115 @@ void run(fscp::logger& logger, const cli_configuration& configuration, int& exit
 
 	core.open();
 
-	signals.async_wait(boost::bind(signal_handler, _1, _2, boost::ref(core), boost::ref(exit_signal)));
+	// SIGHUP re-reads the configuration file and applies what can change at
+	// runtime, SIGUSR1 dumps the frame trace rings; any other signal stops
+	// the core.
+	typedef boost::function<void (const boost::system::error_code&, int)> signal_handler_type;
+	const auto handle_signal = boost::make_shared<signal_handler_type>();
+	const auto configuration_digest = boost::make_shared<size_t>(configuration.configuration_digest);
 
-	boost::thread_group threads;
+	*handle_signal = [&, handle_signal, configuration_digest] (const boost::system::error_code& error, int signal_number) {
+		if (error)
+		{
+			return;
+		}
 
-	unsigned int thread_count = configuration.thread_count;
+#ifndef WINDOWS
+		if (signal_number == SIGHUP)
+		{
+			// An unchanged file means an identical configuration: the
+			// whole parse - the grammar runs over every endpoint and
+			// route entry included - is skipped.
+			if ((*configuration_digest != 0) && (configuration_file_digest(configuration.configuration_file) == *configuration_digest))
+			{
+				logger(fscp::log_level::important) << "Signal caught (" << signal_number << "): the configuration file is unchanged. Keeping the current configuration.";
 
-	if (thread_count == 0)
-	{
-		thread_count = boost::thread::hardware_concurrency();
+				signals.async_wait(*handle_signal);
 
-		// Some implementation can return 0.
-		if (thread_count == 0)
+				return;
+			}
+
+			logger(fscp::log_level::important) << "Signal caught (" << signal_number << "): reloading the configuration...";
+
+			try
+			{
+				cli_configuration new_configuration;
+
+				if (parse_options(logger, argc, argv, new_configuration))
+				{
+					const fscp::log_level level = new_configuration.debug ? fscp::log_level::trace : fscp::log_level::information;
+
+					logger.set_level(level);
+					core.set_log_level(level);
+					core.reload_configuration(new_configuration.fl_configuration);
+
+					*configuration_digest = new_configuration.configuration_digest;
+				}
+			}
+			catch (std::exception& ex)
+			{
+				logger(fscp::log_level::error) << "Unable to reload the configuration: " << ex.what() << ". Keeping the current one.";
+			}
+
+			signals.async_wait(*handle_signal);
+
+			return;
+		}
+
+		if (signal_number == SIGUSR1)
 		{
-			// We create 2 threads.
-			thread_count = 2;
+			const boost::filesystem::path trace_path = boost::filesystem::temp_directory_path() / ("freelan-frame-trace." + std::to_string(::getpid()) + ".log");
+
+			try
+			{
+				boost::filesystem::ofstream trace_file(trace_path);
+
+				fscp::frame_recorder::dump(trace_file);
+
+				logger(fscp::log_level::important) << "Signal caught (" << signal_number << "): frame trace dumped to " << trace_path.string() << ".";
+			}
+			catch (std::exception& ex)
+			{
+				logger(fscp::log_level::error) << "Unable to dump the frame trace to " << trace_path.string() << ": " << ex.what();
+			}
+
+			signals.async_wait(*handle_signal);
+
+			return;
 		}
-	}
+#endif
+
+		signal_handler(error, signal_number, core, exit_signal);
+	};
+
+	signals.async_wait(*handle_signal);
+
+	boost::thread_group threads;
 
 	logger(fscp::log_level::information) << "Using " << thread_count << " thread(s).";
 	logger(fscp::log_level::important) << "Execution started.";
 
+	const std::vector<unsigned int>& worker_affinity = configuration.fl_configuration.threads.worker_affinity;
+
 	for (std::size_t i = 0; i < thread_count; ++i)
 	{
-		threads.create_thread([i, &io_service, &core, &logger, &signals](){
+		threads.create_thread([i, &io_service, &core, &logger, &signals, &worker_affinity](){
+			if (!worker_affinity.empty())
+			{
+				// Pinning the workers also keeps the recycled buffers
+				// NUMA-local, since the first touch decides their placement.
+				const unsigned int cpu = worker_affinity[i % worker_affinity.size()];
+
+				if (pin_current_thread(cpu))
+				{
+					logger(fscp::log_level::information) << "Thread #" << i << " pinned to CPU #" << cpu << ".";
+				}
+				else
+				{
+					logger(fscp::log_level::warning) << "Unable to pin thread #" << i << " to CPU #" << cpu << ".";
+				}
+			}
+
 			logger(fscp::log_level::debug) << "Thread #" << i << " started.";
 
 			try
@@ -574,7 +800,7 @@ int main(int argc, char** argv)
 
 		if (parse_options(logger, argc, argv, configuration))
 		{
-			run(logger, configuration, exit_signal);
+			run(logger, argc, argv, configuration, exit_signal);
 		}
 	}
 	catch (std::exception& ex)
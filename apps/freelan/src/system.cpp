@@ -210,3 +210,47 @@ int execute(const fscp::logger& logger, fs::path script, const std::vector<std::
 
 	return return_code;
 }
+
+#ifndef WINDOWS
+void async_execute(boost::asio::io_service& io_service, const fscp::logger& logger, fs::path script, const std::vector<std::string>& args, boost::function<void (int)> handler, const std::map<std::string, std::string>& env)
+{
+	std::vector<std::string> real_args = { script.string() };
+
+	real_args.insert(real_args.end(), args.begin(), args.end());
+	auto new_env = executeplus::get_current_environment();
+
+	for (auto&& pair : env)
+	{
+		new_env[pair.first] = pair.second;
+	}
+
+	logger(fscp::log_level::debug) << "Calling script " << script.string() << "...";
+
+	// A misbehaving script must not wedge the daemon: past this delay it is
+	// killed and reported as failed.
+	static const boost::posix_time::seconds SCRIPT_TIMEOUT(30);
+
+	executeplus::async_execute(io_service, real_args, new_env, SCRIPT_TIMEOUT, [logger, script, handler](const boost::system::error_code& ec, int return_code, const std::string& output) {
+		if (ec == boost::asio::error::timed_out)
+		{
+			logger(fscp::log_level::warning) << "Script " << script.string() << " took too long to complete and was killed.";
+		}
+		else if (ec)
+		{
+			logger(fscp::log_level::warning) << "Unable to execute script " << script.string() << ": " << ec.message();
+		}
+		else
+		{
+			const auto log_level = (return_code == 0) ? fscp::log_level::debug : fscp::log_level::warning;
+			logger(log_level) << "Script " << script.string() << " returned " << return_code << ".";
+
+			if (!output.empty())
+			{
+				logger(fscp::log_level::debug) << "Output follows:\n" << output;
+			}
+		}
+
+		handler(return_code);
+	});
+}
+#endif
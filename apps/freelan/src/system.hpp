@@ -51,7 +51,9 @@
 #include <string>
 #include <map>
 
+#include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/function.hpp>
 #include <freelan/os.hpp>
 
 #include <fscp/logger.hpp>
@@ -107,4 +109,17 @@ int execute(const fscp::logger& logger, boost::filesystem::path script, const st
 int execute(const fscp::logger& logger, boost::filesystem::path script, const std::vector<std::string>& args, const std::map<std::string, std::string>& env = std::map<std::string, std::string>());
 #endif
 
+#ifndef WINDOWS
+/**
+ * \brief Execute a script asynchronously.
+ * \param io_service The io_service on which the script output is streamed and the handler is invoked.
+ * \param logger The logger to use.
+ * \param script The script to execute.
+ * \param args The parameters.
+ * \param handler The handler to invoke with the exit status.
+ * \param env Variables to inject into the environment.
+ */
+void async_execute(boost::asio::io_service& io_service, const fscp::logger& logger, boost::filesystem::path script, const std::vector<std::string>& args, boost::function<void (int)> handler, const std::map<std::string, std::string>& env = std::map<std::string, std::string>());
+#endif
+
 #endif /* SYSTEM_HPP */
@@ -89,13 +89,14 @@ int log_level_to_syslog_priority(fscp::log_level level)
 	{
 		std::wstring to_wstring(const std::string& str)
 		{
-			iconvplus::iconv_instance iconv("utf-16", "");
-			iconvplus::converter<char, wchar_t> converter(iconv);
-			std::wostringstream out;
-			std::istringstream in(str);
-			converter.convert(in, out);
-			
-			return out.str();
+			// The conversion state persists so that converting one log line per call does not rebuild it every time.
+			static thread_local iconvplus::iconv_instance iconv("utf-16", "");
+			static thread_local iconvplus::converter<char, wchar_t> converter(iconv);
+
+			std::wstring out;
+			converter.convert(str, out);
+
+			return out;
 		}
 	}
 #endif
@@ -124,9 +125,12 @@ const char* log_level_to_string(fscp::log_level level)
 	throw std::logic_error("Unsupported enumeration value");
 }
 
-void execute_tap_adapter_up_script(const boost::filesystem::path& script, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter)
+void execute_tap_adapter_up_script(const boost::filesystem::path& script, boost::asio::io_service& io_service, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter)
 {
-#if defined(WINDOWS) && defined(UNICODE)
+#ifdef WINDOWS
+	static_cast<void>(io_service);
+
+#ifdef UNICODE
 	int exit_status = execute(logger, script, { to_wstring(tap_adapter.name()) });
 #else
 	int exit_status = execute(logger, script, { tap_adapter.name() });
@@ -136,11 +140,24 @@ void execute_tap_adapter_up_script(const boost::filesystem::path& script, const
 	{
 		logger(fscp::log_level::warning) << "Up script exited with a non-zero exit status: " << exit_status;
 	}
+#else
+	// The script runs asynchronously so bringing the tap adapter up never
+	// blocks on process spawning.
+	async_execute(io_service, logger, script, { tap_adapter.name() }, [logger](int exit_status) {
+		if (exit_status != 0)
+		{
+			logger(fscp::log_level::warning) << "Up script exited with a non-zero exit status: " << exit_status;
+		}
+	});
+#endif
 }
 
-void execute_tap_adapter_down_script(const boost::filesystem::path& script, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter)
+void execute_tap_adapter_down_script(const boost::filesystem::path& script, boost::asio::io_service& io_service, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter)
 {
-#if defined(WINDOWS) && defined(UNICODE)
+#ifdef WINDOWS
+	static_cast<void>(io_service);
+
+#ifdef UNICODE
 	int exit_status = execute(logger, script, { to_wstring(tap_adapter.name()) });
 #else
 	int exit_status = execute(logger, script, { tap_adapter.name() });
@@ -150,6 +167,14 @@ void execute_tap_adapter_down_script(const boost::filesystem::path& script, cons
 	{
 		logger(fscp::log_level::warning) << "Down script exited with a non-zero exit status: " << exit_status;
 	}
+#else
+	async_execute(io_service, logger, script, { tap_adapter.name() }, [logger](int exit_status) {
+		if (exit_status != 0)
+		{
+			logger(fscp::log_level::warning) << "Down script exited with a non-zero exit status: " << exit_status;
+		}
+	});
+#endif
 }
 
 bool execute_certificate_validation_script(const fs::path& script, const fscp::logger& logger, fl::security_configuration::cert_type cert)
@@ -76,18 +76,20 @@ const char* log_level_to_string(fscp::log_level level);
 /**
  * \brief The tap adapter up function.
  * \param script The script to call.
+ * \param io_service The io_service on which the script runs, on the platforms that support asynchronous execution.
  * \param logger The logger instance.
  * \param tap_adapter The tap_adapter instance.
  */
-void execute_tap_adapter_up_script(const boost::filesystem::path& script, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter);
+void execute_tap_adapter_up_script(const boost::filesystem::path& script, boost::asio::io_service& io_service, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter);
 
 /**
  * \brief The tap adapter down function.
  * \param script The script to call.
+ * \param io_service The io_service on which the script runs, on the platforms that support asynchronous execution.
  * \param logger The logger instance.
  * \param tap_adapter The tap_adapter instance.
  */
-void execute_tap_adapter_down_script(const boost::filesystem::path& script, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter);
+void execute_tap_adapter_down_script(const boost::filesystem::path& script, boost::asio::io_service& io_service, const fscp::logger& logger, const asiotap::tap_adapter& tap_adapter);
 
 /**
  * \brief The certificate validation function.
@@ -62,6 +62,8 @@
 
 #include <freelan/freelan.hpp>
 
+#include <asiotap/tap_adapter.hpp>
+
 #include "../tools.hpp"
 #include "../system.hpp"
 #include "../configuration_helper.hpp"
@@ -488,8 +490,16 @@ namespace windows
 			{
 				boost::asio::io_service io_service;
 
+				// The registry walk for tap adapters dominates the start
+				// time on some hosts: it runs while the configuration loads
+				// and its result is consumed when the core opens the
+				// adapter.
+				boost::thread enumeration_prefetch_thread(&asiotap::tap_adapter::prefetch_enumeration);
+
 				fl::configuration fl_configuration = get_freelan_configuration(logger, configuration);
 
+				enumeration_prefetch_thread.join();
+
 				fl::core core(io_service, fl_configuration);
 
 				core.set_log_level(logger.level());
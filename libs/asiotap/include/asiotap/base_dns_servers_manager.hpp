@@ -130,6 +130,32 @@ namespace asiotap
 			 */
 			typedef boost::shared_ptr<entry_type_impl> entry_type;
 
+			/**
+			 * \brief A scope during which DNS server changes are grouped and applied as a single batch, when the backend supports it.
+			 */
+			class batch_scope_type
+			{
+				public:
+
+					explicit batch_scope_type(base_dns_servers_manager& dns_servers_manager) :
+						m_dns_servers_manager(dns_servers_manager)
+					{
+						static_cast<DNSServersManagerType&>(m_dns_servers_manager).begin_batch();
+					}
+
+					~batch_scope_type()
+					{
+						static_cast<DNSServersManagerType&>(m_dns_servers_manager).end_batch();
+					}
+
+					batch_scope_type(const batch_scope_type&) = delete;
+					batch_scope_type& operator=(const batch_scope_type&) = delete;
+
+				private:
+
+					base_dns_servers_manager& m_dns_servers_manager;
+			};
+
 			/**
 			 * \brief The add handler type.
 			 */
@@ -290,10 +316,40 @@ namespace asiotap
 				return entry;
 			}
 
+			/**
+			 * \brief Start grouping DNS server changes. The default does nothing: backends without batching support apply every change immediately.
+			 */
+			void begin_batch()
+			{
+			}
+
+			/**
+			 * \brief Apply the grouped DNS server changes.
+			 */
+			void end_batch()
+			{
+			}
+
 		protected:
 
 			typedef std::map<dns_server_type, boost::weak_ptr<entry_type_impl>> entry_table_type;
 
+			void report_dns_server_registration_failure(const dns_server_type& dns_server, const boost::system::system_error& ex)
+			{
+				if (m_dns_server_registration_failure_handler)
+				{
+					m_dns_server_registration_failure_handler(dns_server, ex);
+				}
+			}
+
+			void report_dns_server_unregistration_failure(const dns_server_type& dns_server, const boost::system::system_error& ex)
+			{
+				if (m_dns_server_unregistration_failure_handler)
+				{
+					m_dns_server_unregistration_failure_handler(dns_server, ex);
+				}
+			}
+
 		private:
 
 			boost::asio::io_service& m_io_service;
@@ -46,7 +46,7 @@
 #define ASIOTAP_BASE_ROUTE_MANAGER_HPP
 
 #include <string>
-#include <map>
+#include <unordered_map>
 #include <iostream>
 
 #include <boost/asio.hpp>
@@ -95,6 +95,23 @@ namespace asiotap
 		}
 	};
 
+	/**
+	 * \brief A hash functor for routing table entries, keyed on their canonical (interface, route) representation.
+	 *
+	 * The metric is ignored, like in the comparison operators.
+	 */
+	struct routing_table_entry_hash
+	{
+		template <typename InterfaceType>
+		size_t operator()(const base_routing_table_entry<InterfaceType>& value) const
+		{
+			size_t seed = boost::hash<InterfaceType>()(value.interface);
+			boost::hash_combine(seed, hash_value(value.route));
+
+			return seed;
+		}
+	};
+
 	/**
 	 * \brief Handle system routes.
 	 */
@@ -114,6 +131,8 @@ namespace asiotap
 						{
 							m_route_manager.unregister_route(m_route);
 						}
+
+						m_route_manager.release_route_entry(m_route);
 					}
 
 					entry_type_impl(const entry_type_impl&) = delete;
@@ -148,6 +167,77 @@ namespace asiotap
 			 */
 			typedef boost::shared_ptr<entry_type_impl> entry_type;
 
+			/**
+			 * \brief A scope during which route changes are grouped and applied as a single batch, when the backend supports it.
+			 */
+			class batch_scope_type
+			{
+				public:
+
+					explicit batch_scope_type(base_route_manager& route_manager) :
+						m_route_manager(route_manager)
+					{
+						static_cast<RouteManagerType&>(m_route_manager).begin_batch();
+					}
+
+					~batch_scope_type()
+					{
+						static_cast<RouteManagerType&>(m_route_manager).end_batch();
+					}
+
+					batch_scope_type(const batch_scope_type&) = delete;
+					batch_scope_type& operator=(const batch_scope_type&) = delete;
+
+				private:
+
+					base_route_manager& m_route_manager;
+			};
+
+			/**
+			 * \brief A scope during which route changes are staged and applied all-or-nothing upon commit, when the backend supports it.
+			 *
+			 * If the scope is destroyed without a call to commit(), the staged changes are discarded.
+			 */
+			class transaction_scope_type
+			{
+				public:
+
+					explicit transaction_scope_type(base_route_manager& route_manager) :
+						m_route_manager(route_manager),
+						m_committed(false)
+					{
+						static_cast<RouteManagerType&>(m_route_manager).begin_transaction();
+					}
+
+					/**
+					 * \brief Apply the staged route changes.
+					 *
+					 * If some change cannot be applied, the changes that were applied already are reverted and an exception is thrown.
+					 */
+					void commit()
+					{
+						m_committed = true;
+
+						static_cast<RouteManagerType&>(m_route_manager).commit_transaction();
+					}
+
+					~transaction_scope_type()
+					{
+						if (!m_committed)
+						{
+							static_cast<RouteManagerType&>(m_route_manager).rollback_transaction();
+						}
+					}
+
+					transaction_scope_type(const transaction_scope_type&) = delete;
+					transaction_scope_type& operator=(const transaction_scope_type&) = delete;
+
+				private:
+
+					base_route_manager& m_route_manager;
+					bool m_committed;
+			};
+
 			/**
 			 * \brief The registration success handler type.
 			 */
@@ -266,12 +356,98 @@ namespace asiotap
 				return entry;
 			}
 
+			/**
+			 * \brief Start grouping route changes. The default does nothing: backends without batching support apply every change immediately.
+			 */
+			void begin_batch()
+			{
+			}
+
+			/**
+			 * \brief Apply the grouped route changes.
+			 */
+			void end_batch()
+			{
+			}
+
+			/**
+			 * \brief Start staging route changes into a transaction. The default does nothing: backends without transaction support apply every change immediately.
+			 */
+			void begin_transaction()
+			{
+			}
+
+			/**
+			 * \brief Apply the staged route changes all-or-nothing.
+			 */
+			void commit_transaction()
+			{
+			}
+
+			/**
+			 * \brief Discard the staged route changes without applying them.
+			 */
+			void rollback_transaction()
+			{
+			}
+
+			/**
+			 * \brief Remove the expired entries from the entry table.
+			 * \return The count of removed entries.
+			 */
+			size_t purge_expired_entries()
+			{
+				size_t count = 0;
+
+				for (auto it = m_entry_table.begin(); it != m_entry_table.end();)
+				{
+					if (it->second.expired())
+					{
+						it = m_entry_table.erase(it);
+						++count;
+					}
+					else
+					{
+						++it;
+					}
+				}
+
+				return count;
+			}
+
 		protected:
 
-			typedef std::map<route_type, boost::weak_ptr<entry_type_impl>> entry_table_type;
+			typedef std::unordered_map<route_type, boost::weak_ptr<entry_type_impl>, routing_table_entry_hash> entry_table_type;
+
+			void report_route_registration_failure(const route_type& route, const boost::system::system_error& ex)
+			{
+				if (m_route_registration_failure_handler)
+				{
+					m_route_registration_failure_handler(route, ex);
+				}
+			}
+
+			void report_route_unregistration_failure(const route_type& route, const boost::system::system_error& ex)
+			{
+				if (m_route_unregistration_failure_handler)
+				{
+					m_route_unregistration_failure_handler(route, ex);
+				}
+			}
 
 		private:
 
+			void release_route_entry(const route_type& route)
+			{
+				const auto it = m_entry_table.find(route);
+
+				// The slot may already hold a live replacement entry: only expired slots are released.
+				if ((it != m_entry_table.end()) && it->second.expired())
+				{
+					m_entry_table.erase(it);
+				}
+			}
+
 			boost::asio::io_service& m_io_service;
 			entry_table_type m_entry_table;
 			route_registration_success_handler_type m_route_registration_success_handler;
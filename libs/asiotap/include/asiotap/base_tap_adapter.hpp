@@ -49,6 +49,7 @@
 #include <boost/system/system_error.hpp>
 
 #include <iostream>
+#include <vector>
 
 #include "osi/ethernet_address.hpp"
 #include "tap_adapter_layer.hpp"
@@ -58,6 +59,38 @@
 
 namespace asiotap
 {
+	/**
+	 * \brief The kernel-side counters of a tap adapter interface.
+	 *
+	 * The counters are read from the operating system and cover what happens
+	 * below the descriptor: in particular rx_dropped counts the frames the
+	 * kernel discarded because the userspace read loop fell behind, which no
+	 * userspace counter can see.
+	 */
+	struct tap_adapter_statistics
+	{
+		tap_adapter_statistics() :
+			rx_packets{},
+			tx_packets{},
+			rx_bytes{},
+			tx_bytes{},
+			rx_errors{},
+			tx_errors{},
+			rx_dropped{},
+			tx_dropped{}
+		{
+		}
+
+		uint64_t rx_packets;
+		uint64_t tx_packets;
+		uint64_t rx_bytes;
+		uint64_t tx_bytes;
+		uint64_t rx_errors;
+		uint64_t tx_errors;
+		uint64_t rx_dropped;
+		uint64_t tx_dropped;
+	};
+
 	template <typename DescriptorType>
 	class base_tap_adapter
 	{
@@ -92,6 +125,54 @@ namespace asiotap
 				m_descriptor.async_read_some(buffers, handler);
 			}
 
+			/**
+			 * \brief Get the number of read queues exposed by the tap adapter.
+			 * \return The number of queues. The default implementation always exposes a single queue.
+			 */
+			size_t queue_count() const
+			{
+				return 1;
+			}
+
+			/**
+			 * \brief Read some data from the specified tap adapter queue.
+			 * \param queue The queue index. Must be strictly less than queue_count().
+			 * \param buffers The buffers into which the data will be read.
+			 * \param handler The handler to be called when the read operation completes.
+			 */
+			template <typename MutableBufferSequence, typename ReadHandler>
+			void async_read_queue(size_t queue, const MutableBufferSequence& buffers, ReadHandler handler)
+			{
+				static_cast<void>(queue);
+
+				m_descriptor.async_read_some(buffers, handler);
+			}
+
+			/**
+			 * \brief Read up to several frames from the specified tap adapter queue in a single completion.
+			 * \param queue The queue index. Must be strictly less than queue_count().
+			 * \param frame_buffers The per-frame buffers into which the frames will be read. At most one frame is read into each buffer.
+			 * \param handler The handler to be called when the read operation completes. It is called as handler(ec, frame_sizes) where frame_sizes contains the size of every frame that was read.
+			 *
+			 * The generic implementation reads a single frame per completion.
+			 * Platform implementations may drain several frames per completion
+			 * to amortize the handler dispatch cost.
+			 */
+			template <typename ReadFramesHandler>
+			void async_read_some_frames(size_t queue, const std::vector<boost::asio::mutable_buffer>& frame_buffers, ReadFramesHandler handler)
+			{
+				async_read_queue(queue, boost::asio::buffer(frame_buffers.front()), [handler] (const boost::system::error_code& ec, size_t count) {
+					std::vector<size_t> frame_sizes;
+
+					if (!ec)
+					{
+						frame_sizes.push_back(count);
+					}
+
+					handler(ec, frame_sizes);
+				});
+			}
+
 			/**
 			 * \brief Write some data to the tap adapter.
 			 * \param buffers One or more buffers to be written to the tap adapter.
@@ -103,6 +184,30 @@ namespace asiotap
 				m_descriptor.async_write_some(buffers, handler);
 			}
 
+			/**
+			 * \brief Write several frames to the tap adapter in a single completion.
+			 * \param frame_buffers The per-frame buffers to write. Each buffer holds exactly one frame.
+			 * \param handler The handler to be called when the write operation completes. It is called as handler(ec, frame_sizes) where frame_sizes contains the size of every frame that was written: on error, the frame at index frame_sizes.size() is the one that failed and the following ones were not attempted.
+			 *
+			 * The generic implementation writes a single frame per completion.
+			 * Platform implementations may deliver several frames per completion
+			 * to amortize the handler dispatch cost.
+			 */
+			template <typename WriteFramesHandler>
+			void async_write_frames(const std::vector<boost::asio::const_buffer>& frame_buffers, WriteFramesHandler handler)
+			{
+				async_write(boost::asio::buffer(frame_buffers.front()), [handler] (const boost::system::error_code& ec, size_t count) {
+					std::vector<size_t> frame_sizes;
+
+					if (!ec)
+					{
+						frame_sizes.push_back(count);
+					}
+
+					handler(ec, frame_sizes);
+				});
+			}
+
 			/**
 			 * \brief Read some data from the tap adapter.
 			 * \param buffers The buffers into which the data will be read.
@@ -211,6 +316,46 @@ namespace asiotap
 				return m_ethernet_address;
 			}
 
+			/**
+			 * \brief Set the busy-poll duration for reads.
+			 * \param busy_poll_usec The duration, in microseconds, during which reads may spin on the descriptor before falling back to the regular readiness wait. 0 disables busy-polling.
+			 *
+			 * Busy-polling trades CPU for wakeup latency and only makes sense
+			 * when the read loop runs on a dedicated core. The generic
+			 * implementation ignores the hint.
+			 */
+			void set_busy_poll_duration(unsigned int busy_poll_usec)
+			{
+				m_busy_poll_usec = busy_poll_usec;
+			}
+
+			/**
+			 * \brief Get the busy-poll duration for reads.
+			 * \return The duration, in microseconds. 0 when busy-polling is disabled.
+			 */
+			unsigned int busy_poll_duration() const
+			{
+				return m_busy_poll_usec;
+			}
+
+			/**
+			 * \brief Check whether the adapter offloads checksums.
+			 * \return true if the driver accepted checksum offload negotiation: frames written to the adapter may then leave their transport checksum unfinished.
+			 */
+			bool checksum_offload() const
+			{
+				return m_checksum_offload;
+			}
+
+			/**
+			 * \brief Get the kernel counters of the underlying interface.
+			 * \return The counters. The generic implementation has no access to kernel counters and returns zeroes.
+			 */
+			tap_adapter_statistics interface_statistics()
+			{
+				return tap_adapter_statistics();
+			}
+
 			/**
 			 * \brief Get the tap adapter current state.
 			 * \return true if the tap adapter is open.
@@ -244,7 +389,9 @@ namespace asiotap
 				m_layer(_layer),
 				m_name(),
 				m_mtu(),
-				m_ethernet_address()
+				m_ethernet_address(),
+				m_busy_poll_usec(0),
+				m_checksum_offload(false)
 			{}
 
 			descriptor_type& descriptor()
@@ -267,6 +414,11 @@ namespace asiotap
 				m_ethernet_address = _ethernet_address;
 			}
 
+			void set_checksum_offload(bool _checksum_offload)
+			{
+				m_checksum_offload = _checksum_offload;
+			}
+
 		private:
 
 			descriptor_type m_descriptor;
@@ -274,6 +426,8 @@ namespace asiotap
 			std::string m_name;
 			size_t m_mtu;
 			osi::ethernet_address m_ethernet_address;
+			unsigned int m_busy_poll_usec;
+			bool m_checksum_offload;
 
 			friend std::ostream& operator<<(std::ostream& os, const base_tap_adapter& value)
 			{
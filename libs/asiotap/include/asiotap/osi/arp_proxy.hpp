@@ -52,6 +52,7 @@
 #include "complex_filter.hpp"
 #include "ethernet_address.hpp"
 
+#include <boost/array.hpp>
 #include <boost/optional.hpp>
 
 #include <map>
@@ -132,8 +133,24 @@ namespace asiotap
 
 				typedef std::map<boost::asio::ip::address_v4, ethernet_address_type> entry_map_type;
 
+				/**
+				 * \brief A fully built reply frame for a given target logical address.
+				 *
+				 * Only the requester-specific fields are patched before the
+				 * frame is sent again, so repeated requests for the same
+				 * address skip the builder chain entirely.
+				 */
+				struct cached_response_type
+				{
+					ethernet_address_type hardware_address;
+					boost::array<uint8_t, sizeof(ethernet_frame) + sizeof(arp_frame)> frame;
+				};
+
+				typedef std::map<boost::asio::ip::address_v4, cached_response_type> response_cache_type;
+
 				entry_map_type m_entry_map;
 				arp_request_callback_type m_arp_request_callback;
+				mutable response_cache_type m_response_cache;
 		};
 
 		inline bool proxy<arp_frame>::add_entry(const entry_type& entry)
@@ -148,6 +165,8 @@ namespace asiotap
 
 		inline bool proxy<arp_frame>::remove_entry(const boost::asio::ip::address_v4& logical_address)
 		{
+			m_response_cache.erase(logical_address);
+
 			return (m_entry_map.erase(logical_address) > 0);
 		}
 
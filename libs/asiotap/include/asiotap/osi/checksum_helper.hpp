@@ -76,6 +76,19 @@ namespace asiotap
 				 */
 				uint32_t compute();
 
+				/**
+				 * \brief Incrementally update a checksum after a 16-bit word change, as per RFC 1624.
+				 * \param checksum The current checksum.
+				 * \param old_value The previous value of the changed word.
+				 * \param new_value The new value of the changed word.
+				 * \return The updated checksum.
+				 *
+				 * All the values must be in the same byte order. Updating a
+				 * checksum this way only costs a few additions, regardless of
+				 * the size of the checksummed data.
+				 */
+				static uint16_t recompute(uint16_t checksum, uint16_t old_value, uint16_t new_value);
+
 			private:
 
 				uint32_t m_checksum;
@@ -87,6 +100,19 @@ namespace asiotap
 			m_left(0)
 		{
 		}
+
+		inline uint16_t checksum_helper::recompute(uint16_t checksum, uint16_t old_value, uint16_t new_value)
+		{
+			// RFC 1624, equation 3: HC' = ~(~HC + ~m + m').
+			uint32_t sum = static_cast<uint32_t>(static_cast<uint16_t>(~checksum)) + static_cast<uint16_t>(~old_value) + new_value;
+
+			while (sum >> 16)
+			{
+				sum = (sum & 0xFFFF) + (sum >> 16);
+			}
+
+			return static_cast<uint16_t>(~sum);
+		}
 	}
 }
 
@@ -53,12 +53,13 @@
 #include "bootp_filter.hpp"
 #include "dhcp_filter.hpp"
 #include "complex_filter.hpp"
+#include "ethernet_address.hpp"
 
 #include <boost/array.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/optional.hpp>
 
-#include <map>
+#include <unordered_map>
 
 namespace asiotap
 {
@@ -80,7 +81,7 @@ namespace asiotap
 				/**
 				 * \brief The Ethernet address type.
 				 */
-				typedef boost::array<uint8_t, ETHERNET_ADDRESS_SIZE> ethernet_address_type;
+				typedef ethernet_address ethernet_address_type;
 
 				/**
 				 * \brief An IPv4 address netmask type.
@@ -100,10 +101,24 @@ namespace asiotap
 				 * \brief Create an DHCP proxy.
 				 */
 				proxy() :
-					m_lease_time(DEFAULT_LEASE_TIME)
+					m_lease_time(DEFAULT_LEASE_TIME),
+					m_lease_time_option(htonl(static_cast<uint32_t>(DEFAULT_LEASE_TIME.total_seconds()))),
+					m_checksum_offload(false)
 				{
 				}
 
+				/**
+				 * \brief Set whether the adapter offloads checksums.
+				 * \param checksum_offload true if frames written to the adapter may leave their transport checksum unfinished.
+				 *
+				 * When enabled, the UDP checksum of synthesized replies is
+				 * left empty instead of being computed in software.
+				 */
+				void set_checksum_offload(bool checksum_offload)
+				{
+					m_checksum_offload = checksum_offload;
+				}
+
 				/**
 				 * \brief Set the hardware address.
 				 * \param hardware_address The hardware address.
@@ -159,32 +174,56 @@ namespace asiotap
 
 			private:
 
-				typedef std::map<ethernet_address_type, ipv4_address_netmask_type> entry_map_type;
+				/**
+				 * \brief A lease, with its reply fields precomputed.
+				 *
+				 * The chaddr bytes and the subnet mask option value are
+				 * derived once when the entry is added, so answering a
+				 * request only copies them.
+				 */
+				struct lease_type
+				{
+					boost::asio::ip::address_v4 address;
+					ethernet_address_type::data_type hardware_address_data;
+					boost::asio::ip::address_v4::bytes_type subnet_mask;
+				};
+
+				struct ethernet_address_hash
+				{
+					size_t operator()(const ethernet_address_type& address) const
+					{
+						return address.hash();
+					}
+				};
+
+				typedef std::unordered_map<ethernet_address_type, lease_type, ethernet_address_hash> entry_map_type;
 
 				ethernet_address_type m_hardware_address;
+				ethernet_address_type::data_type m_hardware_address_data;
 				boost::asio::ip::address_v4 m_software_address;
+				boost::asio::ip::address_v4::bytes_type m_software_address_bytes;
 				boost::posix_time::time_duration m_lease_time;
+				uint32_t m_lease_time_option;
 				entry_map_type m_entry_map;
+				bool m_checksum_offload;
 		};
 
 		inline void proxy<dhcp_frame>::set_hardware_address(const ethernet_address_type& hardware_address)
 		{
 			m_hardware_address = hardware_address;
+			m_hardware_address_data = hardware_address.data();
 		}
 
 		inline void proxy<dhcp_frame>::set_software_address(const boost::asio::ip::address_v4& software_address)
 		{
 			m_software_address = software_address;
+			m_software_address_bytes = software_address.to_bytes();
 		}
 
 		inline void proxy<dhcp_frame>::set_lease_time(boost::posix_time::time_duration lease_time)
 		{
 			m_lease_time = lease_time;
-		}
-
-		inline bool proxy<dhcp_frame>::add_entry(const entry_type& entry)
-		{
-			return m_entry_map.insert(entry).second;
+			m_lease_time_option = htonl(static_cast<uint32_t>(lease_time.total_seconds()));
 		}
 
 		inline bool proxy<dhcp_frame>::add_entry(const ethernet_address_type& hardware_address, const boost::asio::ip::address_v4& logical_address, unsigned int logical_prefix_length)
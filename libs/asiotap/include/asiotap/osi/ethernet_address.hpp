@@ -57,6 +57,11 @@ namespace asiotap
 	{
 		/**
 		 * \brief An ethernet address class.
+		 *
+		 * The address is held as a single 48-bit value so that copies,
+		 * comparisons and hashing are plain integer operations: the class is
+		 * trivially copyable and fits in a register, which matters when
+		 * addresses are looked up for every switched frame.
 		 */
 		class ethernet_address
 		{
@@ -71,56 +76,94 @@ namespace asiotap
 				 * \brief Get a null address.
 				 * \return A null address.
 				 */
-				static ethernet_address null()
+				static constexpr ethernet_address null()
 				{
-					const data_type data = { { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } };
-
-					return ethernet_address(data);
+					return ethernet_address();
 				}
 
 				/**
 				 * \brief Get a broadcast address.
 				 * \return A broadcast address, that is: ff:ff:ff:ff:ff:ff.
 				 */
-				static ethernet_address broadcast()
+				static constexpr ethernet_address broadcast()
 				{
-					const data_type data = { { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } };
-
-					return ethernet_address(data);
+					return ethernet_address(UINT64_C(0xFFFFFFFFFFFF));
 				}
 
 				/**
-				 * \brief Creates a default initialized ethernet_address.
+				 * \brief Creates a null ethernet_address.
 				 */
-				ethernet_address() {}
+				constexpr ethernet_address() : m_value(0) {}
+
+				/**
+				 * \brief Create an address from its integer representation.
+				 * \param value The address, as returned by to_uint64().
+				 */
+				explicit constexpr ethernet_address(uint64_t value) : m_value(value & UINT64_C(0xFFFFFFFFFFFF)) {}
 
 				/**
 				 * \brief Create an address from its bytes.
 				 * \param _data The data.
 				 */
-				ethernet_address(const data_type& _data) : m_data(_data) {}
+				ethernet_address(const data_type& _data) :
+					m_value(
+						(static_cast<uint64_t>(_data[0]) << 40) |
+						(static_cast<uint64_t>(_data[1]) << 32) |
+						(static_cast<uint64_t>(_data[2]) << 24) |
+						(static_cast<uint64_t>(_data[3]) << 16) |
+						(static_cast<uint64_t>(_data[4]) << 8) |
+						static_cast<uint64_t>(_data[5])
+					)
+				{}
 
 				/**
 				 * \brief Get the associated data.
 				 * \return The associated data.
 				 */
-				const data_type& data() const
+				data_type data() const
+				{
+					const data_type result = { {
+						static_cast<uint8_t>(m_value >> 40),
+						static_cast<uint8_t>(m_value >> 32),
+						static_cast<uint8_t>(m_value >> 24),
+						static_cast<uint8_t>(m_value >> 16),
+						static_cast<uint8_t>(m_value >> 8),
+						static_cast<uint8_t>(m_value)
+					} };
+
+					return result;
+				}
+
+				/**
+				 * \brief Get the integer representation of the address.
+				 * \return The address, with its first byte in the most significant position so that integer ordering matches the byte-wise ordering.
+				 */
+				constexpr uint64_t to_uint64() const
 				{
-					return m_data;
+					return m_value;
 				}
 
 				/**
-				* \brief Get the associated data.
-				* \return The associated data.
-				*/
-				data_type& data()
+				 * \brief Get a hash of the address.
+				 * \return A well-mixed hash value, suitable for power-of-two sized hash tables.
+				 */
+				constexpr size_t hash() const
+				{
+					return static_cast<size_t>((m_value * UINT64_C(0x9E3779B97F4A7C15)) >> 16);
+				}
+
+				/**
+				 * \brief Check if the address is a multicast (or broadcast) address.
+				 * \return true if the least significant bit of the first byte is set.
+				 */
+				constexpr bool is_multicast() const
 				{
-					return m_data;
+					return ((m_value & UINT64_C(0x010000000000)) != 0);
 				}
 
 		private:
 
-				data_type m_data;
+				uint64_t m_value;
 		};
 
 		/**
@@ -129,9 +172,9 @@ namespace asiotap
 		 * \param rhs The right argument.
 		 * \return true if the two addresses are equal.
 		 */
-		inline bool operator==(const ethernet_address& lhs, const ethernet_address& rhs)
+		inline constexpr bool operator==(const ethernet_address& lhs, const ethernet_address& rhs)
 		{
-			return lhs.data() == rhs.data();
+			return lhs.to_uint64() == rhs.to_uint64();
 		}
 
 		/**
@@ -140,9 +183,9 @@ namespace asiotap
 		 * \param rhs The right argument.
 		 * \return true if the two addresses are different.
 		 */
-		inline bool operator!=(const ethernet_address& lhs, const ethernet_address& rhs)
+		inline constexpr bool operator!=(const ethernet_address& lhs, const ethernet_address& rhs)
 		{
-			return lhs.data() != rhs.data();
+			return lhs.to_uint64() != rhs.to_uint64();
 		}
 
 		/**
@@ -151,9 +194,9 @@ namespace asiotap
 		 * \param rhs The right argument.
 		 * \return true if lhs compare lexicographically smaller to rhs.
 		 */
-		inline bool operator<(const ethernet_address& lhs, const ethernet_address& rhs)
+		inline constexpr bool operator<(const ethernet_address& lhs, const ethernet_address& rhs)
 		{
-			return lhs.data() < rhs.data();
+			return lhs.to_uint64() < rhs.to_uint64();
 		}
 
 		/**
@@ -162,9 +205,9 @@ namespace asiotap
 		 * \param rhs The right argument.
 		 * \return true if lhs compare lexicographically larger to rhs.
 		 */
-		inline bool operator>(const ethernet_address& lhs, const ethernet_address& rhs)
+		inline constexpr bool operator>(const ethernet_address& lhs, const ethernet_address& rhs)
 		{
-			return lhs.data() > rhs.data();
+			return lhs.to_uint64() > rhs.to_uint64();
 		}
 
 		/**
@@ -173,9 +216,9 @@ namespace asiotap
 		 * \param rhs The right argument.
 		 * \return true if lhs compare lexicographically smaller or equal to rhs.
 		 */
-		inline bool operator<=(const ethernet_address& lhs, const ethernet_address& rhs)
+		inline constexpr bool operator<=(const ethernet_address& lhs, const ethernet_address& rhs)
 		{
-			return lhs.data() <= rhs.data();
+			return lhs.to_uint64() <= rhs.to_uint64();
 		}
 
 		/**
@@ -184,9 +227,9 @@ namespace asiotap
 		 * \param rhs The right argument.
 		 * \return true if lhs compare lexicographically larger or equal to rhs.
 		 */
-		inline bool operator>=(const ethernet_address& lhs, const ethernet_address& rhs)
+		inline constexpr bool operator>=(const ethernet_address& lhs, const ethernet_address& rhs)
 		{
-			return lhs.data() >= rhs.data();
+			return lhs.to_uint64() >= rhs.to_uint64();
 		}
 
 		/**
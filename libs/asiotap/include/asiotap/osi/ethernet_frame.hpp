@@ -70,6 +70,8 @@ namespace asiotap
 			uint16_t protocol; /**< The protocol. */
 		} PACKED;
 
+		static_assert(sizeof(ethernet_frame) == 14, "ethernet_frame must match the on-wire Ethernet header layout");
+
 #ifdef MSV
 #pragma pack(pop)
 #endif
@@ -50,7 +50,11 @@
 #include "icmpv6_filter.hpp"
 #include "ethernet_address.hpp"
 
+#include <boost/array.hpp>
 #include <boost/optional.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <map>
 
 namespace asiotap
 {
@@ -78,10 +82,24 @@ namespace asiotap
 				 * \brief Create an ARP proxy.
 				 */
 				proxy() :
-					m_neighbor_solicitation_callback()
+					m_neighbor_solicitation_callback(),
+					m_checksum_offload(false)
 				{
 				}
 
+				/**
+				 * \brief Set whether the adapter offloads checksums.
+				 * \param checksum_offload true if frames written to the adapter may leave their transport checksum unfinished.
+				 *
+				 * When enabled, the ICMPv6 checksum of synthesized neighbor
+				 * advertisements is left empty instead of being computed in
+				 * software.
+				 */
+				void set_checksum_offload(bool checksum_offload)
+				{
+					m_checksum_offload = checksum_offload;
+				}
+
 				/**
 				 * \brief Set the callback function when a neighbor sollicitation is received.
 				 * \param callback The callback function.
@@ -102,7 +120,36 @@ namespace asiotap
 
 			private:
 
+				/**
+				 * \brief A fully built neighbor advertisement for a given target address.
+				 *
+				 * Only the destination fields and the checksum are patched
+				 * before the frame is sent again, so repeated solicitations
+				 * for the same address skip the builder chain and the full
+				 * checksum pass.
+				 */
+				struct cached_response_type
+				{
+					ethernet_address_type hardware_address;
+					boost::array<uint8_t, sizeof(ipv6_frame) + sizeof(icmpv6_frame) + 8> frame;
+					boost::asio::ip::address_v6 last_requester;
+					boost::posix_time::ptime last_answer;
+				};
+
+				typedef std::map<boost::asio::ip::address_v6, cached_response_type> response_cache_type;
+
+				/**
+				 * \brief The duration during which a duplicate solicitation from the same requester is not answered again.
+				 *
+				 * The window is kept well below the one second retransmit
+				 * interval of RFC 4861, so only same-burst duplicates are
+				 * suppressed and genuine retransmissions still get answered.
+				 */
+				static const boost::posix_time::time_duration DUPLICATE_SOLICITATION_WINDOW;
+
 				neighbor_solicitation_callback_type m_neighbor_solicitation_callback;
+				bool m_checksum_offload;
+				mutable response_cache_type m_response_cache;
 		};
 	}
 }
@@ -82,6 +82,8 @@ namespace asiotap
 			struct in_addr destination; /**< IPv4 destination address */
 		} PACKED;
 
+		static_assert(sizeof(ipv4_frame) == 20, "ipv4_frame must match the on-wire IPv4 header layout");
+
 #ifdef MSV
 #pragma pack(pop)
 #endif
@@ -171,6 +171,15 @@ namespace asiotap
 				 * \param buf The buffer to refer to.
 				 */
 				_base_helper_impl(typename _base_helper_impl::buffer_type buf);
+
+				/**
+				 * \brief The cached header length, in bytes.
+				 *
+				 * Decoded from the IHL once, when the view is created, so
+				 * payload() and payload_length() do not redo the arithmetic
+				 * per call. Mutable setters keep it in sync with the frame.
+				 */
+				mutable size_t m_header_length;
 		};
 
 		/**
@@ -277,7 +286,7 @@ namespace asiotap
 		template <class HelperTag>
 		inline size_t _base_helper_impl<HelperTag, ipv4_frame>::header_length() const
 		{
-			return ihl() * sizeof(uint32_t);
+			return m_header_length;
 		}
 
 		template <class HelperTag>
@@ -354,7 +363,8 @@ namespace asiotap
 
 		template <class HelperTag>
 		inline _base_helper_impl<HelperTag, ipv4_frame>::_base_helper_impl(typename _base_helper_impl::buffer_type buf) :
-			_base_helper<HelperTag, ipv4_frame>(buf)
+			_base_helper<HelperTag, ipv4_frame>(buf),
+			m_header_length(ihl() * sizeof(uint32_t))
 		{
 		}
 
@@ -366,6 +376,7 @@ namespace asiotap
 		inline void _helper_impl<mutable_helper_tag, ipv4_frame>::set_ihl(uint8_t _ihl) const
 		{
 			this->frame().version_ihl = (this->frame().version_ihl & 0xF0) | (_ihl & 0x0F);
+			this->m_header_length = (_ihl & 0x0F) * sizeof(uint32_t);
 		}
 
 		inline void _helper_impl<mutable_helper_tag, ipv4_frame>::set_tos(uint8_t _tos) const
@@ -78,6 +78,8 @@ namespace asiotap
 			struct in6_addr destination; /**< Destination address */
 		} PACKED;
 
+		static_assert(sizeof(ipv6_frame) == 40, "ipv6_frame must match the on-wire IPv6 header layout");
+
 #ifdef MSV
 #pragma pack(pop)
 #endif
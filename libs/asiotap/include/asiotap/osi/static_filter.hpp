@@ -0,0 +1,292 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file static_filter.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief An OSI static filter class.
+ */
+
+#ifndef ASIOTAP_OSI_STATIC_FILTER_HPP
+#define ASIOTAP_OSI_STATIC_FILTER_HPP
+
+#include "filter.hpp"
+
+namespace asiotap
+{
+	namespace osi
+	{
+		/**
+		 * \brief A filter chain node, composed at compile time.
+		 */
+		template <typename A, typename B = void, typename C = void, typename D = void, typename E = void>
+		struct _static_filter_chain
+		{
+			typedef _static_filter_chain<B, C, D, E> child_chain_type;
+			typedef typename child_chain_type::leaf_frame_type leaf_frame_type;
+
+			template <typename ParentFrameType>
+			struct leaf_parent
+			{
+				typedef typename child_chain_type::template leaf_parent<A>::type type;
+			};
+
+			template <typename ParentHelperType, typename FilterType>
+			static void handle(ParentHelperType parent_helper, const_helper<A> helper, const FilterType& filter)
+			{
+				static_cast<void>(parent_helper);
+
+				if (frame_parent_match<B, A>(helper))
+				{
+					const_helper<B> child_helper(helper.payload());
+
+					if (check_frame(child_helper))
+					{
+						child_chain_type::handle(helper, child_helper, filter);
+					}
+				}
+			}
+
+			template <typename ParentHelperType, typename FilterType>
+			static void handle(ParentHelperType parent_helper, mutable_helper<A> helper, const FilterType& filter)
+			{
+				static_cast<void>(parent_helper);
+
+				if (frame_parent_match<B, A>(helper))
+				{
+					mutable_helper<B> child_helper(helper.payload());
+
+					if (check_frame(child_helper))
+					{
+						child_chain_type::handle(helper, child_helper, filter);
+					}
+				}
+			}
+		};
+
+		/**
+		 * \brief The leaf filter chain node.
+		 */
+		template <typename A>
+		struct _static_filter_chain<A, void, void, void, void>
+		{
+			typedef A leaf_frame_type;
+
+			template <typename ParentFrameType>
+			struct leaf_parent
+			{
+				typedef ParentFrameType type;
+			};
+
+			template <typename ParentHelperType, typename FilterType>
+			static void handle(ParentHelperType parent_helper, const_helper<A> helper, const FilterType& filter)
+			{
+				filter.frame_handled(parent_helper, helper);
+			}
+
+			template <typename ParentHelperType, typename FilterType>
+			static void handle(ParentHelperType parent_helper, mutable_helper<A> helper, const FilterType& filter)
+			{
+				filter.frame_handled(parent_helper, helper);
+			}
+		};
+
+		/**
+		 * \brief A filter chain whose parse and check sequence is composed at compile time.
+		 *
+		 * Unlike a stack of filter instances, which dispatches through
+		 * type-erased handler lists at every protocol layer, a static filter
+		 * inlines the whole frame_parent_match()/check_frame() walk and only
+		 * calls type-erased handlers for the leaf frame.
+		 *
+		 * The registered handlers receive the helper of the frame that
+		 * encapsulates the leaf frame along with the leaf frame helper.
+		 */
+		template <typename A, typename B = void, typename C = void, typename D = void, typename E = void>
+		class static_filter
+		{
+			public:
+
+				/**
+				 * \brief The chain type.
+				 */
+				typedef _static_filter_chain<A, B, C, D, E> chain_type;
+
+				/**
+				 * \brief The leaf frame type.
+				 */
+				typedef typename chain_type::leaf_frame_type frame_type;
+
+				/**
+				 * \brief The frame type that encapsulates the leaf frame.
+				 */
+				typedef typename chain_type::template leaf_parent<A>::type parent_frame_type;
+
+				/**
+				 * \brief The frame handler callback.
+				 */
+				typedef boost::function<void (mutable_helper<parent_frame_type>, mutable_helper<frame_type>)> frame_handler_callback;
+
+				/**
+				 * \brief The frame const handler callback.
+				 */
+				typedef boost::function<void (const_helper<parent_frame_type>, const_helper<frame_type>)> frame_const_handler_callback;
+
+				/**
+				 * \brief Add a handler function.
+				 * \param callback The handler function to add.
+				 */
+				void add_handler(frame_handler_callback callback) {
+					m_handlers.push_back(callback);
+				}
+
+				/**
+				 * \brief Add a const handler function.
+				 * \param callback The const handler function to add.
+				 */
+				void add_const_handler(frame_const_handler_callback callback) {
+					m_const_handlers.push_back(callback);
+				}
+
+				/**
+				 * \brief Get the last helper.
+				 * \return The last leaf frame helper, if any.
+				 */
+				boost::optional<mutable_helper<frame_type> > get_last_helper() const {
+					return m_last_helper;
+				}
+
+				/**
+				 * \brief Get the last const helper.
+				 * \return The last leaf frame const helper, if any.
+				 */
+				boost::optional<const_helper<frame_type> > get_last_const_helper() const {
+					return m_last_const_helper;
+				}
+
+				/**
+				 * \brief Clear the last helper.
+				 */
+				void clear_last_helper() const {
+					m_last_helper = boost::none;
+					m_last_const_helper = boost::none;
+				}
+
+				/**
+				 * \brief Parse the specified buffer.
+				 * \param buf The buffer to parse.
+				 */
+				void parse(boost::asio::const_buffer buf) const
+				{
+					clear_last_helper();
+
+					try
+					{
+						const_helper<A> helper(buf);
+
+						if (check_frame(helper))
+						{
+							chain_type::handle(helper, helper, *this);
+						}
+					}
+					catch (std::logic_error&)
+					{
+					}
+				}
+
+				/**
+				 * \brief Parse the specified buffer.
+				 * \param buf The buffer to parse.
+				 */
+				void parse(boost::asio::mutable_buffer buf) const
+				{
+					clear_last_helper();
+
+					try
+					{
+						mutable_helper<A> helper(buf);
+
+						if (check_frame(helper))
+						{
+							chain_type::handle(helper, helper, *this);
+						}
+					}
+					catch (std::logic_error&)
+					{
+					}
+				}
+
+				/**
+				 * \brief Handle the leaf frame by the handler functions.
+				 * \param parent_helper The helper of the frame that encapsulates the leaf frame.
+				 * \param helper The leaf frame helper.
+				 */
+				void frame_handled(const_helper<parent_frame_type> parent_helper, const_helper<frame_type> helper) const {
+					m_last_const_helper = helper;
+
+					for (auto&& handler : m_const_handlers)
+					{
+						handler(parent_helper, *m_last_const_helper);
+					}
+				}
+
+				/**
+				 * \brief Handle the leaf frame by the handler functions.
+				 * \param parent_helper The helper of the frame that encapsulates the leaf frame.
+				 * \param helper The leaf frame helper.
+				 */
+				void frame_handled(mutable_helper<parent_frame_type> parent_helper, mutable_helper<frame_type> helper) const {
+					m_last_helper = helper;
+
+					for (auto&& handler : m_handlers)
+					{
+						handler(parent_helper, *m_last_helper);
+					}
+				}
+
+			private:
+
+				std::vector<frame_handler_callback> m_handlers;
+				std::vector<frame_const_handler_callback> m_const_handlers;
+				mutable boost::optional<mutable_helper<frame_type> > m_last_helper;
+				mutable boost::optional<const_helper<frame_type> > m_last_const_helper;
+		};
+	}
+}
+
+#endif /* ASIOTAP_OSI_STATIC_FILTER_HPP */
@@ -89,6 +89,8 @@ namespace asiotap
 			uint16_t pointer; /**< The pointer */
 		} PACKED;
 
+		static_assert(sizeof(tcp_frame) == 20, "tcp_frame must match the on-wire TCP header layout");
+
 		/**
 		 * \brief A TCP-IPv4 pseudo-header structure.
 		 */
@@ -101,6 +103,8 @@ namespace asiotap
 			uint16_t tcp_length; /**< The TCP length */
 		} PACKED;
 
+		static_assert(sizeof(tcp_ipv4_pseudo_header) == 12, "tcp_ipv4_pseudo_header must match the checksum pseudo-header layout");
+
 		/**
 		 * \brief A TCP-IPv6 pseudo-header structure.
 		 */
@@ -114,6 +118,8 @@ namespace asiotap
 			uint8_t ipv6_next_header; /**< The IPv6 next header */
 		} PACKED;
 
+		static_assert(sizeof(tcp_ipv6_pseudo_header) == 40, "tcp_ipv6_pseudo_header must match the checksum pseudo-header layout");
+
 #ifdef MSV
 #pragma pack(pop)
 #endif
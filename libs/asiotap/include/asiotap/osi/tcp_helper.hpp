@@ -170,7 +170,7 @@ namespace asiotap
 				 * \return The offset.
 				 */
 				size_t offset() const {
-					return ((ntohs(this->frame().offset_flags) & 0xf000) >> 12) * 4;
+					return ((offset_flags() & 0xf000) >> 12) * 4;
 				}
 
 				/**
@@ -178,7 +178,7 @@ namespace asiotap
 				 * \return The flag's value.
 				 */
 				bool urgent_flag() const {
-					return ((this->frame().offset_flags & htons(0x0020)) != 0);
+					return ((offset_flags() & 0x0020) != 0);
 				}
 
 				/**
@@ -186,7 +186,7 @@ namespace asiotap
 				 * \return The flag's value.
 				 */
 				bool ack_flag() const {
-					return ((this->frame().offset_flags & htons(0x0010)) != 0);
+					return ((offset_flags() & 0x0010) != 0);
 				}
 
 				/**
@@ -194,7 +194,7 @@ namespace asiotap
 				 * \return The flag's value.
 				 */
 				bool psh_flag() const {
-					return ((this->frame().offset_flags & htons(0x0008)) != 0);
+					return ((offset_flags() & 0x0008) != 0);
 				}
 
 				/**
@@ -202,7 +202,7 @@ namespace asiotap
 				 * \return The flag's value.
 				 */
 				bool rst_flag() const {
-					return ((this->frame().offset_flags & htons(0x0004)) != 0);
+					return ((offset_flags() & 0x0004) != 0);
 				}
 
 				/**
@@ -210,7 +210,7 @@ namespace asiotap
 				 * \return The flag's value.
 				 */
 				bool syn_flag() const {
-					return ((this->frame().offset_flags & htons(0x0002)) != 0);
+					return ((offset_flags() & 0x0002) != 0);
 				}
 
 				/**
@@ -218,7 +218,7 @@ namespace asiotap
 				 * \return The flag's value.
 				 */
 				bool fin_flag() const {
-					return ((this->frame().offset_flags & htons(0x0001)) != 0);
+					return ((offset_flags() & 0x0001) != 0);
 				}
 
 				/**
@@ -311,8 +311,29 @@ namespace asiotap
 				 * \param buf The buffer to refer to.
 				 */
 				_base_helper_impl(typename _base_helper_impl::buffer_type buf) :
-					_base_helper<HelperTag, tcp_frame>(buf)
+					_base_helper<HelperTag, tcp_frame>(buf),
+					m_offset_flags(ntohs(this->frame().offset_flags))
 				{}
+
+				/**
+				 * \brief Get the offset-flags word, in host order.
+				 * \return The offset-flags word.
+				 *
+				 * The word is byte-swapped once, when the view is created:
+				 * the offset and flag accessors all read the cached value,
+				 * so walking the options of a frame does not redo the swap
+				 * per call.
+				 */
+				uint16_t offset_flags() const {
+					return m_offset_flags;
+				}
+
+				/**
+				 * \brief The cached offset-flags word, in host order.
+				 *
+				 * Mutable setters keep it in sync with the frame.
+				 */
+				mutable uint16_t m_offset_flags;
 		};
 
 		/**
@@ -360,7 +381,7 @@ namespace asiotap
 				 * \param _offset The offset. Must be a multiple of 4, or the result is undefined.
 				 */
 				void set_offset(size_t _offset) const {
-					this->frame().offset_flags = (this->frame().offset_flags & htons(0x0fff)) | htons(static_cast<uint16_t>(_offset / 4) << 12);
+					set_offset_flags((this->offset_flags() & 0x0fff) | (static_cast<uint16_t>(_offset / 4) << 12));
 				}
 
 				/**
@@ -369,10 +390,10 @@ namespace asiotap
 				 */
 				void set_urgent_flag(bool value) const {
 					if (value) {
-						this->frame().offset_flags |= htons(0x0020);
+						set_offset_flags(this->offset_flags() | 0x0020);
 					}
 					else {
-						this->frame().offset_flags &= htons(0xffdf);
+						set_offset_flags(this->offset_flags() & 0xffdf);
 					}
 				}
 
@@ -382,10 +403,10 @@ namespace asiotap
 				 */
 				void set_ack_flag(bool value) const {
 					if (value) {
-						this->frame().offset_flags |= htons(0x0010);
+						set_offset_flags(this->offset_flags() | 0x0010);
 					}
 					else {
-						this->frame().offset_flags &= htons(0xffef);
+						set_offset_flags(this->offset_flags() & 0xffef);
 					}
 				}
 
@@ -395,10 +416,10 @@ namespace asiotap
 				 */
 				void set_psh_flag(bool value) const {
 					if (value) {
-						this->frame().offset_flags |= htons(0x0008);
+						set_offset_flags(this->offset_flags() | 0x0008);
 					}
 					else {
-						this->frame().offset_flags &= htons(0xfff7);
+						set_offset_flags(this->offset_flags() & 0xfff7);
 					}
 				}
 
@@ -408,10 +429,10 @@ namespace asiotap
 				 */
 				void set_rst_flag(bool value) const {
 					if (value) {
-						this->frame().offset_flags |= htons(0x0004);
+						set_offset_flags(this->offset_flags() | 0x0004);
 					}
 					else {
-						this->frame().offset_flags &= htons(0xfffb);
+						set_offset_flags(this->offset_flags() & 0xfffb);
 					}
 				}
 
@@ -421,10 +442,10 @@ namespace asiotap
 				 */
 				void set_syn_flag(bool value) const {
 					if (value) {
-						this->frame().offset_flags |= htons(0x0002);
+						set_offset_flags(this->offset_flags() | 0x0002);
 					}
 					else {
-						this->frame().offset_flags &= htons(0xfffd);
+						set_offset_flags(this->offset_flags() & 0xfffd);
 					}
 				}
 
@@ -434,10 +455,10 @@ namespace asiotap
 				 */
 				void set_fin_flag(bool value) const {
 					if (value) {
-						this->frame().offset_flags |= htons(0x0001);
+						set_offset_flags(this->offset_flags() | 0x0001);
 					}
 					else {
-						this->frame().offset_flags &= htons(0xfffe);
+						set_offset_flags(this->offset_flags() & 0xfffe);
 					}
 				}
 
@@ -474,6 +495,17 @@ namespace asiotap
 				_helper_impl(_helper_impl::buffer_type buf) :
 					_base_helper_impl<mutable_helper_tag, tcp_frame>(buf)
 				{}
+
+			private:
+
+				/**
+				 * \brief Overwrite the offset-flags word and its cached copy.
+				 * \param value The new value, in host order.
+				 */
+				void set_offset_flags(uint16_t value) const {
+					this->frame().offset_flags = htons(value);
+					this->m_offset_flags = value;
+				}
 		};
 	}
 }
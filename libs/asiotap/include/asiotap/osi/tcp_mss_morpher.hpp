@@ -48,8 +48,11 @@
 #include "ipv4_helper.hpp"
 #include "ipv6_helper.hpp"
 
+#include <boost/array.hpp>
 #include <boost/optional.hpp>
 
+#include <stdint.h>
+
 namespace asiotap
 {
 	namespace osi
@@ -61,12 +64,18 @@ namespace asiotap
 		{
 			public:
 
+				/**
+				 * \brief The size of the established-flow bypass cache.
+				 */
+				static const size_t FLOW_CACHE_SIZE = 256;
+
 				/**
 				 * \brief Create a TCP MSS morpher.
 				 * \brief The max MSS value.
 				 */
 				tcp_mss_morpher(size_t max_mss) :
-					m_max_mss(max_mss)
+					m_max_mss(max_mss),
+					m_established_flows()
 				{
 				}
 
@@ -85,7 +94,19 @@ namespace asiotap
 				void handle(const_helper<ipv6_frame> ipv6_helper, mutable_helper<tcp_frame> tcp_helper);
 
 			private:
+
+				bool should_skip(uint32_t flow, bool syn);
+
 				size_t m_max_mss;
+
+				// A direct-mapped cache of the flows known to be past their
+				// SYN exchange, keyed by a 5-tuple hash. Only SYN segments
+				// can carry an MSS option, so the data segments of an
+				// established flow bypass the morpher on a single array
+				// lookup. A collision merely evicts the note for another
+				// flow, which then costs one flag check again: correctness
+				// never depends on the cache.
+				boost::array<uint32_t, FLOW_CACHE_SIZE> m_established_flows;
 		};
 	}
 }
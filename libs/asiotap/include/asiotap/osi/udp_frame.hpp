@@ -71,6 +71,8 @@ namespace asiotap
 			uint16_t checksum; /**< The checksum */
 		} PACKED;
 
+		static_assert(sizeof(udp_frame) == 8, "udp_frame must match the on-wire UDP header layout");
+
 		/**
 		 * \brief An UDP-IPv4 pseudo-header structure.
 		 */
@@ -83,6 +85,8 @@ namespace asiotap
 			uint16_t udp_length; /**< The UDP length */
 		} PACKED;
 
+		static_assert(sizeof(udp_ipv4_pseudo_header) == 12, "udp_ipv4_pseudo_header must match the checksum pseudo-header layout");
+
 		/**
 		 * \brief An UDP-IPv6 pseudo-header structure.
 		 */
@@ -96,6 +100,8 @@ namespace asiotap
 			uint8_t ipv6_next_header; /**< The IPv6 next header */
 		} PACKED;
 
+		static_assert(sizeof(udp_ipv6_pseudo_header) == 38, "udp_ipv6_pseudo_header must match the checksum pseudo-header layout");
+
 #ifdef MSV
 #pragma pack(pop)
 #endif
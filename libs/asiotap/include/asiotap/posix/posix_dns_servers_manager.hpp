@@ -48,6 +48,8 @@
 #include "../base_dns_servers_manager.hpp"
 #include "../types/ip_network_address.hpp"
 
+#include <map>
+#include <set>
 #include <string>
 
 namespace asiotap
@@ -57,15 +59,44 @@ namespace asiotap
 		public:
 
 			explicit posix_dns_servers_manager(boost::asio::io_service& io_service_) :
+#ifndef LINUX
 				base_dns_servers_manager<posix_dns_servers_manager>(io_service_)
+#else
+				base_dns_servers_manager<posix_dns_servers_manager>(io_service_),
+				m_batching(false)
+#endif
 			{
 			}
 
+#ifdef LINUX
+			/**
+			 * \brief Start grouping DNS server changes into per-interface resolvconf records.
+			 */
+			void begin_batch();
+
+			/**
+			 * \brief Apply the grouped DNS server changes, one resolvconf invocation per modified interface.
+			 *
+			 * Failures are reported through the registration/unregistration failure handlers.
+			 */
+			void end_batch();
+#endif
+
 		protected:
 
 			void register_dns_server(const dns_server_type& dns_server);
 			void unregister_dns_server(const dns_server_type& dns_server);
 
 		friend class base_dns_servers_manager<posix_dns_servers_manager>;
+
+#ifdef LINUX
+		private:
+
+			void apply_dns_servers(const std::string& interface_name);
+
+			std::map<std::string, ip_address_set> m_dns_servers;
+			bool m_batching;
+			std::set<std::string> m_dirty_interfaces;
+#endif
 	};
 }
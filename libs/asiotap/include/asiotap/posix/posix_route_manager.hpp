@@ -49,6 +49,7 @@
 #include "../types/ip_network_address.hpp"
 
 #include <string>
+#include <vector>
 
 #ifdef LINUX
 #include <netlinkplus/manager.hpp>
@@ -67,7 +68,8 @@ namespace asiotap
 				base_route_manager<posix_route_manager, posix_routing_table_entry>(io_service_)
 #else
 				base_route_manager<posix_route_manager, posix_routing_table_entry>(io_service_),
-				m_netlink_manager(io_service_)
+				m_netlink_manager(io_service_),
+				m_batching(false)
 #endif
 			{
 			}
@@ -84,6 +86,37 @@ namespace asiotap
 			void set_route(route_action action, const std::string& interface, const ip_network_address& dest);
 			void set_route(route_action action, const std::string& interface, const ip_network_address& dest, const boost::asio::ip::address& gateway);
 
+#ifdef LINUX
+			/**
+			 * \brief Start grouping route changes into a single netlink batch.
+			 */
+			void begin_batch();
+
+			/**
+			 * \brief Apply the grouped route changes in a single netlink batch.
+			 *
+			 * Failures are reported through the registration/unregistration failure handlers.
+			 */
+			void end_batch();
+
+			/**
+			 * \brief Start staging route changes into a transaction.
+			 */
+			void begin_transaction();
+
+			/**
+			 * \brief Apply the staged route changes in a single netlink batch, reverting the ones that succeeded if any of them fails.
+			 *
+			 * Unlike end_batch(), this blocks until the kernel acknowledged every change. Failures are reported through the registration/unregistration failure handlers and the first error is rethrown.
+			 */
+			void commit_transaction();
+
+			/**
+			 * \brief Discard the staged route changes without applying them.
+			 */
+			void rollback_transaction();
+#endif
+
 		protected:
 
 			void register_route(const route_type& route);
@@ -93,7 +126,13 @@ namespace asiotap
 
 #ifdef LINUX
 		private:
+
+			void queue_batch_operation(route_action action, const std::string& interface, const ip_network_address& dest, const boost::optional<boost::asio::ip::address>& gateway);
+
 			netlinkplus::manager m_netlink_manager;
+			bool m_batching;
+			std::vector<netlinkplus::route_operation> m_batch_operations;
+			std::vector<route_type> m_batch_routes;
 #endif
 	};
 }
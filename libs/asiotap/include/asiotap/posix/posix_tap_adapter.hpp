@@ -52,6 +52,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 namespace asiotap
 {
@@ -73,7 +74,8 @@ namespace asiotap
 			 */
 			posix_tap_adapter(boost::asio::io_service& _io_service, tap_adapter_layer _layer) :
 				base_tap_adapter(_io_service, _layer),
-				m_route_manager(_io_service)
+				m_route_manager(_io_service),
+				m_desired_queue_count(1)
 			{}
 
 			/**
@@ -106,6 +108,228 @@ namespace asiotap
 				return m_route_manager;
 			}
 
+			/**
+			 * \brief Get the kernel counters of the underlying interface.
+			 * \return The counters. On Linux they are read over netlink; on the other systems only zeroes are returned.
+			 */
+			tap_adapter_statistics interface_statistics();
+
+			/**
+			 * \brief Set the desired number of read queues.
+			 * \param _queue_count The desired queue count. Must be non-zero.
+			 *
+			 * The hint is taken into account at open() time. On Linux, when the
+			 * driver supports IFF_MULTI_QUEUE, up to _queue_count queue
+			 * descriptors are opened on the same device. On other systems the
+			 * adapter always exposes a single queue.
+			 */
+			void set_desired_queue_count(size_t _queue_count)
+			{
+				m_desired_queue_count = (_queue_count > 0) ? _queue_count : 1;
+			}
+
+			/**
+			 * \brief Get the number of read queues exposed by the tap adapter.
+			 * \return The number of queues.
+			 */
+			size_t queue_count() const
+			{
+				return 1 + m_queues.size();
+			}
+
+			/**
+			 * \brief Read some data from the specified tap adapter queue.
+			 * \param queue The queue index. Must be strictly less than queue_count().
+			 * \param buffers The buffers into which the data will be read.
+			 * \param handler The handler to be called when the read operation completes.
+			 */
+			template <typename MutableBufferSequence, typename ReadHandler>
+			void async_read_queue(size_t queue, const MutableBufferSequence& buffers, ReadHandler handler)
+			{
+				if (queue == 0)
+				{
+					async_read(buffers, handler);
+				}
+				else
+				{
+					m_queues[queue - 1].async_read_some(buffers, handler);
+				}
+			}
+
+			/**
+			 * \brief Read up to several frames from the specified tap adapter queue in a single completion.
+			 * \param queue The queue index. Must be strictly less than queue_count().
+			 * \param frame_buffers The per-frame buffers into which the frames will be read. At most one frame is read into each buffer.
+			 * \param handler The handler to be called when the read operation completes. It is called as handler(ec, frame_sizes) where frame_sizes contains the size of every frame that was read.
+			 *
+			 * The descriptor is drained with non-blocking reads once it becomes
+			 * readable, so several frames can be handled per completion at the
+			 * cost of a single handler dispatch.
+			 */
+			template <typename ReadFramesHandler>
+			void async_read_some_frames(size_t queue, const std::vector<boost::asio::mutable_buffer>& frame_buffers, ReadFramesHandler handler)
+			{
+				descriptor_type& queue_descriptor = (queue == 0) ? descriptor() : m_queues[queue - 1];
+
+				if (busy_poll_duration() > 0)
+				{
+					// Busy-poll mode: spin on non-blocking reads before
+					// falling back to the readiness wait, so a frame that
+					// arrives while spinning skips the wake-from-epoll
+					// latency.
+					const boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::microseconds(busy_poll_duration());
+
+					do
+					{
+						std::vector<size_t> frame_sizes;
+						boost::system::error_code read_ec;
+
+						for (auto&& frame_buffer : frame_buffers)
+						{
+							const size_t count = queue_descriptor.read_some(boost::asio::buffer(frame_buffer), read_ec);
+
+							if (read_ec)
+							{
+								break;
+							}
+
+							frame_sizes.push_back(count);
+						}
+
+						if (!frame_sizes.empty() || ((read_ec != boost::asio::error::would_block) && (read_ec != boost::asio::error::try_again)))
+						{
+							if (!frame_sizes.empty())
+							{
+								read_ec = boost::system::error_code();
+							}
+
+							// The handler is posted, never called inline, to preserve the asynchronous semantics.
+							get_io_service().post([handler, read_ec, frame_sizes] () {
+								handler(read_ec, frame_sizes);
+							});
+
+							return;
+						}
+					}
+					while (boost::posix_time::microsec_clock::universal_time() < deadline);
+				}
+
+				queue_descriptor.async_read_some(
+					boost::asio::null_buffers(),
+					[&queue_descriptor, frame_buffers, handler] (const boost::system::error_code& ec, size_t) {
+						std::vector<size_t> frame_sizes;
+
+						if (ec)
+						{
+							handler(ec, frame_sizes);
+
+							return;
+						}
+
+						boost::system::error_code read_ec;
+
+						for (auto&& frame_buffer : frame_buffers)
+						{
+							const size_t count = queue_descriptor.read_some(boost::asio::buffer(frame_buffer), read_ec);
+
+							if (read_ec)
+							{
+								break;
+							}
+
+							frame_sizes.push_back(count);
+						}
+
+						if ((read_ec == boost::asio::error::would_block) || (read_ec == boost::asio::error::try_again) || !frame_sizes.empty())
+						{
+							// Either the descriptor was drained or we got at
+							// least one frame: this is a success.
+							read_ec = boost::system::error_code();
+						}
+
+						handler(read_ec, frame_sizes);
+					}
+				);
+			}
+
+			/**
+			 * \brief Write several frames to the tap adapter in a single completion.
+			 * \param frame_buffers The per-frame buffers to write. Each buffer holds exactly one frame.
+			 * \param handler The handler to be called when the write operation completes. It is called as handler(ec, frame_sizes) where frame_sizes contains the size of every frame that was written: on error, the frame at index frame_sizes.size() is the one that failed and the following ones were not attempted.
+			 *
+			 * The frames are pushed with non-blocking writes while the device
+			 * accepts them, so a burst of frames is delivered at the cost of
+			 * a single handler dispatch. The character device delimits one
+			 * frame per write, so each frame still is its own system call,
+			 * but the reactor round-trip between frames is gone.
+			 */
+			template <typename WriteFramesHandler>
+			void async_write_frames(const std::vector<boost::asio::const_buffer>& frame_buffers, WriteFramesHandler handler)
+			{
+				std::vector<size_t> frame_sizes;
+				boost::system::error_code write_ec;
+
+				for (auto&& frame_buffer : frame_buffers)
+				{
+					const size_t count = descriptor().write_some(boost::asio::buffer(frame_buffer), write_ec);
+
+					if (write_ec)
+					{
+						break;
+					}
+
+					frame_sizes.push_back(count);
+				}
+
+				if (!frame_sizes.empty() || ((write_ec != boost::asio::error::would_block) && (write_ec != boost::asio::error::try_again)))
+				{
+					if (!frame_sizes.empty())
+					{
+						// At least one frame went through: this is a success,
+						// the caller resubmits the frames we did not attempt.
+						write_ec = boost::system::error_code();
+					}
+
+					// The handler is posted, never called inline, to preserve the asynchronous semantics.
+					get_io_service().post([handler, write_ec, frame_sizes] () {
+						handler(write_ec, frame_sizes);
+					});
+
+					return;
+				}
+
+				// The device cannot take a frame right now: wait for
+				// writability and try again.
+				descriptor().async_write_some(
+					boost::asio::null_buffers(),
+					[this, frame_buffers, handler] (const boost::system::error_code& ec, size_t) {
+						if (ec)
+						{
+							handler(ec, std::vector<size_t>());
+
+							return;
+						}
+
+						async_write_frames(frame_buffers, handler);
+					}
+				);
+			}
+
+			/**
+			 * \brief Cancel all pending asynchronous operations associated with the tap adapter.
+			 */
+			void cancel()
+			{
+				for (auto&& queue : m_queues)
+				{
+					boost::system::error_code ec;
+
+					queue.cancel(ec);
+				}
+
+				base_tap_adapter::cancel();
+			}
+
 			/**
 			 * \brief Open the first available tap adapter.
 			 * \param ec The error code.
@@ -136,6 +360,8 @@ namespace asiotap
 
 				// We do nothing with the error code as errors can happen legitimately.
 
+				close_queues();
+
 				base_tap_adapter::close();
 			}
 
@@ -147,6 +373,8 @@ namespace asiotap
 			{
 				destroy_device(ec);
 
+				close_queues();
+
 				base_tap_adapter::close(ec);
 
 				return ec;
@@ -202,8 +430,32 @@ namespace asiotap
 			void destroy_device();
 			void destroy_device(boost::system::error_code& ec);
 
+			void close_queues()
+			{
+				for (auto&& queue : m_queues)
+				{
+					boost::system::error_code ec;
+
+					queue.close(ec);
+
+					// We do nothing with the error code as errors can happen legitimately.
+				}
+
+				m_queues.clear();
+			}
+
 			posix_route_manager m_route_manager;
 
+			/**
+			 * \brief The desired queue count, as set before open().
+			 */
+			size_t m_desired_queue_count;
+
+			/**
+			 * \brief The additional queue descriptors, when multi-queue is in use.
+			 */
+			std::vector<boost::asio::posix::stream_descriptor> m_queues;
+
 			/**
 			 * \brief If we use an existing tun/tap adapter.
 			 */
@@ -0,0 +1,313 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file posix_xdp_tap_adapter.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief An AF_XDP kernel-bypass adapter class.
+ */
+
+#ifndef ASIOTAP_POSIX_XDP_TAP_ADAPTER_HPP
+#define ASIOTAP_POSIX_XDP_TAP_ADAPTER_HPP
+
+#include "../os.hpp"
+
+#if defined(LINUX) && defined(USE_XDP)
+
+#include "../base_tap_adapter.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace asiotap
+{
+	/**
+	 * \brief An experimental AF_XDP kernel-bypass adapter.
+	 *
+	 * Unlike the regular tap adapter, this adapter attaches to an existing
+	 * network interface queue and exchanges raw ethernet frames with it
+	 * through memory-mapped UMEM rings, bypassing the kernel network stack.
+	 * It exposes the same interface as the other tap adapters: the
+	 * readiness of the AF_XDP socket is waited for through the reactor and
+	 * the rings are drained and filled in userspace.
+	 *
+	 * The adapter is ethernet-only and does not own the interface: IP
+	 * configuration, routes and connected state are left to the interface
+	 * itself, so configure() and set_connected_state() are no-ops.
+	 */
+	class posix_xdp_tap_adapter : public base_tap_adapter<boost::asio::posix::stream_descriptor>
+	{
+		public:
+
+			/**
+			 * \brief Create a new AF_XDP adapter.
+			 * \param _io_service The io_service to attach to.
+			 */
+			explicit posix_xdp_tap_adapter(boost::asio::io_service& _io_service);
+
+			/**
+			 * \brief Destroy the adapter.
+			 */
+			~posix_xdp_tap_adapter();
+
+			posix_xdp_tap_adapter(const posix_xdp_tap_adapter&) = delete;
+			posix_xdp_tap_adapter& operator=(const posix_xdp_tap_adapter&) = delete;
+
+			/**
+			 * \brief Attach to the specified interface queue.
+			 * \param _name The name of the network interface to attach to.
+			 * \param queue_id The interface queue to attach to.
+			 * \param ec The error code.
+			 */
+			void open(const std::string& _name, size_t queue_id, boost::system::error_code& ec);
+
+			/**
+			 * \brief Attach to the specified interface queue.
+			 * \param _name The name of the network interface to attach to.
+			 * \param queue_id The interface queue to attach to.
+			 */
+			void open(const std::string& _name, size_t queue_id = 0);
+
+			/**
+			 * \brief Detach from the interface.
+			 */
+			void close();
+
+			/**
+			 * \brief Get the kernel counters of the underlying interface.
+			 * \return The counters, read over netlink.
+			 */
+			tap_adapter_statistics interface_statistics();
+
+			/**
+			 * \brief Detach from the interface.
+			 * \param ec The error code.
+			 */
+			boost::system::error_code close(boost::system::error_code& ec);
+
+			/**
+			 * \brief Read up to several frames in a single completion.
+			 * \param queue The queue index. The adapter exposes a single queue.
+			 * \param frame_buffers The per-frame buffers into which the frames will be read.
+			 * \param handler The handler to be called when the read operation completes.
+			 *
+			 * The RX ring is drained once the socket becomes readable: every
+			 * available frame is copied out and its UMEM slot goes straight
+			 * back to the fill ring.
+			 */
+			template <typename ReadFramesHandler>
+			void async_read_some_frames(size_t queue, const std::vector<boost::asio::mutable_buffer>& frame_buffers, ReadFramesHandler handler)
+			{
+				static_cast<void>(queue);
+
+				descriptor().async_read_some(
+					boost::asio::null_buffers(),
+					[this, frame_buffers, handler] (const boost::system::error_code& ec, size_t) {
+						std::vector<size_t> frame_sizes;
+
+						if (ec)
+						{
+							handler(ec, frame_sizes);
+
+							return;
+						}
+
+						boost::system::error_code read_ec;
+
+						do_receive_frames(frame_buffers, frame_sizes, read_ec);
+
+						handler(read_ec, frame_sizes);
+					}
+				);
+			}
+
+			/**
+			 * \brief Read a single frame.
+			 * \param buffers The buffers into which the frame will be read.
+			 * \param handler The handler to be called when the read operation completes.
+			 */
+			template <typename MutableBufferSequence, typename ReadHandler>
+			void async_read(const MutableBufferSequence& buffers, ReadHandler handler)
+			{
+				const boost::asio::mutable_buffer frame_buffer(*buffers.begin());
+
+				descriptor().async_read_some(
+					boost::asio::null_buffers(),
+					[this, buffers, frame_buffer, handler] (const boost::system::error_code& ec, size_t) {
+						if (ec)
+						{
+							handler(ec, 0);
+
+							return;
+						}
+
+						size_t count = 0;
+						boost::system::error_code read_ec;
+
+						if (!do_receive_frame(frame_buffer, count, read_ec) && !read_ec)
+						{
+							// A spurious wakeup: wait again.
+							async_read(buffers, handler);
+
+							return;
+						}
+
+						handler(read_ec, count);
+					}
+				);
+			}
+
+			/**
+			 * \brief Read a single frame from the specified queue.
+			 * \param queue The queue index. The adapter exposes a single queue.
+			 * \param buffers The buffers into which the frame will be read.
+			 * \param handler The handler to be called when the read operation completes.
+			 */
+			template <typename MutableBufferSequence, typename ReadHandler>
+			void async_read_queue(size_t queue, const MutableBufferSequence& buffers, ReadHandler handler)
+			{
+				static_cast<void>(queue);
+
+				async_read(buffers, handler);
+			}
+
+			/**
+			 * \brief Write a frame.
+			 * \param buffers One or more buffers holding the frame.
+			 * \param handler The handler to be called when the write operation completes.
+			 *
+			 * The frame is copied into a free UMEM slot and submitted to the
+			 * TX ring: the submission never blocks, so the handler is posted
+			 * immediately. A full ring reports no_buffer_space.
+			 */
+			template <typename ConstBufferSequence, typename WriteHandler>
+			void async_write(const ConstBufferSequence& buffers, WriteHandler handler)
+			{
+				const std::vector<boost::asio::const_buffer> buffer_list(buffers.begin(), buffers.end());
+
+				boost::system::error_code ec;
+				const size_t count = do_transmit(buffer_list, ec);
+
+				get_io_service().post([handler, ec, count] () {
+					handler(ec, count);
+				});
+			}
+
+			/**
+			 * \brief Write a frame.
+			 * \param buffers One or more buffers holding the frame.
+			 * \return The number of bytes written.
+			 */
+			template <typename ConstBufferSequence>
+			size_t write(const ConstBufferSequence& buffers)
+			{
+				const std::vector<boost::asio::const_buffer> buffer_list(buffers.begin(), buffers.end());
+
+				boost::system::error_code ec;
+				const size_t count = do_transmit(buffer_list, ec);
+
+				if (ec)
+				{
+					throw boost::system::system_error(ec);
+				}
+
+				return count;
+			}
+
+			/**
+			 * \brief Write a frame.
+			 * \param buffers One or more buffers holding the frame.
+			 * \param ec The error code.
+			 * \return The number of bytes written.
+			 */
+			template <typename ConstBufferSequence>
+			size_t write(const ConstBufferSequence& buffers, boost::system::error_code& ec)
+			{
+				const std::vector<boost::asio::const_buffer> buffer_list(buffers.begin(), buffers.end());
+
+				return do_transmit(buffer_list, ec);
+			}
+
+			/**
+			 * \brief Configure the adapter.
+			 *
+			 * The adapter does not own the interface: its IP configuration is
+			 * left untouched.
+			 */
+			void configure(const configuration_type&)
+			{
+			}
+
+			/**
+			 * \brief Set the adapter connected state.
+			 *
+			 * The adapter does not own the interface: its administrative
+			 * state is left untouched.
+			 */
+			void set_connected_state(bool)
+			{
+			}
+
+		private:
+
+			/**
+			 * \brief The size of one UMEM frame slot.
+			 */
+			static const size_t FRAME_SIZE = 2048;
+
+			/**
+			 * \brief The count of UMEM frame slots, split evenly between RX and TX.
+			 */
+			static const size_t FRAME_COUNT = 4096;
+
+			struct xdp_state;
+
+			void do_receive_frames(const std::vector<boost::asio::mutable_buffer>& frame_buffers, std::vector<size_t>& frame_sizes, boost::system::error_code& ec);
+			bool do_receive_frame(const boost::asio::mutable_buffer& frame_buffer, size_t& count, boost::system::error_code& ec);
+			size_t do_transmit(const std::vector<boost::asio::const_buffer>& buffers, boost::system::error_code& ec);
+			void read_interface_attributes(const std::string& _name);
+			void destroy_socket();
+
+			std::unique_ptr<xdp_state> m_state;
+	};
+}
+
+#endif /* LINUX && USE_XDP */
+
+#endif /* ASIOTAP_POSIX_XDP_TAP_ADAPTER_HPP */
@@ -53,6 +53,10 @@
 #include "posix/posix_tap_adapter.hpp"
 #endif
 
+#if defined(LINUX) && defined(USE_XDP)
+#include "posix/posix_xdp_tap_adapter.hpp"
+#endif
+
 namespace asiotap
 {
 #ifdef WINDOWS
@@ -60,6 +64,10 @@ namespace asiotap
 #elif defined(UNIX)
 	typedef posix_tap_adapter tap_adapter;
 #endif
+
+#if defined(LINUX) && defined(USE_XDP)
+	typedef posix_xdp_tap_adapter xdp_tap_adapter;
+#endif
 }
 
 #endif /* ASIOTAP_TAP_ADAPTER_HPP */
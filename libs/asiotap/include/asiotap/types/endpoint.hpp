@@ -350,6 +350,19 @@ namespace asiotap
 	 */
 	std::istream& operator>>(std::istream& is, endpoint& value);
 
+	/**
+	 * \brief Parse an endpoint, caching the result by input string.
+	 * \param str The string to parse.
+	 * \return The parsed endpoint.
+	 *
+	 * Contact lists are re-evaluated on every refresh and their strings
+	 * rarely change, so repeated calls with the same string are plain hash
+	 * lookups and the parsers only run the first time a string is seen.
+	 * Strings that fail to parse are cached too and throw
+	 * boost::bad_lexical_cast, like a boost::lexical_cast<endpoint> would.
+	 */
+	endpoint parse_endpoint(const std::string& str);
+
 // Note: this operator is defined in boost variant as of version 1.58. Keeping it around will
 // introduce overload resolution ambiguity.
 #if BOOST_VERSION < 105800
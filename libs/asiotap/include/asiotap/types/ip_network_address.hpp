@@ -52,6 +52,7 @@
 
 #include <boost/asio.hpp>
 #include <boost/variant.hpp>
+#include <boost/functional/hash.hpp>
 
 namespace asiotap
 {
@@ -628,6 +629,38 @@ namespace asiotap
 	{
 		return boost::apply_visitor(ip_network_address_prefix_len_visitor(), ina);
 	}
+
+	/**
+	 * \brief Compute a hash value for an IP address.
+	 * \param value The IP address.
+	 * \return The hash value.
+	 */
+	inline size_t hash_value(const boost::asio::ip::address& value)
+	{
+		if (value.is_v4())
+		{
+			return boost::hash<unsigned long>()(value.to_v4().to_ulong());
+		}
+		else
+		{
+			const auto bytes = value.to_v6().to_bytes();
+
+			return boost::hash_range(bytes.begin(), bytes.end());
+		}
+	}
+
+	/**
+	 * \brief Compute a hash value for a network address, so it can be used in unordered containers.
+	 * \param value The ip_network_address.
+	 * \return The hash value.
+	 */
+	inline size_t hash_value(const ip_network_address& value)
+	{
+		size_t seed = hash_value(to_ip_address(value));
+		boost::hash_combine(seed, to_prefix_length(value));
+
+		return seed;
+	}
 }
 
 #endif /* ASIOTAP_IP_NETWORK_ADDRESS_HPP */
@@ -613,6 +613,25 @@ namespace asiotap
 		return static_cast<bool>(gateway(ir));
 	}
 
+	/**
+	 * \brief Compute a hash value for an IP route, so it can be used in unordered containers.
+	 * \param value The ip_route.
+	 * \return The hash value.
+	 */
+	inline size_t hash_value(const ip_route& value)
+	{
+		size_t seed = hash_value(network_address(value));
+
+		const auto _gateway = gateway(value);
+
+		if (_gateway)
+		{
+			boost::hash_combine(seed, hash_value(*_gateway));
+		}
+
+		return seed;
+	}
+
 	/**
 	 * \brief A route set type.
 	 */
@@ -66,6 +66,11 @@ inline bool operator<(const NET_LUID& lhs, const NET_LUID& rhs)
 	return (lhs.Value < rhs.Value);
 }
 
+inline std::size_t hash_value(const NET_LUID& value)
+{
+	return boost::hash<ULONG64>()(value.Value);
+}
+
 inline std::ostream& operator<<(std::ostream& os, const NET_LUID& value)
 {
 	return os << "Network interface #" << value.Info.NetLuidIndex;
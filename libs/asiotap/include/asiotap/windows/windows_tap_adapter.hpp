@@ -50,8 +50,14 @@
 #include "windows_route_manager.hpp"
 #include "windows_dns_servers_manager.hpp"
 
+#include <deque>
 #include <map>
 #include <string>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 
 #include <ifdef.h>
 
@@ -68,6 +74,15 @@ namespace asiotap
 			 */
 			static std::map<std::string, std::string> enumerate(tap_adapter_layer _layer);
 
+			/**
+			 * \brief Enumerate the tap adapters ahead of time.
+			 *
+			 * The result is cached and consumed by the next enumeration, so
+			 * that open() or enumerate() skips the registry walk. Meant to
+			 * run on a background thread while the configuration loads.
+			 */
+			static void prefetch_enumeration();
+
 			/**
 			 * \brief Create a new tap adapter.
 			 * \param _io_service The io_service to attach to.
@@ -78,7 +93,9 @@ namespace asiotap
 				m_route_manager(_io_service),
 				m_display_name(),
 				m_interface_index(),
-				m_interface_luid()
+				m_interface_luid(),
+				m_read_strand(_io_service),
+				m_read_ring_started(false)
 			{}
 
 			windows_tap_adapter(const windows_tap_adapter&) = delete;
@@ -166,13 +183,69 @@ namespace asiotap
 			 */
 			void set_metric(unsigned int metric);
 
+			/**
+			 * \brief Get the kernel counters of the underlying interface.
+			 * \return The counters, read from the adapter interface entry.
+			 */
+			tap_adapter_statistics interface_statistics();
+
+			/**
+			 * \brief The read frames handler type.
+			 */
+			typedef boost::function<void (const boost::system::error_code&, const std::vector<size_t>&)> read_frames_handler_type;
+
+			/**
+			 * \brief Read up to several frames from the tap adapter in a single completion.
+			 * \param queue The queue index. The TAP-Windows device exposes a single queue so this must be zero.
+			 * \param frame_buffers The per-frame buffers into which the frames will be read. At most one frame is read into each buffer.
+			 * \param handler The handler to be called when the read operation completes.
+			 *
+			 * A ring of READ_RING_SIZE overlapped reads is kept outstanding
+			 * against the device, so it never idles while a completed frame is
+			 * being processed. A single outstanding read caps the throughput
+			 * of the TAP-Windows driver.
+			 */
+			template <typename ReadFramesHandler>
+			void async_read_some_frames(size_t queue, const std::vector<boost::asio::mutable_buffer>& frame_buffers, ReadFramesHandler handler)
+			{
+				static_cast<void>(queue);
+
+				m_read_strand.post(boost::bind(&windows_tap_adapter::do_read_some_frames, this, frame_buffers, read_frames_handler_type(handler)));
+			}
+
 		private:
 
+			/**
+			 * \brief The count of overlapped reads kept outstanding against the device.
+			 */
+			static const size_t READ_RING_SIZE = 8;
+
+			struct read_ring_slot
+			{
+				boost::array<uint8_t, 65536> buffer;
+			};
+
+			// These run within the read strand.
+			void do_read_some_frames(const std::vector<boost::asio::mutable_buffer>& frame_buffers, read_frames_handler_type handler);
+			void do_post_ring_read(size_t slot);
+			void do_handle_ring_read(size_t slot, const boost::system::error_code& ec, size_t count);
+			void do_deliver_frames();
+
 			windows_route_manager m_route_manager;
 			std::string m_display_name;
 			NET_IFINDEX m_interface_index;
 			NET_LUID m_interface_luid;
 
+			// The read ring state. It is only ever accessed from within the
+			// read strand.
+			boost::asio::io_service::strand m_read_strand;
+			bool m_read_ring_started;
+			boost::array<read_ring_slot, READ_RING_SIZE> m_read_ring_slots;
+			std::deque<std::pair<size_t, size_t>> m_read_ring_completions;
+			boost::system::error_code m_read_ring_error;
+			std::vector<boost::asio::mutable_buffer> m_pending_read_buffers;
+			read_frames_handler_type m_pending_read_handler;
+
 			friend std::ostream& operator<<(std::ostream& os, const windows_tap_adapter& value)
 			{
 				return os << value.display_name();
@@ -50,6 +50,9 @@
 #include "osi/ethernet_builder.hpp"
 #include "osi/arp_builder.hpp"
 
+#include <cassert>
+#include <cstring>
+
 namespace asiotap
 {
 	namespace osi
@@ -79,27 +82,63 @@ namespace asiotap
 
 				if (should_answer)
 				{
-					size_t payload_size;
+					const size_t frame_size = sizeof(ethernet_frame) + sizeof(arp_frame);
+					const boost::asio::mutable_buffer response = response_buffer + (boost::asio::buffer_size(response_buffer) - frame_size);
+
+					const response_cache_type::iterator cached_response_it = m_response_cache.find(arp_helper.target_logical_address());
+
+					if ((cached_response_it == m_response_cache.end()) || (cached_response_it->second.hardware_address != eth_addr))
+					{
+						// First request for this address (or its hardware
+						// address changed): build the reply through the
+						// builder chain and cache the resulting frame.
+						size_t payload_size;
+
+						const ethernet_address_type::data_type eth_addr_data = eth_addr.data();
+
+						builder<arp_frame> arp_builder(response_buffer);
+
+						payload_size = arp_builder.write(
+						                   ARP_REPLY_OPERATION,
+						                   boost::asio::buffer(eth_addr_data),
+						                   arp_helper.target_logical_address(),
+						                   arp_helper.sender_hardware_address(),
+						                   arp_helper.sender_logical_address()
+						               );
+
+						builder<ethernet_frame> ethernet_builder(response_buffer, payload_size);
+
+						payload_size = ethernet_builder.write(
+						                   ethernet_helper.sender(),
+						                   ethernet_helper.target(),
+						                   ethernet_helper.protocol()
+						               );
+
+						assert(payload_size == frame_size);
+
+						cached_response_type& cached_response = m_response_cache[arp_helper.target_logical_address()];
+
+						cached_response.hardware_address = eth_addr;
+						std::memcpy(cached_response.frame.data(), boost::asio::buffer_cast<const uint8_t*>(response), frame_size);
+
+						return boost::make_optional<boost::asio::const_buffer>(response);
+					}
+
+					// The reply was built before: replay the cached frame and
+					// patch only the requester-specific fields.
+					std::memcpy(boost::asio::buffer_cast<uint8_t*>(response), cached_response_it->second.frame.data(), frame_size);
 
-					builder<arp_frame> arp_builder(response_buffer);
+					mutable_helper<ethernet_frame> response_ethernet_helper(response);
 
-					payload_size = arp_builder.write(
-					                   ARP_REPLY_OPERATION,
-					                   boost::asio::buffer(eth_addr.data()),
-					                   arp_helper.target_logical_address(),
-					                   arp_helper.sender_hardware_address(),
-					                   arp_helper.sender_logical_address()
-					               );
+					std::memcpy(boost::asio::buffer_cast<uint8_t*>(response_ethernet_helper.target()), boost::asio::buffer_cast<const uint8_t*>(ethernet_helper.sender()), ETHERNET_ADDRESS_SIZE);
+					std::memcpy(boost::asio::buffer_cast<uint8_t*>(response_ethernet_helper.sender()), boost::asio::buffer_cast<const uint8_t*>(ethernet_helper.target()), ETHERNET_ADDRESS_SIZE);
 
-					builder<ethernet_frame> ethernet_builder(response_buffer, payload_size);
+					mutable_helper<arp_frame> response_arp_helper(response_ethernet_helper.payload());
 
-					payload_size = ethernet_builder.write(
-					                   ethernet_helper.sender(),
-					                   ethernet_helper.target(),
-					                   ethernet_helper.protocol()
-					               );
+					std::memcpy(boost::asio::buffer_cast<uint8_t*>(response_arp_helper.target_hardware_address()), boost::asio::buffer_cast<const uint8_t*>(arp_helper.sender_hardware_address()), ETHERNET_ADDRESS_SIZE);
+					response_arp_helper.set_target_logical_address(arp_helper.sender_logical_address());
 
-					return boost::make_optional<boost::asio::const_buffer>(response_buffer + (boost::asio::buffer_size(response_buffer) - payload_size));
+					return boost::make_optional<boost::asio::const_buffer>(response);
 				}
 			}
 
@@ -44,10 +44,140 @@
 
 #include "osi/checksum_helper.hpp"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 namespace asiotap
 {
 	namespace osi
 	{
+		namespace
+		{
+			/*
+			 * Sum word_count 16-bit words into a wide accumulator.
+			 *
+			 * The ones-complement addition is deferred: the words are summed
+			 * into lanes wide enough not to overflow for any frame-sized
+			 * buffer (at most 32768 words), and the caller folds the carries
+			 * afterwards. The vector variants are selected at compile time
+			 * from the target architecture flags.
+			 */
+#if defined(__AVX2__)
+			uint64_t sum_words(const uint16_t* buf, size_t word_count)
+			{
+				__m256i acc = _mm256_setzero_si256();
+				const __m256i zero = _mm256_setzero_si256();
+
+				while (word_count >= 16)
+				{
+					const __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf));
+
+					acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(words, zero));
+					acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(words, zero));
+
+					buf += 16;
+					word_count -= 16;
+				}
+
+				__m128i acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+				acc128 = _mm_add_epi32(acc128, _mm_srli_si128(acc128, 8));
+				acc128 = _mm_add_epi32(acc128, _mm_srli_si128(acc128, 4));
+
+				uint64_t sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc128));
+
+				while (word_count > 0)
+				{
+					sum += *buf++;
+					--word_count;
+				}
+
+				return sum;
+			}
+#elif defined(__SSE2__)
+			uint64_t sum_words(const uint16_t* buf, size_t word_count)
+			{
+				__m128i acc = _mm_setzero_si128();
+				const __m128i zero = _mm_setzero_si128();
+
+				while (word_count >= 8)
+				{
+					const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+
+					acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(words, zero));
+					acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(words, zero));
+
+					buf += 8;
+					word_count -= 8;
+				}
+
+				acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+				acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+
+				uint64_t sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc));
+
+				while (word_count > 0)
+				{
+					sum += *buf++;
+					--word_count;
+				}
+
+				return sum;
+			}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+			uint64_t sum_words(const uint16_t* buf, size_t word_count)
+			{
+				uint32x4_t acc = vdupq_n_u32(0);
+
+				while (word_count >= 8)
+				{
+					acc = vpadalq_u16(acc, vld1q_u16(buf));
+
+					buf += 8;
+					word_count -= 8;
+				}
+
+				const uint64x2_t pair = vpaddlq_u32(acc);
+
+				uint64_t sum = vgetq_lane_u64(pair, 0) + vgetq_lane_u64(pair, 1);
+
+				while (word_count > 0)
+				{
+					sum += *buf++;
+					--word_count;
+				}
+
+				return sum;
+			}
+#else
+			uint64_t sum_words(const uint16_t* buf, size_t word_count)
+			{
+				uint64_t sum = 0;
+
+				while (word_count >= 4)
+				{
+					sum += static_cast<uint32_t>(buf[0]) + buf[1] + buf[2] + buf[3];
+
+					buf += 4;
+					word_count -= 4;
+				}
+
+				while (word_count > 0)
+				{
+					sum += *buf++;
+					--word_count;
+				}
+
+				return sum;
+			}
+#endif
+		}
+
 		void checksum_helper::update(const uint16_t* buf, size_t buf_len)
 		{
 			if (buf_len > 0)
@@ -59,10 +189,22 @@ namespace asiotap
 					m_left = 0;
 				}
 
-				while (buf_len > 1)
+				const size_t word_count = buf_len / sizeof(uint16_t);
+
+				if (word_count > 0)
 				{
-					m_checksum += *buf++;
-					buf_len -= sizeof(uint16_t);
+					uint64_t sum = sum_words(buf, word_count);
+
+					// Fold the wide partial sum before merging it into the accumulator.
+					while (sum >> 16)
+					{
+						sum = (sum & 0xFFFF) + (sum >> 16);
+					}
+
+					m_checksum += static_cast<uint32_t>(sum);
+
+					buf += word_count;
+					buf_len -= word_count * sizeof(uint16_t);
 				}
 
 				if (buf_len > 0)
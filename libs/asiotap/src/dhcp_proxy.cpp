@@ -76,11 +76,11 @@ namespace asiotap
 
 			proxy<dhcp_frame>::ethernet_address_type bootp_get_ethernet_address(const_helper<bootp_frame> bootp_helper)
 			{
-				proxy<dhcp_frame>::ethernet_address_type result;
+				proxy<dhcp_frame>::ethernet_address_type::data_type result;
 
 				std::memcpy(result.data(), boost::asio::buffer_cast<const void*>(bootp_helper.chaddr()), result.size());
 
-				return result;
+				return proxy<dhcp_frame>::ethernet_address_type(result);
 			}
 
 			boost::asio::ip::address_v4 prefix_length_to_netmask_v4(unsigned int netmask)
@@ -105,6 +105,17 @@ namespace asiotap
 
 		const boost::posix_time::time_duration proxy<dhcp_frame>::DEFAULT_LEASE_TIME = boost::posix_time::hours(1);
 
+		bool proxy<dhcp_frame>::add_entry(const entry_type& entry)
+		{
+			lease_type lease;
+
+			lease.address = entry.second.address;
+			lease.hardware_address_data = entry.first.data();
+			lease.subnet_mask = prefix_length_to_netmask_v4(entry.second.prefix_length).to_bytes();
+
+			return m_entry_map.insert(std::make_pair(entry.first, lease)).second;
+		}
+
 		boost::optional<boost::asio::const_buffer> proxy<dhcp_frame>::process_frame(
 				const_helper<ethernet_frame> ethernet_helper,
 				const_helper<ipv4_frame> ipv4_helper,
@@ -170,12 +181,11 @@ namespace asiotap
 								break;
 						}
 
-						dhcp_builder.add_option(dhcp_option::server_identifier, boost::asio::buffer(m_software_address.to_bytes()));
+						dhcp_builder.add_option(dhcp_option::server_identifier, boost::asio::buffer(m_software_address_bytes));
 
 						if (!info)
 						{
-							const uint32_t lease_time = htonl(m_lease_time.total_seconds());
-							dhcp_builder.add_option(dhcp_option::ip_address_lease_time, &lease_time, sizeof(lease_time));
+							dhcp_builder.add_option(dhcp_option::ip_address_lease_time, &m_lease_time_option, sizeof(m_lease_time_option));
 						}
 
 						BOOST_FOREACH(dhcp_option_helper<const_helper_tag>& dhcp_option_helper, dhcp_helper)
@@ -193,7 +203,7 @@ namespace asiotap
 											switch (static_cast<dhcp_option::dhcp_option_tag>(options[i]))
 											{
 												case dhcp_option::subnet_mask:
-													dhcp_builder.add_option(dhcp_option::subnet_mask, boost::asio::buffer(prefix_length_to_netmask_v4(entry->second.prefix_length).to_bytes()));
+													dhcp_builder.add_option(dhcp_option::subnet_mask, boost::asio::buffer(entry->second.subnet_mask));
 													break;
 
 												default:
@@ -226,7 +236,7 @@ namespace asiotap
 						                   info ? boost::asio::ip::address_v4::any() : entry->second.address,
 						                   m_software_address,
 						                   boost::asio::ip::address_v4::any(),
-						                   boost::asio::buffer(entry->first),
+						                   boost::asio::buffer(entry->second.hardware_address_data),
 						                   boost::asio::const_buffer(NULL, 0),
 						                   boost::asio::const_buffer(NULL, 0)
 						               );
@@ -248,11 +258,14 @@ namespace asiotap
 						                   ipv4_helper.source()
 						               );
 
-						udp_builder.update_checksum(ipv4_builder.get_helper());
+						if (!m_checksum_offload)
+						{
+							udp_builder.update_checksum(ipv4_builder.get_helper());
+						}
 
 						builder<ethernet_frame> ethernet_builder(response_buffer, payload_size);
 
-						payload_size = ethernet_builder.write(ethernet_helper.sender(), boost::asio::buffer(m_hardware_address), ethernet_helper.protocol());
+						payload_size = ethernet_builder.write(ethernet_helper.sender(), boost::asio::buffer(m_hardware_address_data), ethernet_helper.protocol());
 
 						return boost::make_optional<boost::asio::const_buffer>(response_buffer + (boost::asio::buffer_size(response_buffer) - payload_size));
 					}
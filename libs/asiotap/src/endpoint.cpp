@@ -44,8 +44,26 @@
 
 #include "types/endpoint.hpp"
 
+#include <sstream>
+#include <unordered_map>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+
 namespace asiotap
 {
+	namespace
+	{
+		bool parse(const std::string& str, endpoint& value)
+		{
+			std::istringstream iss(str);
+
+			// Like boost::lexical_cast, the whole string must be consumed.
+			return (iss >> value) && (iss.peek() == std::char_traits<char>::eof());
+		}
+	}
+
 	std::istream& operator>>(std::istream& is, endpoint& value)
 	{
 		if (is)
@@ -87,4 +105,60 @@ namespace asiotap
 
 		return is;
 	}
+
+	endpoint parse_endpoint(const std::string& str)
+	{
+		static const size_t MAX_CACHE_ENTRIES = 1024;
+		static boost::mutex cache_mutex;
+		static std::unordered_map<std::string, boost::optional<endpoint>> cache;
+
+		{
+			boost::mutex::scoped_lock lock(cache_mutex);
+
+			const auto it = cache.find(str);
+
+			if (it != cache.end())
+			{
+				if (!it->second)
+				{
+					throw boost::bad_lexical_cast();
+				}
+
+				return *it->second;
+			}
+		}
+
+		// The parse itself happens outside the lock: it is the expensive
+		// part, and parsing the same string twice on a miss race is harmless.
+		boost::optional<endpoint> value;
+
+		{
+			endpoint ep;
+
+			if (parse(str, ep))
+			{
+				value = ep;
+			}
+		}
+
+		{
+			boost::mutex::scoped_lock lock(cache_mutex);
+
+			if (cache.size() >= MAX_CACHE_ENTRIES)
+			{
+				// The strings may come from remote peers: without a bound
+				// they could grow the cache indefinitely.
+				cache.clear();
+			}
+
+			cache[str] = value;
+		}
+
+		if (!value)
+		{
+			throw boost::bad_lexical_cast();
+		}
+
+		return *value;
+	}
 }
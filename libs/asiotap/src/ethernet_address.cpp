@@ -105,13 +105,15 @@ namespace asiotap
 			// This will save the flags and restore them when the function exits.
 			boost::io::ios_flags_saver ifs(os);
 
+			const ethernet_address::data_type data = value.data();
+
 			os << std::hex << std::setfill('0') << std::setw(2);
 
-			os << static_cast<unsigned int>(value.data()[0]);
+			os << static_cast<unsigned int>(data[0]);
 
-			for (size_t i = 1; i < value.data().size(); ++i)
+			for (size_t i = 1; i < data.size(); ++i)
 			{
-				os << ':' << std::setw(2) << static_cast<unsigned int>(value.data()[i]);
+				os << ':' << std::setw(2) << static_cast<unsigned int>(data[i]);
 			}
 
 			return os;
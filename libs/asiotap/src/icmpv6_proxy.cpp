@@ -50,10 +50,17 @@
 #include "osi/ipv6_builder.hpp"
 #include "osi/icmpv6_builder.hpp"
 
+#include "osi/checksum_helper.hpp"
+
+#include <cassert>
+#include <cstring>
+
 namespace asiotap
 {
 	namespace osi
 	{
+		const boost::posix_time::time_duration proxy<icmpv6_frame>::DUPLICATE_SOLICITATION_WINDOW = boost::posix_time::milliseconds(100);
+
 		boost::optional<boost::asio::const_buffer> proxy<icmpv6_frame>::process_frame(const_helper<ipv6_frame> ipv6_helper, const_helper<icmpv6_frame> icmpv6_helper, boost::asio::mutable_buffer response_buffer) const
 		{
 			if (icmpv6_helper.type() == ICMPV6_NEIGHBOR_SOLICITATION)
@@ -69,39 +76,119 @@ namespace asiotap
 
 				if (should_answer)
 				{
-					// We hardcode the structure for the ICMPv6 option because it just works.
-					size_t payload_size = 8;
-					uint8_t* const target_link_layer_address_option_buffer = boost::asio::buffer_cast<uint8_t*>(response_buffer + (boost::asio::buffer_size(response_buffer) - payload_size));
-
-					target_link_layer_address_option_buffer[0] = ICMPV6_OPTION_TARGET_LINK_LAYER_ADDRESS; // The option type.
-					target_link_layer_address_option_buffer[1] = 0x01; // The size, in multiples of 8 bytes.
-					::memcpy(&target_link_layer_address_option_buffer[2], &eth_addr.data()[0], eth_addr.data().size()); // The ethernet address.
-
-					builder<icmpv6_frame> icmpv6_builder(response_buffer, payload_size);
-
-					payload_size = icmpv6_builder.write(
-					    ICMPV6_NEIGHBOR_ADVERTISEMENT,
-						0,
-						false,
-						true,
-						true,
-						icmpv6_helper.target()
-					);
-
-					builder<ipv6_frame> ipv6_builder(response_buffer, payload_size);
-
-					payload_size = ipv6_builder.write(
-						ipv6_helper._class(),
-						ipv6_helper.label(),
-						ICMPV6_HEADER,
-						0xFF,
-						icmpv6_helper.target(),
-						ipv6_helper.source()
-					);
-
-					icmpv6_builder.update_checksum(ipv6_builder.get_helper());
-
-					return boost::make_optional<boost::asio::const_buffer>(response_buffer + (boost::asio::buffer_size(response_buffer) - payload_size));
+					const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+					const size_t frame_size = sizeof(ipv6_frame) + sizeof(icmpv6_frame) + 8;
+					const boost::asio::mutable_buffer response = response_buffer + (boost::asio::buffer_size(response_buffer) - frame_size);
+
+					const response_cache_type::iterator cached_response_it = m_response_cache.find(icmpv6_helper.target());
+
+					if ((cached_response_it == m_response_cache.end()) || (cached_response_it->second.hardware_address != eth_addr))
+					{
+						// First solicitation for this address (or its hardware
+						// address changed): build the advertisement through
+						// the builder chain and cache the resulting frame.
+
+						// We hardcode the structure for the ICMPv6 option because it just works.
+						size_t payload_size = 8;
+						uint8_t* const target_link_layer_address_option_buffer = boost::asio::buffer_cast<uint8_t*>(response_buffer + (boost::asio::buffer_size(response_buffer) - payload_size));
+
+						const ethernet_address_type::data_type eth_addr_data = eth_addr.data();
+
+						target_link_layer_address_option_buffer[0] = ICMPV6_OPTION_TARGET_LINK_LAYER_ADDRESS; // The option type.
+						target_link_layer_address_option_buffer[1] = 0x01; // The size, in multiples of 8 bytes.
+						::memcpy(&target_link_layer_address_option_buffer[2], eth_addr_data.data(), eth_addr_data.size()); // The ethernet address.
+
+						builder<icmpv6_frame> icmpv6_builder(response_buffer, payload_size);
+
+						payload_size = icmpv6_builder.write(
+						    ICMPV6_NEIGHBOR_ADVERTISEMENT,
+							0,
+							false,
+							true,
+							true,
+							icmpv6_helper.target()
+						);
+
+						builder<ipv6_frame> ipv6_builder(response_buffer, payload_size);
+
+						payload_size = ipv6_builder.write(
+							ipv6_helper._class(),
+							ipv6_helper.label(),
+							ICMPV6_HEADER,
+							0xFF,
+							icmpv6_helper.target(),
+							ipv6_helper.source()
+						);
+
+						if (!m_checksum_offload)
+						{
+							icmpv6_builder.update_checksum(ipv6_builder.get_helper());
+						}
+
+						assert(payload_size == frame_size);
+
+						cached_response_type& cached_response = m_response_cache[icmpv6_helper.target()];
+
+						cached_response.hardware_address = eth_addr;
+						std::memcpy(cached_response.frame.data(), boost::asio::buffer_cast<const uint8_t*>(response), frame_size);
+						cached_response.last_requester = ipv6_helper.source();
+						cached_response.last_answer = now;
+
+						return boost::make_optional<boost::asio::const_buffer>(response);
+					}
+
+					cached_response_type& cached_response = cached_response_it->second;
+
+					// Same-burst duplicates of a solicitation we just answered
+					// are dropped: the first advertisement is still in flight.
+					if ((cached_response.last_requester == ipv6_helper.source()) && ((now - cached_response.last_answer) < DUPLICATE_SOLICITATION_WINDOW))
+					{
+						return boost::optional<boost::asio::const_buffer>();
+					}
+
+					// The advertisement was built before: replay the cached
+					// frame and patch only the requester-specific fields.
+					std::memcpy(boost::asio::buffer_cast<uint8_t*>(response), cached_response.frame.data(), frame_size);
+
+					mutable_helper<ipv6_frame> response_ipv6_helper(response);
+
+					const boost::asio::ip::address_v6::bytes_type old_destination = response_ipv6_helper.destination().to_bytes();
+					const boost::asio::ip::address_v6::bytes_type new_destination = ipv6_helper.source().to_bytes();
+
+					response_ipv6_helper.set_class(ipv6_helper._class());
+					response_ipv6_helper.set_label(ipv6_helper.label());
+					response_ipv6_helper.set_destination(ipv6_helper.source());
+
+					mutable_helper<icmpv6_frame> response_icmpv6_helper(response_ipv6_helper.payload());
+
+					if (!m_checksum_offload)
+					{
+						// The destination address is the only checksummed field
+						// that changed: update the stored checksum incrementally
+						// (RFC 1624) instead of recomputing it over the whole
+						// pseudo-header and payload. All the words are kept in
+						// network byte order, as the checksum field itself is.
+						uint16_t checksum = response_icmpv6_helper.checksum();
+
+						for (size_t i = 0; i < old_destination.size(); i += sizeof(uint16_t))
+						{
+							uint16_t old_word;
+							uint16_t new_word;
+
+							std::memcpy(&old_word, &old_destination[i], sizeof(old_word));
+							std::memcpy(&new_word, &new_destination[i], sizeof(new_word));
+
+							checksum = checksum_helper::recompute(checksum, old_word, new_word);
+						}
+
+						response_icmpv6_helper.set_checksum(checksum);
+					}
+
+					cached_response.last_requester = ipv6_helper.source();
+					cached_response.last_answer = now;
+
+					return boost::make_optional<boost::asio::const_buffer>(response);
 				}
 			}
 
@@ -50,35 +50,81 @@
 
 namespace asiotap
 {
-	template <typename AddressType>
-	bool base_ip_network_address<AddressType>::has_address(const AddressType& addr) const
+	namespace
 	{
-		const typename AddressType::bytes_type network_bytes = address().to_bytes();
-		const typename AddressType::bytes_type addr_bytes = addr.to_bytes();
+		/**
+		 * \brief Compute the network mask of a prefix length, as a 32 bit word.
+		 * \param prefix_length The prefix length. Must not exceed 32.
+		 * \return The mask.
+		 */
+		constexpr uint32_t prefix_mask_32(unsigned int prefix_length)
+		{
+			return (prefix_length == 0) ? 0 : (~static_cast<uint32_t>(0) << (32 - prefix_length));
+		}
 
-		unsigned int prefix_len = m_prefix_length;
+		/**
+		 * \brief Compute the network mask of a prefix length, as a 64 bit word.
+		 * \param prefix_length The prefix length. Must not exceed 64.
+		 * \return The mask.
+		 */
+		constexpr uint64_t prefix_mask_64(unsigned int prefix_length)
+		{
+			return (prefix_length == 0) ? 0 : (~static_cast<uint64_t>(0) << (64 - prefix_length));
+		}
 
-		for (size_t i = 0; i < network_bytes.size(); ++i)
+		/**
+		 * \brief Load 8 bytes of an address as a big-endian 64 bit word.
+		 * \param bytes The bytes to load from.
+		 * \return The word.
+		 *
+		 * Compilers turn the shift cascade into a single load.
+		 */
+		inline uint64_t load_be_64(const unsigned char* bytes)
 		{
-			if (prefix_len >= 8)
-			{
-				if (network_bytes[i] != addr_bytes[i])
-					return false;
+			return (static_cast<uint64_t>(bytes[0]) << 56) |
+				(static_cast<uint64_t>(bytes[1]) << 48) |
+				(static_cast<uint64_t>(bytes[2]) << 40) |
+				(static_cast<uint64_t>(bytes[3]) << 32) |
+				(static_cast<uint64_t>(bytes[4]) << 24) |
+				(static_cast<uint64_t>(bytes[5]) << 16) |
+				(static_cast<uint64_t>(bytes[6]) << 8) |
+				static_cast<uint64_t>(bytes[7]);
+		}
 
-				prefix_len -= 8;
-			}
-			else
-			{
-				const typename AddressType::bytes_type::value_type mask = (static_cast<unsigned char>(0xFF) >> prefix_len) ^ static_cast<unsigned char>(0xFF);
+		/**
+		 * \brief Check whether an IPv4 address matches a network prefix.
+		 *
+		 * The comparison works on the native numeric form of the addresses:
+		 * a match is a XOR and a mask, not a byte loop.
+		 */
+		inline bool has_address_impl(const boost::asio::ip::address_v4& network, const boost::asio::ip::address_v4& addr, unsigned int prefix_length)
+		{
+			return ((static_cast<uint32_t>(network.to_ulong()) ^ static_cast<uint32_t>(addr.to_ulong())) & prefix_mask_32(prefix_length)) == 0;
+		}
 
-				if ((network_bytes[i] & mask) != (addr_bytes[i] & mask))
-					return false;
+		/**
+		 * \brief Check whether an IPv6 address matches a network prefix.
+		 *
+		 * The addresses are compared as two 64 bit words each, masked with
+		 * the high and low halves of the prefix.
+		 */
+		inline bool has_address_impl(const boost::asio::ip::address_v6& network, const boost::asio::ip::address_v6& addr, unsigned int prefix_length)
+		{
+			const boost::asio::ip::address_v6::bytes_type network_bytes = network.to_bytes();
+			const boost::asio::ip::address_v6::bytes_type addr_bytes = addr.to_bytes();
 
-				break;
-			}
+			const unsigned int high_bits = (prefix_length < 64) ? prefix_length : 64;
+			const unsigned int low_bits = (prefix_length > 64) ? (prefix_length - 64) : 0;
+
+			return (((load_be_64(&network_bytes[0]) ^ load_be_64(&addr_bytes[0])) & prefix_mask_64(high_bits)) == 0) &&
+				(((load_be_64(&network_bytes[8]) ^ load_be_64(&addr_bytes[8])) & prefix_mask_64(low_bits)) == 0);
 		}
+	}
 
-		return true;
+	template <typename AddressType>
+	bool base_ip_network_address<AddressType>::has_address(const AddressType& addr) const
+	{
+		return has_address_impl(address(), addr, m_prefix_length);
 	}
 
 	template bool base_ip_network_address<boost::asio::ip::address_v4>::has_address(const boost::asio::ip::address_v4&) const;
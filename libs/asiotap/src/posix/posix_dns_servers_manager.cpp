@@ -46,8 +46,13 @@
 
 #include <executeplus/posix_system.hpp>
 
+#include <boost/make_shared.hpp>
+
+#include <sstream>
+
 namespace asiotap
 {
+#ifndef LINUX
 	void posix_dns_servers_manager::register_dns_server(const dns_server_type& dns_server_entry)
 	{
 		//TODO: Implement.
@@ -59,4 +64,105 @@ namespace asiotap
 		//TODO: Implement.
 		static_cast<void>(dns_server_entry);
 	}
+#else
+	void posix_dns_servers_manager::register_dns_server(const dns_server_type& dns_server_entry)
+	{
+		m_dns_servers[dns_server_entry.interface_name].insert(dns_server_entry.dns_server_address);
+
+		if (m_batching)
+		{
+			m_dirty_interfaces.insert(dns_server_entry.interface_name);
+		}
+		else
+		{
+			apply_dns_servers(dns_server_entry.interface_name);
+		}
+	}
+
+	void posix_dns_servers_manager::unregister_dns_server(const dns_server_type& dns_server_entry)
+	{
+		m_dns_servers[dns_server_entry.interface_name].erase(dns_server_entry.dns_server_address);
+
+		if (m_batching)
+		{
+			m_dirty_interfaces.insert(dns_server_entry.interface_name);
+		}
+		else
+		{
+			apply_dns_servers(dns_server_entry.interface_name);
+		}
+	}
+
+	void posix_dns_servers_manager::begin_batch()
+	{
+		m_batching = true;
+	}
+
+	void posix_dns_servers_manager::end_batch()
+	{
+		m_batching = false;
+
+		const auto interfaces = boost::make_shared<std::set<std::string>>();
+
+		interfaces->swap(m_dirty_interfaces);
+
+		if (interfaces->empty())
+		{
+			return;
+		}
+
+		// The records are applied asynchronously so the calling thread never waits on process spawning.
+		io_service().post([this, interfaces]() {
+			for (auto&& interface_name : *interfaces)
+			{
+				try
+				{
+					apply_dns_servers(interface_name);
+				}
+				catch (boost::system::system_error& ex)
+				{
+					// The changes were acknowledged when they were queued:
+					// report the failure for every server of the record, as
+					// the record is applied as a whole.
+					for (auto&& dns_server_address : m_dns_servers[interface_name])
+					{
+						report_dns_server_registration_failure(dns_server_type { interface_name, dns_server_address }, ex);
+					}
+				}
+			}
+		});
+	}
+
+	void posix_dns_servers_manager::apply_dns_servers(const std::string& interface_name)
+	{
+		const auto dns_servers = m_dns_servers.find(interface_name);
+
+		if ((dns_servers == m_dns_servers.end()) || dns_servers->second.empty())
+		{
+			m_dns_servers.erase(interface_name);
+
+			const std::vector<std::string> args { "/sbin/resolvconf", "-d", interface_name };
+
+			executeplus::checked_execute(args, executeplus::get_current_environment());
+		}
+		else
+		{
+			std::ostringstream record;
+
+			for (auto&& dns_server_address : dns_servers->second)
+			{
+				record << "nameserver " << dns_server_address << "\n";
+			}
+
+			// resolvconf reads the record from its standard input, so the
+			// whole server list for the interface is piped through the
+			// shell in a single invocation. The record and the interface
+			// name are passed as positional parameters to avoid any
+			// quoting issue.
+			const std::vector<std::string> args { "/bin/sh", "-c", "printf %s \"$1\" | /sbin/resolvconf -a \"$2\"", "sh", record.str(), interface_name };
+
+			executeplus::checked_execute(args, executeplus::get_current_environment());
+		}
+	}
+#endif
 }
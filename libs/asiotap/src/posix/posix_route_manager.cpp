@@ -49,6 +49,7 @@
 #include <sstream>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/algorithm/string.hpp>
@@ -205,7 +206,11 @@ namespace asiotap
 
 		executeplus::checked_execute(real_args, executeplus::get_current_environment());
 #else
-		if (action == route_action::add)
+		if (m_batching)
+		{
+			queue_batch_operation(action, interface, dest, boost::optional<boost::asio::ip::address>());
+		}
+		else if (action == route_action::add)
 		{
 			m_netlink_manager.add_route(netlinkplus::interface_entry(interface), to_ip_address(dest), to_prefix_length(dest));
 		}
@@ -230,7 +235,11 @@ namespace asiotap
 
 		executeplus::checked_execute(real_args, executeplus::get_current_environment());
 #else
-		if (action == route_action::add)
+		if (m_batching)
+		{
+			queue_batch_operation(action, interface, dest, gateway);
+		}
+		else if (action == route_action::add)
 		{
 			m_netlink_manager.add_route(netlinkplus::interface_entry(interface), to_ip_address(dest), to_prefix_length(dest), gateway);
 		}
@@ -241,6 +250,148 @@ namespace asiotap
 #endif
 	}
 
+#ifdef LINUX
+	void posix_route_manager::begin_batch()
+	{
+		m_batching = true;
+	}
+
+	void posix_route_manager::end_batch()
+	{
+		m_batching = false;
+
+		const auto operations = boost::make_shared<std::vector<netlinkplus::route_operation>>();
+		const auto routes = boost::make_shared<std::vector<route_type>>();
+
+		operations->swap(m_batch_operations);
+		routes->swap(m_batch_routes);
+
+		if (operations->empty())
+		{
+			return;
+		}
+
+		// The batch is flushed asynchronously so the calling thread never waits for the kernel acknowledgments.
+		m_netlink_manager.async_set_routes(*operations, [this, operations, routes](const std::vector<boost::system::error_code>& results) {
+			for (size_t i = 0; i < results.size(); ++i)
+			{
+				if (results[i])
+				{
+					const boost::system::system_error error(results[i]);
+
+					if ((*operations)[i].operation == netlinkplus::route_operation::operation_type::add)
+					{
+						report_route_registration_failure((*routes)[i], error);
+					}
+					else
+					{
+						report_route_unregistration_failure((*routes)[i], error);
+					}
+				}
+			}
+		});
+	}
+
+	void posix_route_manager::queue_batch_operation(route_action action, const std::string& interface, const ip_network_address& dest, const boost::optional<boost::asio::ip::address>& gateway)
+	{
+		netlinkplus::route_operation operation;
+
+		operation.operation = (action == route_action::add) ? netlinkplus::route_operation::operation_type::add : netlinkplus::route_operation::operation_type::remove;
+		operation.interface = netlinkplus::interface_entry(interface);
+		operation.destination = to_ip_address(dest);
+		operation.destination_length = to_prefix_length(dest);
+		operation.gateway = gateway;
+
+		m_batch_operations.push_back(operation);
+
+		const route_type route_entry = { interface, to_ip_route(dest, gateway), 0 };
+		m_batch_routes.push_back(route_entry);
+	}
+
+	void posix_route_manager::begin_transaction()
+	{
+		m_batching = true;
+	}
+
+	void posix_route_manager::commit_transaction()
+	{
+		m_batching = false;
+
+		std::vector<netlinkplus::route_operation> operations;
+		std::vector<route_type> routes;
+
+		operations.swap(m_batch_operations);
+		routes.swap(m_batch_routes);
+
+		if (operations.empty())
+		{
+			return;
+		}
+
+		// set_routes() pipelines the requests over the netlink socket, so the kernel processes the whole delta concurrently no matter how many interfaces or tables are involved.
+		const auto results = m_netlink_manager.set_routes(operations);
+
+		boost::optional<boost::system::error_code> first_error;
+
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			if (results[i])
+			{
+				if (!first_error)
+				{
+					first_error = results[i];
+				}
+
+				const boost::system::system_error error(results[i]);
+
+				if (operations[i].operation == netlinkplus::route_operation::operation_type::add)
+				{
+					report_route_registration_failure(routes[i], error);
+				}
+				else
+				{
+					report_route_unregistration_failure(routes[i], error);
+				}
+			}
+		}
+
+		if (!first_error)
+		{
+			return;
+		}
+
+		// Revert the operations that succeeded, in reverse order so that a route always goes away before the route its gateway may depend on. The revert is best-effort: there is no sane recovery from a failure at this point.
+		std::vector<netlinkplus::route_operation> inverse_operations;
+
+		for (size_t i = results.size(); i > 0; --i)
+		{
+			if (!results[i - 1])
+			{
+				netlinkplus::route_operation operation = operations[i - 1];
+
+				operation.operation = (operation.operation == netlinkplus::route_operation::operation_type::add) ? netlinkplus::route_operation::operation_type::remove : netlinkplus::route_operation::operation_type::add;
+
+				inverse_operations.push_back(operation);
+			}
+		}
+
+		if (!inverse_operations.empty())
+		{
+			m_netlink_manager.set_routes(inverse_operations);
+		}
+
+		throw boost::system::system_error(*first_error);
+	}
+
+	void posix_route_manager::rollback_transaction()
+	{
+		m_batching = false;
+
+		m_batch_operations.clear();
+		m_batch_routes.clear();
+	}
+#endif
+
 	void posix_route_manager::register_route(const route_type& route_entry)
 	{
 		const auto _gateway = gateway(route_entry.route);
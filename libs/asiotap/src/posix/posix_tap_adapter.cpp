@@ -270,8 +270,22 @@ namespace asiotap
 
 		ifr.ifr_flags = IFF_NO_PI;
 
+#if defined(IFF_MULTI_QUEUE)
+		const bool multi_queue = (m_desired_queue_count > 1);
+
+		if (multi_queue)
+		{
+			ifr.ifr_flags |= IFF_MULTI_QUEUE;
+		}
+#else
+		const bool multi_queue = false;
+#endif
+
 #if defined(IFF_ONE_QUEUE) && defined(SIOCSIFTXQLEN)
-		ifr.ifr_flags |= IFF_ONE_QUEUE;
+		if (!multi_queue)
+		{
+			ifr.ifr_flags |= IFF_ONE_QUEUE;
+		}
 #endif
 
 		if (layer() == tap_adapter_layer::ethernet)
@@ -296,6 +310,42 @@ namespace asiotap
 			return;
 		}
 
+#if defined(TUNSETOFFLOAD) && defined(TUN_F_CSUM)
+		// Negotiate checksum offload with the driver: when accepted, the
+		// kernel hands packets to us - and takes them from us - with their
+		// transport checksum possibly unfinished, so frames synthesized for
+		// local delivery can skip the software checksum pass.
+		set_checksum_offload(::ioctl(device.native_handle(), TUNSETOFFLOAD, TUN_F_CSUM) >= 0);
+#endif
+
+		std::vector<descriptor_handler> queue_devices;
+
+#if defined(IFF_MULTI_QUEUE)
+		if (multi_queue)
+		{
+			// Attach the remaining queues to the same device. If the driver
+			// refuses at some point, we simply run with the queues we got.
+			for (size_t queue = 1; queue < m_desired_queue_count; ++queue)
+			{
+				descriptor_handler queue_device = open_device(dev_name, ec);
+
+				if (!queue_device.valid())
+				{
+					ec = boost::system::error_code();
+
+					break;
+				}
+
+				if (::ioctl(queue_device.native_handle(), TUNSETIFF, (void *)&ifr) < 0)
+				{
+					break;
+				}
+
+				queue_devices.push_back(std::move(queue_device));
+			}
+		}
+#endif
+
 		descriptor_handler socket = open_socket(AF_INET, ec);
 
 		if (!socket.valid())
@@ -333,9 +383,9 @@ namespace asiotap
 				return;
 			}
 
-			osi::ethernet_address _ethernet_address;
-			std::memcpy(_ethernet_address.data().data(), netifr.ifr_hwaddr.sa_data, _ethernet_address.data().size());
-			set_ethernet_address(_ethernet_address);
+			osi::ethernet_address::data_type _ethernet_address_data;
+			std::memcpy(_ethernet_address_data.data(), netifr.ifr_hwaddr.sa_data, _ethernet_address_data.size());
+			set_ethernet_address(osi::ethernet_address(_ethernet_address_data));
 		}
 
 		set_name(ifr.ifr_name);
@@ -443,9 +493,9 @@ namespace asiotap
 
 				if (sdl->sdl_type == IFT_ETHER)
 				{
-					osi::ethernet_address _ethernet_address;
-					std::memcpy(_ethernet_address.data().data(), LLADDR(sdl), ethernet_address().data().size());
-					set_ethernet_address(_ethernet_address);
+					osi::ethernet_address::data_type _ethernet_address_data;
+					std::memcpy(_ethernet_address_data.data(), LLADDR(sdl), _ethernet_address_data.size());
+					set_ethernet_address(osi::ethernet_address(_ethernet_address_data));
 
 					break;
 				}
@@ -459,6 +509,37 @@ namespace asiotap
 		{
 			return;
 		}
+
+		// The batch read path relies on non-blocking reads to drain the
+		// descriptor without ever blocking the io_service thread.
+		if (descriptor().non_blocking(true, ec))
+		{
+			return;
+		}
+
+#if defined(LINUX)
+		m_queues.clear();
+		m_queues.reserve(queue_devices.size());
+
+		for (auto&& queue_device : queue_devices)
+		{
+			m_queues.emplace_back(get_io_service());
+
+			if (m_queues.back().assign(queue_device.release(), ec))
+			{
+				close_queues();
+
+				return;
+			}
+
+			if (m_queues.back().non_blocking(true, ec))
+			{
+				close_queues();
+
+				return;
+			}
+		}
+#endif
 	}
 
 	void posix_tap_adapter::open(const std::string& _name)
@@ -849,4 +930,26 @@ namespace asiotap
 		}
 #endif
 	}
+
+	tap_adapter_statistics posix_tap_adapter::interface_statistics()
+	{
+		tap_adapter_statistics result;
+
+#ifdef LINUX
+		netlinkplus::manager manager(get_io_service());
+
+		const netlinkplus::interface_stats_entry stats = manager.get_interface_stats(netlinkplus::interface_entry(name()));
+
+		result.rx_packets = stats.rx_packets;
+		result.tx_packets = stats.tx_packets;
+		result.rx_bytes = stats.rx_bytes;
+		result.tx_bytes = stats.tx_bytes;
+		result.rx_errors = stats.rx_errors;
+		result.tx_errors = stats.tx_errors;
+		result.rx_dropped = stats.rx_dropped;
+		result.tx_dropped = stats.tx_dropped;
+#endif
+
+		return result;
+	}
 }
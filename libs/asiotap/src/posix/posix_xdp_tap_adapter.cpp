@@ -0,0 +1,463 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file posix_xdp_tap_adapter.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief An AF_XDP kernel-bypass adapter class.
+ */
+
+#include "posix/posix_xdp_tap_adapter.hpp"
+
+#if defined(LINUX) && defined(USE_XDP)
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <bpf/xsk.h>
+
+#include <netlinkplus/manager.hpp>
+
+namespace asiotap
+{
+	struct posix_xdp_tap_adapter::xdp_state
+	{
+		xdp_state() :
+			umem_area(nullptr),
+			umem(nullptr),
+			xsk(nullptr)
+		{
+			std::memset(&fill, 0x00, sizeof(fill));
+			std::memset(&comp, 0x00, sizeof(comp));
+			std::memset(&rx, 0x00, sizeof(rx));
+			std::memset(&tx, 0x00, sizeof(tx));
+		}
+
+		void* umem_area;
+		xsk_umem* umem;
+		xsk_socket* xsk;
+		xsk_ring_prod fill;
+		xsk_ring_cons comp;
+		xsk_ring_cons rx;
+		xsk_ring_prod tx;
+
+		// The UMEM slots currently available for TX.
+		std::vector<uint64_t> free_frames;
+	};
+
+	posix_xdp_tap_adapter::posix_xdp_tap_adapter(boost::asio::io_service& _io_service) :
+		base_tap_adapter(_io_service, tap_adapter_layer::ethernet)
+	{
+	}
+
+	posix_xdp_tap_adapter::~posix_xdp_tap_adapter()
+	{
+		boost::system::error_code ec;
+
+		close(ec);
+
+		// We do nothing with the error code as errors can happen legitimately.
+	}
+
+	void posix_xdp_tap_adapter::open(const std::string& _name, size_t queue_id, boost::system::error_code& ec)
+	{
+		ec = boost::system::error_code();
+
+		std::unique_ptr<xdp_state> state(new xdp_state());
+
+		const size_t umem_size = FRAME_COUNT * FRAME_SIZE;
+
+		if (::posix_memalign(&state->umem_area, static_cast<size_t>(::sysconf(_SC_PAGESIZE)), umem_size) != 0)
+		{
+			ec = boost::system::error_code(ENOMEM, boost::system::system_category());
+
+			return;
+		}
+
+		int result = ::xsk_umem__create(&state->umem, state->umem_area, umem_size, &state->fill, &state->comp, nullptr);
+
+		if (result < 0)
+		{
+			::free(state->umem_area);
+
+			ec = boost::system::error_code(-result, boost::system::system_category());
+
+			return;
+		}
+
+		xsk_socket_config config;
+
+		std::memset(&config, 0x00, sizeof(config));
+
+		config.rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS;
+		config.tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS;
+
+		// No bind flags: the kernel negotiates zero-copy with the driver
+		// when it can and falls back to copy mode otherwise.
+		result = ::xsk_socket__create(&state->xsk, _name.c_str(), static_cast<uint32_t>(queue_id), state->umem, &state->rx, &state->tx, &config);
+
+		if (result < 0)
+		{
+			::xsk_umem__delete(state->umem);
+			::free(state->umem_area);
+
+			ec = boost::system::error_code(-result, boost::system::system_category());
+
+			return;
+		}
+
+		// Half the UMEM slots pre-arm the fill ring so the kernel always
+		// has somewhere to land RX frames; the other half is the TX pool.
+		const size_t rx_slots = FRAME_COUNT / 2;
+
+		uint32_t fill_idx = 0;
+		const size_t reserved = ::xsk_ring_prod__reserve(&state->fill, rx_slots, &fill_idx);
+
+		for (size_t i = 0; i < reserved; ++i)
+		{
+			*::xsk_ring_prod__fill_addr(&state->fill, fill_idx + i) = static_cast<uint64_t>(i * FRAME_SIZE);
+		}
+
+		::xsk_ring_prod__submit(&state->fill, reserved);
+
+		state->free_frames.reserve(FRAME_COUNT - rx_slots);
+
+		for (size_t i = rx_slots; i < FRAME_COUNT; ++i)
+		{
+			state->free_frames.push_back(static_cast<uint64_t>(i * FRAME_SIZE));
+		}
+
+		// The reactor watches a duplicate of the AF_XDP descriptor: the
+		// original stays owned by the socket so both can be closed exactly
+		// once.
+		descriptor().assign(::dup(::xsk_socket__fd(state->xsk)), ec);
+
+		if (ec)
+		{
+			::xsk_socket__delete(state->xsk);
+			::xsk_umem__delete(state->umem);
+			::free(state->umem_area);
+
+			return;
+		}
+
+		m_state = std::move(state);
+
+		set_name(_name);
+
+		try
+		{
+			read_interface_attributes(_name);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			ec = ex.code();
+
+			boost::system::error_code close_ec;
+
+			close(close_ec);
+		}
+	}
+
+	void posix_xdp_tap_adapter::open(const std::string& _name, size_t queue_id)
+	{
+		boost::system::error_code ec;
+
+		open(_name, queue_id, ec);
+
+		if (ec)
+		{
+			throw boost::system::system_error(ec);
+		}
+	}
+
+	void posix_xdp_tap_adapter::close()
+	{
+		boost::system::error_code ec;
+
+		if (close(ec))
+		{
+			throw boost::system::system_error(ec);
+		}
+	}
+
+	boost::system::error_code posix_xdp_tap_adapter::close(boost::system::error_code& ec)
+	{
+		ec = boost::system::error_code();
+
+		if (is_open())
+		{
+			base_tap_adapter::close(ec);
+		}
+
+		destroy_socket();
+
+		return ec;
+	}
+
+	void posix_xdp_tap_adapter::destroy_socket()
+	{
+		if (m_state)
+		{
+			if (m_state->xsk)
+			{
+				::xsk_socket__delete(m_state->xsk);
+			}
+
+			if (m_state->umem)
+			{
+				::xsk_umem__delete(m_state->umem);
+			}
+
+			if (m_state->umem_area)
+			{
+				::free(m_state->umem_area);
+			}
+
+			m_state.reset();
+		}
+	}
+
+	void posix_xdp_tap_adapter::do_receive_frames(const std::vector<boost::asio::mutable_buffer>& frame_buffers, std::vector<size_t>& frame_sizes, boost::system::error_code& ec)
+	{
+		ec = boost::system::error_code();
+
+		if (!m_state)
+		{
+			ec = boost::asio::error::bad_descriptor;
+
+			return;
+		}
+
+		uint32_t rx_idx = 0;
+		const size_t available = ::xsk_ring_cons__peek(&m_state->rx, frame_buffers.size(), &rx_idx);
+
+		if (available == 0)
+		{
+			return;
+		}
+
+		// The drained slots are handed back to the fill ring in the same
+		// pass, while their descriptors are still valid.
+		uint32_t fill_idx = 0;
+		const size_t refill = ::xsk_ring_prod__reserve(&m_state->fill, available, &fill_idx);
+
+		frame_sizes.reserve(available);
+
+		for (size_t i = 0; i < available; ++i)
+		{
+			const xdp_desc* const desc = ::xsk_ring_cons__rx_desc(&m_state->rx, rx_idx + i);
+			const void* const frame = ::xsk_umem__get_data(m_state->umem_area, desc->addr);
+			const size_t count = std::min(static_cast<size_t>(desc->len), boost::asio::buffer_size(frame_buffers[i]));
+
+			std::memcpy(boost::asio::buffer_cast<uint8_t*>(frame_buffers[i]), frame, count);
+
+			frame_sizes.push_back(count);
+
+			if (i < refill)
+			{
+				*::xsk_ring_prod__fill_addr(&m_state->fill, fill_idx + i) = desc->addr;
+			}
+		}
+
+		::xsk_ring_cons__release(&m_state->rx, available);
+		::xsk_ring_prod__submit(&m_state->fill, refill);
+	}
+
+	bool posix_xdp_tap_adapter::do_receive_frame(const boost::asio::mutable_buffer& frame_buffer, size_t& count, boost::system::error_code& ec)
+	{
+		const std::vector<boost::asio::mutable_buffer> frame_buffers(1, frame_buffer);
+		std::vector<size_t> frame_sizes;
+
+		do_receive_frames(frame_buffers, frame_sizes, ec);
+
+		if (frame_sizes.empty())
+		{
+			return false;
+		}
+
+		count = frame_sizes.front();
+
+		return true;
+	}
+
+	size_t posix_xdp_tap_adapter::do_transmit(const std::vector<boost::asio::const_buffer>& buffers, boost::system::error_code& ec)
+	{
+		ec = boost::system::error_code();
+
+		if (!m_state)
+		{
+			ec = boost::asio::error::bad_descriptor;
+
+			return 0;
+		}
+
+		// Completions are reaped first: every acknowledged TX slot goes
+		// back to the pool before a new one is claimed.
+		uint32_t comp_idx = 0;
+		const size_t completed = ::xsk_ring_cons__peek(&m_state->comp, FRAME_COUNT, &comp_idx);
+
+		for (size_t i = 0; i < completed; ++i)
+		{
+			m_state->free_frames.push_back(*::xsk_ring_cons__comp_addr(&m_state->comp, comp_idx + i));
+		}
+
+		if (completed > 0)
+		{
+			::xsk_ring_cons__release(&m_state->comp, completed);
+		}
+
+		size_t size = 0;
+
+		for (auto&& buffer : buffers)
+		{
+			size += boost::asio::buffer_size(buffer);
+		}
+
+		if (size > FRAME_SIZE)
+		{
+			ec = boost::asio::error::message_size;
+
+			return 0;
+		}
+
+		uint32_t tx_idx = 0;
+
+		if (m_state->free_frames.empty() || (::xsk_ring_prod__reserve(&m_state->tx, 1, &tx_idx) != 1))
+		{
+			ec = boost::asio::error::no_buffer_space;
+
+			return 0;
+		}
+
+		const uint64_t addr = m_state->free_frames.back();
+		m_state->free_frames.pop_back();
+
+		uint8_t* const frame = static_cast<uint8_t*>(::xsk_umem__get_data(m_state->umem_area, addr));
+
+		size_t offset = 0;
+
+		for (auto&& buffer : buffers)
+		{
+			std::memcpy(frame + offset, boost::asio::buffer_cast<const uint8_t*>(buffer), boost::asio::buffer_size(buffer));
+
+			offset += boost::asio::buffer_size(buffer);
+		}
+
+		xdp_desc* const desc = ::xsk_ring_prod__tx_desc(&m_state->tx, tx_idx);
+
+		desc->addr = addr;
+		desc->len = static_cast<uint32_t>(offset);
+		desc->options = 0;
+
+		::xsk_ring_prod__submit(&m_state->tx, 1);
+
+		// Kick the kernel so the frame leaves right away.
+		::sendto(::xsk_socket__fd(m_state->xsk), nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+
+		return offset;
+	}
+
+	void posix_xdp_tap_adapter::read_interface_attributes(const std::string& _name)
+	{
+		const int socket_fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+		if (socket_fd < 0)
+		{
+			throw boost::system::system_error(errno, boost::system::system_category());
+		}
+
+		struct ifreq netifr {};
+
+		::strncpy(netifr.ifr_name, _name.c_str(), IFNAMSIZ - 1);
+
+		if (::ioctl(socket_fd, SIOCGIFMTU, (void*)&netifr) < 0)
+		{
+			const int error = errno;
+
+			::close(socket_fd);
+
+			throw boost::system::system_error(error, boost::system::system_category());
+		}
+
+		set_mtu(netifr.ifr_mtu);
+
+		if (::ioctl(socket_fd, SIOCGIFHWADDR, (void*)&netifr) < 0)
+		{
+			const int error = errno;
+
+			::close(socket_fd);
+
+			throw boost::system::system_error(error, boost::system::system_category());
+		}
+
+		osi::ethernet_address::data_type _ethernet_address_data;
+		std::memcpy(_ethernet_address_data.data(), netifr.ifr_hwaddr.sa_data, _ethernet_address_data.size());
+		set_ethernet_address(osi::ethernet_address(_ethernet_address_data));
+
+		::close(socket_fd);
+	}
+
+	tap_adapter_statistics posix_xdp_tap_adapter::interface_statistics()
+	{
+		tap_adapter_statistics result;
+
+		netlinkplus::manager manager(get_io_service());
+
+		const netlinkplus::interface_stats_entry stats = manager.get_interface_stats(netlinkplus::interface_entry(name()));
+
+		result.rx_packets = stats.rx_packets;
+		result.tx_packets = stats.tx_packets;
+		result.rx_bytes = stats.rx_bytes;
+		result.tx_bytes = stats.tx_bytes;
+		result.rx_errors = stats.rx_errors;
+		result.tx_errors = stats.tx_errors;
+		result.rx_dropped = stats.rx_dropped;
+		result.tx_dropped = stats.tx_dropped;
+
+		return result;
+	}
+}
+
+#endif /* LINUX && USE_XDP */
@@ -44,13 +44,45 @@
 
 #include "osi/tcp_mss_morpher.hpp"
 
+#include "osi/checksum_helper.hpp"
+
 namespace asiotap
 {
 	namespace osi
 	{
 		namespace {
+			uint32_t fnv1a(const uint8_t* buf, size_t len, uint32_t hash) {
+				for (size_t i = 0; i < len; ++i) {
+					hash = (hash ^ buf[i]) * 16777619UL;
+				}
+
+				return hash;
+			}
+
+			uint32_t flow_hash(const_helper<ipv4_frame> ip_helper, const_helper<tcp_frame> tcp_helper) {
+				uint32_t hash = 2166136261UL;
+
+				hash = fnv1a(reinterpret_cast<const uint8_t*>(&ip_helper.frame().source), sizeof(ip_helper.frame().source), hash);
+				hash = fnv1a(reinterpret_cast<const uint8_t*>(&ip_helper.frame().destination), sizeof(ip_helper.frame().destination), hash);
+				hash = fnv1a(reinterpret_cast<const uint8_t*>(&tcp_helper.frame().source), sizeof(uint16_t) * 2, hash);
+
+				return hash;
+			}
+
+			uint32_t flow_hash(const_helper<ipv6_frame> ip_helper, const_helper<tcp_frame> tcp_helper) {
+				uint32_t hash = 2166136261UL;
+
+				hash = fnv1a(reinterpret_cast<const uint8_t*>(&ip_helper.frame().source), sizeof(ip_helper.frame().source), hash);
+				hash = fnv1a(reinterpret_cast<const uint8_t*>(&ip_helper.frame().destination), sizeof(ip_helper.frame().destination), hash);
+				hash = fnv1a(reinterpret_cast<const uint8_t*>(&tcp_helper.frame().source), sizeof(uint16_t) * 2, hash);
+
+				return hash;
+			}
+
 			template <typename OSIHelperType>
 			void generic_handle(uint16_t max_mss, OSIHelperType ip_helper, mutable_helper<tcp_frame> tcp_helper) {
+				static_cast<void>(ip_helper);
+
 				if (tcp_helper.syn_flag()) {
 					for (auto option = tcp_helper.first_option(); option.valid(); option = option.next_option()) {
 						if (option.kind() == TCP_OPTION_END) {
@@ -63,9 +95,25 @@ namespace asiotap
 								uint16_t mss = ntohs(*boost::asio::buffer_cast<uint16_t*>(value));
 
 								if (mss > max_mss) {
-									*boost::asio::buffer_cast<uint16_t*>(value) = htons(max_mss);
-									tcp_helper.set_checksum(0x0000);
-									tcp_helper.set_checksum(tcp_helper.compute_checksum(ip_helper));
+									uint16_t old_mss_value = *boost::asio::buffer_cast<uint16_t*>(value);
+									uint16_t new_mss_value = htons(max_mss);
+
+									*boost::asio::buffer_cast<uint16_t*>(value) = new_mss_value;
+
+									const size_t value_offset = boost::asio::buffer_cast<const uint8_t*>(value) - boost::asio::buffer_cast<const uint8_t*>(tcp_helper.buffer());
+
+									if ((value_offset % 2) != 0) {
+										// A NOP before the option puts the value at an odd
+										// offset: its two bytes then straddle two checksum
+										// words and contribute to the sum byte-swapped. The
+										// pseudo-header is even-sized, so parity relative to
+										// the TCP header start is parity in the coverage.
+										old_mss_value = static_cast<uint16_t>((old_mss_value << 8) | (old_mss_value >> 8));
+										new_mss_value = static_cast<uint16_t>((new_mss_value << 8) | (new_mss_value >> 8));
+									}
+
+									// Only two bytes changed: fold the difference into the existing checksum instead of recomputing it over the whole segment.
+									tcp_helper.set_checksum(checksum_helper::recompute(tcp_helper.checksum(), old_mss_value, new_mss_value));
 								}
 							}
 
@@ -76,11 +124,43 @@ namespace asiotap
 			}
 		}
 
+		bool tcp_mss_morpher::should_skip(uint32_t flow, bool syn) {
+			// Zero marks an empty slot, so a flow never hashes to it.
+			if (flow == 0) {
+				flow = 1;
+			}
+
+			uint32_t& slot = m_established_flows[flow % FLOW_CACHE_SIZE];
+
+			if (slot == flow) {
+				// The flow is known to be past its SYN exchange.
+				return true;
+			}
+
+			if (!syn) {
+				// First data segment of the flow: note it so the next ones
+				// bypass the flag check too.
+				slot = flow;
+
+				return true;
+			}
+
+			return false;
+		}
+
 		void tcp_mss_morpher::handle(const_helper<ipv4_frame> ipv4_helper, mutable_helper<tcp_frame> tcp_helper) {
+			if (should_skip(flow_hash(ipv4_helper, tcp_helper), tcp_helper.syn_flag())) {
+				return;
+			}
+
 			generic_handle(static_cast<uint16_t>(m_max_mss), ipv4_helper, tcp_helper);
 		}
 
 		void tcp_mss_morpher::handle(const_helper<ipv6_frame> ipv6_helper, mutable_helper<tcp_frame> tcp_helper) {
+			if (should_skip(flow_hash(ipv6_helper, tcp_helper), tcp_helper.syn_flag())) {
+				return;
+			}
+
 			generic_handle(static_cast<uint16_t>(m_max_mss), ipv6_helper, tcp_helper);
 		}
 	}
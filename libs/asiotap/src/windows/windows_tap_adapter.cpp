@@ -48,8 +48,10 @@
 
 #include <boost/optional.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <iterator>
+#include <mutex>
 
 #include <winioctl.h>
 #include <iphlpapi.h>
@@ -125,7 +127,7 @@ namespace asiotap
 			return network_connections_map;
 		}
 
-		guid_map_type enumerate_tap_adapters()
+		guid_map_type enumerate_tap_adapters_now()
 		{
 			guid_map_type tap_adapters_map;
 
@@ -149,8 +151,58 @@ namespace asiotap
 			return tap_adapters_map;
 		}
 
+		// The tap adapters enumerated ahead of time by
+		// prefetch_enumeration(), consumed by the next enumeration so that
+		// a service start overlaps the registry walk with its configuration
+		// loading.
+		std::mutex prefetch_mutex;
+		boost::optional<guid_map_type> prefetched_tap_adapters;
+
+		// The last adapter successfully opened by this process: opening it
+		// again skips the registry walk entirely. The display name may go
+		// stale if the connection is renamed meanwhile, which only affects
+		// its cosmetic uses.
+		std::mutex last_adapter_mutex;
+		guid_pair_type last_adapter;
+
+		guid_map_type enumerate_tap_adapters()
+		{
+			{
+				std::lock_guard<std::mutex> lock(prefetch_mutex);
+
+				if (prefetched_tap_adapters)
+				{
+					// Consumed once: a later enumeration must observe the
+					// current state of the system.
+					const guid_map_type result = *prefetched_tap_adapters;
+
+					prefetched_tap_adapters = boost::none;
+
+					return result;
+				}
+			}
+
+			return enumerate_tap_adapters_now();
+		}
+
+		void remember_tap_adapter(const guid_pair_type& adapter)
+		{
+			std::lock_guard<std::mutex> lock(last_adapter_mutex);
+
+			last_adapter = adapter;
+		}
+
 		guid_pair_type find_tap_adapter_by_guid(const std::string& guid)
 		{
+			{
+				std::lock_guard<std::mutex> lock(last_adapter_mutex);
+
+				if (!last_adapter.first.empty() && (last_adapter.first == guid))
+				{
+					return last_adapter;
+				}
+			}
+
 			const guid_map_type tap_adapters_map = enumerate_tap_adapters();
 
 			const guid_map_type::const_iterator it = tap_adapters_map.find(guid);
@@ -169,8 +221,40 @@ namespace asiotap
 		return enumerate_tap_adapters();
 	}
 
+	void windows_tap_adapter::prefetch_enumeration()
+	{
+		const guid_map_type tap_adapters_map = enumerate_tap_adapters_now();
+
+		std::lock_guard<std::mutex> lock(prefetch_mutex);
+
+		prefetched_tap_adapters = tap_adapters_map;
+	}
+
 	void windows_tap_adapter::open(boost::system::error_code& ec)
 	{
+		guid_pair_type cached;
+
+		{
+			std::lock_guard<std::mutex> lock(last_adapter_mutex);
+
+			cached = last_adapter;
+		}
+
+		if (!cached.first.empty())
+		{
+			// The adapter used last time is tried first, without any
+			// enumeration; a failure forgets it and falls back to the full
+			// scan.
+			open(cached.first, ec);
+
+			if (!ec)
+			{
+				return;
+			}
+
+			remember_tap_adapter(guid_pair_type());
+		}
+
 		const guid_map_type tap_adapters_map = enumerate_tap_adapters();
 
 		if (tap_adapters_map.empty()) {
@@ -284,9 +368,9 @@ namespace asiotap
 						return;
 					}
 
-					osi::ethernet_address _ethernet_address;
-					std::memcpy(_ethernet_address.data().data(), pi->Address, pi->AddressLength);
-					set_ethernet_address(_ethernet_address);
+					osi::ethernet_address::data_type _ethernet_address_data;
+					std::memcpy(_ethernet_address_data.data(), pi->Address, pi->AddressLength);
+					set_ethernet_address(osi::ethernet_address(_ethernet_address_data));
 
 					DWORD read_mtu;
 					DWORD len;
@@ -300,6 +384,8 @@ namespace asiotap
 
 					set_mtu(static_cast<size_t>(read_mtu));
 
+					remember_tap_adapter(adapter);
+
 					break;
 				}
 			}
@@ -532,4 +618,135 @@ namespace asiotap
 		}
 	}
 
+	tap_adapter_statistics windows_tap_adapter::interface_statistics()
+	{
+		MIB_IF_ROW2 row{};
+
+		row.InterfaceLuid = m_interface_luid;
+
+		const auto error = ::GetIfEntry2(&row);
+
+		if (error != NO_ERROR)
+		{
+			throw boost::system::system_error(error, boost::system::system_category());
+		}
+
+		tap_adapter_statistics result;
+
+		result.rx_packets = row.InUcastPkts + row.InNUcastPkts;
+		result.tx_packets = row.OutUcastPkts + row.OutNUcastPkts;
+		result.rx_bytes = row.InOctets;
+		result.tx_bytes = row.OutOctets;
+		result.rx_errors = row.InErrors;
+		result.tx_errors = row.OutErrors;
+		result.rx_dropped = row.InDiscards;
+		result.tx_dropped = row.OutDiscards;
+
+		return result;
+	}
+
+	void windows_tap_adapter::do_read_some_frames(const std::vector<boost::asio::mutable_buffer>& frame_buffers, read_frames_handler_type handler)
+	{
+		// do_read_some_frames() is executed within the read strand so this is safe.
+		m_pending_read_buffers = frame_buffers;
+		m_pending_read_handler = handler;
+
+		if (!m_read_ring_started)
+		{
+			m_read_ring_started = true;
+
+			for (size_t slot = 0; slot < READ_RING_SIZE; ++slot)
+			{
+				do_post_ring_read(slot);
+			}
+		}
+
+		do_deliver_frames();
+	}
+
+	void windows_tap_adapter::do_post_ring_read(size_t slot)
+	{
+		descriptor().async_read_some(
+			boost::asio::buffer(m_read_ring_slots[slot].buffer),
+			m_read_strand.wrap(
+				boost::bind(
+					&windows_tap_adapter::do_handle_ring_read,
+					this,
+					slot,
+					boost::asio::placeholders::error,
+					boost::asio::placeholders::bytes_transferred
+				)
+			)
+		);
+	}
+
+	void windows_tap_adapter::do_handle_ring_read(size_t slot, const boost::system::error_code& ec, size_t count)
+	{
+		// do_handle_ring_read() is executed within the read strand so this is safe.
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+
+		if (ec)
+		{
+			// The slot is not re-posted: the ring drains and the error is
+			// reported once the completed frames were delivered.
+			m_read_ring_error = ec;
+		}
+		else
+		{
+			m_read_ring_completions.push_back(std::make_pair(slot, count));
+		}
+
+		do_deliver_frames();
+	}
+
+	void windows_tap_adapter::do_deliver_frames()
+	{
+		if (!m_pending_read_handler)
+		{
+			return;
+		}
+
+		std::vector<size_t> frame_sizes;
+
+		for (auto&& frame_buffer : m_pending_read_buffers)
+		{
+			if (m_read_ring_completions.empty())
+			{
+				break;
+			}
+
+			const size_t slot = m_read_ring_completions.front().first;
+			const size_t count = std::min(m_read_ring_completions.front().second, boost::asio::buffer_size(frame_buffer));
+
+			m_read_ring_completions.pop_front();
+
+			std::memcpy(boost::asio::buffer_cast<uint8_t*>(frame_buffer), m_read_ring_slots[slot].buffer.data(), count);
+			frame_sizes.push_back(count);
+
+			// The slot is free again: keep the device busy.
+			do_post_ring_read(slot);
+		}
+
+		if (!frame_sizes.empty())
+		{
+			const read_frames_handler_type handler = m_pending_read_handler;
+			m_pending_read_handler = read_frames_handler_type();
+
+			handler(boost::system::error_code(), frame_sizes);
+		}
+		else if (m_read_ring_error)
+		{
+			const read_frames_handler_type handler = m_pending_read_handler;
+			const boost::system::error_code error = m_read_ring_error;
+
+			m_pending_read_handler = read_frames_handler_type();
+			m_read_ring_error = boost::system::error_code();
+
+			handler(error, frame_sizes);
+		}
+	}
+
 }
@@ -89,6 +89,15 @@ namespace cryptoplus
 					encrypt = 1 /**< \brief Specifies an encryption cipher context. */
 				};
 
+				/**
+				 * \brief An input span, for the scatter-gather update functions.
+				 */
+				struct input_span
+				{
+					const void* data; /**< \brief A pointer to the data. */
+					size_t size; /**< \brief The size of the data. */
+				};
+
 				/**
 				 * \brief Create a new cipher_context.
 				 */
@@ -243,6 +252,27 @@ namespace cryptoplus
 				 */
 				size_t update(void* out, size_t out_len, const void* in, size_t in_len);
 
+				/**
+				 * \brief Feed additional authenticated data to the cipher_context.
+				 * \param in The additional authenticated data. Cannot be NULL unless in_len is 0.
+				 * \param in_len The length of the in buffer.
+				 *
+				 * The data takes part in the authentication tag computation of AEAD ciphers but produces no output. It must be fed before any call to update().
+				 */
+				void update_aad(const void* in, size_t in_len);
+
+				/**
+				 * \brief Update the cipher_context with several non-contiguous input buffers.
+				 * \param out The output buffer. Should be at least the sum of the input sizes plus algorithm().block_size() bytes long. Cannot be NULL.
+				 * \param out_len The length of the out buffer.
+				 * \param in_begin A pointer to the first input span.
+				 * \param in_end A pointer past the last input span.
+				 * \return The count of bytes written.
+				 *
+				 * The input spans are processed in order, as if they were one contiguous buffer. A span may alias the output region it maps to, which results in an in-place operation.
+				 */
+				size_t update(void* out, size_t out_len, const input_span* in_begin, const input_span* in_end);
+
 				/**
 				 * \brief Update the cipher_context with some data.
 				 * \param out The output buffer. Should be at least in_len + algorithm().block_size() bytes long. Cannot be NULL.
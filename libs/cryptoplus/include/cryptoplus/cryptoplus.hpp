@@ -49,6 +49,9 @@
 
 #include <openssl/evp.h>
 
+#include <string>
+#include <vector>
+
 namespace cryptoplus
 {
 	namespace
@@ -90,6 +93,40 @@ namespace cryptoplus
 #else
 	typedef initializer<_null_function, CRYPTO_cleanup_all_ex_data> crypto_initializer;
 #endif
+
+	/**
+	 * \brief Enumerate the available cryptographic engines.
+	 * \return The list of the engine identifiers.
+	 */
+	std::vector<std::string> enumerate_engines();
+
+	/**
+	 * \brief Pin a cryptographic engine as the default implementation provider.
+	 * \param id The engine identifier, as listed by enumerate_engines().
+	 * \warning If the engine cannot be loaded or initialized, a boost::system::system_error is thrown.
+	 *
+	 * On success, the engine provides every cryptographic method it
+	 * implements, in place of the built-in implementations.
+	 */
+	void pin_engine(const std::string& id);
+
+	/**
+	 * \brief Check whether the processor provides AES instructions.
+	 * \return true if the AES instructions are available. The built-in implementations use them automatically.
+	 */
+	bool cpu_has_aes_instructions();
+
+	/**
+	 * \brief Check whether the processor provides carry-less multiplication, which accelerates the GHASH part of GCM.
+	 * \return true if carry-less multiplication is available.
+	 */
+	bool cpu_has_carryless_multiplication();
+
+	/**
+	 * \brief Describe the AES implementation the built-in provider uses on this host.
+	 * \return A short human-readable description.
+	 */
+	std::string get_aes_implementation();
 }
 
 #endif /* CRYPTOPLUS_CRYPTOPLUS_HPP */
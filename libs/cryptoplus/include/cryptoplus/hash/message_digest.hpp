@@ -54,6 +54,16 @@ namespace cryptoplus
 {
 	namespace hash
 	{
+		class message_digest_context;
+
+		/**
+		 * \brief Get a reusable message digest context for the calling thread.
+		 * \return A thread-local context. Call initialize() on it to reset it for a new computation.
+		 *
+		 * The one-shot message_digest() functions draw from this context, so repeated hashing does not allocate a new EVP_MD_CTX per operation.
+		 */
+		message_digest_context& thread_message_digest_context();
+
 		/**
 		 * \brief Compute a message digest for the given buffer, using the given digest method.
 		 * \param out The output buffer. Must be at least message_digest_size(md) bytes long.
@@ -126,6 +126,8 @@ namespace cryptoplus
 				 * \param impl The engine to use. Default is NULL which indicates that no engine should be used.
 				 *
 				 * The list of the available hash methods depends on the version of OpenSSL and can be found on the man page of EVP_DigestInit().
+				 *
+				 * initialize() may be called again at any time to reset the context for a new computation: the underlying EVP_MD_CTX is reused, not reallocated.
 				 */
 				void initialize(const message_digest_algorithm& algorithm, ENGINE* impl = NULL);
 
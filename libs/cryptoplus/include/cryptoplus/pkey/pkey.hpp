@@ -52,10 +52,72 @@
 #include "dsa_key.hpp"
 #include "dh_key.hpp"
 
+#include <mutex>
+#include <condition_variable>
+#include <iterator>
+
 namespace cryptoplus
 {
 	namespace pkey
 	{
+		/**
+		 * \brief Run a batch of independent verification tasks on a worker pool and wait for their completion.
+		 * \param post A callable that schedules a nullary callable onto a worker pool. It may also invoke it synchronously.
+		 * \param task_begin An iterator to the first verification task. A task is a nullary callable that performs one verification and throws on failure, like rsa_key::verify or pkey-based digest verification.
+		 * \param task_end An iterator past the last verification task.
+		 * \return The count of tasks that completed without throwing.
+		 *
+		 * The tasks are independent and may run concurrently; the call blocks until every task has run.
+		 */
+		template <typename PostFunction, typename TaskIterator>
+		size_t verify_batch(PostFunction post, TaskIterator task_begin, TaskIterator task_end)
+		{
+			std::mutex mutex;
+			std::condition_variable condition;
+			size_t remaining = static_cast<size_t>(std::distance(task_begin, task_end));
+			size_t successes = 0;
+
+			if (remaining == 0)
+			{
+				return 0;
+			}
+
+			for (TaskIterator it = task_begin; it != task_end; ++it)
+			{
+				const typename std::iterator_traits<TaskIterator>::value_type task = *it;
+
+				post([&mutex, &condition, &remaining, &successes, task]() {
+					bool success = true;
+
+					try
+					{
+						task();
+					}
+					catch (...)
+					{
+						success = false;
+					}
+
+					std::lock_guard<std::mutex> lock(mutex);
+
+					if (success)
+					{
+						++successes;
+					}
+
+					if (--remaining == 0)
+					{
+						condition.notify_one();
+					}
+				});
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&remaining]() { return remaining == 0; });
+
+			return successes;
+		}
+
 		/**
 		 * \brief A EVP_PKEY.
 		 *
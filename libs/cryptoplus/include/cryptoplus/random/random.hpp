@@ -67,11 +67,13 @@ namespace cryptoplus
 		void set_randomization_engine(ENGINE* engine);
 
 		/**
-		 * \brief Get truly random bytes.
-		 * \param buf The buffer to fill with the random bytes. Its content will be mixed in the enthropy pool unless disabled at OpenSSL compile time.
+		 * \brief Get random bytes.
+		 * \param buf The buffer to fill with the random bytes.
 		 * \param buf_len The number of random bytes to request. buf must be big enough to hold the data.
 		 * \see get_pseudo_random_bytes
 		 *
+		 * The bytes are drawn from a per-thread deterministic generator that is keyed from OpenSSL's global pool and periodically reseeded from it, so concurrent callers do not contend on the global RAND lock.
+		 *
 		 * If the PRNG was not seeded with enough randomness, the call fails and an exception is thrown.
 		 */
 		void get_random_bytes(void* buf, size_t buf_len);
@@ -211,11 +213,6 @@ namespace cryptoplus
 			throw_error_if_not(RAND_set_rand_engine(engine) != 0);
 		}
 
-		inline void get_random_bytes(void* buf, size_t buf_len)
-		{
-			throw_error_if_not(RAND_bytes(static_cast<unsigned char*>(buf), static_cast<int>(buf_len)) == 1);
-		}
-
 		inline buffer get_random_bytes(size_t cnt)
 		{
 			buffer result(cnt);
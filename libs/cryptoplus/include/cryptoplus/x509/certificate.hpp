@@ -57,6 +57,9 @@
 #include "extension.hpp"
 #include "certificate_request.hpp"
 
+#include <boost/make_shared.hpp>
+#include <boost/optional.hpp>
+
 #include <openssl/x509.h>
 #include <openssl/pem.h>
 
@@ -257,6 +260,18 @@ namespace cryptoplus
 				 */
 				static certificate from_trusted_certificate(bio::bio_ptr bio, pem_passphrase_callback_type callback = NULL, void* callback_arg = NULL);
 
+				/**
+				 * \brief Load every X509 trusted certificate from a PEM bundle, in a single BIO pass.
+				 * \param bio The BIO.
+				 * \param certificates The vector to append the certificates to. Existing elements are left untouched.
+				 * \param callback A callback that will get called whenever a passphrase is needed. Can be NULL, in such case no passphrase is used.
+				 * \param callback_arg An argument that will be passed to callback, if needed.
+				 * \return The count of certificates that were appended to certificates.
+				 *
+				 * Reaching the end of the bundle is not an error: the function simply returns. Any other parsing failure throws.
+				 */
+				static size_t from_trusted_certificate_bundle(bio::bio_ptr bio, std::vector<certificate>& certificates, pem_passphrase_callback_type callback = NULL, void* callback_arg = NULL);
+
 				/**
 				 * \brief Load a X509 certificate in DER format.
 				 * \param file The file.
@@ -284,6 +299,16 @@ namespace cryptoplus
 				 */
 				static certificate from_trusted_certificate(file file, pem_passphrase_callback_type callback = NULL, void* callback_arg = NULL);
 
+				/**
+				 * \brief Load every X509 trusted certificate from a PEM bundle file, in a single BIO pass.
+				 * \param file The file.
+				 * \param certificates The vector to append the certificates to. Existing elements are left untouched.
+				 * \param callback A callback that will get called whenever a passphrase is needed. Can be NULL, in such case no passphrase is used.
+				 * \param callback_arg An argument that will be passed to callback, if needed.
+				 * \return The count of certificates that were appended to certificates.
+				 */
+				static size_t from_trusted_certificate_bundle(file file, std::vector<certificate>& certificates, pem_passphrase_callback_type callback = NULL, void* callback_arg = NULL);
+
 				/**
 				 * \brief Load a X509 certificate in DER format.
 				 * \param buf The buffer.
@@ -380,6 +405,22 @@ namespace cryptoplus
 				 */
 				buffer write_der() const;
 
+				/**
+				 * \brief Get the DER representation of the certificate.
+				 * \return The DER representation, as write_der() would produce it.
+				 *
+				 * The representation is computed on the first call and cached afterwards. All the copies of an instance share the cache and the mutating methods invalidate it. Mutations done through another instance that wraps the same underlying pointer are not detected.
+				 */
+				const buffer& der() const;
+
+				/**
+				 * \brief Get the SHA-256 fingerprint of the certificate.
+				 * \return The SHA-256 message digest of the DER representation.
+				 *
+				 * The fingerprint is cached, just like der().
+				 */
+				const buffer& sha256_fingerprint() const;
+
 				/**
 				 * \brief Clone the certificate instance.
 				 * \return The clone.
@@ -724,7 +765,17 @@ namespace cryptoplus
 
 			private:
 
+				struct representation_cache
+				{
+					boost::optional<buffer> der;
+					boost::optional<buffer> sha256_fingerprint;
+				};
+
 				certificate(pointer _ptr, deleter_type _del);
+
+				void invalidate_representation_cache() const;
+
+				boost::shared_ptr<representation_cache> m_representation_cache;
 		};
 
 		/**
@@ -961,10 +1012,10 @@ namespace cryptoplus
 		{
 			return from_der(buffer_cast<const uint8_t*>(buf), buffer_size(buf));
 		}
-		inline certificate::certificate()
+		inline certificate::certificate() : m_representation_cache(boost::make_shared<representation_cache>())
 		{
 		}
-		inline certificate::certificate(pointer _ptr) : pointer_wrapper<value_type>(_ptr, null_deleter)
+		inline certificate::certificate(pointer _ptr) : pointer_wrapper<value_type>(_ptr, null_deleter), m_representation_cache(boost::make_shared<representation_cache>())
 		{
 		}
 		inline void certificate::write_der(bio::bio_ptr bio) const
@@ -1010,6 +1061,32 @@ namespace cryptoplus
 
 			return result;
 		}
+		inline const buffer& certificate::der() const
+		{
+			if (!m_representation_cache->der)
+			{
+				m_representation_cache->der = write_der();
+			}
+
+			return *m_representation_cache->der;
+		}
+		inline const buffer& certificate::sha256_fingerprint() const
+		{
+			if (!m_representation_cache->sha256_fingerprint)
+			{
+				buffer result(EVP_MAX_MD_SIZE);
+				unsigned int result_len = 0;
+
+				// X509_digest() computes the digest of the DER representation.
+				throw_error_if_not(X509_digest(ptr().get(), EVP_sha256(), buffer_cast<uint8_t*>(result), &result_len) != 0);
+
+				result.data().resize(result_len);
+
+				m_representation_cache->sha256_fingerprint = result;
+			}
+
+			return *m_representation_cache->sha256_fingerprint;
+		}
 		inline certificate certificate::clone() const
 		{
 			return certificate(X509_dup(ptr().get()));
@@ -1062,12 +1139,16 @@ namespace cryptoplus
 		{
 			wrapped_value_type::take_ownership(X509_delete_ext(it.m_owner->ptr().get(), it.m_index));
 
+			invalidate_representation_cache();
+
 			return it;
 		}
 		inline certificate::iterator certificate::erase(iterator it)
 		{
 			wrapped_value_type::take_ownership(X509_delete_ext(it.m_owner->ptr().get(), it.m_index));
 
+			invalidate_representation_cache();
+
 			return it;
 		}
 		inline certificate::const_iterator certificate::erase(const_iterator first, const_iterator last) const
@@ -1163,6 +1244,8 @@ namespace cryptoplus
 		inline void certificate::push_back(wrapped_value_type ext) const
 		{
 			throw_error_if_not(X509_add_ext(ptr().get(), ext.raw(), -1) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline certificate::const_iterator certificate::insert(const_iterator position, wrapped_value_type ext) const
 		{
@@ -1170,6 +1253,8 @@ namespace cryptoplus
 
 			throw_error_if_not(X509_add_ext(ptr().get(), ext.raw(), position.m_index) != 0);
 
+			invalidate_representation_cache();
+
 			return position;
 		}
 		inline certificate::iterator certificate::insert(iterator position, wrapped_value_type ext)
@@ -1178,6 +1263,8 @@ namespace cryptoplus
 
 			throw_error_if_not(X509_add_ext(ptr().get(), ext.raw(), position.m_index) != 0);
 
+			invalidate_representation_cache();
+
 			return position;
 		}
 		inline pkey::pkey certificate::public_key() const
@@ -1187,6 +1274,8 @@ namespace cryptoplus
 		inline void certificate::set_public_key(pkey::pkey pkey) const
 		{
 			throw_error_if_not(X509_set_pubkey(ptr().get(), pkey.raw()) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline name certificate::subject() const
 		{
@@ -1195,6 +1284,8 @@ namespace cryptoplus
 		inline void certificate::set_subject(name _name) const
 		{
 			throw_error_if_not(X509_set_subject_name(ptr().get(), _name.raw()) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline name certificate::issuer() const
 		{
@@ -1203,6 +1294,8 @@ namespace cryptoplus
 		inline void certificate::set_issuer(name _name) const
 		{
 			throw_error_if_not(X509_set_issuer_name(ptr().get(), _name.raw()) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline long certificate::version() const
 		{
@@ -1211,6 +1304,8 @@ namespace cryptoplus
 		inline void certificate::set_version(long _version) const
 		{
 			throw_error_if_not(X509_set_version(ptr().get(), _version) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline asn1::integer certificate::serial_number() const
 		{
@@ -1219,6 +1314,8 @@ namespace cryptoplus
 		inline void certificate::set_serial_number(asn1::integer _serial_number) const
 		{
 			throw_error_if_not(X509_set_serialNumber(ptr().get(), _serial_number.raw()) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline asn1::utctime certificate::not_before() const
 		{
@@ -1227,6 +1324,8 @@ namespace cryptoplus
 		inline void certificate::set_not_before(asn1::utctime _not_before) const
 		{
 			throw_error_if_not(X509_set_notBefore(ptr().get(), _not_before.raw()) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline asn1::utctime certificate::not_after() const
 		{
@@ -1235,6 +1334,8 @@ namespace cryptoplus
 		inline void certificate::set_not_after(asn1::utctime _not_after) const
 		{
 			throw_error_if_not(X509_set_notAfter(ptr().get(), _not_after.raw()) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline bool certificate::verify_public_key(pkey::pkey pkey) const
 		{
@@ -1243,6 +1344,8 @@ namespace cryptoplus
 		inline void certificate::sign(pkey::pkey pkey, hash::message_digest_algorithm algorithm) const
 		{
 			throw_error_if_not(X509_sign(ptr().get(), pkey.raw(), algorithm.raw()) != 0);
+
+			invalidate_representation_cache();
 		}
 		inline bool certificate::verify_private_key(pkey::pkey pkey) const
 		{
@@ -1252,8 +1355,13 @@ namespace cryptoplus
 		{
 			return certificate_request::take_ownership(X509_to_X509_REQ(ptr().get(), pkey.raw(), algorithm.raw()));
 		}
-		inline certificate::certificate(pointer _ptr, deleter_type _del) : pointer_wrapper<value_type>(_ptr, _del)
+		inline certificate::certificate(pointer _ptr, deleter_type _del) : pointer_wrapper<value_type>(_ptr, _del), m_representation_cache(boost::make_shared<representation_cache>())
+		{
+		}
+		inline void certificate::invalidate_representation_cache() const
 		{
+			m_representation_cache->der = boost::none;
+			m_representation_cache->sha256_fingerprint = boost::none;
 		}
 		template <typename _IteratorValueType>
 		inline bool operator==(const certificate::base_iterator<_IteratorValueType>& lhs, const certificate::base_iterator<_IteratorValueType>& rhs)
@@ -50,11 +50,15 @@
 #include "../error/helpers.hpp"
 #include "../bio/bio_ptr.hpp"
 #include "../pkey/pkey.hpp"
+#include "../asn1/integer.hpp"
 #include "../asn1/utctime.hpp"
 #include "../file.hpp"
 #include "name.hpp"
 #include "extension.hpp"
 
+#include <boost/make_shared.hpp>
+#include <boost/optional.hpp>
+
 #include <openssl/x509.h>
 #include <openssl/pem.h>
 
@@ -591,9 +595,36 @@ namespace cryptoplus
 				 */
 				void sign(pkey::pkey pkey, hash::message_digest_algorithm algorithm) const;
 
+				/**
+				 * \brief Get the issuer name.
+				 * \return The issuer name.
+				 * \warning The returned name depends on the certificate_revocation_list instance and will be invalidated as soon as the underlying pointer is changed (or freed).
+				 */
+				name issuer() const;
+
+				/**
+				 * \brief Check whether the specified serial number belongs to a revoked entry.
+				 * \param serial_number The serial number.
+				 * \return true if serial_number is revoked by this certificate_revocation_list.
+				 *
+				 * A sorted index of the revoked serial numbers is built on the first call and shared by all the copies of this instance, so subsequent checks run in logarithmic time. The index reflects the entries as they were on the first call: re-create the instance whenever a new revocation list is loaded.
+				 */
+				bool is_revoked(asn1::integer serial_number) const;
+
 			private:
 
+				typedef std::vector<unsigned char> indexed_serial_type;
+
+				struct revocation_index
+				{
+					boost::optional<std::vector<indexed_serial_type> > serial_numbers;
+				};
+
+				static indexed_serial_type to_indexed_serial(asn1::integer::const_pointer serial_number);
+
 				certificate_revocation_list(pointer _ptr, deleter_type _del);
+
+				boost::shared_ptr<revocation_index> m_revocation_index;
 		};
 
 		/**
@@ -814,10 +845,10 @@ namespace cryptoplus
 		{
 			return from_der(buffer_cast<const uint8_t*>(buf), buffer_size(buf));
 		}
-		inline certificate_revocation_list::certificate_revocation_list()
+		inline certificate_revocation_list::certificate_revocation_list() : m_revocation_index(boost::make_shared<revocation_index>())
 		{
 		}
-		inline certificate_revocation_list::certificate_revocation_list(pointer _ptr) : pointer_wrapper<value_type>(_ptr, null_deleter)
+		inline certificate_revocation_list::certificate_revocation_list(pointer _ptr) : pointer_wrapper<value_type>(_ptr, null_deleter), m_revocation_index(boost::make_shared<revocation_index>())
 		{
 		}
 		inline void certificate_revocation_list::write_der(bio::bio_ptr bio) const
@@ -1045,8 +1076,12 @@ namespace cryptoplus
 		{
 			throw_error_if_not(X509_CRL_sign(ptr().get(), pkey.raw(), algorithm.raw()) != 0);
 		}
-		inline certificate_revocation_list::certificate_revocation_list(pointer _ptr, deleter_type _del) : pointer_wrapper<value_type>(_ptr, _del)
+		inline certificate_revocation_list::certificate_revocation_list(pointer _ptr, deleter_type _del) : pointer_wrapper<value_type>(_ptr, _del), m_revocation_index(boost::make_shared<revocation_index>())
+		{
+		}
+		inline name certificate_revocation_list::issuer() const
 		{
+			return X509_CRL_get_issuer(ptr().get());
 		}
 		template <typename _IteratorValueType>
 		inline bool operator==(const certificate_revocation_list::base_iterator<_IteratorValueType>& lhs, const certificate_revocation_list::base_iterator<_IteratorValueType>& rhs)
@@ -278,6 +278,27 @@ namespace cryptoplus
 				 */
 				unsigned int hash() const;
 
+				/**
+				 * \brief Get the DER encoding of the name, cached.
+				 * \return The cached DER encoding.
+				 *
+				 * The encoding is computed on first use and kept until the
+				 * name is mutated through this instance. Copies share the
+				 * underlying X509_NAME but not the cache: mutating the name
+				 * through another copy leaves this cache stale.
+				 */
+				const buffer& der_encoding() const;
+
+				/**
+				 * \brief Get a 64-bit hash of the DER encoding, cached.
+				 * \return The hash.
+				 *
+				 * Different hashes imply different encodings, so repeated
+				 * comparisons of long-lived names reduce to integer compares
+				 * with only the rare equal case doing a byte comparison.
+				 */
+				uint64_t der_hash() const;
+
 				/**
 				 * \brief Get a one-line human readable representation of the X509 name.
 				 * \param max_size The maximum size of the result. Default is 256.
@@ -645,6 +666,12 @@ namespace cryptoplus
 			private:
 
 				name(pointer _ptr, deleter_type _del);
+
+				void invalidate_der_cache() const;
+
+				mutable buffer m_der_encoding;
+				mutable uint64_t m_der_hash;
+				mutable bool m_der_cache_valid;
 		};
 
 		/**
@@ -865,10 +892,15 @@ namespace cryptoplus
 		{
 			return from_der(buffer_cast<const uint8_t*>(buf), buffer_size(buf));
 		}
-		inline name::name()
+		inline name::name() :
+			m_der_hash(0),
+			m_der_cache_valid(false)
 		{
 		}
-		inline name::name(pointer _ptr) : pointer_wrapper<value_type>(_ptr, null_deleter)
+		inline name::name(pointer _ptr) :
+			pointer_wrapper<value_type>(_ptr, null_deleter),
+			m_der_hash(0),
+			m_der_cache_valid(false)
 		{
 		}
 		inline size_t name::write_der(void* buf) const
@@ -898,6 +930,39 @@ namespace cryptoplus
 		{
 			return X509_NAME_hash(ptr().get());
 		}
+		inline const buffer& name::der_encoding() const
+		{
+			if (!m_der_cache_valid)
+			{
+				m_der_encoding = write_der();
+
+				// FNV-1a, 64 bits: cheap to compute, and a collision only
+				// costs one byte comparison.
+				uint64_t hash = 0xcbf29ce484222325ULL;
+
+				const uint8_t* const data = buffer_cast<const uint8_t*>(m_der_encoding);
+
+				for (size_t i = 0; i < buffer_size(m_der_encoding); ++i)
+				{
+					hash = (hash ^ data[i]) * 0x100000001b3ULL;
+				}
+
+				m_der_hash = hash;
+				m_der_cache_valid = true;
+			}
+
+			return m_der_encoding;
+		}
+		inline uint64_t name::der_hash() const
+		{
+			der_encoding();
+
+			return m_der_hash;
+		}
+		inline void name::invalidate_der_cache() const
+		{
+			m_der_cache_valid = false;
+		}
 		inline std::string name::oneline(size_t max_size) const
 		{
 			std::string result(max_size + 1, ' ');
@@ -956,12 +1021,16 @@ namespace cryptoplus
 		}
 		inline name::const_iterator name::erase(const_iterator it) const
 		{
+			invalidate_der_cache();
+
 			wrapped_value_type::take_ownership(X509_NAME_delete_entry(it.m_owner->ptr().get(), it.m_index));
 
 			return it;
 		}
 		inline name::iterator name::erase(iterator it)
 		{
+			invalidate_der_cache();
+
 			wrapped_value_type::take_ownership(X509_NAME_delete_entry(it.m_owner->ptr().get(), it.m_index));
 
 			return it;
@@ -1034,24 +1103,34 @@ namespace cryptoplus
 		}
 		inline void name::push_back(wrapped_value_type entry) const
 		{
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry(ptr().get(), entry.raw(), -1, 0) != 0);
 		}
 		inline void name::push_back(const std::string& field, int type, const void* data, size_t data_len, int set) const
 		{
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_txt(ptr().get(), field.c_str(), type, static_cast<const unsigned char*>(data), static_cast<int>(data_len), -1, set) != 0);
 		}
 		inline void name::push_back(asn1::object object, int type, const void* data, size_t data_len, int set) const
 		{
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_OBJ(ptr().get(), object.raw(), type, static_cast<unsigned char*>(const_cast<void*>(data)), static_cast<int>(data_len), -1, set) != 0);
 		}
 		inline void name::push_back(int nid, int type, const void* data, size_t data_len, int set) const
 		{
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_NID(ptr().get(), nid, type, static_cast<unsigned char*>(const_cast<void*>(data)), static_cast<int>(data_len), -1, set) != 0);
 		}
 		inline name::const_iterator name::insert(const_iterator position, wrapped_value_type entry) const
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry(ptr().get(), entry.raw(), position.m_index, 0) != 0);
 
 			return position;
@@ -1060,6 +1139,8 @@ namespace cryptoplus
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry(ptr().get(), entry.raw(), position.m_index, 0) != 0);
 
 			return position;
@@ -1068,48 +1149,64 @@ namespace cryptoplus
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry(ptr().get(), entry.raw(), position.m_index, set) != 0);
 		}
 		inline void name::insert(iterator position, wrapped_value_type entry, int set)
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry(ptr().get(), entry.raw(), position.m_index, set) != 0);
 		}
 		inline void name::insert(const_iterator position, const std::string& field, int type, const void* data, size_t data_len, int set) const
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_txt(ptr().get(), field.c_str(), type, static_cast<const unsigned char*>(data), static_cast<int>(data_len), position.m_index, set) != 0);
 		}
 		inline void name::insert(iterator position, const std::string& field, int type, const void* data, size_t data_len, int set)
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_txt(ptr().get(), field.c_str(), type, static_cast<const unsigned char*>(data), static_cast<int>(data_len), position.m_index, set) != 0);
 		}
 		inline void name::insert(const_iterator position, asn1::object object, int type, const void* data, size_t data_len, int set) const
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_OBJ(ptr().get(), object.raw(), type, static_cast<unsigned char*>(const_cast<void*>(data)), static_cast<int>(data_len), position.m_index, set) != 0);
 		}
 		inline void name::insert(iterator position, asn1::object object, int type, const void* data, size_t data_len, int set)
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_OBJ(ptr().get(), object.raw(), type, static_cast<unsigned char*>(const_cast<void*>(data)), static_cast<int>(data_len), position.m_index, set) != 0);
 		}
 		inline void name::insert(const_iterator position, int nid, int type, const void* data, size_t data_len, int set) const
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_NID(ptr().get(),nid, type, static_cast<unsigned char*>(const_cast<void*>(data)), static_cast<int>(data_len), position.m_index, set) != 0);
 		}
 		inline void name::insert(iterator position, int nid, int type, const void* data, size_t data_len, int set)
 		{
 			assert(position.m_owner == this);
 
+			invalidate_der_cache();
+
 			throw_error_if_not(X509_NAME_add_entry_by_NID(ptr().get(),nid, type, static_cast<unsigned char*>(const_cast<void*>(data)), static_cast<int>(data_len), position.m_index, set) != 0);
 		}
 		inline void name::insert(const_iterator position, const_iterator first, const_iterator last) const
@@ -1132,7 +1229,10 @@ namespace cryptoplus
 				position = insert(position, *first) + 1;
 			}
 		}
-		inline name::name(pointer _ptr, deleter_type _del) : pointer_wrapper<value_type>(_ptr, _del)
+		inline name::name(pointer _ptr, deleter_type _del) :
+			pointer_wrapper<value_type>(_ptr, _del),
+			m_der_hash(0),
+			m_der_cache_valid(false)
 		{
 		}
 		template <typename IteratorValueType>
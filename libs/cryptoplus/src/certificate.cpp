@@ -77,6 +77,38 @@ namespace cryptoplus
 			return from_trusted_certificate(bio_chain.first(), callback, callback_arg);
 		}
 
+		size_t certificate::from_trusted_certificate_bundle(bio::bio_ptr bio, std::vector<certificate>& certificates, pem_passphrase_callback_type callback, void* callback_arg)
+		{
+			size_t count = 0;
+
+			while (X509* x509 = PEM_read_bio_X509_AUX(bio.raw(), NULL, callback, callback_arg))
+			{
+				certificates.push_back(certificate(x509, deleter));
+				++count;
+			}
+
+			// Running out of PEM data is the normal way out of the loop. Anything else is a genuine parsing error.
+			const error::error_type err = error::peek_last_error();
+
+			if ((error::get_library_error(err) == ERR_LIB_PEM) && (error::get_reason_error(err) == PEM_R_NO_START_LINE))
+			{
+				ERR_clear_error();
+			}
+			else
+			{
+				throw_error();
+			}
+
+			return count;
+		}
+
+		size_t certificate::from_trusted_certificate_bundle(file _file, std::vector<certificate>& certificates, pem_passphrase_callback_type callback, void* callback_arg)
+		{
+			bio::bio_chain bio_chain(BIO_new_fp(_file.raw(), BIO_NOCLOSE));
+
+			return from_trusted_certificate_bundle(bio_chain.first(), certificates, callback, callback_arg);
+		}
+
 		certificate certificate::take_ownership(pointer _ptr)
 		{
 			throw_error_if_not(_ptr);
@@ -46,6 +46,7 @@
 
 #include "bio/bio_chain.hpp"
 
+#include <algorithm>
 #include <cassert>
 
 namespace cryptoplus
@@ -76,6 +77,46 @@ namespace cryptoplus
 
 			return certificate_revocation_list(_ptr, deleter);
 		}
+
+		bool certificate_revocation_list::is_revoked(asn1::integer serial_number) const
+		{
+			if (!m_revocation_index->serial_numbers)
+			{
+				std::vector<indexed_serial_type> serial_numbers;
+
+				STACK_OF(X509_REVOKED)* const entries = X509_CRL_get_REVOKED(ptr().get());
+
+				if (entries)
+				{
+					serial_numbers.reserve(sk_X509_REVOKED_num(entries));
+
+					for (int index = 0; index < sk_X509_REVOKED_num(entries); ++index)
+					{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER)
+						serial_numbers.push_back(to_indexed_serial(X509_REVOKED_get0_serialNumber(sk_X509_REVOKED_value(entries, index))));
+#else
+						serial_numbers.push_back(to_indexed_serial(sk_X509_REVOKED_value(entries, index)->serialNumber));
+#endif
+					}
+				}
+
+				std::sort(serial_numbers.begin(), serial_numbers.end());
+
+				m_revocation_index->serial_numbers = serial_numbers;
+			}
+
+			const std::vector<indexed_serial_type>& serial_numbers = *m_revocation_index->serial_numbers;
+
+			return std::binary_search(serial_numbers.begin(), serial_numbers.end(), to_indexed_serial(serial_number.raw()));
+		}
+
+		certificate_revocation_list::indexed_serial_type certificate_revocation_list::to_indexed_serial(asn1::integer::const_pointer serial_number)
+		{
+			// The index only needs a total order with exact matches, so the raw ASN.1 content bytes make a fine key.
+			const unsigned char* const data = serial_number->data;
+
+			return indexed_serial_type(data, data + serial_number->length);
+		}
 	}
 }
 
@@ -183,6 +183,33 @@ namespace cryptoplus
 			return generic_update(*this, EVP_CipherUpdate, out, out_len, in, in_len);
 		}
 
+		void cipher_context::update_aad(const void* in, size_t in_len)
+		{
+			if (in_len <= 0)
+			{
+				return;
+			}
+
+			assert(in);
+
+			int iout_len = 0;
+
+			// A NULL output buffer makes EVP_CipherUpdate() treat the input as additional authenticated data.
+			throw_error_if_not(EVP_CipherUpdate(m_ctx, NULL, &iout_len, static_cast<const unsigned char*>(in), static_cast<int>(in_len)) != 0);
+		}
+
+		size_t cipher_context::update(void* out, size_t out_len, const input_span* in_begin, const input_span* in_end)
+		{
+			size_t result = 0;
+
+			for (const input_span* in = in_begin; in != in_end; ++in)
+			{
+				result += update(static_cast<uint8_t*>(out) + result, out_len - result, in->data, in->size);
+			}
+
+			return result;
+		}
+
 		size_t cipher_context::seal_update(void* out, size_t out_len, const void* in, size_t in_len)
 		{
 			return generic_update(*this, _EVP_SealUpdate, out, out_len, in, in_len);
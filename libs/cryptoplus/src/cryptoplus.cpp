@@ -44,6 +44,100 @@
 
 #include "cryptoplus.hpp"
 
+#include "error/helpers.hpp"
+
+#include <openssl/crypto.h>
+
+#ifndef OPENSSL_NO_ENGINE
+#include <openssl/engine.h>
+#endif
+
+#include <stdexcept>
+
 namespace cryptoplus
 {
+	std::vector<std::string> enumerate_engines()
+	{
+		std::vector<std::string> result;
+
+#ifndef OPENSSL_NO_ENGINE
+		ENGINE_load_builtin_engines();
+
+		// ENGINE_get_next() releases the structural reference of its
+		// argument, so walking the list this way leaks nothing.
+		for (ENGINE* engine = ENGINE_get_first(); engine != NULL; engine = ENGINE_get_next(engine))
+		{
+			result.push_back(ENGINE_get_id(engine));
+		}
+#endif
+
+		return result;
+	}
+
+	void pin_engine(const std::string& id)
+	{
+#ifndef OPENSSL_NO_ENGINE
+		ENGINE_load_builtin_engines();
+
+		ENGINE* engine = ENGINE_by_id(id.c_str());
+
+		throw_error_if_not(engine);
+
+		if (ENGINE_init(engine) == 0)
+		{
+			ENGINE_free(engine);
+
+			throw_error();
+		}
+
+		const int result = ENGINE_set_default(engine, ENGINE_METHOD_ALL);
+
+		// ENGINE_set_default() takes its own references: ours can go.
+		ENGINE_finish(engine);
+		ENGINE_free(engine);
+
+		throw_error_if_not(result == 1);
+#else
+		static_cast<void>(id);
+
+		throw std::runtime_error("OpenSSL was built without engine support");
+#endif
+	}
+
+	bool cpu_has_aes_instructions()
+	{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		return __builtin_cpu_supports("aes") != 0;
+#elif defined(__ARM_FEATURE_CRYPTO)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool cpu_has_carryless_multiplication()
+	{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		return __builtin_cpu_supports("pclmul") != 0;
+#elif defined(__ARM_FEATURE_CRYPTO)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	std::string get_aes_implementation()
+	{
+		if (cpu_has_aes_instructions())
+		{
+			if (cpu_has_carryless_multiplication())
+			{
+				return "hardware (AES instructions with carry-less multiplication)";
+			}
+
+			return "hardware (AES instructions with software GHASH)";
+		}
+
+		return "software";
+	}
 }
@@ -51,12 +51,19 @@ namespace cryptoplus
 {
 	namespace hash
 	{
+		message_digest_context& thread_message_digest_context()
+		{
+			static thread_local message_digest_context ctx;
+
+			return ctx;
+		}
+
 		size_t message_digest(void* out, size_t out_len, const void* data, size_t len, const message_digest_algorithm& algorithm, ENGINE* impl)
 		{
 			assert(out);
 			assert(data);
 
-			message_digest_context ctx;
+			message_digest_context& ctx = thread_message_digest_context();
 			ctx.initialize(algorithm, impl);
 			ctx.update(data, len);
 			return ctx.finalize(out, out_len);
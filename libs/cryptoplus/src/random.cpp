@@ -44,17 +44,80 @@
 
 #include "random/random.hpp"
 
-#ifdef MSV
-// Avoid LNK4221: no public symbols found; archive member will be inacessible
-namespace
-{
-	char not_empty;
-}
-#endif
+#include "cipher/cipher_context.hpp"
+
+#include <cstring>
 
 namespace cryptoplus
 {
 	namespace random
 	{
+		namespace
+		{
+			const EVP_CIPHER* drbg_cipher()
+			{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) && !defined(LIBRESSL_VERSION_NUMBER)
+				return EVP_chacha20();
+#else
+				return EVP_aes_256_ctr();
+#endif
+			}
+
+			/**
+			 * \brief A per-thread deterministic random generator.
+			 *
+			 * The generator is keyed from OpenSSL's global pool and periodically reseeded from it, so drawing bytes does not take the global RAND lock.
+			 */
+			class thread_drbg : public boost::noncopyable
+			{
+				public:
+
+					thread_drbg() : m_remaining(0) {}
+
+					void generate(void* buf, size_t buf_len)
+					{
+						if (m_remaining < buf_len)
+						{
+							reseed();
+						}
+
+						// The keystream is the output: encrypting zeroes in place extracts it.
+						std::memset(buf, 0x00, buf_len);
+
+						m_context.update(buf, buf_len, buf, buf_len);
+
+						m_remaining -= (buf_len < m_remaining) ? buf_len : m_remaining;
+					}
+
+				private:
+
+					static const size_t KEY_SIZE = 32;
+					static const size_t IV_SIZE = 16;
+					static const size_t RESEED_BYTE_COUNT = 1024 * 1024;
+
+					void reseed()
+					{
+						uint8_t seed_material[KEY_SIZE + IV_SIZE];
+
+						throw_error_if_not(RAND_bytes(seed_material, static_cast<int>(sizeof(seed_material))) == 1);
+
+						m_context.initialize(cipher::cipher_algorithm(drbg_cipher()), cipher::cipher_context::encrypt, seed_material, KEY_SIZE, seed_material + KEY_SIZE);
+
+						std::memset(seed_material, 0x00, sizeof(seed_material));
+
+						m_remaining = RESEED_BYTE_COUNT;
+					}
+
+					cipher::cipher_context m_context;
+					size_t m_remaining;
+			};
+		}
+
+		void get_random_bytes(void* buf, size_t buf_len)
+		{
+			static thread_local thread_drbg drbg;
+
+			drbg.generate(buf, buf_len);
+		}
 	}
 }
@@ -52,6 +52,9 @@
 #include <map>
 #include <string>
 
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
 #include <boost/system/system_error.hpp>
 
 namespace executeplus
@@ -60,6 +63,36 @@ namespace executeplus
 	int execute(const std::vector<std::string>& args, const std::map<std::string, std::string>& env, boost::system::error_code& ec, std::ostream* output = nullptr);
 	int execute(const std::vector<std::string>& args, const std::map<std::string, std::string>& env, std::ostream* output = nullptr);
 	void checked_execute(const std::vector<std::string>& args, const std::map<std::string, std::string>& env, std::ostream* output = nullptr);
+
+	/**
+	 * \brief The asynchronous execution handler type.
+	 *
+	 * The handler gets the spawn error, if any, the exit status of the
+	 * process and whatever the process wrote to its standard output and
+	 * standard error.
+	 */
+	typedef boost::function<void (const boost::system::error_code&, int, const std::string&)> async_execute_handler_type;
+
+	/**
+	 * \brief Execute a command asynchronously.
+	 * \param io_service The io_service on which the output is streamed and the handler is invoked.
+	 * \param args The command and its arguments.
+	 * \param env The environment of the process.
+	 * \param handler The handler to invoke upon completion.
+	 */
+	void async_execute(boost::asio::io_service& io_service, const std::vector<std::string>& args, const std::map<std::string, std::string>& env, async_execute_handler_type handler);
+
+	/**
+	 * \brief Execute a command asynchronously, with a completion timeout.
+	 * \param io_service The io_service on which the output is streamed and the handler is invoked.
+	 * \param args The command and its arguments.
+	 * \param env The environment of the process.
+	 * \param timeout The maximum time the process is given to complete. Past
+	 * it, the process is sent a SIGTERM, then a SIGKILL shortly after, and
+	 * the handler is invoked with boost::asio::error::timed_out.
+	 * \param handler The handler to invoke upon completion.
+	 */
+	void async_execute(boost::asio::io_service& io_service, const std::vector<std::string>& args, const std::map<std::string, std::string>& env, const boost::posix_time::time_duration& timeout, async_execute_handler_type handler);
 }
 
 #endif
@@ -49,14 +49,20 @@
 #include "error.hpp"
 
 #include <unistd.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <signal.h>
 
 #include <iostream>
 #include <sstream>
 
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/iostreams/stream.hpp>
 
@@ -64,6 +70,171 @@ extern char** environ;
 
 namespace executeplus
 {
+	namespace
+	{
+		pid_t spawn_process(const std::vector<std::string>& args, const std::map<std::string, std::string>& env, int output_fd, boost::system::error_code& ec)
+		{
+			std::vector<char*> argv(args.size() + 1, nullptr);
+
+			for (size_t i = 0; i != args.size(); ++i)
+			{
+				argv[i] = const_cast<char*>(args[i].c_str());
+			}
+
+			std::vector<std::string> env_buffer;
+			env_buffer.reserve(env.size());
+
+			std::vector<char*> envp(env.size() + 1, nullptr);
+
+			{
+				size_t i = 0;
+
+				for (auto&& pair : env)
+				{
+					env_buffer.push_back(pair.first + "=" + pair.second);
+					envp[i++] = const_cast<char*>(env_buffer.back().c_str());
+				}
+			}
+
+			::posix_spawn_file_actions_t file_actions;
+			::posix_spawn_file_actions_init(&file_actions);
+
+			if (output_fd >= 0)
+			{
+				::posix_spawn_file_actions_adddup2(&file_actions, output_fd, STDOUT_FILENO);
+				::posix_spawn_file_actions_adddup2(&file_actions, output_fd, STDERR_FILENO);
+				::posix_spawn_file_actions_addclose(&file_actions, output_fd);
+			}
+
+			pid_t pid = -1;
+
+			// posix_spawn() shares the parent address space until the exec
+			// instead of duplicating its page tables, so spawning from a
+			// large resident process stays cheap.
+			const int result = ::posix_spawn(&pid, argv[0], &file_actions, nullptr, &argv[0], &envp[0]);
+
+			::posix_spawn_file_actions_destroy(&file_actions);
+
+			if (result != 0)
+			{
+				ec = boost::system::error_code(result, boost::system::system_category());
+
+				return -1;
+			}
+
+			return pid;
+		}
+
+		class async_execute_context : public boost::enable_shared_from_this<async_execute_context>
+		{
+			public:
+
+				async_execute_context(boost::asio::io_service& io_service, int output_fd, pid_t pid, async_execute_handler_type handler) :
+					m_output(io_service, output_fd),
+					m_timer(io_service),
+					m_pid(pid),
+					m_handler(handler),
+					m_timed_out(false)
+				{
+				}
+
+				void arm_timeout(const boost::posix_time::time_duration& timeout)
+				{
+					const auto self = shared_from_this();
+
+					m_timer.expires_from_now(timeout);
+					m_timer.async_wait([self](const boost::system::error_code& ec) {
+						if (!ec)
+						{
+							self->handle_timeout();
+						}
+					});
+				}
+
+				void async_read()
+				{
+					const auto self = shared_from_this();
+
+					m_output.async_read_some(boost::asio::buffer(m_buffer), [self](const boost::system::error_code& ec, size_t cnt) {
+						if (!ec)
+						{
+							self->m_output_data.append(self->m_buffer.data(), cnt);
+							self->async_read();
+						}
+						else
+						{
+							self->complete(ec);
+						}
+					});
+				}
+
+			private:
+
+				void handle_timeout()
+				{
+					static const boost::posix_time::seconds KILL_GRACE_PERIOD(5);
+
+					if (!m_timed_out)
+					{
+						// First chance: ask politely. The read loop completes
+						// once the process dies and closes its output.
+						m_timed_out = true;
+						::kill(m_pid, SIGTERM);
+
+						arm_timeout(KILL_GRACE_PERIOD);
+					}
+					else
+					{
+						// The process ignored the SIGTERM: this one cannot be ignored.
+						::kill(m_pid, SIGKILL);
+					}
+				}
+
+				void complete(const boost::system::error_code& read_ec)
+				{
+					m_timer.cancel();
+
+					// End-of-file means the process closed its output, which
+					// happens when it terminates: the wait below never blocks
+					// for long.
+					int status = 0;
+
+					if (::waitpid(m_pid, &status, 0) != m_pid)
+					{
+						m_handler(boost::system::error_code(errno, boost::system::system_category()), -1, m_output_data);
+
+						return;
+					}
+
+					if (read_ec && (read_ec != boost::asio::error::eof))
+					{
+						m_handler(read_ec, -1, m_output_data);
+
+						return;
+					}
+
+					if (m_timed_out)
+					{
+						m_handler(boost::asio::error::timed_out, -1, m_output_data);
+
+						return;
+					}
+
+					const int return_code = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+
+					m_handler(boost::system::error_code(), return_code, m_output_data);
+				}
+
+				boost::asio::posix::stream_descriptor m_output;
+				boost::asio::deadline_timer m_timer;
+				pid_t m_pid;
+				async_execute_handler_type m_handler;
+				boost::array<char, 1024> m_buffer;
+				std::string m_output_data;
+				bool m_timed_out;
+		};
+	}
+
 	std::map<std::string, std::string> get_current_environment()
 	{
 		std::map<std::string, std::string> result;
@@ -110,15 +281,6 @@ namespace executeplus
 		std::cout << "Environment ends." << std::endl;
 #endif
 
-		int fd[2] = {0, 0};
-
-		if (::pipe(fd) < 0)
-		{
-			ec = boost::system::error_code(errno, boost::system::system_category());
-
-			return -1;
-		}
-
 		int output_fd[2] = {0, 0};
 
 		if (output)
@@ -131,179 +293,98 @@ namespace executeplus
 			}
 		}
 
-		const pid_t pid = fork();
+		const pid_t pid = spawn_process(args, env, output ? output_fd[1] : -1, ec);
 
-		switch (pid)
+		if (output)
 		{
-			case -1:
-				{
-					// fork() failed.
-					if (output)
-					{
-						::close(output_fd[0]);
-						::close(output_fd[1]);
-					}
-
-					::close(fd[0]);
-					::close(fd[1]);
-
-					ec = boost::system::error_code(errno, boost::system::system_category());
-
-					return -1;
-				}
-			case 0:
-				{
-					// Child process
-					const int fdlimit = ::sysconf(_SC_OPEN_MAX);
-
-					if (output)
-					{
-						::dup2(output_fd[1], STDOUT_FILENO);
-						::dup2(output_fd[1], STDERR_FILENO);
-						::close(output_fd[1]);
-					}
-
-					for (int n = 0; n < fdlimit; ++n)
-					{
-						if ((n != fd[1]) && (!output || ((n != STDOUT_FILENO) && (n != STDERR_FILENO))))
-						{
-							::close(n);
-						}
-					}
-
-					fcntl(fd[1], F_SETFD, FD_CLOEXEC);
-
-					// Estimate the required size for the argv buffer.
-					std::vector<char> argv_buffer;
-					std::vector<char*> argv(args.size() + 1, nullptr);
-
-					{
-						// One null-terminated byte per arg.
-						size_t buffer_size = args.size();
-
-						for (auto&& arg : args)
-						{
-							buffer_size += arg.size();
-						}
-
-						argv_buffer.resize(buffer_size, 0x00);
-						auto offset = argv_buffer.begin();
-
-						for (size_t i = 0; i != args.size(); ++i)
-						{
-							const auto& arg = args[i];
+			::close(output_fd[1]);
+		}
 
-							argv[i] = &*offset;
-							offset = std::copy(arg.begin(), arg.end(), offset);
-							*(offset++) = '\0';
-						}
-					}
+		if (pid < 0)
+		{
+			if (output)
+			{
+				::close(output_fd[0]);
+			}
 
-					// Estimate the required size for the envp buffer.
-					std::vector<char> envp_buffer;
-					std::vector<char*> envp(env.size() + 1, nullptr);
+			return -1;
+		}
 
-					{
-						// One null-terminated byte per arg.
-						size_t buffer_size = env.size();
+		if (output)
+		{
+			// This will take ownership of the file descriptor.
+			boost::iostreams::file_descriptor_source output_src(output_fd[0], boost::iostreams::close_handle);
+			boost::iostreams::stream<boost::iostreams::file_descriptor_source> output_is(output_src);
 
-						for (auto&& pair : env)
-						{
-							buffer_size += pair.first.size() + 1 + pair.second.size();
-						}
+			(*output) << output_is.rdbuf();
+		}
 
-						envp_buffer.resize(buffer_size, 0x00);
-						auto offset = envp_buffer.begin();
+		int status = 0;
 
-						for (size_t i = 0; i != env.size(); ++i)
-						{
-							auto it = env.begin();
-							std::advance(it, i);
-							const auto& pair = *it;
-
-							envp[i] = &*offset;
-							offset = std::copy(pair.first.begin(), pair.first.end(), offset);
-							*(offset++) = '=';
-							offset = std::copy(pair.second.begin(), pair.second.end(), offset);
-							*(offset++) = '\0';
-						}
-					}
+		if (::waitpid(pid, &status, 0) != pid)
+		{
+			ec = boost::system::error_code(errno, boost::system::system_category());
 
-					// Execute the file specified
-					::execve(argv[0], &argv[0], &envp[0]);
+			return -1;
+		}
 
-					// Something went wrong. Sending back errno to parent process then exiting.
-					if (::write(fd[1], &errno, sizeof(errno))) {}
+		if (WIFEXITED(status))
+		{
+			const int result = WEXITSTATUS(status);
 
-					_exit(127);
+#if FREELAN_DEBUG
+			std::cout << "Exit status: " << result << std::endl;
+#endif
 
-					break;
-				}
-			default:
-				{
-					// Parent process
-					::close(fd[1]);
+			return result;
+		}
 
-					if (output)
-					{
-						::close(output_fd[1]);
-					}
+		return EXIT_FAILURE;
+	}
 
-					int child_errno = 0;
+	void async_execute(boost::asio::io_service& io_service, const std::vector<std::string>& args, const std::map<std::string, std::string>& env, async_execute_handler_type handler)
+	{
+		async_execute(io_service, args, env, boost::posix_time::pos_infin, handler);
+	}
 
-					if (output)
-					{
-						// This will take ownership of the file descriptor.
-						boost::iostreams::file_descriptor_source output_src(output_fd[0], boost::iostreams::close_handle);
-						boost::iostreams::stream<boost::iostreams::file_descriptor_source> output_is(output_src);
+	void async_execute(boost::asio::io_service& io_service, const std::vector<std::string>& args, const std::map<std::string, std::string>& env, const boost::posix_time::time_duration& timeout, async_execute_handler_type handler)
+	{
+		int output_fd[2] = {0, 0};
 
-						(*output) << output_is.rdbuf();
-					}
+		if (::pipe(output_fd) < 0)
+		{
+			const boost::system::error_code ec(errno, boost::system::system_category());
 
-					const ssize_t readcnt = ::read(fd[0], &child_errno, sizeof(child_errno));
+			io_service.post(boost::bind(handler, ec, -1, std::string()));
 
-					::close(fd[0]);
+			return;
+		}
 
-					if (readcnt < 0)
-					{
-						ec = boost::system::error_code(errno, boost::system::system_category());
+		boost::system::error_code ec;
 
-						return -1;
-					}
-					else if (readcnt == sizeof(child_errno))
-					{
-						ec = boost::system::error_code(child_errno, boost::system::system_category());
+		const pid_t pid = spawn_process(args, env, output_fd[1], ec);
 
-						return -1;
-					}
+		::close(output_fd[1]);
 
-					int status = 0;
+		if (pid < 0)
+		{
+			::close(output_fd[0]);
 
-					if (::waitpid(pid, &status, 0) != pid)
-					{
-						ec = boost::system::error_code(child_errno, boost::system::system_category());
+			io_service.post(boost::bind(handler, ec, -1, std::string()));
 
-						return -1;
-					}
-					else
-					{
-						if (WIFEXITED(status))
-						{
-							const int result = WEXITSTATUS(status);
+			return;
+		}
 
-#if FREELAN_DEBUG
-							std::cout << "Exit status: " << result << std::endl;
-#endif
+		// The context takes ownership of the read end of the pipe and keeps
+		// itself alive until the output is drained and the process is reaped.
+		const auto context = boost::make_shared<async_execute_context>(boost::ref(io_service), output_fd[0], pid, handler);
 
-							return result;
-						}
-					}
+		context->async_read();
 
-					break;
-				}
+		if (!timeout.is_special())
+		{
+			context->arm_timeout(timeout);
 		}
-
-		return EXIT_FAILURE;
 	}
 
 	int execute(const std::vector<std::string>& args, const std::map<std::string, std::string>& env, std::ostream* output)
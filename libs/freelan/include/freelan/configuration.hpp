@@ -277,6 +277,29 @@ namespace freelan
 		 */
 		endpoint_list contact_list;
 
+		/**
+		 * \brief Whether the TCP fallback transport is enabled.
+		 */
+		bool tcp_enabled;
+
+		/**
+		 * \brief The contacts to reach over the TCP fallback transport.
+		 *
+		 * These hosts sit on networks that block UDP: a TCP connection is
+		 * established with them before the usual greeting takes place.
+		 */
+		endpoint_list tcp_contact_list;
+
+		/**
+		 * \brief Whether the relay capability is enabled.
+		 *
+		 * When enabled, this host forwards traffic between peers that
+		 * cannot reach each other directly (within strict rate budgets),
+		 * and routes its own traffic through a common neighbor when a
+		 * learned contact cannot be greeted directly.
+		 */
+		bool relay_enabled;
+
 		/**
 		 * \brief The "accept contact requests" flag.
 		 */
@@ -321,6 +344,127 @@ namespace freelan
 		 * \brief State of UPnP.
 		 */
 		bool upnp_enabled;
+
+		/**
+		 * \brief The persistent presentation cache file.
+		 *
+		 * When non-empty, the certificates presented by peers are
+		 * mirrored into this file so a restarted node validates
+		 * returning peers without a full presentation exchange. An
+		 * empty value disables the cache.
+		 */
+		std::string presentation_cache_file;
+
+		/**
+		 * \brief The busy-poll duration, in microseconds.
+		 *
+		 * When non-zero, the FSCP socket and the tap adapter busy-poll for
+		 * incoming packets during this duration before blocking. This trades
+		 * CPU for receive latency. 0 disables busy-polling.
+		 */
+		unsigned int busy_poll_us;
+
+		/**
+		 * \brief The send queue sojourn limit, in milliseconds.
+		 *
+		 * When non-zero, data datagrams that waited longer than this in the
+		 * send queue of a congested peer are dropped instead of adding to
+		 * the standing delay (bufferbloat), keeping the in-tunnel queuing
+		 * latency bounded. 0 disables the limit.
+		 */
+		unsigned int max_queue_sojourn_ms;
+
+		/**
+		 * \brief The reorder hold duration, in milliseconds.
+		 *
+		 * When non-zero, a data message that arrives ahead of a sequence
+		 * gap is held back for up to this long, waiting for the missing
+		 * message, before being delivered out of order anyway. This keeps
+		 * in-tunnel TCP from interpreting multipath reordering as loss. 0
+		 * disables the hold.
+		 */
+		unsigned int reorder_hold_ms;
+
+		/**
+		 * \brief The count of receive steering workers.
+		 *
+		 * When non-zero, that many extra receive sockets join the FSCP
+		 * socket in a SO_REUSEPORT group: the kernel hashes inbound peers
+		 * over the sockets, so different peers are deciphered on different
+		 * cores while per-peer ordering is preserved. Linux only; 0
+		 * disables receive steering.
+		 */
+		unsigned int receive_steering_workers;
+
+		/**
+		 * \brief Whether to trace the packet-path latency.
+		 *
+		 * When enabled, frames are timestamped at each pipeline stage and
+		 * per-stage latency histograms are logged when the server closes.
+		 */
+		bool latency_tracing;
+
+		/**
+		 * \brief Whether to discover the path MTU towards the peers.
+		 *
+		 * When enabled, the path towards each peer is probed when a session
+		 * is established and the discovered MTU is logged. The don't-fragment
+		 * flag is set on all outgoing FSCP datagrams, where supported.
+		 */
+		bool mtu_discovery;
+
+		/**
+		 * \brief Whether to coalesce small data frames.
+		 *
+		 * When enabled, several small frames bound to the same peer may be
+		 * packed into a single FSCP data message, amortizing the header and
+		 * ciphering overhead. All the peers must have the option enabled.
+		 */
+		bool data_coalescing;
+
+		/**
+		 * \brief A peer scheduling class.
+		 *
+		 * Hosts matched by the class are granted the scheduling weight in
+		 * the send path: their queues drain proportionally faster and hold
+		 * proportionally more buffers, so bulk traffic towards other peers
+		 * cannot starve them.
+		 */
+		struct scheduling_class_type
+		{
+			scheduling_class_type() :
+				weight(1)
+			{
+			}
+
+			/**
+			 * \brief The certificate common name to match, if any.
+			 */
+			boost::optional<std::string> common_name;
+
+			/**
+			 * \brief The network address to match the host endpoint against, if any.
+			 */
+			boost::optional<asiotap::ip_network_address> network;
+
+			/**
+			 * \brief The scheduling weight granted to the matched hosts.
+			 */
+			unsigned int weight;
+		};
+
+		/**
+		 * \brief The scheduling class list type.
+		 */
+		typedef std::vector<scheduling_class_type> scheduling_class_list;
+
+		/**
+		 * \brief The peer scheduling classes, evaluated in order.
+		 *
+		 * The first matching class gives a host its scheduling weight;
+		 * unmatched hosts keep the default weight.
+		 */
+		scheduling_class_list scheduling_classes;
 	};
 
 	/**
@@ -401,6 +545,14 @@ namespace freelan
 		 * \brief The certificate revocation lists.
 		 */
 		crl_list_type certificate_revocation_list_list;
+
+		/**
+		 * \brief The cryptographic engine to pin, if any.
+		 *
+		 * When non-empty, the named OpenSSL engine provides every
+		 * cryptographic method it implements.
+		 */
+		std::string crypto_engine;
 	};
 
 	/**
@@ -442,6 +594,14 @@ namespace freelan
 		 */
 		std::string name;
 
+		/**
+		 * \brief The number of read queues to open on the tap adapter.
+		 *
+		 * Only honored on systems that support multi-queue tap adapters. On
+		 * other systems a single queue is always used.
+		 */
+		size_t queue_count;
+
 		/**
 		 * \brief The tap adapter's MTU.
 		 */
@@ -536,6 +696,14 @@ namespace freelan
 		 * \brief Whether to enable the relay mode.
 		 */
 		bool relay_mode_enabled;
+
+		/**
+		 * \brief Whether to gossip learned ethernet addresses to the other hosts.
+		 *
+		 * Gossip warms the remote switch tables proactively, so unicast
+		 * frames towards local stations are forwarded instead of flooded.
+		 */
+		bool mac_gossip_enabled;
 	};
 
 	/**
@@ -632,6 +800,32 @@ namespace freelan
 		boost::filesystem::path dns_script;
 	};
 
+	/**
+	 * \brief The threading related options type.
+	 */
+	struct threads_configuration
+	{
+		/**
+		 * \brief Create a new threads configuration.
+		 */
+		threads_configuration();
+
+		/**
+		 * \brief The count of worker threads running the main io_service. 0 means one per processor core.
+		 */
+		unsigned int worker_count;
+
+		/**
+		 * \brief The count of threads dedicated to certificate chain verification. 0 means the built-in default.
+		 */
+		unsigned int certificate_verification_count;
+
+		/**
+		 * \brief The CPUs to pin the worker threads to. Worker i is pinned to the i-th value, wrapping around. An empty list disables pinning.
+		 */
+		std::vector<unsigned int> worker_affinity;
+	};
+
 	/**
 	 * \brief The configuration structure.
 	 */
@@ -672,6 +866,11 @@ namespace freelan
 		 */
 		freelan::router_configuration router;
 
+		/**
+		 * \brief The threading related options.
+		 */
+		freelan::threads_configuration threads;
+
 		/**
 		 * \brief The constructor.
 		 */
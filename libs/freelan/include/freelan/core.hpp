@@ -51,6 +51,7 @@
 #include "router.hpp"
 #include "message.hpp"
 #include "routes_message.hpp"
+#include "mac_addresses_message.hpp"
 
 #include <fscp/fscp.hpp>
 #include <fscp/logger.hpp>
@@ -62,6 +63,7 @@
 #include <asiotap/osi/dhcp_proxy.hpp>
 #include <asiotap/osi/icmpv6_proxy.hpp>
 #include <asiotap/osi/complex_filter.hpp>
+#include <asiotap/osi/static_filter.hpp>
 #include <asiotap/route_manager.hpp>
 #include <asiotap/dns_servers_manager.hpp>
 #include <asiotap/types/ip_route.hpp>
@@ -70,6 +72,7 @@
 #include <cryptoplus/x509/store.hpp>
 #include <cryptoplus/x509/store_context.hpp>
 
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -77,6 +80,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 
+#include <deque>
 #include <queue>
 #include <set>
 
@@ -266,6 +270,11 @@ namespace freelan
 			 */
 			static const boost::posix_time::time_duration ROUTES_REQUEST_PERIOD;
 
+			/**
+			 * \brief The delay before newly learned ethernet addresses are gossiped.
+			 */
+			static const boost::posix_time::time_duration MAC_GOSSIP_DELAY;
+
 			/**
 			 * \brief The renew certificate warning period.
 			 */
@@ -281,6 +290,16 @@ namespace freelan
 			 */
 			static const boost::posix_time::time_duration GET_CONTACT_INFORMATION_UPDATE_PERIOD;
 
+			/**
+			 * \brief The duration during which a successful contact resolution is kept in cache.
+			 */
+			static const boost::posix_time::time_duration CONTACT_RESOLUTION_DURATION;
+
+			/**
+			 * \brief The duration during which a failed contact resolution is kept in cache.
+			 */
+			static const boost::posix_time::time_duration CONTACT_RESOLUTION_ERROR_DURATION;
+
 			/**
 			 * \brief The default service.
 			 */
@@ -309,7 +328,9 @@ namespace freelan
 			/**
 			 * \brief Set the logger's level.
 			 * \param level The log level.
-			 * \warning This method can only be called when the core is NOT running.
+			 *
+			 * Unlike the other setters, this method may also be called while
+			 * the core is running, to adjust the verbosity.
 			 */
 			void set_log_level(fscp::log_level level)
 			{
@@ -439,6 +460,18 @@ namespace freelan
 			 */
 			void close();
 
+			/**
+			 * \brief Reload the configuration.
+			 * \param configuration The new configuration.
+			 *
+			 * Only the differences that can be applied without restarting the
+			 * FSCP server or reopening the tap adapter are taken into
+			 * account: the contact lists and the advertised local routes and
+			 * DNS servers. Every other change is ignored until the next
+			 * restart.
+			 */
+			void reload_configuration(const freelan::configuration& configuration);
+
 		private:
 
 			boost::asio::io_service& m_io_service;
@@ -472,7 +505,13 @@ namespace freelan
 			void open_fscp_server();
 			void close_fscp_server();
 
+			typedef boost::function<void (const boost::system::error_code&, const ep_type&)> resolution_handler_type;
+			typedef boost::function<void (const boost::system::error_code&, const std::vector<ep_type>&)> multi_resolution_handler_type;
+
+			void async_resolve_contact(const endpoint& target, resolution_handler_type handler);
+			void async_resolve_contact_all(const endpoint& target, multi_resolution_handler_type handler);
 			void async_contact(const endpoint& target, duration_handler_type handler);
+			void race_contact(const std::vector<ep_type>& hosts, duration_handler_type handler);
 			void async_contact(const endpoint& target);
 			void async_contact_all();
 			void async_dynamic_contact_all();
@@ -484,11 +523,13 @@ namespace freelan
 			void async_request_session(const ep_type&);
 			void async_handle_routes_request(const ep_type&, const routes_request_message&);
 			void async_handle_routes(const ep_type&, const routes_message&);
+			void async_handle_routes_delta(const ep_type&, const routes_message&);
+			void async_handle_mac_addresses(const ep_type&, const mac_addresses_message&);
 			void async_send_routes_request(const ep_type&, simple_handler_type);
 			void async_send_routes_request(const ep_type&);
-			void async_send_routes_request_to_all(multiple_endpoints_handler_type);
 			void async_send_routes_request_to_all();
-			void async_send_routes(const ep_type&, routes_message::version_type, const asiotap::ip_route_set&, const asiotap::ip_address_set& dns_servers, simple_handler_type);
+			void async_send_routes(const ep_type&, routes_message::version_type, const asiotap::ip_route_set&, const asiotap::ip_address_set& dns_servers, bool compact, simple_handler_type);
+			void async_send_routes_delta(const ep_type&, routes_message::version_type, routes_message::version_type, const asiotap::ip_route_set&, const asiotap::ip_route_set&, const asiotap::ip_address_set&, const asiotap::ip_address_set&, simple_handler_type);
 
 			void do_contact(const ep_type&, duration_handler_type);
 
@@ -500,28 +541,46 @@ namespace freelan
 			void do_handle_send_contact_request_to_all(const std::map<ep_type, boost::system::error_code>&);
 			void do_handle_introduce_to(const ep_type&, const boost::system::error_code&);
 			void do_handle_request_session(const ep_type&, const boost::system::error_code&);
+			void do_send_routes_request(const ep_type&, simple_handler_type);
 			void do_handle_send_routes_request(const ep_type&, const boost::system::error_code&);
-			void do_handle_send_routes_request_to_all(const std::map<ep_type, boost::system::error_code>&);
 
 			bool do_handle_hello_received(const ep_type&, bool);
 			bool do_handle_contact_request_received(const ep_type&, cert_type, hash_type, const ep_type&);
 			void do_handle_contact_received(const ep_type&, hash_type, const ep_type&);
-			bool do_handle_presentation_received(const ep_type&, cert_type, fscp::server::presentation_status_type, bool);
+			void do_handle_presentation_received(const ep_type&, cert_type, fscp::server::presentation_status_type, bool, fscp::server::presentation_acceptance_handler_type);
 			bool do_handle_session_request_received(const ep_type&, const fscp::cipher_suite_list_type&, const fscp::elliptic_curve_list_type&, bool);
 			bool do_handle_session_received(const ep_type&, fscp::cipher_suite_type, fscp::elliptic_curve_type, bool);
 			void do_handle_session_failed(const ep_type&, bool);
 			void do_handle_session_error(const ep_type&, bool, const std::exception&);
 			void do_handle_session_established(const ep_type&, bool, const fscp::cipher_suite_type&, const fscp::elliptic_curve_type&);
 			void do_handle_session_lost(const ep_type&, fscp::server::session_loss_reason);
+			void do_handle_mtu_discovered(const ep_type&, const boost::system::error_code&, size_t);
 			void do_handle_data_received(const ep_type&, fscp::channel_number_type, fscp::SharedBuffer, boost::asio::const_buffer);
 			void do_handle_message(const ep_type&, fscp::SharedBuffer, const message&);
-			void do_handle_routes_request(const ep_type&);
+			void do_handle_routes_request(const ep_type&, const boost::optional<routes_message::version_type>&);
+			void do_send_routes_reply(const ep_type&, const boost::optional<routes_message::version_type>&, routes_message::version_type, const asiotap::ip_route_set&, const asiotap::ip_address_set&);
+			void do_record_local_routes_snapshot(routes_message::version_type, const asiotap::ip_route_set&, const asiotap::ip_address_set&);
 			void do_handle_routes(const asiotap::ip_network_address_list&, const ep_type&, routes_message::version_type, const asiotap::ip_route_set&, const asiotap::ip_address_set&);
+			void do_handle_routes_delta(const asiotap::ip_network_address_list&, const ep_type&, routes_message::version_type, routes_message::version_type, const asiotap::ip_route_set&, const asiotap::ip_route_set&, const asiotap::ip_address_set&, const asiotap::ip_address_set&);
+			void do_handle_mac_addresses(const ep_type&, const std::vector<switch_::ethernet_address_type>&);
+
+			struct resolution_cache_entry
+			{
+				// The host list is shared, not copied, on cache hits: a
+				// stable resolution then costs no allocation per refresh.
+				boost::shared_ptr<const std::vector<ep_type> > hosts;
+				boost::system::error_code ec;
+				boost::posix_time::ptime expires_at;
+			};
 
 			boost::shared_ptr<fscp::server> m_fscp_server;
 			boost::asio::deadline_timer m_contact_timer;
 			boost::asio::deadline_timer m_dynamic_contact_timer;
 			boost::asio::deadline_timer m_routes_request_timer;
+			std::map<endpoint, resolution_cache_entry> m_resolution_cache;
+			std::map<endpoint, std::vector<multi_resolution_handler_type> > m_pending_resolutions;
+			boost::mutex m_resolution_cache_mutex;
+			hash_list_type m_dynamic_contact_hashes;
 
 		private: /* Certificate validation */
 
@@ -537,10 +596,39 @@ namespace freelan
 			void build_ca_store(build_ca_store_when);
 			bool certificate_validation_method(bool, cryptoplus::x509::store_context);
 			bool certificate_is_valid(cert_type);
+			unsigned int scheduling_weight_for(const ep_type&, cert_type) const;
+			void open_certificate_verification_pool();
+			void close_certificate_verification_pool();
 
 			cryptoplus::x509::store m_ca_store;
 			boost::mutex m_ca_store_mutex;
 
+			// The issuer names of the configured revocation lists, with
+			// their cached encodings and hashes: the lists never change
+			// after load, so revocation checks compare integers first.
+			std::vector<cryptoplus::x509::name> m_crl_issuers;
+
+			// The fingerprints of the leaf certificates whose chain was
+			// validated against the current CA store: a session renewal
+			// usually presents the same certificate, so it skips the full
+			// chain verification. Rebuilding the store flushes the set, so
+			// an entry never outlives the CRLs it was checked against.
+			std::set<cryptoplus::buffer> m_validated_chain_cache;
+
+			static const size_t VALIDATED_CHAIN_CACHE_MAX_SIZE = 1024;
+
+			/**
+			 * \brief The number of threads dedicated to certificate verification.
+			 */
+			static const unsigned int CERTIFICATE_VERIFICATION_THREAD_COUNT = 2;
+
+			// X.509 chain verification runs on this dedicated pool so the
+			// FSCP presentation strand is not stalled while signatures are
+			// being checked.
+			boost::asio::io_service m_cert_verification_io_service;
+			boost::scoped_ptr<boost::asio::io_service::work> m_cert_verification_work;
+			boost::thread_group m_cert_verification_threads;
+
 		private: /* TAP adapter */
 
 			typedef asiotap::osi::filter<asiotap::osi::ethernet_frame> ethernet_filter_type;
@@ -556,9 +644,10 @@ namespace freelan
 			typedef asiotap::osi::filter<asiotap::osi::ipv6_frame> tun_ipv6_filter_type;
 			typedef asiotap::osi::complex_filter<asiotap::osi::tcp_frame, asiotap::osi::ipv4_frame>::type tun_tcpv4_filter_type;
 			typedef asiotap::osi::complex_filter<asiotap::osi::tcp_frame, asiotap::osi::ipv6_frame>::type tun_tcpv6_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::icmpv6_frame, asiotap::osi::ipv6_frame>::type tun_icmpv6_filter_type;
+			typedef asiotap::osi::static_filter<asiotap::osi::ipv6_frame, asiotap::osi::icmpv6_frame> tun_icmpv6_filter_type;
 			typedef asiotap::osi::const_helper<asiotap::osi::arp_frame> arp_helper_type;
 			typedef asiotap::osi::const_helper<asiotap::osi::dhcp_frame> dhcp_helper_type;
+			typedef asiotap::osi::const_helper<asiotap::osi::ipv6_frame> ipv6_helper_type;
 			typedef asiotap::osi::const_helper<asiotap::osi::icmpv6_frame> icmpv6_helper_type;
 			typedef asiotap::osi::proxy<asiotap::osi::arp_frame> arp_proxy_type;
 			typedef asiotap::osi::proxy<asiotap::osi::dhcp_frame> dhcp_proxy_type;
@@ -578,25 +667,42 @@ namespace freelan
 				});
 			}
 
-			template <typename ConstBufferSequence>
-			void push_tap_write(const ConstBufferSequence&, simple_handler_type);
-			void pop_tap_write();
+			/**
+			 * \brief A frame queued for delivery to the tap adapter.
+			 */
+			struct pending_tap_write_type
+			{
+				boost::asio::const_buffer data;
+				simple_handler_type handler;
+			};
 
-			void do_read_tap();
+			/**
+			 * \brief The maximum number of frames delivered to the tap
+			 * adapter in a single write batch.
+			 */
+			static const size_t TAP_WRITE_BATCH_SIZE = 64;
 
-			void do_handle_tap_adapter_read(fscp::SharedBuffer, const boost::system::error_code&, size_t);
+			void push_tap_write(boost::asio::const_buffer, simple_handler_type);
+			void flush_tap_writes();
+			void handle_tap_writes_complete(const boost::system::error_code&, const std::vector<size_t>&);
+
+			void do_read_tap(size_t queue);
+
+			void do_handle_tap_adapter_read(size_t queue, boost::shared_ptr<std::vector<fscp::SharedBuffer>>, const boost::system::error_code&, const std::vector<size_t>&);
+			void do_handle_tap_frame(const fscp::SharedBuffer&, size_t);
 			void do_handle_tap_adapter_write(const boost::system::error_code&);
 			void do_handle_arp_frame(const arp_helper_type&);
 			void do_handle_dhcp_frame(const dhcp_helper_type&);
-			void do_handle_icmpv6_frame(const icmpv6_helper_type&);
+			void do_handle_icmpv6_frame(const ipv6_helper_type&, const icmpv6_helper_type&);
 			bool do_handle_arp_request(const boost::asio::ip::address_v4&, ethernet_address_type&);
 			bool do_handle_icmpv6_neighbor_solicitation(const boost::asio::ip::address_v6&, ethernet_address_type&);
 
 			boost::asio::io_service m_tap_adapter_io_service;
 			boost::thread m_tap_adapter_thread;
 			boost::shared_ptr<asiotap::tap_adapter> m_tap_adapter;
-			std::queue<void_handler_type> m_tap_write_queue;
-			std::list<fscp::SharedBuffer> m_tap_adapter_buffers;
+			std::deque<pending_tap_write_type> m_tap_write_queue;
+			fscp::TieredSharedBufferPool m_tap_adapter_buffers;
+			fscp::SharedBufferPool m_proxy_buffers;
 
 			ethernet_filter_type m_ethernet_filter;
 			arp_filter_type m_arp_filter;
@@ -619,6 +725,25 @@ namespace freelan
 
 			boost::scoped_ptr<asiotap::osi::tcp_mss_morpher> m_tcp_mss_morpher;
 
+			/**
+			 * \brief The dispatch decision for a frame read in tun mode.
+			 */
+			enum class tun_frame_action : uint8_t
+			{
+				route = 0,
+				parse = 1,
+				parse_icmpv6 = 2
+			};
+
+			void update_tun_frame_dispatch();
+
+			// The dispatch table for frames read in tun mode, indexed by the
+			// IPv6 next-header byte. It is computed from the active morphers
+			// and proxies, so the frames that need none of them reach the
+			// router on a two-byte inspection instead of going through the
+			// generic filter machinery.
+			boost::array<tun_frame_action, 256> m_tun_ipv6_dispatch;
+
 		private: /* Switch & router */
 
 			typedef asiotap::route_manager::route_type route_type;
@@ -637,6 +762,8 @@ namespace freelan
 				}
 
 				boost::optional<routes_message::version_type> version;
+				asiotap::ip_route_set routes;
+				asiotap::ip_address_set dns_servers;
 				std::vector<asiotap::route_manager::entry_type> system_route_entries;
 				asiotap::route_manager::entry_type saved_system_route;
 				std::vector<asiotap::dns_servers_manager::entry_type> dns_servers_entries;
@@ -644,6 +771,14 @@ namespace freelan
 
 			typedef std::map<ep_type, client_router_info_type> client_router_info_map_type;
 
+			struct local_routes_snapshot_type
+			{
+				asiotap::ip_route_set routes;
+				asiotap::ip_address_set dns_servers;
+			};
+
+			typedef std::map<routes_message::version_type, local_routes_snapshot_type> local_routes_history_map_type;
+
 			void async_register_switch_port(const ep_type& host, void_handler_type handler)
 			{
 				m_router_strand.post(boost::bind(&core::do_register_switch_port, this, host, handler));
@@ -675,25 +810,39 @@ namespace freelan
 			}
 
 			template <typename WriteHandler>
-			void async_write_switch(const port_index_type& index, boost::asio::const_buffer data, WriteHandler handler)
+			void async_write_switch(const port_index_type& index, boost::asio::const_buffer data, const boost::optional<switch_::ethernet_frame_context_type>& context, WriteHandler handler)
+			{
+				m_router_strand.post(boost::bind(&core::do_write_switch, this, index, data, context, handler));
+			}
+
+			template <typename WriteHandler>
+			void async_write_switch(const port_index_type& index, fscp::SharedBuffer buffer, boost::asio::const_buffer data, const boost::optional<switch_::ethernet_frame_context_type>& context, WriteHandler handler)
 			{
-				m_router_strand.post(boost::bind(&core::do_write_switch, this, index, data, handler));
+				m_router_strand.post(boost::bind(&core::do_write_switch_buffer, this, index, buffer, data, context, handler));
 			}
 
 			template <typename WriteHandler>
-			void async_write_router(const port_index_type& index, boost::asio::const_buffer data, WriteHandler handler)
+			void async_write_router(const port_index_type& index, boost::asio::const_buffer data, const boost::optional<boost::asio::ip::address>& destination, WriteHandler handler)
 			{
-				m_router_strand.post(boost::bind(&core::do_write_router, this, index, data, handler));
+				m_router_strand.post(boost::bind(&core::do_write_router, this, index, data, destination, handler));
 			}
 
 			void do_register_switch_port(const ep_type&, void_handler_type);
+			void async_write_switch_endpoints(const std::vector<port_index_type>&, boost::asio::const_buffer, switch_::multi_write_handler_type);
 			void do_register_router_port(const ep_type&, void_handler_type);
+			void async_send_classified_data(const ep_type&, bool, boost::asio::const_buffer, fscp::server::simple_handler_type);
+			void async_send_classified_data_in_place(const ep_type&, bool, fscp::SharedBuffer, boost::asio::const_buffer, fscp::server::simple_handler_type);
 			void do_unregister_switch_port(const ep_type&, void_handler_type);
 			void do_unregister_router_port(const ep_type&, void_handler_type);
 			void do_save_system_route(const ep_type&, const route_type&, void_handler_type);
 			void do_clear_client_router_info(const ep_type&, void_handler_type);
-			void do_write_switch(const port_index_type&, boost::asio::const_buffer, switch_::multi_write_handler_type);
-			void do_write_router(const port_index_type&, boost::asio::const_buffer, router::port_type::write_handler_type);
+			void do_write_switch(const port_index_type&, boost::asio::const_buffer, const boost::optional<switch_::ethernet_frame_context_type>&, switch_::multi_write_handler_type);
+			void do_write_switch_buffer(const port_index_type&, fscp::SharedBuffer, boost::asio::const_buffer, const boost::optional<switch_::ethernet_frame_context_type>&, switch_::multi_write_handler_type);
+			void do_write_router(const port_index_type&, boost::asio::const_buffer, const boost::optional<boost::asio::ip::address>&, router::port_type::write_handler_type);
+			void do_reload_local_routes(const asiotap::ip_route_set&, const asiotap::ip_address_set&);
+			void do_handle_local_mac_learned(const port_index_type&, const switch_::ethernet_address_type&);
+			void do_gossip_local_macs(const boost::system::error_code&);
+			void do_send_local_macs_to(const ep_type&);
 
 			boost::asio::strand m_router_strand;
 
@@ -702,8 +851,18 @@ namespace freelan
 			asiotap::route_manager m_route_manager;
 			asiotap::dns_servers_manager m_dns_servers_manager;
 			boost::optional<routes_message::version_type> m_local_routes_version;
+			local_routes_history_map_type m_local_routes_history;
 			client_router_info_map_type m_client_router_info_map;
 
+			// The ethernet addresses learned behind the local tap adapter and
+			// the ones not yet gossiped, both confined to the router strand.
+			// Newly learned addresses are batched behind a short timer so a
+			// burst of new stations costs one message, not one per station.
+			std::set<switch_::ethernet_address_type> m_local_macs;
+			std::vector<switch_::ethernet_address_type> m_pending_mac_gossip;
+			boost::asio::deadline_timer m_mac_gossip_timer;
+			bool m_mac_gossip_pending;
+
 		private:
 
 			void open_web_server();
@@ -49,6 +49,7 @@
 #include <asiotap/asiotap.hpp>
 
 #include <fscp/server.hpp>
+#include <fscp/frame_recorder.hpp>
 
 #include <boost/variant.hpp>
 #include <boost/shared_ptr.hpp>
@@ -185,6 +186,36 @@ namespace freelan
 	{
 		return endpoint_port_index_type(ep);
 	}
+
+	/**
+	 * \brief Build a compact frame-trace peer identifier from a port index.
+	 * \param index The port index.
+	 * \return The endpoint peer identifier for endpoint ports, 1 for tap adapter ports and 0 for null ports.
+	 */
+	inline uint64_t to_trace_peer_id(const port_index_type& index)
+	{
+		class visitor_type : public boost::static_visitor<uint64_t>
+		{
+			public:
+
+				uint64_t operator()(const null_port_index_type&) const
+				{
+					return 0;
+				}
+
+				uint64_t operator()(const tap_adapter_port_index_type&) const
+				{
+					return 1;
+				}
+
+				uint64_t operator()(const endpoint_port_index_type& idx) const
+				{
+					return fscp::frame_recorder::to_peer_id(idx.endpoint());
+				}
+		};
+
+		return boost::apply_visitor(visitor_type(), index);
+	}
 }
 
 #endif /* PORT_INDEX_HPP */
@@ -49,6 +49,7 @@
 #include <algorithm>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
@@ -79,6 +80,16 @@ namespace freelan
 			 */
 			typedef unsigned int port_group_type;
 
+			/**
+			 * \brief The dense port handle type.
+			 *
+			 * A handle is a small integer assigned at registration time that
+			 * indexes the port storage directly: the routes trie and the
+			 * per-frame lookups key on handles, so the variant port identity
+			 * is only compared at the registration boundary.
+			 */
+			typedef unsigned int port_handle_type;
+
 			/**
 			 * \brief A router port type.
 			 */
@@ -224,11 +235,6 @@ namespace freelan
 					router* m_router;
 			};
 
-			/**
-			 * \brief The port list type.
-			 */
-			typedef std::map<port_index_type, port_type> port_list_type;
-
 			/**
 			 * \brief Create a new router.
 			 * \param configuration The router configuration.
@@ -249,14 +255,12 @@ namespace freelan
 			 * \brief Register a router port.
 			 * \param index The index of the port.
 			 * \param port The port to register. Cannot be null.
+			 * \return The dense handle assigned to the port.
+			 *
+			 * Registering an index that is already registered replaces the
+			 * port and keeps its handle.
 			 */
-			void register_port(port_index_type index, port_type port)
-			{
-				port_type& local_port = (m_ports[index] = port);
-
-				// This takes care of automatically clearing the route cache whenever needed.
-				local_port.associate_to_router(this);
-			}
+			port_handle_type register_port(port_index_type index, port_type port);
 
 			/**
 			 * \brief Unregister a port.
@@ -264,10 +268,7 @@ namespace freelan
 			 *
 			 * If the port was not registered, nothing is done.
 			 */
-			void unregister_port(port_index_type index)
-			{
-				m_ports.erase(index);
-			}
+			void unregister_port(port_index_type index);
 
 			/**
 			 * \brief Check if the specified port is registered.
@@ -276,52 +277,133 @@ namespace freelan
 			 */
 			bool is_registered(port_index_type index) const
 			{
-				return (m_ports.find(index) != m_ports.end());
+				return (m_port_handles.find(index) != m_port_handles.end());
 			}
 
 			/**
 			 * \brief Get the port associated to a given index, if it exists.
 			 * \param index The index of the port to get.
-			 * \return A pointer to the port.
+			 * \return A pointer to the port. It remains valid until the next registration or unregistration.
 			 */
 			port_type* get_port(port_index_type index)
 			{
-				const port_list_type::iterator port_entry = m_ports.find(index);
+				const port_handle_map_type::const_iterator handle_entry = m_port_handles.find(index);
 
-				if (port_entry == m_ports.end())
+				if (handle_entry == m_port_handles.end())
 				{
 					return nullptr;
 				}
 
-				return &port_entry->second;
+				return &m_port_slots[handle_entry->second].port;
 			}
 
 			/**
 			 * \brief Receive data trough the specified port.
 			 * \param index The port from which the data comes.
 			 * \param data The data to write.
+			 * \param destination The destination address of the frame, if it was already parsed. When set, the frame is not parsed again.
 			 * \param handler The handler to call when the write is complete.
 			 */
-			void async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler);
+			void async_write(port_index_type index, boost::asio::const_buffer data, const boost::optional<boost::asio::ip::address>& destination, port_type::write_handler_type handler);
 
 		private:
 
-			std::vector<const port_type*> get_targets_for(port_index_type, boost::asio::const_buffer);
+			/**
+			 * \brief A port storage slot, indexed by the port handle.
+			 *
+			 * The variant identity is kept here only for the registration
+			 * boundary: the routing structures refer to ports by handle.
+			 */
+			struct port_entry_type
+			{
+				port_entry_type() :
+					index(),
+					port(),
+					used(false)
+				{}
+
+				port_index_type index;
+				port_type port;
+				bool used;
+			};
+
+			typedef std::map<port_index_type, port_handle_type> port_handle_map_type;
+
+			std::vector<const port_type*> get_targets_for(port_handle_type, boost::asio::const_buffer);
 
 			template <typename AddressType>
-			std::vector<const port_type*> get_targets_for(port_index_type, const AddressType&);
+			std::vector<const port_type*> get_targets_for(port_handle_type, const AddressType&, size_t flow_hash_value);
 
 			router_configuration m_configuration;
 
-			port_list_type m_ports;
+			std::vector<port_entry_type> m_port_slots;
+			std::vector<port_handle_type> m_free_handles;
+
+			// The only map keyed on the variant identity: it is consulted at
+			// the registration boundary and once per frame, at the entry of
+			// async_write().
+			port_handle_map_type m_port_handles;
 
 			asiotap::osi::filter<asiotap::osi::ipv4_frame> m_ipv4_filter;
 			asiotap::osi::filter<asiotap::osi::ipv6_frame> m_ipv6_filter;
 
-			typedef std::multimap<asiotap::ip_route, port_index_type> routes_port_type;
+			/**
+			 * \brief A binary trie that maps network prefixes to port handles.
+			 *
+			 * Lookups walk the destination address bit by bit and collect the
+			 * ports of every route that contains it, most specific first: a
+			 * longest-prefix-match lookup costs at most one step per prefix
+			 * bit instead of a scan over every advertised route.
+			 */
+			template <typename AddressType>
+			class routes_trie_type
+			{
+				public:
+
+					routes_trie_type()
+					{
+						clear();
+					}
+
+					void clear();
+					void insert(const asiotap::base_ip_network_address<AddressType>& network_address, port_handle_type port);
+					void find(const AddressType& addr, std::vector<port_handle_type>& results, std::vector<size_t>& group_sizes) const;
+
+				private:
+
+					struct node_type
+					{
+						node_type()
+						{
+							children[0] = -1;
+							children[1] = -1;
+						}
+
+						int children[2];
+						std::vector<port_handle_type> ports;
+					};
+
+					std::vector<node_type> m_nodes;
+			};
+
+			struct routes_type
+			{
+				routes_trie_type<boost::asio::ip::address_v4> ipv4;
+				routes_trie_type<boost::asio::ip::address_v6> ipv6;
+			};
+
+			const routes_type& routes() const;
+			void find_route_ports(const boost::asio::ip::address_v4&, std::vector<port_handle_type>&, std::vector<size_t>&);
+			void find_route_ports(const boost::asio::ip::address_v6&, std::vector<port_handle_type>&, std::vector<size_t>&);
+
+			mutable boost::optional<routes_type> m_routes;
 
-			const routes_port_type& routes() const;
-			mutable boost::optional<routes_port_type> m_routes;
+			// get_targets_for() is always invoked from the same strand, so
+			// the lookup results can be reused across frames to avoid
+			// per-frame allocations.
+			std::vector<port_handle_type> m_route_ports_scratch;
+			std::vector<size_t> m_route_groups_scratch;
+			std::vector<const port_type*> m_ecmp_ports_scratch;
 	};
 }
 
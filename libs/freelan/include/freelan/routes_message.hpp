@@ -67,15 +67,39 @@ namespace freelan
 			 */
 			typedef uint32_t version_type;
 
+			/**
+			 * \brief Estimate the size of a routes message.
+			 * \param route_count The count of routes the message will carry. For a delta, added and removed routes together.
+			 * \param dns_server_count The count of DNS servers the message will carry. For a delta, added and removed DNS servers together.
+			 * \return An upper bound of the buffer size write() or write_delta() needs.
+			 */
+			static size_t estimate_size(size_t route_count, size_t dns_server_count);
+
 			/**
 			 * \brief Write a routes message to a buffer.
 			 * \param buf The buffer to write to.
 			 * \param buf_len The length of buf.
 			 * \param version The version.
 			 * \param routes The routes.
+			 * \param compact Whether the routes may be packed into prefix-compressed groups. Only enable it when the receiver is known to understand them.
 			 * \return The count of bytes written.
 			 */
-			static size_t write(void* buf, size_t buf_len, version_type version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers);
+			static size_t write(void* buf, size_t buf_len, version_type version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers, bool compact = false);
+
+			/**
+			 * \brief Write a routes delta message to a buffer.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param version The version the delta brings the receiver to.
+			 * \param base_version The version the delta applies against.
+			 * \param added_routes The routes added since base_version.
+			 * \param removed_routes The routes removed since base_version.
+			 * \param added_dns_servers The DNS servers added since base_version.
+			 * \param removed_dns_servers The DNS servers removed since base_version.
+			 * \param compact Whether the routes may be packed into prefix-compressed groups. Only enable it when the receiver is known to understand them.
+			 * \return The count of bytes written.
+			 */
+			static size_t write_delta(void* buf, size_t buf_len, version_type version, version_type base_version, const asiotap::ip_route_set& added_routes, const asiotap::ip_route_set& removed_routes, const asiotap::ip_address_set& added_dns_servers, const asiotap::ip_address_set& removed_dns_servers, bool compact = false);
 
 			/**
 			 * \brief Get the version.
@@ -83,18 +107,45 @@ namespace freelan
 			 */
 			version_type version() const;
 
+			/**
+			 * \brief Check whether the message is a delta.
+			 * \return true if the message only carries the changes against a base version.
+			 */
+			bool is_delta() const
+			{
+				return (type() == MT_ROUTES_DELTA);
+			}
+
+			/**
+			 * \brief Get the base version a delta applies against.
+			 * \return The base version. Only meaningful if is_delta() returns true.
+			 */
+			version_type base_version() const;
+
 			/**
 			 * \brief Get the routes.
-			 * \return The routes.
+			 * \return The routes. For a delta, the added routes.
 			 */
 			const asiotap::ip_route_set& routes() const;
 
 			/**
 			* \brief Get the DNS servers.
-			* \return The DNS servers.
+			* \return The DNS servers. For a delta, the added DNS servers.
 			*/
 			const asiotap::ip_address_set& dns_servers() const;
 
+			/**
+			 * \brief Get the removed routes of a delta.
+			 * \return The removed routes. Always empty for a full message.
+			 */
+			const asiotap::ip_route_set& removed_routes() const;
+
+			/**
+			 * \brief Get the removed DNS servers of a delta.
+			 * \return The removed DNS servers. Always empty for a full message.
+			 */
+			const asiotap::ip_address_set& removed_dns_servers() const;
+
 			/**
 			 * \brief Create a routes_message and map it on a buffer.
 			 * \param buf The buffer.
@@ -115,6 +166,8 @@ namespace freelan
 			struct routes_and_dns_servers {
 				asiotap::ip_route_set routes;
 				asiotap::ip_address_set dns_servers;
+				asiotap::ip_route_set removed_routes;
+				asiotap::ip_address_set removed_dns_servers;
 			};
 
 			void read_and_cache_results() const;
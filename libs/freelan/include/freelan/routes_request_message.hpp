@@ -46,6 +46,8 @@
 #ifndef FREELAN_ROUTES_REQUEST_MESSAGE_HPP
 #define FREELAN_ROUTES_REQUEST_MESSAGE_HPP
 
+#include <boost/optional.hpp>
+
 #include "message.hpp"
 
 namespace freelan
@@ -57,6 +59,11 @@ namespace freelan
 	{
 		public:
 
+			/**
+			 * \brief The version typedef.
+			 */
+			typedef uint32_t version_type;
+
 			/**
 			 * \brief Write a routes request message to a buffer.
 			 * \param buf The buffer to write to.
@@ -65,6 +72,21 @@ namespace freelan
 			 */
 			static size_t write(void* buf, size_t buf_len);
 
+			/**
+			 * \brief Write a routes request message that advertises the version the requester already knows.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param known_version The version the requester already knows.
+			 * \return The count of bytes written.
+			 */
+			static size_t write(void* buf, size_t buf_len, version_type known_version);
+
+			/**
+			 * \brief Get the version the requester already knows, if it advertised one.
+			 * \return The known version, if any.
+			 */
+			boost::optional<version_type> known_version() const;
+
 			/**
 			 * \brief Create a routes_request_message and map it on a buffer.
 			 * \param buf The buffer.
@@ -52,12 +52,22 @@
 #include "configuration.hpp"
 
 #include <map>
+#include <deque>
+#include <atomic>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <fscp/logger.hpp>
 #include <fscp/presentation_store.hpp>
 
+#include <cryptoplus/buffer.hpp>
+
+#include <kfather/value.hpp>
+
 #include <asiotap/types/endpoint.hpp>
 
 #include <mongooseplus/mongooseplus.hpp>
@@ -68,8 +78,10 @@ namespace freelan
 	{
 		public:
 			typedef boost::function<bool (const std::string& username, const std::string& password, const std::string& remote_host, uint16_t remote_post)> authentication_handler_type;
+			typedef boost::function<kfather::object_type ()> statistics_handler_type;
 
-			web_server(fscp::logger& _logger, const freelan::server_configuration& configuration, authentication_handler_type authentication_handler);
+			web_server(fscp::logger& _logger, const freelan::server_configuration& configuration, authentication_handler_type authentication_handler, statistics_handler_type statistics_handler = statistics_handler_type());
+			~web_server();
 
 		protected:
 			route_type& register_authenticated_route(route_type&& route);
@@ -82,6 +94,8 @@ namespace freelan
 
 			mongooseplus::routed_web_server::request_result handle_request(mongooseplus::request&) override;
 			mongooseplus::routed_web_server::request_result handle_http_error(mongooseplus::request&) override;
+			mongooseplus::routed_web_server::request_result handle_poll(mongooseplus::request&) override;
+			mongooseplus::routed_web_server::request_result handle_close(mongooseplus::request&) override;
 
 		private:
 			struct client_information_type
@@ -107,9 +121,37 @@ namespace freelan
 
 			client_information_type* get_client_information(mongooseplus::request&);
 
+			// A certificate signing operation in flight on the signing thread. The connection waits with MG_MORE and is completed from handle_poll() once done flips.
+			struct pending_signing_type
+			{
+				pending_signing_type() :
+					done(false),
+					success(false)
+				{
+				}
+
+				std::atomic<bool> done;
+				bool success;
+				cryptoplus::buffer certificate_der;
+			};
+
+			typedef boost::shared_ptr<pending_signing_type> pending_signing_ptr;
+
+			static std::string make_signing_cache_key(const std::string& username, const void* buf, size_t buf_len);
+			void complete_pending_signing(mongooseplus::request& req, const pending_signing_type& pending);
+
 			fscp::logger& m_logger;
 			authentication_handler_type m_authentication_handler;
 			std::map<std::string, client_information_type> m_client_information_map;
+
+			// RSA signing is slow: it runs on a dedicated thread so the poll loop keeps serving other clients, and recent results are cached so idempotent re-requests during retries are answered immediately.
+			boost::asio::io_service m_signing_io_service;
+			boost::scoped_ptr<boost::asio::io_service::work> m_signing_work;
+			boost::thread m_signing_thread;
+			boost::mutex m_signing_mutex;
+			std::map<void*, pending_signing_ptr> m_pending_signings;
+			std::map<std::string, cryptoplus::buffer> m_signing_cache;
+			std::deque<std::string> m_signing_cache_order;
 	};
 }
 
@@ -47,11 +47,19 @@
 #define SWITCH_HPP
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
+#include <boost/optional.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <fscp/shared_buffer.hpp>
+
+#include <asiotap/osi/ethernet_address.hpp>
 
 #include "configuration.hpp"
 #include "port_index.hpp"
@@ -75,11 +83,30 @@ namespace freelan
 			 */
 			typedef unsigned int port_group_type;
 
+			/**
+			 * \brief The dense port handle type.
+			 *
+			 * A handle is a small integer assigned at registration time that
+			 * indexes the port storage directly: every per-frame structure
+			 * keys on handles, so the variant port identity is only compared
+			 * at the registration boundary.
+			 */
+			typedef unsigned int port_handle_type;
+
 			/**
 			 * \brief The multi write result type.
 			 */
 			typedef std::map<port_index_type, boost::system::error_code> multi_write_result_type;
 
+			/**
+			 * \brief The learned ethernet address handler type.
+			 *
+			 * Called whenever a frame teaches the switch a new (or moved)
+			 * ethernet address mapping, from the same strand that serializes
+			 * the async_write() calls.
+			 */
+			typedef boost::function<void (const port_index_type&, const asiotap::osi::ethernet_address&)> mac_learned_handler_type;
+
 			/**
 			 * \brief The write handler type.
 			 */
@@ -102,6 +129,21 @@ namespace freelan
 					 */
 					typedef boost::function<void (boost::asio::const_buffer data, write_handler_type handler)> write_function_type;
 
+					/**
+					 * \brief A buffer write function type, for ports that can take ownership of the source buffer and avoid a payload copy.
+					 */
+					typedef boost::function<void (fscp::SharedBuffer buffer, boost::asio::const_buffer data, write_handler_type handler)> buffer_write_function_type;
+
+					/**
+					 * \brief A batch write function type, for ports whose underlying transport can submit one frame to several targets in a single call.
+					 *
+					 * All the ports that declare a batch write function are
+					 * assumed to share the same underlying transport: the
+					 * switch submits all the batchable targets of a frame
+					 * through any one of them.
+					 */
+					typedef boost::function<void (const std::vector<port_index_type>& targets, boost::asio::const_buffer data, multi_write_handler_type handler)> batch_write_function_type;
+
 					/**
 					 * \brief Create a new default port.
 					 */
@@ -120,6 +162,32 @@ namespace freelan
 						m_group(_group)
 					{}
 
+					/**
+					 * \brief Create a new port with a zero-copy capable write function.
+					 * \param write_function The write function to use.
+					 * \param buffer_write_function The buffer write function to use when the port is the only target.
+					 * \param _group The group this port belongs to.
+					 */
+					port_type(write_function_type write_function, buffer_write_function_type buffer_write_function, port_group_type _group) :
+						m_write_function(write_function),
+						m_buffer_write_function(buffer_write_function),
+						m_group(_group)
+					{}
+
+					/**
+					 * \brief Create a new port with zero-copy and batch capable write functions.
+					 * \param write_function The write function to use.
+					 * \param buffer_write_function The buffer write function to use when the port is the only target.
+					 * \param batch_write_function The batch write function to use when several ports of the same transport are targeted.
+					 * \param _group The group this port belongs to.
+					 */
+					port_type(write_function_type write_function, buffer_write_function_type buffer_write_function, batch_write_function_type batch_write_function, port_group_type _group) :
+						m_write_function(write_function),
+						m_buffer_write_function(buffer_write_function),
+						m_batch_write_function(batch_write_function),
+						m_group(_group)
+					{}
+
 					/**
 					 * \brief Write data to the port.
 					 * \param data The data to write.
@@ -130,6 +198,46 @@ namespace freelan
 						m_write_function(data, handler);
 					}
 
+					/**
+					 * \brief Check whether the port supports zero-copy buffer writes.
+					 * \return true if async_write_buffer() can be called.
+					 */
+					bool supports_buffer_writes() const
+					{
+						return !m_buffer_write_function.empty();
+					}
+
+					/**
+					 * \brief Write data to the port, handing over the source buffer.
+					 * \param buffer The buffer that contains the data. The port takes exclusive ownership of it.
+					 * \param data The data to write. Must point inside buffer.
+					 * \param handler The handler to call when the write is complete.
+					 */
+					void async_write_buffer(fscp::SharedBuffer buffer, boost::asio::const_buffer data, write_handler_type handler)
+					{
+						m_buffer_write_function(buffer, data, handler);
+					}
+
+					/**
+					 * \brief Check whether the port supports batch writes.
+					 * \return true if async_write_batch() can be called.
+					 */
+					bool supports_batch_writes() const
+					{
+						return !m_batch_write_function.empty();
+					}
+
+					/**
+					 * \brief Write data to several ports of the same transport in a single call.
+					 * \param targets The target ports. All of them must support batch writes.
+					 * \param data The data to write.
+					 * \param handler The handler to call with the per-port results when all the writes completed.
+					 */
+					void async_write_batch(const std::vector<port_index_type>& targets, boost::asio::const_buffer data, multi_write_handler_type handler)
+					{
+						m_batch_write_function(targets, data, handler);
+					}
+
 					port_group_type group() const
 					{
 						return m_group;
@@ -138,14 +246,11 @@ namespace freelan
 				private:
 
 					write_function_type m_write_function;
+					buffer_write_function_type m_buffer_write_function;
+					batch_write_function_type m_batch_write_function;
 					port_group_type m_group;
 			};
 
-			/**
-			 * \brief The port list type.
-			 */
-			typedef std::map<port_index_type, port_type> port_list_type;
-
 			/**
 			 * \brief Create a new switch.
 			 * \param configuration The switch configuration.
@@ -153,18 +258,23 @@ namespace freelan
 			 */
 			switch_(const switch_configuration& configuration, const unsigned int max_entries = MAX_ENTRIES_DEFAULT) :
 				m_configuration(configuration),
-				m_max_entries(max_entries)
+				m_max_entries(max_entries),
+				m_ethernet_address_map(max_entries),
+				m_unknown_unicast_floods(0),
+				m_suppressed_floods(0),
+				m_gossip_learned(0)
 			{}
 
 			/**
 			 * \brief Register a switch port.
 			 * \param index The index of the port.
 			 * \param port The port to register. Cannot be null.
+			 * \return The dense handle assigned to the port.
+			 *
+			 * Registering an index that is already registered replaces the
+			 * port and keeps its handle.
 			 */
-			void register_port(port_index_type index, port_type port)
-			{
-				m_ports[index] = port;
-			}
+			port_handle_type register_port(port_index_type index, port_type port);
 
 			/**
 			 * \brief Unregister a port.
@@ -172,10 +282,7 @@ namespace freelan
 			 *
 			 * If the port was not registered, nothing is done.
 			 */
-			void unregister_port(port_index_type index)
-			{
-				m_ports.erase(index);
-			}
+			void unregister_port(port_index_type index);
 
 			/**
 			 * \brief Check if the specified port is registered.
@@ -184,34 +291,268 @@ namespace freelan
 			 */
 			bool is_registered(port_index_type index) const
 			{
-				return (m_ports.find(index) != m_ports.end());
+				return (m_port_handles.find(index) != m_port_handles.end());
+			}
+
+			/**
+			 * \brief Get the approximate count of learned ethernet addresses.
+			 * \return The occupancy of the ethernet address table. The value is a relaxed snapshot intended for diagnostics and can be read from any thread.
+			 */
+			size_t ethernet_address_map_size() const
+			{
+				return m_ethernet_address_map.size();
+			}
+
+			/**
+			 * \brief Set the handler called when a frame teaches the switch a new ethernet address.
+			 * \param handler The handler. Can be null to disable the notifications.
+			 */
+			void set_mac_learned_handler(mac_learned_handler_type handler)
+			{
+				m_mac_learned_handler = handler;
+			}
+
+			/**
+			 * \brief Learn a gossiped ethernet address mapping.
+			 * \param index The port the address was gossiped by.
+			 * \param address The gossiped ethernet address.
+			 * \return true if the mapping was learned.
+			 *
+			 * A gossiped mapping never overrides an entry learned from live
+			 * traffic: the data plane is authoritative, gossip only warms
+			 * lookups that would otherwise miss and flood.
+			 */
+			bool learn(port_index_type index, const asiotap::osi::ethernet_address& address);
+
+			/**
+			 * \brief Get the count of unicast frames that were flooded because their target address was unknown.
+			 * \return The flood count, as a relaxed snapshot intended for diagnostics.
+			 */
+			uint64_t unknown_unicast_flood_count() const
+			{
+				return m_unknown_unicast_floods.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the count of unicast frames whose flood was suppressed by an address table hit.
+			 * \return The suppressed flood count, as a relaxed snapshot intended for diagnostics.
+			 */
+			uint64_t suppressed_flood_count() const
+			{
+				return m_suppressed_floods.load(std::memory_order_relaxed);
 			}
 
+			/**
+			 * \brief Get the count of entries learned from gossip.
+			 * \return The gossip-learned entry count, as a relaxed snapshot intended for diagnostics.
+			 */
+			uint64_t gossip_learned_count() const
+			{
+				return m_gossip_learned.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief The ethernet address type.
+			 *
+			 * The type is backed by a single integer, so the comparisons and
+			 * hashing done for every switched frame are single integer
+			 * operations.
+			 */
+			typedef asiotap::osi::ethernet_address ethernet_address_type;
+
+			/**
+			 * \brief The parse context of an ethernet frame.
+			 *
+			 * Holds the addresses discovered when the frame went through the
+			 * OSI filters, so the switching code does not have to parse the
+			 * frame a second time.
+			 */
+			struct ethernet_frame_context_type
+			{
+				ethernet_address_type sender;
+				ethernet_address_type target;
+			};
+
 			/**
 			 * \brief Receive data trough the specified port.
 			 * \param index The port from which the data comes.
 			 * \param data The data to write.
+			 * \param context The parse context of the frame, if it was already parsed.
 			 * \param handler The handler to call when the write is complete.
 			 */
-			void async_write(port_index_type index, boost::asio::const_buffer data, multi_write_handler_type handler);
+			void async_write(port_index_type index, boost::asio::const_buffer data, const boost::optional<ethernet_frame_context_type>& context, multi_write_handler_type handler);
+
+			/**
+			 * \brief Receive data trough the specified port, allowing a zero-copy write when the frame has a single target.
+			 * \param index The port from which the data comes.
+			 * \param buffer The buffer that contains the data. Ownership is handed over to the target port if the zero-copy path is taken.
+			 * \param data The data to write. Must point inside buffer.
+			 * \param context The parse context of the frame, if it was already parsed.
+			 * \param handler The handler to call when the write is complete.
+			 */
+			void async_write(port_index_type index, fscp::SharedBuffer buffer, boost::asio::const_buffer data, const boost::optional<ethernet_frame_context_type>& context, multi_write_handler_type handler);
+
+			/**
+			 * \brief Extract an ethernet address from a buffer.
+			 * \param buf The buffer. Must be at least 6 bytes long.
+			 * \return The ethernet address.
+			 */
+			static ethernet_address_type to_ethernet_address(boost::asio::const_buffer buf);
 
 		private:
 
-			std::set<port_index_type> get_targets_for(port_index_type, boost::asio::const_buffer);
-			std::set<port_index_type> get_targets_for(port_list_type::const_iterator);
+			/**
+			 * \brief A port storage slot, indexed by the port handle.
+			 *
+			 * The variant identity is kept here only so results and batch
+			 * writes can be reported to the callers in terms of it.
+			 */
+			struct port_entry_type
+			{
+				port_entry_type() :
+					index(),
+					port(),
+					used(false)
+				{}
+
+				port_index_type index;
+				port_type port;
+				bool used;
+			};
+
+			typedef std::map<port_index_type, port_handle_type> port_handle_map_type;
+
+			const port_index_type& index_of(port_handle_type handle) const
+			{
+				return m_port_slots[handle].index;
+			}
+
+			port_type& port_of(port_handle_type handle)
+			{
+				return m_port_slots[handle].port;
+			}
+
+			void get_targets_for(port_handle_type, boost::asio::const_buffer, const boost::optional<ethernet_frame_context_type>&, std::vector<port_handle_type>&);
+			void get_targets_for(port_handle_type, std::vector<port_handle_type>&);
+			void async_write_targets(const std::vector<port_handle_type>&, boost::asio::const_buffer, multi_write_handler_type);
+
+			// async_write() is always invoked from the same strand, so the
+			// target list can be reused across frames to avoid per-frame
+			// allocations.
+			std::vector<port_handle_type> m_targets_scratch;
+			std::vector<port_handle_type> m_batch_scratch;
+			std::vector<port_index_type> m_batch_indexes_scratch;
 
 			switch_configuration m_configuration;
 			unsigned int m_max_entries;
 
-			port_list_type m_ports;
+			std::vector<port_entry_type> m_port_slots;
+			std::vector<port_handle_type> m_free_handles;
 
-			typedef boost::array<uint8_t, 6> ethernet_address_type;
-			typedef std::map<ethernet_address_type, port_index_type> ethernet_address_map_type;
+			// The only map keyed on the variant identity: it is consulted at
+			// the registration boundary and once per frame, at the entry of
+			// async_write().
+			port_handle_map_type m_port_handles;
+
+			/**
+			 * \brief An open-addressing hash table that maps ethernet addresses to port handles.
+			 *
+			 * The table uses linear probing with a bounded probe length: when a
+			 * probe sequence is exhausted, the first probed entry is evicted,
+			 * which naturally bounds the table size like a hardware CAM would.
+			 *
+			 * Entries age out after MAX_ENTRY_AGE of inactivity, like a
+			 * hardware bridge: learning refreshes the entry and expiry is
+			 * checked lazily while probing, so no maintenance pass is needed
+			 * and every operation stays O(1).
+			 */
+			class ethernet_address_map_type
+			{
+				public:
+
+					/**
+					 * \brief The duration after which an entry that was not refreshed expires.
+					 */
+					static const boost::posix_time::time_duration MAX_ENTRY_AGE;
+
+					explicit ethernet_address_map_type(size_t max_entries);
+
+					/**
+					 * \brief Look for the port associated to the specified ethernet address.
+					 * \param address The ethernet address.
+					 * \return A pointer to the associated port handle, or nullptr if the address is unknown.
+					 */
+					const port_handle_type* find(const ethernet_address_type& address) const;
+
+					/**
+					 * \brief Associate an ethernet address to a port, evicting an older entry if needed.
+					 * \param address The ethernet address.
+					 * \param port The port handle.
+					 * \return true if the mapping changed: the address was unknown (or expired), or it moved to another port.
+					 */
+					bool insert(const ethernet_address_type& address, port_handle_type port);
+
+					/**
+					 * \brief Remove the entry for the specified ethernet address, if any.
+					 * \param address The ethernet address.
+					 */
+					void erase(const ethernet_address_type& address);
+
+					/**
+					 * \brief Remove every entry that points to the specified port handle.
+					 * \param port The port handle.
+					 *
+					 * Handles are reused across registrations: the entries of
+					 * an unregistered port must be purged so they cannot alias
+					 * the next port the handle is assigned to.
+					 */
+					void erase_port(port_handle_type port);
+
+					/**
+					 * \brief Get the approximate count of used entries.
+					 * \return The used entry count, as a relaxed snapshot.
+					 */
+					size_t size() const
+					{
+						return m_used_count.load(std::memory_order_relaxed);
+					}
+
+				private:
+
+					enum class slot_state : uint8_t { empty, used, deleted };
+
+					struct entry_type
+					{
+						ethernet_address_type address;
+						port_handle_type port;
+						boost::posix_time::ptime last_seen;
+						slot_state state;
+					};
+
+					static bool is_expired(const entry_type& entry, const boost::posix_time::ptime& now)
+					{
+						return (now - entry.last_seen) > MAX_ENTRY_AGE;
+					}
+
+					static const size_t PROBE_LIMIT = 16;
+
+					std::vector<entry_type> m_entries;
+					size_t m_mask;
+					std::atomic<size_t> m_used_count;
+			};
 
-			static ethernet_address_type to_ethernet_address(boost::asio::const_buffer);
 			static bool is_multicast_address(const ethernet_address_type&);
 
 			ethernet_address_map_type m_ethernet_address_map;
+
+			mac_learned_handler_type m_mac_learned_handler;
+
+			// The flood suppression counters: how often the address table
+			// resolved a unicast frame to a single port, and how often a miss
+			// forced a flood to every port.
+			std::atomic<uint64_t> m_unknown_unicast_floods;
+			std::atomic<uint64_t> m_suppressed_floods;
+			std::atomic<uint64_t> m_gossip_learned;
 	};
 }
 
@@ -60,6 +60,13 @@ namespace
 {
 	using fscp::SharedBuffer;
 
+	// A resolved authority address is considered fresh for this long; an
+	// older entry is still served while a background revalidation runs.
+	const boost::posix_time::time_duration DNS_FRESH_DURATION = boost::posix_time::minutes(5);
+
+	// A stale entry older than this is never served.
+	const boost::posix_time::time_duration DNS_MAX_STALE_DURATION = boost::posix_time::hours(6);
+
 	template <typename BufferType, typename BufferSizeType>
 	boost::function<size_t (boost::asio::const_buffer)> get_write_function(BufferType buffer, BufferSizeType count)
 	{
@@ -134,7 +141,7 @@ namespace
 
 			try
 			{
-				auto endpoint = boost::lexical_cast<asiotap::endpoint>(endpoint_str);
+				auto endpoint = asiotap::parse_endpoint(endpoint_str);
 				result.insert(endpoint);
 			}
 			catch (const std::exception&)
@@ -165,35 +172,32 @@ namespace
 		return hash;
 	}
 
-	template <typename ResultType>
-	ResultType from_json(const kfather::object_type&);
+}
 
-	template <>
-	std::map<fscp::hash_type, std::set<asiotap::endpoint>> from_json<std::map<fscp::hash_type, std::set<asiotap::endpoint>>>(const kfather::object_type& contacts)
+namespace freelan
+{
+	namespace
 	{
-		std::map<fscp::hash_type, std::set<asiotap::endpoint>> result;
-
-		for (auto&& item : contacts.items)
+		void log_transfer_timings(fscp::logger& logger, const boost::shared_ptr<curl>& request)
 		{
+			if (logger.level() > fscp::log_level::debug)
+			{
+				return;
+			}
+
 			try
 			{
-				const auto hash = from_json<fscp::hash_type>(item.first);
-				const auto endpoints = from_json<std::set<asiotap::endpoint>>(kfather::value_cast<kfather::array_type>(item.second));
+				const auto timings = request->get_transfer_timings();
 
-				result[hash] = endpoints;
+				logger(fscp::log_level::debug) << "Transfer timings for " << request->get_effective_url() << ": DNS " << timings.namelookup << "s, connect " << timings.connect << "s, TLS " << timings.appconnect << "s, first byte " << timings.starttransfer << "s, total " << timings.total << "s.";
 			}
 			catch (const std::exception&)
 			{
-				// If parsing fail, we discard the value silently.
+				// Timings are best-effort diagnostics: never let them fail a completed transfer.
 			}
 		}
-
-		return result;
 	}
-}
 
-namespace freelan
-{
 	void web_client::request_certificate(cryptoplus::x509::certificate_request certificate_request, request_certificate_callback handler)
 	{
 		const auto self = shared_from_this();
@@ -209,6 +213,8 @@ namespace freelan
 		request->set_write_function(get_write_function(buffer, count));
 
 		m_curl_multi_asio->execute(request, [self, request, buffer, count, handler] (boost::system::error_code ec) {
+			log_transfer_timings(self->m_logger, request);
+
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
 
@@ -264,6 +270,8 @@ namespace freelan
 		request->set_write_function(get_write_function(buffer, count));
 
 		m_curl_multi_asio->execute(request, [self, request, buffer, count, handler] (boost::system::error_code ec) {
+			log_transfer_timings(self->m_logger, request);
+
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
 
@@ -323,6 +331,8 @@ namespace freelan
 		request->set_write_function(get_write_function(buffer, count));
 
 		m_curl_multi_asio->execute(request, [self, request, buffer, count, handler] (boost::system::error_code ec) {
+			log_transfer_timings(self->m_logger, request);
+
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
 
@@ -403,6 +413,7 @@ namespace freelan
 		request->set_write_function(get_write_function(buffer, count));
 
 		m_curl_multi_asio->execute(request, [self, request, buffer, count, handler] (boost::system::error_code ec) {
+			log_transfer_timings(self->m_logger, request);
 
 			if (ec)
 			{
@@ -449,6 +460,8 @@ namespace freelan
 		request->set_write_function(get_write_function(buffer, count));
 
 		m_curl_multi_asio->execute(request, [self, request, buffer, count, handler] (boost::system::error_code ec) {
+			log_transfer_timings(self->m_logger, request);
+
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
 
@@ -527,16 +540,70 @@ namespace freelan
 		request->set_http_header("content-type", "application/json");
 		request->set_copy_post_fields(boost::asio::buffer(oss.str()));
 
-		const auto buffer = SharedBuffer(8192);
-		const boost::shared_ptr<size_t> count(new size_t(0));
+		// The contact list can reach tens of megabytes: the response is parsed as the chunks arrive instead of being buffered and materialized whole.
+		const auto parser = boost::make_shared<kfather::stream_parser>();
+		const auto contacts = boost::make_shared<std::map<fscp::hash_type, std::set<asiotap::endpoint>>>();
+		const auto depth = boost::make_shared<int>(0);
+		const auto section = boost::make_shared<std::string>();
+		const auto contact = boost::make_shared<boost::optional<fscp::hash_type>>();
+		const auto parse_ok = boost::make_shared<bool>(true);
 
-		request->set_write_function(get_write_function(buffer, count));
+		parser->set_object_start_callback([depth] () {
+			++*depth;
+		});
+		parser->set_object_end_callback([depth, contact] () {
+			if (--*depth < 2)
+			{
+				*contact = boost::none;
+			}
+		});
+		parser->set_key_callback([depth, section, contact] (const kfather::string_type& key) {
+			if (*depth == 1)
+			{
+				*section = key;
+			}
+			else if ((*depth == 2) && (*section == "contacts"))
+			{
+				try
+				{
+					*contact = from_json<fscp::hash_type>(key);
+				}
+				catch (const std::exception&)
+				{
+					// If parsing fail, we discard the value silently.
+					*contact = boost::none;
+				}
+			}
+		});
+		parser->set_string_callback([depth, section, contact, contacts] (const kfather::string_type& str) {
+			if ((*depth == 2) && (*section == "contacts") && *contact)
+			{
+				try
+				{
+					(*contacts)[**contact].insert(asiotap::parse_endpoint(str));
+				}
+				catch (const std::exception&)
+				{
+					// If parsing fail, we discard the value silently.
+				}
+			}
+		});
 
-		m_curl_multi_asio->execute(request, [self, request, buffer, count, handler] (boost::system::error_code ec) {
+		request->set_write_function([parser, parse_ok] (boost::asio::const_buffer indata) {
 			using boost::asio::buffer_cast;
 			using boost::asio::buffer_size;
 
-			std::map<fscp::hash_type, std::set<asiotap::endpoint>> contacts;
+			if (*parse_ok)
+			{
+				*parse_ok = parser->feed(buffer_cast<const char*>(indata), buffer_size(indata));
+			}
+
+			// The chunk is always reported as consumed so an invalid document surfaces as a JSON error rather than a transfer error.
+			return buffer_size(indata);
+		});
+
+		m_curl_multi_asio->execute(request, [self, request, parser, contacts, parse_ok, handler] (boost::system::error_code ec) {
+			log_transfer_timings(self->m_logger, request);
 
 			if (ec)
 			{
@@ -557,28 +624,10 @@ namespace freelan
 
 					if (content_type == "application/json")
 					{
-						self->m_logger(fscp::log_level::debug) << "Received JSON data: " << std::string(buffer_cast<const char*>(buffer), *count);
-
-						kfather::parser parser;
-						kfather::value_type result;
-
-						if (!parser.parse(result, buffer_cast<const char*>(buffer), *count))
+						if (!*parse_ok || !parser->finish())
 						{
 							ec = make_error_code(web_client_error::invalid_json_stream);
 						}
-						else
-						{
-							const kfather::object_type value = kfather::value_cast<kfather::object_type>(result);
-
-							if (kfather::is_falsy(value))
-							{
-								ec = make_error_code(web_client_error::invalid_json_stream);
-							}
-							else
-							{
-								contacts = from_json<std::map<fscp::hash_type, std::set<asiotap::endpoint>>>(value.get<kfather::object_type>("contacts"));
-							}
-						}
 					}
 					else
 					{
@@ -587,16 +636,62 @@ namespace freelan
 				}
 			}
 
-			handler(ec, contacts);
+			handler(ec, *contacts);
 		});
 	}
 
 	web_client::web_client(boost::asio::io_service& io_service, fscp::logger& _logger, const freelan::client_configuration& configuration) :
 		m_curl_multi_asio(curl_multi_asio::create(io_service)),
+		m_curl_share(boost::make_shared<curl_share>()),
 		m_logger(_logger),
 		m_configuration(configuration),
-		m_url_prefix(boost::lexical_cast<std::string>(m_configuration.protocol) + "://" + boost::lexical_cast<std::string>(m_configuration.server_endpoint))
+		m_url_prefix(boost::lexical_cast<std::string>(m_configuration.protocol) + "://" + boost::lexical_cast<std::string>(m_configuration.server_endpoint)),
+		m_dns_resolver(io_service),
+		m_dns_port(0),
+		m_dns_revalidating(false)
 	{
+		// Queued requests ride an existing connection to the server instead
+		// of each opening their own.
+		m_curl_multi_asio->set_option(CURLMOPT_PIPELINING, 1L);
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+		m_curl_multi_asio->set_option(CURLMOPT_MAX_HOST_CONNECTIONS, 2L);
+#endif
+
+		// Cap the transfers in flight: extra requests wait in submission
+		// order so a slow server cannot starve retries behind a burst.
+		m_curl_multi_asio->set_max_concurrent_transfers(4);
+
+		if (const asiotap::hostname_endpoint* const hostname = boost::get<asiotap::hostname_endpoint>(&m_configuration.server_endpoint))
+		{
+			m_dns_hostname = hostname->hostname();
+			m_dns_service = hostname->service().empty() ? boost::lexical_cast<std::string>(m_configuration.protocol) : hostname->service();
+
+			if (hostname->service().empty())
+			{
+				m_dns_port = (m_configuration.protocol == client_configuration::client_protocol_type::https) ? 443 : 80;
+			}
+			else
+			{
+				try
+				{
+					m_dns_port = boost::lexical_cast<uint16_t>(hostname->service());
+				}
+				catch (const boost::bad_lexical_cast&)
+				{
+					// A named service cannot be mapped onto a resolve
+					// entry: the transfers fall back to the regular
+					// resolver and its shared cache.
+					m_dns_hostname.clear();
+				}
+			}
+		}
+
+		if (!m_dns_hostname.empty() && !curl::has_asynchronous_dns())
+		{
+			m_logger(fscp::log_level::information) << "libcurl has no asynchronous resolver: a slow authority DNS lookup can stall a transfer until it completes.";
+		}
+
 		if (m_configuration.protocol == client_configuration::client_protocol_type::http)
 		{
 			m_logger(fscp::log_level::warning) << "Web client not configured to use HTTPS: your username and password will be readable by anyone !";
@@ -615,12 +710,54 @@ namespace freelan
 		}
 	}
 
-	boost::shared_ptr<curl> web_client::make_request(const std::string& path) const
+	boost::shared_ptr<curl> web_client::make_request(const std::string& path)
 	{
 		boost::shared_ptr<curl> request = boost::make_shared<curl>();
 
 		request->set_url(m_url_prefix + path);
+		request->set_share(m_curl_share);
 		request->enable_cookie_support();
+		request->set_dns_cache_timeout(DNS_FRESH_DURATION);
+
+		if (!m_dns_hostname.empty())
+		{
+			bool refresh = false;
+
+			{
+				boost::mutex::scoped_lock lock(m_dns_mutex);
+
+				if (m_dns_ip.empty())
+				{
+					// The cache is cold: this transfer resolves through
+					// libcurl while the cache warms up for the next ones.
+					refresh = !m_dns_revalidating;
+				}
+				else
+				{
+					const boost::posix_time::time_duration age = boost::posix_time::second_clock::universal_time() - m_dns_resolved_at;
+
+					if (age <= DNS_MAX_STALE_DURATION)
+					{
+						request->add_resolve_entry(m_dns_hostname, m_dns_port, m_dns_ip);
+					}
+
+					if (age > DNS_FRESH_DURATION)
+					{
+						refresh = !m_dns_revalidating;
+					}
+				}
+
+				if (refresh)
+				{
+					m_dns_revalidating = true;
+				}
+			}
+
+			if (refresh)
+			{
+				refresh_dns_cache();
+			}
+		}
 
 		if (m_configuration.disable_peer_verification)
 		{
@@ -640,4 +777,28 @@ namespace freelan
 
 		return request;
 	}
+
+	void web_client::refresh_dns_cache()
+	{
+		const auto self = shared_from_this();
+		const boost::asio::ip::tcp::resolver::query query(m_dns_hostname, m_dns_service);
+
+		m_dns_resolver.async_resolve(query, [self] (const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator it) {
+			boost::mutex::scoped_lock lock(self->m_dns_mutex);
+
+			self->m_dns_revalidating = false;
+
+			if (!ec && (it != boost::asio::ip::tcp::resolver::iterator()))
+			{
+				self->m_dns_ip = it->endpoint().address().to_string();
+				self->m_dns_resolved_at = boost::posix_time::second_clock::universal_time();
+			}
+			else if (ec)
+			{
+				// The stale entry, if any, keeps being served: an old
+				// authority address beats a stalled renewal.
+				self->m_logger(fscp::log_level::debug) << "DNS revalidation of " << self->m_dns_hostname << " failed: " << ec.message();
+			}
+		});
+	}
 }
@@ -126,11 +126,26 @@ namespace freelan
 
 		private:
 			web_client(boost::asio::io_service& io_service, fscp::logger& _logger, const freelan::client_configuration& configuration);
-			boost::shared_ptr<curl> make_request(const std::string& path) const;
+			boost::shared_ptr<curl> make_request(const std::string& path);
+			void refresh_dns_cache();
 
 			boost::shared_ptr<curl_multi_asio> m_curl_multi_asio;
+			boost::shared_ptr<curl_share> m_curl_share;
 			fscp::logger& m_logger;
 			freelan::client_configuration m_configuration;
 			std::string m_url_prefix;
+
+			// The resolved authority address is cached across transfers: a
+			// stale entry is still served while a revalidation runs in the
+			// background, so a DNS hiccup delays the next refresh of the
+			// cache, not the transfers.
+			boost::asio::ip::tcp::resolver m_dns_resolver;
+			boost::mutex m_dns_mutex;
+			std::string m_dns_hostname;
+			std::string m_dns_service;
+			uint16_t m_dns_port;
+			std::string m_dns_ip;
+			boost::posix_time::ptime m_dns_resolved_at;
+			bool m_dns_revalidating;
 	};
 }
@@ -76,10 +76,22 @@ namespace freelan
 		listen_on(),
 		listen_on_device(),
 		contact_list(),
+		tcp_enabled(false),
+		tcp_contact_list(),
+		relay_enabled(false),
 		accept_contact_requests(true),
 		accept_contacts(true),
 		hostname_resolution_protocol(HRP_IPV4),
-		hello_timeout(boost::posix_time::seconds(3))
+		hello_timeout(boost::posix_time::seconds(3)),
+		presentation_cache_file(),
+		busy_poll_us(0),
+		max_queue_sojourn_ms(0),
+		reorder_hold_ms(0),
+		receive_steering_workers(0),
+		latency_tracing(false),
+		mtu_discovery(false),
+		data_coalescing(false),
+		scheduling_classes()
 	{
 	}
 
@@ -89,13 +101,15 @@ namespace freelan
 		certificate_validation_script(),
 		certificate_authority_list(),
 		certificate_revocation_validation_method(CRVM_NONE),
-		certificate_revocation_list_list()
+		certificate_revocation_list_list(),
+		crypto_engine()
 	{
 	}
 
 	tap_adapter_configuration::tap_adapter_configuration() :
 		enabled(true),
 		type(tap_adapter_type::tap),
+		queue_count(1),
 		ipv4_address_prefix_length(),
 		ipv6_address_prefix_length(),
 		arp_proxy_enabled(false),
@@ -110,7 +124,8 @@ namespace freelan
 
 	switch_configuration::switch_configuration() :
 		routing_method(RM_SWITCH),
-		relay_mode_enabled(false)
+		relay_mode_enabled(false),
+		mac_gossip_enabled(true)
 	{
 	}
 
@@ -127,13 +142,21 @@ namespace freelan
 	{
 	}
 
+	threads_configuration::threads_configuration() :
+		worker_count(0),
+		certificate_verification_count(0),
+		worker_affinity()
+	{
+	}
+
 	configuration::configuration() :
 		server(),
 		fscp(),
 		security(),
 		tap_adapter(),
 		switch_(),
-		router()
+		router(),
+		threads()
 	{
 	}
 
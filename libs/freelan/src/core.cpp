@@ -56,6 +56,10 @@
 #include "client.hpp"
 
 #include <fscp/server_error.hpp>
+#include <fscp/data_message.hpp>
+#include <fscp/memory_usage.hpp>
+
+#include <cryptoplus/cryptoplus.hpp>
 
 #include <asiotap/types/ip_network_address.hpp>
 
@@ -67,11 +71,15 @@
 
 #include <boost/make_shared.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/iterator/transform_iterator.hpp>
 #include <boost/date_time/c_local_time_adjustor.hpp>
 
+#include <atomic>
 #include <cassert>
+#include <exception>
+#include <sstream>
 
 namespace freelan
 {
@@ -97,6 +105,67 @@ namespace freelan
 		{
 		}
 
+		// The FSCP channel carrying regular frames.
+		const fscp::channel_number_type FRAME_CHANNEL = fscp::CHANNEL_NUMBER_0;
+
+		// The FSCP channel carrying interactive frames: the send scheduler
+		// gives each data channel its own queue, so voice and interactive
+		// traffic does not wait behind bulk transfers.
+		const fscp::channel_number_type INTERACTIVE_FRAME_CHANNEL = fscp::CHANNEL_NUMBER_2;
+
+		// The ToS byte of the inner frame, with the ECN bits cleared: the
+		// congestion marks of the inner flow are not the tunnel's to carry.
+		// Non-IP (and VLAN-tagged) frames yield 0.
+		uint8_t frame_tos(boost::asio::const_buffer data, bool ethernet)
+		{
+			const uint8_t* bytes = buffer_cast<const uint8_t*>(data);
+			size_t size = buffer_size(data);
+
+			if (ethernet)
+			{
+				// Untagged ethernet only: a VLAN-tagged frame stays on the
+				// regular channel.
+				if (size < 14)
+				{
+					return 0;
+				}
+
+				const uint16_t ether_type = static_cast<uint16_t>((bytes[12] << 8) | bytes[13]);
+
+				if ((ether_type != 0x0800) && (ether_type != 0x86DD))
+				{
+					return 0;
+				}
+
+				bytes += 14;
+				size -= 14;
+			}
+
+			if (size < 2)
+			{
+				return 0;
+			}
+
+			switch (bytes[0] >> 4)
+			{
+				case 4:
+					return static_cast<uint8_t>(bytes[1] & 0xFC);
+				case 6:
+					// The IPv6 traffic class straddles the first two bytes.
+					return static_cast<uint8_t>((((bytes[0] & 0x0F) << 4) | (bytes[1] >> 4)) & 0xFC);
+				default:
+					return 0;
+			}
+		}
+
+		fscp::channel_number_type channel_for_tos(uint8_t tos)
+		{
+			// CS4 and above covers the interactive classes (AF4x, CS5,
+			// voice-admit, EF, network control): everything below is
+			// best-effort or bulk.
+			return ((tos >> 2) >= 32) ? INTERACTIVE_FRAME_CHANNEL : FRAME_CHANNEL;
+		}
+
 		asiotap::endpoint to_endpoint(const core::ep_type& host)
 		{
 			if (host.address().is_v4())
@@ -185,6 +254,10 @@ namespace freelan
 			return default_mtu_value - static_payload_size;
 		}
 
+		// An ethernet header plus a possible 802.1Q tag: what a tap read
+		// can yield on top of the configured MTU.
+		const size_t ETHERNET_FRAME_OVERHEAD = 14 + 4;
+
 		size_t get_auto_mss_value(size_t mtu)
 		{
 			// This somehow is the magic number.
@@ -195,6 +268,9 @@ namespace freelan
 		static const unsigned int TAP_ADAPTERS_GROUP = 0;
 		static const unsigned int ENDPOINTS_GROUP = 1;
 
+		// The maximum number of frames read from the tap adapter per handler dispatch.
+		static const size_t TAP_READ_BATCH_SIZE = 32;
+
 		asiotap::ip_route_set filter_routes(const asiotap::ip_route_set& routes, router_configuration::internal_route_scope_type scope, unsigned int limit, const asiotap::ip_network_address_list& network_addresses)
 		{
 			asiotap::ip_route_set result;
@@ -414,11 +490,14 @@ namespace freelan
 	const boost::posix_time::time_duration core::CONTACT_PERIOD = boost::posix_time::seconds(30);
 	const boost::posix_time::time_duration core::DYNAMIC_CONTACT_PERIOD = boost::posix_time::seconds(45);
 	const boost::posix_time::time_duration core::ROUTES_REQUEST_PERIOD = boost::posix_time::seconds(180);
+	const boost::posix_time::time_duration core::MAC_GOSSIP_DELAY = boost::posix_time::seconds(1);
 	const boost::posix_time::time_duration core::RENEW_CERTIFICATE_WARNING_PERIOD = boost::posix_time::hours(6);
 	const boost::posix_time::time_duration core::REGISTRATION_WARNING_PERIOD = boost::posix_time::minutes(5);
 	const boost::posix_time::time_duration core::GET_CONTACT_INFORMATION_UPDATE_PERIOD = boost::posix_time::minutes(5);
 
 	const std::string core::DEFAULT_SERVICE = "12000";
+	const boost::posix_time::time_duration core::CONTACT_RESOLUTION_DURATION = boost::posix_time::minutes(5);
+	const boost::posix_time::time_duration core::CONTACT_RESOLUTION_ERROR_DURATION = boost::posix_time::seconds(30);
 
 	core::core(boost::asio::io_service& io_service, const freelan::configuration& _configuration) :
 		m_io_service(io_service),
@@ -443,6 +522,8 @@ namespace freelan
 		m_routes_request_timer(m_io_service, ROUTES_REQUEST_PERIOD),
 		m_tap_adapter_io_service(),
 		m_tap_adapter_thread(),
+		m_tap_adapter_buffers(65536),
+		m_proxy_buffers(2048),
 		m_arp_filter(m_ethernet_filter),
 		m_ipv4_filter(m_ethernet_filter),
 		m_ipv6_filter(m_ethernet_filter),
@@ -455,12 +536,14 @@ namespace freelan
 		m_tun_ipv6_filter(),
 		m_tun_tcpv4_filter(m_tun_ipv4_filter),
 		m_tun_tcpv6_filter(m_tun_ipv6_filter),
-		m_tun_icmpv6_filter(m_tun_ipv6_filter),
+		m_tun_icmpv6_filter(),
 		m_router_strand(m_io_service),
 		m_switch(m_configuration.switch_),
 		m_router(m_configuration.router),
 		m_route_manager(m_io_service),
 		m_dns_servers_manager(m_io_service),
+		m_mac_gossip_timer(m_io_service),
+		m_mac_gossip_pending(false),
 		m_request_certificate(m_io_service, boost::posix_time::seconds(5), boost::posix_time::seconds(90)),
 		m_request_ca_certificate(m_io_service, boost::posix_time::seconds(5), boost::posix_time::seconds(90)),
 		m_renew_certificate_timer(m_io_service),
@@ -468,9 +551,26 @@ namespace freelan
 		m_set_contact_information_retry(m_io_service, boost::posix_time::seconds(5), boost::posix_time::seconds(35)),
 		m_get_contact_information_retry(m_io_service, boost::posix_time::seconds(5), boost::posix_time::seconds(35))
 	{
+		// The revocation lists are fixed after load: their issuer names are
+		// kept around so the cached encodings and hashes persist across
+		// validations. The caches are warmed here, while still
+		// single-threaded: the verification pool then only ever reads them.
+		for (const crl_type& crl : m_configuration.security.certificate_revocation_list_list)
+		{
+			m_crl_issuers.push_back(crl.issuer());
+			m_crl_issuers.back().der_hash();
+		}
+
+		if (m_configuration.switch_.mac_gossip_enabled)
+		{
+			// The notifications come from within the router strand, where
+			// all the gossip state lives.
+			m_switch.set_mac_learned_handler(boost::bind(&core::do_handle_local_mac_learned, this, _1, _2));
+		}
+
 		m_arp_filter.add_handler(boost::bind(&core::do_handle_arp_frame, this, _1));
 		m_dhcp_filter.add_handler(boost::bind(&core::do_handle_dhcp_frame, this, _1));
-		m_tun_icmpv6_filter.add_handler(boost::bind(&core::do_handle_icmpv6_frame, this, _1));
+		m_tun_icmpv6_filter.add_handler(boost::bind(&core::do_handle_icmpv6_frame, this, _1, _2));
 		m_tcpv4_filter.add_handler([this](asiotap::osi::mutable_helper<asiotap::osi::tcp_frame> tcp_helper){
 			if (m_tcp_mss_morpher) {
 				m_tcp_mss_morpher->handle(*m_tcpv4_filter.parent().get_last_helper(), tcp_helper);
@@ -492,6 +592,8 @@ namespace freelan
 			}
 		});
 
+		update_tun_frame_dispatch();
+
 		// Setup the route manager.
 		m_route_manager.set_route_registration_success_handler([this](const asiotap::route_manager::route_type& route){
 			m_logger(fscp::log_level::information) << "Added system route: " << route;
@@ -557,14 +659,63 @@ namespace freelan
 	{
 		m_logger(fscp::log_level::debug) << "Opening core...";
 
+		if (!m_configuration.security.crypto_engine.empty())
+		{
+			cryptoplus::pin_engine(m_configuration.security.crypto_engine);
+
+			m_logger(fscp::log_level::important) << "Using cryptographic engine: " << m_configuration.security.crypto_engine;
+		}
+
+		m_logger(fscp::log_level::information) << "AES implementation: " << cryptoplus::get_aes_implementation();
+
+		if (!cryptoplus::cpu_has_aes_instructions())
+		{
+			m_logger(fscp::log_level::warning) << "This host lacks AES instructions: consider preferring the ChaCha20-Poly1305 cipher suite.";
+		}
+
 		open_web_client();
 
-		if (m_configuration.security.identity || !m_configuration.client.enabled)
+		// The FSCP server and the tap adapter do not depend on one another:
+		// the tap adapter open (device creation, addressing, up scripts) can
+		// proceed while the FSCP server resolves and binds its endpoint.
+		std::exception_ptr tap_adapter_error;
+
+		boost::thread tap_adapter_open_thread([this, &tap_adapter_error]() {
+			try
+			{
+				open_tap_adapter();
+			}
+			catch (...)
+			{
+				tap_adapter_error = std::current_exception();
+			}
+		});
+
+		try
+		{
+			if (m_configuration.security.identity || !m_configuration.client.enabled)
+			{
+				open_fscp_server();
+			}
+		}
+		catch (...)
+		{
+			tap_adapter_open_thread.join();
+
+			close_tap_adapter();
+
+			throw;
+		}
+
+		tap_adapter_open_thread.join();
+
+		if (tap_adapter_error)
 		{
-			open_fscp_server();
+			close_fscp_server();
+
+			std::rethrow_exception(tap_adapter_error);
 		}
 
-		open_tap_adapter();
 		open_web_server();
 
 		m_logger(fscp::log_level::debug) << "Core opened.";
@@ -582,6 +733,56 @@ namespace freelan
 		m_logger(fscp::log_level::debug) << "Core closed.";
 	}
 
+	void core::reload_configuration(const freelan::configuration& configuration)
+	{
+		m_logger(fscp::log_level::important) << "Reloading the configuration...";
+
+		// Contacts that appear in the new configuration are contacted at
+		// once; removed ones simply stop being refreshed by the periodic
+		// contact loop. Established sessions are left untouched.
+		fscp_configuration::endpoint_list added_contacts;
+
+		std::set_difference(
+			configuration.fscp.contact_list.begin(), configuration.fscp.contact_list.end(),
+			m_configuration.fscp.contact_list.begin(), m_configuration.fscp.contact_list.end(),
+			std::inserter(added_contacts, added_contacts.end())
+		);
+
+		// The cached certificate hashes are recomputed on the next dynamic
+		// contact cycle.
+		m_dynamic_contact_hashes.clear();
+
+		const bool routes_changed =
+			(configuration.router.local_ip_routes != m_configuration.router.local_ip_routes) ||
+			(configuration.router.local_dns_servers != m_configuration.router.local_dns_servers);
+
+		m_configuration.fscp.contact_list = configuration.fscp.contact_list;
+		m_configuration.fscp.tcp_contact_list = configuration.fscp.tcp_contact_list;
+		m_configuration.fscp.dynamic_contact_list = configuration.fscp.dynamic_contact_list;
+		m_configuration.router.local_ip_routes = configuration.router.local_ip_routes;
+		m_configuration.router.local_dns_servers = configuration.router.local_dns_servers;
+
+		for (auto&& contact : added_contacts)
+		{
+			async_contact(contact);
+		}
+
+		if (routes_changed && m_tap_adapter && (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ip))
+		{
+			auto local_routes = translate_ip_routes(m_configuration.router.local_ip_routes);
+
+			// The routes from the TAP adapter are kept, as during the initial advertisement.
+			for (auto&& ip_address : m_tap_adapter->get_ip_addresses())
+			{
+				local_routes.insert(asiotap::to_network_address(asiotap::to_ip_address(ip_address)));
+			}
+
+			m_router_strand.post(boost::bind(&core::do_reload_local_routes, this, local_routes, m_configuration.router.local_dns_servers));
+		}
+
+		m_logger(fscp::log_level::information) << "Configuration reloaded. Changes to anything but the contact lists and the local routes require a restart.";
+	}
+
 	// Private methods
 
 	void core::do_handle_log(fscp::log_level level, const std::string& msg, const boost::posix_time::ptime& timestamp)
@@ -600,16 +801,11 @@ namespace freelan
 
 	void core::open_fscp_server()
 	{
-		if (!m_configuration.security.identity)
-		{
-			m_logger(fscp::log_level::warning) << "No user certificate/private key or pre-shared key set. Generating a temporary certificate/private key pair...";
-
-			const auto private_key = generate_private_key();
-			const auto certificate = generate_self_signed_certificate(private_key);
-
-			m_configuration.security.identity = fscp::identity_store(certificate, private_key);
+		const bool generate_temporary_identity = !m_configuration.security.identity;
 
-			m_logger(fscp::log_level::warning) << "Using a generated temporary certificate (" << certificate.subject() << ") prevents reliable authentication ! Generate and specify a static certificate/key pair for use in production.";
+		if (generate_temporary_identity)
+		{
+			m_logger(fscp::log_level::warning) << "No user certificate/private key or pre-shared key set. Generating a temporary certificate/private key pair in the background...";
 		}
 		else
 		{
@@ -626,17 +822,57 @@ namespace freelan
 
 		m_logger(fscp::log_level::information) << "Starting FSCP server...";
 
-		m_fscp_server = boost::make_shared<fscp::server>(boost::ref(m_io_service), boost::ref(m_logger), boost::cref(*m_configuration.security.identity));
+		open_certificate_verification_pool();
+
+		if (generate_temporary_identity)
+		{
+			// The key generation takes seconds on small devices: the server
+			// starts with a deferred identity, so the socket binds and HELLO
+			// exchanges begin immediately. Presentations fail with
+			// no_identity until the generation completes and are retried by
+			// the contact loop.
+			m_fscp_server = boost::make_shared<fscp::server>(boost::ref(m_io_service), boost::ref(m_logger));
+
+			const auto server = m_fscp_server;
+
+			boost::thread([this, server]() {
+				const auto private_key = generate_private_key();
+				const auto certificate = generate_self_signed_certificate(private_key);
+
+				// The same assignment is done from an io_service thread by
+				// the web client certificate flow.
+				m_configuration.security.identity = fscp::identity_store(certificate, private_key);
+
+				server->async_set_identity(*m_configuration.security.identity, [this, certificate]() {
+					m_logger(fscp::log_level::warning) << "Using a generated temporary certificate (" << certificate.subject() << ") prevents reliable authentication ! Generate and specify a static certificate/key pair for use in production.";
+				});
+			}).detach();
+		}
+		else
+		{
+			m_fscp_server = boost::make_shared<fscp::server>(boost::ref(m_io_service), boost::ref(m_logger), boost::cref(*m_configuration.security.identity));
+		}
 
 		try
 		{
 			m_fscp_server->set_cipher_suites(m_configuration.fscp.cipher_suite_capabilities);
 			m_fscp_server->set_elliptic_curves(m_configuration.fscp.elliptic_curve_capabilities);
+			m_fscp_server->set_busy_poll_duration(m_configuration.fscp.busy_poll_us);
+			m_fscp_server->set_send_queue_sojourn_limit(m_configuration.fscp.max_queue_sojourn_ms);
+			m_fscp_server->set_reorder_hold_duration(m_configuration.fscp.reorder_hold_ms);
+			m_fscp_server->set_receive_steering(m_configuration.fscp.receive_steering_workers);
+			m_fscp_server->set_mtu_discovery(m_configuration.fscp.mtu_discovery);
+			m_fscp_server->set_data_coalescing(m_configuration.fscp.data_coalescing);
+
+			if (m_configuration.fscp.latency_tracing)
+			{
+				fscp::buffer_trace::enable();
+			}
 
 			m_fscp_server->set_hello_message_received_callback(boost::bind(&core::do_handle_hello_received, this, _1, _2));
 			m_fscp_server->set_contact_request_received_callback(boost::bind(&core::do_handle_contact_request_received, this, _1, _2, _3, _4));
 			m_fscp_server->set_contact_received_callback(boost::bind(&core::do_handle_contact_received, this, _1, _2, _3));
-			m_fscp_server->set_presentation_message_received_callback(boost::bind(&core::do_handle_presentation_received, this, _1, _2, _3, _4));
+			m_fscp_server->set_presentation_message_received_async_callback(boost::bind(&core::do_handle_presentation_received, this, _1, _2, _3, _4, _5));
 			m_fscp_server->set_session_request_message_received_callback(boost::bind(&core::do_handle_session_request_received, this, _1, _2, _3, _4));
 			m_fscp_server->set_session_message_received_callback(boost::bind(&core::do_handle_session_received, this, _1, _2, _3, _4));
 			m_fscp_server->set_session_failed_callback(boost::bind(&core::do_handle_session_failed, this, _1, _2));
@@ -660,7 +896,13 @@ namespace freelan
 
 			if (m_configuration.security.certificate_validation_method == security_configuration::CVM_DEFAULT)
 			{
-				build_ca_store(build_ca_store_when::it_doesnt_exist);
+				// Building the store (and loading the CRLs it contains) can
+				// take a while: warm it up on the verification pool so the
+				// socket opens and HELLO messages go out without waiting for
+				// it. A verification that comes first builds it on demand.
+				m_cert_verification_io_service.post([this]() {
+					build_ca_store(build_ca_store_when::it_doesnt_exist);
+				});
 			}
 
 			for(auto&& network_address : m_configuration.fscp.never_contact_list)
@@ -671,6 +913,27 @@ namespace freelan
 			// Let's open the server.
 			m_fscp_server->open(listen_endpoint);
 
+			if (m_configuration.fscp.tcp_enabled)
+			{
+				m_fscp_server->open_tcp(listen_endpoint);
+
+				m_logger(fscp::log_level::important) << "TCP fallback transport set to listen on: " << listen_endpoint;
+			}
+
+			if (m_configuration.fscp.relay_enabled)
+			{
+				m_fscp_server->set_relay_enabled(true);
+
+				m_logger(fscp::log_level::important) << "Relay mode enabled: traffic between non-connected peers may be forwarded, within rate budgets.";
+			}
+
+			if (!m_configuration.fscp.presentation_cache_file.empty())
+			{
+				m_fscp_server->set_presentation_cache(m_configuration.fscp.presentation_cache_file);
+
+				m_logger(fscp::log_level::information) << "Presentation cache file set to: " << m_configuration.fscp.presentation_cache_file;
+			}
+
 			if (m_configuration.fscp.upnp_enabled)
 			{
 #ifdef USE_UPNP
@@ -726,50 +989,156 @@ namespace freelan
 			m_routes_request_timer.cancel();
 			m_dynamic_contact_timer.cancel();
 			m_contact_timer.cancel();
+			m_mac_gossip_timer.cancel();
 
 			m_fscp_server->close();
 
+			close_certificate_verification_pool();
+
+			if (m_configuration.fscp.latency_tracing)
+			{
+				std::ostringstream oss;
+
+				fscp::buffer_trace::report(oss);
+
+				m_logger(fscp::log_level::information) << "Packet-path latency histograms:\n" << oss.str();
+			}
+
 			m_logger(fscp::log_level::information) << "FSCP server closed.";
 		}
 	}
 
-	void core::async_contact(const endpoint& target, duration_handler_type handler)
+	void core::open_certificate_verification_pool()
 	{
-		m_logger(fscp::log_level::debug) << "Resolving " << target << " for potential contact...";
+		m_cert_verification_work.reset(new boost::asio::io_service::work(m_cert_verification_io_service));
 
-		// This is a ugly workaround for a bug in Boost::Variant (<1.55)
-		endpoint target1 = target;
+		unsigned int thread_count = m_configuration.threads.certificate_verification_count;
+
+		if (thread_count == 0)
+		{
+			thread_count = CERTIFICATE_VERIFICATION_THREAD_COUNT;
+		}
+
+		for (unsigned int i = 0; i < thread_count; ++i)
+		{
+			m_cert_verification_threads.create_thread([this](){
+				m_cert_verification_io_service.run();
+			});
+		}
+	}
+
+	void core::close_certificate_verification_pool()
+	{
+		m_cert_verification_work.reset();
+		m_cert_verification_threads.join_all();
+		m_cert_verification_io_service.reset();
+	}
+
+	void core::async_resolve_contact(const endpoint& target, resolution_handler_type handler)
+	{
+		async_resolve_contact_all(target, [handler] (const boost::system::error_code& ec, const std::vector<ep_type>& hosts) {
+			handler(ec, hosts.empty() ? ep_type() : hosts.front());
+		});
+	}
+
+	void core::async_resolve_contact_all(const endpoint& target, multi_resolution_handler_type handler)
+	{
+		{
+			boost::mutex::scoped_lock lock(m_resolution_cache_mutex);
+
+			const auto entry = m_resolution_cache.find(target);
+
+			if (entry != m_resolution_cache.end())
+			{
+				if (boost::posix_time::microsec_clock::universal_time() < entry->second.expires_at)
+				{
+					// Failed resolutions are cached too, so an unreachable resolver cannot stall every refresh.
+					const boost::system::error_code ec = entry->second.ec;
+					const boost::shared_ptr<const std::vector<ep_type> > hosts = entry->second.hosts;
+
+					lock.unlock();
+
+					handler(ec, *hosts);
+
+					return;
+				}
+
+				// The expired entry stays in place so the refreshed
+				// resolution can be diffed against it.
+			}
+
+			const auto pending = m_pending_resolutions.find(target);
+
+			if (pending != m_pending_resolutions.end())
+			{
+				// A resolution for the same name is already in flight: wait for its result instead of issuing another query.
+				pending->second.push_back(handler);
+
+				return;
+			}
+
+			m_pending_resolutions[target].push_back(handler);
+		}
 
-		const auto resolve_handler = [this, handler, target1] (const boost::system::error_code& ec, boost::asio::ip::udp::resolver::iterator it)
+		const auto resolve_handler = [this, target] (const boost::system::error_code& ec, boost::asio::ip::udp::resolver::iterator it)
 		{
+			resolution_cache_entry entry;
+			entry.ec = ec;
+
+			const auto hosts = boost::make_shared<std::vector<ep_type> >();
+
 			if (!ec)
 			{
-				const ep_type host = *it;
+				// A contact may resolve to several endpoints (IPv4+IPv6,
+				// multiple A records): they are all kept, so the contact
+				// logic can race them instead of picking the first one.
+				for (boost::asio::ip::udp::resolver::iterator end; it != end; ++it)
+				{
+					hosts->push_back(*it);
+				}
+			}
 
-				// This is a ugly workaround for a bug in Boost::Variant (<1.55)
-				endpoint target2 = target1;
+			entry.hosts = hosts;
 
-				// The host was resolved: we first make sure no session exist with that host before doing anything else.
-				m_fscp_server->async_has_session_with_endpoint(
-					host,
-					[this, handler, host, target2] (bool has_session)
-					{
-						if (!has_session)
-						{
-							m_logger(fscp::log_level::debug) << "No session exists with " << target2 << " (at " << host << "). Contacting...";
+			// The system resolver does not expose the record's time-to-live, so we use fixed durations instead.
+			entry.expires_at = boost::posix_time::microsec_clock::universal_time() + (ec ? CONTACT_RESOLUTION_ERROR_DURATION : CONTACT_RESOLUTION_DURATION);
 
-							do_contact(host, handler);
-						}
-						else
-						{
-							m_logger(fscp::log_level::debug) << "A session already exists with " << target2 << " (at " << host << "). Not contacting again.";
-						}
+			std::vector<multi_resolution_handler_type> handlers;
+			bool changed = false;
+
+			{
+				boost::mutex::scoped_lock lock(m_resolution_cache_mutex);
+
+				const auto previous = m_resolution_cache.find(target);
+
+				if (previous != m_resolution_cache.end())
+				{
+					if (previous->second.hosts && (*previous->second.hosts == *hosts))
+					{
+						// The name still resolves to the same endpoints: the
+						// previous host list is kept, so everything downstream
+						// that retained it keeps sharing a single copy.
+						entry.hosts = previous->second.hosts;
 					}
-				);
+					else
+					{
+						changed = true;
+					}
+				}
+
+				m_resolution_cache[target] = entry;
+				handlers.swap(m_pending_resolutions[target]);
+				m_pending_resolutions.erase(target);
 			}
-			else
+
+			if (changed)
+			{
+				m_logger(fscp::log_level::debug) << "Resolution of " << target << " changed: " << entry.hosts->size() << " endpoint(s) now.";
+			}
+
+			for (auto&& _handler : handlers)
 			{
-				handler(ep_type(), ec, boost::posix_time::time_duration());
+				_handler(entry.ec, *entry.hosts);
 			}
 		};
 
@@ -785,57 +1154,202 @@ namespace freelan
 		);
 	}
 
-	void core::async_contact(const endpoint& target)
+	void core::async_contact(const endpoint& target, duration_handler_type handler)
 	{
-		async_contact(target, boost::bind(&core::do_handle_contact, this, target, _1, _2, _3));
-	}
+		m_logger(fscp::log_level::debug) << "Resolving " << target << " for potential contact...";
 
-	void core::async_contact_all()
-	{
-		for (auto&& contact : m_configuration.fscp.contact_list)
+		// This is a ugly workaround for a bug in Boost::Variant (<1.55)
+		endpoint target1 = target;
+
+		const bool use_tcp = m_configuration.fscp.tcp_enabled && (m_configuration.fscp.tcp_contact_list.count(target) > 0);
+
+		const auto resolve_handler = [this, handler, target1, use_tcp] (const boost::system::error_code& ec, const std::vector<ep_type>& hosts)
 		{
-			async_contact(contact);
-		}
-	}
+			if (!ec && !hosts.empty())
+			{
+				// This is a ugly workaround for a bug in Boost::Variant (<1.55)
+				endpoint target2 = target1;
 
-	void core::async_dynamic_contact_all()
-	{
-		using boost::make_transform_iterator;
+				// The host was resolved: we first make sure no session exists
+				// with any of its endpoints before doing anything else.
+				struct contact_state
+				{
+					explicit contact_state(size_t count) :
+						any_session(false),
+						remaining(count)
+					{}
 
-		hash_type (*func)(cert_type) = fscp::get_certificate_hash;
+					std::atomic<bool> any_session;
+					std::atomic<size_t> remaining;
+				};
 
-		const hash_list_type hash_list(make_transform_iterator(m_configuration.fscp.dynamic_contact_list.begin(), func), make_transform_iterator(m_configuration.fscp.dynamic_contact_list.end(), func));
+				// A single shared state and a single shared copy of the host
+				// list serve all the per-endpoint completions: the periodic
+				// refresh then makes two allocations per contact instead of
+				// one host list copy per resolved endpoint.
+				const auto state = boost::make_shared<contact_state>(hosts.size());
+				const auto host_list = boost::make_shared<const std::vector<ep_type> >(hosts);
 
-		async_send_contact_request_to_all(hash_list);
-	}
+				for (auto&& host : *host_list)
+				{
+					m_fscp_server->async_has_session_with_endpoint(
+						host,
+						[this, handler, host_list, host, target2, use_tcp, state] (bool has_session)
+						{
+							if (has_session)
+							{
+								m_logger(fscp::log_level::debug) << "A session already exists with " << target2 << " (at " << host << "). Not contacting again.";
 
-	void core::async_send_contact_request_to_all(const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
-	{
-		m_fscp_server->async_send_contact_request_to_all(hash_list, handler);
-	}
+								state->any_session.store(true);
+							}
 
-	void core::async_send_contact_request_to_all(const hash_list_type& hash_list)
-	{
-		async_send_contact_request_to_all(hash_list, boost::bind(&core::do_handle_send_contact_request_to_all, this, _1));
-	}
+							if ((state->remaining.fetch_sub(1) == 1) && !state->any_session.load())
+							{
+								m_logger(fscp::log_level::debug) << "No session exists with " << target2 << ". Contacting...";
 
-	void core::async_introduce_to(const ep_type& target, simple_handler_type handler)
-	{
-		assert(m_fscp_server);
+								if (use_tcp)
+								{
+									// The host is configured as unreachable over
+									// UDP: the TCP connection goes first, the
+									// greeting then follows over it.
+									const ep_type tcp_host = host_list->front();
+
+									m_fscp_server->async_connect_tcp(
+										tcp_host,
+										[this, handler, tcp_host] (const boost::system::error_code& connect_ec)
+										{
+											if (!connect_ec)
+											{
+												do_contact(tcp_host, handler);
+											}
+											else
+											{
+												handler(tcp_host, connect_ec, boost::posix_time::time_duration());
+											}
+										}
+									);
+								}
+								else if (host_list->size() == 1)
+								{
+									do_contact(host_list->front(), handler);
+								}
+								else
+								{
+									race_contact(*host_list, handler);
+								}
+							}
+						}
+					);
+				}
+			}
+			else
+			{
+				const boost::system::error_code result_ec = ec ? ec : boost::asio::error::make_error_code(boost::asio::error::host_not_found);
 
-		m_fscp_server->async_introduce_to(target, handler);
-	}
+				handler(ep_type(), result_ec, boost::posix_time::time_duration());
+			}
+		};
 
-	void core::async_introduce_to(const ep_type& target)
-	{
-		async_introduce_to(target, boost::bind(&core::do_handle_introduce_to, this, target, _1));
+		async_resolve_contact_all(target, resolve_handler);
 	}
 
-	void core::async_request_session(const ep_type& target, simple_handler_type handler)
+	void core::race_contact(const std::vector<ep_type>& hosts, duration_handler_type handler)
 	{
-		assert(m_fscp_server);
+		// All the resolved endpoints are greeted in parallel and the first
+		// one to answer wins: the session then forms over the fastest path
+		// instead of whichever address the resolver happened to list first.
+		const auto won = boost::make_shared<std::atomic<bool> >(false);
+		const auto remaining = boost::make_shared<std::atomic<size_t> >(hosts.size());
 
-		m_logger(fscp::log_level::debug) << "Sending SESSION_REQUEST to " << target << ".";
+		for (auto&& host : hosts)
+		{
+			m_logger(fscp::log_level::debug) << "Sending HELLO to " << host << " (racing " << hosts.size() << " endpoints)";
+
+			m_fscp_server->async_greet(
+				host,
+				[this, handler, host, won, remaining] (const boost::system::error_code& ec, const boost::posix_time::time_duration& duration)
+				{
+					if (!ec)
+					{
+						// The winner is elected before the count drops so a
+						// concurrent last failure cannot also call the handler.
+						if (!won->exchange(true))
+						{
+							handler(host, ec, duration);
+						}
+						else
+						{
+							m_logger(fscp::log_level::debug) << "Received HELLO_RESPONSE from " << host << " but another endpoint answered first. Latency: " << duration << "";
+						}
+
+						remaining->fetch_sub(1);
+					}
+					else if ((remaining->fetch_sub(1) == 1) && !won->load())
+					{
+						// Every endpoint failed: the last failure reports it.
+						handler(host, ec, duration);
+					}
+				}
+			);
+		}
+	}
+
+	void core::async_contact(const endpoint& target)
+	{
+		async_contact(target, boost::bind(&core::do_handle_contact, this, target, _1, _2, _3));
+	}
+
+	void core::async_contact_all()
+	{
+		for (auto&& contact : m_configuration.fscp.contact_list)
+		{
+			async_contact(contact);
+		}
+	}
+
+	void core::async_dynamic_contact_all()
+	{
+		using boost::make_transform_iterator;
+
+		if (m_dynamic_contact_hashes.empty() && !m_configuration.fscp.dynamic_contact_list.empty())
+		{
+			// The dynamic contact list is fixed at configuration time: the
+			// certificate hashes are computed once and reused every cycle.
+			hash_type (*func)(cert_type) = fscp::get_certificate_hash;
+
+			m_dynamic_contact_hashes = hash_list_type(make_transform_iterator(m_configuration.fscp.dynamic_contact_list.begin(), func), make_transform_iterator(m_configuration.fscp.dynamic_contact_list.end(), func));
+		}
+
+		async_send_contact_request_to_all(m_dynamic_contact_hashes);
+	}
+
+	void core::async_send_contact_request_to_all(const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
+	{
+		m_fscp_server->async_send_contact_request_to_all(hash_list, handler);
+	}
+
+	void core::async_send_contact_request_to_all(const hash_list_type& hash_list)
+	{
+		async_send_contact_request_to_all(hash_list, boost::bind(&core::do_handle_send_contact_request_to_all, this, _1));
+	}
+
+	void core::async_introduce_to(const ep_type& target, simple_handler_type handler)
+	{
+		assert(m_fscp_server);
+
+		m_fscp_server->async_introduce_to(target, handler);
+	}
+
+	void core::async_introduce_to(const ep_type& target)
+	{
+		async_introduce_to(target, boost::bind(&core::do_handle_introduce_to, this, target, _1));
+	}
+
+	void core::async_request_session(const ep_type& target, simple_handler_type handler)
+	{
+		assert(m_fscp_server);
+
+		m_logger(fscp::log_level::debug) << "Sending SESSION_REQUEST to " << target << ".";
 
 		m_fscp_server->async_request_session(target, handler);
 	}
@@ -847,14 +1361,14 @@ namespace freelan
 
 	void core::async_handle_routes_request(const ep_type& sender, const routes_request_message& msg)
 	{
-		// The routes request message does not contain any meaningful information.
-		static_cast<void>(msg);
+		const auto known_version = msg.known_version();
 
 		m_router_strand.post(
 			boost::bind(
 				&core::do_handle_routes_request,
 				this,
-				sender
+				sender,
+				known_version
 			)
 		);
 	}
@@ -880,24 +1394,75 @@ namespace freelan
 		});
 	}
 
-	void core::async_send_routes_request(const ep_type& target, simple_handler_type handler)
+	void core::async_handle_routes_delta(const ep_type& sender, const routes_message& msg)
 	{
-		assert(m_fscp_server);
+		const auto version = msg.version();
+		const auto base_version = msg.base_version();
+		const auto added_routes = msg.routes();
+		const auto removed_routes = msg.removed_routes();
+		const auto added_dns_servers = msg.dns_servers();
+		const auto removed_dns_servers = msg.removed_dns_servers();
+
+		async_get_tap_addresses([this, sender, version, base_version, added_routes, removed_routes, added_dns_servers, removed_dns_servers](const asiotap::ip_network_address_list& ip_addresses){
+			m_router_strand.post(
+				boost::bind(
+					&core::do_handle_routes_delta,
+					this,
+					ip_addresses,
+					sender,
+					version,
+					base_version,
+					added_routes,
+					removed_routes,
+					added_dns_servers,
+					removed_dns_servers
+				)
+			);
+		});
+	}
 
-		m_logger(fscp::log_level::debug) << "Sending routes request to " << target << ".";
+	void core::async_handle_mac_addresses(const ep_type& sender, const mac_addresses_message& msg)
+	{
+		if (!m_configuration.switch_.mac_gossip_enabled)
+		{
+			return;
+		}
 
-		const auto data_buffer = SharedBuffer(2048);
-		const size_t size = routes_request_message::write(
-			buffer_cast<uint8_t*>(data_buffer),
-			buffer_size(data_buffer)
+		if (m_configuration.tap_adapter.type != tap_adapter_configuration::tap_adapter_type::tap)
+		{
+			return;
+		}
+
+		// The message maps a borrowed buffer: the addresses are copied out
+		// before the deferred handling.
+		std::vector<switch_::ethernet_address_type> addresses;
+		addresses.reserve(msg.addresses_count());
+
+		for (size_t index = 0; index < msg.addresses_count(); ++index)
+		{
+			addresses.push_back(msg.address_at(index));
+		}
+
+		m_router_strand.post(
+			boost::bind(
+				&core::do_handle_mac_addresses,
+				this,
+				sender,
+				addresses
+			)
 		);
+	}
 
-		m_fscp_server->async_send_data(
-			target,
-			fscp::CHANNEL_NUMBER_1,
-			buffer(data_buffer, size),
-			make_shared_buffer_handler(
-				data_buffer,
+	void core::async_send_routes_request(const ep_type& target, simple_handler_type handler)
+	{
+		assert(m_fscp_server);
+
+		// The version we already know for the target lives in m_client_router_info_map, which must only be accessed from within the m_router_strand.
+		m_router_strand.post(
+			boost::bind(
+				&core::do_send_routes_request,
+				this,
+				target,
 				handler
 			)
 		);
@@ -908,19 +1473,41 @@ namespace freelan
 		async_send_routes_request(target, boost::bind(&core::do_handle_send_routes_request, this, target, _1));
 	}
 
-	void core::async_send_routes_request_to_all(multiple_endpoints_handler_type handler)
+	void core::async_send_routes_request_to_all()
 	{
 		assert(m_fscp_server);
 
 		m_logger(fscp::log_level::debug) << "Sending routes request to all hosts.";
 
-		const auto data_buffer = SharedBuffer(2048);
-		const size_t size = routes_request_message::write(
+		// Every host may be at a different known version, so each request is crafted (and sent) individually.
+		m_fscp_server->async_get_session_endpoints([this](const std::set<ep_type>& endpoints){
+			for (auto&& endpoint : endpoints)
+			{
+				async_send_routes_request(endpoint);
+			}
+		});
+	}
+
+	void core::async_send_routes(const ep_type& target, routes_message::version_type version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers, bool compact, simple_handler_type handler)
+	{
+		assert(m_fscp_server);
+
+		m_logger(fscp::log_level::debug) << "Sending routes and DNS servers to " << target << ": version " << version << " (" << routes << "), (" << dns_servers << ").";
+
+		// The buffer is sized from the route count: a large advertisement
+		// must not be truncated by an arbitrary fixed capacity.
+		const auto data_buffer = SharedBuffer(routes_message::estimate_size(routes.size(), dns_servers.size()));
+		const size_t size = routes_message::write(
 			buffer_cast<uint8_t*>(data_buffer),
-			buffer_size(data_buffer)
+			buffer_size(data_buffer),
+			version,
+			routes,
+			dns_servers,
+			compact
 		);
 
-		m_fscp_server->async_send_data_to_all(
+		m_fscp_server->async_send_data(
+			target,
 			fscp::CHANNEL_NUMBER_1,
 			buffer(data_buffer, size),
 			make_shared_buffer_handler(
@@ -930,24 +1517,26 @@ namespace freelan
 		);
 	}
 
-	void core::async_send_routes_request_to_all()
-	{
-		async_send_routes_request_to_all(boost::bind(&core::do_handle_send_routes_request_to_all, this, _1));
-	}
-
-	void core::async_send_routes(const ep_type& target, routes_message::version_type version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers, simple_handler_type handler)
+	void core::async_send_routes_delta(const ep_type& target, routes_message::version_type version, routes_message::version_type base_version, const asiotap::ip_route_set& added_routes, const asiotap::ip_route_set& removed_routes, const asiotap::ip_address_set& added_dns_servers, const asiotap::ip_address_set& removed_dns_servers, simple_handler_type handler)
 	{
 		assert(m_fscp_server);
 
-		m_logger(fscp::log_level::debug) << "Sending routes and DNS servers to " << target << ": version " << version << " (" << routes << "), (" << dns_servers << ").";
+		m_logger(fscp::log_level::debug) << "Sending routes delta to " << target << ": version " << version << " from version " << base_version << " (added " << added_routes << ", removed " << removed_routes << "), (added " << added_dns_servers << ", removed " << removed_dns_servers << ").";
 
-		const auto data_buffer = SharedBuffer(8192);
-		const size_t size = routes_message::write(
+		const auto data_buffer = SharedBuffer(routes_message::estimate_size(added_routes.size() + removed_routes.size(), added_dns_servers.size() + removed_dns_servers.size()));
+
+		// A delta is only ever sent to a peer that advertised a known
+		// version, so it necessarily understands the compressed groups.
+		const size_t size = routes_message::write_delta(
 			buffer_cast<uint8_t*>(data_buffer),
 			buffer_size(data_buffer),
 			version,
-			routes,
-			dns_servers
+			base_version,
+			added_routes,
+			removed_routes,
+			added_dns_servers,
+			removed_dns_servers,
+			true
 		);
 
 		m_fscp_server->async_send_data(
@@ -1056,19 +1645,57 @@ namespace freelan
 		}
 	}
 
-	void core::do_handle_send_routes_request(const ep_type& target, const boost::system::error_code& ec)
+	void core::do_send_routes_request(const ep_type& target, simple_handler_type handler)
 	{
-		if (ec)
+		// All calls to do_send_routes_request() are done within the m_router_strand, so the following is safe.
+		assert(m_fscp_server);
+
+		boost::optional<routes_message::version_type> known_version;
+
+		const client_router_info_map_type::const_iterator client_router_info = m_client_router_info_map.find(target);
+
+		if (client_router_info != m_client_router_info_map.end())
 		{
-			m_logger(fscp::log_level::warning) << "Error sending routes request to " << target << ": " << ec.message();
+			known_version = client_router_info->second.version;
 		}
+
+		if (known_version)
+		{
+			m_logger(fscp::log_level::debug) << "Sending routes request to " << target << " (known version " << *known_version << ").";
+		}
+		else
+		{
+			m_logger(fscp::log_level::debug) << "Sending routes request to " << target << ".";
+		}
+
+		const auto data_buffer = SharedBuffer(2048);
+		const size_t size = known_version ?
+			routes_request_message::write(
+				buffer_cast<uint8_t*>(data_buffer),
+				buffer_size(data_buffer),
+				*known_version
+			) :
+			routes_request_message::write(
+				buffer_cast<uint8_t*>(data_buffer),
+				buffer_size(data_buffer)
+			);
+
+		m_fscp_server->async_send_data(
+			target,
+			fscp::CHANNEL_NUMBER_1,
+			buffer(data_buffer, size),
+			make_shared_buffer_handler(
+				data_buffer,
+				handler
+			)
+		);
 	}
 
-	void core::do_handle_send_routes_request_to_all(const std::map<ep_type, boost::system::error_code>& results)
+	void core::do_handle_send_routes_request(const ep_type& target, const boost::system::error_code& ec)
 	{
-		for (std::map<ep_type, boost::system::error_code>::const_iterator result = results.begin(); result != results.end(); ++result)
+		if (ec)
 		{
-			do_handle_send_routes_request(result->first, result->second);
+			m_logger(fscp::log_level::warning) << "Error sending routes request to " << target << ": " << ec.message();
 		}
 	}
 
@@ -1118,12 +1745,74 @@ namespace freelan
 			{
 				m_logger(fscp::log_level::information) << "Received contact from " << sender << ": " << hash << " is at: " << answer;
 
-				async_contact(to_endpoint(answer));
+				if (m_configuration.fscp.relay_enabled)
+				{
+					const endpoint contact_ep = to_endpoint(answer);
+
+					async_contact(contact_ep, [this, contact_ep, sender, answer] (const ep_type& host, const boost::system::error_code& ec, const boost::posix_time::time_duration& duration)
+					{
+						if (!ec)
+						{
+							do_handle_contact(contact_ep, host, ec, duration);
+						}
+						else
+						{
+							// The host cannot be greeted directly, but the
+							// peer that announced it reaches both of us: it
+							// becomes the relay for that host.
+							m_logger(fscp::log_level::information) << "Unable to contact " << answer << " directly. Relaying through " << sender << ".";
+
+							m_fscp_server->set_relay(answer, sender);
+
+							do_contact(answer, boost::bind(&core::do_handle_contact, this, contact_ep, _1, _2, _3));
+						}
+					});
+				}
+				else
+				{
+					async_contact(to_endpoint(answer));
+				}
+			}
+		}
+	}
+
+	unsigned int core::scheduling_weight_for(const ep_type& host, cert_type sig_cert) const
+	{
+		// The classes are evaluated in order: the first one whose every
+		// selector matches gives the host its weight.
+		for (auto&& scheduling_class : m_configuration.fscp.scheduling_classes)
+		{
+			if (scheduling_class.network)
+			{
+				if (!has_address(*scheduling_class.network, host.address()))
+				{
+					continue;
+				}
+			}
+
+			if (scheduling_class.common_name)
+			{
+				if (!sig_cert)
+				{
+					continue;
+				}
+
+				const auto subject = sig_cert.subject();
+				const auto entry = subject.find(NID_commonName);
+
+				if ((entry == subject.end()) || (entry->data().str() != *scheduling_class.common_name))
+				{
+					continue;
+				}
 			}
+
+			return scheduling_class.weight;
 		}
+
+		return 1;
 	}
 
-	bool core::do_handle_presentation_received(const ep_type& sender, cert_type sig_cert, fscp::server::presentation_status_type status, bool has_session)
+	void core::do_handle_presentation_received(const ep_type& sender, cert_type sig_cert, fscp::server::presentation_status_type status, bool has_session, fscp::server::presentation_acceptance_handler_type acceptance_handler)
 	{
 		if (m_logger.level() <= fscp::log_level::debug)
 		{
@@ -1141,35 +1830,66 @@ namespace freelan
 		{
 			m_logger(fscp::log_level::warning) << "Ignoring PRESENTATION from " << sender << " as it is a banned host.";
 
-			return false;
+			acceptance_handler(false);
+
+			return;
 		}
 
 		if (has_session)
 		{
 			m_logger(fscp::log_level::warning) << "Ignoring PRESENTATION from " << sender << " as an active session currently exists with this host.";
 
-			return false;
+			acceptance_handler(false);
+
+			return;
 		}
 
 		if (!!sig_cert)
 		{
-			if (!certificate_is_valid(sig_cert))
-			{
-				m_logger(fscp::log_level::warning) << "Ignoring PRESENTATION from " << sender << " as the signature certificate is invalid.";
+			// The certificate chain verification is expensive: it runs on the
+			// dedicated verification pool so that presentations from other
+			// hosts can proceed in the meantime.
+			m_cert_verification_io_service.post([this, sender, sig_cert, status, acceptance_handler](){
+				if (!certificate_is_valid(sig_cert))
+				{
+					m_logger(fscp::log_level::warning) << "Ignoring PRESENTATION from " << sender << " as the signature certificate is invalid.";
 
-				return false;
-			}
+					acceptance_handler(false);
+
+					return;
+				}
+
+				m_logger(fscp::log_level::information) << "Accepting PRESENTATION from " << sender << " (" << sig_cert.subject() << "): " << status << ".";
 
-			m_logger(fscp::log_level::information) << "Accepting PRESENTATION from " << sender << " (" << sig_cert.subject() << "): " << status << ".";
+				if (!m_configuration.fscp.scheduling_classes.empty())
+				{
+					// The weight is set before the session exists, so it is
+					// in place before any traffic flows towards the host.
+					m_fscp_server->set_peer_scheduling_weight(sender, scheduling_weight_for(sender, sig_cert));
+				}
+
+				// The acceptance is reported first so the presentation store is committed before the session request is processed.
+				acceptance_handler(true);
+
+				async_request_session(sender);
+			});
 		}
 		else
 		{
 			m_logger(fscp::log_level::information) << "Accepting PRESENTATION from " << sender << " for pre-shared key authentication: " << status << ".";
-		}
 
-		async_request_session(sender);
+			if (!m_configuration.fscp.scheduling_classes.empty())
+			{
+				// Pre-shared key hosts carry no certificate: only the
+				// endpoint selectors can match them.
+				m_fscp_server->set_peer_scheduling_weight(sender, scheduling_weight_for(sender, sig_cert));
+			}
 
-		return true;
+			// The acceptance is reported first so the presentation store is committed before the session request is processed.
+			acceptance_handler(true);
+
+			async_request_session(sender);
+		}
 	}
 
 	bool core::do_handle_session_request_received(const ep_type& sender, const fscp::cipher_suite_list_type& cscap, const fscp::elliptic_curve_list_type& eccap, bool default_accept)
@@ -1262,6 +1982,14 @@ namespace freelan
 			if (m_configuration.tap_adapter.type == tap_adapter_configuration::tap_adapter_type::tap)
 			{
 				async_register_switch_port(host, boost::bind(&core::async_send_routes_request, this, host));
+
+				if (m_configuration.switch_.mac_gossip_enabled)
+				{
+					// The new peer's switch table is cold: hand it every
+					// local station at once instead of letting it flood
+					// its way to them.
+					m_router_strand.post(boost::bind(&core::do_send_local_macs_to, this, host));
+				}
 			}
 			else
 			{
@@ -1271,6 +1999,11 @@ namespace freelan
 
 			const auto route = m_route_manager.get_route_for(host.address());
 			async_save_system_route(host, route, void_handler_type());
+
+			if (m_configuration.fscp.mtu_discovery)
+			{
+				m_fscp_server->async_discover_mtu(host, boost::bind(&core::do_handle_mtu_discovered, this, host, _1, _2));
+			}
 		}
 
 		if (m_session_established_callback)
@@ -1298,19 +2031,46 @@ namespace freelan
 		}
 
 		async_clear_client_router_info(host, void_handler_type());
+
+		// Unregistering the port withdraws its routes at once: the next
+		// frame already fails over to whatever other route covers the
+		// destination. Reconvergence must not wait for the next timer
+		// cycles either, so the remaining hosts are asked for their routes
+		// right away and the configured contacts are probed again to
+		// re-establish the lost session.
+		async_send_routes_request_to_all();
+		async_contact_all();
+	}
+
+	void core::do_handle_mtu_discovered(const ep_type& host, const boost::system::error_code& ec, size_t mtu)
+	{
+		if (ec)
+		{
+			if (ec != boost::asio::error::operation_aborted)
+			{
+				m_logger(fscp::log_level::warning) << "Path MTU discovery with " << host << " failed: " << ec.message() << ".";
+			}
+
+			return;
+		}
+
+		m_logger(fscp::log_level::information) << "Path MTU with " << host << ": " << mtu << " byte(s).";
 	}
 
 	void core::do_handle_data_received(const ep_type& sender, fscp::channel_number_type channel_number, fscp::SharedBuffer buffer, boost::asio::const_buffer data)
 	{
 		switch (channel_number)
 		{
-			// Channel 0 contains ethernet/ip frames
+			// Channels 0 and 2 contain ethernet/ip frames (2 carries the
+			// interactive ones)
 			case fscp::CHANNEL_NUMBER_0:
+			case fscp::CHANNEL_NUMBER_2:
 				if (m_configuration.tap_adapter.type == tap_adapter_configuration::tap_adapter_type::tap)
 				{
 					async_write_switch(
 						make_port_index(sender),
 						data,
+						boost::none,
 						make_shared_buffer_handler(
 							buffer,
 							&null_switch_write_handler
@@ -1322,6 +2082,7 @@ namespace freelan
 					async_write_router(
 						make_port_index(sender),
 						data,
+						boost::none,
 						make_shared_buffer_handler(
 							buffer,
 							&null_router_write_handler
@@ -1372,13 +2133,31 @@ namespace freelan
 					break;
 				}
 
+			case message::MT_ROUTES_DELTA:
+				{
+					routes_message r_msg(msg);
+
+					async_handle_routes_delta(sender, r_msg);
+
+					break;
+				}
+
+			case message::MT_MAC_ADDRESSES:
+				{
+					mac_addresses_message ma_msg(msg);
+
+					async_handle_mac_addresses(sender, ma_msg);
+
+					break;
+				}
+
 			default:
 				m_logger(fscp::log_level::warning) << "Received unhandled message of type " << static_cast<int>(msg.type()) << " on the message channel";
 				break;
 		}
 	}
 
-	void core::do_handle_routes_request(const ep_type& sender)
+	void core::do_handle_routes_request(const ep_type& sender, const boost::optional<routes_message::version_type>& known_version)
 	{
 		// All calls to do_handle_routes_request() are done within the m_router_strand, so the following is safe.
 		if (!m_configuration.router.accept_routes_requests)
@@ -1396,9 +2175,7 @@ namespace freelan
 					const auto routes = local_port->local_routes();
 					const auto dns_servers = local_port->local_dns_servers();
 
-					m_logger(fscp::log_level::debug) << "Received routes request from " << sender << ". Replying with version " << *m_local_routes_version << ": " << routes << ". DNS: " << dns_servers;
-
-					async_send_routes(sender, *m_local_routes_version, routes, dns_servers, &null_simple_write_handler);
+					do_send_routes_reply(sender, known_version, *m_local_routes_version, routes, dns_servers);
 				}
 				else
 				{
@@ -1409,13 +2186,104 @@ namespace freelan
 			{
 				const auto routes = translate_ip_routes(m_configuration.router.local_ip_routes);
 				const auto dns_servers = m_configuration.router.local_dns_servers;
-				const auto version = 0;
+				const auto version = routes_message::version_type();
 
-				m_logger(fscp::log_level::debug) << "Received routes request from " << sender << ". Replying with version " << version << ": " << routes;
+				do_send_routes_reply(sender, known_version, version, routes, dns_servers);
+			}
+		}
+	}
+
+	void core::do_send_routes_reply(const ep_type& sender, const boost::optional<routes_message::version_type>& known_version, routes_message::version_type version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers)
+	{
+		// All calls to do_send_routes_reply() are done within the m_router_strand, so the following is safe.
+		do_record_local_routes_snapshot(version, routes, dns_servers);
+
+		if (known_version)
+		{
+			if (*known_version == version)
+			{
+				m_logger(fscp::log_level::debug) << "Received routes request from " << sender << " but it already knows version " << version << ". Not sending anything.";
+
+				return;
+			}
+
+			const local_routes_history_map_type::const_iterator snapshot = m_local_routes_history.find(*known_version);
+
+			if (snapshot != m_local_routes_history.end())
+			{
+				asiotap::ip_route_set added_routes;
+				asiotap::ip_route_set removed_routes;
+				asiotap::ip_address_set added_dns_servers;
+				asiotap::ip_address_set removed_dns_servers;
+
+				std::set_difference(routes.begin(), routes.end(), snapshot->second.routes.begin(), snapshot->second.routes.end(), std::inserter(added_routes, added_routes.end()));
+				std::set_difference(snapshot->second.routes.begin(), snapshot->second.routes.end(), routes.begin(), routes.end(), std::inserter(removed_routes, removed_routes.end()));
+				std::set_difference(dns_servers.begin(), dns_servers.end(), snapshot->second.dns_servers.begin(), snapshot->second.dns_servers.end(), std::inserter(added_dns_servers, added_dns_servers.end()));
+				std::set_difference(snapshot->second.dns_servers.begin(), snapshot->second.dns_servers.end(), dns_servers.begin(), dns_servers.end(), std::inserter(removed_dns_servers, removed_dns_servers.end()));
+
+				m_logger(fscp::log_level::debug) << "Received routes request from " << sender << ". Replying with a delta from version " << *known_version << " to version " << version << ".";
+
+				async_send_routes_delta(sender, version, *known_version, added_routes, removed_routes, added_dns_servers, removed_dns_servers, &null_simple_write_handler);
 
-				async_send_routes(sender, version, routes, dns_servers, &null_simple_write_handler);
+				return;
 			}
 		}
+
+		m_logger(fscp::log_level::debug) << "Received routes request from " << sender << ". Replying with version " << version << ": " << routes << ". DNS: " << dns_servers;
+
+		// A peer that advertises a known version runs a build recent enough
+		// to understand the compressed route groups; older peers get the
+		// legacy representation.
+		async_send_routes(sender, version, routes, dns_servers, known_version.is_initialized(), &null_simple_write_handler);
+	}
+
+	void core::do_record_local_routes_snapshot(routes_message::version_type version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers)
+	{
+		// All calls to do_record_local_routes_snapshot() are done within the m_router_strand, so the following is safe.
+		static const size_t MAX_LOCAL_ROUTES_HISTORY_SIZE = 8;
+
+		local_routes_snapshot_type& snapshot = m_local_routes_history[version];
+		snapshot.routes = routes;
+		snapshot.dns_servers = dns_servers;
+
+		// Only the most recent versions are kept: a requester at an evicted version gets a full message instead of a delta.
+		while (m_local_routes_history.size() > MAX_LOCAL_ROUTES_HISTORY_SIZE)
+		{
+			m_local_routes_history.erase(m_local_routes_history.begin());
+		}
+	}
+
+	void core::do_reload_local_routes(const asiotap::ip_route_set& local_routes, const asiotap::ip_address_set& local_dns_servers)
+	{
+		// All calls to do_reload_local_routes() are done within the m_router_strand, so the following is safe.
+		if (!m_tap_adapter)
+		{
+			return;
+		}
+
+		const auto local_port = m_router.get_port(make_port_index(m_tap_adapter));
+
+		if (!local_port)
+		{
+			return;
+		}
+
+		// Bumping the version is enough for propagation: the peers pick the
+		// change up through their periodic routes requests and only receive
+		// the delta from the version they already know.
+		if (m_local_routes_version.is_initialized())
+		{
+			m_local_routes_version = *m_local_routes_version + 1;
+		}
+		else
+		{
+			m_local_routes_version = routes_message::version_type();
+		}
+
+		local_port->set_local_routes(local_routes);
+		local_port->set_local_dns_servers(local_dns_servers);
+
+		m_logger(fscp::log_level::information) << "Now advertising the following routes (version " << *m_local_routes_version << "): " << local_routes;
 	}
 
 	void core::do_handle_routes(const asiotap::ip_network_address_list& tap_addresses, const ep_type& sender, routes_message::version_type version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers)
@@ -1548,74 +2416,246 @@ namespace freelan
 		// Silently filter out routes that are already covered by the default interface routing table entries (aka. routes that belong to the interface's network).
 		asiotap::ip_route_set filtered_system_routes;
 
-		for (auto&& ina: tap_addresses)
+		for (auto&& ina: tap_addresses)
+		{
+			for (auto&& route : filtered_routes)
+			{
+				if (!has_network(ina, network_address(route)))
+				{
+					filtered_system_routes.insert(route);
+				}
+			}
+		}
+
+		const auto system_routes = filter_routes(filtered_system_routes, m_configuration.router.system_route_acceptance_policy, m_configuration.router.maximum_routes_limit);
+
+		if (system_routes != filtered_system_routes)
+		{
+			if (system_routes.empty() && !filtered_system_routes.empty())
+			{
+				m_logger(fscp::log_level::warning) << "Received system routes from " << sender << " (version " << version << ") but none matched the system route acceptance policy (" << m_configuration.router.system_route_acceptance_policy << ", limit " << m_configuration.router.maximum_routes_limit << "): " << filtered_system_routes;
+			}
+			else
+			{
+				asiotap::ip_route_set excluded_routes;
+				std::set_difference(filtered_system_routes.begin(), filtered_system_routes.end(), system_routes.begin(), system_routes.end(), std::inserter(excluded_routes, excluded_routes.end()));
+
+				m_logger(fscp::log_level::warning) << "Received system routes from " << sender << " (version " << version << ") but some did not match the system route acceptance policy (" << m_configuration.router.system_route_acceptance_policy << ", limit " << m_configuration.router.maximum_routes_limit << "): " << excluded_routes;
+			}
+		}
+
+		// Group all the kernel route changes below (registrations, and the release of stale entries when the assignment at the end destroys them) into a single batch, when the platform supports it.
+		const asiotap::route_manager::batch_scope_type batch_scope(m_route_manager);
+
+		// The same goes for the DNS server changes, which would otherwise each spawn a platform command.
+		const asiotap::dns_servers_manager::batch_scope_type dns_batch_scope(m_dns_servers_manager);
+
+		client_router_info_type new_client_router_info;
+		new_client_router_info.saved_system_route = client_router_info.saved_system_route;
+		new_client_router_info.version = version;
+		new_client_router_info.routes = routes;
+		new_client_router_info.dns_servers = dns_servers;
+
+		for (auto&& route : filtered_system_routes)
+		{
+			// Mac OSX doesn't support duplicate default gateways.
+#ifdef MACINTOSH
+			const auto address = to_ip_address(network_address(route));
+			const auto prefix_length = to_prefix_length(network_address(route));
+
+			if ((address == boost::asio::ip::address_v4::any()) && (prefix_length == 0)) {
+				m_logger(fscp::log_level::warning) << "Received a default IPv4 route: splitting it as Mac OS X doesn't support duplicate default routes.";
+
+				const auto gateway = asiotap::gateway(route);
+
+				boost::optional<boost::asio::ip::address_v4> ipv4_gateway;
+
+				if (gateway && gateway->is_v4()) {
+					ipv4_gateway = gateway->to_v4();
+				}
+
+				const auto route1 = asiotap::ipv4_route(asiotap::ipv4_network_address(boost::asio::ip::address_v4::from_string("0.0.0.0"), 1), ipv4_gateway);
+				const auto route2 = asiotap::ipv4_route(asiotap::ipv4_network_address(boost::asio::ip::address_v4::from_string("128.0.0.0"), 1), ipv4_gateway);
+
+				new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route1)));
+				new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route2)));
+			} else {
+				new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route)));
+			}
+#else
+			new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route)));
+#endif
+		}
+		for (auto&& dns_server : filtered_dns_servers)
+		{
+			new_client_router_info.dns_servers_entries.push_back(m_dns_servers_manager.get_dns_server_entry(m_tap_adapter->get_dns_server(dns_server)));
+		}
+
+		// The route and DNS server entries are reference-counted by their managers: entries for unchanged routes were acquired above, before the old entries get released here, so unchanged system routes are never removed and re-added.
+		client_router_info = new_client_router_info;
+	}
+
+	void core::do_handle_routes_delta(const asiotap::ip_network_address_list& tap_addresses, const ep_type& sender, routes_message::version_type version, routes_message::version_type base_version, const asiotap::ip_route_set& added_routes, const asiotap::ip_route_set& removed_routes, const asiotap::ip_address_set& added_dns_servers, const asiotap::ip_address_set& removed_dns_servers)
+	{
+		// All calls to do_handle_routes_delta() are done within the m_router_strand, so the following is safe.
+
+		client_router_info_type& client_router_info = m_client_router_info_map[sender];
+
+		if (!client_router_info.version || (*client_router_info.version != base_version))
+		{
+			m_logger(fscp::log_level::debug) << "Received routes delta from " << sender << " based on version " << base_version << " which does not match the local state. Requesting a full routes message.";
+
+			// Forgetting the version makes the next request a legacy one, which always gets a full reply.
+			client_router_info.version = boost::none;
+
+			async_send_routes_request(sender);
+
+			return;
+		}
+
+		if (!client_router_info.is_older_than(version))
+		{
+			m_logger(fscp::log_level::debug) << "Ignoring old routes delta message with version " << version << " as current version is " << *client_router_info.version;
+
+			return;
+		}
+
+		asiotap::ip_route_set routes = client_router_info.routes;
+		asiotap::ip_address_set dns_servers = client_router_info.dns_servers;
+
+		for (auto&& route : removed_routes)
+		{
+			routes.erase(route);
+		}
+
+		routes.insert(added_routes.begin(), added_routes.end());
+
+		for (auto&& dns_server : removed_dns_servers)
+		{
+			dns_servers.erase(dns_server);
+		}
+
+		dns_servers.insert(added_dns_servers.begin(), added_dns_servers.end());
+
+		m_logger(fscp::log_level::debug) << "Received routes delta from " << sender << " (version " << base_version << " to " << version << "): applying over the known routes.";
+
+		do_handle_routes(tap_addresses, sender, version, routes, dns_servers);
+	}
+
+	void core::do_handle_mac_addresses(const ep_type& sender, const std::vector<switch_::ethernet_address_type>& addresses)
+	{
+		// All calls to do_handle_mac_addresses() are done within the m_router_strand, so the following is safe.
+		size_t learned = 0;
+
+		for (auto&& address : addresses)
+		{
+			if (m_switch.learn(make_port_index(sender), address))
+			{
+				++learned;
+			}
+		}
+
+		if (learned > 0)
+		{
+			m_logger(fscp::log_level::debug) << "Learned " << learned << " gossiped ethernet address(es) from " << sender << ".";
+		}
+	}
+
+	void core::do_handle_local_mac_learned(const port_index_type& index, const switch_::ethernet_address_type& address)
+	{
+		// The switch invokes the handler from within the m_router_strand, so the following is safe.
+		if (m_tap_adapter && (index == make_port_index(m_tap_adapter)))
 		{
-			for (auto&& route : filtered_routes)
+			if (m_local_macs.insert(address).second)
 			{
-				if (!has_network(ina, network_address(route)))
+				m_pending_mac_gossip.push_back(address);
+
+				if (!m_mac_gossip_pending)
 				{
-					filtered_system_routes.insert(route);
+					// The first new station of a batch arms the gossip
+					// timer: whatever else shows up before it fires rides
+					// the same message.
+					m_mac_gossip_pending = true;
+
+					m_mac_gossip_timer.expires_from_now(MAC_GOSSIP_DELAY);
+					m_mac_gossip_timer.async_wait(m_router_strand.wrap(boost::bind(&core::do_gossip_local_macs, this, boost::asio::placeholders::error)));
 				}
 			}
 		}
+		else
+		{
+			// The station moved behind another port: it is no longer ours
+			// to advertise.
+			m_local_macs.erase(address);
+		}
+	}
 
-		const auto system_routes = filter_routes(filtered_system_routes, m_configuration.router.system_route_acceptance_policy, m_configuration.router.maximum_routes_limit);
+	void core::do_gossip_local_macs(const boost::system::error_code& ec)
+	{
+		// All calls to do_gossip_local_macs() are done within the m_router_strand, so the following is safe.
+		m_mac_gossip_pending = false;
 
-		if (system_routes != filtered_system_routes)
+		if (ec == boost::asio::error::operation_aborted)
 		{
-			if (system_routes.empty() && !filtered_system_routes.empty())
-			{
-				m_logger(fscp::log_level::warning) << "Received system routes from " << sender << " (version " << version << ") but none matched the system route acceptance policy (" << m_configuration.router.system_route_acceptance_policy << ", limit " << m_configuration.router.maximum_routes_limit << "): " << filtered_system_routes;
-			}
-			else
-			{
-				asiotap::ip_route_set excluded_routes;
-				std::set_difference(filtered_system_routes.begin(), filtered_system_routes.end(), system_routes.begin(), system_routes.end(), std::inserter(excluded_routes, excluded_routes.end()));
-
-				m_logger(fscp::log_level::warning) << "Received system routes from " << sender << " (version " << version << ") but some did not match the system route acceptance policy (" << m_configuration.router.system_route_acceptance_policy << ", limit " << m_configuration.router.maximum_routes_limit << "): " << excluded_routes;
-			}
+			return;
 		}
 
-		client_router_info_type new_client_router_info;
-		new_client_router_info.saved_system_route = client_router_info.saved_system_route;
-		new_client_router_info.version = client_router_info.version;
-
-		for (auto&& route : filtered_system_routes)
+		if (!m_fscp_server || m_pending_mac_gossip.empty())
 		{
-			// Mac OSX doesn't support duplicate default gateways.
-#ifdef MACINTOSH
-			const auto address = to_ip_address(network_address(route));
-			const auto prefix_length = to_prefix_length(network_address(route));
+			m_pending_mac_gossip.clear();
 
-			if ((address == boost::asio::ip::address_v4::any()) && (prefix_length == 0)) {
-				m_logger(fscp::log_level::warning) << "Received a default IPv4 route: splitting it as Mac OS X doesn't support duplicate default routes.";
+			return;
+		}
 
-				const auto gateway = asiotap::gateway(route);
+		m_logger(fscp::log_level::debug) << "Gossiping " << m_pending_mac_gossip.size() << " newly learned ethernet address(es).";
 
-				boost::optional<boost::asio::ip::address_v4> ipv4_gateway;
+		const auto data_buffer = SharedBuffer(mac_addresses_message::estimate_size(m_pending_mac_gossip.size()));
+		const size_t size = mac_addresses_message::write(
+			buffer_cast<uint8_t*>(data_buffer),
+			buffer_size(data_buffer),
+			m_pending_mac_gossip
+		);
 
-				if (gateway && gateway->is_v4()) {
-					ipv4_gateway = gateway->to_v4();
-				}
+		m_pending_mac_gossip.clear();
 
-				const auto route1 = asiotap::ipv4_route(asiotap::ipv4_network_address(boost::asio::ip::address_v4::from_string("0.0.0.0"), 1), ipv4_gateway);
-				const auto route2 = asiotap::ipv4_route(asiotap::ipv4_network_address(boost::asio::ip::address_v4::from_string("128.0.0.0"), 1), ipv4_gateway);
+		m_fscp_server->async_send_data_to_all(
+			fscp::CHANNEL_NUMBER_1,
+			buffer(data_buffer, size),
+			make_shared_buffer_handler(
+				data_buffer,
+				multiple_endpoints_handler_type([] (const std::map<ep_type, boost::system::error_code>&) {})
+			)
+		);
+	}
 
-				new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route1)));
-				new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route2)));
-			} else {
-				new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route)));
-			}
-#else
-			new_client_router_info.system_route_entries.push_back(m_route_manager.get_route_entry(m_tap_adapter->get_route(route)));
-#endif
-		}
-		for (auto&& dns_server : filtered_dns_servers)
+	void core::do_send_local_macs_to(const ep_type& host)
+	{
+		// All calls to do_send_local_macs_to() are done within the m_router_strand, so the following is safe.
+		if (!m_fscp_server || m_local_macs.empty())
 		{
-			new_client_router_info.dns_servers_entries.push_back(m_dns_servers_manager.get_dns_server_entry(m_tap_adapter->get_dns_server(dns_server)));
+			return;
 		}
 
-		client_router_info = new_client_router_info;
+		m_logger(fscp::log_level::debug) << "Sending " << m_local_macs.size() << " learned ethernet address(es) to " << host << ".";
+
+		const std::vector<switch_::ethernet_address_type> addresses(m_local_macs.begin(), m_local_macs.end());
+
+		const auto data_buffer = SharedBuffer(mac_addresses_message::estimate_size(addresses.size()));
+		const size_t size = mac_addresses_message::write(
+			buffer_cast<uint8_t*>(data_buffer),
+			buffer_size(data_buffer),
+			addresses
+		);
+
+		m_fscp_server->async_send_data(
+			host,
+			fscp::CHANNEL_NUMBER_1,
+			buffer(data_buffer, size),
+			make_shared_buffer_handler(
+				data_buffer,
+				simple_handler_type([] (const boost::system::error_code&) {})
+			)
+		);
 	}
 
 	int core::certificate_validation_callback(int ok, X509_STORE_CTX* ctx)
@@ -1648,6 +2688,10 @@ namespace freelan
 
 		m_ca_store = cryptoplus::x509::store::create();
 
+		// The new store may carry different authorities or revocation
+		// lists: chains validated against the old one are stale.
+		m_validated_chain_cache.clear();
+
 		for (const cert_type& cert : m_configuration.security.certificate_authority_list)
 		{
 			m_ca_store.add_certificate(cert);
@@ -1685,6 +2729,28 @@ namespace freelan
 	{
 		cert_type cert = store_context.get_current_certificate();
 
+		if (ok && (m_configuration.security.certificate_revocation_validation_method != security_configuration::CRVM_NONE) && !m_crl_issuers.empty())
+		{
+			// The issuer comparisons run on the cached encoding hashes:
+			// only a list whose issuer actually matches pays the byte
+			// comparison and the serial number lookup, which itself stays
+			// cheap even with huge lists since they index their serials.
+			const cryptoplus::x509::name cert_issuer = cert.issuer();
+			const uint64_t cert_issuer_hash = cert_issuer.der_hash();
+
+			const auto& crls = m_configuration.security.certificate_revocation_list_list;
+
+			for (size_t i = 0; i < crls.size(); ++i)
+			{
+				if ((m_crl_issuers[i].der_hash() == cert_issuer_hash) && (m_crl_issuers[i].der_encoding() == cert_issuer.der_encoding()) && crls[i].is_revoked(cert.serial_number()))
+				{
+					m_logger(fscp::log_level::warning) << "Error when validating " << cert.subject() << ": certificate is revoked (depth: " << store_context.get_error_depth() << ")";
+
+					return false;
+				}
+			}
+		}
+
 		if (!ok)
 		{
 			m_logger(fscp::log_level::warning) << "Error when validating " << cert.subject() << ": " << store_context.get_error_string() << " (depth: " << store_context.get_error_depth() << ")";
@@ -1705,9 +2771,25 @@ namespace freelan
 				{
 					using namespace cryptoplus;
 
+					// The store is normally warmed up asynchronously at
+					// start-up: build it on demand if we got here first.
+					build_ca_store(build_ca_store_when::it_doesnt_exist);
+
 					// We can't easily ensure m_ca_store is used only in one strand, so we protect it with a mutex instead.
 					boost::mutex::scoped_lock lock(m_ca_store_mutex);
 
+					// A fingerprint already validated against the current
+					// store skips the chain verification, as long as the
+					// certificate has not expired meanwhile. The SHA-256 is
+					// orders of magnitude cheaper than the path building
+					// and the signature checks it saves on every renewal.
+					const cryptoplus::buffer fingerprint = cert.sha256_fingerprint();
+
+					if ((m_validated_chain_cache.count(fingerprint) > 0) && (X509_cmp_current_time(X509_get_notAfter(cert.raw())) > 0))
+					{
+						break;
+					}
+
 					// Create a store context to proceed to verification
 					x509::store_context store_context = x509::store_context::create();
 
@@ -1724,6 +2806,13 @@ namespace freelan
 						return false;
 					}
 
+					if (m_validated_chain_cache.size() >= VALIDATED_CHAIN_CACHE_MAX_SIZE)
+					{
+						m_validated_chain_cache.clear();
+					}
+
+					m_validated_chain_cache.insert(fingerprint);
+
 					break;
 				}
 			case security_configuration::CVM_NONE:
@@ -1752,8 +2841,19 @@ namespace freelan
 				async_write_tap(buffer(data), m_io_service.wrap(handler));
 			};
 
+#ifndef WINDOWS
+			m_tap_adapter->set_desired_queue_count(m_configuration.tap_adapter.queue_count);
+#endif
+
+			m_tap_adapter->set_busy_poll_duration(m_configuration.fscp.busy_poll_us);
+
 			m_tap_adapter->open(m_configuration.tap_adapter.name);
 
+			if (m_tap_adapter->queue_count() > 1)
+			{
+				m_logger(fscp::log_level::information) << "Tap adapter opened with " << m_tap_adapter->queue_count() << " queues.";
+			}
+
 			asiotap::tap_adapter_configuration tap_config;
 
 			// The device MTU.
@@ -1864,6 +2964,7 @@ namespace freelan
 
 					m_dhcp_proxy.reset(new dhcp_proxy_type());
 					m_dhcp_proxy->set_hardware_address(m_tap_adapter->ethernet_address().data());
+					m_dhcp_proxy->set_checksum_offload(m_tap_adapter->checksum_offload());
 
 					if (!m_configuration.tap_adapter.dhcp_server_ipv4_address_prefix_length.is_null())
 					{
@@ -1907,6 +3008,7 @@ namespace freelan
 				// Handle ICMPv6 neighbor solicitations. This is required for Windows.
 				m_icmpv6_proxy.reset(new icmpv6_proxy_type());
 				m_icmpv6_proxy->set_neighbor_solicitation_callback(boost::bind(&core::do_handle_icmpv6_neighbor_solicitation, this, _1, _2));
+				m_icmpv6_proxy->set_checksum_offload(m_tap_adapter->checksum_offload());
 
 				// We don't need those proxies in TUN mode.
 				m_arp_proxy.reset();
@@ -1936,6 +3038,10 @@ namespace freelan
 				m_tap_adapter_up_callback(*m_tap_adapter);
 			}
 
+			// The morphers and proxies are set up: recompute the tun frame
+			// dispatch table before the first read.
+			update_tun_frame_dispatch();
+
 			async_read_tap();
 
 			m_tap_adapter_thread = boost::thread([this](){
@@ -1963,6 +3069,8 @@ namespace freelan
 
 		m_tcp_mss_morpher.reset();
 
+		update_tun_frame_dispatch();
+
 		if (m_tap_adapter)
 		{
 			if (m_tap_adapter_down_callback)
@@ -2001,85 +3109,154 @@ namespace freelan
 
 	void core::async_read_tap()
 	{
-		m_tap_adapter_io_service.post(boost::bind(&core::do_read_tap, this));
+		// One independent read pipeline per queue exposed by the tap adapter.
+		for (size_t queue = 0; queue < m_tap_adapter->queue_count(); ++queue)
+		{
+			m_tap_adapter_io_service.post(boost::bind(&core::do_read_tap, this, queue));
+		}
 	}
 
-	template <typename ConstBufferSequence>
-	void core::push_tap_write(const ConstBufferSequence& data, simple_handler_type handler)
+	void core::push_tap_write(boost::asio::const_buffer data, simple_handler_type handler)
 	{
 		// All push_tap_write() calls are done in the m_tap_adapter_io_service so the following is thread-safe.
-		const auto write_call = [this, data, handler] () {
-			m_tap_adapter->async_write(data, [this, handler] (const boost::system::error_code& ec, size_t) {
-				pop_tap_write();
+		const bool idle = m_tap_write_queue.empty();
 
-				handler(ec);
-			});
-		};
+		m_tap_write_queue.push_back(pending_tap_write_type{ data, handler });
+
+		if (idle)
+		{
+			// Nothing is being written, lets start a write batch immediately.
+			flush_tap_writes();
+		}
+	}
+
+	void core::flush_tap_writes()
+	{
+		// All flush_tap_writes() calls are done in the m_tap_adapter_io_service so the following is thread-safe.
+		//
+		// The queued frames are submitted as one batch: the entries stay in
+		// the queue until the completion reports, per frame, which ones went
+		// through. A non-empty queue thus also marks a batch in flight.
+		const size_t batch_size = std::min(m_tap_write_queue.size(), TAP_WRITE_BATCH_SIZE);
+		std::vector<boost::asio::const_buffer> frame_buffers;
+
+		frame_buffers.reserve(batch_size);
 
-		if (m_tap_write_queue.empty())
+		for (size_t i = 0; i < batch_size; ++i)
 		{
-			// Nothing is being written, lets start the write immediately.
-			write_call();
+			frame_buffers.push_back(m_tap_write_queue[i].data);
 		}
 
-		// We need to push it always, even if it was called immediately as it
-		// will be popped-out when the write ends and also serves as a marker
-		// that a write is in progress.
-		m_tap_write_queue.push(write_call);
+		m_tap_adapter->async_write_frames(frame_buffers, [this] (const boost::system::error_code& ec, const std::vector<size_t>& frame_sizes) {
+			handle_tap_writes_complete(ec, frame_sizes);
+		});
 	}
 
-	void core::pop_tap_write()
+	void core::handle_tap_writes_complete(const boost::system::error_code& ec, const std::vector<size_t>& frame_sizes)
 	{
-		// All pop_tap_write() calls are done in the m_tap_adapter_io_service so the following is thread-safe.
-		m_tap_write_queue.pop();
+		// All handle_tap_writes_complete() calls are done in the m_tap_adapter_io_service so the following is thread-safe.
+		for (size_t i = 0; i < frame_sizes.size(); ++i)
+		{
+			m_tap_write_queue.front().handler(boost::system::error_code());
+			m_tap_write_queue.pop_front();
+		}
+
+		if (ec && !m_tap_write_queue.empty())
+		{
+			// The frame right after the last written one failed; the ones
+			// after it were not attempted and stay queued.
+			m_tap_write_queue.front().handler(ec);
+			m_tap_write_queue.pop_front();
+		}
 
 		if (!m_tap_write_queue.empty())
 		{
-			m_tap_write_queue.front()();
+			flush_tap_writes();
 		}
 	}
 
-	void core::do_read_tap()
+	void core::do_read_tap(size_t queue)
 	{
 		// All calls to do_read_tap() are done within the m_tap_adapter_io_service, so the following is safe.
 		assert(m_tap_adapter);
 
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer receive_buffer = m_tap_adapter_buffers.empty() ? SharedBuffer(65536) : [this] () {
-			const auto result = m_tap_adapter_buffers.front();
-			m_tap_adapter_buffers.pop_front();
+		// Get a batch of buffers, either new ones or old, recycled ones if possible.
+		const auto receive_buffers = boost::make_shared<std::vector<SharedBuffer>>();
+		std::vector<boost::asio::mutable_buffer> frame_buffers;
 
-			return result;
-		}();
+		receive_buffers->reserve(TAP_READ_BATCH_SIZE);
+		frame_buffers.reserve(TAP_READ_BATCH_SIZE);
 
-		m_tap_adapter->async_read(
-			buffer(receive_buffer),
-			boost::bind(
-				&core::do_handle_tap_adapter_read,
-				this,
-				SharedBuffer(receive_buffer, [this](const SharedBuffer& buffer) {
-					m_tap_adapter_io_service.post([this, buffer] () {
-						m_tap_adapter_buffers.push_back(buffer);
-					});
-				}),
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred
-			)
+		for (size_t i = 0; i < TAP_READ_BATCH_SIZE; ++i)
+		{
+			// The tier follows the configured MTU: ordinary frames recycle
+			// small buffers, jumbo MTUs fall back to the worst-case tier.
+			const SharedBuffer receive_buffer = m_tap_adapter_buffers.get(m_tap_adapter->mtu() + ETHERNET_FRAME_OVERHEAD + fscp::data_message::HEADER_OVERHEAD);
+
+			receive_buffers->push_back(receive_buffer);
+
+			// Reserve headroom so that unicast frames can be encrypted in
+			// place and sent without any payload copy.
+			frame_buffers.push_back(boost::asio::mutable_buffer(buffer(receive_buffer) + fscp::data_message::HEADER_OVERHEAD));
+		}
+
+		m_tap_adapter->async_read_some_frames(
+			queue,
+			frame_buffers,
+			[this, queue, receive_buffers] (const boost::system::error_code& ec, const std::vector<size_t>& frame_sizes) {
+				do_handle_tap_adapter_read(queue, receive_buffers, ec, frame_sizes);
+			}
 		);
 	}
 
-	void core::do_handle_tap_adapter_read(SharedBuffer receive_buffer, const boost::system::error_code& ec, size_t count)
+	void core::do_handle_tap_adapter_read(size_t queue, boost::shared_ptr<std::vector<SharedBuffer>> receive_buffers, const boost::system::error_code& ec, const std::vector<size_t>& frame_sizes)
 	{
 		// All calls to do_handle_tap_adapter_read() are done within the m_tap_adapter_io_service, so the following is safe.
 		if (ec != boost::asio::error::operation_aborted)
 		{
 			// We try to read again, as soon as possible.
-			do_read_tap();
+			do_read_tap(queue);
 		}
 
 		if (!ec)
 		{
-			const boost::asio::mutable_buffer data = buffer(receive_buffer, count);
+			for (size_t frame = 0; frame < frame_sizes.size(); ++frame)
+			{
+				(*receive_buffers)[frame].trace_stamp(fscp::trace_stage::tap_read);
+
+				do_handle_tap_frame((*receive_buffers)[frame], frame_sizes[frame]);
+			}
+		}
+		else if (ec != boost::asio::error::operation_aborted)
+		{
+			m_logger(fscp::log_level::error) << "Read failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
+		}
+	}
+
+	void core::update_tun_frame_dispatch()
+	{
+		// The table is recomputed whenever a morpher or a proxy is enabled
+		// or disabled: only the protocols they care about pay for the
+		// generic filter parse.
+		std::fill(m_tun_ipv6_dispatch.begin(), m_tun_ipv6_dispatch.end(), tun_frame_action::route);
+
+		if (m_tcp_mss_morpher)
+		{
+			m_tun_ipv6_dispatch[asiotap::osi::TCP_PROTOCOL] = tun_frame_action::parse;
+		}
+
+		if (m_icmpv6_proxy)
+		{
+			m_tun_ipv6_dispatch[asiotap::osi::ICMPV6_HEADER] = tun_frame_action::parse_icmpv6;
+		}
+	}
+
+	void core::do_handle_tap_frame(const SharedBuffer& receive_buffer, size_t count)
+	{
+		// All calls to do_handle_tap_frame() are done within the m_tap_adapter_io_service, so the following is safe.
+		{
+			// The frame was read with some headroom reserved (see do_read_tap()).
+			const boost::asio::mutable_buffer data = boost::asio::buffer(buffer(receive_buffer) + fscp::data_message::HEADER_OVERHEAD, count);
 
 #ifdef FREELAN_DEBUG
 			std::cerr << "Read " << buffer_size(data) << " byte(s) on " << *m_tap_adapter << std::endl;
@@ -2092,6 +3269,8 @@ namespace freelan
 				// This line will eventually call the filters callbacks and the mss morpher.
 				m_ethernet_filter.parse(data);
 
+				receive_buffer.trace_stamp(fscp::trace_stage::filter_parse);
+
 				if (m_arp_proxy || m_dhcp_proxy)
 				{
 					if (m_arp_proxy && m_arp_filter.get_last_helper())
@@ -2109,9 +3288,23 @@ namespace freelan
 
 				if (!handled)
 				{
+					// The filters already parsed the frame: the addresses are carried along so the switch does not parse it again.
+					boost::optional<switch_::ethernet_frame_context_type> context;
+
+					const auto ethernet_helper = m_ethernet_filter.get_last_helper();
+
+					if (ethernet_helper)
+					{
+						context = switch_::ethernet_frame_context_type();
+						context->sender = switch_::to_ethernet_address(ethernet_helper->sender());
+						context->target = switch_::to_ethernet_address(ethernet_helper->target());
+					}
+
 					async_write_switch(
 						make_port_index(m_tap_adapter),
+						receive_buffer,
 						data,
+						context,
 						make_shared_buffer_handler(
 							receive_buffer,
 							&null_switch_write_handler
@@ -2121,25 +3314,72 @@ namespace freelan
 			}
 			else
 			{
-				// This line will eventually call the filters callbacks and the mss override.
-				m_tun_ipv6_filter.parse(data);
-
-				if (m_icmpv6_proxy)
+				// In tun mode, the frames that need a morpher or a proxy are
+				// told apart by the version nibble and the next-header byte
+				// through the computed dispatch table: every other frame goes
+				// straight to the router without the generic filter
+				// machinery.
+				const uint8_t* const frame_bytes = boost::asio::buffer_cast<const uint8_t*>(data);
+				const size_t frame_size = buffer_size(data);
+
+				// When the destination can be determined here, it is carried
+				// along so the router does not parse the frame again.
+				boost::optional<boost::asio::ip::address> destination;
+
+				if ((frame_size >= 40) && ((frame_bytes[0] >> 4) == 6))
 				{
-					if (m_tun_icmpv6_filter.get_last_helper())
+					const tun_frame_action action = m_tun_ipv6_dispatch[frame_bytes[6]];
+
+					if (action == tun_frame_action::parse)
+					{
+						// This line will eventually call the filters callbacks and the mss override.
+						m_tun_ipv6_filter.parse(data);
+
+						const auto ipv6_helper = m_tun_ipv6_filter.get_last_helper();
+
+						if (ipv6_helper)
+						{
+							destination = boost::asio::ip::address(ipv6_helper->destination());
+						}
+					}
+					else
 					{
-						// We don't want to catch ICMP echo requests or other stuff yet.
-						handled = m_tun_icmpv6_filter.get_last_helper()->type() == asiotap::osi::ICMPV6_NEIGHBOR_SOLICITATION;
-						m_tun_icmpv6_filter.clear_last_helper();
+						if (action == tun_frame_action::parse_icmpv6)
+						{
+							// The IPv6/ICMPv6 parse-and-check sequence is composed at compile time.
+							m_tun_icmpv6_filter.parse(data);
+
+							if (m_tun_icmpv6_filter.get_last_helper())
+							{
+								// We don't want to catch ICMP echo requests or other stuff yet.
+								handled = m_tun_icmpv6_filter.get_last_helper()->type() == asiotap::osi::ICMPV6_NEIGHBOR_SOLICITATION;
+								m_tun_icmpv6_filter.clear_last_helper();
+							}
+						}
+
+						if (!handled)
+						{
+							// The destination comes straight from the fixed
+							// header: the frame needs no further inspection.
+							boost::asio::ip::address_v6::bytes_type destination_bytes;
+
+							std::copy(frame_bytes + 24, frame_bytes + 40, destination_bytes.begin());
+
+							destination = boost::asio::ip::address(boost::asio::ip::address_v6(destination_bytes));
+						}
 					}
 				}
 
+				receive_buffer.trace_stamp(fscp::trace_stage::filter_parse);
+
 				if (!handled)
 				{
-					// This is a TUN interface. We receive either IPv4 or IPv6 frames.
+					// This is a TUN interface. We receive either IPv4 or IPv6
+					// frames; IPv4 frames are parsed by the router itself.
 					async_write_router(
 						make_port_index(m_tap_adapter),
 						data,
+						destination,
 						make_shared_buffer_handler(
 							receive_buffer,
 							&null_router_write_handler
@@ -2148,10 +3388,6 @@ namespace freelan
 				}
 			}
 		}
-		else if (ec != boost::asio::error::operation_aborted)
-		{
-			m_logger(fscp::log_level::error) << "Read failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
-		}
 	}
 
 	void core::do_handle_tap_adapter_write(const boost::system::error_code& ec)
@@ -2169,7 +3405,8 @@ namespace freelan
 	{
 		if (m_arp_proxy)
 		{
-			const auto response_buffer = SharedBuffer(2048);
+			// Get either a new buffer or an old, recycled one if possible.
+			const auto response_buffer = m_proxy_buffers.get();
 			const boost::optional<boost::asio::const_buffer> data = m_arp_proxy->process_frame(
 				*m_arp_filter.parent().get_last_helper(),
 				helper,
@@ -2197,7 +3434,8 @@ namespace freelan
 	{
 		if (m_dhcp_proxy)
 		{
-			const auto response_buffer = SharedBuffer(2048);
+			// Get either a new buffer or an old, recycled one if possible.
+			const auto response_buffer = m_proxy_buffers.get();
 			const boost::optional<boost::asio::const_buffer> data = m_dhcp_proxy->process_frame(
 				*m_dhcp_filter.parent().parent().parent().parent().get_last_helper(),
 				*m_dhcp_filter.parent().parent().parent().get_last_helper(),
@@ -2224,13 +3462,14 @@ namespace freelan
 		}
 	}
 
-	void core::do_handle_icmpv6_frame(const icmpv6_helper_type& helper)
+	void core::do_handle_icmpv6_frame(const ipv6_helper_type& ipv6_helper, const icmpv6_helper_type& helper)
 	{
 		if (m_icmpv6_proxy)
 		{
-			const auto response_buffer = SharedBuffer(2048);
+			// Get either a new buffer or an old, recycled one if possible.
+			const auto response_buffer = m_proxy_buffers.get();
 			const boost::optional<boost::asio::const_buffer> data = m_icmpv6_proxy->process_frame(
-				*m_tun_icmpv6_filter.parent().get_last_helper(),
+				ipv6_helper,
 				helper,
 				buffer(response_buffer)
 			);
@@ -2285,7 +3524,12 @@ namespace freelan
 	void core::do_register_switch_port(const ep_type& host, void_handler_type handler)
 	{
 		// All calls to do_register_switch_port() are done within the m_router_strand, so the following is safe.
-		m_switch.register_port(make_port_index(host), switch_::port_type(boost::bind(&fscp::server::async_send_data, m_fscp_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP));
+		m_switch.register_port(make_port_index(host), switch_::port_type(
+			boost::bind(&core::async_send_classified_data, this, host, true, _1, _2),
+			boost::bind(&core::async_send_classified_data_in_place, this, host, true, _1, _2, _3),
+			boost::bind(&core::async_write_switch_endpoints, this, _1, _2, _3),
+			ENDPOINTS_GROUP
+		));
 
 		if (handler)
 		{
@@ -2293,6 +3537,50 @@ namespace freelan
 		}
 	}
 
+	void core::async_write_switch_endpoints(const std::vector<port_index_type>& targets, boost::asio::const_buffer data, switch_::multi_write_handler_type handler)
+	{
+		// The switch batches all its endpoint ports into a single call: the
+		// frame is submitted to the FSCP server once, whatever the number of
+		// targets, instead of once per port.
+		std::set<ep_type> endpoints;
+
+		for (auto&& target : targets)
+		{
+			endpoints.insert(boost::get<endpoint_port_index_type>(target).endpoint());
+		}
+
+		const uint8_t tos = frame_tos(data, m_tap_adapter && (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ethernet));
+
+		m_fscp_server->async_send_data_to_list(endpoints, channel_for_tos(tos), data, [handler] (const std::map<ep_type, boost::system::error_code>& results) {
+			switch_::multi_write_result_type port_results;
+
+			for (auto&& result : results)
+			{
+				port_results[make_port_index(result.first)] = result.second;
+			}
+
+			handler(port_results);
+		}, tos);
+	}
+
+	void core::async_send_classified_data(const ep_type& target, bool ethernet, boost::asio::const_buffer data, fscp::server::simple_handler_type handler)
+	{
+		// The frame's DSCP picks its FSCP channel right at the port seam,
+		// so both tap-adapter reads and switched frames get classified. The
+		// same byte rides down to the socket and marks the outer datagram,
+		// so the underlay QoS sees the inner traffic class too.
+		const uint8_t tos = frame_tos(data, ethernet);
+
+		m_fscp_server->async_send_data(target, channel_for_tos(tos), data, handler, tos);
+	}
+
+	void core::async_send_classified_data_in_place(const ep_type& target, bool ethernet, fscp::SharedBuffer data_buffer, boost::asio::const_buffer data, fscp::server::simple_handler_type handler)
+	{
+		const uint8_t tos = frame_tos(data, ethernet);
+
+		m_fscp_server->async_send_data_in_place(target, channel_for_tos(tos), data_buffer, data, handler, tos);
+	}
+
 	void core::do_unregister_switch_port(const ep_type& host, void_handler_type handler)
 	{
 		// All calls to do_unregister_switch_port() are done within the m_router_strand, so the following is safe.
@@ -2307,7 +3595,7 @@ namespace freelan
 	void core::do_register_router_port(const ep_type& host, void_handler_type handler)
 	{
 		// All calls to do_register_router_port() are done within the m_router_strand, so the following is safe.
-		m_router.register_port(make_port_index(host), router::port_type(boost::bind(&fscp::server::async_send_data, m_fscp_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP));
+		m_router.register_port(make_port_index(host), router::port_type(boost::bind(&core::async_send_classified_data, this, host, false, _1, _2), ENDPOINTS_GROUP));
 
 		if (handler)
 		{
@@ -2342,7 +3630,10 @@ namespace freelan
 	{
 		// All calls to do_clear_client_router_info() are done within the m_router_strand, so the following is safe.
 
-		// This clears the routes, if any.
+		// This clears the routes and DNS servers, if any, releasing them as a single batch when the platform supports it.
+		const asiotap::route_manager::batch_scope_type batch_scope(m_route_manager);
+		const asiotap::dns_servers_manager::batch_scope_type dns_batch_scope(m_dns_servers_manager);
+
 		m_client_router_info_map.erase(host);
 
 		if (handler)
@@ -2351,16 +3642,24 @@ namespace freelan
 		}
 	}
 
-	void core::do_write_switch(const port_index_type& index, boost::asio::const_buffer data, switch_::multi_write_handler_type handler)
+	void core::do_write_switch(const port_index_type& index, boost::asio::const_buffer data, const boost::optional<switch_::ethernet_frame_context_type>& context, switch_::multi_write_handler_type handler)
 	{
 		// All calls to do_write_switch() are done within the m_router_strand, so the following is safe.
-		m_switch.async_write(index, data, handler);
+		m_switch.async_write(index, data, context, handler);
+	}
+
+	void core::do_write_switch_buffer(const port_index_type& index, fscp::SharedBuffer buffer, boost::asio::const_buffer data, const boost::optional<switch_::ethernet_frame_context_type>& context, switch_::multi_write_handler_type handler)
+	{
+		// All calls to do_write_switch_buffer() are done within the m_router_strand, so the following is safe.
+		buffer.trace_stamp(fscp::trace_stage::switch_decision);
+
+		m_switch.async_write(index, buffer, data, context, handler);
 	}
 
-	void core::do_write_router(const port_index_type& index, boost::asio::const_buffer data, router::port_type::write_handler_type handler)
+	void core::do_write_router(const port_index_type& index, boost::asio::const_buffer data, const boost::optional<boost::asio::ip::address>& destination, router::port_type::write_handler_type handler)
 	{
 		// All calls to do_write_router() are done within the m_router_strand, so the following is safe.
-		m_router.async_write(index, data, handler);
+		m_router.async_write(index, data, destination, handler);
 	}
 
 	void core::open_web_server()
@@ -2424,7 +3723,115 @@ namespace freelan
 				}
 			}
 
-			m_web_server = boost::make_shared<web_server>(m_logger, m_configuration.server, m_authentication_callback);
+			const web_server::statistics_handler_type statistics_handler = [this]() {
+				// Everything below is sampled from lock-free snapshots:
+				// serving the statistics never posts into the data-plane
+				// strands.
+				kfather::object_type result;
+				kfather::object_type peers;
+
+				const auto server = m_fscp_server;
+
+				if (server)
+				{
+					for (auto&& peer_counters : server->get_all_peer_counters())
+					{
+						kfather::object_type counters;
+
+						counters.items["packets_in"] = static_cast<kfather::number_type>(peer_counters.second.packets_in);
+						counters.items["bytes_in"] = static_cast<kfather::number_type>(peer_counters.second.bytes_in);
+						counters.items["packets_out"] = static_cast<kfather::number_type>(peer_counters.second.packets_out);
+						counters.items["bytes_out"] = static_cast<kfather::number_type>(peer_counters.second.bytes_out);
+						counters.items["crypto_failures"] = static_cast<kfather::number_type>(peer_counters.second.crypto_failures);
+						counters.items["replay_drops"] = static_cast<kfather::number_type>(peer_counters.second.replay_drops);
+					counters.items["decrypt_backlog_drops"] = static_cast<kfather::number_type>(peer_counters.second.decrypt_backlog_drops);
+						counters.items["send_queue_depth"] = static_cast<kfather::number_type>(peer_counters.second.send_queue_depth);
+
+						peers.items[boost::lexical_cast<std::string>(peer_counters.first)] = counters;
+					}
+
+					result.items["socket_buffer_pool_idle"] = static_cast<kfather::number_type>(server->socket_buffer_pool_idle_count());
+					result.items["session_buffer_pool_idle"] = static_cast<kfather::number_type>(server->session_buffer_pool_idle_count());
+
+					// Bucket N counts the handshakes whose stage took
+					// [2^N, 2^(N+1)) microseconds.
+					kfather::object_type handshake;
+
+					for (auto&& stage : server->get_handshake_histograms())
+					{
+						kfather::array_type buckets;
+						buckets.items.reserve(stage.second.size());
+
+						for (auto&& count : stage.second)
+						{
+							buckets.items.push_back(static_cast<kfather::number_type>(count));
+						}
+
+						handshake.items[stage.first] = buckets;
+					}
+
+					result.items["handshake_us"] = handshake;
+				}
+
+				result.items["peers"] = peers;
+				result.items["ethernet_address_map_size"] = static_cast<kfather::number_type>(m_switch.ethernet_address_map_size());
+				result.items["switch_unknown_unicast_floods"] = static_cast<kfather::number_type>(m_switch.unknown_unicast_flood_count());
+				result.items["switch_suppressed_floods"] = static_cast<kfather::number_type>(m_switch.suppressed_flood_count());
+				result.items["switch_gossip_learned"] = static_cast<kfather::number_type>(m_switch.gossip_learned_count());
+				result.items["tap_adapter_buffer_pool_idle"] = static_cast<kfather::number_type>(m_tap_adapter_buffers.idle_count());
+
+				if (m_tap_adapter && m_tap_adapter->is_open())
+				{
+					// The kernel-side counters of the tap interface:
+					// rx_dropped is the only place where frames lost to a
+					// lagging read loop show up.
+					try
+					{
+						const asiotap::tap_adapter_statistics tap_stats = m_tap_adapter->interface_statistics();
+
+						kfather::object_type tap;
+
+						tap.items["rx_packets"] = static_cast<kfather::number_type>(tap_stats.rx_packets);
+						tap.items["tx_packets"] = static_cast<kfather::number_type>(tap_stats.tx_packets);
+						tap.items["rx_bytes"] = static_cast<kfather::number_type>(tap_stats.rx_bytes);
+						tap.items["tx_bytes"] = static_cast<kfather::number_type>(tap_stats.tx_bytes);
+						tap.items["rx_errors"] = static_cast<kfather::number_type>(tap_stats.rx_errors);
+						tap.items["tx_errors"] = static_cast<kfather::number_type>(tap_stats.tx_errors);
+						tap.items["rx_dropped"] = static_cast<kfather::number_type>(tap_stats.rx_dropped);
+						tap.items["tx_dropped"] = static_cast<kfather::number_type>(tap_stats.tx_dropped);
+
+						result.items["tap_adapter"] = tap;
+					}
+					catch (const boost::system::system_error&)
+					{
+						// A failed counters read never fails the whole
+						// snapshot: the entry is simply absent.
+					}
+				}
+
+				// The per-subsystem memory accounting, with high-water
+				// marks: what a massif run would attribute, without the
+				// massif run.
+				kfather::object_type memory;
+
+				for (size_t index = 0; index < fscp::memory_usage::SUBSYSTEM_COUNT; ++index)
+				{
+					const fscp::memory_subsystem subsystem = static_cast<fscp::memory_subsystem>(index);
+
+					kfather::object_type usage;
+
+					usage.items["current"] = static_cast<kfather::number_type>(fscp::memory_usage::current(subsystem));
+					usage.items["peak"] = static_cast<kfather::number_type>(fscp::memory_usage::peak(subsystem));
+
+					memory.items[fscp::memory_usage::name(subsystem)] = usage;
+				}
+
+				result.items["memory_bytes"] = memory;
+
+				return result;
+			};
+
+			m_web_server = boost::make_shared<web_server>(m_logger, m_configuration.server, m_authentication_callback, statistics_handler);
 
 			m_logger(fscp::log_level::information) << "Starting " << m_configuration.server.protocol << " web server on " << m_configuration.server.listen_on << "...";
 
@@ -2532,8 +3939,8 @@ namespace freelan
 
 					if (m_fscp_server)
 					{
-						m_fscp_server->async_set_identity(*m_configuration.security.identity, [this]() {
-							m_logger(fscp::log_level::important) << "Renewed identity. Existing connections will be reset.";
+						m_fscp_server->async_rotate_identity(*m_configuration.security.identity, fscp::IDENTITY_ROTATION_GRACE_PERIOD, [this]() {
+							m_logger(fscp::log_level::important) << "Renewed identity. Established sessions keep the previous certificate until they end.";
 						});
 					}
 					else
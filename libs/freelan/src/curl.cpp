@@ -101,6 +101,41 @@ namespace freelan
 		return m_slist.get();
 	}
 
+	void curl_share::lock_function(CURL*, curl_lock_data data, curl_lock_access, void* userptr)
+	{
+		static_cast<curl_share*>(userptr)->m_mutexes[data].lock();
+	}
+
+	void curl_share::unlock_function(CURL*, curl_lock_data data, void* userptr)
+	{
+		static_cast<curl_share*>(userptr)->m_mutexes[data].unlock();
+	}
+
+	curl_share::curl_share() :
+		m_curlsh(curl_share_init(), [] (CURLSH* p) { if (p) curl_share_cleanup(p); })
+	{
+		if (!m_curlsh)
+		{
+			throw std::runtime_error("Unable to allocate a CURLSH structure");
+		}
+
+		if ((curl_share_setopt(m_curlsh.get(), CURLSHOPT_LOCKFUNC, &curl_share::lock_function) != CURLSHE_OK) ||
+			(curl_share_setopt(m_curlsh.get(), CURLSHOPT_UNLOCKFUNC, &curl_share::unlock_function) != CURLSHE_OK) ||
+			(curl_share_setopt(m_curlsh.get(), CURLSHOPT_USERDATA, this) != CURLSHE_OK) ||
+			(curl_share_setopt(m_curlsh.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK) ||
+			(curl_share_setopt(m_curlsh.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK))
+		{
+			throw std::runtime_error("Unable to configure the CURLSH structure");
+		}
+	}
+
+	bool curl::has_asynchronous_dns()
+	{
+		const curl_version_info_data* const info = curl_version_info(CURLVERSION_NOW);
+
+		return ((info->features & CURL_VERSION_ASYNCHDNS) != 0);
+	}
+
 	curl::curl() :
 		m_curl(curl_easy_init(), [] (CURL* p) { if (p) curl_easy_cleanup(p); }),
 		m_debug_function()
@@ -230,6 +265,18 @@ namespace freelan
 		set_option(CURLOPT_TIMEOUT_MS, static_cast<long>(timeout.total_milliseconds()));
 	}
 
+	void curl::set_dns_cache_timeout(const boost::posix_time::time_duration& timeout)
+	{
+		set_option(CURLOPT_DNS_CACHE_TIMEOUT, static_cast<long>(timeout.total_seconds()));
+	}
+
+	void curl::add_resolve_entry(const std::string& host, uint16_t port, const std::string& ip)
+	{
+		m_resolve_entries.append(host + ":" + boost::lexical_cast<std::string>(port) + ":" + ip);
+
+		set_option(CURLOPT_RESOLVE, static_cast<const void*>(m_resolve_entries.raw()));
+	}
+
 	void curl::set_http_header(const std::string& header, const std::string& value)
 	{
 		m_http_headers.append(header + ": " + value);
@@ -273,6 +320,13 @@ namespace freelan
 		set_option(CURLOPT_COPYPOSTFIELDS, boost::asio::buffer_cast<const void*>(buf));
 	}
 
+	void curl::set_share(boost::shared_ptr<curl_share> share)
+	{
+		m_share = share;
+
+		set_option(CURLOPT_SHARE, share ? share->raw() : nullptr);
+	}
+
 	void curl::set_cookie_file(const std::string& file)
 	{
 		set_option(CURLOPT_COOKIEFILE, file.c_str());
@@ -345,6 +399,19 @@ namespace freelan
 		return response_code;
 	}
 
+	curl::transfer_timings_type curl::get_transfer_timings()
+	{
+		transfer_timings_type result = {};
+
+		throw_if_curl_error(curl_easy_getinfo(m_curl.get(), CURLINFO_NAMELOOKUP_TIME, &result.namelookup));
+		throw_if_curl_error(curl_easy_getinfo(m_curl.get(), CURLINFO_CONNECT_TIME, &result.connect));
+		throw_if_curl_error(curl_easy_getinfo(m_curl.get(), CURLINFO_APPCONNECT_TIME, &result.appconnect));
+		throw_if_curl_error(curl_easy_getinfo(m_curl.get(), CURLINFO_STARTTRANSFER_TIME, &result.starttransfer));
+		throw_if_curl_error(curl_easy_getinfo(m_curl.get(), CURLINFO_TOTAL_TIME, &result.total));
+
+		return result;
+	}
+
 	ptrdiff_t curl::get_content_length_download()
 	{
 		double content_length = 0.0;
@@ -543,18 +610,65 @@ namespace freelan
 		assert(self);
 
 		m_strand.post([self, handle, handler] () {
-			self->add_handle(handle);
-			self->m_handler_map[handle] = handler;
-			self->m_result_map.erase(handle);
+			if ((self->m_max_concurrent_transfers > 0) && (self->m_handler_map.size() >= self->m_max_concurrent_transfers))
+			{
+				// The handle waits its turn: transfers start in submission order as running ones complete.
+				self->m_pending_handles.push_back(std::make_pair(handle, handler));
+			}
+			else
+			{
+				self->do_execute(handle, handler);
+			}
+		});
+	}
+
+	void curl_multi_asio::set_max_concurrent_transfers(size_t max_concurrent_transfers)
+	{
+		const auto self = shared_from_this();
+		assert(self);
+
+		m_strand.post([self, max_concurrent_transfers] () {
+			self->m_max_concurrent_transfers = max_concurrent_transfers;
+
+			// A raised limit may allow queued handles to start right away.
+			self->start_pending_handles();
 		});
 	}
 
+	void curl_multi_asio::do_execute(boost::shared_ptr<curl> handle, connection_complete_callback handler)
+	{
+		add_handle(handle);
+		m_handler_map[handle] = handler;
+		m_result_map.erase(handle);
+	}
+
+	void curl_multi_asio::start_pending_handles()
+	{
+		while (!m_pending_handles.empty() && ((m_max_concurrent_transfers == 0) || (m_handler_map.size() < m_max_concurrent_transfers)))
+		{
+			const auto pending = m_pending_handles.front();
+			m_pending_handles.pop_front();
+
+			do_execute(pending.first, pending.second);
+		}
+	}
+
 	void curl_multi_asio::async_clear(boost::function<void ()> handler)
 	{
 		const auto self = shared_from_this();
 		assert(self);
 
 		m_strand.post([self, handler] () {
+			// Queued handles that never started complete as aborted.
+			for (auto&& pending : self->m_pending_handles)
+			{
+				if (pending.second)
+				{
+					self->m_io_service.post(boost::bind(pending.second, boost::system::error_code(boost::asio::error::operation_aborted)));
+				}
+			}
+
+			self->m_pending_handles.clear();
 			self->clear();
 
 			if (handler)
@@ -610,6 +724,9 @@ namespace freelan
 		handle->set_option(CURLOPT_CLOSESOCKETFUNCTION, static_cast<void*>(nullptr));
 		handle->set_option(CURLOPT_OPENSOCKETDATA, static_cast<void*>(nullptr));
 		handle->set_option(CURLOPT_OPENSOCKETFUNCTION, static_cast<void*>(nullptr));
+
+		// A completed transfer frees a slot for the next queued handle.
+		start_pending_handles();
 	}
 
 	void curl_multi_asio::curl_socket::trigger(curl_multi_asio& _curl_multi_asio)
@@ -768,7 +885,8 @@ namespace freelan
 	curl_multi_asio::curl_multi_asio(boost::asio::io_service& io_service) :
 		m_io_service(io_service),
 		m_strand(m_io_service),
-		m_timer(m_io_service)
+		m_timer(m_io_service),
+		m_max_concurrent_transfers(0)
 	{
 		set_option(CURLMOPT_TIMERFUNCTION, &curl_multi_asio::static_timer_callback);
 		set_option(CURLMOPT_TIMERDATA, this);
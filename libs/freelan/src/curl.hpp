@@ -46,6 +46,8 @@
 #ifndef FREELAN_CURL_HPP
 #define FREELAN_CURL_HPP
 
+#include <deque>
+
 #include <curl/curl.h>
 
 #include <boost/asio.hpp>
@@ -53,6 +55,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <asiotap/types/endpoint.hpp>
 
@@ -118,6 +121,47 @@ namespace freelan
 	typedef curl_socket_t (*curl_open_socket_callback)(void*, curlsocktype, struct curl_sockaddr*);
 	typedef int (*curl_close_socket_callback)(void*, curl_socket_t);
 
+	/**
+	 * \brief A CURLSH wrapper class.
+	 *
+	 * A share holds caches that several curl instances use together: the
+	 * instances of this class share TLS sessions and resolved host names, so
+	 * consecutive requests to the same server resume the previous TLS session
+	 * instead of paying for a full handshake.
+	 *
+	 * The underlying caches are protected by mutexes, so a curl_share can
+	 * back handles running on different threads.
+	 */
+	class curl_share
+	{
+		public:
+
+			/**
+			 * \brief Create a CURLSH.
+			 */
+			curl_share();
+
+			/**
+			 * \brief Get the raw pointer.
+			 * \return The raw pointer.
+			 */
+			CURLSH* raw() const
+			{
+				return m_curlsh.get();
+			}
+
+		private:
+
+			static void lock_function(CURL*, curl_lock_data data, curl_lock_access, void* userptr);
+			static void unlock_function(CURL*, curl_lock_data data, void* userptr);
+
+			curl_share(const curl_share&) = delete;
+			curl_share& operator=(const curl_share&) = delete;
+
+			std::unique_ptr<CURLSH, void (*)(CURLSH*)> m_curlsh;
+			boost::mutex m_mutexes[CURL_LOCK_DATA_LAST];
+	};
+
 	/**
 	 * \brief A CURL wrapper class.
 	 */
@@ -145,6 +189,12 @@ namespace freelan
 				return boost::asio::buffer_size(data);
 			}
 
+			/**
+			 * \brief Check whether libcurl resolves host names asynchronously.
+			 * \return true if libcurl was built with an asynchronous resolver (c-ares or the threaded resolver), false if lookups block the transfer.
+			 */
+			static bool has_asynchronous_dns();
+
 			/**
 			 * \brief Create a CURL.
 			 */
@@ -282,6 +332,26 @@ namespace freelan
 			*/
 			void set_timeout(const boost::posix_time::time_duration& timeout);
 
+			/**
+			 * \brief Set how long resolved host names stay in the DNS cache.
+			 * \param timeout The timeout.
+			 *
+			 * When a share set with set_share() provides the DNS cache, the
+			 * timeout effectively applies to every handle using that share.
+			 */
+			void set_dns_cache_timeout(const boost::posix_time::time_duration& timeout);
+
+			/**
+			 * \brief Provide a resolved address for a host, bypassing DNS.
+			 * \param host The host name.
+			 * \param port The port.
+			 * \param ip The address to use, in its textual form.
+			 *
+			 * The transfer uses the provided address as if the resolver had
+			 * returned it, and never blocks on a DNS lookup for that host.
+			 */
+			void add_resolve_entry(const std::string& host, uint16_t port, const std::string& ip);
+
 			/**
 			 * \brief Set a HTTP header.
 			 * \param header The header.
@@ -328,6 +398,14 @@ namespace freelan
 			 */
 			void set_copy_post_fields(boost::asio::const_buffer buf);
 
+			/**
+			 * \brief Set the share instance whose caches this curl uses.
+			 * \param share The share instance. It is kept alive for as long
+			 * as this instance references it. A null pointer detaches the
+			 * current share, if any.
+			 */
+			void set_share(boost::shared_ptr<curl_share> share);
+
 			/**
 			 * \brief Set the cookie file.
 			 * \param file The file.
@@ -384,6 +462,24 @@ namespace freelan
 			 */
 			long get_response_code();
 
+			/**
+			 * \brief The transfer phase timings, in seconds, as reported by libcurl.
+			 */
+			struct transfer_timings_type
+			{
+				double namelookup; /**< The time until name resolution completed. */
+				double connect; /**< The time until the TCP connection was established. */
+				double appconnect; /**< The time until the TLS handshake completed. Zero for plain connections. */
+				double starttransfer; /**< The time until the first response byte was received. */
+				double total; /**< The total transfer time. */
+			};
+
+			/**
+			 * \brief Get the timings of the last transfer.
+			 * \return The timings.
+			 */
+			transfer_timings_type get_transfer_timings();
+
 			/**
 			 * \brief Get the content length for downloads.
 			 * \return The content length or -1, if no content length is specified.
@@ -415,8 +511,10 @@ namespace freelan
 
 			std::unique_ptr<CURL, void (*)(CURL*)> m_curl;
 			curl_list m_http_headers;
+			curl_list m_resolve_entries;
 			debug_function_t m_debug_function;
 			write_function_t m_write_function;
+			boost::shared_ptr<curl_share> m_share;
 
 			friend class curl_multi;
 	};
@@ -624,8 +722,18 @@ namespace freelan
 			 */
 			void execute(boost::shared_ptr<curl> handle, connection_complete_callback handler = connection_complete_callback());
 
+			/**
+			 * \brief Set the maximum count of concurrently running transfers, asynchronously.
+			 * \param max_concurrent_transfers The limit. Zero, the default, means no limit.
+			 *
+			 * Handles submitted past the limit are queued and started in submission order as running transfers complete, so no queued request starves behind later ones.
+			 */
+			void set_max_concurrent_transfers(size_t max_concurrent_transfers);
+
 			/**
 			 * \brief Clear all the handles from this CURLM, asynchronously.
+			 *
+			 * Queued handles that were never started are completed with boost::asio::error::operation_aborted.
 			 */
 			void async_clear(boost::function<void ()> handler = boost::function<void ()>());
 
@@ -686,6 +794,8 @@ namespace freelan
 			void timer_callback(const boost::system::error_code& ec);
 			void socket_callback(const boost::system::error_code& ec, boost::shared_ptr<curl_socket> socket);
 			void check_info();
+			void do_execute(boost::shared_ptr<curl> handle, connection_complete_callback handler);
+			void start_pending_handles();
 
 			boost::asio::io_service& m_io_service;
 			boost::asio::strand m_strand;
@@ -693,6 +803,8 @@ namespace freelan
 			std::map<boost::shared_ptr<curl>, connection_complete_callback> m_handler_map;
 			std::map<boost::shared_ptr<curl>, CURLcode> m_result_map;
 			std::map<curl_socket_t, boost::shared_ptr<curl_socket>> m_socket_map;
+			size_t m_max_concurrent_transfers;
+			std::deque<std::pair<boost::shared_ptr<curl>, connection_complete_callback>> m_pending_handles;
 	};
 }
 
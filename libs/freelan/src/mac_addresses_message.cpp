@@ -0,0 +1,115 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file mac_addresses_message.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief The ethernet address gossip messages exchanged by the peers.
+ */
+
+#include "mac_addresses_message.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#include <stdexcept>
+
+namespace freelan
+{
+	size_t mac_addresses_message::estimate_size(size_t address_count)
+	{
+		return HEADER_LENGTH + address_count * asiotap::osi::ETHERNET_ADDRESS_SIZE;
+	}
+
+	size_t mac_addresses_message::write(void* buf, size_t buf_len, const std::vector<ethernet_address_type>& addresses)
+	{
+		const size_t payload_len = addresses.size() * asiotap::osi::ETHERNET_ADDRESS_SIZE;
+
+		if (buf_len < HEADER_LENGTH + payload_len)
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		uint8_t* payload = static_cast<uint8_t*>(buf) + HEADER_LENGTH;
+
+		for (std::vector<ethernet_address_type>::const_iterator address = addresses.begin(); address != addresses.end(); ++address)
+		{
+			const ethernet_address_type::data_type raw = address->data();
+
+			std::memcpy(payload, raw.data(), raw.size());
+			payload += raw.size();
+		}
+
+		return message::write(buf, buf_len, MT_MAC_ADDRESSES, payload_len);
+	}
+
+	size_t mac_addresses_message::addresses_count() const
+	{
+		return length() / asiotap::osi::ETHERNET_ADDRESS_SIZE;
+	}
+
+	mac_addresses_message::ethernet_address_type mac_addresses_message::address_at(size_t index) const
+	{
+		assert(index < addresses_count());
+
+		ethernet_address_type::data_type raw;
+
+		std::memcpy(raw.data(), payload() + index * asiotap::osi::ETHERNET_ADDRESS_SIZE, raw.size());
+
+		return ethernet_address_type(raw);
+	}
+
+	mac_addresses_message::mac_addresses_message(const void* buf, size_t buf_len) :
+		message(buf, buf_len)
+	{
+		if ((length() % asiotap::osi::ETHERNET_ADDRESS_SIZE) != 0)
+		{
+			throw std::runtime_error("bad message length");
+		}
+	}
+
+	mac_addresses_message::mac_addresses_message(const message& _message) :
+		message(_message)
+	{
+		if ((length() % asiotap::osi::ETHERNET_ADDRESS_SIZE) != 0)
+		{
+			throw std::runtime_error("bad message length");
+		}
+	}
+}
@@ -67,18 +67,125 @@ namespace freelan
 
 			return solicited_node_multicast_address.has_address(addr);
 		}
+
+		size_t hash_bytes(size_t hash, const unsigned char* buf, size_t buf_len) {
+			// FNV-1a: cheap and spreads flows evenly across equal routes.
+			for (size_t i = 0; i < buf_len; ++i) {
+				hash ^= buf[i];
+				hash *= 16777619UL;
+			}
+
+			return hash;
+		}
+
+		template <typename AddressType>
+		size_t flow_hash(const AddressType& address) {
+			const typename AddressType::bytes_type bytes = address.to_bytes();
+
+			return hash_bytes(2166136261UL, &bytes[0], bytes.size());
+		}
+
+		template <typename AddressType>
+		size_t flow_hash(const AddressType& source, const AddressType& destination) {
+			const typename AddressType::bytes_type bytes = source.to_bytes();
+
+			return hash_bytes(flow_hash(destination), &bytes[0], bytes.size());
+		}
 	}
 
-	void router::async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler)
+	router::port_handle_type router::register_port(port_index_type index, port_type port)
 	{
-		const auto port_entries = get_targets_for(index, data);
+		const port_handle_map_type::iterator handle_entry = m_port_handles.find(index);
+
+		port_handle_type handle;
+
+		if (handle_entry != m_port_handles.end())
+		{
+			handle = handle_entry->second;
+		}
+		else if (!m_free_handles.empty())
+		{
+			handle = m_free_handles.back();
+			m_free_handles.pop_back();
+		}
+		else
+		{
+			handle = static_cast<port_handle_type>(m_port_slots.size());
+			m_port_slots.push_back(port_entry_type());
+		}
+
+		m_port_slots[handle].index = index;
+		m_port_slots[handle].port = port;
+		m_port_slots[handle].used = true;
+
+		m_port_handles[index] = handle;
+
+		// Growing the slots vector may have reallocated it, which copies the
+		// ports and drops their back-pointer to the router: (re-)associating
+		// them all keeps the route cache invalidation working. This also
+		// takes care of invalidating the cache for the new port.
+		for (auto&& entry : m_port_slots)
+		{
+			if (entry.used)
+			{
+				entry.port.associate_to_router(this);
+			}
+		}
+
+		return handle;
+	}
+
+	void router::unregister_port(port_index_type index)
+	{
+		const port_handle_map_type::iterator handle_entry = m_port_handles.find(index);
+
+		if (handle_entry == m_port_handles.end())
+		{
+			return;
+		}
+
+		const port_handle_type handle = handle_entry->second;
+
+		// Resetting the port dissociates it from the router, which
+		// invalidates the route cache: the trie cannot keep a stale handle.
+		m_port_slots[handle] = port_entry_type();
+		m_free_handles.push_back(handle);
+		m_port_handles.erase(handle_entry);
+	}
+
+	void router::async_write(port_index_type index, boost::asio::const_buffer data, const boost::optional<boost::asio::ip::address>& destination, port_type::write_handler_type handler)
+	{
+		// The variant identity is only resolved here, at the frame's entry:
+		// everything past this point works with dense handles.
+		const port_handle_map_type::const_iterator handle_entry = m_port_handles.find(index);
+
+		std::vector<const port_type*> port_entries;
+
+		if (handle_entry != m_port_handles.end())
+		{
+			if (!destination)
+			{
+				port_entries = get_targets_for(handle_entry->second, data);
+			}
+			else if (destination->is_v4())
+			{
+				// The destination was already discovered by the OSI filters: the frame is not parsed a second time.
+				port_entries = get_targets_for(handle_entry->second, destination->to_v4(), flow_hash(destination->to_v4()));
+			}
+			else
+			{
+				port_entries = get_targets_for(handle_entry->second, destination->to_v6(), flow_hash(destination->to_v6()));
+			}
+		}
+
+		fscp::frame_recorder::record(fscp::trace_point::router_write, port_entries.empty() ? fscp::frame_verdict::no_route : fscp::frame_verdict::forwarded, to_trace_peer_id(index), boost::asio::buffer_size(data));
 
 		for (auto&& port_entry : port_entries) {
 			port_entry->async_write(data, handler);
 		}
 	}
 
-	std::vector<const router::port_type*> router::get_targets_for(port_index_type index, boost::asio::const_buffer data)
+	std::vector<const router::port_type*> router::get_targets_for(port_handle_type source_handle, boost::asio::const_buffer data)
 	{
 		// Try IPv4 first because it is more likely.
 
@@ -86,11 +193,12 @@ namespace freelan
 
 		if (m_ipv4_filter.get_last_const_helper())
 		{
+			const boost::asio::ip::address_v4 source = m_ipv4_filter.get_last_const_helper()->source();
 			const boost::asio::ip::address_v4 destination = m_ipv4_filter.get_last_const_helper()->destination();
 
 			m_ipv4_filter.clear_last_helper();
 
-			return get_targets_for(index, destination);
+			return get_targets_for(source_handle, destination, flow_hash(source, destination));
 		}
 		else
 		{
@@ -98,11 +206,12 @@ namespace freelan
 
 			if (m_ipv6_filter.get_last_const_helper())
 			{
+				const boost::asio::ip::address_v6 source = m_ipv6_filter.get_last_const_helper()->source();
 				const boost::asio::ip::address_v6 destination = m_ipv6_filter.get_last_const_helper()->destination();
 
 				m_ipv6_filter.clear_last_helper();
 
-				return get_targets_for(index, destination);
+				return get_targets_for(source_handle, destination, flow_hash(source, destination));
 			}
 		}
 
@@ -111,68 +220,180 @@ namespace freelan
 	}
 
 	template <typename AddressType>
-	std::vector<const router::port_type*> router::get_targets_for(port_index_type index, const AddressType& dest_addr)
+	std::vector<const router::port_type*> router::get_targets_for(port_handle_type source_handle, const AddressType& dest_addr, size_t flow_hash_value)
 	{
-		const router::port_list_type::const_iterator source_port_entry = m_ports.find(index);
+		const port_group_type source_group = m_port_slots[source_handle].port.group();
 
-		if (source_port_entry != m_ports.end())
-		{
-			std::vector<const router::port_type*> result;
+		std::vector<const router::port_type*> result;
+
+		if (is_multicast(dest_addr)) {
+			result.reserve(m_port_slots.size());
 
-			if (is_multicast(dest_addr)) {
-				result.reserve(m_ports.size());
+			for (size_t slot = 0; slot != m_port_slots.size(); ++slot) {
+				const port_entry_type& entry = m_port_slots[slot];
 
-				for (auto port_entry = m_ports.begin(); port_entry != m_ports.end(); ++port_entry) {
-					// Make sure we don't route multicast back packets to the source.
-					if (source_port_entry != port_entry) {
-						if (m_configuration.client_routing_enabled || (source_port_entry->second.group() != port_entry->second.group())) {
-							result.push_back(&port_entry->second);
-						}
+				// Make sure we don't route multicast back packets to the source.
+				if (entry.used && (slot != source_handle)) {
+					if (m_configuration.client_routing_enabled || (source_group != entry.port.group())) {
+						result.push_back(&entry.port);
 					}
 				}
-			} else {
-				const auto& routes_ports = routes();
+			}
+		} else {
+			m_route_ports_scratch.clear();
+			m_route_groups_scratch.clear();
+
+			find_route_ports(dest_addr, m_route_ports_scratch, m_route_groups_scratch);
+
+			// The groups are listed most specific route first. Within the
+			// winning group, several ports advertising the very same
+			// prefix are equal-cost paths: the flow hash spreads flows
+			// across them while keeping each flow on a single port, so no
+			// flow gets reordered.
+			size_t offset = 0;
+
+			for (auto&& group_size : m_route_groups_scratch) {
+				m_ecmp_ports_scratch.clear();
 
-				for (auto&& route_port : routes_ports) {
-					if (has_address(route_port.first, dest_addr)) {
-						const port_list_type::const_iterator port_entry = m_ports.find(route_port.second);
+				for (size_t i = offset; i != offset + group_size; ++i) {
+					// The trie is rebuilt whenever a port goes away, so its
+					// handles always point to live slots.
+					const port_entry_type& entry = m_port_slots[m_route_ports_scratch[i]];
 
-						if (m_configuration.client_routing_enabled || (source_port_entry->second.group() != port_entry->second.group())) {
-							result.push_back(&port_entry->second);
-							break;
-						}
+					if (m_configuration.client_routing_enabled || (source_group != entry.port.group())) {
+						m_ecmp_ports_scratch.push_back(&entry.port);
 					}
 				}
+
+				if (!m_ecmp_ports_scratch.empty()) {
+					result.push_back(m_ecmp_ports_scratch[flow_hash_value % m_ecmp_ports_scratch.size()]);
+					break;
+				}
+
+				offset += group_size;
+			}
+		}
+
+		return result;
+	}
+
+	template <typename AddressType>
+	void router::routes_trie_type<AddressType>::clear()
+	{
+		m_nodes.assign(1, node_type());
+	}
+
+	template <typename AddressType>
+	void router::routes_trie_type<AddressType>::insert(const asiotap::base_ip_network_address<AddressType>& network_address, port_handle_type port)
+	{
+		const typename AddressType::bytes_type bytes = network_address.address().to_bytes();
+
+		int node = 0;
+
+		for (unsigned int bit = 0; bit < network_address.prefix_length(); ++bit)
+		{
+			const int branch = (bytes[bit / 8] >> (7 - (bit % 8))) & 0x01;
+
+			if (m_nodes[node].children[branch] < 0)
+			{
+				m_nodes[node].children[branch] = static_cast<int>(m_nodes.size());
+				m_nodes.push_back(node_type());
 			}
 
-			return result;
+			node = m_nodes[node].children[branch];
 		}
 
-		// No route for the current frame so we return an empty list.
-		return {};
+		m_nodes[node].ports.push_back(port);
 	}
 
-	const router::routes_port_type& router::routes() const
+	template <typename AddressType>
+	void router::routes_trie_type<AddressType>::find(const AddressType& addr, std::vector<port_handle_type>& results, std::vector<size_t>& group_sizes) const
+	{
+		const typename AddressType::bytes_type bytes = addr.to_bytes();
+
+		int matches[sizeof(typename AddressType::bytes_type) * 8 + 1];
+		size_t match_count = 0;
+
+		int node = 0;
+
+		for (size_t bit = 0; bit < sizeof(typename AddressType::bytes_type) * 8; ++bit)
+		{
+			if (!m_nodes[node].ports.empty())
+			{
+				matches[match_count++] = node;
+			}
+
+			const int branch = (bytes[bit / 8] >> (7 - (bit % 8))) & 0x01;
+
+			node = m_nodes[node].children[branch];
+
+			if (node < 0)
+			{
+				break;
+			}
+		}
+
+		if (node >= 0 && !m_nodes[node].ports.empty())
+		{
+			matches[match_count++] = node;
+		}
+
+		// Deeper nodes match longer prefixes: we list their ports first. The
+		// ports of a single node share the exact same prefix and form one
+		// equal-cost group.
+		while (match_count > 0)
+		{
+			const std::vector<port_handle_type>& ports = m_nodes[matches[--match_count]].ports;
+
+			results.insert(results.end(), ports.begin(), ports.end());
+			group_sizes.push_back(ports.size());
+		}
+	}
+
+	const router::routes_type& router::routes() const
 	{
 		if (!m_routes)
 		{
 			// The routes were invalidated, we recompile them.
 
-			m_routes = routes_port_type();
+			m_routes = routes_type();
 
-			// We add all the port routes to the routes list.
-			// These are sorted automatically by the container.
-			for (port_list_type::const_iterator port = m_ports.begin(); port != m_ports.end(); ++port)
+			// We add all the port routes to the tries.
+			for (size_t slot = 0; slot != m_port_slots.size(); ++slot)
 			{
-				const auto& local_routes = port->second.local_routes();
+				const port_entry_type& entry = m_port_slots[slot];
 
-				for (auto&& route : local_routes)
+				if (!entry.used)
 				{
-					m_routes->insert(std::make_pair(route, port->first));
+					continue;
+				}
+
+				const port_handle_type handle = static_cast<port_handle_type>(slot);
+
+				for (auto&& route : entry.port.local_routes())
+				{
+					if (const asiotap::ipv4_route* ipv4_route = boost::get<asiotap::ipv4_route>(&route))
+					{
+						m_routes->ipv4.insert(ipv4_route->network_address(), handle);
+					}
+					else if (const asiotap::ipv6_route* ipv6_route = boost::get<asiotap::ipv6_route>(&route))
+					{
+						m_routes->ipv6.insert(ipv6_route->network_address(), handle);
+					}
 				}
 			}
 		}
 
 		return *m_routes;
 	}
+
+	void router::find_route_ports(const boost::asio::ip::address_v4& addr, std::vector<port_handle_type>& results, std::vector<size_t>& group_sizes)
+	{
+		routes().ipv4.find(addr, results, group_sizes);
+	}
+
+	void router::find_route_ports(const boost::asio::ip::address_v6& addr, std::vector<port_handle_type>& results, std::vector<size_t>& group_sizes)
+	{
+		routes().ipv6.find(addr, results, group_sizes);
+	}
 }
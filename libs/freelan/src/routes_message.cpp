@@ -46,6 +46,7 @@
 #include "routes_message.hpp"
 
 #include <cassert>
+#include <vector>
 
 namespace freelan
 {
@@ -59,9 +60,29 @@ namespace freelan
 			INAT_IPV6 = 0x03,
 			INAT_IPV6_GATEWAY = 0x04,
 			INAT_DNS_SERVER_IPV4 = 0x05,
-			INAT_DNS_SERVER_IPV6 = 0x06
+			INAT_DNS_SERVER_IPV6 = 0x06,
+			INAT_REMOVED_IPV4 = 0x07,
+			INAT_REMOVED_IPV4_GATEWAY = 0x08,
+			INAT_REMOVED_IPV6 = 0x09,
+			INAT_REMOVED_IPV6_GATEWAY = 0x0a,
+			INAT_REMOVED_DNS_SERVER_IPV4 = 0x0b,
+			INAT_REMOVED_DNS_SERVER_IPV6 = 0x0c,
+			INAT_IPV4_GROUP = 0x0d,
+			INAT_IPV6_GROUP = 0x0e,
+			INAT_REMOVED_IPV4_GROUP = 0x0f,
+			INAT_REMOVED_IPV6_GROUP = 0x10
 		};
 
+		/**
+		 * \brief The offset between an entry type and its removed counterpart, as used in delta messages.
+		 */
+		const uint8_t INAT_REMOVED_OFFSET = INAT_REMOVED_IPV4 - INAT_IPV4;
+
+		/**
+		 * \brief The offset between a group entry type and its removed counterpart, as used in delta messages.
+		 */
+		const uint8_t INAT_GROUP_REMOVED_OFFSET = INAT_REMOVED_IPV4_GROUP - INAT_IPV4_GROUP;
+
 		template <typename AddressType>
 		ip_network_address_type get_address_type();
 
@@ -92,6 +113,131 @@ namespace freelan
 			return has_gateway ? INAT_IPV6_GATEWAY : INAT_IPV6;
 		}
 
+		template <typename AddressType>
+		ip_network_address_type get_group_type();
+
+		template <>
+		ip_network_address_type get_group_type<boost::asio::ip::address_v4>()
+		{
+			return INAT_IPV4_GROUP;
+		}
+
+		template <>
+		ip_network_address_type get_group_type<boost::asio::ip::address_v6>()
+		{
+			return INAT_IPV6_GROUP;
+		}
+
+		/**
+		 * \brief Check whether every bit beyond the prefix of a network address is zero.
+		 * \param ina The network address.
+		 * \return true if the address can be truncated to its significant bytes without loss.
+		 */
+		template <typename AddressType>
+		bool has_zero_host_bits(const asiotap::base_ip_network_address<AddressType>& ina)
+		{
+			const auto bytes = ina.address().to_bytes();
+
+			for (size_t bit_index = ina.prefix_length(); bit_index < bytes.size() * 8; ++bit_index)
+			{
+				if ((bytes[bit_index / 8] >> (7 - (bit_index % 8))) & 0x01)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Write an unsigned value as a base-128 varint.
+		 * \param buf The buffer to write to.
+		 * \param buf_len The length of buf.
+		 * \param value The value to write.
+		 * \return The count of bytes written.
+		 */
+		size_t write_varint(uint8_t* buf, size_t buf_len, size_t value)
+		{
+			size_t result_size = 0;
+
+			do
+			{
+				if (result_size >= buf_len)
+				{
+					throw std::runtime_error("buf_len");
+				}
+
+				const uint8_t byte = static_cast<uint8_t>(value & 0x7f);
+				value >>= 7;
+
+				buf[result_size++] = value ? static_cast<uint8_t>(byte | 0x80) : byte;
+			}
+			while (value);
+
+			return result_size;
+		}
+
+		/**
+		 * \brief Write a group of gateway-less routes with prefix compression.
+		 * \param buf The buffer to write to.
+		 * \param buf_len The length of buf.
+		 * \param group The routes of the group. They must not carry a gateway and must have zero host bits.
+		 * \param type_offset The offset to add to the group type upon writing. Either 0 or INAT_GROUP_REMOVED_OFFSET.
+		 * \return The count of bytes written.
+		 *
+		 * Each route is written as its prefix length, the count of leading
+		 * bytes it shares with the previous route of the group and the
+		 * remaining significant bytes only. Route sets iterate in address
+		 * order, so consecutive routes share most of their leading bytes.
+		 */
+		template <typename AddressType>
+		size_t write_route_group(uint8_t* buf, size_t buf_len, const std::vector<const asiotap::base_ip_route<AddressType>*>& group, uint8_t type_offset)
+		{
+			size_t result_size = 1;
+
+			if (buf_len < result_size)
+			{
+				throw std::runtime_error("buf_len");
+			}
+
+			buf[0] = static_cast<uint8_t>(get_group_type<AddressType>() + type_offset);
+
+			result_size += write_varint(buf + result_size, buf_len - result_size, group.size());
+
+			typename AddressType::bytes_type previous_bytes = typename AddressType::bytes_type();
+
+			for (auto&& route : group)
+			{
+				const auto ina = route->network_address();
+				const uint8_t prefix_length = static_cast<uint8_t>(ina.prefix_length());
+				const auto bytes = ina.address().to_bytes();
+				const size_t significant = (static_cast<size_t>(prefix_length) + 7) / 8;
+
+				size_t shared = 0;
+
+				while ((shared < significant) && (bytes[shared] == previous_bytes[shared]))
+				{
+					++shared;
+				}
+
+				if (buf_len - result_size < 2 + (significant - shared))
+				{
+					throw std::runtime_error("buf_len");
+				}
+
+				buf[result_size] = prefix_length;
+				buf[result_size + 1] = static_cast<uint8_t>(shared);
+				result_size += 2;
+
+				std::copy(bytes.begin() + shared, bytes.begin() + significant, buf + result_size);
+				result_size += significant - shared;
+
+				previous_bytes = bytes;
+			}
+
+			return result_size;
+		}
+
 		/**
 		 * \brief A visitor that writes the representation of a network address to a buffer.
 		 */
@@ -104,10 +250,16 @@ namespace freelan
 				 * \brief Create a new ip_network_address_representation.
 				 * \param buf The buffer to write the representation to.
 				 * \param buf_len The length of buf.
+				 * \param type_offset The offset to add to the entry types upon writing. Either 0 or INAT_REMOVED_OFFSET.
 				 */
-				routes_helper(BufferType buf, size_t buf_len) :
+				routes_helper(BufferType buf, size_t buf_len, uint8_t type_offset = 0) :
 					m_buf(buf),
-					m_buf_len(buf_len)
+					m_buf_len(buf_len),
+					m_type_offset(type_offset),
+					m_group_remaining(0),
+					m_group_is_v6(false),
+					m_group_removed(false),
+					m_group_previous_bytes()
 				{}
 
 				/**
@@ -130,7 +282,7 @@ namespace freelan
 						throw std::runtime_error("buf_len");
 					}
 
-					fscp::buffer_tools::set<uint8_t>(m_buf, 0, static_cast<uint8_t>(get_address_type<AddressType>(static_cast<bool>(_gateway))));
+					fscp::buffer_tools::set<uint8_t>(m_buf, 0, static_cast<uint8_t>(get_address_type<AddressType>(static_cast<bool>(_gateway)) + m_type_offset));
 					fscp::buffer_tools::set<uint8_t>(m_buf, 1, static_cast<uint8_t>(prefix_length));
 
 					std::copy(bytes.begin(), bytes.end(), m_buf + 2);
@@ -182,7 +334,7 @@ namespace freelan
 						throw std::runtime_error("buf_len");
 					}
 
-					fscp::buffer_tools::set<uint8_t>(m_buf, 0, static_cast<uint8_t>(get_address_type<AddressType>()));
+					fscp::buffer_tools::set<uint8_t>(m_buf, 0, static_cast<uint8_t>(get_address_type<AddressType>() + m_type_offset));
 
 					std::copy(bytes.begin(), bytes.end(), m_buf + 1);
 
@@ -241,6 +393,98 @@ namespace freelan
 					}
 				}
 
+				/**
+				 * \brief Read the next base-128 varint contained in the buffer.
+				 * \return The value.
+				 */
+				size_t read_varint()
+				{
+					size_t value = 0;
+					unsigned int shift = 0;
+
+					while (true)
+					{
+						if (m_buf_len == 0)
+						{
+							throw std::runtime_error("Not enough bytes for the expected varint");
+						}
+
+						const uint8_t byte = static_cast<uint8_t>(*m_buf);
+
+						++m_buf;
+						--m_buf_len;
+
+						value |= static_cast<size_t>(byte & 0x7f) << shift;
+
+						if (!(byte & 0x80))
+						{
+							break;
+						}
+
+						shift += 7;
+
+						if (shift >= 32)
+						{
+							throw std::runtime_error("Varint too long in message");
+						}
+					}
+
+					return value;
+				}
+
+				/**
+				 * \brief Read the next route of the current prefix-compressed group.
+				 * \return The IP route.
+				 */
+				template <typename AddressType>
+				asiotap::base_ip_route<AddressType> read_next_group_route()
+				{
+					if (m_buf_len < 2)
+					{
+						throw std::runtime_error("Not enough bytes for the expected group route");
+					}
+
+					const unsigned int prefix_length = static_cast<uint8_t>(*m_buf);
+					const size_t shared = static_cast<uint8_t>(*(m_buf + 1));
+
+					m_buf += 2;
+					m_buf_len -= 2;
+
+					typename AddressType::bytes_type bytes;
+
+					if (prefix_length > bytes.size() * 8)
+					{
+						throw std::runtime_error("Invalid prefix length in route group");
+					}
+
+					const size_t significant = (prefix_length + 7) / 8;
+
+					if (shared > significant)
+					{
+						throw std::runtime_error("Invalid shared prefix length in route group");
+					}
+
+					const size_t remaining = significant - shared;
+
+					if (m_buf_len < remaining)
+					{
+						throw std::runtime_error("Not enough bytes for the expected IP address");
+					}
+
+					// The bits beyond the prefix were truncated away: they are
+					// zero by construction.
+					std::fill(bytes.begin(), bytes.end(), 0);
+					std::copy(m_group_previous_bytes.begin(), m_group_previous_bytes.begin() + shared, bytes.begin());
+					std::copy(m_buf, m_buf + remaining, bytes.begin() + shared);
+
+					m_buf += remaining;
+					m_buf_len -= remaining;
+
+					std::copy(bytes.begin(), bytes.end(), m_group_previous_bytes.begin());
+
+					return asiotap::base_ip_route<AddressType>(asiotap::base_ip_network_address<AddressType>(AddressType(bytes), prefix_length));
+				}
+
 				/**
 				 * \brief Read the next DNS server address contained in the buffer.
 				 * \return The DNS server address.
@@ -271,6 +515,26 @@ namespace freelan
 				 */
 				ip_network_address_type read_next(asiotap::ip_route& ir, asiotap::ip_address& dns_server)
 				{
+					// A started group is drained first: its routes are
+					// reported one by one, as if they were regular entries.
+					if (m_group_remaining > 0)
+					{
+						--m_group_remaining;
+
+						if (m_group_is_v6)
+						{
+							ir = read_next_group_route<boost::asio::ip::address_v6>();
+
+							return m_group_removed ? INAT_REMOVED_IPV6 : INAT_IPV6;
+						}
+						else
+						{
+							ir = read_next_group_route<boost::asio::ip::address_v4>();
+
+							return m_group_removed ? INAT_REMOVED_IPV4 : INAT_IPV4;
+						}
+					}
+
 					if (m_buf_len == 0)
 					{
 						return INAT_INVALID;
@@ -284,24 +548,53 @@ namespace freelan
 					{
 						case INAT_IPV4:
 						case INAT_IPV4_GATEWAY:
+						case INAT_REMOVED_IPV4:
+						case INAT_REMOVED_IPV4_GATEWAY:
 						{
-							ir = read_next_ip_route<boost::asio::ip::address_v4>(_type == INAT_IPV4_GATEWAY);
+							ir = read_next_ip_route<boost::asio::ip::address_v4>((_type == INAT_IPV4_GATEWAY) || (_type == INAT_REMOVED_IPV4_GATEWAY));
 
 							break;
 						}
 						case INAT_IPV6:
 						case INAT_IPV6_GATEWAY:
+						case INAT_REMOVED_IPV6:
+						case INAT_REMOVED_IPV6_GATEWAY:
 						{
-							ir = read_next_ip_route<boost::asio::ip::address_v6>(_type == INAT_IPV6_GATEWAY);
+							ir = read_next_ip_route<boost::asio::ip::address_v6>((_type == INAT_IPV6_GATEWAY) || (_type == INAT_REMOVED_IPV6_GATEWAY));
 
 							break;
 						}
+						case INAT_IPV4_GROUP:
+						case INAT_IPV6_GROUP:
+						case INAT_REMOVED_IPV4_GROUP:
+						case INAT_REMOVED_IPV6_GROUP:
+						{
+							const size_t count = read_varint();
+
+							// The writer never emits empty groups, and
+							// rejecting them caps the recursion below at one
+							// level.
+							if (count == 0)
+							{
+								throw std::runtime_error("Empty route group in message");
+							}
+
+							m_group_remaining = count;
+							m_group_is_v6 = (_type == INAT_IPV6_GROUP) || (_type == INAT_REMOVED_IPV6_GROUP);
+							m_group_removed = (_type == INAT_REMOVED_IPV4_GROUP) || (_type == INAT_REMOVED_IPV6_GROUP);
+
+							std::fill(m_group_previous_bytes.begin(), m_group_previous_bytes.end(), 0);
+
+							return read_next(ir, dns_server);
+						}
 						case INAT_DNS_SERVER_IPV4:
+						case INAT_REMOVED_DNS_SERVER_IPV4:
 						{
 							dns_server = read_next_dns_server<boost::asio::ip::address_v4>();
 							break;
 						}
 						case INAT_DNS_SERVER_IPV6:
+						case INAT_REMOVED_DNS_SERVER_IPV6:
 						{
 							dns_server = read_next_dns_server<boost::asio::ip::address_v6>();
 							break;
@@ -319,10 +612,90 @@ namespace freelan
 
 				BufferType m_buf;
 				size_t m_buf_len;
+				uint8_t m_type_offset;
+
+				// The decoding state of the prefix-compressed group being
+				// read, if any. The previous bytes buffer is sized for IPv6
+				// and only partially used for IPv4.
+				size_t m_group_remaining;
+				bool m_group_is_v6;
+				bool m_group_removed;
+				boost::asio::ip::address_v6::bytes_type m_group_previous_bytes;
 		};
+
+		/**
+		 * \brief Write a set of routes, optionally packing them into prefix-compressed groups.
+		 * \param buf The buffer to write to.
+		 * \param buf_len The length of buf.
+		 * \param routes The routes.
+		 * \param compact Whether the routes may be packed into groups.
+		 * \param type_offset The offset to add to the entry types upon writing. Either 0 or INAT_REMOVED_OFFSET.
+		 * \param group_type_offset The offset to add to the group types upon writing. Either 0 or INAT_GROUP_REMOVED_OFFSET.
+		 * \return The count of bytes written.
+		 */
+		size_t write_routes(uint8_t* buf, size_t buf_len, const asiotap::ip_route_set& routes, bool compact, uint8_t type_offset, uint8_t group_type_offset)
+		{
+			size_t result_size = 0;
+
+			std::vector<const asiotap::ipv4_route*> ipv4_group;
+			std::vector<const asiotap::ipv6_route*> ipv6_group;
+
+			for (auto&& route : routes)
+			{
+				if (compact)
+				{
+					if (const asiotap::ipv4_route* ipv4 = boost::get<asiotap::ipv4_route>(&route))
+					{
+						if (!ipv4->gateway() && has_zero_host_bits(ipv4->network_address()))
+						{
+							ipv4_group.push_back(ipv4);
+
+							continue;
+						}
+					}
+					else if (const asiotap::ipv6_route* ipv6 = boost::get<asiotap::ipv6_route>(&route))
+					{
+						if (!ipv6->gateway() && has_zero_host_bits(ipv6->network_address()))
+						{
+							ipv6_group.push_back(ipv6);
+
+							continue;
+						}
+					}
+				}
+
+				// Gateway-bearing routes and addresses with host bits set
+				// keep the legacy representation, which carries them exactly.
+				result_size += boost::apply_visitor(routes_helper<uint8_t*>(buf + result_size, buf_len - result_size, type_offset), route);
+			}
+
+			if (!ipv4_group.empty())
+			{
+				result_size += write_route_group(buf + result_size, buf_len - result_size, ipv4_group, group_type_offset);
+			}
+
+			if (!ipv6_group.empty())
+			{
+				result_size += write_route_group(buf + result_size, buf_len - result_size, ipv6_group, group_type_offset);
+			}
+
+			return result_size;
+		}
+	}
+
+	size_t routes_message::estimate_size(size_t route_count, size_t dns_server_count)
+	{
+		// Worst case: IPv6 entries in the legacy representation with a
+		// gateway, plus the group headers. The estimate only has to be an
+		// upper bound: write() reports the bytes actually used.
+		static const size_t MAX_ROUTE_SIZE = 2 + 2 * 16;
+		static const size_t MAX_DNS_SERVER_SIZE = 1 + 16;
+		static const size_t MAX_GROUP_HEADERS_SIZE = 2 * (1 + 5);
+
+		return HEADER_LENGTH + 2 * sizeof(uint32_t) + route_count * MAX_ROUTE_SIZE + dns_server_count * MAX_DNS_SERVER_SIZE + MAX_GROUP_HEADERS_SIZE;
 	}
 
-	size_t routes_message::write(void* buf, size_t buf_len, version_type _version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers)
+	size_t routes_message::write(void* buf, size_t buf_len, version_type _version, const asiotap::ip_route_set& routes, const asiotap::ip_address_set& dns_servers, bool compact)
 	{
 		if (buf_len < HEADER_LENGTH)
 		{
@@ -339,9 +712,8 @@ namespace freelan
 		pbuf += sizeof(uint32_t);
 		pbuf_len -= sizeof(uint32_t);
 
-		for (auto&& route : routes)
 		{
-			const size_t count = boost::apply_visitor(routes_helper<uint8_t*>(pbuf, pbuf_len), route);
+			const size_t count = write_routes(pbuf, pbuf_len, routes, compact, 0, 0);
 
 			required_size += count;
 			pbuf += count;
@@ -360,11 +732,71 @@ namespace freelan
 		return message::write(buf, buf_len, MT_ROUTES, required_size);
 	}
 
+	size_t routes_message::write_delta(void* buf, size_t buf_len, version_type _version, version_type _base_version, const asiotap::ip_route_set& added_routes, const asiotap::ip_route_set& removed_routes, const asiotap::ip_address_set& added_dns_servers, const asiotap::ip_address_set& removed_dns_servers, bool compact)
+	{
+		if (buf_len < HEADER_LENGTH)
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		size_t required_size = 0;
+		uint8_t* pbuf = static_cast<uint8_t*>(buf) + HEADER_LENGTH;
+		size_t pbuf_len = buf_len - HEADER_LENGTH;
+
+		fscp::buffer_tools::set<uint32_t>(pbuf, 0, htonl(static_cast<uint32_t>(_version)));
+		fscp::buffer_tools::set<uint32_t>(pbuf, sizeof(uint32_t), htonl(static_cast<uint32_t>(_base_version)));
+
+		required_size += 2 * sizeof(uint32_t);
+		pbuf += 2 * sizeof(uint32_t);
+		pbuf_len -= 2 * sizeof(uint32_t);
+
+		{
+			const size_t count = write_routes(pbuf, pbuf_len, added_routes, compact, 0, 0);
+
+			required_size += count;
+			pbuf += count;
+			pbuf_len -= count;
+		}
+
+		{
+			const size_t count = write_routes(pbuf, pbuf_len, removed_routes, compact, INAT_REMOVED_OFFSET, INAT_GROUP_REMOVED_OFFSET);
+
+			required_size += count;
+			pbuf += count;
+			pbuf_len -= count;
+		}
+
+		for (auto&& dns_server : added_dns_servers)
+		{
+			const size_t count = routes_helper<uint8_t*>(pbuf, pbuf_len).write_dns_server(dns_server.value());
+
+			required_size += count;
+			pbuf += count;
+			pbuf_len -= count;
+		}
+
+		for (auto&& dns_server : removed_dns_servers)
+		{
+			const size_t count = routes_helper<uint8_t*>(pbuf, pbuf_len, INAT_REMOVED_OFFSET).write_dns_server(dns_server.value());
+
+			required_size += count;
+			pbuf += count;
+			pbuf_len -= count;
+		}
+
+		return message::write(buf, buf_len, MT_ROUTES_DELTA, required_size);
+	}
+
 	routes_message::version_type routes_message::version() const
 	{
 		return ntohl(static_cast<version_type>(fscp::buffer_tools::get<uint32_t>(payload(), 0)));
 	}
 
+	routes_message::version_type routes_message::base_version() const
+	{
+		return ntohl(static_cast<version_type>(fscp::buffer_tools::get<uint32_t>(payload(), sizeof(uint32_t))));
+	}
+
 	const asiotap::ip_route_set& routes_message::routes() const
 	{
 		read_and_cache_results();
@@ -379,6 +811,20 @@ namespace freelan
 		return m_results->dns_servers;
 	}
 
+	const asiotap::ip_route_set& routes_message::removed_routes() const
+	{
+		read_and_cache_results();
+
+		return m_results->removed_routes;
+	}
+
+	const asiotap::ip_address_set& routes_message::removed_dns_servers() const
+	{
+		read_and_cache_results();
+
+		return m_results->removed_dns_servers;
+	}
+
 	routes_message::routes_message(const void* buf, size_t buf_len) :
 		message(buf, buf_len)
 	{
@@ -397,8 +843,15 @@ namespace freelan
 		{
 			routes_and_dns_servers result;
 
-			const uint8_t* pbuf = payload() + sizeof(uint32_t);
-			size_t pbuf_len = length() - sizeof(uint32_t);
+			const size_t versions_size = is_delta() ? (2 * sizeof(uint32_t)) : sizeof(uint32_t);
+
+			if (length() < versions_size)
+			{
+				throw std::runtime_error("Not enough bytes for the expected versions");
+			}
+
+			const uint8_t* pbuf = payload() + versions_size;
+			size_t pbuf_len = length() - versions_size;
 
 			routes_helper<const uint8_t*> deserializer(pbuf, pbuf_len);
 
@@ -424,6 +877,18 @@ namespace freelan
 						result.dns_servers.insert(dns_server);
 						break;
 					}
+					case INAT_REMOVED_IPV4:
+					case INAT_REMOVED_IPV4_GATEWAY:
+					case INAT_REMOVED_IPV6:
+					case INAT_REMOVED_IPV6_GATEWAY: {
+						result.removed_routes.insert(ir);
+						break;
+					}
+					case INAT_REMOVED_DNS_SERVER_IPV4:
+					case INAT_REMOVED_DNS_SERVER_IPV6: {
+						result.removed_dns_servers.insert(dns_server);
+						break;
+					}
 					default:
 						break;
 				}
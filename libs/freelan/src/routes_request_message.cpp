@@ -54,10 +54,32 @@ namespace freelan
 		return message::write(buf, buf_len, MT_ROUTES_REQUEST, 0);
 	}
 
+	size_t routes_request_message::write(void* buf, size_t buf_len, version_type known_version)
+	{
+		if (buf_len < HEADER_LENGTH + sizeof(uint32_t))
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		fscp::buffer_tools::set<uint32_t>(static_cast<uint8_t*>(buf) + HEADER_LENGTH, 0, htonl(static_cast<uint32_t>(known_version)));
+
+		return message::write(buf, buf_len, MT_ROUTES_REQUEST, sizeof(uint32_t));
+	}
+
+	boost::optional<routes_request_message::version_type> routes_request_message::known_version() const
+	{
+		if (length() < sizeof(uint32_t))
+		{
+			return boost::none;
+		}
+
+		return ntohl(static_cast<version_type>(fscp::buffer_tools::get<uint32_t>(payload(), 0)));
+	}
+
 	routes_request_message::routes_request_message(const void* buf, size_t buf_len) :
 		message(buf, buf_len)
 	{
-		if (length() != 0)
+		if ((length() != 0) && (length() != sizeof(uint32_t)))
 		{
 			throw std::runtime_error("bad message length");
 		}
@@ -66,7 +88,7 @@ namespace freelan
 	routes_request_message::routes_request_message(const message& _message) :
 		message(_message)
 	{
-		if (length() != 0)
+		if ((length() != 0) && (length() != sizeof(uint32_t)))
 		{
 			throw std::runtime_error("bad message length");
 		}
@@ -51,6 +51,7 @@
 
 #include <cryptoplus/x509/certificate_request.hpp>
 #include <cryptoplus/base64.hpp>
+#include <cryptoplus/hash/message_digest.hpp>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/date_time/c_local_time_adjustor.hpp>
@@ -58,6 +59,7 @@
 #include <kfather/formatter.hpp>
 
 #include <cassert>
+#include <cstring>
 
 namespace freelan
 {
@@ -65,6 +67,9 @@ namespace freelan
 
 	namespace
 	{
+		// The count of recently signed certificates kept for idempotent re-requests.
+		const size_t SIGNING_CACHE_SIZE = 32;
+
 		class session_type : public mongooseplus::generic_session, public mongooseplus::basic_session_type
 		{
 			public:
@@ -150,13 +155,18 @@ namespace freelan
 		}
 	}
 
-	web_server::web_server(fscp::logger& _logger, const freelan::server_configuration& configuration, authentication_handler_type authentication_handler) :
+	web_server::web_server(fscp::logger& _logger, const freelan::server_configuration& configuration, authentication_handler_type authentication_handler, statistics_handler_type statistics_handler) :
 		m_logger(_logger),
-		m_authentication_handler(authentication_handler)
+		m_authentication_handler(authentication_handler),
+		m_signing_work(new boost::asio::io_service::work(m_signing_io_service))
 	{
+		m_signing_thread = boost::thread([this](){ m_signing_io_service.run(); });
 		m_logger(fscp::log_level::debug) << "Web server's listen endpoint set to " << configuration.listen_on << ".";
 		set_option("listening_port", boost::lexical_cast<std::string>(configuration.listen_on));
 
+		// The largest legitimate bodies are DER certificate requests, which are a few kilobytes. Anything bigger is rejected before it accumulates.
+		set_max_content_size(64 * 1024);
+
 		if (configuration.protocol == server_configuration::server_protocol_type::https)
 		{
 			set_certificate_and_private_key(configuration.server_certificate, configuration.server_private_key);
@@ -164,17 +174,72 @@ namespace freelan
 
 		register_authenticated_route("/request_certificate/", [this, configuration](mongooseplus::request& req) {
 			const auto session = req.get_session<session_type>();
+			const std::string username = session->username();
 
-			m_logger(fscp::log_level::debug) << session->username() << " (" << req.remote() << ") requested a certificate.";
+			m_logger(fscp::log_level::debug) << username << " (" << req.remote() << ") requested a certificate.";
 
-			const cryptoplus::x509::certificate_request cert_req = cryptoplus::x509::certificate_request::from_der(req.content(), req.content_size());
-			const auto certificate = sign_certificate_request(cert_req, configuration.certification_authority_certificate, configuration.certification_authority_private_key, session->username());
-			const auto certificate_buffer = certificate.write_der();
+			// Idempotent re-requests (same user, same DER request) during retries are answered from the cache without signing again.
+			const std::string cache_key = make_signing_cache_key(username, req.content(), req.content_size());
 
-			req.send_header("content-type", "application/x-x509-cert");
-			req.send_data(&certificate_buffer.data()[0], certificate_buffer.data().size());
+			{
+				boost::mutex::scoped_lock lock(m_signing_mutex);
 
-			return request_result::handled;
+				const auto cached = m_signing_cache.find(cache_key);
+
+				if (cached != m_signing_cache.end())
+				{
+					req.send_header("content-type", "application/x-x509-cert");
+					req.send_data(&cached->second.data()[0], cached->second.data().size());
+
+					return request_result::handled;
+				}
+			}
+
+			// The body buffer belongs to the connection: copy it before leaving the handler.
+			const std::string der_request(req.content(), req.content_size());
+
+			const pending_signing_ptr pending = boost::make_shared<pending_signing_type>();
+
+			{
+				boost::mutex::scoped_lock lock(m_signing_mutex);
+
+				m_pending_signings[pending.get()] = pending;
+			}
+
+			req.set_user_param(pending.get());
+
+			m_signing_io_service.post([this, configuration, pending, der_request, username, cache_key](){
+				try
+				{
+					const cryptoplus::x509::certificate_request cert_req = cryptoplus::x509::certificate_request::from_der(der_request.c_str(), der_request.size());
+					const auto certificate = sign_certificate_request(cert_req, configuration.certification_authority_certificate, configuration.certification_authority_private_key, username);
+
+					pending->certificate_der = certificate.write_der();
+					pending->success = true;
+
+					boost::mutex::scoped_lock lock(m_signing_mutex);
+
+					m_signing_cache[cache_key] = pending->certificate_der;
+					m_signing_cache_order.push_back(cache_key);
+
+					while (m_signing_cache_order.size() > SIGNING_CACHE_SIZE)
+					{
+						m_signing_cache.erase(m_signing_cache_order.front());
+						m_signing_cache_order.pop_front();
+					}
+				}
+				catch (const std::exception& ex)
+				{
+					m_logger(fscp::log_level::warning) << "Failed to sign the certificate request of " << username << ": " << ex.what();
+				}
+
+				pending->done = true;
+
+				// The poll loop completes the response from handle_poll().
+				wake();
+			});
+
+			return request_result::expect_more;
 		});
 
 		register_authenticated_route("/request_ca_certificate/", [this, configuration](mongooseplus::request& req) {
@@ -276,7 +341,7 @@ namespace freelan
 
 					try
 					{
-						auto endpoint = boost::lexical_cast<asiotap::endpoint>(endpoint_str);
+						auto endpoint = asiotap::parse_endpoint(endpoint_str);
 						endpoint = asiotap::get_default_ip_endpoint(endpoint, req.remote_ip());
 
 						if (asiotap::is_endpoint_complete(endpoint))
@@ -416,6 +481,23 @@ namespace freelan
 				return request_result::handled;
 			}
 		});
+
+		if (statistics_handler)
+		{
+			register_authenticated_route("/get_statistics/", [this, statistics_handler](mongooseplus::request& req) {
+				// The handler samples lock-free snapshots only, so serving the
+				// statistics never perturbs the data plane.
+				req.send_json(statistics_handler());
+
+				return request_result::handled;
+			});
+		}
+	}
+
+	web_server::~web_server()
+	{
+		m_signing_work.reset();
+		m_signing_thread.join();
 	}
 
 	web_server::route_type& web_server::register_authenticated_route(route_type&& route)
@@ -448,6 +530,91 @@ namespace freelan
 		return mongooseplus::routed_web_server::handle_http_error(req);
 	}
 
+	web_server::request_result web_server::handle_poll(mongooseplus::request& req)
+	{
+		void* const param = req.get_user_param();
+
+		if (param)
+		{
+			pending_signing_ptr pending;
+
+			{
+				boost::mutex::scoped_lock lock(m_signing_mutex);
+
+				const auto pending_it = m_pending_signings.find(param);
+
+				if (pending_it != m_pending_signings.end())
+				{
+					pending = pending_it->second;
+				}
+			}
+
+			if (pending && pending->done)
+			{
+				{
+					boost::mutex::scoped_lock lock(m_signing_mutex);
+
+					m_pending_signings.erase(param);
+				}
+
+				req.set_user_param(nullptr);
+
+				complete_pending_signing(req, *pending);
+
+				return request_result::handled;
+			}
+		}
+
+		return mongooseplus::routed_web_server::handle_poll(req);
+	}
+
+	web_server::request_result web_server::handle_close(mongooseplus::request& req)
+	{
+		void* const param = req.get_user_param();
+
+		if (param)
+		{
+			// The client went away while its signing request was in flight: the result, if any, stays in the cache for the retry.
+			boost::mutex::scoped_lock lock(m_signing_mutex);
+
+			m_pending_signings.erase(param);
+
+			req.set_user_param(nullptr);
+		}
+
+		return mongooseplus::routed_web_server::handle_close(req);
+	}
+
+	void web_server::complete_pending_signing(mongooseplus::request& req, const pending_signing_type& pending)
+	{
+		if (pending.success)
+		{
+			req.send_header("content-type", "application/x-x509-cert");
+			req.send_data(&pending.certificate_der.data()[0], pending.certificate_der.data().size());
+		}
+		else
+		{
+			req.send_status_code(500);
+			req.send_data("", 0);
+		}
+	}
+
+	std::string web_server::make_signing_cache_key(const std::string& username, const void* buf, size_t buf_len)
+	{
+		cryptoplus::buffer key_material(username.size() + 1 + buf_len);
+		uint8_t* const data = cryptoplus::buffer_cast<uint8_t*>(key_material);
+
+		std::copy(username.begin(), username.end(), data);
+		data[username.size()] = 0x00;
+
+		if (buf_len > 0)
+		{
+			std::memcpy(data + username.size() + 1, buf, buf_len);
+		}
+
+		return cryptoplus::hash::message_digest(key_material, EVP_sha256()).to_string();
+	}
+
 	web_server::client_information_type* web_server::get_client_information(mongooseplus::request& req)
 	{
 		const auto session = req.get_session<session_type>();
@@ -48,16 +48,6 @@
 #include <cassert>
 
 #include <boost/foreach.hpp>
-#include <boost/random/mersenne_twister.hpp>
-
-#include <boost/version.hpp>
-
-#if BOOST_VERSION >= 104700
-#include <boost/random/uniform_int_distribution.hpp>
-#else
-#include <boost/random/uniform_int.hpp>
-#include <boost/random/variate_generator.hpp>
-#endif
 
 #include <boost/thread/mutex.hpp>
 #include <boost/make_shared.hpp>
@@ -73,14 +63,13 @@ namespace freelan
 		{
 			public:
 
-				typedef std::set<KeyType> set_type;
 				typedef std::map<KeyType, ValueType> map_type;
 
-				results_gatherer(Handler handler, const set_type& keys) :
+				results_gatherer(Handler handler, size_t count) :
 					m_handler(handler),
-					m_keys(keys)
+					m_remaining(count)
 				{
-					if (m_keys.empty())
+					if (m_remaining == 0)
 					{
 						m_handler(m_results);
 					}
@@ -90,14 +79,29 @@ namespace freelan
 				{
 					boost::mutex::scoped_lock lock(m_mutex);
 
-					const size_t erased_count = m_keys.erase(key);
-
-					// Ensure that gather was called only once for a given key.
-					assert(erased_count == 1);
+					// Ensure that gather was not called more times than there are keys.
+					assert(m_remaining > 0);
 
 					m_results[key] = value;
 
-					if (m_keys.empty())
+					if (--m_remaining == 0)
+					{
+						m_handler(m_results);
+					}
+				}
+
+				void gather_batch(const map_type& values)
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+
+					// Ensure that gather was not called more times than there are keys.
+					assert(m_remaining >= values.size());
+
+					m_results.insert(values.begin(), values.end());
+
+					m_remaining -= values.size();
+
+					if (m_remaining == 0)
 					{
 						m_handler(m_results);
 					}
@@ -107,18 +111,84 @@ namespace freelan
 
 				boost::mutex m_mutex;
 				Handler m_handler;
-				set_type m_keys;
+				size_t m_remaining;
 				map_type m_results;
 		};
 	}
 
 	const unsigned int switch_::MAX_ENTRIES_DEFAULT = 1024;
+	const boost::posix_time::time_duration switch_::ethernet_address_map_type::MAX_ENTRY_AGE = boost::posix_time::seconds(300);
 
-	void switch_::async_write(port_index_type index, boost::asio::const_buffer data, multi_write_handler_type handler)
+	switch_::port_handle_type switch_::register_port(port_index_type index, port_type port)
 	{
-		typedef results_gatherer<port_index_type, boost::system::error_code, multi_write_handler_type> results_gatherer_type;
+		const port_handle_map_type::iterator handle_entry = m_port_handles.find(index);
+
+		if (handle_entry != m_port_handles.end())
+		{
+			m_port_slots[handle_entry->second].port = port;
+
+			return handle_entry->second;
+		}
+
+		port_handle_type handle;
+
+		if (!m_free_handles.empty())
+		{
+			handle = m_free_handles.back();
+			m_free_handles.pop_back();
+		}
+		else
+		{
+			handle = static_cast<port_handle_type>(m_port_slots.size());
+			m_port_slots.push_back(port_entry_type());
+		}
+
+		m_port_slots[handle].index = index;
+		m_port_slots[handle].port = port;
+		m_port_slots[handle].used = true;
+
+		m_port_handles[index] = handle;
 
-		const auto targets = get_targets_for(index, data);
+		return handle;
+	}
+
+	void switch_::unregister_port(port_index_type index)
+	{
+		const port_handle_map_type::iterator handle_entry = m_port_handles.find(index);
+
+		if (handle_entry == m_port_handles.end())
+		{
+			return;
+		}
+
+		const port_handle_type handle = handle_entry->second;
+
+		// Unregistration is rare, so we can afford the full scan that keeps
+		// the address table free of handles about to be reused.
+		m_ethernet_address_map.erase_port(handle);
+
+		m_port_slots[handle] = port_entry_type();
+		m_free_handles.push_back(handle);
+		m_port_handles.erase(handle_entry);
+	}
+
+	void switch_::async_write(port_index_type index, boost::asio::const_buffer data, const boost::optional<ethernet_frame_context_type>& context, multi_write_handler_type handler)
+	{
+		// The variant identity is only resolved here, at the frame's entry:
+		// everything past this point works with dense handles.
+		const port_handle_map_type::const_iterator handle_entry = m_port_handles.find(index);
+
+		// async_write() is always invoked from the same strand, so reusing the
+		// scratch vector is safe and avoids a per-frame allocation.
+		std::vector<port_handle_type>& targets = m_targets_scratch;
+		targets.clear();
+
+		if (handle_entry != m_port_handles.end())
+		{
+			get_targets_for(handle_entry->second, data, context, targets);
+		}
+
+		fscp::frame_recorder::record(fscp::trace_point::switch_write, targets.empty() ? fscp::frame_verdict::no_target : fscp::frame_verdict::forwarded, to_trace_peer_id(index), buffer_size(data));
 
 #if FREELAN_DEBUG
 		if (!targets.empty())
@@ -131,127 +201,398 @@ namespace freelan
 		}
 #endif
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		async_write_targets(targets, data, handler);
+	}
 
-		for (auto&& target : targets)
+	void switch_::async_write(port_index_type index, fscp::SharedBuffer buffer, boost::asio::const_buffer data, const boost::optional<ethernet_frame_context_type>& context, multi_write_handler_type handler)
+	{
+		typedef results_gatherer<port_index_type, boost::system::error_code, multi_write_handler_type> results_gatherer_type;
+
+		const port_handle_map_type::const_iterator handle_entry = m_port_handles.find(index);
+
+		std::vector<port_handle_type>& targets = m_targets_scratch;
+		targets.clear();
+
+		if (handle_entry != m_port_handles.end())
 		{
-#if FREELAN_DEBUG
-			std::cerr << index << "-> " << target << std::endl;
-#endif
+			get_targets_for(handle_entry->second, data, context, targets);
+		}
+
+		fscp::frame_recorder::record(fscp::trace_point::switch_write, targets.empty() ? fscp::frame_verdict::no_target : fscp::frame_verdict::forwarded, to_trace_peer_id(index), buffer_size(data));
 
-			m_ports[target].async_write(data, boost::bind(&results_gatherer_type::gather, rg, target, _1));
+		// When the frame has a single target that supports buffer writes, we
+		// hand over the source buffer so the frame can be processed without
+		// any payload copy.
+		if (targets.size() == 1)
+		{
+			port_type& target_port = port_of(targets.front());
+
+			if (target_port.supports_buffer_writes())
+			{
+				boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets.size());
+
+				target_port.async_write_buffer(buffer, data, boost::bind(&results_gatherer_type::gather, rg, index_of(targets.front()), _1));
+
+				return;
+			}
 		}
+
+		async_write_targets(targets, data, handler);
 	}
 
-	std::set<port_index_type> switch_::get_targets_for(port_index_type index, boost::asio::const_buffer data)
+	void switch_::async_write_targets(const std::vector<port_handle_type>& targets, boost::asio::const_buffer data, multi_write_handler_type handler)
 	{
-		const port_list_type::iterator source_port_entry = m_ports.find(index);
+		typedef results_gatherer<port_index_type, boost::system::error_code, multi_write_handler_type> results_gatherer_type;
+
+		// Targets whose ports share a batch-capable transport are submitted
+		// together in a single call: broadcast frames then cost one submission
+		// per transport instead of one per port.
+		std::vector<port_handle_type>& batch = m_batch_scratch;
+		batch.clear();
 
-		if (source_port_entry != m_ports.end())
+		port_type* batch_port = nullptr;
+
+		for (auto&& target : targets)
 		{
-			switch (m_configuration.routing_method)
+			port_type& port = port_of(target);
+
+			if (port.supports_batch_writes())
 			{
-				case switch_configuration::RM_HUB:
+				batch.push_back(target);
+
+				if (!batch_port)
 				{
-					return get_targets_for(source_port_entry);
+					batch_port = &port;
 				}
-				case switch_configuration::RM_SWITCH:
+			}
+		}
+
+		// A batch of one gains nothing over the regular write path.
+		const bool use_batch = (batch.size() >= 2);
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets.size());
+
+		if (use_batch)
+		{
+			// The batch write function is part of the public port API and
+			// reports its targets with the variant identity: the translation
+			// only happens here, for actual batches.
+			std::vector<port_index_type>& batch_indexes = m_batch_indexes_scratch;
+			batch_indexes.clear();
+
+			for (auto&& target : batch)
+			{
+				batch_indexes.push_back(index_of(target));
+			}
+
+			batch_port->async_write_batch(batch_indexes, data, boost::bind(&results_gatherer_type::gather_batch, rg, _1));
+		}
+
+		for (auto&& target : targets)
+		{
+			port_type& port = port_of(target);
+
+			if (use_batch && port.supports_batch_writes())
+			{
+				continue;
+			}
+
+			port.async_write(data, boost::bind(&results_gatherer_type::gather, rg, index_of(target), _1));
+		}
+	}
+
+	void switch_::get_targets_for(port_handle_type source_handle, boost::asio::const_buffer data, const boost::optional<ethernet_frame_context_type>& context, std::vector<port_handle_type>& targets)
+	{
+		switch (m_configuration.routing_method)
+		{
+			case switch_configuration::RM_HUB:
+			{
+				get_targets_for(source_handle, targets);
+
+				return;
+			}
+			case switch_configuration::RM_SWITCH:
+			{
+				ethernet_address_type sender_address;
+				ethernet_address_type target_address;
+
+				if (context)
+				{
+					// The frame was already parsed by the OSI filters: the addresses come for free.
+					sender_address = context->sender;
+					target_address = context->target;
+				}
+				else
 				{
 					asiotap::osi::const_helper<asiotap::osi::ethernet_frame> ethernet_helper(data);
 
-					const ethernet_address_type target_address = to_ethernet_address(ethernet_helper.target());
+					sender_address = to_ethernet_address(ethernet_helper.sender());
+					target_address = to_ethernet_address(ethernet_helper.target());
+				}
+
+				if (is_multicast_address(target_address))
+				{
+					get_targets_for(source_handle, targets);
 
-					if (is_multicast_address(target_address))
+					return;
+				}
+				else
+				{
+					if (m_ethernet_address_map.insert(sender_address, source_handle) && m_mac_learned_handler)
 					{
-						return get_targets_for(source_port_entry);
+						// A station was learned (or moved) from live
+						// traffic: let the owner gossip it, so remote
+						// tables warm up before they miss and flood.
+						m_mac_learned_handler(index_of(source_handle), sender_address);
 					}
-					else
+
+					// We look in the ethernet address map
+
+					const port_handle_type* const target_port = m_ethernet_address_map.find(target_address);
+
+					if (!target_port)
 					{
-						m_ethernet_address_map[to_ethernet_address(ethernet_helper.sender())] = index;
+						// No target entry: we send the message to everybody.
+						m_unknown_unicast_floods.fetch_add(1, std::memory_order_relaxed);
 
-						// We exceeded the maximum count for entries: we delete random entries to fix it.
-						while (m_ethernet_address_map.size() > m_max_entries)
-						{
-							ethernet_address_map_type::iterator entry = m_ethernet_address_map.begin();
+						get_targets_for(source_handle, targets);
 
-#if BOOST_VERSION >= 104700
-							boost::random::mt19937 gen;
+						return;
+					}
 
-							std::advance(entry, boost::random::uniform_int_distribution<>(0, static_cast<int>(m_ethernet_address_map.size()) - 1)(gen));
-#else
-							boost::mt19937 gen;
+					const port_handle_type target_handle = *target_port;
 
-							boost::variate_generator<boost::mt19937&, boost::uniform_int<> > vgen(gen, boost::uniform_int<>(0, m_ethernet_address_map.size() - 1));
-							std::advance(entry, vgen());
-#endif
+					// Unregistration purges the address table, so a live entry
+					// should always point to a live slot: the check is only a
+					// cheap safety net.
+					if ((target_handle >= m_port_slots.size()) || !m_port_slots[target_handle].used)
+					{
+						m_ethernet_address_map.erase(target_address);
 
-							m_ethernet_address_map.erase(entry);
-						}
+						m_unknown_unicast_floods.fetch_add(1, std::memory_order_relaxed);
 
-						// We look in the ethernet address map
+						get_targets_for(source_handle, targets);
 
-						const ethernet_address_map_type::iterator target_entry = m_ethernet_address_map.find(target_address);
+						return;
+					}
 
-						if (target_entry == m_ethernet_address_map.end())
-						{
-							// No target entry: we send the message to everybody.
-							return get_targets_for(source_port_entry);
-						}
+					m_suppressed_floods.fetch_add(1, std::memory_order_relaxed);
 
-						const port_index_type target_port_index = target_entry->second;
+					targets.push_back(target_handle);
 
-						if (!is_registered(target_port_index))
-						{
-							// The port does not exist: we delete the entry and send to everybody.
-							m_ethernet_address_map.erase(target_entry);
+					return;
+				}
+			}
+		}
+	}
 
-							return get_targets_for(source_port_entry);
-						}
+	bool switch_::learn(port_index_type index, const asiotap::osi::ethernet_address& address)
+	{
+		if (is_multicast_address(address))
+		{
+			return false;
+		}
 
-						std::set<port_index_type> targets;
+		const port_handle_map_type::const_iterator handle_entry = m_port_handles.find(index);
 
-						targets.insert(target_port_index);
+		if (handle_entry == m_port_handles.end())
+		{
+			return false;
+		}
 
-						return targets;
-					}
+		// Live traffic already mapped the address: the gossiped mapping may
+		// be stale, so the existing entry wins.
+		if (m_ethernet_address_map.find(address))
+		{
+			return false;
+		}
+
+		m_ethernet_address_map.insert(address, handle_entry->second);
+		m_gossip_learned.fetch_add(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	void switch_::get_targets_for(port_handle_type source_handle, std::vector<port_handle_type>& targets)
+	{
+		const port_group_type source_group = m_port_slots[source_handle].port.group();
+
+		for (size_t slot = 0; slot != m_port_slots.size(); ++slot)
+		{
+			const port_entry_type& entry = m_port_slots[slot];
+
+			if (entry.used && (slot != source_handle))
+			{
+				if (m_configuration.relay_mode_enabled || (source_group != entry.port.group()))
+				{
+					targets.push_back(static_cast<port_handle_type>(slot));
 				}
 			}
 		}
+	}
+
+	switch_::ethernet_address_map_type::ethernet_address_map_type(size_t max_entries) :
+		m_used_count(0)
+	{
+		// Round the capacity up to a power of two so that probing can use a
+		// simple mask, with some headroom to keep the load factor low.
+		size_t capacity = 16;
+
+		while (capacity < max_entries * 2)
+		{
+			capacity <<= 1;
+		}
+
+		m_entries.resize(capacity);
+		m_mask = capacity - 1;
 
-		return std::set<port_index_type>();
+		for (auto&& entry : m_entries)
+		{
+			entry.port = 0;
+			entry.state = slot_state::empty;
+		}
 	}
 
-	std::set<port_index_type> switch_::get_targets_for(port_list_type::const_iterator source_port_entry)
+	const switch_::port_handle_type* switch_::ethernet_address_map_type::find(const ethernet_address_type& address) const
 	{
-		std::set<port_index_type> targets;
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+		size_t slot = address.hash() & m_mask;
 
-		for (port_list_type::const_iterator port_entry = m_ports.begin(); port_entry != m_ports.end(); ++port_entry)
+		for (size_t probe = 0; probe < PROBE_LIMIT; ++probe, slot = (slot + 1) & m_mask)
 		{
-			if (source_port_entry != port_entry)
+			const entry_type& entry = m_entries[slot];
+
+			if (entry.state == slot_state::empty)
+			{
+				return nullptr;
+			}
+
+			if ((entry.state == slot_state::used) && (entry.address == address))
 			{
-				if (m_configuration.relay_mode_enabled || (source_port_entry->second.group() != port_entry->second.group()))
+				// An expired entry is as good as absent: its slot will be
+				// reclaimed by the next insertion that probes it.
+				if (is_expired(entry, now))
 				{
-					targets.insert(port_entry->first);
+					return nullptr;
 				}
+
+				return &entry.port;
 			}
 		}
 
-		return targets;
+		return nullptr;
+	}
+
+	bool switch_::ethernet_address_map_type::insert(const ethernet_address_type& address, port_handle_type port)
+	{
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+		size_t slot = address.hash() & m_mask;
+		entry_type* free_entry = nullptr;
+
+		for (size_t probe = 0; probe < PROBE_LIMIT; ++probe, slot = (slot + 1) & m_mask)
+		{
+			entry_type& entry = m_entries[slot];
+
+			if ((entry.state == slot_state::used) && (entry.address == address))
+			{
+				// An expired entry was as good as absent, so refreshing it
+				// counts as learning, just like a port move does.
+				const bool changed = (entry.port != port) || is_expired(entry, now);
+
+				// Learning refreshes the entry, so active stations never
+				// expire.
+				entry.port = port;
+				entry.last_seen = now;
+
+				return changed;
+			}
+
+			// Expired entries are reclaimable, just like deleted ones.
+			if (((entry.state != slot_state::used) || is_expired(entry, now)) && !free_entry)
+			{
+				free_entry = &entry;
+			}
+
+			if (entry.state == slot_state::empty)
+			{
+				break;
+			}
+		}
+
+		if (!free_entry)
+		{
+			// The whole probe sequence is in use: evict the entry at the
+			// initial slot.
+			free_entry = &m_entries[address.hash() & m_mask];
+		}
+
+		if (free_entry->state != slot_state::used)
+		{
+			m_used_count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		free_entry->address = address;
+		free_entry->port = port;
+		free_entry->last_seen = now;
+		free_entry->state = slot_state::used;
+
+		return true;
+	}
+
+	void switch_::ethernet_address_map_type::erase(const ethernet_address_type& address)
+	{
+		size_t slot = address.hash() & m_mask;
+
+		for (size_t probe = 0; probe < PROBE_LIMIT; ++probe, slot = (slot + 1) & m_mask)
+		{
+			entry_type& entry = m_entries[slot];
+
+			if (entry.state == slot_state::empty)
+			{
+				return;
+			}
+
+			if ((entry.state == slot_state::used) && (entry.address == address))
+			{
+				entry.port = 0;
+				entry.state = slot_state::deleted;
+
+				m_used_count.fetch_sub(1, std::memory_order_relaxed);
+
+				return;
+			}
+		}
+	}
+
+	void switch_::ethernet_address_map_type::erase_port(port_handle_type port)
+	{
+		for (auto&& entry : m_entries)
+		{
+			if ((entry.state == slot_state::used) && (entry.port == port))
+			{
+				entry.port = 0;
+				entry.state = slot_state::deleted;
+
+				m_used_count.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
 	}
 
 	switch_::ethernet_address_type switch_::to_ethernet_address(boost::asio::const_buffer buf)
 	{
-		assert(boost::asio::buffer_size(buf) == ethernet_address_type::static_size);
+		assert(boost::asio::buffer_size(buf) == asiotap::osi::ETHERNET_ADDRESS_SIZE);
 
-		ethernet_address_type result;
+		ethernet_address_type::data_type raw;
 
-		std::memcpy(result.c_array(), boost::asio::buffer_cast<const ethernet_address_type::value_type*>(buf), result.size());
+		std::memcpy(raw.data(), boost::asio::buffer_cast<const uint8_t*>(buf), raw.size());
 
-		return result;
+		return ethernet_address_type(raw);
 	}
 
 	bool switch_::is_multicast_address(const switch_::ethernet_address_type& address)
 	{
-		return ((address[0] & 0x01) != 0x00);
+		return address.is_multicast();
 	}
 }
@@ -0,0 +1,127 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file async_logger.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief An asynchronous log sink.
+ */
+
+#pragma once
+
+#include "logger.hpp"
+
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace fscp
+{
+	/**
+	 * \brief An asynchronous log sink.
+	 *
+	 * Log records are pushed into a bounded ring buffer and written by a
+	 * dedicated thread, so the calling threads never pay for the final
+	 * formatting or the output itself. When the ring buffer is full,
+	 * records are dropped rather than blocking the caller; the count of
+	 * dropped records is reported once the writer catches up.
+	 */
+	class async_logger
+	{
+		public:
+
+			/**
+			 * \brief The log handler type.
+			 */
+			typedef logger::log_handler_type log_handler_type;
+
+			/**
+			 * \brief The default ring buffer capacity, in records.
+			 */
+			static const size_t DEFAULT_CAPACITY = 1024;
+
+			/**
+			 * \brief Create an asynchronous log sink.
+			 * \param handler The handler that writes the records, called from the sink's own thread.
+			 * \param capacity The ring buffer capacity, in records.
+			 */
+			explicit async_logger(log_handler_type handler, size_t capacity = DEFAULT_CAPACITY);
+
+			/**
+			 * \brief Destroy the sink, writing the pending records first.
+			 */
+			~async_logger();
+
+			async_logger(const async_logger&) = delete;
+			async_logger& operator=(const async_logger&) = delete;
+
+			/**
+			 * \brief Queue a log record.
+			 * \param level The log level.
+			 * \param msg The message to log.
+			 * \param timestamp The timestamp.
+			 *
+			 * This method never blocks on the output: when the ring buffer
+			 * is full, the record is dropped.
+			 */
+			void log(log_level level, const std::string& msg, const logger::timestamp_type& timestamp);
+
+		private:
+
+			struct record_type
+			{
+				log_level level;
+				std::string msg;
+				logger::timestamp_type timestamp;
+			};
+
+			void run();
+
+			log_handler_type m_handler;
+			std::vector<record_type> m_ring;
+			size_t m_head;
+			size_t m_count;
+			size_t m_dropped;
+			bool m_stopping;
+			boost::mutex m_mutex;
+			boost::condition_variable m_condition;
+			boost::thread m_thread;
+	};
+}
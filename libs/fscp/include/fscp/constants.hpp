@@ -195,15 +195,47 @@ namespace fscp
 	typedef std::map<hash_type, boost::asio::ip::udp::endpoint> contact_map_type;
 
 	/**
-	 * \brief The sequence number type.
+	 * \brief The contact list type.
+	 *
+	 * A flat alternative to contact_map_type, used when building a contact
+	 * answer: entries are appended in order and no tree nodes are allocated.
+	 */
+	typedef std::vector<std::pair<hash_type, boost::asio::ip::udp::endpoint> > contact_list_type;
+
+	/**
+	 * \brief The sequence number type, as it appears on the wire.
 	 */
 	typedef uint32_t sequence_number_type;
 
+	/**
+	 * \brief The extended sequence number type.
+	 *
+	 * Only the low 32 bits travel on the wire: the high bits are inferred
+	 * from the replay window on receive, IPsec ESN style, so a session no
+	 * longer needs renewing every 2^31 messages.
+	 */
+	typedef uint64_t extended_sequence_number_type;
+
 	/**
 	 * \brief The current protocol version.
 	 */
 	const unsigned char CURRENT_PROTOCOL_VERSION = 3;
 
+	/**
+	 * \brief The compile-time peer capacity.
+	 *
+	 * Embedded deployments with a known small peer count build with the
+	 * FSCP_MAX_PEERS define (see the --max-peers build option): the peer
+	 * tables are then sized for that capacity up front, the buffer pools
+	 * are filled at open() and hosts past the capacity are rejected, so
+	 * the steady state performs no allocation. 0 means unbounded.
+	 */
+#ifdef FSCP_MAX_PEERS
+	const size_t MAX_PEERS = FSCP_MAX_PEERS;
+#else
+	const size_t MAX_PEERS = 0;
+#endif
+
 	/**
 	 * \brief The length of the GCM tag.
 	 */
@@ -211,8 +243,60 @@ namespace fscp
 
 	/**
 	 * \brief The default nonce prefix size.
+	 *
+	 * The prefix plus the 8-bytes extended sequence number must fit the
+	 * 12-bytes AEAD IV that every supported cipher accepts: OpenSSL caps
+	 * the ChaCha20-Poly1305 IV at 12 bytes.
+	 */
+	const size_t DEFAULT_NONCE_PREFIX_SIZE = 4;
+
+	/**
+	 * \brief The session capability flags type.
+	 *
+	 * The flags travel in the first reserved byte of the SESSION message,
+	 * next to the cipher suite: a capability only becomes active once both
+	 * hosts advertised it.
 	 */
-	const size_t DEFAULT_NONCE_PREFIX_SIZE = 8;
+	typedef uint8_t session_capability_flags_type;
+
+	/**
+	 * \brief The LZ4 compression capability: channel data messages carry a compression stage.
+	 */
+	const session_capability_flags_type SESSION_CAPABILITY_LZ4_COMPRESSION = 0x01;
+
+	/**
+	 * \brief The padding capability: channel data messages may carry size-bucket padding.
+	 *
+	 * Advertising the capability only means the host can strip padding on
+	 * receive; whether it pads its own data messages is a local policy.
+	 */
+	const session_capability_flags_type SESSION_CAPABILITY_PADDING = 0x02;
+
+	/**
+	 * \brief Get the session capabilities advertised by this build.
+	 * \return The capability flags.
+	 */
+	inline session_capability_flags_type local_session_capabilities()
+	{
+#ifdef USE_LZ4
+		return SESSION_CAPABILITY_LZ4_COMPRESSION | SESSION_CAPABILITY_PADDING;
+#else
+		return SESSION_CAPABILITY_PADDING;
+#endif
+	}
+
+	/**
+	 * \brief The extension TLV types.
+	 *
+	 * A handshake message may end with a block of extension TLVs - a one
+	 * byte type, a one byte value length and the value - appended after its
+	 * fixed format body. Hosts skip the TLV types they do not know, so a
+	 * feature can be advertised before every host understands it.
+	 */
+	enum extension_tlv_type
+	{
+		EXTENSION_TLV_SESSION_CAPABILITIES = 0x01
+	};
 
 	/**
 	 * \brief The different message types.
@@ -224,6 +308,7 @@ namespace fscp
 		MESSAGE_TYPE_PRESENTATION = 0x02,
 		MESSAGE_TYPE_SESSION_REQUEST = 0x03,
 		MESSAGE_TYPE_SESSION = 0x04,
+		MESSAGE_TYPE_DATA_COALESCED = 0x6F,
 		MESSAGE_TYPE_DATA_0 = 0x70,
 		MESSAGE_TYPE_DATA_1 = 0x71,
 		MESSAGE_TYPE_DATA_2 = 0x72,
@@ -240,6 +325,8 @@ namespace fscp
 		MESSAGE_TYPE_DATA_13 = 0x7D,
 		MESSAGE_TYPE_DATA_14 = 0x7E,
 		MESSAGE_TYPE_DATA_15 = 0x7F,
+		MESSAGE_TYPE_RELAY_FORWARD = 0xF0,
+		MESSAGE_TYPE_RELAY_DELIVER = 0xF1,
 		MESSAGE_TYPE_CONTACT_REQUEST = 0xFD,
 		MESSAGE_TYPE_CONTACT = 0xFE,
 		MESSAGE_TYPE_KEEP_ALIVE = 0xFF
@@ -287,6 +374,7 @@ namespace fscp
 			static const value_type unsupported;
 			static const value_type ecdhe_rsa_aes128_gcm_sha256;
 			static const value_type ecdhe_rsa_aes256_gcm_sha384;
+			static const value_type ecdhe_rsa_chacha20_poly1305_sha256;
 
 			cipher_suite_type() {}
 			cipher_suite_type(value_type _value) : enumeration_type(_value) {}
@@ -297,12 +385,8 @@ namespace fscp
 			 */
 			bool is_valid() const
 			{
-				if ((value() == unsupported) || (value() == ecdhe_rsa_aes128_gcm_sha256) || value() == ecdhe_rsa_aes256_gcm_sha384)
-				{
-					return true;
-				}
-
-				return false;
+				// The suite values are dense: validity is a range check.
+				return (value() <= ecdhe_rsa_chacha20_poly1305_sha256);
 			}
 
 			/**
@@ -323,6 +407,10 @@ namespace fscp
 				{
 					return ecdhe_rsa_aes256_gcm_sha384_string;
 				}
+				else if (value() == ecdhe_rsa_chacha20_poly1305_sha256)
+				{
+					return ecdhe_rsa_chacha20_poly1305_sha256_string;
+				}
 
 				throw std::invalid_argument("Invalid cipher suite value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
 			}
@@ -342,6 +430,10 @@ namespace fscp
 				{
 					return ecdhe_rsa_aes256_gcm_sha384;
 				}
+				else if (str == ecdhe_rsa_chacha20_poly1305_sha256_string)
+				{
+					return ecdhe_rsa_chacha20_poly1305_sha256;
+				}
 
 				throw std::invalid_argument("Invalid cipher suite string representation: " + str);
 			}
@@ -352,20 +444,27 @@ namespace fscp
 			 */
 			cryptoplus::hash::message_digest_algorithm to_message_digest_algorithm() const
 			{
+				// The suite values are dense: a flat table replaces the
+				// former comparison chain on this per-packet path, and
+				// folds to a constant where the suite is statically known.
+				static const int nids[] = {
+					0, // unsupported
+					NID_sha256, // ecdhe_rsa_aes128_gcm_sha256
+					NID_sha384, // ecdhe_rsa_aes256_gcm_sha384
+					NID_sha256, // ecdhe_rsa_chacha20_poly1305_sha256
+				};
+
 				if (value() == unsupported)
 				{
 					throw std::runtime_error("Unsupported cipher suite value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
 				}
-				else if (value() == ecdhe_rsa_aes128_gcm_sha256)
-				{
-					return cryptoplus::hash::message_digest_algorithm(NID_sha256);
-				}
-				else if (value() == ecdhe_rsa_aes256_gcm_sha384)
+
+				if (value() >= sizeof(nids) / sizeof(nids[0]))
 				{
-					return cryptoplus::hash::message_digest_algorithm(NID_sha384);
+					throw std::invalid_argument("Invalid cipher suite value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
 				}
 
-				throw std::invalid_argument("Invalid cipher suite value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
+				return cryptoplus::hash::message_digest_algorithm(nids[value()]);
 			}
 
 			/**
@@ -376,26 +475,50 @@ namespace fscp
 			 */
 			cryptoplus::cipher::cipher_algorithm to_cipher_algorithm() const
 			{
+				// The suite values are dense: a flat table replaces the
+				// former comparison chain on this per-packet path, and
+				// folds to a constant where the suite is statically known.
+				//
+				// ChaCha20-Poly1305 takes the same 12-byte nonce and
+				// produces the same 16-byte tag as GCM, and OpenSSL maps
+				// the GCM control values onto the generic AEAD ones, so
+				// the data message code needs no special casing. A zero
+				// entry means the suite is known but not available in the
+				// linked OpenSSL.
+				static const int nids[] = {
+					0, // unsupported
+					NID_aes_128_gcm, // ecdhe_rsa_aes128_gcm_sha256
+					NID_aes_256_gcm, // ecdhe_rsa_aes256_gcm_sha384
+#ifdef NID_chacha20_poly1305
+					NID_chacha20_poly1305, // ecdhe_rsa_chacha20_poly1305_sha256
+#else
+					0, // ecdhe_rsa_chacha20_poly1305_sha256
+#endif
+				};
+
 				if (value() == unsupported)
 				{
 					throw std::runtime_error("Unsupported cipher suite value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
 				}
-				else if (value() == ecdhe_rsa_aes128_gcm_sha256)
+
+				if (value() >= sizeof(nids) / sizeof(nids[0]))
 				{
-					return cryptoplus::cipher::cipher_algorithm(NID_aes_128_gcm);
+					throw std::invalid_argument("Invalid cipher suite value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
 				}
-				else if (value() == ecdhe_rsa_aes256_gcm_sha384)
+
+				if (nids[value()] == 0)
 				{
-					return cryptoplus::cipher::cipher_algorithm(NID_aes_256_gcm);
+					throw std::runtime_error("The ChaCha20-Poly1305 cipher suite requires OpenSSL 1.1.0 or later");
 				}
 
-				throw std::invalid_argument("Invalid cipher suite value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
+				return cryptoplus::cipher::cipher_algorithm(nids[value()]);
 			}
 
 		private:
 
 			static const std::string ecdhe_rsa_aes128_gcm_sha256_string;
 			static const std::string ecdhe_rsa_aes256_gcm_sha384_string;
+			static const std::string ecdhe_rsa_chacha20_poly1305_sha256_string;
 	};
 
 	/**
@@ -419,12 +542,8 @@ namespace fscp
 			 */
 			bool is_valid() const
 			{
-				if ((value() == unsupported) || (value() == sect571k1) || value() == secp384r1 || value() == secp521r1)
-				{
-					return true;
-				}
-
-				return false;
+				// The curve values are dense: validity is a range check.
+				return (value() <= secp521r1);
 			}
 
 			/**
@@ -484,24 +603,27 @@ namespace fscp
 			 */
 			int to_elliptic_curve_nid() const
 			{
+				// The curve values are dense: a flat table replaces the
+				// former comparison chain, and folds to a constant where
+				// the curve is statically known.
+				static const int nids[] = {
+					0, // unsupported
+					NID_sect571k1, // sect571k1
+					NID_secp384r1, // secp384r1
+					NID_secp521r1, // secp521r1
+				};
+
 				if (value() == unsupported)
 				{
 					throw std::runtime_error("Unsupported elliptic curve value: " + boost::lexical_cast<std::string>(static_cast<int>(value())));
 				}
-				else if (value() == sect571k1)
-				{
-					return NID_sect571k1;
-				}
-				else if (value() == secp384r1)
-				{
-					return NID_secp384r1;
-				}
-				else if (value() == secp521r1)
+
+				if (value() >= sizeof(nids) / sizeof(nids[0]))
 				{
-					return NID_secp521r1;
+					throw std::invalid_argument("Invalid elliptic curve value");
 				}
 
-				throw std::invalid_argument("Invalid elliptic curve value");
+				return nids[value()];
 			}
 
 		private:
@@ -528,7 +650,8 @@ namespace fscp
 	{
 		return {
 			cipher_suite_type::ecdhe_rsa_aes256_gcm_sha384,
-			cipher_suite_type::ecdhe_rsa_aes128_gcm_sha256
+			cipher_suite_type::ecdhe_rsa_aes128_gcm_sha256,
+			cipher_suite_type::ecdhe_rsa_chacha20_poly1305_sha256
 		};
 	}
 
@@ -555,11 +678,41 @@ namespace fscp
 	 */
 	const boost::posix_time::time_duration SESSION_KEEP_ALIVE_PERIOD = boost::posix_time::seconds(10);
 
+	/**
+	 * \brief The default duration during which a previous identity remains active after a rotation.
+	 */
+	const boost::posix_time::time_duration IDENTITY_ROTATION_GRACE_PERIOD = boost::posix_time::minutes(30);
+
 	/**
 	 * \brief The session timeout.
 	 */
 	const boost::posix_time::time_duration SESSION_TIMEOUT = SESSION_KEEP_ALIVE_PERIOD * 3;
 
+	/**
+	 * \brief The longest session keep-alive period the adaptive prober may reach.
+	 */
+	const boost::posix_time::time_duration SESSION_KEEP_ALIVE_MAX_PERIOD = SESSION_KEEP_ALIVE_PERIOD * 10;
+
+	/**
+	 * \brief The count of consecutively survived intervals before a keep-alive period is stretched further.
+	 */
+	const size_t SESSION_KEEP_ALIVE_PROBE_SUCCESSES = 3;
+
+	/**
+	 * \brief The count of bytes a relay forwards for a single source endpoint, per second.
+	 */
+	const size_t RELAY_RATE_BUDGET_BYTES_PER_SECOND = 1048576;
+
+	/**
+	 * \brief The count of packets a relay forwards for a single source endpoint, per second.
+	 */
+	const size_t RELAY_RATE_BUDGET_PACKETS_PER_SECOND = 2048;
+
+	/**
+	 * \brief The grace period during which the previous session keys are still accepted after a renewal.
+	 */
+	const boost::posix_time::time_duration PREVIOUS_SESSION_GRACE_PERIOD = boost::posix_time::seconds(5);
+
 	/**
 	 * \brief The keep-alive data size.
 	 */
@@ -53,6 +53,8 @@
 
 namespace fscp
 {
+	class session_cipher_context;
+
 	/**
 	 * \brief A data message class.
 	 */
@@ -65,6 +67,11 @@ namespace fscp
 			 */
 			typedef cryptoplus::cipher::cipher_algorithm calg_t;
 
+			/**
+			 * \brief The number of bytes of headroom required before a cleartext for in-place message writes.
+			 */
+			static const size_t HEADER_OVERHEAD = HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t);
+
 			/**
 			 * \brief Write a data message to a buffer.
 			 * \param buf The buffer to write to.
@@ -80,7 +87,72 @@ namespace fscp
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
 			 */
-			static size_t write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write(void* buf, size_t buf_len, channel_number_type channel_number, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Write a data message to a buffer, using a session cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param channel_number The channel number.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The session cipher context. Must be keyed for encryption.
+			 * \param cleartext The cleartext data.
+			 * \param cleartext_len The data length.
+			 * \param pad_to The length to pad the cleartext to before sealing. 0 disables padding. See padded_length().
+			 * \return The count of bytes written.
+			 *
+			 * The context is already keyed so only the IV is set, which
+			 * avoids running the key schedule for every message.
+			 */
+			static size_t write(void* buf, size_t buf_len, channel_number_type channel_number, extended_sequence_number_type sequence_number, session_cipher_context& cipher_context, const void* cleartext, size_t cleartext_len, size_t pad_to = 0);
+
+			/**
+			 * \brief Write a coalesced data message to a buffer, using a session cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The session cipher context. Must be keyed for encryption.
+			 * \param cleartext The cleartext data: a sequence of length-prefixed frames.
+			 * \param cleartext_len The data length.
+			 * \param pad_to The length to pad the cleartext to before sealing. 0 disables padding. See padded_length().
+			 * \return The count of bytes written.
+			 */
+			static size_t write_coalesced(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, session_cipher_context& cipher_context, const void* cleartext, size_t cleartext_len, size_t pad_to = 0);
+
+			/**
+			 * \brief Write a data message to a buffer, encrypting the cleartext in place.
+			 * \param buf The buffer to write to. It must already contain the cleartext at cleartext_offset.
+			 * \param buf_len The length of buf.
+			 * \param cleartext_offset The offset of the cleartext within buf. Must be at least HEADER_OVERHEAD: the message is written starting at cleartext_offset - HEADER_OVERHEAD.
+			 * \param cleartext_len The data length.
+			 * \param channel_number The channel number.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param enc_key The encryption key.
+			 * \param enc_key_len The encryption key length.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 *
+			 * The cleartext is encrypted where it lies, so no copy of the
+			 * payload is made. The caller must have reserved HEADER_OVERHEAD
+			 * bytes of headroom before the cleartext.
+			 */
+			static size_t write_in_place(void* buf, size_t buf_len, size_t cleartext_offset, size_t cleartext_len, channel_number_type channel_number, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Write a data message to a buffer, encrypting the cleartext in place with a session cipher context.
+			 * \param buf The buffer to write to. It must already contain the cleartext at cleartext_offset.
+			 * \param buf_len The length of buf.
+			 * \param cleartext_offset The offset of the cleartext within buf. Must be at least HEADER_OVERHEAD: the message is written starting at cleartext_offset - HEADER_OVERHEAD.
+			 * \param cleartext_len The data length.
+			 * \param channel_number The channel number.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The session cipher context. Must be keyed for encryption.
+			 * \param pad_to The length to pad the cleartext to before sealing. 0 disables padding. See padded_length().
+			 * \return The count of bytes written.
+			 */
+			static size_t write_in_place(void* buf, size_t buf_len, size_t cleartext_offset, size_t cleartext_len, channel_number_type channel_number, extended_sequence_number_type sequence_number, session_cipher_context& cipher_context, size_t pad_to = 0);
 
 			/**
 			 * \brief Write a contact-request message to a buffer.
@@ -95,7 +167,7 @@ namespace fscp
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
 			 */
-			static size_t write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write_contact_request(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
 			/**
 			 * \brief Write a contact message to a buffer.
@@ -110,7 +182,26 @@ namespace fscp
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
 			 */
-			static size_t write_contact(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write_contact(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Write a contact message to a buffer.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param contact_list The contact list.
+			 * \param enc_key The encryption key.
+			 * \param enc_key_len The encryption key length.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 *
+			 * The contacts are serialized directly into the region of buf the
+			 * ciphertext will occupy and enciphered in place: this overload
+			 * allocates nothing.
+			 */
+			static size_t write_contact(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const contact_list_type& contact_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
 			/**
 			 * \brief Write a keep-alive message to a buffer.
@@ -125,7 +216,32 @@ namespace fscp
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \return The count of bytes written.
 			 */
-			static size_t write_keep_alive(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+			static size_t write_keep_alive(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Get the padded length for a cleartext length.
+			 * \param cleartext_len The cleartext length.
+			 * \return The bucket cleartext_len rounds up to, including the one-byte padding delimiter.
+			 *
+			 * The buckets quantize the sealed payload sizes an observer can
+			 * see. The table is geared towards tunneled traffic at a
+			 * typical MTU: small control frames collapse into a few coarse
+			 * buckets while near-MTU frames pay only the rounding to the
+			 * next 128-byte step, so the bandwidth overhead stays low where
+			 * the volume is.
+			 */
+			static size_t padded_length(size_t cleartext_len);
+
+			/**
+			 * \brief Get the original length of a padded cleartext.
+			 * \param cleartext The padded cleartext.
+			 * \param cleartext_len The padded cleartext length.
+			 * \return The length of the cleartext without the padding.
+			 *
+			 * If no padding delimiter is found, a std::runtime_error is
+			 * thrown: a peer that negotiated padding always sends it.
+			 */
+			static size_t unpadded_length(const void* cleartext, size_t cleartext_len);
 
 			/**
 			 * \brief Parse the hash list.
@@ -143,6 +259,43 @@ namespace fscp
 			 */
 			static contact_map_type parse_contact_map(const void* buf, size_t buflen);
 
+			/**
+			 * \brief A non-owning view over the serialized contacts of a CONTACT message.
+			 *
+			 * The view iterates the wire records in place: no contact map is
+			 * ever allocated. The buffer must outlive the view.
+			 */
+			class contact_map_view
+			{
+				public:
+
+					/**
+					 * \brief Create a view over the specified buffer.
+					 * \param buf The buffer to iterate.
+					 * \param buflen The length of the buffer to iterate.
+					 */
+					contact_map_view(const void* buf, size_t buflen) :
+						m_ptr(static_cast<const uint8_t*>(buf)),
+						m_end(static_cast<const uint8_t*>(buf) + buflen)
+					{
+					}
+
+					/**
+					 * \brief Read the next contact.
+					 * \param hash The hash to fill.
+					 * \param endpoint The endpoint to fill.
+					 * \return true when a contact was read, false when the view is exhausted.
+					 *
+					 * If a record is malformed, a std::runtime_error is thrown.
+					 */
+					bool next(hash_type& hash, boost::asio::ip::udp::endpoint& endpoint);
+
+				private:
+
+					const uint8_t* m_ptr;
+					const uint8_t* m_end;
+			};
+
 			/**
 			 * \brief Create a data_message and map it on a buffer.
 			 * \param buf The buffer.
@@ -197,9 +350,20 @@ namespace fscp
 			 * \param enc_key_len The encryption key length.
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
+			 * \param sequence_number The extended sequence number, as reconstructed from the replay window.
+			 * \return The count of bytes deciphered.
+			 */
+			size_t get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, extended_sequence_number_type sequence_number) const;
+
+			/**
+			 * \brief Get the clear text data, using a session cipher context.
+			 * \param buf The buffer that must receive the data. If buf is NULL, the function returns the expected size of buf.
+			 * \param buf_len The length of buf.
+			 * \param cipher_context The session cipher context. Must be keyed for decryption.
+			 * \param sequence_number The extended sequence number, as reconstructed from the replay window.
 			 * \return The count of bytes deciphered.
 			 */
-			size_t get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len) const;
+			size_t get_cleartext(void* buf, size_t buf_len, session_cipher_context& cipher_context, extended_sequence_number_type sequence_number) const;
 
 		protected:
 
@@ -223,7 +387,26 @@ namespace fscp
 			 * \param type The message type.
 			 * \return The count of bytes written.
 			 */
-			static size_t raw_write(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type);
+			static size_t raw_write(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type);
+
+			/**
+			 * \brief Write a data message to a buffer, using a session cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The session cipher context. Must be keyed for encryption.
+			 * \param cleartext The cleartext data.
+			 * \param cleartext_len The data length.
+			 * \param type The message type.
+			 * \param pad_to The length to pad the cleartext to before sealing. 0 disables padding.
+			 * \return The count of bytes written.
+			 *
+			 * When pad_to exceeds cleartext_len, a 0x80 delimiter and zeros
+			 * are streamed through the cipher after the cleartext until the
+			 * sealed payload is pad_to bytes long: no padded copy of the
+			 * cleartext is ever made.
+			 */
+			static size_t raw_write(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, session_cipher_context& cipher_context, const void* cleartext, size_t cleartext_len, message_type type, size_t pad_to = 0);
 
 		private:
 
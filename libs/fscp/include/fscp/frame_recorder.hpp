@@ -0,0 +1,173 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file frame_recorder.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A per-thread frame event flight recorder.
+ */
+
+#pragma once
+
+#include "strand_profiler.hpp"
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+
+#include <iosfwd>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * \brief The data-path decision points a frame event can be recorded at.
+	 */
+	enum class trace_point : uint8_t
+	{
+		server_receive = 0,
+		switch_write,
+		router_write,
+	};
+
+	/**
+	 * \brief The verdict recorded for a frame.
+	 */
+	enum class frame_verdict : uint8_t
+	{
+		forwarded = 0,
+		no_target,
+		no_route,
+		unknown_session,
+		replayed,
+		decipher_failed,
+		corrupt_frame,
+	};
+
+	/**
+	 * \brief The per-frame event flight recorder.
+	 *
+	 * Each data-path thread records compact per-frame events - timestamp,
+	 * peer, size, verdict - into its own fixed-size ring, where the newest
+	 * events overwrite the oldest. Recording is a handful of plain stores
+	 * into thread-local storage, without any atomic operation or shared
+	 * cache line: the recorder stays enabled in production, so that the
+	 * last seconds of data-path decisions can be dumped after the fact
+	 * when a frame went missing.
+	 */
+	class frame_recorder
+	{
+		public:
+
+			/**
+			 * \brief The count of events each thread ring holds.
+			 */
+			static const size_t RING_SIZE = 8192;
+
+			/**
+			 * \brief A recorded frame event.
+			 */
+			struct event_type
+			{
+				uint64_t timestamp; /**< The profiling_ticks() timestamp. */
+				uint64_t peer; /**< The compact peer identifier. \see to_peer_id. */
+				uint16_t size; /**< The frame size, saturated at 65535. */
+				trace_point point; /**< The decision point. */
+				frame_verdict verdict; /**< The verdict. */
+			};
+
+			/**
+			 * \brief Build a compact peer identifier from an endpoint.
+			 * \param ep The endpoint.
+			 * \return For IPv4 endpoints, the address and port packed
+			 * losslessly. For IPv6 endpoints, a hash of the address and
+			 * port, with the high bit set.
+			 */
+			static uint64_t to_peer_id(const boost::asio::ip::udp::endpoint& ep);
+
+			/**
+			 * \brief Record a frame event into the calling thread's ring.
+			 * \param point The decision point.
+			 * \param verdict The verdict.
+			 * \param peer The compact peer identifier.
+			 * \param size The frame size.
+			 */
+			static void record(trace_point point, frame_verdict verdict, uint64_t peer, size_t size)
+			{
+				ring_type& ring = local_ring();
+				event_type& event = ring.events[ring.next & (RING_SIZE - 1)];
+
+				event.timestamp = profiling_ticks();
+				event.peer = peer;
+				event.size = (size < 0xffff) ? static_cast<uint16_t>(size) : 0xffff;
+				event.point = point;
+				event.verdict = verdict;
+
+				++ring.next;
+			}
+
+			/**
+			 * \brief Write every recorded event, oldest first within each ring.
+			 * \param os The stream to write to.
+			 *
+			 * Can be called from any thread, at any time. The rings are
+			 * read without synchronization: an event being overwritten
+			 * while the dump runs may come out torn. The recorder trades
+			 * dump fidelity for a zero-cost data path, and a dump is only
+			 * ever taken when something already went wrong.
+			 */
+			static void dump(std::ostream& os);
+
+		private:
+
+			struct ring_type
+			{
+				ring_type() :
+					next(0)
+				{}
+
+				uint64_t next;
+				boost::array<event_type, RING_SIZE> events;
+			};
+
+			static ring_type& local_ring();
+			static std::vector<ring_type*>& rings();
+			static std::mutex& rings_mutex();
+	};
+}
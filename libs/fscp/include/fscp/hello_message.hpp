@@ -97,15 +97,28 @@ namespace fscp
 
 		protected:
 
+			/**
+			 * \brief The layout of the body: the unique number.
+			 */
+			typedef message_layout<sizeof(uint32_t)> body_layout;
+
+			/**
+			 * \brief The field indices in body_layout.
+			 */
+			enum
+			{
+				FIELD_UNIQUE_NUMBER = 0
+			};
+
 			/**
 			 * \brief The length of the body.
 			 */
-			static const size_t BODY_LENGTH = 4;
+			static const size_t BODY_LENGTH = body_layout::SIZE;
 	};
 
 	inline uint32_t hello_message::unique_number() const
 	{
-		return ntohl(buffer_tools::get<uint32_t>(payload(), 0));
+		return ntohl(buffer_tools::get<uint32_t>(payload(), body_layout::field<FIELD_UNIQUE_NUMBER>::OFFSET));
 	}
 }
 
@@ -67,6 +67,17 @@ namespace fscp
 			 */
 			typedef cryptoplus::pkey::pkey key_type;
 
+			/**
+			 * \brief Create an empty identity store.
+			 *
+			 * An empty store carries no credentials: it stands in while a
+			 * deferred identity is being loaded or generated, and must be
+			 * replaced before the first presentation or session.
+			 */
+			identity_store()
+			{
+			}
+
 			/**
 			 * \brief Create a new identity store.
 			 * \param sig_cert The signature certificate.
@@ -75,6 +86,15 @@ namespace fscp
 			 */
 			identity_store(cert_type sig_cert, key_type sig_key, const cryptoplus::buffer& pre_shared_key = cryptoplus::buffer());
 
+			/**
+			 * \brief Check whether the store carries any credential.
+			 * \return true if neither a certificate, a key nor a pre-shared key is set.
+			 */
+			bool empty() const
+			{
+				return !m_sig_cert && !m_sig_key && !m_pre_shared_key;
+			}
+
 			/**
 			 * \brief Get the signature certificate.
 			 * \return The signature certificate.
@@ -102,11 +122,72 @@ namespace fscp
 				return m_pre_shared_key;
 			}
 
+			/**
+			 * \brief Check whether a previous identity is retained.
+			 * \return true if a previous signature certificate and key are available.
+			 */
+			bool has_previous_identity() const
+			{
+				return !!m_prev_sig_cert;
+			}
+
+			/**
+			 * \brief Get the previous signature certificate.
+			 * \return The previous signature certificate, or a null certificate if there is none.
+			 */
+			cert_type previous_signature_certificate() const
+			{
+				return m_prev_sig_cert;
+			}
+
+			/**
+			 * \brief Get the previous signature key.
+			 * \return The previous signature key, or a null key if there is none.
+			 */
+			key_type previous_signature_key() const
+			{
+				return m_prev_sig_key;
+			}
+
+			/**
+			 * \brief Retain the specified identity as the previous identity.
+			 * \param sig_cert The previous signature certificate.
+			 * \param sig_key The previous signature key.
+			 *
+			 * During an identity rotation, the peers that were presented the
+			 * previous certificate keep verifying against it: the previous key
+			 * must remain available to sign for them until they learn the new
+			 * certificate.
+			 */
+			void set_previous_identity(cert_type sig_cert, key_type sig_key)
+			{
+				m_prev_sig_cert = sig_cert;
+				m_prev_sig_key = sig_key;
+
+				if (!!m_prev_sig_cert)
+				{
+					// Warm the DER cache, like the constructor does for the
+					// current certificate.
+					m_prev_sig_cert.der();
+				}
+			}
+
+			/**
+			 * \brief Drop the previous identity, if any.
+			 */
+			void clear_previous_identity()
+			{
+				m_prev_sig_cert = cert_type();
+				m_prev_sig_key = key_type();
+			}
+
 		private:
 
 			cert_type m_sig_cert;
 			key_type m_sig_key;
 			cryptoplus::buffer m_pre_shared_key;
+			cert_type m_prev_sig_cert;
+			key_type m_prev_sig_key;
 	};
 }
 
@@ -46,6 +46,9 @@
 
 #include <iostream>
 #include <sstream>
+#include <atomic>
+
+#include <stdint.h>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
@@ -394,4 +397,193 @@ namespace fscp
 			m_logger.log(m_level, msg);
 		}
 	}
+
+	/**
+	 * \brief A token bucket that rate limits a single logging call site.
+	 *
+	 * A hot error path can be driven by a misbehaving peer at packet rate,
+	 * and the formatting alone then steals CPU from forwarding. Each
+	 * FSCP_LOG_LIMITED call site owns one bucket: while the bucket is empty
+	 * the statement is skipped before any streamed argument is evaluated,
+	 * and the next allowed line reports how many were suppressed.
+	 *
+	 * The counters are relaxed atomics: a race can at worst let an extra
+	 * line or two through, which is harmless for logging.
+	 */
+	class log_rate_limiter
+	{
+		public:
+
+			/**
+			 * \brief The outcome of an acquire attempt.
+			 */
+			class ticket
+			{
+				public:
+
+					/**
+					 * \brief Create a ticket.
+					 * \param allowed Whether the statement may be logged.
+					 * \param suppressed The count of statements suppressed since the last allowed one.
+					 */
+					ticket(bool allowed, uint64_t suppressed) :
+						m_allowed(allowed),
+						m_suppressed(suppressed)
+					{
+					}
+
+					/**
+					 * \brief Check whether the statement may be logged.
+					 */
+					explicit operator bool() const
+					{
+						return m_allowed;
+					}
+
+					/**
+					 * \brief Get the count of statements suppressed since the last allowed one.
+					 * \return The count of suppressed statements.
+					 */
+					uint64_t suppressed() const
+					{
+						return m_suppressed;
+					}
+
+				private:
+
+					bool m_allowed;
+					uint64_t m_suppressed;
+			};
+
+			/**
+			 * \brief Create a full bucket.
+			 */
+			log_rate_limiter() :
+				m_tokens(BURST_SIZE),
+				m_last_refill(now_us()),
+				m_suppressed(0)
+			{
+			}
+
+			/**
+			 * \brief Take a token from the bucket.
+			 * \return A ticket that converts to true if the statement may be logged.
+			 */
+			ticket acquire()
+			{
+				refill();
+
+				if (m_tokens.fetch_sub(1, std::memory_order_relaxed) > 0)
+				{
+					return ticket(true, m_suppressed.exchange(0, std::memory_order_relaxed));
+				}
+
+				// The bucket was empty: the token is given back so the
+				// deficit does not grow without bound.
+				m_tokens.fetch_add(1, std::memory_order_relaxed);
+				m_suppressed.fetch_add(1, std::memory_order_relaxed);
+
+				return ticket(false, 0);
+			}
+
+		private:
+
+			/**
+			 * \brief The refill period: one token per period, so ten lines per second sustained.
+			 */
+			static const int64_t TOKEN_PERIOD_US = 100000;
+
+			/**
+			 * \brief The bucket capacity: a short burst logs in full.
+			 */
+			static const int32_t BURST_SIZE = 10;
+
+			static int64_t now_us()
+			{
+				static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+				return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+			}
+
+			void refill()
+			{
+				int64_t last = m_last_refill.load(std::memory_order_relaxed);
+				const int64_t periods = (now_us() - last) / TOKEN_PERIOD_US;
+
+				if (periods <= 0)
+				{
+					return;
+				}
+
+				if (!m_last_refill.compare_exchange_strong(last, last + periods * TOKEN_PERIOD_US, std::memory_order_relaxed))
+				{
+					// Another thread performed the refill.
+					return;
+				}
+
+				int32_t tokens = m_tokens.load(std::memory_order_relaxed);
+				int32_t target;
+
+				do
+				{
+					const int64_t refilled = static_cast<int64_t>(tokens) + periods;
+					target = (refilled > BURST_SIZE) ? BURST_SIZE : static_cast<int32_t>(refilled);
+				}
+				while (!m_tokens.compare_exchange_weak(tokens, target, std::memory_order_relaxed));
+			}
+
+			std::atomic<int32_t> m_tokens;
+			std::atomic<int64_t> m_last_refill;
+			std::atomic<uint64_t> m_suppressed;
+	};
+
+	/**
+	 * \brief Output the suppression count carried by a ticket.
+	 * \param os The output stream.
+	 * \param _ticket The ticket.
+	 * \return os.
+	 */
+	inline std::ostream& operator<<(std::ostream& os, const log_rate_limiter::ticket& _ticket)
+	{
+		if (_ticket.suppressed() > 0)
+		{
+			os << "(message repeated " << _ticket.suppressed() << " times) ";
+		}
+
+		return os;
+	}
 }
+
+/**
+ * \brief The minimum log level compiled in.
+ *
+ * Statements below that level are elided at compile time by FSCP_LOG, so a
+ * release build can strip the trace logging from the data path entirely.
+ */
+#ifndef FSCP_LOG_MIN_LEVEL
+#define FSCP_LOG_MIN_LEVEL ::fscp::log_level::trace
+#endif
+
+/**
+ * \brief Log to the specified logger, evaluating the streamed arguments only when the level is enabled.
+ *
+ * Unlike calling logger::operator()() directly, the level check happens
+ * before the streamed expressions are evaluated, so disabled statements cost
+ * a single comparison.
+ */
+#define FSCP_LOG(_logger, _level) \
+	if (((_level) < (FSCP_LOG_MIN_LEVEL)) || ((_level) < (_logger).level())) {} else (_logger)(_level)
+
+/**
+ * \brief Log to the specified logger through a per-call-site token bucket.
+ *
+ * Each expansion owns a static ::fscp::log_rate_limiter - the lambda gives
+ * the static a distinct type, and so a distinct instance, per call site.
+ * While the bucket is empty the whole statement is skipped, and the first
+ * line after a dry spell starts with the count of suppressed messages. Use
+ * it on error paths that a misbehaving peer can drive at packet rate.
+ */
+#define FSCP_LOG_LIMITED(_logger, _level) \
+	if (((_level) < (FSCP_LOG_MIN_LEVEL)) || ((_level) < (_logger).level())) {} \
+	else if (const ::fscp::log_rate_limiter::ticket fscp_log_ticket_ = ([]() -> ::fscp::log_rate_limiter& { static ::fscp::log_rate_limiter limiter; return limiter; }()).acquire()) \
+		(_logger)(_level) << fscp_log_ticket_
@@ -0,0 +1,185 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file memory_usage.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief Per-subsystem memory usage accounting.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <ostream>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * \brief The subsystems whose memory usage is accounted.
+	 */
+	enum class memory_subsystem : size_t
+	{
+		buffer_pools = 0,
+		sessions,
+		presentation_stores,
+	};
+
+	/**
+	 * \brief Per-subsystem memory usage counters.
+	 *
+	 * The resident memory of a long-running instance is dominated by a
+	 * few well-identified owners: the shared buffer pools, the peer
+	 * session state and the presentation (certificate) stores. Each of
+	 * them reports its allocations and releases here, so the usage and
+	 * its high-water mark can be attributed per subsystem without a
+	 * heap profiler.
+	 *
+	 * The counters are updated with relaxed atomic operations: an
+	 * accounting call is a couple of relaxed increments on an already
+	 * allocation-sized code path. The figures are deliberate
+	 * approximations - they track the payload bytes the subsystems ask
+	 * for, not the allocator overhead around them.
+	 */
+	class memory_usage
+	{
+		public:
+
+			/**
+			 * \brief The count of accounted subsystems.
+			 */
+			static const size_t SUBSYSTEM_COUNT = 3;
+
+			/**
+			 * \brief Account an allocation.
+			 * \param subsystem The subsystem the memory belongs to.
+			 * \param bytes The count of bytes allocated.
+			 */
+			static void add(memory_subsystem subsystem, uint64_t bytes)
+			{
+				const size_t index = static_cast<size_t>(subsystem);
+
+				const uint64_t new_value = counters()[index].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+				std::atomic<uint64_t>& peak = peaks()[index];
+				uint64_t old_peak = peak.load(std::memory_order_relaxed);
+
+				while ((new_value > old_peak) && !peak.compare_exchange_weak(old_peak, new_value, std::memory_order_relaxed))
+				{
+				}
+			}
+
+			/**
+			 * \brief Account a release.
+			 * \param subsystem The subsystem the memory belonged to.
+			 * \param bytes The count of bytes released. Must match what was accounted by add().
+			 */
+			static void remove(memory_subsystem subsystem, uint64_t bytes)
+			{
+				counters()[static_cast<size_t>(subsystem)].fetch_sub(bytes, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the current usage of a subsystem.
+			 * \param subsystem The subsystem.
+			 * \return The count of bytes currently accounted. A relaxed snapshot intended for diagnostics.
+			 */
+			static uint64_t current(memory_subsystem subsystem)
+			{
+				return counters()[static_cast<size_t>(subsystem)].load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the high-water mark of a subsystem.
+			 * \param subsystem The subsystem.
+			 * \return The highest count of bytes ever accounted at once. A relaxed snapshot intended for diagnostics.
+			 */
+			static uint64_t peak(memory_subsystem subsystem)
+			{
+				return peaks()[static_cast<size_t>(subsystem)].load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the name of a subsystem.
+			 * \param subsystem The subsystem.
+			 * \return The name.
+			 */
+			static const char* name(memory_subsystem subsystem)
+			{
+				static const char* const names[SUBSYSTEM_COUNT] = {
+					"buffer_pools",
+					"sessions",
+					"presentation_stores",
+				};
+
+				return names[static_cast<size_t>(subsystem)];
+			}
+
+			/**
+			 * \brief Write a human-readable report of the usage.
+			 * \param os The stream to write to.
+			 */
+			static void report(std::ostream& os)
+			{
+				for (size_t index = 0; index < SUBSYSTEM_COUNT; ++index)
+				{
+					const memory_subsystem subsystem = static_cast<memory_subsystem>(index);
+
+					os << name(subsystem) << ": " << current(subsystem) << " bytes (peak: " << peak(subsystem) << ")\n";
+				}
+			}
+
+		private:
+
+			static std::atomic<uint64_t>* counters()
+			{
+				// Zero-initialized, like any static storage duration array.
+				static std::atomic<uint64_t> values[SUBSYSTEM_COUNT];
+
+				return values;
+			}
+
+			static std::atomic<uint64_t>* peaks()
+			{
+				static std::atomic<uint64_t> values[SUBSYSTEM_COUNT];
+
+				return values;
+			}
+	};
+}
@@ -47,6 +47,7 @@
 
 #include "buffer_tools.hpp"
 #include "constants.hpp"
+#include "message_layout.hpp"
 
 #include <boost/asio.hpp>
 
@@ -120,10 +121,41 @@ namespace fscp
 
 		protected:
 
+			/**
+			 * \brief The layout of the header, in wire order: the version, the type and the payload length.
+			 */
+			typedef message_layout<sizeof(uint8_t), sizeof(uint8_t), sizeof(uint16_t)> header_layout;
+
+			/**
+			 * \brief The field indices in header_layout.
+			 */
+			enum
+			{
+				FIELD_VERSION = 0,
+				FIELD_TYPE,
+				FIELD_LENGTH
+			};
+
 			/**
 			 * \brief The length of the header.
 			 */
-			static const size_t HEADER_LENGTH = 4;
+			static const size_t HEADER_LENGTH = header_layout::SIZE;
+
+			/**
+			 * \brief Write the extension TLV block advertised by this build.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \return The count of bytes written.
+			 */
+			static size_t write_extensions(uint8_t* buf, size_t buf_len);
+
+			/**
+			 * \brief Parse the session capabilities out of an extension TLV block.
+			 * \param buf The extension block.
+			 * \param buf_len The length of buf.
+			 * \return The advertised capability flags. Unknown TLV types are skipped; a truncated TLV stops the parsing.
+			 */
+			static session_capability_flags_type parse_extensions(const uint8_t* buf, size_t buf_len);
 
 		private:
 
@@ -132,17 +164,17 @@ namespace fscp
 
 	inline unsigned int message::version() const
 	{
-		return buffer_tools::get<uint8_t>(m_data, 0);
+		return buffer_tools::get<uint8_t>(m_data, header_layout::field<FIELD_VERSION>::OFFSET);
 	}
 
 	inline message_type message::type() const
 	{
-		return static_cast<message_type>(buffer_tools::get<uint8_t>(m_data, 1));
+		return static_cast<message_type>(buffer_tools::get<uint8_t>(m_data, header_layout::field<FIELD_TYPE>::OFFSET));
 	}
 
 	inline size_t message::length() const
 	{
-		return ntohs(buffer_tools::get<uint16_t>(m_data, 2));
+		return ntohs(buffer_tools::get<uint16_t>(m_data, header_layout::field<FIELD_LENGTH>::OFFSET));
 	}
 
 	inline const uint8_t* message::data() const
@@ -0,0 +1,112 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file message_layout.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Compile-time message field layout descriptors.
+ */
+
+#ifndef FSCP_MESSAGE_LAYOUT_HPP
+#define FSCP_MESSAGE_LAYOUT_HPP
+
+#include <cstddef>
+
+namespace fscp
+{
+	namespace layout_detail
+	{
+		template <size_t... Sizes>
+		struct sum
+		{
+			static const size_t value = 0;
+		};
+
+		template <size_t First, size_t... Rest>
+		struct sum<First, Rest...>
+		{
+			static const size_t value = First + sum<Rest...>::value;
+		};
+
+		template <size_t Index, size_t... Sizes>
+		struct offset_of;
+
+		template <size_t First, size_t... Rest>
+		struct offset_of<0, First, Rest...>
+		{
+			static const size_t value = 0;
+		};
+
+		template <size_t Index, size_t First, size_t... Rest>
+		struct offset_of<Index, First, Rest...>
+		{
+			static const size_t value = First + offset_of<Index - 1, Rest...>::value;
+		};
+	}
+
+	/**
+	 * \brief A compile-time layout descriptor for the fixed part of a message.
+	 *
+	 * The field sizes are listed in wire order: the cumulative field offsets
+	 * and the total size then come out of the template metadata, so accessors
+	 * read each field at a constant offset instead of recomputing sums, and
+	 * validating the fixed part reduces to a single bounds check against SIZE.
+	 */
+	template <size_t... FieldSizes>
+	struct message_layout
+	{
+		/**
+		 * \brief The total size of the described fields.
+		 */
+		static const size_t SIZE = layout_detail::sum<FieldSizes...>::value;
+
+		/**
+		 * \brief The field at the specified index, in wire order.
+		 */
+		template <size_t Index>
+		struct field
+		{
+			/**
+			 * \brief The offset of the field, relative to the first described field.
+			 */
+			static const size_t OFFSET = layout_detail::offset_of<Index, FieldSizes...>::value;
+		};
+	};
+}
+
+#endif /* FSCP_MESSAGE_LAYOUT_HPP */
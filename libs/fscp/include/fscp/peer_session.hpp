@@ -50,13 +50,76 @@
 #include <cryptoplus/buffer.hpp>
 #include <cryptoplus/random/random.hpp>
 #include <cryptoplus/pkey/ecdhe.hpp>
+#include <cryptoplus/cipher/cipher_context.hpp>
 
 #include <boost/optional.hpp>
+#include <boost/array.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/make_shared.hpp>
 
 namespace fscp
 {
+	/**
+	 * \brief A session-scoped cipher context.
+	 *
+	 * The underlying EVP cipher context is keyed once, when the session keys
+	 * are derived: ciphering a data message then only requires setting the
+	 * IV, which avoids running the key schedule for every packet.
+	 */
+	class session_cipher_context : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The cipher direction type.
+			 */
+			typedef cryptoplus::cipher::cipher_context::cipher_direction cipher_direction;
+
+			/**
+			 * \brief Create a session cipher context.
+			 * \param cipher_algorithm The cipher algorithm.
+			 * \param direction The cipher direction.
+			 * \param key The session key.
+			 * \param nonce_prefix The session nonce prefix.
+			 */
+			session_cipher_context(cryptoplus::cipher::cipher_algorithm cipher_algorithm, cipher_direction direction, const cryptoplus::buffer& key, const cryptoplus::buffer& nonce_prefix);
+
+			/**
+			 * \brief Get the cipher algorithm.
+			 * \return The cipher algorithm.
+			 */
+			cryptoplus::cipher::cipher_algorithm cipher_algorithm() const { return m_cipher_algorithm; }
+
+			/**
+			 * \brief Get the nonce prefix.
+			 * \return The nonce prefix.
+			 */
+			const cryptoplus::buffer& nonce_prefix() const { return m_nonce_prefix; }
+
+			/**
+			 * \brief Get the underlying keyed cipher context.
+			 * \return The cipher context.
+			 */
+			cryptoplus::cipher::cipher_context& context() { return m_context; }
+
+			/**
+			 * \brief Format the IV for the specified sequence number.
+			 * \param sequence_number The sequence number.
+			 * \return A pointer to the formatted IV, valid until the next call.
+			 *
+			 * The nonce prefix part of the IV was written once, at
+			 * construction: only the two counter words are overwritten.
+			 */
+			const uint8_t* format_iv(extended_sequence_number_type sequence_number);
+
+		private:
+
+			cryptoplus::cipher::cipher_algorithm m_cipher_algorithm;
+			cryptoplus::buffer m_nonce_prefix;
+			cryptoplus::cipher::cipher_context m_context;
+			std::vector<uint8_t> m_iv;
+	};
+
 	/**
 	 * \brief A peer session storage class.
 	 */
@@ -81,38 +144,145 @@ namespace fscp
 
 			struct next_session_type
 			{
+				next_session_type(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve, boost::shared_ptr<cryptoplus::pkey::ecdhe_context> _ecdhe_context) :
+					ecdhe_context(_ecdhe_context),
+					parameters(_session_number, _cipher_suite, _elliptic_curve, ecdhe_context->get_public_key()),
+					derivation_pending(false)
+				{}
+
+				/**
+				 * \brief Prepare a resumed session, which carries no public key: the keys derive from the previous epoch's ratchet secret.
+				 */
 				next_session_type(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve) :
-					ecdhe_context(_elliptic_curve.to_elliptic_curve_nid()),
-					parameters(_session_number, _cipher_suite, _elliptic_curve, ecdhe_context.get_public_key())
+					ecdhe_context(),
+					parameters(_session_number, _cipher_suite, _elliptic_curve, cryptoplus::buffer()),
+					derivation_pending(false)
 				{}
 
-				cryptoplus::pkey::ecdhe_context ecdhe_context;
+				bool is_resumption() const { return !ecdhe_context; }
+
+				boost::shared_ptr<cryptoplus::pkey::ecdhe_context> ecdhe_context;
 				session_parameters parameters;
+
+				// Set when the session keys are being computed outside of the
+				// session strand, so the derivation is not started twice.
+				bool derivation_pending;
 			};
 
 			struct current_session_type
 			{
+				/**
+				 * \brief The size of the replay protection window, in sequence numbers.
+				 */
+				static const size_t REPLAY_WINDOW_SIZE = 1024;
+
+				/**
+				 * \brief The size of the ratchet secret, in bytes.
+				 */
+				static const size_t RATCHET_SECRET_SIZE = 32;
+
+				/**
+				 * \brief The key-usage bound, in messages, past which the session keys must not be used anymore.
+				 */
+				static const extended_sequence_number_type KEY_USAGE_BOUND = static_cast<extended_sequence_number_type>(1) << 48;
+
+				/**
+				 * \brief The number of messages before the key-usage bound at which the next epoch is prepared.
+				 */
+				static const extended_sequence_number_type REKEY_AHEAD_MARGIN = static_cast<extended_sequence_number_type>(1) << 20;
+
 				explicit current_session_type(const session_parameters& _parameters) :
 					parameters(_parameters),
 					local_sequence_number(),
 					remote_sequence_number()
-				{}
+				{
+					replay_window.assign(0);
+				}
 
 				bool is_old() const;
 
+				/**
+				 * \brief Check whether the next epoch should be prepared.
+				 *
+				 * This returns true slightly before is_old() does, so the
+				 * next epoch keys can be established while the current ones
+				 * are still usable and the switch does not interrupt traffic.
+				 */
+				bool needs_renewal() const;
+
 				session_parameters parameters;
-				sequence_number_type local_sequence_number;
-				sequence_number_type remote_sequence_number;
+				extended_sequence_number_type local_sequence_number;
+				extended_sequence_number_type remote_sequence_number;
+
+				// A RFC 6479 style bitmap over the last REPLAY_WINDOW_SIZE
+				// sequence numbers, so reordered-but-fresh data messages are
+				// accepted while duplicates are still rejected. As per the
+				// RFC, the bitmap holds one word more than the window needs:
+				// the window straddles up to REPLAY_WINDOW_SIZE / 64 + 1
+				// words, so with a smaller bitmap advancing across a word
+				// boundary would clear the word that still covers the oldest
+				// in-window sequence numbers and allow their replay.
+				boost::array<uint64_t, REPLAY_WINDOW_SIZE / 64 + 1> replay_window;
+
 				cryptoplus::buffer local_session_key;
 				cryptoplus::buffer remote_session_key;
 				cryptoplus::buffer local_nonce_prefix;
 				cryptoplus::buffer remote_nonce_prefix;
+
+				// The keyed cipher contexts, shared so ciphering operations
+				// deferred to another strand can outlive a session renewal.
+				boost::shared_ptr<session_cipher_context> local_cipher_context;
+				boost::shared_ptr<session_cipher_context> remote_cipher_context;
+
+				// A secret both hosts derive identically from the epoch's
+				// master secret. A renewal can derive the next epoch's keys
+				// from it instead of running a new ECDHE exchange.
+				cryptoplus::buffer ratchet_secret;
+			};
+
+			/**
+			 * \brief A serializable image of an established session.
+			 *
+			 * A snapshot captures everything a fresh process needs to resume
+			 * the session without renegotiating: the host identifiers, the
+			 * negotiated parameters, the session keys and the sequence
+			 * counters. The replay window is deliberately not part of it:
+			 * restore_from_snapshot() compensates with a sequence number
+			 * margin instead.
+			 */
+			struct session_snapshot
+			{
+				/**
+				 * \brief The margin added to the local sequence number upon restoration.
+				 *
+				 * The old process may have sent messages after the snapshot was
+				 * taken: skipping ahead guarantees the resumed session never
+				 * reuses a sequence number (and thus a GCM nonce), as long as
+				 * fewer than this many messages were sent in the meantime.
+				 */
+				static const extended_sequence_number_type RESTORE_SEQUENCE_MARGIN = static_cast<extended_sequence_number_type>(1) << 20;
+
+				host_identifier_type local_host_identifier;
+				host_identifier_type remote_host_identifier;
+				session_capability_flags_type remote_capabilities;
+				session_number_type session_number;
+				cipher_suite_type cipher_suite;
+				elliptic_curve_type elliptic_curve;
+				extended_sequence_number_type local_sequence_number;
+				extended_sequence_number_type remote_sequence_number;
+				cryptoplus::buffer local_session_key;
+				cryptoplus::buffer remote_session_key;
+				cryptoplus::buffer local_nonce_prefix;
+				cryptoplus::buffer remote_nonce_prefix;
+				cryptoplus::buffer ratchet_secret;
 			};
 
 			peer_session() :
 				m_local_host_identifier(),
 				m_remote_host_identifier(),
-				m_last_sign_of_life(boost::posix_time::microsec_clock::local_time())
+				m_remote_capabilities(0x00),
+				m_last_sign_of_life(boost::posix_time::microsec_clock::local_time()),
+				m_last_data_sent(boost::posix_time::min_date_time)
 			{
 				// Generate a random host identifier.
 				cryptoplus::random::get_random_bytes(m_local_host_identifier.data.data(), m_local_host_identifier.data.size());
@@ -142,6 +312,30 @@ namespace fscp
 			 */
 			boost::optional<host_identifier_type> remote_host_identifier() const { return m_remote_host_identifier; }
 
+			/**
+			 * \brief Set the session capabilities advertised by the remote host.
+			 * \param capabilities The capability flags.
+			 */
+			void set_remote_session_capabilities(session_capability_flags_type capabilities) { m_remote_capabilities = capabilities; }
+
+			/**
+			 * \brief Get the session capabilities active with the remote host.
+			 * \return The capability flags advertised by both hosts.
+			 */
+			session_capability_flags_type negotiated_session_capabilities() const { return static_cast<session_capability_flags_type>(m_remote_capabilities & local_session_capabilities()); }
+
+			/**
+			 * \brief Check whether the LZ4 compression stage is active with the remote host.
+			 * \return true if both hosts advertised the capability.
+			 */
+			bool compression_enabled() const { return (negotiated_session_capabilities() & SESSION_CAPABILITY_LZ4_COMPRESSION) != 0; }
+
+			/**
+			 * \brief Check whether the remote host strips padding from data messages.
+			 * \return true if both hosts advertised the capability.
+			 */
+			bool padding_enabled() const { return (negotiated_session_capabilities() & SESSION_CAPABILITY_PADDING) != 0; }
+
 			/**
 			 * \brief Check if the session has timed out.
 			 * \param timeout The timeout value.
@@ -160,14 +354,72 @@ namespace fscp
 				m_last_sign_of_life = boost::posix_time::microsec_clock::local_time();
 			}
 
+			/**
+			 * \brief Get the date of the last sign of life.
+			 * \return The date of the last sign of life.
+			 */
+			const boost::posix_time::ptime& last_sign_of_life() const
+			{
+				return m_last_sign_of_life;
+			}
+
+			/**
+			 * \brief Record that a data message was sent to the remote host.
+			 *
+			 * An outgoing data message refreshes the NAT mapping and proves
+			 * our liveness to the peer just as a keep-alive would: the
+			 * keep-alive schedule backs off while data is flowing out.
+			 */
+			void data_sent()
+			{
+				m_last_data_sent = boost::posix_time::microsec_clock::local_time();
+			}
+
+			/**
+			 * \brief Get the date of the last data message sent to the remote host.
+			 * \return The date. The minimum date when no data was ever sent.
+			 */
+			const boost::posix_time::ptime& last_data_sent() const
+			{
+				return m_last_data_sent;
+			}
+
 			/**
 			 * \brief Prepare the next session.
 			 * \param _session_number The next session number.
 			 * \param _cipher_suite The next cipher suite.
 			 * \param _elliptic_curve The next elliptic curve.
+			 * \param _ecdhe_context A pre-generated ECDHE context to use. If null, a new one is created, which generates a keypair on the spot.
 			 * \return true if a new session was created.
 			 */
-			bool prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve);
+			bool prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve, boost::shared_ptr<cryptoplus::pkey::ecdhe_context> _ecdhe_context = boost::shared_ptr<cryptoplus::pkey::ecdhe_context>());
+
+			/**
+			 * \brief Check whether the next session can be resumed from the current one's ratchet secret.
+			 * \param _cipher_suite The next cipher suite.
+			 * \param _elliptic_curve The next elliptic curve.
+			 * \return true if a current session exists, holds a ratchet secret and uses the same parameters.
+			 */
+			bool can_resume_session(cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve) const;
+
+			/**
+			 * \brief Prepare the next session as a resumption of the current one.
+			 * \param _session_number The next session number.
+			 * \param _cipher_suite The next cipher suite.
+			 * \param _elliptic_curve The next elliptic curve.
+			 * \return true if a new session was created.
+			 *
+			 * The prepared session carries no public key: its keys are to be
+			 * derived from the current session's ratchet secret, which skips
+			 * the ECDHE exchange entirely.
+			 */
+			bool prepare_session_resumption(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve);
+
+			/**
+			 * \brief Get the current session's ratchet secret.
+			 * \return The ratchet secret. An empty buffer if there is no current session.
+			 */
+			cryptoplus::buffer ratchet_secret() const { return m_current_session ? m_current_session->ratchet_secret : cryptoplus::buffer(); }
 
 			/**
 			 * \brief Complete the next session.
@@ -177,6 +429,55 @@ namespace fscp
 			 */
 			bool complete_session(const void* remote_public_key, size_t remote_public_key_size);
 
+			/**
+			 * \brief Check if a session is being prepared.
+			 * \return true if a session is being prepared.
+			 */
+			bool has_next_session() const { return static_cast<bool>(m_next_session); }
+
+			/**
+			 * \brief Get the session being prepared, if any.
+			 * \return The session being prepared.
+			 */
+			boost::shared_ptr<next_session_type> next_session() const { return m_next_session; }
+
+			/**
+			 * \brief Compute the session keys for a prepared session.
+			 * \param _next_session The session being prepared.
+			 * \param local_host_identifier The local host identifier.
+			 * \param remote_host_identifier The remote host identifier.
+			 * \param remote_public_key The remote public key.
+			 * \return The computed session.
+			 *
+			 * This function only depends on its arguments: the expensive ECDHE
+			 * derivation can thus run on any thread, outside of the strand that
+			 * owns the peer session.
+			 */
+			static boost::shared_ptr<current_session_type> compute_session_keys(next_session_type& _next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& remote_public_key);
+
+			/**
+			 * \brief Compute the session keys for a resumed session.
+			 * \param _next_session The session being prepared.
+			 * \param local_host_identifier The local host identifier.
+			 * \param remote_host_identifier The remote host identifier.
+			 * \param _ratchet_secret The previous epoch's ratchet secret.
+			 * \return The computed session.
+			 *
+			 * The epoch's master secret is ratcheted forward from
+			 * _ratchet_secret instead of being derived from an ECDHE
+			 * exchange. Like compute_session_keys(), this function only
+			 * depends on its arguments and can run on any thread.
+			 */
+			static boost::shared_ptr<current_session_type> compute_resumed_session_keys(next_session_type& _next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& _ratchet_secret);
+
+			/**
+			 * \brief Install previously computed session keys.
+			 * \param _next_session The session the keys were computed for.
+			 * \param _current_session The computed session.
+			 * \return true if the keys were installed. false if another session was prepared in the meantime, in which case the computed keys are stale and were discarded.
+			 */
+			bool install_session_keys(boost::shared_ptr<next_session_type> _next_session, boost::shared_ptr<current_session_type> _current_session);
+
 			/**
 			 * \brief Get the next session number.
 			 * \return The next session number.
@@ -211,14 +512,63 @@ namespace fscp
 			 * \brief Increment the local sequence number.
 			 * \return Return the current sequence number and increment it afterwards.
 			 */
-			sequence_number_type increment_local_sequence_number() { return ++m_current_session->local_sequence_number; }
+			extended_sequence_number_type increment_local_sequence_number() { return ++m_current_session->local_sequence_number; }
+
+			/**
+			 * \brief Reconstruct the extended sequence number of a received data message.
+			 * \param sequence_number The low 32 bits, as they appear on the wire.
+			 * \return The extended sequence number whose low 32 bits match and which is the closest to the top of the replay window.
+			 */
+			extended_sequence_number_type reconstruct_sequence_number(sequence_number_type sequence_number) const;
+
+			/**
+			 * \brief Reconstruct the extended sequence number of a received data message, for a given session.
+			 * \param session The session whose replay window serves as a reference.
+			 * \param sequence_number The low 32 bits, as they appear on the wire.
+			 * \return The extended sequence number whose low 32 bits match and which is the closest to the top of the replay window.
+			 */
+			static extended_sequence_number_type reconstruct_sequence_number(const current_session_type& session, sequence_number_type sequence_number);
+
+			/**
+			 * \brief Check whether a remote sequence number would be accepted by the replay protection window.
+			 * \param sequence_number The remote extended sequence number.
+			 * \return true if the sequence number is fresh: ahead of the window, or within the window and not seen yet.
+			 */
+			bool is_acceptable_sequence_number(extended_sequence_number_type sequence_number) const;
 
 			/**
-			 * \brief Set the remote sequence number.
-			 * \param sequence_number The remote sequence number.
-			 * \return true if the sequence number was incremented with the new value, false is the current sequence number is greater than sequence_number.
+			 * \brief Check whether a remote sequence number would be accepted by the replay protection window of a given session.
+			 * \param session The session whose replay window is queried.
+			 * \param sequence_number The remote extended sequence number.
+			 * \return true if the sequence number is fresh: ahead of the window, or within the window and not seen yet.
 			 */
-			bool set_remote_sequence_number(sequence_number_type sequence_number);
+			static bool is_acceptable_sequence_number(const current_session_type& session, extended_sequence_number_type sequence_number);
+
+			/**
+			 * \brief Register a remote sequence number into the replay protection window.
+			 * \param sequence_number The remote extended sequence number.
+			 * \return true if the sequence number was fresh and was registered, false if it was a duplicate or fell out of the window.
+			 */
+			bool register_remote_sequence_number(extended_sequence_number_type sequence_number);
+
+			/**
+			 * \brief Register a remote sequence number into the replay protection window of a given session.
+			 * \param session The session whose replay window is updated.
+			 * \param sequence_number The remote extended sequence number.
+			 * \return true if the sequence number was fresh and was registered, false if it was a duplicate or fell out of the window.
+			 */
+			static bool register_remote_sequence_number(current_session_type& session, extended_sequence_number_type sequence_number);
+
+			/**
+			 * \brief Get the previous session, if it is still within its grace period.
+			 * \return The previous session, or a null pointer if there is none or if its grace period has elapsed.
+			 *
+			 * After a renewal, data messages ciphered with the previous epoch
+			 * keys may still be in flight: the previous session is kept
+			 * around briefly so such messages are delivered instead of being
+			 * dropped by the switch.
+			 */
+			boost::shared_ptr<current_session_type> previous_session();
 
 			/**
 			 * \brief Clear the current session.
@@ -226,15 +576,43 @@ namespace fscp
 			 */
 			bool clear();
 
+			/**
+			 * \brief Take a snapshot of the current session.
+			 * \param snapshot The snapshot to fill.
+			 * \return true if a current session exists and the snapshot was taken.
+			 */
+			bool make_snapshot(session_snapshot& snapshot) const;
+
+			/**
+			 * \brief Restore a session from a snapshot.
+			 * \param snapshot The snapshot, as taken by make_snapshot() in another process.
+			 * \return true if the session was restored. false if a current session already exists.
+			 *
+			 * The cipher contexts are rekeyed from the snapshot keys. The
+			 * local sequence number is advanced by
+			 * session_snapshot::RESTORE_SEQUENCE_MARGIN and the replay window
+			 * starts empty, anchored at the snapshot's remote sequence
+			 * number: in-flight messages from before the handover are
+			 * accepted, at the cost of tolerating a duplicate within the
+			 * window once.
+			 */
+			bool restore_from_snapshot(const session_snapshot& snapshot);
+
 		private:
 
+			static boost::shared_ptr<current_session_type> expand_session_keys(next_session_type& _next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& secret_key);
+
 			host_identifier_type m_local_host_identifier;
 			boost::optional<host_identifier_type> m_remote_host_identifier;
+			session_capability_flags_type m_remote_capabilities;
 
 			boost::posix_time::ptime m_last_sign_of_life;
+			boost::posix_time::ptime m_last_data_sent;
 
 			boost::shared_ptr<next_session_type> m_next_session;
 			boost::shared_ptr<current_session_type> m_current_session;
+			boost::shared_ptr<current_session_type> m_previous_session;
+			boost::posix_time::ptime m_previous_session_expires;
 	};
 }
 
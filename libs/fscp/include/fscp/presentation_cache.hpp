@@ -0,0 +1,153 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file presentation_cache.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A persistent presentation cache class.
+ */
+
+#ifndef FSCP_PRESENTATION_CACHE_HPP
+#define FSCP_PRESENTATION_CACHE_HPP
+
+#include "constants.hpp"
+
+#include <cryptoplus/x509/certificate.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
+
+namespace boost
+{
+	namespace interprocess
+	{
+		class file_mapping;
+		class mapped_region;
+	}
+}
+
+namespace fscp
+{
+	/**
+	 * \brief A persistent presentation cache class.
+	 *
+	 * The cache is a flat file of fingerprint-indexed DER certificate
+	 * records, memory-mapped and indexed lazily on first access: a
+	 * restarted node can validate returning peers without a full
+	 * presentation exchange, at the cost of a single mmap and one pass
+	 * over the file.
+	 *
+	 * Only certificates are ever written to the file: pre-shared keys
+	 * never reach the disk.
+	 *
+	 * The cache is not thread-safe: the caller is responsible for
+	 * serializing accesses (the server does so on its presentation
+	 * strand).
+	 */
+	class presentation_cache : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The certificate type.
+			 */
+			typedef cryptoplus::x509::certificate cert_type;
+
+			/**
+			 * \brief Create a presentation cache backed by the specified file.
+			 * \param path The cache file path.
+			 *
+			 * The file is neither opened nor created until the cache is
+			 * first used.
+			 */
+			explicit presentation_cache(const std::string& path);
+
+			~presentation_cache();
+
+			/**
+			 * \brief Look up a certificate by its fingerprint.
+			 * \param hash The certificate hash.
+			 * \return The certificate, if any.
+			 */
+			boost::optional<cert_type> find(const hash_type& hash);
+
+			/**
+			 * \brief Look up the certificate last presented from the specified endpoint.
+			 * \param endpoint The endpoint, in its textual representation.
+			 * \return The certificate, if any.
+			 */
+			boost::optional<cert_type> find(const std::string& endpoint);
+
+			/**
+			 * \brief Store a presented certificate.
+			 * \param endpoint The endpoint that presented the certificate, in its textual representation.
+			 * \param cert The certificate.
+			 *
+			 * Storing the certificate an endpoint already has on record is
+			 * a no-op, so repeated presentations do not grow the file.
+			 */
+			void store(const std::string& endpoint, cert_type cert);
+
+		private:
+
+			struct record_location
+			{
+				hash_type hash;
+				size_t der_offset;
+				uint32_t der_size;
+			};
+
+			void ensure_loaded();
+			void ensure_mapped();
+			boost::optional<cert_type> load_record(const record_location& location);
+
+			std::string m_path;
+			bool m_loaded;
+			size_t m_valid_size;
+			boost::shared_ptr<boost::interprocess::file_mapping> m_mapping;
+			boost::shared_ptr<boost::interprocess::mapped_region> m_region;
+			std::map<hash_type, record_location> m_hash_index;
+			std::map<std::string, record_location> m_endpoint_index;
+	};
+}
+
+#endif /* FSCP_PRESENTATION_CACHE_HPP */
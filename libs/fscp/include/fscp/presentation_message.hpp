@@ -47,6 +47,7 @@
 
 #include "message.hpp"
 
+#include <cryptoplus/buffer.hpp>
 #include <cryptoplus/x509/certificate.hpp>
 
 namespace fscp
@@ -72,6 +73,15 @@ namespace fscp
 			 */
 			static size_t write(void* buf, size_t buf_len, cert_type sig_cert);
 
+			/**
+			 * \brief Write a presentation message from a pre-encoded certificate.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sig_cert_der The DER encoding of the signature certificate. May be empty.
+			 * \return The count of bytes written.
+			 */
+			static size_t write(void* buf, size_t buf_len, const cryptoplus::buffer& sig_cert_der);
+
 			/**
 			 * \brief Create a presentation_message and map it on a buffer.
 			 * \param buf The buffer.
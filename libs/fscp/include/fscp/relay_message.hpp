@@ -0,0 +1,142 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file relay_message.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A relay message class.
+ */
+
+#ifndef FSCP_RELAY_MESSAGE_HPP
+#define FSCP_RELAY_MESSAGE_HPP
+
+#include "message.hpp"
+
+#include <boost/asio.hpp>
+
+namespace fscp
+{
+	/**
+	 * \brief A relay message class.
+	 *
+	 * A relay message encapsulates a complete FSCP datagram together with an
+	 * endpoint. On a MESSAGE_TYPE_RELAY_FORWARD message, the endpoint is the
+	 * destination the relay must deliver the datagram to; on a
+	 * MESSAGE_TYPE_RELAY_DELIVER message, it is the original sender the
+	 * datagram came from.
+	 *
+	 * The encapsulated datagram keeps its end-to-end protection: the relay
+	 * never signs nor deciphers anything on behalf of the two hosts.
+	 */
+	class relay_message : public message
+	{
+		public:
+
+			/**
+			 * \brief The endpoint type.
+			 */
+			typedef boost::asio::ip::udp::endpoint ep_type;
+
+			/**
+			 * \brief The maximum overhead a relay message adds on top of the encapsulated datagram: the header, the endpoint type, an IPv6 address and the port.
+			 */
+			static const size_t MAX_OVERHEAD = HEADER_LENGTH + 1 + 16 + sizeof(uint16_t);
+
+			/**
+			 * \brief Write a relay message to a buffer.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param type The message type. Must be MESSAGE_TYPE_RELAY_FORWARD or MESSAGE_TYPE_RELAY_DELIVER.
+			 * \param endpoint The endpoint to write.
+			 * \param data The encapsulated datagram.
+			 * \param data_len The length of data.
+			 * \return The count of bytes written.
+			 */
+			static size_t write(void* buf, size_t buf_len, message_type type, const ep_type& endpoint, const void* data, size_t data_len);
+
+			/**
+			 * \brief Create a relay_message and map it on a buffer.
+			 * \param buf The buffer.
+			 * \param buf_len The buffer length.
+			 *
+			 * If the mapping fails, a std::runtime_error is thrown.
+			 */
+			relay_message(const void* buf, size_t buf_len);
+
+			/**
+			 * \brief Create a relay_message from a message.
+			 * \param message The message.
+			 */
+			relay_message(const message& message);
+
+			/**
+			 * \brief Get the endpoint.
+			 * \return The endpoint.
+			 */
+			ep_type endpoint() const;
+
+			/**
+			 * \brief Get the encapsulated datagram.
+			 * \return The encapsulated datagram.
+			 */
+			const uint8_t* relayed_data() const;
+
+			/**
+			 * \brief Get the size of the encapsulated datagram.
+			 * \return The size of the encapsulated datagram.
+			 */
+			size_t relayed_data_size() const;
+
+		protected:
+
+			/**
+			 * \brief The length of the endpoint part, for the specified endpoint.
+			 * \param endpoint The endpoint.
+			 * \return The length.
+			 */
+			static size_t endpoint_length(const ep_type& endpoint);
+
+		private:
+
+			size_t parse_endpoint_length() const;
+
+			void check_format() const;
+	};
+}
+
+#endif /* FSCP_RELAY_MESSAGE_HPP */
@@ -52,22 +52,37 @@
 #include "presentation_store.hpp"
 #include "peer_session.hpp"
 #include "logger.hpp"
+#include "strand_profiler.hpp"
+#include "tcp_transport.hpp"
+#include "timer_service.hpp"
 
 #ifdef USE_UPNP
 #include "miniupnpcplus/upnp_device.hpp"
 #endif
 
+#include <boost/array.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <cryptoplus/os.hpp>
 
 #include <set>
 #include <map>
 #include <queue>
+#include <deque>
+#include <vector>
 #include <iostream>
+#include <atomic>
 
 #include <stdint.h>
 
+#ifdef LINUX
+#include <sys/socket.h>
+#endif
+
 namespace fscp
 {
 	class hello_message;
@@ -77,6 +92,8 @@ namespace fscp
 	class session_message;
 	class clear_session_message;
 	class data_message;
+	class relay_message;
+	class presentation_cache;
 
 	/**
 	 * \brief A FSCP server.
@@ -139,6 +156,11 @@ namespace fscp
 			 */
 			typedef boost::function<void (const boost::system::error_code&, const boost::posix_time::time_duration& duration)> duration_handler_type;
 
+			/**
+			 * \brief A path MTU discovery handler.
+			 */
+			typedef boost::function<void (const boost::system::error_code&, size_t mtu)> mtu_handler_type;
+
 			/**
 			 * \brief An optional presentation store handler.
 			 */
@@ -149,6 +171,11 @@ namespace fscp
 			 */
 			typedef boost::function<void (const std::set<ep_type>&)> endpoints_handler_type;
 
+			/**
+			 * \brief A session state handler.
+			 */
+			typedef boost::function<void (const cryptoplus::buffer&)> session_state_handler_type;
+
 			// Callbacks
 
 			/**
@@ -179,6 +206,22 @@ namespace fscp
 			 */
 			typedef boost::function<bool (const ep_type& sender, cert_type sig_cert, presentation_status_type status, bool has_session)> presentation_message_received_handler_type;
 
+			/**
+			 * \brief A handler for reporting the asynchronous acceptance result of a presentation message.
+			 * \param accepted true to accept the presentation message for the originating host.
+			 */
+			typedef boost::function<void (bool accepted)> presentation_acceptance_handler_type;
+
+			/**
+			 * \brief An asynchronous handler for when presentation requests are received.
+			 * \param sender The endpoint that sent the presentation message.
+			 * \param sig_cert The signature certificate.
+			 * \param status The presentation status.
+			 * \param has_session Tell if a session currently exists with the host.
+			 * \param acceptance_handler The handler that must eventually be called with the acceptance result. It may be called from any thread, which allows expensive verification work to run outside the presentation strand.
+			 */
+			typedef boost::function<void (const ep_type& sender, cert_type sig_cert, presentation_status_type status, bool has_session, presentation_acceptance_handler_type acceptance_handler)> presentation_message_received_async_handler_type;
+
 			/**
 			 * \brief A handler for when session requests are received.
 			 * \param sender The endpoint that sent the session request message.
@@ -274,6 +317,18 @@ namespace fscp
 			 */
 			server(boost::asio::io_service& io_service, fscp::logger& _logger, const identity_store& identity);
 
+			/**
+			 * \brief Create a new FSCP server with a deferred identity.
+			 * \param io_service The Boost Asio io_service instance to associate with the server.
+			 * \param _logger The logger to use. It must remain valid during the lifetime of the fscp::server.
+			 *
+			 * The server starts with an empty identity store: the socket can
+			 * be opened and HELLO exchanges proceed immediately, but
+			 * presentations and sessions fail with server_error::no_identity
+			 * until async_set_identity() completes.
+			 */
+			server(boost::asio::io_service& io_service, fscp::logger& _logger);
+
 			/**
 			 * \brief Get the underlying socket.
 			 */
@@ -326,6 +381,7 @@ namespace fscp
 			void set_identity(const identity_store& identity)
 			{
 				m_identity_store = identity;
+				m_identity_version.fetch_add(1, std::memory_order_relaxed);
 			}
 
 			/**
@@ -346,6 +402,169 @@ namespace fscp
 			 */
 			void sync_set_identity(const identity_store& identity);
 
+			/**
+			 * \brief Rotate the identity of the server without tearing down the established sessions.
+			 * \param identity The new identity.
+			 * \param grace_period The duration during which the previous identity remains in use for the peers that know it.
+			 * \param handler The handler to call when the rotation is effective.
+			 *
+			 * The new certificate is only presented during new handshakes:
+			 * the peers that currently hold a session keep being presented
+			 * and signed for with the previous identity until their session
+			 * ends or the grace period expires. At expiry the previous
+			 * identity is dropped and the server reintroduces itself to the
+			 * remaining peers. Rotating again before the grace period
+			 * expired drops the oldest identity.
+			 */
+			void async_rotate_identity(const identity_store& identity, const boost::posix_time::time_duration& grace_period = IDENTITY_ROTATION_GRACE_PERIOD, void_handler_type handler = void_handler_type())
+			{
+				m_socket_strand.post(boost::bind(&server::do_rotate_identity, this, identity, grace_period, handler));
+			}
+
+			/**
+			 * \brief Set the busy-poll duration for the underlying socket.
+			 * \param busy_poll_usec The duration, in microseconds, during which the kernel may busy-poll the device queue for new packets. 0 disables busy-polling.
+			 *
+			 * The value is applied at open() time, where supported. Busy-polling
+			 * trades CPU for receive latency and only makes sense on hosts with
+			 * spare cores.
+			 */
+			void set_busy_poll_duration(unsigned int busy_poll_usec)
+			{
+				m_busy_poll_usec = busy_poll_usec;
+			}
+
+			/**
+			 * \brief Set the maximum time a datagram may wait in a send queue.
+			 * \param sojourn_limit_ms The limit, in milliseconds. 0 disables the limit.
+			 *
+			 * When a congested peer cannot drain its queue fast enough, data
+			 * datagrams that waited longer than the limit are dropped from
+			 * the head of the queue: they would only add standing delay for
+			 * everything queued behind them. Control datagrams are never
+			 * dropped this way.
+			 */
+			void set_send_queue_sojourn_limit(unsigned int sojourn_limit_ms)
+			{
+				m_send_queue_sojourn_limit_ms = sojourn_limit_ms;
+			}
+
+			/**
+			 * \brief The maximum peer scheduling weight.
+			 */
+			static const size_t PEER_SCHEDULING_WEIGHT_MAX = 16;
+
+			/**
+			 * \brief Set the scheduling weight of the specified peer.
+			 * \param target The peer to classify.
+			 * \param weight The weight, clamped to [1, PEER_SCHEDULING_WEIGHT_MAX]. The default is 1.
+			 *
+			 * A peer of weight N is granted N times the default share of the
+			 * send path: its send queue drains N times faster when the link
+			 * is contended, it may hold N times more queued datagrams before
+			 * load is shed, and its ciphering work runs on a reserved part
+			 * of the data strand pool, away from the unweighted peers. Set
+			 * the weight before traffic flows towards the peer: changing it
+			 * while datagrams are in flight may reorder a few of them when
+			 * the peer moves to another strand.
+			 */
+			void set_peer_scheduling_weight(const ep_type& target, size_t weight);
+
+			/**
+			 * \brief Set the maximum time an out-of-order data message may be held back.
+			 * \param reorder_hold_ms The hold duration, in milliseconds. 0 disables reordering.
+			 *
+			 * On multipath links, packets legitimately arrive out of order
+			 * and in-tunnel TCP interprets the reordering as loss. When a
+			 * hold duration is set, a data message that arrives ahead of a
+			 * sequence gap is held back for up to that long, waiting for
+			 * the missing message, before being delivered anyway. Must be
+			 * called before the server is started.
+			 */
+			void set_reorder_hold_duration(unsigned int reorder_hold_ms)
+			{
+				m_reorder_hold_ms = reorder_hold_ms;
+			}
+
+			/**
+			 * \brief Set the count of receive steering workers.
+			 * \param worker_count The count of extra receive sockets opened next to the main one. 0 disables receive steering.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * On Linux, the workers join the main socket in a SO_REUSEPORT
+			 * group: the kernel hashes inbound flows over the members, so
+			 * different peers are drained and deciphered on different cores
+			 * while the datagrams of a given peer keep their arrival order.
+			 * Ignored on platforms without SO_REUSEPORT.
+			 */
+			void set_receive_steering(size_t worker_count)
+			{
+				m_receive_steering_count = worker_count;
+			}
+
+			/**
+			 * \brief Allow other processes to bind the listen endpoint.
+			 * \param enabled The value.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * On Linux, the main socket joins a SO_REUSEPORT group, so a
+			 * replacement process can bind the same endpoint while this one
+			 * is still running. Combined with the session state export, this
+			 * allows restarting the server without dropping the established
+			 * sessions. Ignored on platforms without SO_REUSEPORT.
+			 */
+			void set_reuse_port(bool enabled)
+			{
+				m_reuse_port_enabled = enabled;
+			}
+
+			/**
+			 * \brief Enable or disable path MTU discovery.
+			 * \param value The value.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * When enabled, the don't-fragment flag is set on all outgoing
+			 * datagrams at open() time, where supported, so that oversized MTU
+			 * probes are dropped by the path instead of being fragmented.
+			 */
+			void set_mtu_discovery(bool value)
+			{
+				m_mtu_discovery_enabled = value;
+			}
+
+			/**
+			 * \brief Enable or disable small-frame coalescing.
+			 * \param value The value.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * When enabled, several small data frames bound to the same peer
+			 * may be packed into a single data message, amortizing the header
+			 * and ciphering overhead over the batch.
+			 *
+			 * \warning The remote hosts must understand coalesced data
+			 * messages: they silently discard them otherwise.
+			 */
+			void set_data_coalescing(bool value)
+			{
+				m_data_coalescing_enabled = value;
+			}
+
+			/**
+			 * \brief Enable or disable data message padding.
+			 * \param value The value.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * When enabled, data messages bound to peers that advertised the
+			 * padding capability are rounded up to size buckets before
+			 * ciphering, so that the sealed length no longer reveals the
+			 * exact inner frame size. Peers without the capability keep
+			 * receiving unpadded messages.
+			 */
+			void set_data_padding(bool value)
+			{
+				m_data_padding_enabled = value;
+			}
+
 			/**
 			 * \brief Open the server.
 			 * \param listen_endpoint The listen endpoint.
@@ -359,14 +578,185 @@ namespace fscp
 			 */
 			void close();
 
+			/**
+			 * \brief Open the TCP fallback transport.
+			 * \param listen_endpoint The endpoint to listen onto. Typically the same endpoint the UDP socket listens onto.
+			 *
+			 * The TCP transport carries the same FSCP messages over
+			 * length-prefixed stream connections, for peers on networks that
+			 * block UDP. Messages to a peer with an established TCP
+			 * connection automatically go over that connection.
+			 *
+			 * \warning This method must be called after open().
+			 */
+			void open_tcp(const ep_type& listen_endpoint);
+
+			/**
+			 * \brief Establish a TCP connection with the specified host.
+			 * \param target The target host.
+			 * \param handler The handler to call when the connection is established (or when it failed to be).
+			 *
+			 * \warning open_tcp() must have been called first.
+			 */
+			void async_connect_tcp(const ep_type& target, simple_handler_type handler);
+
+			/**
+			 * \brief Set whether the server relays traffic between its peers.
+			 * \param enabled The relay mode.
+			 *
+			 * When enabled, MESSAGE_TYPE_RELAY_FORWARD messages received from
+			 * any host are delivered to the destination they carry, within a
+			 * strict per-source rate budget. The encapsulated datagrams keep
+			 * their end-to-end protection: the relay never signs nor
+			 * deciphers anything on behalf of the two hosts.
+			 */
+			void set_relay_enabled(bool enabled)
+			{
+				m_relay_enabled = enabled;
+			}
+
+			/**
+			 * \brief Route the traffic for the specified host through the specified relay.
+			 * \param target The host whose traffic must be relayed.
+			 * \param relay The relay to route the traffic through. It must run with relay mode enabled.
+			 *
+			 * This method can be called from any thread.
+			 */
+			void set_relay(const ep_type& target, const ep_type& relay);
+
+			/**
+			 * \brief Stop routing the traffic for the specified host through a relay.
+			 * \param target The host.
+			 *
+			 * This method can be called from any thread.
+			 */
+			void clear_relay(const ep_type& target);
+
+			/**
+			 * \brief Get the relay in use for the specified host, if any.
+			 * \param target The host.
+			 * \return The relay endpoint, if any.
+			 */
+			boost::optional<ep_type> get_relay(const ep_type& target) const;
+
 #ifdef USE_UPNP
 			/**
 			 * \brief Use UPnP to punch hole NAT.
 			 * \param port local port.
+			 *
+			 * The discovery and the mapping happen asynchronously: this
+			 * method returns immediately. The mapping lease is renewed
+			 * periodically and a gateway that stops answering triggers a
+			 * rediscovery, so the mapping survives gateway restarts.
 			 */
 			void upnp_punch_hole(uint16_t port);
 #endif
 
+			/**
+			 * \brief A snapshot of the data-plane counters of a peer.
+			 */
+			struct peer_counters_type
+			{
+				peer_counters_type() :
+					packets_in(0),
+					bytes_in(0),
+					packets_out(0),
+					bytes_out(0),
+					crypto_failures(0),
+					replay_drops(0),
+					decrypt_backlog_drops(0),
+					send_queue_depth(0)
+				{}
+
+				uint64_t packets_in;
+				uint64_t bytes_in;
+				uint64_t packets_out;
+				uint64_t bytes_out;
+				uint64_t crypto_failures;
+				uint64_t replay_drops;
+				uint64_t decrypt_backlog_drops;
+				uint64_t send_queue_depth;
+			};
+
+			/**
+			 * \brief Get a snapshot of the counters of a peer.
+			 * \param target The peer endpoint.
+			 * \return The counters. All zeroes if no datagram was ever exchanged with target.
+			 *
+			 * The counters are maintained with relaxed atomic operations on the
+			 * send and receive paths: taking a snapshot never posts to any
+			 * strand and can be called from any thread, at any time.
+			 */
+			peer_counters_type get_peer_counters(const ep_type& target) const;
+
+			/**
+			 * \brief Get a snapshot of the counters of all the known peers.
+			 * \return The counters, indexed by peer endpoint.
+			 */
+			std::map<ep_type, peer_counters_type> get_all_peer_counters() const;
+
+			/**
+			 * \brief The count of handshake histogram buckets. Bucket N counts the durations in [2^N, 2^(N+1)) microseconds.
+			 */
+			static const size_t HANDSHAKE_BUCKET_COUNT = 32;
+
+			/**
+			 * \brief A handshake stage duration histogram.
+			 */
+			typedef boost::array<uint64_t, HANDSHAKE_BUCKET_COUNT> handshake_histogram_type;
+
+			/**
+			 * \brief Get a snapshot of the handshake stage histograms, indexed by stage name.
+			 * \return The histograms, in microseconds.
+			 *
+			 * The stages are measured on the initiating side: "hello" covers
+			 * the HELLO send to its response, "session_setup" covers the
+			 * session request to the establishment, "total_initial" covers
+			 * the whole handshake of a new session, and "renewal" covers the
+			 * preparation-to-establishment time of a session renewal.
+			 *
+			 * The histograms are maintained with relaxed atomic operations:
+			 * taking a snapshot never posts to any strand and can be called
+			 * from any thread, at any time.
+			 */
+			std::map<std::string, handshake_histogram_type> get_handshake_histograms() const;
+
+			/**
+			 * \brief Get the approximate count of idle buffers in the socket buffer pool.
+			 * \return The idle buffer count. This never posts to any strand.
+			 */
+			size_t socket_buffer_pool_idle_count() const
+			{
+				return m_socket_buffers.idle_count();
+			}
+
+			/**
+			 * \brief Get the approximate count of idle buffers in the session buffer pool.
+			 * \return The idle buffer count. This never posts to any strand.
+			 */
+			size_t session_buffer_pool_idle_count() const
+			{
+				return m_session_buffers.idle_count();
+			}
+
+			/**
+			 * \brief Enable or disable strand profiling.
+			 * \param enabled The enabled state.
+			 *
+			 * When disabled (the default), the per-handler overhead is a
+			 * single relaxed atomic load.
+			 */
+			void set_strand_profiling(bool enabled);
+
+			/**
+			 * \brief Get a snapshot of the profiles of the internal strands, indexed by strand name.
+			 * \return The profiles. This never posts to any strand.
+			 *
+			 * The durations are expressed in profiling ticks; see
+			 * profiling_ticks() for their meaning.
+			 */
+			std::map<std::string, strand_profiler::snapshot_type> get_strand_profiles() const;
+
 			/**
 			 * \brief Greet an host.
 			 * \param target The target to greet.
@@ -383,6 +773,54 @@ namespace fscp
 				m_greet_strand.post(boost::bind(&server::do_cancel_all_greetings, this));
 			}
 
+			/**
+			 * \brief Discover the path MTU towards an host.
+			 * \param target The target host.
+			 * \param handler The handler to call when the discovery completed or an error occurred.
+			 *
+			 * The path is probed with padded HELLO requests of varying sizes
+			 * and the largest size that got a reply is searched by
+			 * dichotomy. If a discovery is already in progress for the target,
+			 * it is aborted and restarted.
+			 *
+			 * The result is cached and can be queried at any time with
+			 * get_peer_mtu().
+			 */
+			void async_discover_mtu(const ep_type& target, mtu_handler_type handler);
+
+			/**
+			 * \brief Get the cached path MTU towards an host.
+			 * \param target The target host.
+			 * \return The path MTU, in bytes, as last discovered by async_discover_mtu(). 0 if no discovery completed for the target.
+			 */
+			size_t get_peer_mtu(const ep_type& target) const;
+
+			/**
+			 * \brief A round-trip time estimate for a peer.
+			 */
+			struct peer_rtt_type
+			{
+				uint64_t smoothed_rtt_us; /**< The smoothed round-trip time, in microseconds. */
+				uint64_t rtt_variance_us; /**< The round-trip time variance, in microseconds. */
+				uint64_t sample_count; /**< The count of samples the estimate was built from. */
+			};
+
+			/**
+			 * \brief Get the round-trip time estimate towards an host.
+			 * \param target The target host.
+			 * \return The estimate. boost::none if no sample was taken yet for the target.
+			 *
+			 * The estimate is refreshed continuously: every HELLO exchange
+			 * contributes a sample, and hosts with an established session are
+			 * pinged on the keep-alive schedule. Where the kernel provides
+			 * receive timestamps (SO_TIMESTAMPING), the samples exclude the
+			 * time the reply spent queued between the NIC and the handler,
+			 * which keeps them accurate under load.
+			 *
+			 * This method can be called from any thread.
+			 */
+			boost::optional<peer_rtt_type> get_peer_rtt(const ep_type& target) const;
+
 			/**
 			 * \brief Set the default acceptance behavior of incoming hello messages.
 			 * \param value The default value.
@@ -469,6 +907,20 @@ namespace fscp
 			 */
 			std::map<ep_type, boost::system::error_code> sync_reintroduce_to_all();
 
+			/**
+			 * \brief Set the persistent presentation cache file.
+			 * \param path The cache file path.
+			 *
+			 * Certificates presented by peers are mirrored into the cache,
+			 * and a host whose presentation is not in memory is looked up
+			 * there before its session messages are discarded: a restarted
+			 * node validates returning peers without a full presentation
+			 * exchange. Pre-shared keys are never written to the cache.
+			 *
+			 * This method can be called from any thread.
+			 */
+			void set_presentation_cache(const std::string& path);
+
 			/**
 			 * \brief Get the presentation store associated to a target.
 			 * \param target The target host.
@@ -571,6 +1023,21 @@ namespace fscp
 			 */
 			void sync_set_presentation_message_received_callback(presentation_message_received_handler_type callback);
 
+			/**
+			 * \brief Set the asynchronous presentation message received callback.
+			 * \param callback The callback.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * When set, this callback takes precedence over the synchronous one:
+			 * the presentation strand does not wait for the acceptance result,
+			 * so presentations from other hosts can be processed while the
+			 * decision (typically a certificate chain verification) is taken.
+			 */
+			void set_presentation_message_received_async_callback(presentation_message_received_async_handler_type callback)
+			{
+				m_presentation_message_received_async_handler = callback;
+			}
+
 			/**
 			 * \brief Sends a session request to an host.
 			 * \param target The target to greet.
@@ -635,6 +1102,52 @@ namespace fscp
 			 */
 			bool sync_has_session_with_endpoint(const ep_type& host);
 
+			/**
+			 * \brief Export the state of all established sessions.
+			 * \param handler The handler to call with the exported state. An empty buffer if there is no established session.
+			 *
+			 * The state contains the session keys and is encrypted with a key
+			 * derived from the identity private key: only a process holding
+			 * the same identity can import it. A replacement process imports
+			 * it with async_import_session_state() and resumes the sessions
+			 * without renegotiating.
+			 */
+			void async_export_session_state(session_state_handler_type handler)
+			{
+				m_session_strand.post(boost::bind(&server::do_export_session_state, this, handler));
+			}
+
+			/**
+			 * \brief Export the state of all established sessions.
+			 * \return The exported state. An empty buffer if there is no established session.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			cryptoplus::buffer sync_export_session_state();
+
+			/**
+			 * \brief Import session state exported by another server instance.
+			 * \param state The state, as produced by async_export_session_state() with the same identity.
+			 * \param handler The handler to call when the sessions have been restored.
+			 *
+			 * Sessions for which a live session already exists are left
+			 * untouched. Each restored session fires the session established
+			 * callback, so the upper layers register the hosts as they would
+			 * after a negotiation.
+			 */
+			void async_import_session_state(const cryptoplus::buffer& state, void_handler_type handler = void_handler_type())
+			{
+				m_session_strand.post(boost::bind(&server::do_import_session_state, this, state, handler));
+			}
+
+			/**
+			 * \brief Import session state exported by another server instance.
+			 * \param state The state, as produced by async_export_session_state() with the same identity.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			void sync_import_session_state(const cryptoplus::buffer& state);
+
 			/**
 			 * \brief Set the default acceptance behavior of incoming session requests.
 			 * \param value The default value.
@@ -670,7 +1183,7 @@ namespace fscp
 			 */
 			void set_cipher_suites(const cipher_suite_list_type& cipher_suites)
 			{
-				m_cipher_suites = cipher_suites;
+				m_cipher_suites = get_supported_cipher_suites(cipher_suites);
 			}
 
 			/**
@@ -921,8 +1434,23 @@ namespace fscp
 			 * \param channel_number The channel number.
 			 * \param data The data to send.
 			 * \param handler The handler to call when the data was sent or an error occurred.
+			 * \param tos The ToS byte to mark the outer datagram with. 0 keeps the socket default.
+			 */
+			void async_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos = 0);
+
+			/**
+			 * \brief Send data to a host, encrypting it in place into the source buffer.
+			 * \param target The target host.
+			 * \param channel_number The channel number.
+			 * \param data_buffer The buffer that contains the data. It must remain exclusively owned by this operation.
+			 * \param data The data to send. It must point inside data_buffer, with at least data_message::HEADER_OVERHEAD bytes of headroom before it.
+			 * \param handler The handler to call when the data was sent or an error occurred.
+			 * \param tos The ToS byte to mark the outer datagram with. 0 keeps the socket default.
+			 *
+			 * If the headroom requirements are not met, the regular copying
+			 * send path is used instead.
 			 */
-			void async_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler);
+			void async_send_data_in_place(const ep_type& target, channel_number_type channel_number, SharedBuffer data_buffer, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos = 0);
 
 			/**
 			 * \brief Send data to a host.
@@ -935,14 +1463,66 @@ namespace fscp
 			 */
 			boost::system::error_code sync_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data);
 
+			/**
+			 * \brief Designate a channel as reliable.
+			 * \param channel_number The channel number.
+			 * \param value Whether the channel carries the reliable framing.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * Frames received on a reliable channel are treated as segments
+			 * of sequenced messages and reassembled before delivery; use
+			 * async_send_reliable_data() to send on such a channel.
+			 *
+			 * \warning Both hosts must designate the same channels: a
+			 * segment sent to a host that did not designate the channel is
+			 * delivered to it as a raw frame, and vice versa.
+			 */
+			void set_channel_reliable(channel_number_type channel_number, bool value)
+			{
+				if (value)
+				{
+					m_reliable_channels = static_cast<uint16_t>(m_reliable_channels | (1 << channel_number));
+				}
+				else
+				{
+					m_reliable_channels = static_cast<uint16_t>(m_reliable_channels & ~(1 << channel_number));
+				}
+			}
+
+			/**
+			 * \brief Send data to a host over a reliable channel.
+			 * \param target The target host.
+			 * \param channel_number The channel number. It must have been designated with set_channel_reliable().
+			 * \param data The data to send. It must remain valid until the handler is called.
+			 * \param handler The handler to call when the message was fully acknowledged, or given up on.
+			 * \param tos The ToS byte to mark the outer datagrams with. 0 keeps the socket default.
+			 *
+			 * The message is split into sequenced segments; the remote host
+			 * acknowledges them with SACK blocks and only the missing ones
+			 * are retransmitted, a bounded number of times.
+			 */
+			void async_send_reliable_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos = 0);
+
+			/**
+			 * \brief Send data to a host over a reliable channel.
+			 * \param target The target host.
+			 * \param channel_number The channel number. It must have been designated with set_channel_reliable().
+			 * \param data The data to send.
+			 * \return The error code associated to the send operation.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			boost::system::error_code sync_send_reliable_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data);
+
 			/**
 			 * \brief Send data to a list of hosts.
 			 * \param targets The list of hosts.
 			 * \param channel_number The channel number.
 			 * \param data The data to send.
 			 * \param handler The handler to call when the data was sent to all hosts or an error occurred.
+			 * \param tos The ToS byte to mark the outer datagrams with. 0 keeps the socket default.
 			 */
-			void async_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler);
+			void async_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler, uint8_t tos = 0);
 
 			/**
 			 * \brief Send data to a list of hosts.
@@ -951,11 +1531,12 @@ namespace fscp
 			 * \param channel_number The channel number.
 			 * \param data The data to send.
 			 * \param handler The handler to call when the data was sent to all hosts or an error occurred.
+			 * \param tos The ToS byte to mark the outer datagrams with. 0 keeps the socket default.
 			 */
 			template <typename EPIterator>
-			void async_send_data_to_list(EPIterator begin, EPIterator end, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
+			void async_send_data_to_list(EPIterator begin, EPIterator end, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler, uint8_t tos = 0)
 			{
-				async_send_data_to_list(std::set<ep_type>(begin, end), channel_number, data, handler);
+				async_send_data_to_list(std::set<ep_type>(begin, end), channel_number, data, handler, tos);
 			}
 
 			/**
@@ -993,7 +1574,7 @@ namespace fscp
 			 */
 			void async_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
 			{
-				m_session_strand.post(boost::bind(&server::do_send_data_to_all, this, channel_number, data, handler));
+				m_session_strand.post(boost::bind(&server::do_send_data_to_all, this, channel_number, data, handler, static_cast<uint8_t>(0)));
 			}
 
 			/**
@@ -1263,11 +1844,30 @@ namespace fscp
 
 			identity_store m_identity_store;
 
+			// Bumped on every identity change, within the socket strand. The
+			// receive loop compares it against the version of its identity
+			// snapshot, so it only re-enters the strand when the snapshot
+			// went stale.
+			std::atomic<uint32_t> m_identity_version;
+
 			void do_get_identity(identity_handler_type);
 			void do_set_identity(const identity_store&, void_handler_type);
+			void do_rotate_identity(const identity_store&, const boost::posix_time::time_duration&, void_handler_type);
+			void do_mark_previous_identity_peers(const boost::posix_time::time_duration&, void_handler_type);
+			void do_expire_previous_identity(const boost::system::error_code&);
+			bool peer_uses_previous_identity(const ep_type&) const;
+			void forget_previous_identity_peer(const ep_type&);
+
+			// The peers still served with the previous identity are looked up
+			// from several strands, so the set is protected with a mutex
+			// instead.
+			mutable boost::mutex m_previous_identity_peers_mutex;
+			std::set<ep_type> m_previous_identity_peers;
+			boost::asio::deadline_timer m_identity_grace_timer;
 
 		private:
 			elliptic_curve_list_type get_supported_elliptic_curves(const elliptic_curve_list_type& curves);
+			cipher_suite_list_type get_supported_cipher_suites(const cipher_suite_list_type& cipher_suites);
 
 			void async_receive_from()
 			{
@@ -1275,140 +1875,612 @@ namespace fscp
 			}
 
 			void do_async_receive_from();
-			void handle_receive_from(const identity_store&, boost::shared_ptr<ep_type>, SharedBuffer, const boost::system::error_code&, size_t);
+			void arm_receive_from(const identity_store&, uint32_t identity_version);
+			void handle_receive_from(const identity_store&, uint32_t identity_version, boost::shared_ptr<ep_type>, SharedBuffer, const boost::system::error_code&, size_t);
+			void handle_datagram_from(const identity_store&, const ep_type&, SharedBuffer, size_t, uint64_t rx_time_us = 0);
 
-			ep_type to_socket_format(const ep_type& ep);
+			bool send_relayed(const SharedBuffer& data, size_t offset, size_t size, const ep_type& target, simple_handler_type handler, bool droppable);
+			void handle_relay_forward_from(const relay_message&, const ep_type&);
+			void do_handle_relay_deliver(const identity_store&, const ep_type&, SharedBuffer, const relay_message&);
+			bool relay_budget_allows(const ep_type& source, size_t size);
 
-			void async_send_to(const SharedBuffer& data, const size_t size, const ep_type& target, simple_handler_type handler)
+			/**
+			 * \brief The relay forwarding budget of a single source endpoint.
+			 */
+			struct relay_budget_type
 			{
-				const void_handler_type write_handler = [this, data, size, target, handler] () {
-					m_socket.async_send_to(buffer(data, size), target, 0, [data, handler] (const boost::system::error_code& ec, size_t) {
-						handler(ec);
-					});
+				relay_budget_type() :
+					window_start(),
+					bytes(0),
+					packets(0)
+				{}
+
+				boost::posix_time::ptime window_start;
+				size_t bytes;
+				size_t packets;
+			};
+
+			bool m_relay_enabled;
+			std::atomic<bool> m_has_relay_peers;
+
+			// The relay routes are looked up on every send, from any thread,
+			// so the map is protected with a mutex instead of a strand.
+			mutable boost::mutex m_relay_peers_mutex;
+			std::map<ep_type, ep_type> m_relay_peers;
+
+			boost::mutex m_relay_budgets_mutex;
+			std::map<ep_type, relay_budget_type> m_relay_budgets;
+
+			ep_type to_socket_format(const ep_type& ep);
+
+#ifdef LINUX
+			/**
+			 * \brief A datagram pending in the send queue, waiting to be flushed with sendmmsg().
+			 */
+			struct pending_send_type
+			{
+				// The handler is moved, never copied, along the queueing
+				// path: copying a boost::function may heap-allocate its
+				// captured state, which adds up at one per datagram.
+				pending_send_type(SharedBuffer _data, size_t _offset, size_t _size, const ep_type& _target, simple_handler_type _handler, bool _droppable = false, uint8_t _tos = 0) :
+					data(std::move(_data)),
+					offset(_offset),
+					size(_size),
+					target(_target),
+					handler(std::move(_handler)),
+					droppable(_droppable),
+					tos(_tos)
+				{}
+
+				SharedBuffer data;
+				size_t offset;
+				size_t size;
+				ep_type target;
+				simple_handler_type handler;
+
+				// Droppable datagrams (typically broadcast frames) are shed
+				// first when the queue of a congested peer overflows.
+				bool droppable;
+
+				// The ToS byte to mark the outer datagram with, so the
+				// underlay can tell the inner traffic classes apart. 0 keeps
+				// the socket default.
+				uint8_t tos;
+
+				// When non-zero, the entry is a coalesced super-datagram that
+				// the kernel segments into gso_size-sized packets (UDP GSO).
+				size_t gso_size = 0;
+
+				// When the entry entered its send queue, against which the
+				// sojourn-time limit is checked at flush time.
+				uint64_t enqueue_time_ms = 0;
+			};
+
+			/**
+			 * \brief The send queue of one data channel towards one peer.
+			 */
+			struct channel_send_queue_type
+			{
+				channel_send_queue_type() :
+					deficit(0)
+				{}
+
+				std::deque<pending_send_type> entries;
+				size_t deficit;
+			};
+
+			/**
+			 * \brief The classified send queues towards one peer.
+			 *
+			 * Control-plane datagrams (handshakes, keep-alives, contacts)
+			 * are drained with strict priority; the data channels share the
+			 * remainder with deficit round-robin, so a bulk channel cannot
+			 * queue ahead of an interactive one.
+			 */
+			struct peer_send_queue_type
+			{
+				peer_send_queue_type() :
+					total(0),
+					next_channel(0)
+				{}
+
+				bool empty() const
+				{
+					return (total == 0);
+				}
+
+				std::deque<pending_send_type> control;
+				std::map<uint8_t, channel_send_queue_type> channels;
+				size_t total;
+				uint8_t next_channel;
+			};
+
+			static bool classify_send(const pending_send_type&, uint8_t&);
+			void shed_send(peer_send_queue_type&);
+			std::deque<pending_send_type>& select_send_queue(peer_send_queue_type&);
+			void push_send(pending_send_type&);
+			socket_type& send_socket_for(const ep_type&);
+			void requeue_sends(std::vector<pending_send_type>&, size_t);
+			void do_flush_sends();
+			void handle_send_ready(const boost::system::error_code&);
+			void handle_receive_ready(const identity_store&, uint32_t identity_version, const boost::system::error_code&);
+			void drain_receive_socket(const identity_store&, socket_type&);
+
+#ifdef SO_REUSEPORT
+			/**
+			 * \brief A receive steering worker: an extra SO_REUSEPORT socket
+			 * with its own single-consumer receive loop.
+			 *
+			 * The kernel hashes inbound flows over the SO_REUSEPORT group, so
+			 * each worker drains a stable subset of the peers: a given peer
+			 * always lands on the same worker and its datagrams keep their
+			 * arrival order. Each worker keeps a single receive wait
+			 * outstanding, so its loop serializes itself without a strand.
+			 */
+			struct receive_worker_type
+			{
+				explicit receive_worker_type(boost::asio::io_service& io_service) :
+					socket(io_service)
+				{
+				}
+
+				socket_type socket;
+			};
+
+			void open_receive_workers(const ep_type& listen_endpoint);
+			void close_receive_workers();
+			void async_receive_on(boost::shared_ptr<receive_worker_type> worker);
+			void arm_receive_on(boost::shared_ptr<receive_worker_type> worker, const identity_store&, uint32_t identity_version);
+			void handle_worker_receive_ready(const identity_store&, uint32_t identity_version, boost::shared_ptr<receive_worker_type>, const boost::system::error_code&);
+
+			std::vector<boost::shared_ptr<receive_worker_type>> m_receive_workers;
+#endif
+#endif
+
+			void async_send_to(const SharedBuffer& data, const size_t size, const ep_type& target, simple_handler_type handler, bool droppable = false, uint8_t tos = 0)
+			{
+				data.trace_stamp(trace_stage::socket_send);
+
+				{
+					atomic_peer_counters_type& counters = counters_for(target);
+
+					counters.packets_out.fetch_add(1, std::memory_order_relaxed);
+					counters.bytes_out.fetch_add(size, std::memory_order_relaxed);
+				}
+
+				// Peers with an established TCP connection are reached over
+				// it: their network most likely blocks UDP.
+				if (m_tcp_transport && m_tcp_transport->has_connection(target))
+				{
+					m_tcp_transport->async_send(target, data, 0, size, handler, droppable);
+
+					return;
+				}
+
+				if (m_has_relay_peers.load(std::memory_order_relaxed) && send_relayed(data, 0, size, target, handler, droppable))
+				{
+					return;
+				}
+
+#ifdef LINUX
+				m_socket_strand.post(boost::bind(&server::push_send, this, pending_send_type(data, 0, size, target, std::move(handler), droppable, tos)));
+#else
+				// Per-datagram marking needs the sendmmsg() path and its
+				// ancillary data: the fallback path sends with the socket
+				// default.
+				static_cast<void>(droppable);
+				static_cast<void>(tos);
+
+				const void_handler_type write_handler = [this, data, size, target, handler] () {
+					m_socket.async_send_to(buffer(data, size), target, 0, [data, handler] (const boost::system::error_code& ec, size_t) {
+						handler(ec);
+					});
 				};
 
 				m_write_queue_strand.post(boost::bind(&server::push_write, this, write_handler));
+#endif
+			}
+
+			void async_send_to(const SharedBuffer& data, const size_t offset, const size_t size, const ep_type& target, simple_handler_type handler, uint8_t tos = 0)
+			{
+				data.trace_stamp(trace_stage::socket_send);
+
+				{
+					atomic_peer_counters_type& counters = counters_for(target);
+
+					counters.packets_out.fetch_add(1, std::memory_order_relaxed);
+					counters.bytes_out.fetch_add(size, std::memory_order_relaxed);
+				}
+
+				if (m_tcp_transport && m_tcp_transport->has_connection(target))
+				{
+					m_tcp_transport->async_send(target, data, offset, size, handler);
+
+					return;
+				}
+
+				if (m_has_relay_peers.load(std::memory_order_relaxed) && send_relayed(data, offset, size, target, handler, false))
+				{
+					return;
+				}
+
+#ifdef LINUX
+				m_socket_strand.post(boost::bind(&server::push_send, this, pending_send_type(data, offset, size, target, std::move(handler), false, tos)));
+#else
+				static_cast<void>(tos);
+
+				const void_handler_type write_handler = [this, data, offset, size, target, handler] () {
+					m_socket.async_send_to(boost::asio::buffer(buffer(data) + offset, size), target, 0, [data, handler] (const boost::system::error_code& ec, size_t) {
+						handler(ec);
+					});
+				};
+
+				m_write_queue_strand.post(boost::bind(&server::push_write, this, write_handler));
+#endif
 			}
 
 			void push_write(void_handler_type);
 			void pop_write();
 
+			// The profilers must outlive the strands they instrument, so they
+			// are declared (and thus constructed) first.
+			struct strand_profilers_type
+			{
+				strand_profiler socket;
+				strand_profiler write_queue;
+				strand_profiler greet;
+				strand_profiler presentation;
+				strand_profiler session;
+				strand_profiler contact;
+			};
+
+			strand_profilers_type m_strand_profilers;
+
 			socket_type m_socket;
-			boost::asio::strand m_socket_strand;
+			boost::shared_ptr<tcp_transport> m_tcp_transport;
+			profiled_strand m_socket_strand;
+			unsigned int m_busy_poll_usec;
+			unsigned int m_send_queue_sojourn_limit_ms;
+			size_t m_receive_steering_count;
+			bool m_reuse_port_enabled;
+			bool m_mtu_discovery_enabled;
 			std::queue<void_handler_type> m_write_queue;
-			boost::asio::strand m_write_queue_strand;
-			std::list<SharedBuffer> m_socket_buffers;
+			profiled_strand m_write_queue_strand;
+
+#ifdef LINUX
+			/**
+			 * \brief The maximum count of datagrams flushed in a single sendmmsg() call.
+			 */
+			static const size_t SEND_BATCH_SIZE = 64;
+
+			/**
+			 * \brief The maximum count of datagrams drained in a single recvmmsg() call.
+			 */
+			static const size_t RECEIVE_BATCH_SIZE = 32;
+
+			/**
+			 * \brief The maximum count of recvmmsg() batches drained per readiness notification.
+			 */
+			static const size_t RECEIVE_BATCHES_PER_WAKEUP = 4;
+
+			/**
+			 * \brief The maximum count of datagrams queued per peer.
+			 */
+			static const size_t PEER_SEND_QUEUE_MAX_SIZE = 128;
+
+			/**
+			 * \brief The maximum count of datagrams a single peer may contribute to one send batch.
+			 */
+			static const size_t PEER_SEND_BATCH_QUOTA = 8;
+
+			/**
+			 * \brief The byte quantum granted to a data channel per deficit round-robin visit.
+			 */
+			static const size_t CHANNEL_DRR_QUANTUM = 1536;
+
+			/**
+			 * \brief The maximum count of segments coalesced into one UDP GSO super-datagram.
+			 */
+			static const size_t GSO_MAX_SEGMENTS = 64;
+
+			// These are accessed only from the socket strand. The send queues
+			// are kept per peer and drained round-robin, so a congested peer
+			// only backs up its own queue.
+			std::map<ep_type, peer_send_queue_type> m_peer_send_queues;
+			std::deque<ep_type> m_send_round_robin;
+			bool m_send_flush_pending;
+
+			// The in-flight slots of the flush: at most SEND_BATCH_SIZE
+			// entries ride a sendmmsg() call, so the scratch structures are
+			// allocated once and reused, and filling a batch is array
+			// indexing instead of per-flush heap churn. Socket strand only.
+			std::vector<pending_send_type> m_send_batch;
+			std::vector<socket_type*> m_send_group_sockets;
+			std::vector<std::vector<pending_send_type>> m_send_groups;
+			mmsghdr m_send_msgvec[SEND_BATCH_SIZE];
+			iovec m_send_iov[SEND_BATCH_SIZE];
+			char m_send_cmsgbuf[SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(int))];
+
+			// Set at open() time if the kernel supports UDP GSO/GRO.
+			bool m_gso_enabled;
+			bool m_gro_enabled;
+
+			// Set at open() time if the kernel delivers receive timestamps
+			// (SO_TIMESTAMPING) with the datagrams.
+			bool m_kernel_timestamps_enabled;
+#endif
+			// Datagrams are pooled by size: MTU-sized traffic recycles small
+			// buffers while receives and coalesced sends keep worst-case
+			// ones, so idle pool memory follows the actual frame sizes.
+			TieredSharedBufferPool m_socket_buffers;
+
+			// Small control messages (HELLO, PRESENTATION, MTU probes,
+			// keep-alives) are written into pooled buffers: a reconnect
+			// storm then recycles a handful of buffers instead of hitting
+			// the allocator for every handshake.
+			SharedBufferPool m_handshake_buffers;
+
+			// All the coalescable timeouts (greets, MTU probes, the
+			// keep-alive tick) share a single OS timer through the
+			// service instead of each owning a deadline_timer.
+			timer_service m_timer_service;
 
 		private: // HELLO messages
 
 			/**
-			 * @brief Represents a context for an endpoint.
+			 * \brief The pending HELLO request waits, as a fixed-size open-addressed table keyed by unique number.
+			 *
+			 * During a full-mesh bring-up thousands of greets are
+			 * outstanding at once and every HELLO response used to walk
+			 * two maps to find its wait. The table matches a response in
+			 * a bounded probe window without any allocation, and a
+			 * generation counter invalidates every pending wait at once
+			 * on shutdown.
+			 *
+			 * All the calls are made within the greet strand, so no
+			 * locking is needed.
 			 */
-			class ep_hello_context_type
+			class pending_hello_table
 			{
 				public:
 
 					/**
-					 * @brief Generate an unique number.
-					 * @warning The first invocation of this function is *NOT* thread-safe in C++03.
+					 * \brief Generate an unique number.
+					 * \warning The first invocation of this function is *NOT* thread-safe in C++03.
 					 */
 					static uint32_t generate_unique_number();
 
 					/**
-					 * @brief Create a new context.
+					 * \brief Create an empty table.
 					 */
-					ep_hello_context_type();
+					pending_hello_table();
 
 					/**
-					 * @brief Returns the current hello unique number and generates a new one.
-					 * @return The current hello unique number.
+					 * \brief Returns the current hello unique number and generates a new one.
+					 * \return The current hello unique number.
 					 */
 					uint32_t next_hello_unique_number();
 
 					/**
-					 * @brief Asynchronously waits for a hello reply.
-					 * @param io_service The io_service instance to use for the wait.
-					 * @param hello_unique_number The unique hello number.
-					 * @param timeout The time to wait for the reply.
-					 * @param handler The handler to call upon timeout or cancellation.
+					 * \brief Asynchronously waits for a hello reply.
+					 * \param timers The timer service to schedule the timeout on.
+					 * \param target The endpoint the request was sent to.
+					 * \param hello_unique_number The unique hello number.
+					 * \param timeout The time to wait for the reply.
+					 * \param handler The handler to call upon timeout or cancellation.
+					 *
+					 * If the probe window is full, the oldest wait in it is
+					 * evicted: its timeout is cancelled and it reports as
+					 * unsuccessful.
 					 */
 					template <typename WaitHandler>
-					void async_wait_reply(boost::asio::io_service& io_service, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler);
+					void async_wait_reply(timer_service& timers, const ep_type& target, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler);
 
 					/**
-					 * @brief Cancel a hello reply wait timer.
-					 * @param hello_unique_number The hello reply number.
-					 * @param success Whether the cancel is the result of a received reply.
-					 * @return true if the timer was cancelled or false if it was too late to do so.
+					 * \brief Cancel a hello reply wait timeout.
+					 * \param timers The timer service the timeout was scheduled on.
+					 * \param sender The endpoint the reply came from. It must match the endpoint the request was sent to.
+					 * \param hello_unique_number The hello reply number.
+					 * \param success Whether the cancel is the result of a received reply.
+					 * \return true if the timeout was cancelled or false if there was no matching wait or it was too late to do so.
 					 */
-					bool cancel_reply_wait(uint32_t hello_unique_number, bool success);
+					bool cancel_reply_wait(timer_service& timers, const ep_type& sender, uint32_t hello_unique_number, bool success);
 
 					/**
-					 * @brief Cancel all pending hello request wait timers.
+					 * \brief Cancel all pending hello request wait timeouts.
+					 * \param timers The timer service the timeouts were scheduled on.
 					 *
-					 * This call is similar to calling cancel_reply_wait(<num>, false) for all hello unique numbers.
+					 * This call is similar to calling cancel_reply_wait(<ep>, <num>, false) for all pending waits.
 					 */
-					void cancel_all_reply_wait();
+					void cancel_all_reply_wait(timer_service& timers);
 
 					/**
-					 * @brief Remove a hello reply wait from the pending list.
-					 * @param hello_unique_number The hello reply number.
-					 * @param duration A variable whose value after the call will be the time elapsed since the creation of the request.
-					 * @return The success status of the request.
+					 * \brief Remove a hello reply wait from the table.
+					 * \param target The endpoint the request was sent to.
+					 * \param hello_unique_number The hello reply number.
+					 * \param duration A variable whose value after the call will be the time elapsed since the creation of the request.
+					 * \return The success status of the request. A wait that was evicted or invalidated reports as unsuccessful.
 					 */
-					bool remove_reply_wait(uint32_t hello_unique_number, boost::posix_time::time_duration& duration);
+					bool remove_reply_wait(const ep_type& target, uint32_t hello_unique_number, boost::posix_time::time_duration& duration);
 
 				private:
 
-					struct pending_request_status
+					// The table must hold the maximum count of outstanding
+					// greets: a full-mesh bring-up greets every known host
+					// at once.
+					static const size_t SLOT_COUNT = 8192;
+					static const size_t MAX_PROBE_LENGTH = 16;
+
+					struct slot_type
 					{
-						pending_request_status() :
-							timer(),
-							start_date(boost::posix_time::microsec_clock::universal_time()),
+						slot_type() :
+							unique_number(0),
+							generation(0),
+							wait_id(0),
 							success(false)
 						{}
 
-						pending_request_status(boost::shared_ptr<boost::asio::deadline_timer> _timer) :
-							timer(_timer),
-							start_date(boost::posix_time::microsec_clock::universal_time()),
-							success(false)
-						{}
+						bool live(uint32_t current_generation) const
+						{
+							return ((wait_id != 0) && (generation == current_generation));
+						}
 
-						boost::shared_ptr<boost::asio::deadline_timer> timer;
+						uint32_t unique_number;
+						uint32_t generation;
+						ep_type endpoint;
 						boost::posix_time::ptime start_date;
+						timer_service::timer_id wait_id;
 						bool success;
 					};
 
-					typedef std::map<uint32_t, pending_request_status> pending_requests_map;
+					static size_t slot_index_for(uint32_t hello_unique_number);
+
+					slot_type* find_slot(const ep_type& endpoint, uint32_t hello_unique_number);
 
 					uint32_t m_current_hello_unique_number;
-					pending_requests_map m_pending_requests;
+					uint32_t m_generation;
+					boost::array<slot_type, SLOT_COUNT> m_slots;
 			};
 
-			typedef std::map<ep_type, ep_hello_context_type> ep_hello_context_map;
+			/**
+			 * \brief A token-bucket rate limiter over incoming HELLO requests, keyed by source prefix.
+			 *
+			 * A UDP flood of junk HELLO requests used to pin the greet
+			 * strand: the limiter drops the excess on the receive path,
+			 * before any strand work or allocation happens. Buckets are
+			 * keyed by address prefix (/24 for IPv4, /48 for IPv6) so a
+			 * flood from one network cannot starve the others, and the
+			 * fixed-size table needs no cleanup.
+			 */
+			class hello_request_limiter
+			{
+				public:
+
+					hello_request_limiter();
+
+					/**
+					 * \brief Take a token from the bucket associated to the given address.
+					 * \param address The source address.
+					 * \return true if a token was available: the request may proceed.
+					 */
+					bool allow(const boost::asio::ip::address& address);
+
+				private:
+
+					static const size_t BUCKET_COUNT = 256;
+					static const uint32_t BUCKET_CAPACITY = 32;
+					static const uint32_t BUCKET_TOKENS_PER_SECOND = 16;
+
+					static size_t bucket_index_for(const boost::asio::ip::address& address);
+
+					struct bucket_type
+					{
+						boost::posix_time::ptime last_refill;
+						uint32_t tokens;
+					};
+
+					boost::mutex m_mutex;
+					boost::array<bucket_type, BUCKET_COUNT> m_buckets;
+			};
 
 			void do_greet(const ep_type&, duration_handler_type, const boost::posix_time::time_duration&);
 			void do_greet_handler(const ep_type&, uint32_t, duration_handler_type, const boost::posix_time::time_duration&, const boost::system::error_code&);
 			void do_greet_timeout(const ep_type&, uint32_t, duration_handler_type, const boost::system::error_code&);
 			void do_cancel_all_greetings();
 
-			void handle_hello_message_from(const hello_message&, const ep_type&);
+			void handle_hello_message_from(const hello_message&, const ep_type&, uint64_t rx_time_us);
 			void do_handle_hello_request(const ep_type&, uint32_t);
-			void do_handle_hello_response(const ep_type&, uint32_t);
+			void do_handle_hello_response(const ep_type&, uint32_t, uint64_t rx_time_us);
 
 			void do_set_accept_hello_messages_default(bool, void_handler_type);
 			void do_set_hello_message_received_callback(hello_message_received_handler_type, void_handler_type);
 
-			ep_hello_context_map m_ep_hello_contexts;
-			boost::asio::strand m_greet_strand;
+			pending_hello_table m_pending_hellos;
+			profiled_strand m_greet_strand;
 			bool m_accept_hello_messages_default;
 			hello_message_received_handler_type m_hello_message_received_handler;
+			hello_request_limiter m_hello_request_limiter;
+
+			/**
+			 * @brief The state of an on-going path MTU discovery.
+			 */
+			struct mtu_discovery_context_type
+			{
+				mtu_discovery_context_type() :
+					lower(0),
+					upper(0),
+					probe_size(0),
+					probe_unique_number(0),
+					attempts_left(0)
+				{
+				}
+
+				bool in_progress() const
+				{
+					return static_cast<bool>(handler);
+				}
+
+				size_t lower; // The largest datagram size known to go through.
+				size_t upper; // The largest datagram size still worth probing.
+				size_t probe_size;
+				uint32_t probe_unique_number;
+				size_t attempts_left;
+				mtu_handler_type handler;
+			};
+
+			typedef std::map<ep_type, mtu_discovery_context_type> mtu_discovery_context_map;
+
+			void do_discover_mtu(const ep_type&, mtu_handler_type);
+			void do_probe_mtu(const ep_type&);
+			void do_probe_mtu_handler(const ep_type&, uint32_t, const boost::system::error_code&);
+			void do_probe_mtu_timeout(const ep_type&, uint32_t, const boost::system::error_code&);
+			void do_handle_mtu_probe_result(const ep_type&, bool);
+			void do_finish_mtu_discovery(const ep_type&, const boost::system::error_code&, size_t);
+
+			mtu_discovery_context_map m_mtu_discovery_contexts;
+			mutable boost::mutex m_peer_mtus_mutex;
+			std::map<ep_type, size_t> m_peer_mtus;
 
 		private: // PRESENTATION messages
 
 			typedef std::map<ep_type, presentation_store> presentation_store_map;
 
+			/**
+			 * \brief A counting Bloom filter over the certificate hashes present in the presentation store.
+			 *
+			 * During reconnect storms thousands of presentations can hit the
+			 * presentation strand at once: the filter classifies certificates
+			 * that are definitely not in the store without any DER
+			 * re-encoding, and known ones are then matched by their cached
+			 * hash instead of a full certificate comparison.
+			 */
+			class certificate_filter
+			{
+				public:
+
+					certificate_filter()
+					{
+						m_counters.assign(0);
+					}
+
+					void insert(const hash_type& hash);
+					void remove(const hash_type& hash);
+					bool maybe_contains(const hash_type& hash) const;
+
+				private:
+
+					static const size_t FILTER_SIZE = 4096;
+					static const size_t HASH_COUNT = 2;
+
+					static size_t index_for(const hash_type& hash, size_t i);
+
+					boost::array<uint8_t, FILTER_SIZE> m_counters;
+			};
+
 			bool has_presentation_store_for(const ep_type&) const;
+			void set_presentation_store(const ep_type&, cert_type, const cryptoplus::buffer&);
+			void erase_presentation_store(const ep_type&);
+			bool restore_presentation_from_cache(const ep_type&);
 			void do_introduce_to(const ep_type&, simple_handler_type);
 			void do_reintroduce_to_all(multiple_endpoints_handler_type);
 			void do_get_presentation(const ep_type&, optional_presentation_store_handler_type);
@@ -1416,17 +2488,77 @@ namespace fscp
 			void do_clear_presentation(const ep_type&, void_handler_type);
 			void handle_presentation_message_from(const identity_store&, const presentation_message&, const ep_type&);
 			void do_handle_presentation(const identity_store& identity, const ep_type&, bool, cert_type);
+			void do_complete_handle_presentation(const identity_store& identity, const ep_type&, cert_type, bool);
 
 			void do_set_presentation_message_received_callback(presentation_message_received_handler_type, void_handler_type);
 
 			// This strand is also used by session requests and session messages during the cipherment/decipherment phase.
-			boost::asio::strand m_presentation_strand;
+			profiled_strand m_presentation_strand;
+			// An index from certificate fingerprints to the endpoints that
+			// presented them: contact requests are answered with a lookup
+			// instead of a scan of the whole presentation store per hash.
+			typedef std::multimap<hash_type, ep_type> contact_index_map_type;
+
 			presentation_store_map m_presentation_store_map;
+			certificate_filter m_certificate_filter;
+			contact_index_map_type m_contact_index;
+			boost::shared_ptr<presentation_cache> m_presentation_cache;
 			presentation_message_received_handler_type m_presentation_message_received_handler;
+			presentation_message_received_async_handler_type m_presentation_message_received_async_handler;
+
+			/**
+			 * \brief A session request waiting for a handshake slot.
+			 */
+			struct pending_session_request_type
+			{
+				SharedBuffer data;
+				identity_store identity;
+				ep_type sender;
+				boost::shared_ptr<session_request_message> message;
+			};
+
+			// The handshake admission state, owned by the presentation
+			// strand. The slots bound how many handshakes are in flight
+			// at once and the backlog holds the excess, newest first.
+			size_t m_handshake_slots_in_use;
+			std::vector<pending_session_request_type> m_handshake_backlog;
 
 		private: // SESSION_REQUEST messages
 
-			typedef std::map<ep_type, peer_session> peer_session_map_type;
+			/**
+			 * \brief A cheap hash over endpoints.
+			 *
+			 * Every incoming datagram looks its sender up in the session
+			 * map: the common IPv4 case hashes with a single multiply over
+			 * the address word instead of a byte-wise tree comparison.
+			 */
+			struct endpoint_hash
+			{
+				size_t operator()(const ep_type& ep) const;
+			};
+
+			typedef boost::unordered_map<ep_type, peer_session, endpoint_hash> peer_session_map_type;
+
+			/**
+			 * \brief The outcome of a capability negotiation, cached per peer certificate fingerprint.
+			 *
+			 * A peer's capabilities virtually never change: caching the
+			 * parsed lists and the negotiated suite lets a session renewal
+			 * skip the list parsing and the intersection. An entry is
+			 * validated against a hash of the raw capability bytes, and a
+			 * presentation change moves the peer to a new fingerprint so the
+			 * cache misses naturally.
+			 */
+			struct negotiated_capabilities_type
+			{
+				size_t capabilities_hash;
+				cipher_suite_list_type cipher_suites;
+				elliptic_curve_list_type elliptic_curves;
+				cipher_suite_type cipher_suite;
+				elliptic_curve_type elliptic_curve;
+			};
+
+			typedef std::map<hash_type, negotiated_capabilities_type> negotiation_cache_map_type;
 
 			static cipher_suite_type get_first_common_supported_cipher_suite(const cipher_suite_list_type&, const cipher_suite_list_type&, cipher_suite_type);
 			static elliptic_curve_type get_first_common_supported_elliptic_curve(const elliptic_curve_list_type&, const elliptic_curve_list_type&, elliptic_curve_type);
@@ -1434,7 +2566,10 @@ namespace fscp
 			void do_request_session(const identity_store&, const ep_type&, simple_handler_type);
 			void do_close_session(const ep_type&, simple_handler_type);
 			void do_handle_session_request(SharedBuffer, const identity_store&, const ep_type&, const session_request_message&);
-			void do_handle_verified_session_request(const identity_store&, const ep_type&, const session_request_message&);
+			void do_handle_admitted_session_request(SharedBuffer, const identity_store&, const ep_type&, const session_request_message&);
+			void do_handle_verified_session_request(const identity_store&, const ep_type&, const session_request_message&, boost::optional<hash_type>);
+			void do_handle_verified_session_request_in_slot(const identity_store&, const ep_type&, const session_request_message&, boost::optional<hash_type>);
+			void do_release_handshake_slot();
 
 			std::set<ep_type> get_session_endpoints() const;
 			bool has_session_with_endpoint(const ep_type&);
@@ -1444,23 +2579,47 @@ namespace fscp
 			void do_set_cipher_suites(cipher_suite_list_type, void_handler_type);
 			void do_set_elliptic_curves(elliptic_curve_list_type, void_handler_type);
 			void do_set_session_request_message_received_callback(session_request_received_handler_type, void_handler_type);
+			void do_export_session_state(session_state_handler_type);
+			void do_import_session_state(cryptoplus::buffer, void_handler_type);
+
+			boost::shared_ptr<cryptoplus::pkey::ecdhe_context> get_ecdhe_context(elliptic_curve_type);
+			void do_generate_ecdhe_context(elliptic_curve_type);
+			void do_store_ecdhe_context(elliptic_curve_type, boost::shared_ptr<cryptoplus::pkey::ecdhe_context>);
 
 			// This strand is common to session requests, session messages and data messages.
-			boost::asio::strand m_session_strand;
+			profiled_strand m_session_strand;
+
+			peer_session& session_for(const ep_type& ep);
 
 			peer_session_map_type m_peer_sessions;
-			std::list<SharedBuffer> m_session_buffers;
+			// A one-entry MRU cache over m_peer_sessions for the hot sender.
+			// The map is node-based so the cached reference stays valid
+			// across insertions; sessions are cleared, never erased. Only
+			// ever touched from within the session strand.
+			ep_type m_hot_session_endpoint;
+			peer_session* m_hot_session;
+			TieredSharedBufferPool m_session_buffers;
 
 			bool m_accept_session_request_messages_default;
 			cipher_suite_list_type m_cipher_suites;
 			elliptic_curve_list_type m_elliptic_curves;
+			negotiation_cache_map_type m_negotiation_cache;
 			session_request_received_handler_type m_session_request_message_received_handler;
 
+			// A small pool of pre-generated ECDHE keypairs per elliptic curve,
+			// refilled outside of the session strand, so preparing a session
+			// does not pay the keypair generation cost inline.
+			std::map<elliptic_curve_type::value_type, std::vector<boost::shared_ptr<cryptoplus::pkey::ecdhe_context>>> m_ecdhe_context_cache;
+
 		private: // SESSION messages
 
 			void do_send_session(const identity_store&, const ep_type&, const peer_session::session_parameters&);
 			void do_handle_session(SharedBuffer, const identity_store&, const ep_type&, const session_message&);
 			void do_handle_verified_session(const identity_store&, const ep_type&, const session_message&);
+			void do_compute_session_keys(const identity_store&, const ep_type&, bool, boost::shared_ptr<peer_session::next_session_type>, const host_identifier_type&, const host_identifier_type&, const cryptoplus::buffer&);
+			void do_compute_resumed_session_keys(const identity_store&, const ep_type&, bool, boost::shared_ptr<peer_session::next_session_type>, const host_identifier_type&, const host_identifier_type&, const cryptoplus::buffer&);
+			void do_install_session_keys(const identity_store&, const ep_type&, bool, boost::shared_ptr<peer_session::next_session_type>, boost::shared_ptr<peer_session::current_session_type>);
+			void do_handle_session_keys_failure(const ep_type&, bool, const std::string&);
 
 			void do_set_accept_session_messages_default(bool, void_handler_type);
 			void do_set_session_message_received_callback(session_received_handler_type, void_handler_type);
@@ -1478,10 +2637,13 @@ namespace fscp
 
 		private: // DATA messages
 
-			void do_send_data(const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type);
-			void do_send_data_to_list(const std::set<ep_type>&, channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type);
-			void do_send_data_to_all(channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type);
-			void do_send_data_to_session(peer_session&, const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type);
+			void do_send_data(const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type, uint8_t tos);
+			void do_send_data_in_place(const ep_type&, channel_number_type, SharedBuffer, boost::asio::const_buffer, simple_handler_type, uint8_t tos);
+			void do_send_data_to_list(const std::set<ep_type>&, channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type, uint8_t tos);
+			void do_send_data_to_all(channel_number_type, boost::asio::const_buffer, multiple_endpoints_handler_type, uint8_t tos);
+			void do_send_data_to_session(peer_session&, const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type, uint8_t tos);
+			void do_send_data_to_session_in_place(peer_session&, const ep_type&, channel_number_type, SharedBuffer, boost::asio::const_buffer, simple_handler_type, uint8_t tos);
+			void do_send_data_to_session_staged(peer_session&, const ep_type&, channel_number_type, SharedBuffer, size_t, simple_handler_type, uint8_t tos);
 			void do_send_contact_request(const ep_type&, const hash_list_type&, simple_handler_type);
 			void do_send_contact_request_to_list(const std::set<ep_type>&, const hash_list_type&, multiple_endpoints_handler_type);
 			void do_send_contact_request_to_all(const hash_list_type&, multiple_endpoints_handler_type);
@@ -1490,33 +2652,430 @@ namespace fscp
 			void do_send_contact_to_list(const std::set<ep_type>&, const contact_map_type&, multiple_endpoints_handler_type);
 			void do_send_contact_to_all(const contact_map_type&, multiple_endpoints_handler_type);
 			void do_send_contact_to_session(peer_session&, const ep_type&, const contact_map_type&, simple_handler_type);
+			void do_send_contact_list(const ep_type&, const contact_list_type&, simple_handler_type);
+			void do_send_contact_to_session(peer_session&, const ep_type&, const contact_list_type&, simple_handler_type);
 			void handle_data_message_from(const identity_store&, SharedBuffer, const data_message&, const ep_type&);
-			void do_handle_data(const identity_store&, const ep_type&, const data_message&);
+			void do_handle_data(const identity_store&, const ep_type&, SharedBuffer, const data_message&);
 			void do_handle_data_message(const ep_type&, message_type, SharedBuffer, boost::asio::const_buffer);
+
+			boost::asio::strand& data_strand_for(const ep_type&);
+
+			// Data messages are ciphered on the data strands, outside of the
+			// session strand: the keyed session cipher contexts are shared so
+			// the ciphering code never touches the peer session directly. A
+			// given context is only ever used on the data strand of its peer.
+			size_t padded_send_length(const peer_session&, size_t cleartext_len) const;
+			void do_encrypt_and_send_data(const ep_type&, channel_number_type, extended_sequence_number_type, boost::shared_ptr<session_cipher_context>, SharedBuffer, boost::asio::const_buffer, size_t pad_to, simple_handler_type, uint8_t tos);
+			void do_encrypt_and_send_data_in_place(const ep_type&, channel_number_type, extended_sequence_number_type, boost::shared_ptr<session_cipher_context>, SharedBuffer, size_t, size_t, size_t pad_to, simple_handler_type, uint8_t tos);
+			void do_encrypt_and_send_data_staged(const ep_type&, channel_number_type, extended_sequence_number_type, boost::shared_ptr<session_cipher_context>, SharedBuffer, SharedBuffer, size_t, size_t pad_to, simple_handler_type, uint8_t tos);
+			// The keys a received data message is deciphered against. During
+			// the previous session's grace period a message may be tried
+			// against two epochs: the current one first, then the previous
+			// one as a fallback.
+			struct decryption_epoch
+			{
+				session_number_type session_number;
+				boost::shared_ptr<session_cipher_context> cipher_context;
+				extended_sequence_number_type sequence_number;
+			};
+
+			void do_decrypt_data(const identity_store&, const ep_type&, decryption_epoch, decryption_epoch, SharedBuffer, const data_message&);
+			void do_commit_data(const identity_store&, const ep_type&, session_number_type, extended_sequence_number_type, message_type, SharedBuffer, size_t);
 			void do_handle_contact_request(const ep_type&, const std::set<hash_type>&);
-			void do_handle_contact(const ep_type&, const contact_map_type&);
+			void do_handle_contact(const ep_type&, SharedBuffer, boost::asio::const_buffer);
 
 			void do_set_data_received_callback(data_received_handler_type, void_handler_type);
 			void do_set_contact_request_received_callback(contact_request_received_handler_type, void_handler_type);
 			void do_set_contact_received_callback(contact_received_handler_type, void_handler_type);
 
-			boost::asio::strand m_contact_strand;
+			/**
+			 * \brief The maximum count of out-of-order data messages held back per peer.
+			 */
+			static const size_t REORDER_BUFFER_MAX_SIZE = 32;
+
+			// A deciphered data message held back because it arrived ahead
+			// of a sequence gap, waiting for the missing message or for its
+			// hold deadline.
+			struct held_data_type
+			{
+				message_type type;
+				SharedBuffer buffer;
+				size_t len;
+				boost::posix_time::ptime deadline;
+			};
+
+			// The reordering state of a peer. Only ever touched in the
+			// session strand. The window is the reorder depth to absorb,
+			// learned from how far behind late messages actually arrive:
+			// it grows when a presumed-lost message shows up late and
+			// shrinks when a hold expires without the gap filling.
+			struct reorder_queue_type
+			{
+				reorder_queue_type() :
+					session_number(0),
+					next_sequence_number(0),
+					window(1)
+				{}
+
+				session_number_type session_number;
+				extended_sequence_number_type next_sequence_number;
+				size_t window;
+				std::map<extended_sequence_number_type, held_data_type> held;
+			};
+
+			void deliver_or_hold_data(const ep_type&, session_number_type, extended_sequence_number_type, message_type, SharedBuffer, size_t);
+			void flush_reorder_queue(const ep_type&, reorder_queue_type&);
+			void schedule_reorder_flush();
+			void do_flush_expired_reorder_data(const boost::system::error_code&);
+
+			unsigned int m_reorder_hold_ms;
+			boost::asio::deadline_timer m_reorder_timer;
+			boost::posix_time::ptime m_reorder_flush_at;
+			std::map<ep_type, reorder_queue_type> m_reorder_queues;
+
+			profiled_strand m_contact_strand;
+
+			/**
+			 * \brief The number of strands over which data message ciphering is distributed.
+			 */
+			static const size_t DATA_STRAND_POOL_SIZE = 8;
+
+			/**
+			 * \brief The maximum count of received data messages a single peer may have in flight in the decipher pipeline.
+			 */
+			static const size_t MAX_INFLIGHT_DECRYPTS = 64;
+
+			// Each peer is consistently mapped onto one of these strands, so
+			// data messages for different peers are ciphered in parallel while
+			// messages for a given peer keep their ordering.
+			std::vector<boost::shared_ptr<boost::asio::strand>> m_data_strands;
+
+			// Raised, and never lowered, once some peer is granted a weight
+			// above the default: the strand pool is only partitioned when
+			// prioritization is actually in use.
+			std::atomic<bool> m_has_prioritized_peers;
 
 			data_received_handler_type m_data_received_handler;
 			contact_request_received_handler_type m_contact_request_message_received_handler;
 			contact_received_handler_type m_contact_message_received_handler;
 
+			/**
+			 * @brief The frames coalescing towards one peer.
+			 */
+			struct coalesce_context_type
+			{
+				coalesce_context_type() :
+					size(0),
+					tos(0)
+				{
+				}
+
+				bool empty() const
+				{
+					return handlers.empty();
+				}
+
+				boost::optional<SharedBuffer> buffer; // The staged length-prefixed frames.
+				size_t size;
+				uint8_t tos; // The highest ToS mark of the staged frames.
+				std::vector<simple_handler_type> handlers; // One handler per staged frame.
+			};
+
+			typedef std::map<ep_type, coalesce_context_type> coalesce_context_map;
+
+			void do_coalesce_data(const ep_type&, peer_session&, boost::asio::const_buffer, simple_handler_type, uint8_t tos);
+			void do_flush_coalesced(const ep_type&);
+			void do_flush_all_coalesced(const boost::system::error_code&);
+			void do_encrypt_and_send_data_coalesced(const ep_type&, extended_sequence_number_type, boost::shared_ptr<session_cipher_context>, SharedBuffer, SharedBuffer, size_t, size_t pad_to, simple_handler_type, uint8_t tos);
+
+			bool m_data_coalescing_enabled;
+			bool m_data_padding_enabled;
+			coalesce_context_map m_coalesce_contexts;
+			boost::asio::deadline_timer m_coalesce_timer;
+			bool m_coalesce_flush_pending;
+
+		private: // Reliable channels
+
+			// Frames on a reliable channel start with a one-byte frame type.
+			static const uint8_t RELIABLE_FRAME_DATA = 0x01;
+			static const uint8_t RELIABLE_FRAME_SACK = 0x02;
+
+			// The payload bytes carried by one segment. The segment plus
+			// its framing must fit a typical path MTU once ciphered.
+			static const size_t RELIABLE_SEGMENT_SIZE = 1024;
+
+			// A DATA frame: type, message identifier, segment index and
+			// segment count. The payload follows; its length is implied by
+			// the frame length.
+			static const size_t RELIABLE_DATA_HEADER_SIZE = 1 + 3 * sizeof(uint16_t);
+
+			// A SACK frame: type, message identifier and block count,
+			// followed by the inclusive [start, end] segment index ranges.
+			static const size_t RELIABLE_SACK_HEADER_SIZE = 1 + sizeof(uint16_t) + 1;
+			static const size_t RELIABLE_MAX_SACK_BLOCKS = 16;
+
+			// Bounds the reassembly allocation a remote host can trigger.
+			static const uint16_t RELIABLE_MAX_SEGMENT_COUNT = 64;
+
+			static const unsigned int RELIABLE_MAX_ATTEMPTS = 8;
+
+			struct reliable_transfer_type
+			{
+				reliable_transfer_type() :
+					channel_number(CHANNEL_NUMBER_0),
+					length(0),
+					segment_count(0),
+					acked_count(0),
+					attempts_left(0),
+					ticks_before_retransmit(0),
+					backoff_ticks(0),
+					tos(0)
+				{
+				}
+
+				channel_number_type channel_number;
+				boost::optional<SharedBuffer> buffer; // The staged copy of the whole message.
+				size_t length;
+				uint16_t segment_count;
+				std::vector<bool> acked;
+				size_t acked_count;
+				unsigned int attempts_left;
+				unsigned int ticks_before_retransmit;
+				unsigned int backoff_ticks;
+				simple_handler_type handler;
+				uint8_t tos;
+			};
+
+			struct reliable_reassembly_type
+			{
+				reliable_reassembly_type() :
+					segment_count(0),
+					received_count(0),
+					length(0),
+					has_last(false),
+					delivered(false),
+					ticks_to_live(0)
+				{
+				}
+
+				boost::optional<SharedBuffer> buffer;
+				uint16_t segment_count;
+				std::vector<bool> received;
+				size_t received_count;
+				size_t length; // Known once the last segment arrived.
+				bool has_last;
+				bool delivered; // Kept around to re-acknowledge late retransmissions.
+				unsigned int ticks_to_live;
+			};
+
+			struct reliable_context_type
+			{
+				reliable_context_type() :
+					next_message_id(0)
+				{
+				}
+
+				bool empty() const
+				{
+					return outgoing.empty() && incoming.empty();
+				}
+
+				uint16_t next_message_id;
+				std::map<uint16_t, reliable_transfer_type> outgoing;
+				std::map<uint16_t, reliable_reassembly_type> incoming;
+			};
+
+			typedef std::map<ep_type, reliable_context_type> reliable_context_map;
+
+			void do_send_reliable_data(const ep_type&, channel_number_type, boost::asio::const_buffer, simple_handler_type, uint8_t tos);
+			void do_send_reliable_segment(const ep_type&, const reliable_transfer_type&, uint16_t message_id, uint16_t segment_index);
+			void do_send_reliable_sack(const ep_type&, channel_number_type, uint16_t message_id, const reliable_reassembly_type&);
+			void do_handle_reliable_frame(const ep_type&, channel_number_type, boost::asio::const_buffer);
+			void do_check_reliable_transfers(const boost::system::error_code&);
+			void arm_reliable_timer();
+
+			uint16_t m_reliable_channels;
+			reliable_context_map m_reliable_contexts;
+			boost::asio::deadline_timer m_reliable_timer;
+			bool m_reliable_timer_pending;
+
 		private: // Keep-alive
 
+			/**
+			 * \brief The number of slots of the keep-alive timer wheel.
+			 *
+			 * The wheel must cover the longest adaptive keep-alive period,
+			 * or long deadlines degenerate into repeated early wake-ups.
+			 */
+			static const size_t KEEP_ALIVE_WHEEL_SIZE = 128;
+
+			/**
+			 * \brief The learned keep-alive schedule of a single peer.
+			 *
+			 * The NAT timeout in front of a peer is probed empirically: the
+			 * interval doubles while it survives, then binary-searches
+			 * between the longest known-good and the shortest known-bad
+			 * values, so idle links carry as few keep-alives as their NAT
+			 * mapping tolerates.
+			 */
+			struct keep_alive_state_type
+			{
+				keep_alive_state_type() :
+					interval(SESSION_KEEP_ALIVE_PERIOD),
+					longest_good(SESSION_KEEP_ALIVE_PERIOD),
+					shortest_bad(boost::posix_time::not_a_date_time),
+					successes(0)
+				{}
+
+				boost::posix_time::time_duration interval;
+				boost::posix_time::time_duration longest_good;
+				boost::posix_time::time_duration shortest_bad;
+				unsigned int successes;
+			};
+
+			void schedule_keep_alive(const ep_type&, const boost::posix_time::time_duration& delay);
 			void do_check_keep_alive(const boost::system::error_code&);
 			void do_send_keep_alive(const ep_type&, simple_handler_type);
 
-			boost::asio::deadline_timer m_keep_alive_timer;
+			boost::posix_time::time_duration keep_alive_interval(const ep_type& target)
+			{
+				// All keep_alive_interval() calls are done in the session strand so the following is thread-safe.
+				return m_keep_alive_states[target].interval;
+			}
+
+			void record_keep_alive_survival(const ep_type&);
+			void record_keep_alive_failure(const ep_type&);
+
+			timer_service::timer_id m_keep_alive_timer_id;
+
+			// A hashed timer wheel over the peer sessions: each slot holds the
+			// endpoints whose next keep-alive deadline falls into it, so a
+			// tick only visits the sessions that are due instead of scanning
+			// all of them.
+			boost::array<std::set<ep_type>, KEEP_ALIVE_WHEEL_SIZE> m_keep_alive_wheel;
+			std::set<ep_type> m_keep_alive_scheduled;
+			size_t m_keep_alive_wheel_cursor;
+
+			// The learned schedules outlive the sessions on purpose: a
+			// re-established session starts from the interval its NAT
+			// already proved to tolerate.
+			std::map<ep_type, keep_alive_state_type> m_keep_alive_states;
+
+		private: // Counters
+
+			// The live counters of a peer. The members are only ever touched
+			// with relaxed atomic operations: the counters are diagnostic
+			// values and require no ordering with the data they count.
+			struct atomic_peer_counters_type
+			{
+				atomic_peer_counters_type() :
+					packets_in(0),
+					bytes_in(0),
+					packets_out(0),
+					bytes_out(0),
+					crypto_failures(0),
+					replay_drops(0),
+					decrypt_backlog_drops(0),
+					send_queue_depth(0),
+					decrypt_inflight(0),
+					send_weight(1)
+				{}
+
+				std::atomic<uint64_t> packets_in;
+				std::atomic<uint64_t> bytes_in;
+				std::atomic<uint64_t> packets_out;
+				std::atomic<uint64_t> bytes_out;
+				std::atomic<uint64_t> crypto_failures;
+				std::atomic<uint64_t> replay_drops;
+				std::atomic<uint64_t> decrypt_backlog_drops;
+				std::atomic<uint64_t> send_queue_depth;
+
+				// Not part of the snapshots: the live count of data messages
+				// queued for or undergoing deciphering on the data strand.
+				// Incremented from the session strand, decremented from the
+				// data strand.
+				std::atomic<uint32_t> decrypt_inflight;
+
+				// Not part of the snapshots: the scheduling weight of the
+				// peer, as set by set_peer_scheduling_weight().
+				std::atomic<uint32_t> send_weight;
+			};
+
+			atomic_peer_counters_type& counters_for(const ep_type& target);
+
+			static peer_counters_type make_counters_snapshot(const atomic_peer_counters_type& counters);
+
+			// The mutex only protects the map itself, and is only held for the
+			// time of a lookup or an insertion: the hot paths never hold it
+			// while counting.
+			mutable boost::mutex m_peer_counters_mutex;
+			std::map<ep_type, boost::shared_ptr<atomic_peer_counters_type>> m_peer_counters;
+
+		private: // Handshake timings
+
+			enum class handshake_stage : size_t
+			{
+				hello = 0,
+				session_setup,
+				total_initial,
+				renewal,
+			};
+
+			static const size_t HANDSHAKE_STAGE_COUNT = 4;
+
+			// The in-flight handshake stamps of a peer, in microseconds on
+			// the steady clock. The stages cross several strands, so the
+			// stamps are atomic; zero means the stage was not reached.
+			struct handshake_stamps_type
+			{
+				handshake_stamps_type() :
+					hello_sent_us(0),
+					session_request_us(0)
+				{}
+
+				std::atomic<uint64_t> hello_sent_us;
+				std::atomic<uint64_t> session_request_us;
+			};
+
+			handshake_stamps_type& handshake_stamps_for(const ep_type& target);
+			void record_handshake_duration(handshake_stage stage, uint64_t duration_us);
+
+			// The mutex only protects the map itself, and is only held for
+			// the time of a lookup or an insertion.
+			mutable boost::mutex m_handshake_stamps_mutex;
+			std::map<ep_type, boost::shared_ptr<handshake_stamps_type>> m_handshake_stamps;
+			std::atomic<uint64_t> m_handshake_histograms[HANDSHAKE_STAGE_COUNT * HANDSHAKE_BUCKET_COUNT];
+
+			// The per-peer RTT estimator. Samples come from the greet strand
+			// while readers can be on any thread, so the fields are atomic
+			// and the mutex only protects the map itself.
+			struct rtt_state_type
+			{
+				rtt_state_type() :
+					smoothed_rtt_us(0),
+					rtt_variance_us(0),
+					sample_count(0)
+				{}
+
+				std::atomic<uint64_t> smoothed_rtt_us;
+				std::atomic<uint64_t> rtt_variance_us;
+				std::atomic<uint64_t> sample_count;
+			};
+
+			rtt_state_type& rtt_state_for(const ep_type& target);
+			void record_rtt_sample(const ep_type& target, uint64_t sample_us);
+
+			mutable boost::mutex m_rtt_states_mutex;
+			std::map<ep_type, boost::shared_ptr<rtt_state_type>> m_rtt_states;
 
 		private: // Misc
 
 #ifdef USE_UPNP
+			void do_upnp_punch_hole(uint16_t port);
+			void do_refresh_upnp(const boost::system::error_code& ec);
+
 			boost::shared_ptr<miniupnpcplus::upnp_device> m_upnp;
+			boost::asio::deadline_timer m_upnp_timer;
 #endif
 
 			friend std::ostream& operator<<(std::ostream& os, presentation_status_type status)
@@ -48,6 +48,7 @@
 #include <boost/asio.hpp>
 
 #include "message.hpp"
+#include "message_layout.hpp"
 #include "buffer_tools.hpp"
 #include "constants.hpp"
 
@@ -126,6 +127,12 @@ namespace fscp
 			 */
 			elliptic_curve_type elliptic_curve() const;
 
+			/**
+			 * \brief Get the capability flags advertised by the sender.
+			 * \return The capability flags. Hosts from before the capability flags always advertise none, as the byte was reserved and written as zero.
+			 */
+			session_capability_flags_type capabilities() const;
+
 			/**
 			 * \brief Get the public key.
 			 * \return The public key.
@@ -173,10 +180,37 @@ namespace fscp
 
 		protected:
 
+			/**
+			 * \brief The layout of the fixed part of the body, in wire order: the session number, the host identifier, the cipher suite, the elliptic curve, the capability flags, a reserved byte and the public key length.
+			 */
+			typedef message_layout<
+				sizeof(session_number_type),
+				host_identifier_type::data_type::static_size,
+				sizeof(uint8_t),
+				sizeof(uint8_t),
+				sizeof(session_capability_flags_type),
+				sizeof(uint8_t),
+				sizeof(uint16_t)
+			> body_layout;
+
+			/**
+			 * \brief The field indices in body_layout.
+			 */
+			enum
+			{
+				FIELD_SESSION_NUMBER = 0,
+				FIELD_HOST_IDENTIFIER,
+				FIELD_CIPHER_SUITE,
+				FIELD_ELLIPTIC_CURVE,
+				FIELD_CAPABILITIES,
+				FIELD_RESERVED,
+				FIELD_PUBLIC_KEY_LENGTH
+			};
+
 			/**
 			 * \brief The min length of the body.
 			 */
-			static const size_t MIN_BODY_LENGTH = sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 4 + sizeof(uint16_t);
+			static const size_t MIN_BODY_LENGTH = body_layout::SIZE;
 
 			/**
 			 * \brief Write an unsigned session message to a buffer.
@@ -195,41 +229,46 @@ namespace fscp
 
 	inline session_number_type session_message::session_number() const
 	{
-		return ntohl(buffer_tools::get<session_number_type>(payload(), 0));
+		return ntohl(buffer_tools::get<session_number_type>(payload(), body_layout::field<FIELD_SESSION_NUMBER>::OFFSET));
 	}
 
 	inline host_identifier_type session_message::host_identifier() const
 	{
 		host_identifier_type result;
 
-		std::copy(payload() + sizeof(session_number_type), payload() + sizeof(session_number_type) + result.data.size(), result.data.begin());
+		std::copy(payload() + body_layout::field<FIELD_HOST_IDENTIFIER>::OFFSET, payload() + body_layout::field<FIELD_HOST_IDENTIFIER>::OFFSET + result.data.size(), result.data.begin());
 
 		return result;
 	}
 
 	inline cipher_suite_type session_message::cipher_suite() const
 	{
-		return buffer_tools::get<uint8_t>(payload(), sizeof(session_number_type) + host_identifier_type::data_type::static_size);
+		return buffer_tools::get<uint8_t>(payload(), body_layout::field<FIELD_CIPHER_SUITE>::OFFSET);
 	}
 
 	inline elliptic_curve_type session_message::elliptic_curve() const
 	{
-		return buffer_tools::get<uint8_t>(payload(), sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t));
+		return buffer_tools::get<uint8_t>(payload(), body_layout::field<FIELD_ELLIPTIC_CURVE>::OFFSET);
+	}
+
+	inline session_capability_flags_type session_message::capabilities() const
+	{
+		return buffer_tools::get<uint8_t>(payload(), body_layout::field<FIELD_CAPABILITIES>::OFFSET);
 	}
 
 	inline const uint8_t* session_message::public_key() const
 	{
-		return payload() + sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 2 + 2 + sizeof(uint16_t);
+		return payload() + body_layout::SIZE;
 	}
 
 	inline size_t session_message::public_key_size() const
 	{
-		return ntohs(buffer_tools::get<uint16_t>(payload(), sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 2 + 2));
+		return ntohs(buffer_tools::get<uint16_t>(payload(), body_layout::field<FIELD_PUBLIC_KEY_LENGTH>::OFFSET));
 	}
 
 	inline size_t session_message::header_size() const
 	{
-		return sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 2 + 2 + sizeof(uint16_t) + public_key_size();
+		return body_layout::SIZE + public_key_size();
 	}
 
 	inline const uint8_t* session_message::header_signature() const
@@ -54,6 +54,7 @@
 #include <cstring>
 
 #include <boost/asio.hpp>
+#include <boost/functional/hash.hpp>
 
 namespace fscp
 {
@@ -133,6 +134,22 @@ namespace fscp
 			 */
 			size_t elliptic_curve_capabilities_size() const;
 
+			/**
+			 * \brief Get a hash of the raw capability bytes.
+			 * \return A hash over the cipher suite and elliptic curve capabilities, as they appear on the wire.
+			 */
+			size_t capabilities_hash() const;
+
+			/**
+			 * \brief Get the session capabilities advertised by the sender.
+			 * \return The capability flags. Hosts from before the extension block advertise none.
+			 *
+			 * The extension block lies outside the signed region, so a third
+			 * party may strip it: a capability can only ever enable an
+			 * optional optimization, never weaken the base protocol.
+			 */
+			session_capability_flags_type capabilities() const;
+
 			/**
 			 * \brief Get the header size, without the signature.
 			 * \return The header size, without the signature.
@@ -210,6 +227,25 @@ namespace fscp
 		return ntohs(buffer_tools::get<uint16_t>(payload(), sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint16_t) + cipher_suite_capabilities_size()));
 	}
 
+	inline size_t session_request_message::capabilities_hash() const
+	{
+		const uint8_t* const begin = payload() + sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint16_t);
+
+		return boost::hash_range(begin, begin + cipher_suite_capabilities_size() + sizeof(uint16_t) + elliptic_curve_capabilities_size());
+	}
+
+	inline session_capability_flags_type session_request_message::capabilities() const
+	{
+		const size_t extensions_offset = header_size() + sizeof(uint16_t) + header_signature_size();
+
+		if (length() <= extensions_offset)
+		{
+			return 0x00;
+		}
+
+		return parse_extensions(payload() + extensions_offset, length() - extensions_offset);
+	}
+
 	inline size_t session_request_message::header_size() const
 	{
 		return sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint16_t) + cipher_suite_capabilities_size() + sizeof(uint16_t) + elliptic_curve_capabilities_size();
@@ -44,17 +44,204 @@
 
 #pragma once
 
+#include "memory_usage.hpp"
+
 #include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/function.hpp>
+#include <boost/lockfree/queue.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <ostream>
 #include <stdint.h>
 
 namespace fscp
 {
 	class SharedBuffer;
 
+	/**
+	 * \brief The stages of the packet pipeline a traced buffer goes through.
+	 */
+	enum class trace_stage : size_t
+	{
+		tap_read = 0,
+		filter_parse,
+		switch_decision,
+		encrypt,
+		socket_send,
+	};
+
+	/**
+	 * \brief The packet-path latency tracer.
+	 *
+	 * When tracing is enabled, buffers handed out by SharedBufferPool::get()
+	 * carry a timestamp side-channel. Each pipeline stage stamps the buffer
+	 * as it goes through: the time elapsed since the previous stamp is
+	 * aggregated into a power-of-two histogram attributed to the arriving
+	 * stage, so the time a frame spends between any two stages can be read
+	 * without attaching a profiler.
+	 *
+	 * The histograms are updated with relaxed atomic operations: tracing adds
+	 * one timestamp read and a couple of relaxed increments per stage.
+	 *
+	 * Timestamps are raw TSC values on x86, and steady-clock nanoseconds
+	 * elsewhere: the histograms are meant for relative comparisons, not for
+	 * absolute figures.
+	 */
+	class buffer_trace
+	{
+		public:
+
+			/**
+			 * \brief The count of pipeline stages.
+			 */
+			static const size_t STAGE_COUNT = 5;
+
+			/**
+			 * \brief The count of histogram buckets. Bucket N counts the deltas whose value is in [2^N, 2^(N+1)).
+			 */
+			static const size_t BUCKET_COUNT = 32;
+
+			typedef boost::array<uint64_t, BUCKET_COUNT> histogram_type;
+
+			/**
+			 * \brief The timestamp side-channel carried by a traced buffer.
+			 *
+			 * A buffer moves through the pipeline one handler at a time: the
+			 * handler chain provides the ordering, so the members need no
+			 * synchronization of their own.
+			 */
+			struct timestamps_type
+			{
+				timestamps_type() :
+					last_stamp(0)
+				{}
+
+				uint64_t last_stamp;
+			};
+
+			/**
+			 * \brief Enable the tracing mode. Only buffers handed out from now on are traced.
+			 */
+			static void enable()
+			{
+				enabled_flag().store(true, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Disable the tracing mode.
+			 */
+			static void disable()
+			{
+				enabled_flag().store(false, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Check whether the tracing mode is enabled.
+			 * \return true if the tracing mode is enabled.
+			 */
+			static bool is_enabled()
+			{
+				return enabled_flag().load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the current timestamp.
+			 * \return The TSC value on x86, steady-clock nanoseconds elsewhere.
+			 */
+			static uint64_t now()
+			{
+#if defined(__x86_64__) || defined(__i386__)
+				return __builtin_ia32_rdtsc();
+#else
+				return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+			}
+
+			/**
+			 * \brief Record a stage-arrival delta into the histograms.
+			 * \param stage The stage the buffer arrived at.
+			 * \param delta The time elapsed since the previous stamp.
+			 */
+			static void record(trace_stage stage, uint64_t delta)
+			{
+				size_t bucket = 0;
+
+				while ((delta >>= 1) && (bucket < BUCKET_COUNT - 1))
+				{
+					++bucket;
+				}
+
+				histograms()[static_cast<size_t>(stage) * BUCKET_COUNT + bucket].fetch_add(1, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get a snapshot of the histogram of a stage.
+			 * \param stage The stage.
+			 * \return The histogram. Can be called from any thread, at any time.
+			 */
+			static histogram_type get_histogram(trace_stage stage)
+			{
+				histogram_type result;
+
+				for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+				{
+					result[bucket] = histograms()[static_cast<size_t>(stage) * BUCKET_COUNT + bucket].load(std::memory_order_relaxed);
+				}
+
+				return result;
+			}
+
+			/**
+			 * \brief Write a human-readable report of the non-empty histograms.
+			 * \param os The stream to write to.
+			 */
+			static void report(std::ostream& os)
+			{
+				static const char* const stage_names[STAGE_COUNT] = {
+					"tap_read",
+					"filter_parse",
+					"switch_decision",
+					"encrypt",
+					"socket_send",
+				};
+
+				for (size_t stage = 0; stage < STAGE_COUNT; ++stage)
+				{
+					const histogram_type histogram = get_histogram(static_cast<trace_stage>(stage));
+
+					for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+					{
+						if (histogram[bucket] > 0)
+						{
+							os << stage_names[stage] << " [" << (static_cast<uint64_t>(1) << bucket) << ", " << (static_cast<uint64_t>(1) << (bucket + 1)) << "): " << histogram[bucket] << "\n";
+						}
+					}
+				}
+			}
+
+		private:
+
+			static std::atomic<bool>& enabled_flag()
+			{
+				static std::atomic<bool> flag(false);
+
+				return flag;
+			}
+
+			static std::atomic<uint64_t>* histograms()
+			{
+				// Zero-initialized, like any static storage duration array.
+				static std::atomic<uint64_t> values[STAGE_COUNT * BUCKET_COUNT];
+
+				return values;
+			}
+	};
+
 	boost::asio::mutable_buffers_1 buffer(const SharedBuffer&);
 	boost::asio::mutable_buffers_1 buffer(const SharedBuffer&, size_t);
 	template <typename Type> Type buffer_cast(const SharedBuffer&);
@@ -78,10 +265,48 @@ namespace fscp
 			{
 			}
 
+			/**
+			 * \brief Attach a fresh timestamp side-channel to the buffer.
+			 *
+			 * Only copies made afterwards share the side-channel: this is
+			 * meant to be called right when the buffer is handed out, before
+			 * it enters the pipeline.
+			 */
+			void trace_attach()
+			{
+				m_trace = boost::make_shared<buffer_trace::timestamps_type>();
+			}
+
+			/**
+			 * \brief Stamp the buffer as arriving at a pipeline stage.
+			 * \param stage The stage.
+			 *
+			 * A no-op unless the buffer carries a timestamp side-channel. The
+			 * time elapsed since the previous stamp, if any, is recorded into
+			 * the buffer_trace histograms under stage.
+			 */
+			void trace_stamp(trace_stage stage) const
+			{
+				if (!m_trace)
+				{
+					return;
+				}
+
+				const uint64_t now = buffer_trace::now();
+
+				if (m_trace->last_stamp != 0)
+				{
+					buffer_trace::record(stage, now - m_trace->last_stamp);
+				}
+
+				m_trace->last_stamp = now;
+			}
+
 		private:
 			size_t m_size;
 			boost::shared_array<uint8_t> m_data;
 			boost::shared_ptr<SharedBuffer> m_buffer;
+			boost::shared_ptr<buffer_trace::timestamps_type> m_trace;
 
 			friend inline boost::asio::mutable_buffers_1 buffer(const SharedBuffer& buf)
 			{
@@ -133,6 +358,227 @@ namespace fscp
 			}
 	};
 
+	/**
+	 * \brief A lock-free pool of shared buffers.
+	 *
+	 * Buffers handed out by get() return to the pool when their last
+	 * reference goes away. The release can happen from any thread without
+	 * locking or posting to a strand.
+	 *
+	 * The pool instance must outlive every buffer it handed out.
+	 */
+	class SharedBufferPool
+	{
+		public:
+
+			/**
+			 * \brief The default maximum number of idle buffers kept in the pool.
+			 */
+			static const size_t DEFAULT_CAPACITY = 128;
+
+			/**
+			 * \brief Create a shared buffer pool.
+			 * \param buffer_size The size of the buffers to hand out.
+			 * \param capacity The maximum number of idle buffers kept for recycling. Buffers released while the pool is full are simply freed.
+			 */
+			explicit SharedBufferPool(size_t buffer_size, size_t capacity = DEFAULT_CAPACITY) :
+				m_buffer_size(buffer_size),
+				m_pool(capacity),
+				m_idle_count(0)
+			{}
+
+			SharedBufferPool(const SharedBufferPool&) = delete;
+			SharedBufferPool& operator=(const SharedBufferPool&) = delete;
+
+			~SharedBufferPool()
+			{
+				SharedBuffer* recycled = nullptr;
+
+				while (m_pool.pop(recycled))
+				{
+					memory_usage::remove(memory_subsystem::buffer_pools, m_buffer_size);
+
+					delete recycled;
+				}
+			}
+
+			/**
+			 * \brief Get either a new buffer or an old, recycled one if possible.
+			 * \return A shared buffer that returns to the pool upon release.
+			 */
+			SharedBuffer get()
+			{
+				SharedBuffer* recycled = nullptr;
+
+				const SharedBuffer inner_buffer = m_pool.pop(recycled) ? [this, recycled] () {
+					const SharedBuffer result = *recycled;
+
+					delete recycled;
+
+					m_idle_count.fetch_sub(1, std::memory_order_relaxed);
+
+					return result;
+				}() : [this] () {
+					// Idle buffers stay accounted: they are resident
+					// memory whether or not they are handed out.
+					memory_usage::add(memory_subsystem::buffer_pools, m_buffer_size);
+
+					return SharedBuffer(m_buffer_size);
+				}();
+
+				SharedBuffer result(inner_buffer, [this] (const SharedBuffer& buf) {
+					recycle(buf);
+				});
+
+				if (buffer_trace::is_enabled())
+				{
+					result.trace_attach();
+				}
+
+				return result;
+			}
+
+			/**
+			 * \brief Get the approximate count of idle buffers kept in the pool.
+			 * \return The idle buffer count. The value is a relaxed snapshot intended for diagnostics.
+			 */
+			size_t idle_count() const
+			{
+				return m_idle_count.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Fill the pool with idle buffers, up to the specified count.
+			 * \param count The count of idle buffers to reach.
+			 *
+			 * Deployments with a compile-time peer capacity call this at
+			 * startup so the steady state only ever recycles. Counts past
+			 * the pool capacity are silently truncated.
+			 */
+			void prefill(size_t count)
+			{
+				while (idle_count() < count)
+				{
+					SharedBuffer* const fresh = new SharedBuffer(m_buffer_size);
+
+					if (m_pool.push(fresh))
+					{
+						memory_usage::add(memory_subsystem::buffer_pools, m_buffer_size);
+
+						m_idle_count.fetch_add(1, std::memory_order_relaxed);
+					}
+					else
+					{
+						// The pool is full: the capacity bounds the prefill.
+						delete fresh;
+
+						break;
+					}
+				}
+			}
+
+		private:
+
+			void recycle(const SharedBuffer& buf)
+			{
+				SharedBuffer* const copy = new SharedBuffer(buf);
+
+				if (m_pool.push(copy))
+				{
+					m_idle_count.fetch_add(1, std::memory_order_relaxed);
+				}
+				else
+				{
+					// The pool is full: let the buffer go away.
+					memory_usage::remove(memory_subsystem::buffer_pools, m_buffer_size);
+
+					delete copy;
+				}
+			}
+
+			size_t m_buffer_size;
+			boost::lockfree::queue<SharedBuffer*, boost::lockfree::fixed_sized<true>> m_pool;
+			std::atomic<size_t> m_idle_count;
+	};
+
+	/**
+	 * \brief A size-tiered pool of shared buffers.
+	 *
+	 * Most exchanged frames are no larger than the link MTU, yet a uniform
+	 * pool must size every buffer for the worst-case datagram. This pool
+	 * keeps two tiers - a small one for ordinary frames and a large one for
+	 * jumbo or worst-case datagrams - and picks the tier from the size the
+	 * caller asks for, so the idle memory kept for recycling scales with
+	 * the traffic actually seen instead of with the theoretical maximum.
+	 *
+	 * Callers that cannot bound the size they need - a socket receive, for
+	 * instance - use the parameterless get() and always pay the worst case.
+	 */
+	class TieredSharedBufferPool
+	{
+		public:
+
+			/**
+			 * \brief The default size of the small tier buffers. Large enough for any MTU-sized frame plus its protocol overhead.
+			 */
+			static const size_t DEFAULT_SMALL_BUFFER_SIZE = 2048;
+
+			/**
+			 * \brief Create a size-tiered shared buffer pool.
+			 * \param large_buffer_size The size of the large tier buffers. This is the worst-case buffer size.
+			 * \param small_buffer_size The size of the small tier buffers.
+			 */
+			explicit TieredSharedBufferPool(size_t large_buffer_size, size_t small_buffer_size = DEFAULT_SMALL_BUFFER_SIZE) :
+				m_small_buffer_size(small_buffer_size),
+				m_small_pool(small_buffer_size),
+				m_large_pool(large_buffer_size)
+			{}
+
+			/**
+			 * \brief Get a buffer large enough to hold the specified count of bytes.
+			 * \param size The count of bytes the buffer must hold.
+			 * \return A shared buffer from the smallest tier that fits.
+			 */
+			SharedBuffer get(size_t size)
+			{
+				return (size <= m_small_buffer_size) ? m_small_pool.get() : m_large_pool.get();
+			}
+
+			/**
+			 * \brief Get a buffer of the worst-case size.
+			 * \return A shared buffer from the large tier.
+			 */
+			SharedBuffer get()
+			{
+				return m_large_pool.get();
+			}
+
+			/**
+			 * \brief Get the approximate count of idle buffers kept in the pool, all tiers included.
+			 * \return The idle buffer count. The value is a relaxed snapshot intended for diagnostics.
+			 */
+			size_t idle_count() const
+			{
+				return m_small_pool.idle_count() + m_large_pool.idle_count();
+			}
+
+			/**
+			 * \brief Fill every tier with idle buffers, up to the specified count each.
+			 * \param count The count of idle buffers to reach in each tier.
+			 */
+			void prefill(size_t count)
+			{
+				m_small_pool.prefill(count);
+				m_large_pool.prefill(count);
+			}
+
+		private:
+
+			size_t m_small_buffer_size;
+			SharedBufferPool m_small_pool;
+			SharedBufferPool m_large_pool;
+	};
+
 	template <typename Handler>
 	class SharedBufferHandler
 	{
@@ -0,0 +1,313 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file strand_profiler.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief Strand profiling primitives.
+ */
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+namespace fscp
+{
+	/**
+	 * \brief Read the profiling timestamp counter.
+	 * \return The current timestamp, in arbitrary ticks.
+	 *
+	 * On x86 this is the rdtsc counter, which is cheap enough to read on
+	 * the data path. On other architectures the steady clock is used
+	 * instead; the ticks are only ever compared to each other, so the unit
+	 * does not matter as long as it is monotonic.
+	 */
+	inline uint64_t profiling_ticks()
+	{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+	}
+
+	/**
+	 * \brief The profile of a strand.
+	 *
+	 * The recording side only ever uses relaxed atomic operations: the
+	 * values are diagnostic and require no ordering with the handlers they
+	 * measure. Taking a snapshot never posts to any strand.
+	 */
+	class strand_profiler
+	{
+		public:
+
+			/**
+			 * \brief The count of power-of-two histogram buckets.
+			 *
+			 * Bucket N counts the durations in [2^N, 2^(N+1)) ticks.
+			 */
+			static const size_t BUCKET_COUNT = 64;
+
+			/**
+			 * \brief A snapshot of the profile.
+			 */
+			struct snapshot_type
+			{
+				snapshot_type() :
+					handler_count(0),
+					total_wait_ticks(0),
+					total_execution_ticks(0),
+					wait_histogram(),
+					execution_histogram()
+				{}
+
+				uint64_t handler_count;
+				uint64_t total_wait_ticks;
+				uint64_t total_execution_ticks;
+				boost::array<uint64_t, BUCKET_COUNT> wait_histogram;
+				boost::array<uint64_t, BUCKET_COUNT> execution_histogram;
+			};
+
+			strand_profiler() :
+				m_enabled(false),
+				m_handler_count(0),
+				m_total_wait_ticks(0),
+				m_total_execution_ticks(0),
+				m_wait_histogram(),
+				m_execution_histogram()
+			{
+			}
+
+			strand_profiler(const strand_profiler&) = delete;
+			strand_profiler& operator=(const strand_profiler&) = delete;
+
+			/**
+			 * \brief Check whether profiling is enabled.
+			 * \return The enabled state.
+			 */
+			bool enabled() const
+			{
+				return m_enabled.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Enable or disable profiling.
+			 * \param value The enabled state.
+			 *
+			 * When disabled, the recording overhead is a single relaxed
+			 * atomic load per handler.
+			 */
+			void set_enabled(bool value)
+			{
+				m_enabled.store(value, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Record a handler run.
+			 * \param queued Whether the wait time is known. It is not for handlers wrapped at operation start.
+			 * \param wait_ticks The time the handler spent queued, in ticks.
+			 * \param execution_ticks The time the handler ran, in ticks.
+			 */
+			void record(bool queued, uint64_t wait_ticks, uint64_t execution_ticks)
+			{
+				m_handler_count.fetch_add(1, std::memory_order_relaxed);
+
+				if (queued)
+				{
+					m_total_wait_ticks.fetch_add(wait_ticks, std::memory_order_relaxed);
+					m_wait_histogram[bucket_of(wait_ticks)].fetch_add(1, std::memory_order_relaxed);
+				}
+
+				m_total_execution_ticks.fetch_add(execution_ticks, std::memory_order_relaxed);
+				m_execution_histogram[bucket_of(execution_ticks)].fetch_add(1, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Take a snapshot of the profile.
+			 * \return The snapshot.
+			 */
+			snapshot_type snapshot() const
+			{
+				snapshot_type result;
+
+				result.handler_count = m_handler_count.load(std::memory_order_relaxed);
+				result.total_wait_ticks = m_total_wait_ticks.load(std::memory_order_relaxed);
+				result.total_execution_ticks = m_total_execution_ticks.load(std::memory_order_relaxed);
+
+				for (size_t i = 0; i < BUCKET_COUNT; ++i)
+				{
+					result.wait_histogram[i] = m_wait_histogram[i].load(std::memory_order_relaxed);
+					result.execution_histogram[i] = m_execution_histogram[i].load(std::memory_order_relaxed);
+				}
+
+				return result;
+			}
+
+		private:
+
+			static size_t bucket_of(uint64_t value)
+			{
+				size_t bucket = 0;
+
+				while ((value >>= 1) && (bucket < BUCKET_COUNT - 1))
+				{
+					++bucket;
+				}
+
+				return bucket;
+			}
+
+			std::atomic<bool> m_enabled;
+			std::atomic<uint64_t> m_handler_count;
+			std::atomic<uint64_t> m_total_wait_ticks;
+			std::atomic<uint64_t> m_total_execution_ticks;
+			boost::array<std::atomic<uint64_t>, BUCKET_COUNT> m_wait_histogram;
+			boost::array<std::atomic<uint64_t>, BUCKET_COUNT> m_execution_histogram;
+	};
+
+	/**
+	 * \brief A handler proxy that records its wait and execution times.
+	 */
+	template <typename Handler>
+	class timed_handler
+	{
+		public:
+
+			timed_handler(strand_profiler& profiler, Handler handler, uint64_t enqueue_ticks) :
+				m_profiler(&profiler),
+				m_handler(handler),
+				m_enqueue_ticks(enqueue_ticks)
+			{
+			}
+
+			template <typename... Args>
+			void operator()(Args&&... args)
+			{
+				if (!m_profiler->enabled())
+				{
+					m_handler(std::forward<Args>(args)...);
+
+					return;
+				}
+
+				const uint64_t start = profiling_ticks();
+				const bool queued = (m_enqueue_ticks != 0);
+				const uint64_t wait_ticks = queued ? (start - m_enqueue_ticks) : 0;
+
+				m_handler(std::forward<Args>(args)...);
+
+				m_profiler->record(queued, wait_ticks, profiling_ticks() - start);
+			}
+
+		private:
+
+			strand_profiler* m_profiler;
+			Handler m_handler;
+			uint64_t m_enqueue_ticks;
+	};
+
+	/**
+	 * \brief A strand that profiles its handlers.
+	 *
+	 * This is a drop-in replacement for the post() and wrap() subset of
+	 * boost::asio::strand. Posted handlers get their queue wait and
+	 * execution times recorded; wrapped handlers only get their execution
+	 * time, as the enqueue instant of a completion handler is not
+	 * observable from here.
+	 */
+	class profiled_strand
+	{
+		public:
+
+			profiled_strand(boost::asio::io_service& io_service, strand_profiler& profiler) :
+				m_strand(io_service),
+				m_profiler(profiler)
+			{
+			}
+
+			template <typename Handler>
+			void post(Handler handler)
+			{
+				if (m_profiler.enabled())
+				{
+					m_strand.post(timed_handler<Handler>(m_profiler, handler, profiling_ticks()));
+				}
+				else
+				{
+					m_strand.post(handler);
+				}
+			}
+
+			template <typename Handler>
+			void dispatch(Handler handler)
+			{
+				if (m_profiler.enabled())
+				{
+					m_strand.dispatch(timed_handler<Handler>(m_profiler, handler, profiling_ticks()));
+				}
+				else
+				{
+					m_strand.dispatch(handler);
+				}
+			}
+
+			template <typename Handler>
+			auto wrap(Handler handler) -> decltype(std::declval<boost::asio::io_service::strand&>().wrap(timed_handler<Handler>(std::declval<strand_profiler&>(), handler, 0)))
+			{
+				return m_strand.wrap(timed_handler<Handler>(m_profiler, handler, 0));
+			}
+
+		private:
+
+			boost::asio::io_service::strand m_strand;
+			strand_profiler& m_profiler;
+	};
+}
@@ -0,0 +1,204 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file tcp_transport.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A TCP fallback transport for the FSCP message layer.
+ */
+
+#ifndef FSCP_TCP_TRANSPORT_HPP
+#define FSCP_TCP_TRANSPORT_HPP
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+
+#include "logger.hpp"
+#include "shared_buffer.hpp"
+
+namespace fscp
+{
+	/**
+	 * \brief A TCP fallback transport for the FSCP message layer.
+	 *
+	 * Some networks (hotels, enterprise firewalls) block UDP entirely. The
+	 * TCP transport carries the very same FSCP messages over a stream
+	 * connection, each message prefixed by its 16-bit big-endian length, so
+	 * the message layer above does not have to know which transport a peer
+	 * uses.
+	 *
+	 * Connections are keyed by the peer endpoint as the message layer sees
+	 * it: the configured contact endpoint for outgoing connections, the
+	 * remote endpoint of the stream for incoming ones.
+	 */
+	class tcp_transport
+	{
+		public:
+
+			/**
+			 * \brief The endpoint type, as seen by the message layer.
+			 */
+			typedef boost::asio::ip::udp::endpoint ep_type;
+
+			/**
+			 * \brief The TCP endpoint type.
+			 */
+			typedef boost::asio::ip::tcp::endpoint tcp_ep_type;
+
+			/**
+			 * \brief A simple operation handler.
+			 */
+			typedef boost::function<void (const boost::system::error_code&)> simple_handler_type;
+
+			/**
+			 * \brief A message received handler.
+			 */
+			typedef boost::function<void (const ep_type&, SharedBuffer, size_t)> message_received_handler_type;
+
+			/**
+			 * \brief A connection lost handler.
+			 */
+			typedef boost::function<void (const ep_type&)> connection_lost_handler_type;
+
+			/**
+			 * \brief The maximum size of a framed message.
+			 */
+			static const size_t MAX_FRAME_SIZE = 65535;
+
+			/**
+			 * \brief The maximum count of bytes queued on one connection, waiting to be written.
+			 */
+			static const size_t MAX_PENDING_WRITE_SIZE = 262144;
+
+			/**
+			 * \brief Create a new TCP transport.
+			 * \param io_service The io_service to use.
+			 * \param _logger The logger to use.
+			 */
+			tcp_transport(boost::asio::io_service& io_service, fscp::logger& _logger);
+
+			tcp_transport(const tcp_transport&) = delete;
+			tcp_transport& operator=(const tcp_transport&) = delete;
+
+			/**
+			 * \brief Set the message received callback.
+			 * \param callback The callback.
+			 *
+			 * \warning This method must be called before open().
+			 */
+			void set_message_received_callback(message_received_handler_type callback)
+			{
+				m_message_received_handler = callback;
+			}
+
+			/**
+			 * \brief Set the connection lost callback.
+			 * \param callback The callback.
+			 *
+			 * \warning This method must be called before open().
+			 */
+			void set_connection_lost_callback(connection_lost_handler_type callback)
+			{
+				m_connection_lost_handler = callback;
+			}
+
+			/**
+			 * \brief Open the transport and start accepting connections.
+			 * \param listen_endpoint The endpoint to listen onto.
+			 */
+			void open(const ep_type& listen_endpoint);
+
+			/**
+			 * \brief Close the transport and all its connections.
+			 */
+			void close();
+
+			/**
+			 * \brief Check whether a connection exists with the specified peer.
+			 * \param target The peer endpoint.
+			 * \return true if a connection exists.
+			 */
+			bool has_connection(const ep_type& target) const;
+
+			/**
+			 * \brief Connect to the specified peer, if no connection exists yet.
+			 * \param target The peer endpoint.
+			 * \param handler The handler to call when the connection is established (or when it failed to be).
+			 */
+			void async_connect(const ep_type& target, simple_handler_type handler);
+
+			/**
+			 * \brief Send a message to the specified peer.
+			 * \param target The peer endpoint. A connection must exist with it.
+			 * \param data The message. The referenced buffer must remain valid until the handler gets called.
+			 * \param offset The offset at which the message starts.
+			 * \param size The size of the message.
+			 * \param handler The handler to call when the message was written (or discarded).
+			 * \param droppable Whether the message may be shed when the connection cannot drain fast enough.
+			 */
+			void async_send(const ep_type& target, SharedBuffer data, size_t offset, size_t size, simple_handler_type handler, bool droppable = false);
+
+		private:
+
+			struct connection;
+
+			void async_accept();
+			boost::shared_ptr<connection> connection_for(const ep_type& target) const;
+			void register_connection(const ep_type& target, boost::shared_ptr<connection> conn);
+			void handle_connection_lost(const ep_type& target, boost::shared_ptr<connection> conn);
+
+			boost::asio::io_service& m_io_service;
+			fscp::logger& m_logger;
+			boost::asio::ip::tcp::acceptor m_acceptor;
+			message_received_handler_type m_message_received_handler;
+			connection_lost_handler_type m_connection_lost_handler;
+			SharedBufferPool m_receive_buffers;
+
+			// Connections are looked up from the caller's context on every
+			// send and registered from the acceptor and connect handlers, so
+			// the map is protected with a mutex instead of a strand.
+			mutable boost::mutex m_connections_mutex;
+			std::map<ep_type, boost::shared_ptr<connection> > m_connections;
+	};
+}
+
+#endif /* FSCP_TCP_TRANSPORT_HPP */
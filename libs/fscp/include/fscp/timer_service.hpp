@@ -0,0 +1,148 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file timer_service.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A coalescing timer service.
+ */
+
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <vector>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * \brief A timer service that coalesces many timeouts into a single OS timer.
+	 *
+	 * Every scheduled timeout used to be its own
+	 * boost::asio::deadline_timer, which costs a kernel timer update and
+	 * heap state per operation: thousands of concurrent greets show up
+	 * as timer churn in kernel profiles. The service rounds the
+	 * deadlines up to a fixed granularity and keeps one deadline_timer
+	 * armed on the earliest bucket, so the kernel timer is only
+	 * reprogrammed when an earlier bucket appears.
+	 *
+	 * The handlers follow the deadline_timer::async_wait() contract: a
+	 * handler is always invoked exactly once, with a success code on
+	 * expiry or with boost::asio::error::operation_aborted after a
+	 * cancellation.
+	 *
+	 * The service is thread-safe.
+	 */
+	class timer_service
+	{
+		public:
+
+			/**
+			 * \brief The identifier of a scheduled timeout. Never 0 for a valid timeout.
+			 */
+			typedef uint64_t timer_id;
+
+			/**
+			 * \brief The handler type for a scheduled timeout.
+			 */
+			typedef boost::function<void (const boost::system::error_code&)> timer_handler_type;
+
+			/**
+			 * \brief Create a timer service.
+			 * \param io_service The io_service instance to run the timeouts on.
+			 * \param granularity The coalescing granularity. Deadlines are rounded up to it, never down.
+			 */
+			explicit timer_service(boost::asio::io_service& io_service, const boost::posix_time::time_duration& granularity = boost::posix_time::milliseconds(50));
+
+			/**
+			 * \brief Schedule a timeout.
+			 * \param timeout The time to wait before invoking the handler.
+			 * \param handler The handler to invoke upon expiry or cancellation.
+			 * \return The identifier of the scheduled timeout.
+			 */
+			timer_id schedule(const boost::posix_time::time_duration& timeout, timer_handler_type handler);
+
+			/**
+			 * \brief Cancel a scheduled timeout.
+			 * \param id The identifier of the timeout.
+			 * \return The count of cancelled timeouts, as deadline_timer::cancel() would return: 1, or 0 if it was too late to cancel.
+			 *
+			 * The handler of a cancelled timeout is posted with
+			 * boost::asio::error::operation_aborted.
+			 */
+			size_t cancel(timer_id id);
+
+			/**
+			 * \brief Cancel all the scheduled timeouts.
+			 *
+			 * This call is similar to calling cancel() for every scheduled timeout.
+			 */
+			void cancel_all();
+
+		private:
+
+			struct pending_type
+			{
+				timer_id id;
+				timer_handler_type handler;
+			};
+
+			typedef std::map<boost::posix_time::ptime, std::vector<pending_type> > bucket_map_type;
+			typedef std::map<timer_id, boost::posix_time::ptime> deadline_map_type;
+
+			void arm_locked(const boost::posix_time::ptime& deadline);
+			void handle_tick(const boost::system::error_code& ec);
+
+			boost::asio::io_service& m_io_service;
+			boost::posix_time::time_duration m_granularity;
+			boost::posix_time::ptime m_epoch;
+			boost::asio::deadline_timer m_timer;
+			bool m_armed;
+			boost::posix_time::ptime m_armed_deadline;
+			timer_id m_next_id;
+			bucket_map_type m_buckets;
+			deadline_map_type m_deadlines;
+			boost::mutex m_mutex;
+	};
+}
@@ -0,0 +1,145 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file async_logger.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief An asynchronous log sink.
+ */
+
+#include "async_logger.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+namespace fscp
+{
+	async_logger::async_logger(log_handler_type handler, size_t capacity) :
+		m_handler(handler),
+		m_ring(capacity),
+		m_head(0),
+		m_count(0),
+		m_dropped(0),
+		m_stopping(false),
+		m_thread(&async_logger::run, this)
+	{
+	}
+
+	async_logger::~async_logger()
+	{
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			m_stopping = true;
+		}
+
+		m_condition.notify_one();
+
+		m_thread.join();
+	}
+
+	void async_logger::log(log_level level, const std::string& msg, const logger::timestamp_type& timestamp)
+	{
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			if (m_count == m_ring.size())
+			{
+				// Dropping is preferable to blocking the caller: the drop
+				// count is reported once the writer catches up.
+				++m_dropped;
+
+				return;
+			}
+
+			record_type& record = m_ring[(m_head + m_count) % m_ring.size()];
+
+			record.level = level;
+			record.msg = msg;
+			record.timestamp = timestamp;
+
+			++m_count;
+		}
+
+		m_condition.notify_one();
+	}
+
+	void async_logger::run()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		while (!m_stopping || (m_count > 0))
+		{
+			if (m_count == 0)
+			{
+				m_condition.wait(lock);
+
+				continue;
+			}
+
+			// The record is moved out so the handler runs without the lock
+			// held and the callers are never delayed by the output.
+			record_type record;
+
+			std::swap(record, m_ring[m_head]);
+
+			m_head = (m_head + 1) % m_ring.size();
+			--m_count;
+
+			const size_t dropped = (m_count == 0) ? m_dropped : 0;
+
+			if (dropped > 0)
+			{
+				m_dropped = 0;
+			}
+
+			lock.unlock();
+
+			if (m_handler)
+			{
+				m_handler(record.level, record.msg, record.timestamp);
+
+				if (dropped > 0)
+				{
+					m_handler(log_level::important, "Dropped " + boost::lexical_cast<std::string>(dropped) + " log record(s): the log sink could not keep up.", boost::posix_time::microsec_clock::local_time());
+				}
+			}
+
+			lock.lock();
+		}
+	}
+}
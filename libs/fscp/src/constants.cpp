@@ -45,6 +45,8 @@
 #include "constants.hpp"
 
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
 
 #include <cryptoplus/hash/message_digest_context.hpp>
 
@@ -53,8 +55,10 @@ namespace fscp
 	const cipher_suite_type::value_type cipher_suite_type::unsupported = 0x00;
 	const cipher_suite_type::value_type cipher_suite_type::ecdhe_rsa_aes128_gcm_sha256 = 0x01;
 	const cipher_suite_type::value_type cipher_suite_type::ecdhe_rsa_aes256_gcm_sha384 = 0x02;
+	const cipher_suite_type::value_type cipher_suite_type::ecdhe_rsa_chacha20_poly1305_sha256 = 0x03;
 	const std::string cipher_suite_type::ecdhe_rsa_aes128_gcm_sha256_string("ecdhe_rsa_aes128_gcm_sha256");
 	const std::string cipher_suite_type::ecdhe_rsa_aes256_gcm_sha384_string("ecdhe_rsa_aes256_gcm_sha384");
+	const std::string cipher_suite_type::ecdhe_rsa_chacha20_poly1305_sha256_string("ecdhe_rsa_chacha20_poly1305_sha256");
 	const elliptic_curve_type::value_type elliptic_curve_type::unsupported = 0x00;
 	const elliptic_curve_type::value_type elliptic_curve_type::sect571k1 = 0x01;
 	const elliptic_curve_type::value_type elliptic_curve_type::secp384r1 = 0x02;
@@ -88,10 +92,15 @@ namespace fscp
 		assert(!!buf);
 		assert(!!cert);
 
-		cryptoplus::hash::message_digest_context mdctx;
-		mdctx.initialize(get_default_digest_algorithm());
-		mdctx.update(cert.write_der());
-		mdctx.finalize(buf, buflen);
+		// The fingerprint is computed once per certificate and cached, which matters when the same certificates get hashed over and over during reconnections.
+		const cryptoplus::buffer& fingerprint = cert.sha256_fingerprint();
+
+		if (buflen < cryptoplus::buffer_size(fingerprint))
+		{
+			throw std::runtime_error("buflen");
+		}
+
+		std::memcpy(buf, cryptoplus::buffer_cast<const uint8_t*>(fingerprint), cryptoplus::buffer_size(fingerprint));
 	}
 
 	hash_type get_certificate_hash(cryptoplus::x509::certificate cert)
@@ -44,6 +44,8 @@
 
 #include "data_message.hpp"
 
+#include "peer_session.hpp"
+
 #include <cryptoplus/cipher/cipher_context.hpp>
 #include <cryptoplus/hash/hmac.hpp>
 #include <cryptoplus/random/random.hpp>
@@ -57,14 +59,21 @@ namespace fscp
 {
 	namespace
 	{
+		// The serialized size of a contact entry: the certificate hash, the
+		// endpoint type and an IPv6 address with its port.
+		const size_t CONTACT_ENTRY_MAX_SIZE = hash_type::data_type::static_size + 1 + 16 + sizeof(uint16_t);
+
 		typedef std::vector<uint8_t> iv_type;
 
-		iv_type compute_iv(const void* nonce_prefix, size_t nonce_prefix_len, sequence_number_type sequence_number)
+		iv_type compute_iv(const void* nonce_prefix, size_t nonce_prefix_len, extended_sequence_number_type sequence_number)
 		{
-			iv_type result(nonce_prefix_len + sizeof(sequence_number_type));
+			iv_type result(nonce_prefix_len + sizeof(extended_sequence_number_type));
 
+			// The full extended sequence number feeds the IV, so the nonce
+			// stays unique even after the 32-bit wire value wraps.
 			std::copy(static_cast<const uint8_t*>(nonce_prefix), static_cast<const uint8_t*>(nonce_prefix) + nonce_prefix_len, result.begin());
-			buffer_tools::set<sequence_number_type>(result.data(), nonce_prefix_len, htonl(sequence_number));
+			buffer_tools::set<uint32_t>(result.data(), nonce_prefix_len, htonl(static_cast<uint32_t>(sequence_number >> 32)));
+			buffer_tools::set<uint32_t>(result.data(), nonce_prefix_len + sizeof(uint32_t), htonl(static_cast<uint32_t>(sequence_number)));
 
 			return result;
 		}
@@ -77,31 +86,74 @@ namespace fscp
 
 	using boost::make_transform_iterator;
 
-	size_t data_message::write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	size_t data_message::write(void* buf, size_t buf_len, channel_number_type channel_number, extended_sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
 		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, _cleartext, cleartext_len, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, to_data_message_type(channel_number));
 	}
 
-	size_t data_message::write_keep_alive(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	size_t data_message::write_in_place(void* buf, size_t buf_len, size_t cleartext_offset, size_t cleartext_len, channel_number_type channel_number, extended_sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		assert(cleartext_offset >= HEADER_OVERHEAD);
+
+		// The message starts HEADER_OVERHEAD bytes before the cleartext so
+		// that the ciphertext ends up exactly where the cleartext lies and
+		// the encryption happens in place, without any payload copy.
+		uint8_t* const base = static_cast<uint8_t*>(buf) + (cleartext_offset - HEADER_OVERHEAD);
+
+		return raw_write(base, buf_len - (cleartext_offset - HEADER_OVERHEAD), _sequence_number, cipher_algorithm, static_cast<const uint8_t*>(buf) + cleartext_offset, cleartext_len, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, to_data_message_type(channel_number));
+	}
+
+	size_t data_message::write(void* buf, size_t buf_len, channel_number_type channel_number, extended_sequence_number_type _sequence_number, session_cipher_context& cipher_context, const void* _cleartext, size_t cleartext_len, size_t pad_to)
+	{
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, _cleartext, cleartext_len, to_data_message_type(channel_number), pad_to);
+	}
+
+	size_t data_message::write_coalesced(void* buf, size_t buf_len, extended_sequence_number_type _sequence_number, session_cipher_context& cipher_context, const void* _cleartext, size_t cleartext_len, size_t pad_to)
+	{
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, _cleartext, cleartext_len, MESSAGE_TYPE_DATA_COALESCED, pad_to);
+	}
+
+	size_t data_message::write_in_place(void* buf, size_t buf_len, size_t cleartext_offset, size_t cleartext_len, channel_number_type channel_number, extended_sequence_number_type _sequence_number, session_cipher_context& cipher_context, size_t pad_to)
+	{
+		assert(cleartext_offset >= HEADER_OVERHEAD);
+
+		// The message starts HEADER_OVERHEAD bytes before the cleartext so
+		// that the ciphertext ends up exactly where the cleartext lies and
+		// the encryption happens in place, without any payload copy.
+		uint8_t* const base = static_cast<uint8_t*>(buf) + (cleartext_offset - HEADER_OVERHEAD);
+
+		return raw_write(base, buf_len - (cleartext_offset - HEADER_OVERHEAD), _sequence_number, cipher_context, static_cast<const uint8_t*>(buf) + cleartext_offset, cleartext_len, to_data_message_type(channel_number), pad_to);
+	}
+
+	size_t data_message::write_keep_alive(void* buf, size_t buf_len, extended_sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
 		const cryptoplus::buffer random = cryptoplus::random::get_random_bytes(random_len);
 
 		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, cryptoplus::buffer_cast<const uint8_t*>(random), cryptoplus::buffer_size(random), enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_KEEP_ALIVE);
 	}
 
-	size_t data_message::write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	size_t data_message::write_contact_request(void* buf, size_t buf_len, extended_sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
 		const std::vector<hash_type::data_type> hash_vec(make_transform_iterator(hash_list.begin(), hash_to_data), make_transform_iterator(hash_list.end(), hash_to_data));
 
 		return raw_write(buf, buf_len, sequence_number, cipher_algorithm, hash_vec.empty() ? nullptr : reinterpret_cast<const char*>(&hash_vec[0]), hash_vec.size() * hash_type::data_type::static_size, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT_REQUEST);
 	}
 
-	size_t data_message::write_contact(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	size_t data_message::write_contact(void* buf, size_t buf_len, extended_sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
-		std::vector<uint8_t> cleartext;
-		cleartext.resize(contact_map.size() * 49);
+		// The contacts are serialized directly into the region of buf the
+		// ciphertext will occupy: raw_write() handles the exact aliasing as
+		// an in-place encryption, so sending a contact map allocates
+		// nothing.
+		const size_t cleartext_offset = HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t);
 
-		std::vector<uint8_t>::iterator ptr = cleartext.begin();
+		if (buf_len < cleartext_offset + (contact_map.size() * CONTACT_ENTRY_MAX_SIZE) + cipher_algorithm.block_size())
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		uint8_t* const cleartext = static_cast<uint8_t*>(buf) + cleartext_offset;
+		uint8_t* ptr = cleartext;
 
 		for (contact_map_type::const_iterator it = contact_map.begin(); it != contact_map.end(); ++it)
 		{
@@ -112,11 +164,11 @@ namespace fscp
 			{
 				*(ptr++) = static_cast<uint8_t>(ENDPOINT_TYPE_IPV4);
 
-				boost::asio::ip::address_v4::bytes_type bytes = it->second.address().to_v4().to_bytes();
+				const boost::asio::ip::address_v4::bytes_type bytes = it->second.address().to_v4().to_bytes();
 
 				ptr = std::copy(bytes.begin(), bytes.end(), ptr);
 
-				*(reinterpret_cast<uint16_t*>(&*ptr)) = htons(it->second.port());
+				*(reinterpret_cast<uint16_t*>(ptr)) = htons(it->second.port());
 
 				ptr += sizeof(uint16_t);
 			}
@@ -124,19 +176,66 @@ namespace fscp
 			{
 				*(ptr++) = static_cast<uint8_t>(ENDPOINT_TYPE_IPV6);
 
-				boost::asio::ip::address_v6::bytes_type bytes = it->second.address().to_v6().to_bytes();
+				const boost::asio::ip::address_v6::bytes_type bytes = it->second.address().to_v6().to_bytes();
 
 				ptr = std::copy(bytes.begin(), bytes.end(), ptr);
 
-				*(reinterpret_cast<uint16_t*>(&*ptr)) = htons(it->second.port());
+				*(reinterpret_cast<uint16_t*>(ptr)) = htons(it->second.port());
 
 				ptr += sizeof(uint16_t);
 			}
 		}
 
-		cleartext.resize(std::distance(cleartext.begin(), ptr));
+		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, (ptr == cleartext) ? nullptr : cleartext, ptr - cleartext, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT);
+	}
+
+	size_t data_message::write_contact(void* buf, size_t buf_len, extended_sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const contact_list_type& contact_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		// The contacts are serialized directly into the region of buf the
+		// ciphertext will occupy: raw_write() handles the exact aliasing as
+		// an in-place encryption, so building an answer allocates nothing.
+		const size_t cleartext_offset = HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t);
+
+		if (buf_len < cleartext_offset + (contact_list.size() * CONTACT_ENTRY_MAX_SIZE) + cipher_algorithm.block_size())
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		uint8_t* const cleartext = static_cast<uint8_t*>(buf) + cleartext_offset;
+		uint8_t* ptr = cleartext;
+
+		for (contact_list_type::const_iterator it = contact_list.begin(); it != contact_list.end(); ++it)
+		{
+			// We copy the hash
+			ptr = std::copy(it->first.data.begin(), it->first.data.end(), ptr);
+
+			if (it->second.address().is_v4())
+			{
+				*(ptr++) = static_cast<uint8_t>(ENDPOINT_TYPE_IPV4);
+
+				const boost::asio::ip::address_v4::bytes_type bytes = it->second.address().to_v4().to_bytes();
+
+				ptr = std::copy(bytes.begin(), bytes.end(), ptr);
 
-		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, cleartext.empty() ? nullptr : &cleartext[0], cleartext.size(), enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT);
+				*(reinterpret_cast<uint16_t*>(ptr)) = htons(it->second.port());
+
+				ptr += sizeof(uint16_t);
+			}
+			else if (it->second.address().is_v6())
+			{
+				*(ptr++) = static_cast<uint8_t>(ENDPOINT_TYPE_IPV6);
+
+				const boost::asio::ip::address_v6::bytes_type bytes = it->second.address().to_v6().to_bytes();
+
+				ptr = std::copy(bytes.begin(), bytes.end(), ptr);
+
+				*(reinterpret_cast<uint16_t*>(ptr)) = htons(it->second.port());
+
+				ptr += sizeof(uint16_t);
+			}
+		}
+
+		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, (ptr == cleartext) ? nullptr : cleartext, ptr - cleartext, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT);
 	}
 
 	hash_list_type data_message::parse_hash_list(const void* buf, size_t buflen)
@@ -166,71 +265,86 @@ namespace fscp
 	{
 		contact_map_type result;
 
-		for (const uint8_t* ptr = static_cast<const uint8_t*>(buf); ptr < static_cast<const uint8_t*>(buf) + buflen;)
-		{
-			hash_type hash;
-
-			if (static_cast<const uint8_t*>(buf) + buflen - ptr < static_cast<ptrdiff_t>(hash_type::data_type::static_size) + 1)
-			{
-				throw std::runtime_error("Invalid message structure");
-			}
+		contact_map_view view(buf, buflen);
 
-			std::copy(ptr, ptr + hash_type::data_type::static_size, hash.data.begin());
+		hash_type hash;
+		boost::asio::ip::udp::endpoint endpoint;
 
-			ptr += hash_type::data_type::static_size;
+		while (view.next(hash, endpoint))
+		{
+			result[hash] = endpoint;
+		}
 
-			switch (static_cast<endpoint_type_type>(*ptr))
-			{
-				case ENDPOINT_TYPE_IPV4:
-					{
-						++ptr;
+		return result;
+	}
 
-						boost::asio::ip::address_v4::bytes_type bytes;
+	bool data_message::contact_map_view::next(hash_type& hash, boost::asio::ip::udp::endpoint& endpoint)
+	{
+		if (m_ptr == m_end)
+		{
+			return false;
+		}
 
-						if (static_cast<const uint8_t*>(buf) + buflen - ptr < static_cast<ptrdiff_t>(bytes.size()))
-						{
-							throw std::runtime_error("Invalid message structure");
-						}
+		if (m_end - m_ptr < static_cast<ptrdiff_t>(hash_type::data_type::static_size) + 1)
+		{
+			throw std::runtime_error("Invalid message structure");
+		}
 
-						std::copy(ptr, ptr + bytes.size(), bytes.begin());
+		std::copy(m_ptr, m_ptr + hash_type::data_type::static_size, hash.data.begin());
 
-						ptr += bytes.size();
+		m_ptr += hash_type::data_type::static_size;
 
-						result[hash] = boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(bytes), ntohs(*reinterpret_cast<const uint16_t*>(ptr)));
+		switch (static_cast<endpoint_type_type>(*m_ptr))
+		{
+			case ENDPOINT_TYPE_IPV4:
+				{
+					++m_ptr;
 
-						ptr += sizeof(uint16_t);
+					boost::asio::ip::address_v4::bytes_type bytes;
 
-						break;
-					}
-				case ENDPOINT_TYPE_IPV6:
+					if (m_end - m_ptr < static_cast<ptrdiff_t>(bytes.size() + sizeof(uint16_t)))
 					{
-						++ptr;
+						throw std::runtime_error("Invalid message structure");
+					}
 
-						boost::asio::ip::address_v6::bytes_type bytes;
+					std::copy(m_ptr, m_ptr + bytes.size(), bytes.begin());
 
-						if (static_cast<const uint8_t*>(buf) + buflen - ptr < static_cast<ptrdiff_t>(bytes.size()))
-						{
-							throw std::runtime_error("Invalid message structure");
-						}
+					m_ptr += bytes.size();
 
-						std::copy(ptr, ptr + bytes.size(), bytes.begin());
+					endpoint = boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(bytes), ntohs(*reinterpret_cast<const uint16_t*>(m_ptr)));
 
-						ptr += bytes.size();
+					m_ptr += sizeof(uint16_t);
 
-						result[hash] = boost::asio::ip::udp::endpoint(boost::asio::ip::address_v6(bytes), ntohs(*reinterpret_cast<const uint16_t*>(ptr)));
+					break;
+				}
+			case ENDPOINT_TYPE_IPV6:
+				{
+					++m_ptr;
 
-						ptr += sizeof(uint16_t);
+					boost::asio::ip::address_v6::bytes_type bytes;
 
-						break;
-					}
-				default:
+					if (m_end - m_ptr < static_cast<ptrdiff_t>(bytes.size() + sizeof(uint16_t)))
 					{
 						throw std::runtime_error("Invalid message structure");
 					}
-			}
+
+					std::copy(m_ptr, m_ptr + bytes.size(), bytes.begin());
+
+					m_ptr += bytes.size();
+
+					endpoint = boost::asio::ip::udp::endpoint(boost::asio::ip::address_v6(bytes), ntohs(*reinterpret_cast<const uint16_t*>(m_ptr)));
+
+					m_ptr += sizeof(uint16_t);
+
+					break;
+				}
+			default:
+				{
+					throw std::runtime_error("Invalid message structure");
+				}
 		}
 
-		return result;
+		return true;
 	}
 
 	data_message::data_message(const void* buf, size_t buf_len) :
@@ -258,13 +372,13 @@ namespace fscp
 		}
 	}
 
-	size_t data_message::get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len) const
+	size_t data_message::get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, extended_sequence_number_type _sequence_number) const
 	{
 		assert(enc_key);
 
 		if (buf)
 		{
-			const iv_type iv = compute_iv(nonce_prefix, nonce_prefix_len, sequence_number());
+			const iv_type iv = compute_iv(nonce_prefix, nonce_prefix_len, _sequence_number);
 
 			cryptoplus::cipher::cipher_context cipher_context;
 
@@ -287,7 +401,29 @@ namespace fscp
 		}
 	}
 
-	size_t data_message::raw_write(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type)
+	size_t data_message::get_cleartext(void* buf, size_t buf_len, session_cipher_context& cipher_context, extended_sequence_number_type _sequence_number) const
+	{
+		if (buf)
+		{
+			const uint8_t* const iv = cipher_context.format_iv(_sequence_number);
+
+			// The context is already keyed: only the IV changes from one message to another.
+			cipher_context.context().initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, NULL, 0, iv);
+			cipher_context.context().ctrl(EVP_CTRL_GCM_SET_TAG, static_cast<int>(tag_size()), const_cast<uint8_t*>(tag()));
+
+			size_t cnt = cipher_context.context().update(buf, buf_len, ciphertext(), ciphertext_size());
+
+			cnt += cipher_context.context().finalize(static_cast<uint8_t*>(buf) + cnt, buf_len - cnt);
+
+			return cnt;
+		}
+		else
+		{
+			return ciphertext_size();
+		}
+	}
+
+	size_t data_message::raw_write(void* buf, size_t buf_len, extended_sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type)
 	{
 		assert(enc_key);
 
@@ -302,7 +438,7 @@ namespace fscp
 		uint8_t* const tag = payload + sizeof(sequence_number_type);
 		uint8_t* const ciphertext = tag + GCM_TAG_LENGTH + sizeof(uint16_t);
 
-		buffer_tools::set<sequence_number_type>(payload, 0, htonl(_sequence_number));
+		buffer_tools::set<sequence_number_type>(payload, 0, htonl(static_cast<sequence_number_type>(_sequence_number)));
 
 		cryptoplus::cipher::cipher_context cipher_context;
 
@@ -314,9 +450,9 @@ namespace fscp
 
 		const size_t max_ciphertext_len = buf_len - HEADER_LENGTH - sizeof(sequence_number_type) - GCM_TAG_LENGTH - sizeof(uint16_t) - cipher_algorithm.block_size();
 
-		const cryptoplus::buffer cleartext(_cleartext, cleartext_len);
-
-		size_t ciphertext_len = cipher_context.update(ciphertext, max_ciphertext_len, cleartext);
+		// Note: the cleartext may alias the ciphertext region exactly (see
+		// write_in_place()), which EVP handles as an in-place encryption.
+		size_t ciphertext_len = cipher_context.update(ciphertext, max_ciphertext_len, _cleartext, cleartext_len);
 		ciphertext_len += cipher_context.finalize(ciphertext + ciphertext_len, max_ciphertext_len - ciphertext_len);
 
 		cipher_context.ctrl(EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag);
@@ -327,4 +463,113 @@ namespace fscp
 
 		return message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, type, length) + length;
 	}
+
+	size_t data_message::raw_write(void* buf, size_t buf_len, extended_sequence_number_type _sequence_number, session_cipher_context& cipher_context, const void* _cleartext, size_t cleartext_len, message_type type, size_t pad_to)
+	{
+		const calg_t cipher_algorithm = cipher_context.cipher_algorithm();
+
+		const uint8_t* const iv = cipher_context.format_iv(_sequence_number);
+
+		const size_t sealed_len = (pad_to > cleartext_len) ? pad_to : cleartext_len;
+
+		if (buf_len < HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t) + (sealed_len + cipher_algorithm.block_size()))
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		uint8_t* const payload = static_cast<uint8_t*>(buf) + HEADER_LENGTH;
+		uint8_t* const tag = payload + sizeof(sequence_number_type);
+		uint8_t* const ciphertext = tag + GCM_TAG_LENGTH + sizeof(uint16_t);
+
+		buffer_tools::set<sequence_number_type>(payload, 0, htonl(static_cast<sequence_number_type>(_sequence_number)));
+
+		// The context is already keyed: only the IV changes from one message to another.
+		cipher_context.context().initialize(calg_t(), cryptoplus::cipher::cipher_context::unchanged, NULL, 0, iv);
+
+		const size_t max_ciphertext_len = buf_len - HEADER_LENGTH - sizeof(sequence_number_type) - GCM_TAG_LENGTH - sizeof(uint16_t) - cipher_algorithm.block_size();
+
+		// Note: the cleartext may alias the ciphertext region exactly (see
+		// write_in_place()), which EVP handles as an in-place encryption.
+		size_t ciphertext_len = cipher_context.context().update(ciphertext, max_ciphertext_len, _cleartext, cleartext_len);
+
+		if (pad_to > cleartext_len)
+		{
+			// The padding streams through the cipher from static blocks
+			// after the cleartext: a 0x80 delimiter then zeros. The padded
+			// cleartext is never materialized anywhere.
+			static const uint8_t delimiter = 0x80;
+			static const uint8_t zeros[256] = {};
+
+			ciphertext_len += cipher_context.context().update(ciphertext + ciphertext_len, max_ciphertext_len - ciphertext_len, &delimiter, sizeof(delimiter));
+
+			for (size_t remaining = pad_to - cleartext_len - sizeof(delimiter); remaining > 0; )
+			{
+				const size_t chunk = (remaining < sizeof(zeros)) ? remaining : sizeof(zeros);
+
+				ciphertext_len += cipher_context.context().update(ciphertext + ciphertext_len, max_ciphertext_len - ciphertext_len, zeros, chunk);
+
+				remaining -= chunk;
+			}
+		}
+
+		ciphertext_len += cipher_context.context().finalize(ciphertext + ciphertext_len, max_ciphertext_len - ciphertext_len);
+
+		cipher_context.context().ctrl(EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag);
+
+		buffer_tools::set<uint16_t>(payload, sizeof(sequence_number_type) + GCM_TAG_LENGTH, htons(static_cast<uint16_t>(ciphertext_len)));
+
+		const size_t length = sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t) + ciphertext_len;
+
+		return message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, type, length) + length;
+	}
+
+	size_t data_message::padded_length(size_t cleartext_len)
+	{
+		// One byte always goes to the 0x80 delimiter.
+		const size_t needed = cleartext_len + 1;
+
+		// Below the MTU the buckets double, so a frame costs at most its
+		// own size again and the small control frames - the most
+		// recognizable ones - collapse into a handful of sizes. Past 1024
+		// the buckets step by 128: full-size tunneled frames dominate the
+		// volume there, and the finer steps keep the bandwidth overhead
+		// under ten percent where it matters most.
+		if (needed <= 64)
+		{
+			return 64;
+		}
+
+		if (needed <= 1024)
+		{
+			size_t bucket = 128;
+
+			while (bucket < needed)
+			{
+				bucket *= 2;
+			}
+
+			return bucket;
+		}
+
+		return ((needed + 127) / 128) * 128;
+	}
+
+	size_t data_message::unpadded_length(const void* _cleartext, size_t cleartext_len)
+	{
+		const uint8_t* const cleartext = static_cast<const uint8_t*>(_cleartext);
+
+		size_t result = cleartext_len;
+
+		while ((result > 0) && (cleartext[result - 1] == 0x00))
+		{
+			--result;
+		}
+
+		if ((result == 0) || (cleartext[result - 1] != 0x80))
+		{
+			throw std::runtime_error("Missing padding delimiter");
+		}
+
+		return result - 1;
+	}
 }
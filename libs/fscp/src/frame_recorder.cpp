@@ -0,0 +1,162 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file frame_recorder.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A per-thread frame event flight recorder.
+ */
+
+#include "frame_recorder.hpp"
+
+#include <ostream>
+
+namespace fscp
+{
+	namespace
+	{
+		const char* const point_names[] = {
+			"server_receive",
+			"switch_write",
+			"router_write",
+		};
+
+		const char* const verdict_names[] = {
+			"forwarded",
+			"no_target",
+			"no_route",
+			"unknown_session",
+			"replayed",
+			"decipher_failed",
+			"corrupt_frame",
+		};
+	}
+
+	uint64_t frame_recorder::to_peer_id(const boost::asio::ip::udp::endpoint& ep)
+	{
+		if (ep.address().is_v4())
+		{
+			// An IPv4 address and a port pack losslessly into 48 bits.
+			return (static_cast<uint64_t>(ep.address().to_v4().to_ulong()) << 16) | ep.port();
+		}
+
+		// An IPv6 endpoint does not fit: an FNV-1a hash with the high bit
+		// set identifies the peer well enough for a trace.
+		const boost::asio::ip::address_v6::bytes_type bytes = ep.address().to_v6().to_bytes();
+
+		uint64_t hash = 14695981039346656037ULL;
+
+		for (size_t i = 0; i < bytes.size(); ++i)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+
+		hash = (hash ^ static_cast<uint8_t>(ep.port() >> 8)) * 1099511628211ULL;
+		hash = (hash ^ static_cast<uint8_t>(ep.port() & 0xff)) * 1099511628211ULL;
+
+		return hash | 0x8000000000000000ULL;
+	}
+
+	void frame_recorder::dump(std::ostream& os)
+	{
+		std::vector<ring_type*> all_rings;
+
+		{
+			std::lock_guard<std::mutex> lock(rings_mutex());
+
+			all_rings = rings();
+		}
+
+		for (size_t i = 0; i < all_rings.size(); ++i)
+		{
+			const ring_type& ring = *all_rings[i];
+
+			// The owning thread may still be recording: next is read once
+			// and the events it covers are read as they are, torn or not.
+			const uint64_t next = ring.next;
+			const uint64_t first = (next > RING_SIZE) ? (next - RING_SIZE) : 0;
+
+			os << "# ring " << i << ": " << (next - first) << " event(s)\n";
+
+			for (uint64_t seq = first; seq < next; ++seq)
+			{
+				const event_type& event = ring.events[seq & (RING_SIZE - 1)];
+
+				os << event.timestamp;
+				os << " " << point_names[static_cast<size_t>(event.point)];
+				os << " peer=" << std::hex << event.peer << std::dec;
+				os << " size=" << event.size;
+				os << " " << verdict_names[static_cast<size_t>(event.verdict)];
+				os << "\n";
+			}
+		}
+	}
+
+	frame_recorder::ring_type& frame_recorder::local_ring()
+	{
+		// The ring is deliberately leaked: a dump may run after the thread
+		// that owned the ring exited, and the data-path threads live for
+		// the whole process lifetime anyway.
+		static thread_local ring_type* ring = nullptr;
+
+		if (!ring)
+		{
+			ring = new ring_type();
+
+			std::lock_guard<std::mutex> lock(rings_mutex());
+
+			rings().push_back(ring);
+		}
+
+		return *ring;
+	}
+
+	std::vector<frame_recorder::ring_type*>& frame_recorder::rings()
+	{
+		static std::vector<ring_type*> values;
+
+		return values;
+	}
+
+	std::mutex& frame_recorder::rings_mutex()
+	{
+		static std::mutex mutex;
+
+		return mutex;
+	}
+}
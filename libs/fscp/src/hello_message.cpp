@@ -80,7 +80,10 @@ namespace fscp
 	hello_message::hello_message(const void* buf, size_t buf_len) :
 		message(buf, buf_len)
 	{
-		if (length() != BODY_LENGTH)
+		// Trailing bytes are tolerated: a future version may append an
+		// extension block to its HELLO messages, once every host validates
+		// with a lower bound.
+		if (length() < BODY_LENGTH)
 		{
 			throw std::runtime_error("bad message length");
 		}
@@ -89,7 +92,7 @@ namespace fscp
 	hello_message::hello_message(const message& _message) :
 		message(_message)
 	{
-		if (length() != BODY_LENGTH)
+		if (length() < BODY_LENGTH)
 		{
 			throw std::runtime_error("bad message length");
 		}
@@ -64,6 +64,10 @@ namespace fscp
 			{
 				throw std::runtime_error("sig_key mismatch");
 			}
+
+			// Warm the DER cache so the presentation path never encodes the
+			// certificate, not even for the first peer of a reconnect storm.
+			m_sig_cert.der();
 		}
 	}
 }
@@ -56,9 +56,9 @@ namespace fscp
 			throw std::runtime_error("buf_len");
 		}
 
-		buffer_tools::set<uint8_t>(buf, 0, _version);
-		buffer_tools::set<uint8_t>(buf, 1, static_cast<uint8_t>(_type));
-		buffer_tools::set<uint16_t>(buf, 2, htons(static_cast<uint16_t>(_length)));
+		buffer_tools::set<uint8_t>(buf, header_layout::field<FIELD_VERSION>::OFFSET, _version);
+		buffer_tools::set<uint8_t>(buf, header_layout::field<FIELD_TYPE>::OFFSET, static_cast<uint8_t>(_type));
+		buffer_tools::set<uint16_t>(buf, header_layout::field<FIELD_LENGTH>::OFFSET, htons(static_cast<uint16_t>(_length)));
 
 		return HEADER_LENGTH;
 	}
@@ -66,15 +66,54 @@ namespace fscp
 	message::message(const void* buf, size_t buf_len) :
 		m_data(buf)
 	{
-		if (buf_len < HEADER_LENGTH)
+		// The length field lies inside the header: once the header is known
+		// to fit, a single bound validates the whole message.
+		if ((buf_len < HEADER_LENGTH) || (buf_len < HEADER_LENGTH + length()))
 		{
 			throw std::runtime_error("buf_len");
 		}
+	}
+
+	size_t message::write_extensions(uint8_t* buf, size_t buf_len)
+	{
+		const size_t extensions_size = 2 + sizeof(session_capability_flags_type);
 
-		if (buf_len < HEADER_LENGTH + length())
+		if (buf_len < extensions_size)
 		{
 			throw std::runtime_error("buf_len");
 		}
+
+		buf[0] = static_cast<uint8_t>(EXTENSION_TLV_SESSION_CAPABILITIES);
+		buf[1] = sizeof(session_capability_flags_type);
+		buf[2] = local_session_capabilities();
+
+		return extensions_size;
 	}
 
+	session_capability_flags_type message::parse_extensions(const uint8_t* buf, size_t buf_len)
+	{
+		session_capability_flags_type result = 0x00;
+
+		while (buf_len >= 2)
+		{
+			const uint8_t tlv_type = buf[0];
+			const size_t tlv_length = buf[1];
+
+			if (buf_len < 2 + tlv_length)
+			{
+				// A truncated TLV: the rest of the block cannot be trusted.
+				break;
+			}
+
+			if ((tlv_type == EXTENSION_TLV_SESSION_CAPABILITIES) && (tlv_length >= sizeof(session_capability_flags_type)))
+			{
+				result = buf[2];
+			}
+
+			buf += 2 + tlv_length;
+			buf_len -= 2 + tlv_length;
+		}
+
+		return result;
+	}
 }
@@ -44,14 +44,53 @@
 
 #include "peer_session.hpp"
 
+#include "buffer_tools.hpp"
+
 #include <cryptoplus/tls/tls.hpp>
 
 namespace fscp
 {
+	session_cipher_context::session_cipher_context(cryptoplus::cipher::cipher_algorithm _cipher_algorithm, cipher_direction direction, const cryptoplus::buffer& key, const cryptoplus::buffer& _nonce_prefix) :
+		m_cipher_algorithm(_cipher_algorithm),
+		m_nonce_prefix(_nonce_prefix),
+		m_iv(cryptoplus::buffer_size(_nonce_prefix) + sizeof(extended_sequence_number_type))
+	{
+		// The GCM specific attributes and the key schedule are set once, here: ciphering a message then only requires setting the IV.
+		m_context.initialize(m_cipher_algorithm, direction, NULL, 0, NULL);
+		m_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(cryptoplus::buffer_size(m_nonce_prefix) + sizeof(extended_sequence_number_type)));
+		m_context.initialize(cryptoplus::cipher::cipher_algorithm(), cryptoplus::cipher::cipher_context::unchanged, cryptoplus::buffer_cast<const uint8_t*>(key), cryptoplus::buffer_size(key), NULL);
+
+		std::copy(cryptoplus::buffer_cast<const uint8_t*>(m_nonce_prefix), cryptoplus::buffer_cast<const uint8_t*>(m_nonce_prefix) + cryptoplus::buffer_size(m_nonce_prefix), m_iv.begin());
+	}
+
+	const uint8_t* session_cipher_context::format_iv(extended_sequence_number_type sequence_number)
+	{
+		const size_t nonce_prefix_len = cryptoplus::buffer_size(m_nonce_prefix);
+
+		// The full extended sequence number feeds the IV, so the nonce
+		// stays unique even after the 32-bit wire value wraps.
+		buffer_tools::set<uint32_t>(m_iv.data(), nonce_prefix_len, htonl(static_cast<uint32_t>(sequence_number >> 32)));
+		buffer_tools::set<uint32_t>(m_iv.data(), nonce_prefix_len + sizeof(uint32_t), htonl(static_cast<uint32_t>(sequence_number)));
+
+		return m_iv.data();
+	}
+
 	bool peer_session::current_session_type::is_old() const
 	{
-		const auto max = std::numeric_limits<sequence_number_type>::max() / 2;
-		return ((local_sequence_number > max) || (remote_sequence_number > max));
+		// With extended sequence numbers the wire wrap no longer forces a
+		// renewal: the bound is a conservative key-usage limit for GCM, not
+		// a sequence number capacity.
+		return ((local_sequence_number > KEY_USAGE_BOUND) || (remote_sequence_number > KEY_USAGE_BOUND));
+	}
+
+	bool peer_session::current_session_type::needs_renewal() const
+	{
+		// The next epoch is prepared slightly ahead of the key-usage bound
+		// so its keys are established before the current ones must stop
+		// being used: the switch then does not interrupt traffic.
+		const extended_sequence_number_type threshold = KEY_USAGE_BOUND - REKEY_AHEAD_MARGIN;
+
+		return ((local_sequence_number > threshold) || (remote_sequence_number > threshold));
 	}
 
 	bool peer_session::set_first_remote_host_identifier(const host_identifier_type& _host_identifier)
@@ -66,46 +105,100 @@ namespace fscp
 		return (_host_identifier == *m_remote_host_identifier);
 	}
 
-	bool peer_session::prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve)
+	bool peer_session::prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve, boost::shared_ptr<cryptoplus::pkey::ecdhe_context> _ecdhe_context)
 	{
 		if (m_next_session)
 		{
-			if ((m_next_session->parameters.session_number == _session_number) && (m_next_session->parameters.cipher_suite == _cipher_suite) && (m_next_session->parameters.elliptic_curve == _elliptic_curve))
+			if ((m_next_session->parameters.session_number == _session_number) && (m_next_session->parameters.cipher_suite == _cipher_suite) && (m_next_session->parameters.elliptic_curve == _elliptic_curve) && !m_next_session->is_resumption())
 			{
 				// The session in preparation matches the requested one: not creating one to ensure the private DH key stays the same.
 				return false;
 			}
 		}
 
-		m_next_session = boost::make_shared<next_session_type>(_session_number, _cipher_suite, _elliptic_curve);
+		if (!_ecdhe_context)
+		{
+			_ecdhe_context = boost::make_shared<cryptoplus::pkey::ecdhe_context>(_elliptic_curve.to_elliptic_curve_nid());
+		}
+
+		m_next_session = boost::make_shared<next_session_type>(_session_number, _cipher_suite, _elliptic_curve, _ecdhe_context);
 
 		return true;
 	}
 
-	bool peer_session::complete_session(const void* _remote_public_key, size_t remote_public_key_size)
+	bool peer_session::can_resume_session(cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve) const
 	{
-		using cryptoplus::buffer_cast;
+		if (!m_current_session)
+		{
+			return false;
+		}
 
-		if (!m_next_session || !m_remote_host_identifier)
+		if (cryptoplus::buffer_size(m_current_session->ratchet_secret) == 0)
 		{
 			return false;
 		}
 
-		boost::shared_ptr<current_session_type> _current_session = boost::make_shared<current_session_type>(m_next_session->parameters);
+		return ((m_current_session->parameters.cipher_suite == _cipher_suite) && (m_current_session->parameters.elliptic_curve == _elliptic_curve));
+	}
+
+	bool peer_session::prepare_session_resumption(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve)
+	{
+		if (m_next_session)
+		{
+			if ((m_next_session->parameters.session_number == _session_number) && (m_next_session->parameters.cipher_suite == _cipher_suite) && (m_next_session->parameters.elliptic_curve == _elliptic_curve) && m_next_session->is_resumption())
+			{
+				// The session in preparation already matches the requested resumption.
+				return false;
+			}
+		}
+
+		m_next_session = boost::make_shared<next_session_type>(_session_number, _cipher_suite, _elliptic_curve);
 
-		const size_t key_length = m_next_session->parameters.cipher_suite.to_cipher_algorithm().key_length();
-		const auto remote_public_key = cryptoplus::buffer(_remote_public_key, remote_public_key_size);
+		return true;
+	}
 
+	boost::shared_ptr<peer_session::current_session_type> peer_session::compute_session_keys(next_session_type& _next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& remote_public_key)
+	{
 		// We get the derived secret key.
-		const auto secret_key = m_next_session->ecdhe_context.derive_secret_key(remote_public_key);
+		const auto secret_key = _next_session.ecdhe_context->derive_secret_key(remote_public_key);
+
+		return expand_session_keys(_next_session, local_host_identifier, remote_host_identifier, secret_key);
+	}
+
+	boost::shared_ptr<peer_session::current_session_type> peer_session::compute_resumed_session_keys(next_session_type& _next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& _ratchet_secret)
+	{
+		using cryptoplus::buffer_cast;
+
+		// The epoch's master secret is ratcheted forward from the previous
+		// epoch's secret: no ECDHE exchange is needed.
+		const auto secret_key = cryptoplus::tls::prf(
+			current_session_type::RATCHET_SECRET_SIZE,
+			buffer_cast<const void*>(_ratchet_secret),
+			buffer_size(_ratchet_secret),
+			"session resumption",
+			NULL,
+			0,
+			get_default_digest_algorithm()
+		);
+
+		return expand_session_keys(_next_session, local_host_identifier, remote_host_identifier, secret_key);
+	}
+
+	boost::shared_ptr<peer_session::current_session_type> peer_session::expand_session_keys(next_session_type& _next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& secret_key)
+	{
+		using cryptoplus::buffer_cast;
+
+		boost::shared_ptr<current_session_type> _current_session = boost::make_shared<current_session_type>(_next_session.parameters);
+
+		const size_t key_length = _next_session.parameters.cipher_suite.to_cipher_algorithm().key_length();
 
 		_current_session->local_session_key = cryptoplus::tls::prf(
 			key_length,
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"session key",
-			m_local_host_identifier.data.data(),
-			m_local_host_identifier.data.size(),
+			local_host_identifier.data.data(),
+			local_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -114,8 +207,8 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"session key",
-			m_remote_host_identifier->data.data(),
-			m_remote_host_identifier->data.size(),
+			remote_host_identifier.data.data(),
+			remote_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -124,8 +217,8 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"nonce prefix",
-			m_local_host_identifier.data.data(),
-			m_local_host_identifier.data.size(),
+			local_host_identifier.data.data(),
+			local_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -134,12 +227,61 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"nonce prefix",
-			m_remote_host_identifier->data.data(),
-			m_remote_host_identifier->data.size(),
+			remote_host_identifier.data.data(),
+			remote_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
+		const auto cipher_algorithm = _next_session.parameters.cipher_suite.to_cipher_algorithm();
+
+		_current_session->local_cipher_context = boost::make_shared<session_cipher_context>(
+			cipher_algorithm,
+			cryptoplus::cipher::cipher_context::encrypt,
+			_current_session->local_session_key,
+			_current_session->local_nonce_prefix
+		);
+
+		_current_session->remote_cipher_context = boost::make_shared<session_cipher_context>(
+			cipher_algorithm,
+			cryptoplus::cipher::cipher_context::decrypt,
+			_current_session->remote_session_key,
+			_current_session->remote_nonce_prefix
+		);
+
+		// Both hosts derive the same ratchet secret, so the next renewal can
+		// roll the keys forward without a new ECDHE exchange.
+		_current_session->ratchet_secret = cryptoplus::tls::prf(
+			current_session_type::RATCHET_SECRET_SIZE,
+			buffer_cast<const void*>(secret_key),
+			buffer_size(secret_key),
+			"session ratchet",
+			NULL,
+			0,
+			get_default_digest_algorithm()
+		);
+
+		return _current_session;
+	}
+
+	bool peer_session::install_session_keys(boost::shared_ptr<next_session_type> _next_session, boost::shared_ptr<current_session_type> _current_session)
+	{
+		if (m_next_session != _next_session)
+		{
+			// Another session was prepared while the keys were being computed: the result is stale.
+			return false;
+		}
+
 		m_next_session.reset();
+
+		if (m_current_session)
+		{
+			// Keep the previous epoch around briefly: data messages ciphered
+			// with its keys may still be in flight and should be delivered
+			// rather than dropped by the switch.
+			m_previous_session = m_current_session;
+			m_previous_session_expires = boost::posix_time::microsec_clock::local_time() + PREVIOUS_SESSION_GRACE_PERIOD;
+		}
+
 		swap(m_current_session, _current_session);
 
 		keep_alive();
@@ -147,6 +289,18 @@ namespace fscp
 		return true;
 	}
 
+	bool peer_session::complete_session(const void* _remote_public_key, size_t remote_public_key_size)
+	{
+		if (!m_next_session || !m_remote_host_identifier)
+		{
+			return false;
+		}
+
+		const auto _current_session = compute_session_keys(*m_next_session, m_local_host_identifier, *m_remote_host_identifier, cryptoplus::buffer(_remote_public_key, remote_public_key_size));
+
+		return install_session_keys(m_next_session, _current_session);
+	}
+
 	session_number_type peer_session::next_session_number() const
 	{
 		if (!has_current_session())
@@ -177,16 +331,107 @@ namespace fscp
 		return m_current_session->parameters;
 	}
 
-	bool peer_session::set_remote_sequence_number(sequence_number_type sequence_number)
+	extended_sequence_number_type peer_session::reconstruct_sequence_number(sequence_number_type sequence_number) const
+	{
+		return reconstruct_sequence_number(*m_current_session, sequence_number);
+	}
+
+	extended_sequence_number_type peer_session::reconstruct_sequence_number(const current_session_type& session, sequence_number_type sequence_number)
 	{
-		if (sequence_number > m_current_session->remote_sequence_number)
+		const extended_sequence_number_type top = session.remote_sequence_number;
+		const extended_sequence_number_type span = static_cast<extended_sequence_number_type>(1) << 32;
+
+		// Candidate with the same high bits as the window top.
+		extended_sequence_number_type candidate = (top & ~(span - 1)) | sequence_number;
+
+		// Pick the candidate closest to the window top: a low 32-bit value
+		// far behind the top actually belongs to the next wire wrap, and one
+		// far ahead to the previous.
+		if ((candidate + span / 2) < top)
+		{
+			candidate += span;
+		}
+		else if ((candidate > top + span / 2) && (candidate >= span))
 		{
-			m_current_session->remote_sequence_number = sequence_number;
+			candidate -= span;
+		}
 
+		return candidate;
+	}
+
+	bool peer_session::is_acceptable_sequence_number(extended_sequence_number_type sequence_number) const
+	{
+		return is_acceptable_sequence_number(*m_current_session, sequence_number);
+	}
+
+	bool peer_session::is_acceptable_sequence_number(const current_session_type& session, extended_sequence_number_type sequence_number)
+	{
+		// Sequence numbers start at 1: zero can only be a replay of the initial state.
+		if (sequence_number == 0)
+		{
+			return false;
+		}
+
+		if (sequence_number > session.remote_sequence_number)
+		{
 			return true;
 		}
 
-		return false;
+		if (sequence_number + current_session_type::REPLAY_WINDOW_SIZE <= session.remote_sequence_number)
+		{
+			return false;
+		}
+
+		const size_t word = (sequence_number / 64) % session.replay_window.size();
+		const uint64_t bit = static_cast<uint64_t>(1) << (sequence_number % 64);
+
+		return ((session.replay_window[word] & bit) == 0);
+	}
+
+	bool peer_session::register_remote_sequence_number(extended_sequence_number_type sequence_number)
+	{
+		return register_remote_sequence_number(*m_current_session, sequence_number);
+	}
+
+	bool peer_session::register_remote_sequence_number(current_session_type& session, extended_sequence_number_type sequence_number)
+	{
+		if (!is_acceptable_sequence_number(session, sequence_number))
+		{
+			return false;
+		}
+
+		if (sequence_number > session.remote_sequence_number)
+		{
+			// The window moves forward: the words between the previous top
+			// and the new one have not been used yet and are cleared.
+			const extended_sequence_number_type current_word = sequence_number / 64;
+			const extended_sequence_number_type last_word = session.remote_sequence_number / 64;
+			const size_t diff = static_cast<size_t>(std::min<extended_sequence_number_type>(current_word - last_word, session.replay_window.size()));
+
+			for (size_t i = 1; i <= diff; ++i)
+			{
+				session.replay_window[(last_word + i) % session.replay_window.size()] = 0;
+			}
+
+			session.remote_sequence_number = sequence_number;
+		}
+
+		const size_t word = (sequence_number / 64) % session.replay_window.size();
+		const uint64_t bit = static_cast<uint64_t>(1) << (sequence_number % 64);
+
+		session.replay_window[word] |= bit;
+
+		return true;
+	}
+
+	boost::shared_ptr<peer_session::current_session_type> peer_session::previous_session()
+	{
+		if (m_previous_session && (boost::posix_time::microsec_clock::local_time() > m_previous_session_expires))
+		{
+			m_previous_session.reset();
+		}
+
+		return m_previous_session;
 	}
 
 	bool peer_session::clear()
@@ -197,7 +442,83 @@ namespace fscp
 
 		m_current_session.reset();
 		m_next_session.reset();
+		m_previous_session.reset();
 
 		return result;
 	}
+
+	bool peer_session::make_snapshot(session_snapshot& snapshot) const
+	{
+		if (!m_current_session || !m_remote_host_identifier)
+		{
+			return false;
+		}
+
+		snapshot.local_host_identifier = m_local_host_identifier;
+		snapshot.remote_host_identifier = *m_remote_host_identifier;
+		snapshot.remote_capabilities = m_remote_capabilities;
+		snapshot.session_number = m_current_session->parameters.session_number;
+		snapshot.cipher_suite = m_current_session->parameters.cipher_suite;
+		snapshot.elliptic_curve = m_current_session->parameters.elliptic_curve;
+		snapshot.local_sequence_number = m_current_session->local_sequence_number;
+		snapshot.remote_sequence_number = m_current_session->remote_sequence_number;
+		snapshot.local_session_key = m_current_session->local_session_key;
+		snapshot.remote_session_key = m_current_session->remote_session_key;
+		snapshot.local_nonce_prefix = m_current_session->local_nonce_prefix;
+		snapshot.remote_nonce_prefix = m_current_session->remote_nonce_prefix;
+		snapshot.ratchet_secret = m_current_session->ratchet_secret;
+
+		return true;
+	}
+
+	bool peer_session::restore_from_snapshot(const session_snapshot& snapshot)
+	{
+		if (m_current_session)
+		{
+			// A live session always wins over a restored one.
+			return false;
+		}
+
+		m_local_host_identifier = snapshot.local_host_identifier;
+		m_remote_host_identifier = snapshot.remote_host_identifier;
+		m_remote_capabilities = snapshot.remote_capabilities;
+
+		// The restored session has no public key to carry: it plays the same
+		// role as the empty public key of a resumed session.
+		const session_parameters parameters(snapshot.session_number, snapshot.cipher_suite, snapshot.elliptic_curve, cryptoplus::buffer());
+
+		const auto _current_session = boost::make_shared<current_session_type>(parameters);
+
+		_current_session->local_sequence_number = snapshot.local_sequence_number + session_snapshot::RESTORE_SEQUENCE_MARGIN;
+		_current_session->remote_sequence_number = snapshot.remote_sequence_number;
+		_current_session->local_session_key = snapshot.local_session_key;
+		_current_session->remote_session_key = snapshot.remote_session_key;
+		_current_session->local_nonce_prefix = snapshot.local_nonce_prefix;
+		_current_session->remote_nonce_prefix = snapshot.remote_nonce_prefix;
+		_current_session->ratchet_secret = snapshot.ratchet_secret;
+
+		const auto cipher_algorithm = parameters.cipher_suite.to_cipher_algorithm();
+
+		_current_session->local_cipher_context = boost::make_shared<session_cipher_context>(
+			cipher_algorithm,
+			cryptoplus::cipher::cipher_context::encrypt,
+			_current_session->local_session_key,
+			_current_session->local_nonce_prefix
+		);
+
+		_current_session->remote_cipher_context = boost::make_shared<session_cipher_context>(
+			cipher_algorithm,
+			cryptoplus::cipher::cipher_context::decrypt,
+			_current_session->remote_session_key,
+			_current_session->remote_nonce_prefix
+		);
+
+		m_next_session.reset();
+		m_previous_session.reset();
+		m_current_session = _current_session;
+
+		keep_alive();
+
+		return true;
+	}
 }
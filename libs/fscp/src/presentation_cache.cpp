@@ -0,0 +1,304 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file presentation_cache.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A persistent presentation cache class.
+ */
+
+#include "presentation_cache.hpp"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace fscp
+{
+	namespace
+	{
+		// The cache file never leaves the host it was written on, so the
+		// record lengths are stored in host byte order.
+		//
+		// The file starts with a 5-byte header (magic and version) and
+		// continues with flat records:
+		//
+		//     [32-byte certificate hash]
+		//     [2-byte endpoint length][endpoint, textual form]
+		//     [4-byte DER length][DER certificate]
+		//
+		// A malformed record invalidates the tail of the file: scanning
+		// stops there and the next write overwrites it.
+		const char CACHE_MAGIC[4] = { 'F', 'S', 'P', 'C' };
+		const uint8_t CACHE_VERSION = 1;
+		const size_t CACHE_HEADER_SIZE = sizeof(CACHE_MAGIC) + sizeof(CACHE_VERSION);
+
+		void write_header(const std::string& path)
+		{
+			std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+
+			if (!file)
+			{
+				throw std::runtime_error("Unable to create the presentation cache file: " + path);
+			}
+
+			file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+			file.write(reinterpret_cast<const char*>(&CACHE_VERSION), sizeof(CACHE_VERSION));
+		}
+	}
+
+	presentation_cache::presentation_cache(const std::string& path) :
+		m_path(path),
+		m_loaded(false),
+		m_valid_size(0)
+	{
+	}
+
+	presentation_cache::~presentation_cache()
+	{
+		// The destructor is defined here so the interprocess types can stay
+		// forward-declared in the header.
+	}
+
+	boost::optional<presentation_cache::cert_type> presentation_cache::find(const hash_type& hash)
+	{
+		ensure_loaded();
+
+		const std::map<hash_type, record_location>::const_iterator entry = m_hash_index.find(hash);
+
+		if (entry == m_hash_index.end())
+		{
+			return boost::optional<cert_type>();
+		}
+
+		return load_record(entry->second);
+	}
+
+	boost::optional<presentation_cache::cert_type> presentation_cache::find(const std::string& endpoint)
+	{
+		ensure_loaded();
+
+		const std::map<std::string, record_location>::const_iterator entry = m_endpoint_index.find(endpoint);
+
+		if (entry == m_endpoint_index.end())
+		{
+			return boost::optional<cert_type>();
+		}
+
+		return load_record(entry->second);
+	}
+
+	void presentation_cache::store(const std::string& endpoint, cert_type cert)
+	{
+		ensure_loaded();
+
+		const hash_type hash = get_certificate_hash(cert);
+
+		const std::map<std::string, record_location>::const_iterator entry = m_endpoint_index.find(endpoint);
+
+		if ((entry != m_endpoint_index.end()) && (entry->second.hash == hash))
+		{
+			// The endpoint already has this certificate on record.
+			return;
+		}
+
+		const cryptoplus::buffer der = cert.write_der();
+		const uint32_t der_size = static_cast<uint32_t>(cryptoplus::buffer_size(der));
+		const uint16_t endpoint_size = static_cast<uint16_t>(endpoint.size());
+
+		std::fstream file(m_path.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+
+		if (!file)
+		{
+			throw std::runtime_error("Unable to open the presentation cache file: " + m_path);
+		}
+
+		// Writing at the end of the validated area overwrites any corrupt
+		// tail left by an interrupted write.
+		file.seekp(static_cast<std::streamoff>(m_valid_size));
+
+		file.write(reinterpret_cast<const char*>(&hash.data[0]), hash.data.size());
+		file.write(reinterpret_cast<const char*>(&endpoint_size), sizeof(endpoint_size));
+		file.write(endpoint.c_str(), endpoint_size);
+		file.write(reinterpret_cast<const char*>(&der_size), sizeof(der_size));
+		file.write(cryptoplus::buffer_cast<const char*>(der), der_size);
+		file.flush();
+
+		if (!file)
+		{
+			throw std::runtime_error("Unable to write to the presentation cache file: " + m_path);
+		}
+
+		record_location location;
+		location.hash = hash;
+		location.der_offset = m_valid_size + hash.data.size() + sizeof(endpoint_size) + endpoint_size + sizeof(der_size);
+		location.der_size = der_size;
+
+		m_hash_index[hash] = location;
+		m_endpoint_index[endpoint] = location;
+		m_valid_size = location.der_offset + der_size;
+
+		// The mapping no longer covers the file: it is rebuilt on the next
+		// lookup.
+		m_region.reset();
+		m_mapping.reset();
+	}
+
+	void presentation_cache::ensure_loaded()
+	{
+		if (m_loaded)
+		{
+			return;
+		}
+
+		try
+		{
+			ensure_mapped();
+		}
+		catch (const boost::interprocess::interprocess_exception&)
+		{
+			// The file does not exist yet.
+			write_header(m_path);
+
+			m_valid_size = CACHE_HEADER_SIZE;
+			m_loaded = true;
+
+			return;
+		}
+
+		const char* const base = static_cast<const char*>(m_region->get_address());
+		const size_t size = m_region->get_size();
+
+		if ((size < CACHE_HEADER_SIZE) || (std::memcmp(base, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) || (static_cast<uint8_t>(base[sizeof(CACHE_MAGIC)]) != CACHE_VERSION))
+		{
+			// Not a cache file (or one from another version): start over.
+			m_region.reset();
+			m_mapping.reset();
+
+			write_header(m_path);
+
+			m_valid_size = CACHE_HEADER_SIZE;
+			m_loaded = true;
+
+			return;
+		}
+
+		size_t offset = CACHE_HEADER_SIZE;
+
+		while (offset < size)
+		{
+			record_location location;
+
+			if (offset + location.hash.data.size() + sizeof(uint16_t) > size)
+			{
+				break;
+			}
+
+			std::memcpy(&location.hash.data[0], base + offset, location.hash.data.size());
+
+			uint16_t endpoint_size = 0;
+			std::memcpy(&endpoint_size, base + offset + location.hash.data.size(), sizeof(endpoint_size));
+
+			const size_t der_size_offset = offset + location.hash.data.size() + sizeof(endpoint_size) + endpoint_size;
+
+			if (der_size_offset + sizeof(uint32_t) > size)
+			{
+				break;
+			}
+
+			std::memcpy(&location.der_size, base + der_size_offset, sizeof(location.der_size));
+
+			location.der_offset = der_size_offset + sizeof(location.der_size);
+
+			if (location.der_offset + location.der_size > size)
+			{
+				break;
+			}
+
+			const std::string endpoint(base + offset + location.hash.data.size() + sizeof(endpoint_size), endpoint_size);
+
+			// The latest record for a given fingerprint or endpoint wins.
+			m_hash_index[location.hash] = location;
+			m_endpoint_index[endpoint] = location;
+
+			offset = location.der_offset + location.der_size;
+		}
+
+		m_valid_size = offset;
+		m_loaded = true;
+	}
+
+	void presentation_cache::ensure_mapped()
+	{
+		if (m_region)
+		{
+			return;
+		}
+
+		m_mapping = boost::make_shared<boost::interprocess::file_mapping>(m_path.c_str(), boost::interprocess::read_only);
+		m_region = boost::make_shared<boost::interprocess::mapped_region>(*m_mapping, boost::interprocess::read_only);
+	}
+
+	boost::optional<presentation_cache::cert_type> presentation_cache::load_record(const record_location& location)
+	{
+		ensure_mapped();
+
+		if (location.der_offset + location.der_size > m_region->get_size())
+		{
+			return boost::optional<cert_type>();
+		}
+
+		const char* const base = static_cast<const char*>(m_region->get_address());
+
+		try
+		{
+			// The DER is only decoded when the record is actually requested.
+			return boost::make_optional(cert_type::from_der(base + location.der_offset, location.der_size));
+		}
+		catch (const boost::system::system_error&)
+		{
+			// The record is corrupt: better a cache miss than a failure.
+			return boost::optional<cert_type>();
+		}
+	}
+}
@@ -52,7 +52,14 @@ namespace fscp
 {
 	size_t presentation_message::write(void* buf, size_t buf_len, presentation_message::cert_type sig_cert)
 	{
-		size_t sig_cert_len = !sig_cert.is_null() ? sig_cert.write_der(static_cast<void*>(0)) : 0;
+		// der() is cached on the certificate: repeated presentations copy
+		// the encoding instead of re-serializing it.
+		return write(buf, buf_len, !sig_cert.is_null() ? sig_cert.der() : cryptoplus::buffer());
+	}
+
+	size_t presentation_message::write(void* buf, size_t buf_len, const cryptoplus::buffer& sig_cert_der)
+	{
+		const size_t sig_cert_len = cryptoplus::buffer_size(sig_cert_der);
 
 		if (buf_len < HEADER_LENGTH + MIN_BODY_LENGTH + sig_cert_len)
 		{
@@ -64,9 +71,10 @@ namespace fscp
 		buffer_tools::set<uint16_t>(pbuf, 0, htons(static_cast<uint16_t>(sig_cert_len)));
 		pbuf += sizeof(uint16_t);
 
-		if (!sig_cert.is_null())
+		if (sig_cert_len > 0)
 		{
-			pbuf += sig_cert.write_der(pbuf);
+			std::memcpy(pbuf, cryptoplus::buffer_cast<const char*>(sig_cert_der), sig_cert_len);
+			pbuf += sig_cert_len;
 		}
 
 		message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, MESSAGE_TYPE_PRESENTATION, pbuf - static_cast<char*>(buf) - HEADER_LENGTH);
@@ -0,0 +1,173 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file relay_message.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A relay message class.
+ */
+
+#include "relay_message.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace fscp
+{
+	size_t relay_message::write(void* buf, size_t buf_len, message_type type, const ep_type& endpoint, const void* data, size_t data_len)
+	{
+		assert((type == MESSAGE_TYPE_RELAY_FORWARD) || (type == MESSAGE_TYPE_RELAY_DELIVER));
+
+		const size_t body_length = endpoint_length(endpoint) + data_len;
+
+		if (buf_len < HEADER_LENGTH + body_length)
+		{
+			throw std::runtime_error("buf_len");
+		}
+
+		uint8_t* ptr = static_cast<uint8_t*>(buf) + HEADER_LENGTH;
+
+		if (endpoint.address().is_v4())
+		{
+			*(ptr++) = static_cast<uint8_t>(ENDPOINT_TYPE_IPV4);
+
+			const boost::asio::ip::address_v4::bytes_type bytes = endpoint.address().to_v4().to_bytes();
+
+			ptr = std::copy(bytes.begin(), bytes.end(), ptr);
+		}
+		else
+		{
+			*(ptr++) = static_cast<uint8_t>(ENDPOINT_TYPE_IPV6);
+
+			const boost::asio::ip::address_v6::bytes_type bytes = endpoint.address().to_v6().to_bytes();
+
+			ptr = std::copy(bytes.begin(), bytes.end(), ptr);
+		}
+
+		buffer_tools::set<uint16_t>(ptr, 0, htons(endpoint.port()));
+		ptr += sizeof(uint16_t);
+
+		std::memcpy(ptr, data, data_len);
+
+		message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, type, body_length);
+
+		return HEADER_LENGTH + body_length;
+	}
+
+	relay_message::relay_message(const void* buf, size_t buf_len) :
+		message(buf, buf_len)
+	{
+		check_format();
+	}
+
+	relay_message::relay_message(const message& _message) :
+		message(_message)
+	{
+		check_format();
+	}
+
+	relay_message::ep_type relay_message::endpoint() const
+	{
+		const uint8_t* ptr = payload();
+
+		if (static_cast<endpoint_type_type>(*ptr) == ENDPOINT_TYPE_IPV4)
+		{
+			boost::asio::ip::address_v4::bytes_type bytes;
+
+			std::copy(ptr + 1, ptr + 1 + bytes.size(), bytes.begin());
+
+			const uint16_t port = ntohs(buffer_tools::get<uint16_t>(ptr, 1 + bytes.size()));
+
+			return ep_type(boost::asio::ip::address_v4(bytes), port);
+		}
+		else
+		{
+			boost::asio::ip::address_v6::bytes_type bytes;
+
+			std::copy(ptr + 1, ptr + 1 + bytes.size(), bytes.begin());
+
+			const uint16_t port = ntohs(buffer_tools::get<uint16_t>(ptr, 1 + bytes.size()));
+
+			return ep_type(boost::asio::ip::address_v6(bytes), port);
+		}
+	}
+
+	const uint8_t* relay_message::relayed_data() const
+	{
+		return payload() + parse_endpoint_length();
+	}
+
+	size_t relay_message::relayed_data_size() const
+	{
+		return length() - parse_endpoint_length();
+	}
+
+	size_t relay_message::endpoint_length(const ep_type& endpoint)
+	{
+		// One byte of endpoint type, the address bytes, two bytes of port.
+		return 1 + (endpoint.address().is_v4() ? boost::asio::ip::address_v4::bytes_type().size() : boost::asio::ip::address_v6::bytes_type().size()) + sizeof(uint16_t);
+	}
+
+	size_t relay_message::parse_endpoint_length() const
+	{
+		const bool is_v4 = (static_cast<endpoint_type_type>(*payload()) == ENDPOINT_TYPE_IPV4);
+
+		return 1 + (is_v4 ? boost::asio::ip::address_v4::bytes_type().size() : boost::asio::ip::address_v6::bytes_type().size()) + sizeof(uint16_t);
+	}
+
+	void relay_message::check_format() const
+	{
+		if (length() < 1)
+		{
+			throw std::runtime_error("bad message length");
+		}
+
+		const endpoint_type_type endpoint_type = static_cast<endpoint_type_type>(*payload());
+
+		if ((endpoint_type != ENDPOINT_TYPE_IPV4) && (endpoint_type != ENDPOINT_TYPE_IPV6))
+		{
+			throw std::runtime_error("bad endpoint type");
+		}
+
+		if (length() < parse_endpoint_length())
+		{
+			throw std::runtime_error("bad message length");
+		}
+	}
+}
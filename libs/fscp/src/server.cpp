@@ -52,14 +52,39 @@
 #include "session_request_message.hpp"
 #include "session_message.hpp"
 #include "data_message.hpp"
+#include "relay_message.hpp"
+#include "presentation_cache.hpp"
+#include "frame_recorder.hpp"
+#include "memory_usage.hpp"
+
+#include <cryptoplus/hash/message_digest.hpp>
+
+#include <openssl/x509.h>
 
 #include <boost/random.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/ref.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/iterator/transform_iterator.hpp>
 
 #include <cassert>
+#include <cstring>
+#include <chrono>
+#include <stdexcept>
+
+#ifdef LINUX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <cerrno>
+#include <ctime>
+#endif
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
 
 namespace fscp
 {
@@ -69,9 +94,100 @@ namespace fscp
 
 	namespace
 	{
+		// The number of pre-generated ECDHE keypairs kept per elliptic curve.
+		const size_t ECDHE_CONTEXT_CACHE_SIZE = 4;
+
+		// The timestamp source of the handshake timings.
+		uint64_t monotonic_us()
+		{
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+
+		// The duration covered by one slot of the keep-alive timer wheel.
+		const boost::posix_time::time_duration KEEP_ALIVE_WHEEL_GRANULARITY = boost::posix_time::seconds(1);
+
+		// The count of session handshakes processed concurrently. A
+		// handshake costs a signature check, a key exchange and a signed
+		// reply: bounding how many are in flight keeps a reconnect storm
+		// from crowding the established sessions out of the strands.
+		const size_t HANDSHAKE_MAX_CONCURRENCY = 8;
+
+		// The count of session requests kept waiting for a handshake slot.
+		const size_t HANDSHAKE_BACKLOG_CAPACITY = 64;
+
+		// The smallest datagram size probed during a path MTU discovery. Any
+		// usable path is assumed to carry at least this much.
+		const size_t MTU_PROBE_MIN_SIZE = 576;
+
+		// The largest datagram size probed during a path MTU discovery.
+		const size_t MTU_PROBE_MAX_SIZE = 9000;
+
+		// A path MTU discovery stops when the searched interval gets smaller
+		// than this.
+		const size_t MTU_PROBE_PRECISION = 16;
+
+		// The number of times a probe size is retried before the size is
+		// declared too big for the path.
+		const size_t MTU_PROBE_ATTEMPTS = 2;
+
+		// The maximum time to wait for the reply to a single MTU probe.
+		const boost::posix_time::time_duration MTU_PROBE_TIMEOUT = boost::posix_time::seconds(2);
+
+		// Data frames at most this big are eligible for coalescing.
+		const size_t COALESCE_MAX_FRAME_SIZE = 512;
+
+		// A coalesced data message is flushed before its payload would grow
+		// beyond this, so it still fits a typical path MTU once ciphered.
+		const size_t COALESCE_MAX_PAYLOAD_SIZE = 1400;
+
+		// The maximum count of frames packed into one coalesced data message.
+		const size_t COALESCE_MAX_FRAME_COUNT = 32;
+
+		// The maximum time a frame may wait for companions before its
+		// coalesced data message is flushed.
+		const boost::posix_time::time_duration COALESCE_FLUSH_DELAY = boost::posix_time::microseconds(500);
+
+		// The reliable channel timer granularity: retransmission delays
+		// and reassembly lifetimes are expressed in ticks of this period.
+		const boost::posix_time::time_duration RELIABLE_TICK_PERIOD = boost::posix_time::milliseconds(250);
+
+		// The initial and maximum retransmission delays, in ticks.
+		const unsigned int RELIABLE_INITIAL_BACKOFF_TICKS = 2;
+		const unsigned int RELIABLE_MAX_BACKOFF_TICKS = 16;
+
+		// How long a reassembly lingers without progress, in ticks. A
+		// delivered one lingers just as long, so late retransmissions get
+		// re-acknowledged instead of appearing as a new message.
+		const unsigned int RELIABLE_REASSEMBLY_TTL_TICKS = 240;
+
+#ifdef USE_UPNP
+		// How often the UPnP port mapping lease is renewed: half the
+		// requested lease duration, so a single missed renewal is harmless.
+		const boost::posix_time::time_duration UPNP_LEASE_RENEWAL_PERIOD = boost::posix_time::minutes(30);
+#endif
+
+#ifdef USE_LZ4
+		// Frames smaller than this skip the compression attempt: the LZ4
+		// call overhead and the marker byte outweigh any gain on them.
+		const size_t COMPRESSION_THRESHOLD = 128;
+#endif
+
 		void null_simple_handler(const boost::system::error_code&) {}
+		void null_duration_handler(const boost::system::error_code&, const boost::posix_time::time_duration&) {}
 		void null_multiple_endpoints_handler(const std::map<server::ep_type, boost::system::error_code>&) {}
 
+#if defined(LINUX) && defined(SO_TIMESTAMPING)
+		bool enable_kernel_receive_timestamps(int fd)
+		{
+			// Hardware receive timestamps are requested alongside the
+			// software ones: the driver provides whichever it supports, and
+			// the software timestamp is always there as a fallback.
+			const int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+			return ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+		}
+#endif
+
 		server::ep_type normalize(const server::ep_type& ep)
 		{
 			server::ep_type result = ep;
@@ -200,18 +316,6 @@ namespace fscp
 				set_type m_keys;
 				map_type m_results;
 		};
-
-		bool compare_certificates(const server::cert_type& lhs, const server::cert_type& rhs)
-		{
-			if (!!lhs && !!rhs)
-			{
-				return (lhs.write_der() == rhs.write_der());
-			}
-			else
-			{
-				return (!lhs && !rhs);
-			}
-		}
 	}
 
 	// Public methods
@@ -219,17 +323,33 @@ namespace fscp
 	server::server(boost::asio::io_service& io_service, fscp::logger& _logger, const identity_store& identity) :
 		m_logger(_logger),
 		m_identity_store(identity),
+		m_identity_version(0),
+		m_identity_grace_timer(io_service),
+		m_relay_enabled(false),
+		m_has_relay_peers(false),
 		m_socket(io_service),
-		m_socket_strand(io_service),
-		m_write_queue_strand(io_service),
-		m_greet_strand(io_service),
+		m_socket_strand(io_service, m_strand_profilers.socket),
+		m_busy_poll_usec(0),
+		m_send_queue_sojourn_limit_ms(0),
+		m_receive_steering_count(0),
+		m_reuse_port_enabled(false),
+		m_mtu_discovery_enabled(false),
+		m_write_queue_strand(io_service, m_strand_profilers.write_queue),
+		m_socket_buffers(65536),
+		m_handshake_buffers(MTU_PROBE_MAX_SIZE),
+		m_timer_service(io_service),
+		m_greet_strand(io_service, m_strand_profilers.greet),
 		m_accept_hello_messages_default(true),
 		m_hello_message_received_handler(),
-		m_presentation_strand(io_service),
+		m_presentation_strand(io_service, m_strand_profilers.presentation),
 		m_presentation_message_received_handler(),
-		m_session_strand(io_service),
+		m_presentation_message_received_async_handler(),
+		m_handshake_slots_in_use(0),
+		m_session_strand(io_service, m_strand_profilers.session),
+		m_hot_session(nullptr),
+		m_session_buffers(65536),
 		m_accept_session_request_messages_default(true),
-		m_cipher_suites(get_default_cipher_suites()),
+		m_cipher_suites(get_supported_cipher_suites(get_default_cipher_suites())),
 		m_elliptic_curves(get_supported_elliptic_curves(get_default_elliptic_curves())),
 		m_session_request_message_received_handler(),
 		m_accept_session_messages_default(true),
@@ -238,14 +358,54 @@ namespace fscp
 		m_session_error_handler(),
 		m_session_established_handler(),
 		m_session_lost_handler(),
-		m_contact_strand(io_service),
+		m_reorder_hold_ms(0),
+		m_reorder_timer(io_service),
+		m_reorder_flush_at(boost::posix_time::pos_infin),
+		m_contact_strand(io_service, m_strand_profilers.contact),
+		m_has_prioritized_peers(false),
 		m_data_received_handler(),
 		m_contact_request_message_received_handler(),
 		m_contact_message_received_handler(),
-		m_keep_alive_timer(io_service, SESSION_KEEP_ALIVE_PERIOD)
+		m_data_coalescing_enabled(false),
+		m_data_padding_enabled(false),
+		m_coalesce_timer(io_service),
+		m_coalesce_flush_pending(false),
+		m_reliable_channels(0),
+		m_reliable_timer(io_service),
+		m_reliable_timer_pending(false),
+		m_keep_alive_timer_id(0),
+		m_keep_alive_wheel_cursor(0),
+		m_handshake_histograms()
+#ifdef USE_UPNP
+		, m_upnp_timer(io_service)
+#endif
 	{
 		// These calls are needed in C++03 to ensure that static initializations are done in a single thread.
 		server_category();
+
+#ifdef LINUX
+		m_send_flush_pending = false;
+		m_gso_enabled = false;
+		m_gro_enabled = false;
+		m_kernel_timestamps_enabled = false;
+
+		// The flush scratch memory is pinned once for the lifetime of the
+		// server: filling a batch then only moves entries between
+		// preallocated slots.
+		m_send_batch.reserve(SEND_BATCH_SIZE);
+#endif
+
+		m_data_strands.reserve(DATA_STRAND_POOL_SIZE);
+
+		for (size_t i = 0; i < DATA_STRAND_POOL_SIZE; ++i)
+		{
+			m_data_strands.push_back(boost::make_shared<boost::asio::strand>(boost::ref(io_service)));
+		}
+	}
+
+	server::server(boost::asio::io_service& io_service, fscp::logger& _logger) :
+		server(io_service, _logger, identity_store())
+	{
 	}
 
 	elliptic_curve_list_type server::get_supported_elliptic_curves(
@@ -270,6 +430,27 @@ namespace fscp
 		return ret;
 	}
 
+	cipher_suite_list_type server::get_supported_cipher_suites(
+			const cipher_suite_list_type& cipher_suites)
+	{
+		cipher_suite_list_type ret;
+
+		for (auto&& cs : cipher_suites)
+		{
+			try
+			{
+				cs.to_cipher_algorithm();
+				ret.push_back(cs);
+			}
+			catch(std::exception&)
+			{
+				m_logger(log_level::warning) << "Cipher suite not supported: "
+					<< cs.to_string();
+			}
+		}
+		return ret;
+	}
+
 	identity_store server::sync_get_identity()
 	{
 		typedef boost::promise<identity_store> promise_type;
@@ -302,382 +483,560 @@ namespace fscp
 			m_socket.set_option(boost::asio::ip::v6_only(false));
 		}
 
-		m_socket.bind(listen_endpoint);
+#if defined(LINUX) && defined(SO_REUSEPORT)
+		if ((m_receive_steering_count > 0) || m_reuse_port_enabled)
+		{
+			// The steering workers join the main socket in a SO_REUSEPORT
+			// group: the option must be set on every member before it binds.
+			// A process handover uses the same mechanism, with the
+			// replacement process as the other group member.
+			const int reuse = 1;
 
-		async_receive_from();
+			if (::setsockopt(m_socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0)
+			{
+				m_logger(log_level::warning) << "Unable to enable port sharing on the socket: " << ::strerror(errno);
 
-		m_keep_alive_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
-	}
+				m_receive_steering_count = 0;
+				m_reuse_port_enabled = false;
+			}
+		}
+#endif
 
-	void server::close()
-	{
-		cancel_all_greetings();
+		m_socket.bind(listen_endpoint);
 
-		m_keep_alive_timer.cancel();
+#ifdef FSCP_MAX_PEERS
+		// Embedded capacity profile: the peer tables and buffer pools are
+		// sized for MAX_PEERS up front, so the steady state neither
+		// rehashes nor allocates.
+		m_peer_sessions.rehash(MAX_PEERS);
+		m_socket_buffers.prefill(MAX_PEERS * 2);
+		m_session_buffers.prefill(MAX_PEERS * 2);
+		m_handshake_buffers.prefill(MAX_PEERS);
+#endif
 
-		m_socket.close();
-	}
+#ifdef LINUX
+		// Datagrams are sent and received in batch with sendmmsg()/recvmmsg()
+		// directly on the native descriptor, which must not block.
+		boost::system::error_code nb_ec;
+		m_socket.native_non_blocking(true, nb_ec);
 
-#ifdef USE_UPNP
-	void server::upnp_punch_hole(uint16_t port)
-	{
-		try
+#ifdef SO_BUSY_POLL
+		if (m_busy_poll_usec > 0)
 		{
-			std::ostringstream oss;
-			oss << port;
+			// Let the kernel busy-poll the device queue instead of sleeping
+			// on the interrupt, cutting the wake-up jitter on receives.
+			const int busy_poll = static_cast<int>(m_busy_poll_usec);
 
-			if(m_upnp.get() == nullptr)
+			if (::setsockopt(m_socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) != 0)
 			{
-				m_logger(log_level::information) << "Discovering UPnP IGD gateways.";
-				m_upnp.reset(new miniupnpcplus::upnp_device(2000));
+				m_logger(log_level::warning) << "Unable to enable busy-polling on the socket: " << ::strerror(errno);
+			}
+		}
+#endif
 
-				// same external port as local port
-				m_logger(log_level::trace) << "Try to register UPnP port mapping: " <<
-					m_upnp->get_external_ip() << ":" << port << " -> " << m_upnp->get_lan_ip() <<
-					":" << port;
-				m_upnp->register_port_mapping(miniupnpcplus::UDP, oss.str(), oss.str(),
-						"FreeLAN peer");
-				m_logger(log_level::information) << "UPnP port mapping registered: " <<
-					m_upnp->get_external_ip() << ":" << port << " -> " << m_upnp->get_lan_ip() <<
-					":" << port;
+#ifdef IP_MTU_DISCOVER
+		if (m_mtu_discovery_enabled)
+		{
+			// Set the don't-fragment flag on outgoing datagrams and bypass the
+			// kernel's own path MTU estimate, so that oversized MTU probes are
+			// dropped by the path (or rejected locally) instead of being
+			// fragmented.
+			if (listen_endpoint.address().is_v6())
+			{
+#ifdef IPV6_MTU_DISCOVER
+				const int pmtudisc = IPV6_PMTUDISC_PROBE;
 
-				// TODO retry if port is already taken
+				if (::setsockopt(m_socket.native_handle(), IPPROTO_IPV6, IPV6_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) != 0)
+				{
+					m_logger(log_level::warning) << "Unable to set the don't-fragment flag on the socket: " << ::strerror(errno);
+				}
+#endif
+			}
+			else
+			{
+				const int pmtudisc = IP_PMTUDISC_PROBE;
+
+				if (::setsockopt(m_socket.native_handle(), IPPROTO_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) != 0)
+				{
+					m_logger(log_level::warning) << "Unable to set the don't-fragment flag on the socket: " << ::strerror(errno);
+				}
 			}
 		}
-		catch (const boost::system::system_error& ex)
+#endif
+
+#ifdef UDP_SEGMENT
+		// Probe for UDP GSO support: when available, runs of equal-size
+		// datagrams to one peer are coalesced into a super-datagram that the
+		// kernel segments, cutting the per-packet cost.
 		{
-			m_logger(log_level::error) << "UPnP discovery/port mapping failed: " << ex.what();
+			const int gso = 0;
+
+			m_gso_enabled = (::setsockopt(m_socket.native_handle(), IPPROTO_UDP, UDP_SEGMENT, &gso, sizeof(gso)) == 0);
 		}
-	}
 #endif
 
-	void server::async_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
-	{
-		m_greet_strand.post(boost::bind(&server::do_greet, this, normalize(target), handler, timeout));
-	}
+#ifdef UDP_GRO
+		// UDP GRO lets the kernel coalesce bursts of datagrams from one peer
+		// into a single super-datagram, which is split back after recvmmsg().
+		{
+			const int gro = 1;
 
-	void server::sync_set_accept_hello_messages_default(bool value)
-	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+			m_gro_enabled = (::setsockopt(m_socket.native_handle(), IPPROTO_UDP, UDP_GRO, &gro, sizeof(gro)) == 0);
+		}
+#endif
 
-		async_set_accept_hello_messages_default(value, boost::bind(&promise_type::set_value, &promise));
+#ifdef SO_TIMESTAMPING
+		// Kernel receive timestamps stamp each datagram at the driver (or
+		// the NIC), before it sits in the socket queue: the RTT estimator
+		// prefers them over the noisier userspace receive time.
+		m_kernel_timestamps_enabled = enable_kernel_receive_timestamps(m_socket.native_handle());
 
-		return promise.get_future().wait();
-	}
+		if (!m_kernel_timestamps_enabled)
+		{
+			m_logger(log_level::debug) << "Unable to enable kernel receive timestamps on the socket: " << ::strerror(errno);
+		}
+#endif
+#endif
 
-	void server::sync_set_hello_message_received_callback(hello_message_received_handler_type callback)
-	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+#if defined(LINUX) && defined(SO_REUSEPORT)
+		if (m_receive_steering_count > 0)
+		{
+			open_receive_workers(m_socket.local_endpoint());
+		}
+#endif
 
-		async_set_hello_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		async_receive_from();
 
-		return promise.get_future().wait();
+		m_keep_alive_timer_id = m_timer_service.schedule(KEEP_ALIVE_WHEEL_GRANULARITY, m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
 	}
 
-	void server::async_introduce_to(const ep_type& target, simple_handler_type handler)
+	void server::close()
 	{
-		m_socket_strand.post(boost::bind(&server::do_introduce_to, this, normalize(target), handler));
-	}
+		cancel_all_greetings();
 
-	boost::system::error_code server::sync_introduce_to(const ep_type& target)
-	{
-		typedef boost::promise<boost::system::error_code> promise_type;
-		promise_type promise;
+		m_coalesce_timer.cancel();
+		m_reliable_timer.cancel();
+		m_timer_service.cancel(m_keep_alive_timer_id);
 
-		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
+#ifdef USE_UPNP
+		m_upnp_timer.cancel();
+#endif
 
-		async_introduce_to(target, boost::bind(setter, &promise, _1));
+		if (m_tcp_transport)
+		{
+			m_tcp_transport->close();
+			m_tcp_transport.reset();
+		}
 
-		return promise.get_future().get();
-	}
+		// The receive loops initiate their waits within the socket strand:
+		// closing the sockets there too guarantees the close never runs
+		// concurrently with a receive initiation on another thread.
+		m_socket_strand.post([this] () {
+#if defined(LINUX) && defined(SO_REUSEPORT)
+			close_receive_workers();
+#endif
 
-	void server::async_reintroduce_to_all(multiple_endpoints_handler_type handler)
-	{
-		m_presentation_strand.post(boost::bind(&server::do_reintroduce_to_all, this, handler));
+			boost::system::error_code ec;
+
+			m_socket.close(ec);
+		});
 	}
 
-	std::map<server::ep_type, boost::system::error_code> server::sync_reintroduce_to_all()
+	void server::open_tcp(const ep_type& listen_endpoint)
 	{
-		typedef std::map<server::ep_type, boost::system::error_code> result_type;
-		typedef boost::promise<result_type> promise_type;
-
-		promise_type promise;
+		m_tcp_transport = boost::make_shared<tcp_transport>(boost::ref(get_io_service()), boost::ref(m_logger));
 
-		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+		// Messages received over TCP enter the message layer exactly where
+		// UDP datagrams do: the transport in use is invisible above this
+		// point.
+		m_tcp_transport->set_message_received_callback([this] (const ep_type& sender, SharedBuffer data, size_t size) {
+			m_socket_strand.post([this, sender, data, size] () {
+				handle_datagram_from(get_identity(), normalize(sender), data, size);
+			});
+		});
 
-		async_reintroduce_to_all(boost::bind(setter, &promise, _1));
+		// A lost TCP connection means the host closed its socket (or the
+		// network did): the session cannot survive it, so it is
+		// force-terminated just like an UDP connection refusal.
+		m_tcp_transport->set_connection_lost_callback([this] (const ep_type& target) {
+			async_close_session(target, &null_simple_handler);
+		});
 
-		return promise.get_future().get();
+		m_tcp_transport->open(listen_endpoint);
 	}
 
-	boost::optional<presentation_store> server::get_presentation(const ep_type& target)
+	void server::async_connect_tcp(const ep_type& target, simple_handler_type handler)
 	{
-		const presentation_store_map::const_iterator item = m_presentation_store_map.find(target);
-
-		if (item != m_presentation_store_map.end())
+		if (!m_tcp_transport)
 		{
-			return boost::make_optional<presentation_store>(item->second);
-		}
-		else
-		{
-			return boost::optional<presentation_store>();
+			handler(server_error::make_error_code(server_error::server_offline));
+
+			return;
 		}
-	}
 
-	void server::async_get_presentation(const ep_type& target, optional_presentation_store_handler_type handler)
-	{
-		m_presentation_strand.post(boost::bind(&server::do_get_presentation, this, normalize(target), handler));
+		m_tcp_transport->async_connect(normalize(target), handler);
 	}
 
-	boost::optional<presentation_store> server::sync_get_presentation(const ep_type& target)
+	void server::set_relay(const ep_type& target, const ep_type& relay)
 	{
-		typedef boost::promise<boost::optional<presentation_store> > promise_type;
-		promise_type promise;
-
-		void (promise_type::*setter)(const boost::optional<presentation_store>&) = &promise_type::set_value;
+		if (target == relay)
+		{
+			return;
+		}
 
-		async_get_presentation(target, boost::bind(setter, &promise, _1));
+		boost::mutex::scoped_lock lock(m_relay_peers_mutex);
 
-		return promise.get_future().get();
+		m_relay_peers[normalize(target)] = normalize(relay);
+		m_has_relay_peers.store(true, std::memory_order_relaxed);
 	}
 
-	void server::set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key)
+	void server::clear_relay(const ep_type& target)
 	{
-		m_presentation_store_map[target] = presentation_store(signature_certificate, pre_shared_key);
-	}
+		boost::mutex::scoped_lock lock(m_relay_peers_mutex);
 
-	void server::async_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key, void_handler_type handler)
-	{
-		m_presentation_strand.post(boost::bind(&server::do_set_presentation, this, normalize(target), signature_certificate, pre_shared_key, handler));
+		m_relay_peers.erase(normalize(target));
+
+		if (m_relay_peers.empty())
+		{
+			m_has_relay_peers.store(false, std::memory_order_relaxed);
+		}
 	}
 
-	void server::sync_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key)
+	boost::optional<server::ep_type> server::get_relay(const ep_type& target) const
 	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		boost::mutex::scoped_lock lock(m_relay_peers_mutex);
 
-		async_set_presentation(target, signature_certificate, pre_shared_key, boost::bind(&promise_type::set_value, &promise));
+		const std::map<ep_type, ep_type>::const_iterator it = m_relay_peers.find(target);
 
-		return promise.get_future().wait();
-	}
+		if (it == m_relay_peers.end())
+		{
+			return boost::optional<ep_type>();
+		}
 
-	void server::clear_presentation(const ep_type& target)
-	{
-		m_presentation_store_map.erase(target);
+		return it->second;
 	}
 
-	void server::async_clear_presentation(const ep_type& target, void_handler_type handler)
+	bool server::send_relayed(const SharedBuffer& data, size_t offset, size_t size, const ep_type& target, simple_handler_type handler, bool droppable)
 	{
-		m_presentation_strand.post(boost::bind(&server::do_clear_presentation, this, normalize(target), handler));
-	}
+		const boost::optional<ep_type> relay = get_relay(target);
 
-	void server::sync_clear_presentation(const ep_type& target)
-	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		if (!relay || (*relay == target))
+		{
+			return false;
+		}
 
-		async_clear_presentation(target, boost::bind(&promise_type::set_value, &promise));
+		try
+		{
+			const message inner(buffer_cast<const uint8_t*>(data) + offset, size);
 
-		return promise.get_future().wait();
-	}
+			if ((inner.type() == MESSAGE_TYPE_RELAY_FORWARD) || (inner.type() == MESSAGE_TYPE_RELAY_DELIVER))
+			{
+				// Relay traffic goes to the relay directly: a single hop only.
+				return false;
+			}
 
-	void server::sync_set_presentation_message_received_callback(presentation_message_received_handler_type callback)
-	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+			// The host cannot be reached directly: the datagram goes
+			// encapsulated to a common neighbor that delivers it.
+			const SharedBuffer send_buffer = m_socket_buffers.get(relay_message::MAX_OVERHEAD + size);
 
-		async_set_presentation_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+			const size_t written = relay_message::write(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				MESSAGE_TYPE_RELAY_FORWARD,
+				target,
+				buffer_cast<const uint8_t*>(data) + offset,
+				size
+			);
 
-		return promise.get_future().wait();
-	}
+			async_send_to(send_buffer, written, *relay, handler, droppable);
+		}
+		catch (std::runtime_error&)
+		{
+			return false;
+		}
 
-	void server::async_request_session(const ep_type& target, simple_handler_type handler)
-	{
-		async_get_identity(m_session_strand.wrap(boost::bind(&server::do_request_session, this, _1, normalize(target), handler)));
+		return true;
 	}
 
-	void server::async_close_session(const ep_type& target, simple_handler_type handler)
+	void server::handle_relay_forward_from(const relay_message& _relay_message, const ep_type& sender)
 	{
-		m_session_strand.post(boost::bind(&server::do_close_session, this, normalize(target), handler));
-	}
+		if (!m_relay_enabled)
+		{
+			return;
+		}
 
-	boost::system::error_code server::sync_close_session(const ep_type& target)
-	{
-		typedef boost::promise<boost::system::error_code> promise_type;
-		promise_type promise;
+		const message inner(_relay_message.relayed_data(), _relay_message.relayed_data_size());
 
-		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
+		if ((inner.type() == MESSAGE_TYPE_RELAY_FORWARD) || (inner.type() == MESSAGE_TYPE_RELAY_DELIVER))
+		{
+			// Relayed traffic is never relayed again: a single hop only.
+			return;
+		}
 
-		async_close_session(target, boost::bind(setter, &promise, _1));
+		const ep_type destination = normalize(_relay_message.endpoint());
 
-		return promise.get_future().get();
-	}
+		if (destination == sender)
+		{
+			return;
+		}
 
-	std::set<server::ep_type> server::sync_get_session_endpoints()
-	{
-		typedef std::set<ep_type> result_type;
-		typedef boost::promise<result_type> promise_type;
-		promise_type promise;
+		if (!relay_budget_allows(sender, _relay_message.relayed_data_size()))
+		{
+			// Out of budget: the excess is shed exactly like a congested
+			// link would shed it. The two hosts handle their own
+			// retransmissions.
+			return;
+		}
 
-		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+		const SharedBuffer send_buffer = m_socket_buffers.get(relay_message::MAX_OVERHEAD + _relay_message.relayed_data_size());
 
-		async_get_session_endpoints(boost::bind(setter, &promise, _1));
+		const size_t written = relay_message::write(
+			buffer_cast<uint8_t*>(send_buffer),
+			buffer_size(send_buffer),
+			MESSAGE_TYPE_RELAY_DELIVER,
+			sender,
+			_relay_message.relayed_data(),
+			_relay_message.relayed_data_size()
+		);
 
-		return promise.get_future().get();
+		// Relayed traffic is droppable on the way out: it sheds first when
+		// the destination queue congests.
+		async_send_to(send_buffer, written, destination, &null_simple_handler, true);
 	}
 
-	bool server::sync_has_session_with_endpoint(const ep_type& host)
+	void server::do_handle_relay_deliver(const identity_store& identity, const ep_type& sender, SharedBuffer data, const relay_message& _relay_message)
 	{
-		typedef bool result_type;
-		typedef boost::promise<result_type> promise_type;
-		promise_type promise;
+		// All do_handle_relay_deliver() calls are done in the same strand so the following is thread-safe.
+		static_cast<void>(data);
 
-		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+		// Only established peers may deliver relayed datagrams: anyone
+		// could otherwise redirect the traffic for an arbitrary host to
+		// itself.
+		if (!has_session_with_endpoint(sender))
+		{
+			return;
+		}
 
-		async_has_session_with_endpoint(host, boost::bind(setter, &promise, _1));
+		try
+		{
+			const ep_type origin = normalize(_relay_message.endpoint());
 
-		return promise.get_future().get();
-	}
+			if (origin == sender)
+			{
+				return;
+			}
 
-	boost::system::error_code server::sync_request_session(const ep_type& target)
-	{
-		typedef boost::promise<boost::system::error_code> promise_type;
-		promise_type promise;
+			const message inner(_relay_message.relayed_data(), _relay_message.relayed_data_size());
 
-		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
+			if ((inner.type() == MESSAGE_TYPE_RELAY_FORWARD) || (inner.type() == MESSAGE_TYPE_RELAY_DELIVER))
+			{
+				// Relayed traffic is never relayed again: a single hop only.
+				return;
+			}
 
-		async_request_session(target, boost::bind(setter, &promise, _1));
+			// The replies must take the same path back: the origin is
+			// reachable through the delivering relay, possibly only through
+			// it.
+			set_relay(origin, sender);
 
-		return promise.get_future().get();
+			const SharedBuffer inner_buffer = m_session_buffers.get(inner.size());
+
+			std::memcpy(buffer_cast<uint8_t*>(inner_buffer), inner.data(), inner.size());
+
+			handle_datagram_from(identity, origin, inner_buffer, inner.size());
+		}
+		catch (std::runtime_error&)
+		{
+			// These errors can happen in normal situations (for instance when a malformed datagram is relayed).
+		}
 	}
 
-	void server::sync_set_accept_session_request_messages_default(bool value)
+	bool server::relay_budget_allows(const ep_type& source, size_t size)
 	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
 
-		async_set_accept_session_request_messages_default(value, boost::bind(&promise_type::set_value, &promise));
+		boost::mutex::scoped_lock lock(m_relay_budgets_mutex);
 
-		return promise.get_future().wait();
-	}
+		// The budget table cannot grow without bound: the entries whose
+		// window expired are pruned once the table gets large.
+		if (m_relay_budgets.size() > 1024)
+		{
+			for (std::map<ep_type, relay_budget_type>::iterator it = m_relay_budgets.begin(); it != m_relay_budgets.end();)
+			{
+				if (now - it->second.window_start >= boost::posix_time::seconds(1))
+				{
+					it = m_relay_budgets.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
 
-	void server::sync_set_cipher_suites(const cipher_suite_list_type& cipher_suites)
-	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		relay_budget_type& budget = m_relay_budgets[source];
 
-		async_set_cipher_suites(cipher_suites, boost::bind(&promise_type::set_value, &promise));
+		if (budget.window_start.is_not_a_date_time() || (now - budget.window_start >= boost::posix_time::seconds(1)))
+		{
+			budget.window_start = now;
+			budget.bytes = 0;
+			budget.packets = 0;
+		}
 
-		return promise.get_future().wait();
-	}
+		if ((budget.bytes + size > RELAY_RATE_BUDGET_BYTES_PER_SECOND) || (budget.packets >= RELAY_RATE_BUDGET_PACKETS_PER_SECOND))
+		{
+			return false;
+		}
 
-	void server::sync_set_elliptic_curves(const elliptic_curve_list_type& elliptic_curves)
-	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		budget.bytes += size;
+		budget.packets += 1;
 
-		async_set_elliptic_curves(elliptic_curves, boost::bind(&promise_type::set_value, &promise));
+		return true;
+	}
 
-		return promise.get_future().wait();
+#ifdef USE_UPNP
+	void server::upnp_punch_hole(uint16_t port)
+	{
+		// The discovery blocks for a few seconds: it runs on the io_service
+		// instead of the caller thread so startup does not wait for it.
+		get_io_service().post(boost::bind(&server::do_upnp_punch_hole, this, port));
 	}
 
-	void server::sync_set_session_request_message_received_callback(session_request_received_handler_type callback)
+	void server::do_upnp_punch_hole(uint16_t port)
 	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		try
+		{
+			std::ostringstream oss;
+			oss << port;
 
-		async_set_session_request_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+			if(m_upnp.get() == nullptr)
+			{
+				m_logger(log_level::information) << "Discovering UPnP IGD gateways.";
+				m_upnp.reset(new miniupnpcplus::upnp_device(2000));
 
-		return promise.get_future().wait();
+				// same external port as local port
+				m_logger(log_level::trace) << "Try to register UPnP port mapping: " <<
+					m_upnp->get_external_ip() << ":" << port << " -> " << m_upnp->get_lan_ip() <<
+					":" << port;
+				m_upnp->register_port_mapping(miniupnpcplus::UDP, oss.str(), oss.str(),
+						"FreeLAN peer");
+				m_logger(log_level::information) << "UPnP port mapping registered: " <<
+					m_upnp->get_external_ip() << ":" << port << " -> " << m_upnp->get_lan_ip() <<
+					":" << port;
+
+				// TODO retry if port is already taken
+
+				// The mapping has a finite lease: renew it well before it
+				// expires so it does not silently vanish.
+				m_upnp_timer.expires_from_now(UPNP_LEASE_RENEWAL_PERIOD);
+				m_upnp_timer.async_wait(boost::bind(&server::do_refresh_upnp, this, boost::asio::placeholders::error));
+			}
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			m_logger(log_level::error) << "UPnP discovery/port mapping failed: " << ex.what();
+		}
 	}
 
-	void server::sync_set_accept_session_messages_default(bool value)
+	void server::do_refresh_upnp(const boost::system::error_code& ec)
 	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
 
-		async_set_accept_session_messages_default(value, boost::bind(&promise_type::set_value, &promise));
+		try
+		{
+			m_upnp->refresh_port_mappings();
 
-		return promise.get_future().wait();
-	}
+			m_logger(log_level::trace) << "UPnP port mapping lease renewed.";
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			m_logger(log_level::warning) << "UPnP lease renewal failed: " << ex.what() << ". Rediscovering the gateways.";
 
-	void server::sync_set_session_message_received_callback(session_received_handler_type callback)
-	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+			try
+			{
+				// The gateway may have restarted or gone away: a rediscovery
+				// fails over to any other gateway of the LAN and re-registers
+				// the mappings there.
+				m_upnp->rediscover(2000);
 
-		async_set_session_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+				m_logger(log_level::information) << "UPnP port mapping re-registered on " << m_upnp->get_external_ip() << ".";
+			}
+			catch (const boost::system::system_error& ex2)
+			{
+				m_logger(log_level::error) << "UPnP rediscovery failed: " << ex2.what();
+			}
+		}
 
-		return promise.get_future().wait();
+		m_upnp_timer.expires_from_now(UPNP_LEASE_RENEWAL_PERIOD);
+		m_upnp_timer.async_wait(boost::bind(&server::do_refresh_upnp, this, boost::asio::placeholders::error));
 	}
+#endif
 
-	void server::sync_set_session_failed_callback(session_failed_handler_type callback)
+	void server::async_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
 	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
-
-		async_set_session_failed_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		m_greet_strand.post(boost::bind(&server::do_greet, this, normalize(target), handler, timeout));
+	}
 
-		return promise.get_future().wait();
+	void server::async_discover_mtu(const ep_type& target, mtu_handler_type handler)
+	{
+		m_greet_strand.post(boost::bind(&server::do_discover_mtu, this, normalize(target), handler));
 	}
 
-	void server::sync_set_session_error_callback(session_error_handler_type callback)
+	size_t server::get_peer_mtu(const ep_type& target) const
 	{
-		typedef boost::promise<void> promise_type;
-		promise_type promise;
+		boost::mutex::scoped_lock lock(m_peer_mtus_mutex);
 
-		async_set_session_error_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		const std::map<ep_type, size_t>::const_iterator peer_mtu = m_peer_mtus.find(normalize(target));
 
-		return promise.get_future().wait();
+		return (peer_mtu != m_peer_mtus.end()) ? peer_mtu->second : 0;
 	}
 
-	void server::sync_set_session_established_callback(session_established_handler_type callback)
+	void server::sync_set_accept_hello_messages_default(bool value)
 	{
 		typedef boost::promise<void> promise_type;
 		promise_type promise;
 
-		async_set_session_established_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		async_set_accept_hello_messages_default(value, boost::bind(&promise_type::set_value, &promise));
 
 		return promise.get_future().wait();
 	}
 
-	void server::sync_set_session_lost_callback(session_lost_handler_type callback)
+	void server::sync_set_hello_message_received_callback(hello_message_received_handler_type callback)
 	{
 		typedef boost::promise<void> promise_type;
 		promise_type promise;
 
-		async_set_session_lost_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		async_set_hello_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
 
 		return promise.get_future().wait();
 	}
 
-	void server::async_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
+	void server::async_introduce_to(const ep_type& target, simple_handler_type handler)
 	{
-		m_session_strand.post(boost::bind(&server::do_send_data, this, normalize(target), channel_number, data, handler));
+		m_socket_strand.post(boost::bind(&server::do_introduce_to, this, normalize(target), handler));
 	}
 
-	boost::system::error_code server::sync_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data)
+	boost::system::error_code server::sync_introduce_to(const ep_type& target)
 	{
 		typedef boost::promise<boost::system::error_code> promise_type;
 		promise_type promise;
 
 		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
 
-		async_send_data(target, channel_number, data, boost::bind(setter, &promise, _1));
+		async_introduce_to(target, boost::bind(setter, &promise, _1));
 
 		return promise.get_future().get();
 	}
 
-	void server::async_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
+	void server::async_reintroduce_to_all(multiple_endpoints_handler_type handler)
 	{
-		const std::set<ep_type> normalized_targets(boost::make_transform_iterator(targets.begin(), normalize), boost::make_transform_iterator(targets.end(), normalize));
-
-		m_session_strand.post(boost::bind(&server::do_send_data_to_list, this, normalized_targets, channel_number, data, handler));
+		m_presentation_strand.post(boost::bind(&server::do_reintroduce_to_all, this, handler));
 	}
 
-	std::map<server::ep_type, boost::system::error_code> server::sync_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data)
+	std::map<server::ep_type, boost::system::error_code> server::sync_reintroduce_to_all()
 	{
 		typedef std::map<server::ep_type, boost::system::error_code> result_type;
 		typedef boost::promise<result_type> promise_type;
@@ -686,763 +1045,543 @@ namespace fscp
 
 		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-		async_send_data_to_list(targets, channel_number, data, boost::bind(setter, &promise, _1));
+		async_reintroduce_to_all(boost::bind(setter, &promise, _1));
 
 		return promise.get_future().get();
 	}
 
-	std::map<server::ep_type, boost::system::error_code> server::sync_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data)
+	boost::optional<presentation_store> server::get_presentation(const ep_type& target)
 	{
-		typedef std::map<server::ep_type, boost::system::error_code> result_type;
-		typedef boost::promise<result_type> promise_type;
-
-		promise_type promise;
-
-		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
-
-		async_send_data_to_all(channel_number, data, boost::bind(setter, &promise, _1));
+		const presentation_store_map::const_iterator item = m_presentation_store_map.find(target);
 
-		return promise.get_future().get();
+		if (item != m_presentation_store_map.end())
+		{
+			return boost::make_optional<presentation_store>(item->second);
+		}
+		else
+		{
+			return boost::optional<presentation_store>();
+		}
 	}
 
-	void server::async_send_contact_request(const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
+	void server::async_get_presentation(const ep_type& target, optional_presentation_store_handler_type handler)
 	{
-		m_session_strand.post(boost::bind(&server::do_send_contact_request, this, normalize(target), hash_list, handler));
+		m_presentation_strand.post(boost::bind(&server::do_get_presentation, this, normalize(target), handler));
 	}
 
-	boost::system::error_code server::sync_send_contact_request(const ep_type& target, const hash_list_type& hash_list)
+	boost::optional<presentation_store> server::sync_get_presentation(const ep_type& target)
 	{
-		typedef boost::promise<boost::system::error_code> promise_type;
+		typedef boost::promise<boost::optional<presentation_store> > promise_type;
 		promise_type promise;
 
-		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
+		void (promise_type::*setter)(const boost::optional<presentation_store>&) = &promise_type::set_value;
 
-		async_send_contact_request(target, hash_list, boost::bind(setter, &promise, _1));
+		async_get_presentation(target, boost::bind(setter, &promise, _1));
 
 		return promise.get_future().get();
 	}
 
-	void server::async_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
+	void server::set_presentation_cache(const std::string& path)
 	{
-		const std::set<ep_type> normalized_targets(boost::make_transform_iterator(targets.begin(), normalize), boost::make_transform_iterator(targets.end(), normalize));
+		m_presentation_strand.post([this, path] () {
+			m_presentation_cache = boost::make_shared<presentation_cache>(path);
+		});
+	}
 
-		m_session_strand.post(boost::bind(&server::do_send_contact_request_to_list, this, normalized_targets, hash_list, handler));
+	void server::set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key)
+	{
+		set_presentation_store(target, signature_certificate, pre_shared_key);
 	}
 
-	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list)
+	void server::async_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key, void_handler_type handler)
 	{
-		typedef std::map<server::ep_type, boost::system::error_code> result_type;
-		typedef boost::promise<result_type> promise_type;
+		m_presentation_strand.post(boost::bind(&server::do_set_presentation, this, normalize(target), signature_certificate, pre_shared_key, handler));
+	}
 
+	void server::sync_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key)
+	{
+		typedef boost::promise<void> promise_type;
 		promise_type promise;
 
-		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
-
-		async_send_contact_request_to_list(targets, hash_list, boost::bind(setter, &promise, _1));
+		async_set_presentation(target, signature_certificate, pre_shared_key, boost::bind(&promise_type::set_value, &promise));
 
-		return promise.get_future().get();
+		return promise.get_future().wait();
 	}
 
-	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_request_to_all(const hash_list_type& hash_list)
+	void server::clear_presentation(const ep_type& target)
 	{
-		typedef std::map<server::ep_type, boost::system::error_code> result_type;
-		typedef boost::promise<result_type> promise_type;
-
-		promise_type promise;
+		erase_presentation_store(target);
+	}
 
-		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+	void server::async_clear_presentation(const ep_type& target, void_handler_type handler)
+	{
+		m_presentation_strand.post(boost::bind(&server::do_clear_presentation, this, normalize(target), handler));
+	}
 
-		async_send_contact_request_to_all(hash_list, boost::bind(setter, &promise, _1));
+	void server::sync_clear_presentation(const ep_type& target)
+	{
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		return promise.get_future().get();
+		async_clear_presentation(target, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	void server::async_send_contact(const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
+	void server::sync_set_presentation_message_received_callback(presentation_message_received_handler_type callback)
 	{
-		m_session_strand.post(boost::bind(&server::do_send_contact, this, normalize(target), contact_map, handler));
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
+
+		async_set_presentation_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	boost::system::error_code server::sync_send_contact(const ep_type& target, const contact_map_type& contact_map)
+	void server::async_request_session(const ep_type& target, simple_handler_type handler)
+	{
+		async_get_identity(m_session_strand.wrap(boost::bind(&server::do_request_session, this, _1, normalize(target), handler)));
+	}
+
+	void server::async_close_session(const ep_type& target, simple_handler_type handler)
+	{
+		m_session_strand.post(boost::bind(&server::do_close_session, this, normalize(target), handler));
+	}
+
+	boost::system::error_code server::sync_close_session(const ep_type& target)
 	{
 		typedef boost::promise<boost::system::error_code> promise_type;
 		promise_type promise;
 
 		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
 
-		async_send_contact(target, contact_map, boost::bind(setter, &promise, _1));
+		async_close_session(target, boost::bind(setter, &promise, _1));
 
 		return promise.get_future().get();
 	}
 
-	void server::async_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
+	std::set<server::ep_type> server::sync_get_session_endpoints()
 	{
-		const std::set<ep_type> normalized_targets(boost::make_transform_iterator(targets.begin(), normalize), boost::make_transform_iterator(targets.end(), normalize));
+		typedef std::set<ep_type> result_type;
+		typedef boost::promise<result_type> promise_type;
+		promise_type promise;
 
-		m_session_strand.post(boost::bind(&server::do_send_contact_to_list, this, normalized_targets, contact_map, handler));
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+
+		async_get_session_endpoints(boost::bind(setter, &promise, _1));
+
+		return promise.get_future().get();
 	}
 
-	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map)
+	bool server::sync_has_session_with_endpoint(const ep_type& host)
 	{
-		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef bool result_type;
 		typedef boost::promise<result_type> promise_type;
-
 		promise_type promise;
 
 		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-		async_send_contact_to_list(targets, contact_map, boost::bind(setter, &promise, _1));
+		async_has_session_with_endpoint(host, boost::bind(setter, &promise, _1));
 
 		return promise.get_future().get();
 	}
 
-	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_to_all(const contact_map_type& contact_map)
+	cryptoplus::buffer server::sync_export_session_state()
 	{
-		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef cryptoplus::buffer result_type;
 		typedef boost::promise<result_type> promise_type;
-
 		promise_type promise;
 
 		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-		async_send_contact_to_all(contact_map, boost::bind(setter, &promise, _1));
+		async_export_session_state(boost::bind(setter, &promise, _1));
 
 		return promise.get_future().get();
 	}
 
-	void server::sync_set_data_received_callback(data_received_handler_type callback)
+	void server::sync_import_session_state(const cryptoplus::buffer& state)
 	{
 		typedef boost::promise<void> promise_type;
 		promise_type promise;
 
-		async_set_data_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		async_import_session_state(state, boost::bind(&promise_type::set_value, &promise));
 
 		return promise.get_future().wait();
 	}
 
-	void server::sync_set_contact_request_received_callback(contact_request_received_handler_type callback)
+	boost::system::error_code server::sync_request_session(const ep_type& target)
 	{
-		typedef boost::promise<void> promise_type;
+		typedef boost::promise<boost::system::error_code> promise_type;
 		promise_type promise;
 
-		async_set_contact_request_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
 
-		return promise.get_future().wait();
+		async_request_session(target, boost::bind(setter, &promise, _1));
+
+		return promise.get_future().get();
 	}
 
-	void server::sync_set_contact_received_callback(contact_received_handler_type callback)
+	void server::sync_set_accept_session_request_messages_default(bool value)
 	{
 		typedef boost::promise<void> promise_type;
 		promise_type promise;
 
-		async_set_contact_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+		async_set_accept_session_request_messages_default(value, boost::bind(&promise_type::set_value, &promise));
 
 		return promise.get_future().wait();
 	}
 
-	// Private methods
-
-	void server::do_get_identity(identity_handler_type handler)
+	void server::sync_set_cipher_suites(const cipher_suite_list_type& cipher_suites)
 	{
-		// do_set_identity() is executed within the socket strand so this is safe.
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		handler(get_identity());
+		async_set_cipher_suites(cipher_suites, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	void server::do_set_identity(const identity_store& identity, void_handler_type handler)
+	void server::sync_set_elliptic_curves(const elliptic_curve_list_type& elliptic_curves)
 	{
-		// do_set_identity() is executed within the socket strand so this is safe.
-		set_identity(identity);
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		async_reintroduce_to_all(&null_multiple_endpoints_handler);
+		async_set_elliptic_curves(elliptic_curves, boost::bind(&promise_type::set_value, &promise));
 
-		if (handler)
-		{
-			handler();
-		}
+		return promise.get_future().wait();
 	}
 
-	void server::do_async_receive_from()
+	void server::sync_set_session_request_message_received_callback(session_request_received_handler_type callback)
 	{
-		// do_async_receive_from() is executed within the socket strand so this is safe.
-		boost::shared_ptr<ep_type> sender = boost::make_shared<ep_type>();
-
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer receive_buffer = m_socket_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_socket_buffers.front();
-			m_socket_buffers.pop_front();
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-			return result;
-		}();
+		async_set_session_request_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
 
-		m_socket.async_receive_from(
-			buffer(receive_buffer),
-			*sender,
-			boost::bind(
-				&server::handle_receive_from,
-				this,
-				get_identity(),
-				sender,
-				SharedBuffer(receive_buffer, [this](const SharedBuffer& buffer) {
-					m_socket_strand.post([this, buffer]() {
-						m_socket_buffers.push_back(buffer);
-					});
-				}),
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred
-			)
-		);
+		return promise.get_future().wait();
 	}
 
-	void server::handle_receive_from(const identity_store& identity, boost::shared_ptr<ep_type> sender, SharedBuffer data, const boost::system::error_code& ec, size_t bytes_received)
+	void server::sync_set_accept_session_messages_default(bool value)
 	{
-		assert(sender);
-
-		if (ec != boost::asio::error::operation_aborted)
-		{
-			// Let's read again !
-			async_receive_from();
-
-			*sender = normalize(*sender);
-
-			if (!ec)
-			{
-				try
-				{
-					message message(buffer_cast<const uint8_t*>(data), bytes_received);
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-					switch (message.type())
-					{
-						case MESSAGE_TYPE_DATA_0:
-						case MESSAGE_TYPE_DATA_1:
-						case MESSAGE_TYPE_DATA_2:
-						case MESSAGE_TYPE_DATA_3:
-						case MESSAGE_TYPE_DATA_4:
-						case MESSAGE_TYPE_DATA_5:
-						case MESSAGE_TYPE_DATA_6:
-						case MESSAGE_TYPE_DATA_7:
-						case MESSAGE_TYPE_DATA_8:
-						case MESSAGE_TYPE_DATA_9:
-						case MESSAGE_TYPE_DATA_10:
-						case MESSAGE_TYPE_DATA_11:
-						case MESSAGE_TYPE_DATA_12:
-						case MESSAGE_TYPE_DATA_13:
-						case MESSAGE_TYPE_DATA_14:
-						case MESSAGE_TYPE_DATA_15:
-						case MESSAGE_TYPE_CONTACT_REQUEST:
-						case MESSAGE_TYPE_CONTACT:
-						case MESSAGE_TYPE_KEEP_ALIVE:
-						{
-							data_message data_message(message);
-
-							m_session_strand.post(
-								make_shared_buffer_handler(
-									data,
-									boost::bind(
-										&server::do_handle_data,
-										this,
-										identity,
-										*sender,
-										data_message
-									)
-								)
-							);
-
-							break;
-						}
-						case MESSAGE_TYPE_HELLO_REQUEST:
-						case MESSAGE_TYPE_HELLO_RESPONSE:
-						{
-							hello_message hello_message(message);
+		async_set_accept_session_messages_default(value, boost::bind(&promise_type::set_value, &promise));
 
-							handle_hello_message_from(hello_message, *sender);
+		return promise.get_future().wait();
+	}
 
-							break;
-						}
-						case MESSAGE_TYPE_PRESENTATION:
-						{
-							presentation_message presentation_message(message);
+	void server::sync_set_session_message_received_callback(session_received_handler_type callback)
+	{
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-							handle_presentation_message_from(identity, presentation_message, *sender);
+		async_set_session_message_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
 
-							break;
-						}
-						case MESSAGE_TYPE_SESSION_REQUEST:
-						{
-							session_request_message session_request_message(message);
-
-							m_presentation_strand.post(
-								boost::bind(
-									&server::do_handle_session_request,
-									this,
-									data,
-									identity,
-									*sender,
-									session_request_message
-								)
-							);
-
-							break;
-						}
-						case MESSAGE_TYPE_SESSION:
-						{
-							session_message session_message(message);
-
-							m_presentation_strand.post(
-								boost::bind(
-									&server::do_handle_session,
-									this,
-									data,
-									identity,
-									*sender,
-									session_message
-								)
-							);
-
-							break;
-						}
-						default:
-						{
-							break;
-						}
-					}
-				}
-				catch (std::runtime_error&)
-				{
-					// These errors can happen in normal situations (for instance when a crypto operation fails due to invalid input).
-				}
-			}
-			else if (ec == boost::asio::error::connection_refused)
-			{
-				// The host refused the connection, meaning it closed its socket so we can force-terminate the session.
-				async_close_session(*sender, &null_simple_handler);
-			}
-		}
+		return promise.get_future().wait();
 	}
 
-	void server::push_write(void_handler_type handler)
+	void server::sync_set_session_failed_callback(session_failed_handler_type callback)
 	{
-		// All push_write() calls are done in the same strand so the following is thread-safe.
-		if (m_write_queue.empty())
-		{
-			// Nothing is being written, lets start the write immediately.
-			m_socket_strand.post(make_causal_handler(handler, m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
-		}
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		m_write_queue.push(handler);
+		async_set_session_failed_callback(callback, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	void server::pop_write()
+	void server::sync_set_session_error_callback(session_error_handler_type callback)
 	{
-		// All pop_write() calls are done in the same strand so the following is thread-safe.
-		m_write_queue.pop();
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		if (!m_write_queue.empty())
-		{
-			m_socket_strand.post(make_causal_handler(m_write_queue.front(), m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
-		}
+		async_set_session_error_callback(callback, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	server::ep_type server::to_socket_format(const server::ep_type& ep)
+	void server::sync_set_session_established_callback(session_established_handler_type callback)
 	{
-#ifdef WINDOWS
-		if (m_socket.local_endpoint().address().is_v6() && ep.address().is_v4())
-		{
-			return server::ep_type(boost::asio::ip::address_v6::v4_mapped(ep.address().to_v4()), ep.port());
-		}
-		else
-		{
-			return ep;
-		}
-#else
-		static_cast<void>(ep);
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		return ep;
-#endif
+		async_set_session_established_callback(callback, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	uint32_t server::ep_hello_context_type::generate_unique_number()
+	void server::sync_set_session_lost_callback(session_lost_handler_type callback)
 	{
-		// The first call to this function is *NOT* thread-safe in C++03 !
-		static boost::mt19937 rng(static_cast<uint32_t>(time(0)));
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		return rng();
-	}
+		async_set_session_lost_callback(callback, boost::bind(&promise_type::set_value, &promise));
 
-	server::ep_hello_context_type::ep_hello_context_type() :
-		m_current_hello_unique_number(generate_unique_number())
-	{
+		return promise.get_future().wait();
 	}
 
-	uint32_t server::ep_hello_context_type::next_hello_unique_number()
+	void server::async_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
 	{
-		return m_current_hello_unique_number++;
+		m_session_strand.post(boost::bind(&server::do_send_data, this, normalize(target), channel_number, data, handler, tos));
 	}
 
-	template <typename WaitHandler>
-	void server::ep_hello_context_type::async_wait_reply(boost::asio::io_service& io_service, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler)
+	void server::async_send_data_in_place(const ep_type& target, channel_number_type channel_number, SharedBuffer data_buffer, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
 	{
-		const boost::shared_ptr<boost::asio::deadline_timer> timer = boost::make_shared<boost::asio::deadline_timer>(boost::ref(io_service), timeout);
-
-		m_pending_requests[hello_unique_number] = pending_request_status(timer);
-
-		timer->async_wait(handler);
+		m_session_strand.post(boost::bind(&server::do_send_data_in_place, this, normalize(target), channel_number, data_buffer, data, handler, tos));
 	}
 
-	bool server::ep_hello_context_type::cancel_reply_wait(uint32_t hello_unique_number, bool success)
+	boost::system::error_code server::sync_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data)
 	{
-		pending_requests_map::iterator request = m_pending_requests.find(hello_unique_number);
+		typedef boost::promise<boost::system::error_code> promise_type;
+		promise_type promise;
 
-		if (request != m_pending_requests.end())
-		{
-			if (request->second.timer->cancel() > 0)
-			{
-				// At least one handler was cancelled which means we can set the success flag.
-				request->second.success = success;
+		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
 
-				return true;
-			}
-		}
+		async_send_data(target, channel_number, data, boost::bind(setter, &promise, _1));
 
-		return false;
+		return promise.get_future().get();
 	}
 
-	void server::ep_hello_context_type::cancel_all_reply_wait()
+	void server::async_send_reliable_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
 	{
-		for (pending_requests_map::iterator request = m_pending_requests.begin(); request != m_pending_requests.end(); ++request)
-		{
-			if (request->second.timer->cancel() > 0)
-			{
-				// At least one handler was cancelled which means we can set the success flag.
-				request->second.success = false;
-			}
-		}
+		m_session_strand.post(boost::bind(&server::do_send_reliable_data, this, normalize(target), channel_number, data, handler, tos));
 	}
 
-	bool server::ep_hello_context_type::remove_reply_wait(uint32_t hello_unique_number, boost::posix_time::time_duration& duration)
+	boost::system::error_code server::sync_send_reliable_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data)
 	{
-		pending_requests_map::iterator request = m_pending_requests.find(hello_unique_number);
+		typedef boost::promise<boost::system::error_code> promise_type;
+		promise_type promise;
 
-		assert(request != m_pending_requests.end());
+		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
 
-		const bool result = request->second.success;
+		async_send_reliable_data(target, channel_number, data, boost::bind(setter, &promise, _1));
 
-		duration = boost::posix_time::microsec_clock::universal_time() - request->second.start_date;
+		return promise.get_future().get();
+	}
 
-		m_pending_requests.erase(request);
+	void server::async_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler, uint8_t tos)
+	{
+		const std::set<ep_type> normalized_targets(boost::make_transform_iterator(targets.begin(), normalize), boost::make_transform_iterator(targets.end(), normalize));
 
-		return result;
+		m_session_strand.post(boost::bind(&server::do_send_data_to_list, this, normalized_targets, channel_number, data, handler, tos));
 	}
 
-	void server::do_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
+	std::map<server::ep_type, boost::system::error_code> server::sync_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data)
 	{
-		if (!m_socket.is_open())
-		{
-			handler(server_error::server_offline, boost::posix_time::time_duration());
+		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef boost::promise<result_type> promise_type;
 
-			return;
-		}
+		promise_type promise;
 
-		// All do_greet() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-		const uint32_t hello_unique_number = ep_hello_context.next_hello_unique_number();
-		const auto send_buffer = SharedBuffer(16);
-		const size_t size = hello_message::write_request(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+		async_send_data_to_list(targets, channel_number, data, boost::bind(setter, &promise, _1));
 
-		async_send_to(
-			send_buffer,
-			size,
-			target,
-			m_greet_strand.wrap([this, target, hello_unique_number, handler, timeout](const boost::system::error_code& ec) {
-				do_greet_handler(target, hello_unique_number, handler, timeout, ec);
-			})
-		);
+		return promise.get_future().get();
 	}
 
-	void server::do_greet_handler(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::posix_time::time_duration& timeout, const boost::system::error_code& ec)
+	std::map<server::ep_type, boost::system::error_code> server::sync_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data)
 	{
-		if (ec)
-		{
-			handler(ec, boost::posix_time::time_duration());
+		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef boost::promise<result_type> promise_type;
 
-			return;
-		}
+		promise_type promise;
 
-		// All do_greet() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+
+		async_send_data_to_all(channel_number, data, boost::bind(setter, &promise, _1));
 
-		ep_hello_context.async_wait_reply(get_io_service(), hello_unique_number, timeout, m_greet_strand.wrap(boost::bind(&server::do_greet_timeout, this, target, hello_unique_number, handler, _1)));
+		return promise.get_future().get();
 	}
 
-	void server::do_greet_timeout(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::system::error_code& ec)
+	void server::async_send_contact_request(const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
 	{
-		// All do_greet_timeout() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
-
-		boost::posix_time::time_duration duration;
-
-		const bool success = ep_hello_context.remove_reply_wait(hello_unique_number, duration);
+		m_session_strand.post(boost::bind(&server::do_send_contact_request, this, normalize(target), hash_list, handler));
+	}
 
-		if (ec == boost::asio::error::operation_aborted)
-		{
-			// The timer was aborted, which means we received a reply or the server was shut down.
-			if (success)
-			{
-				// The success flag is set: the timer was cancelled due to a reply.
-				handler(server_error::success, duration);
+	boost::system::error_code server::sync_send_contact_request(const ep_type& target, const hash_list_type& hash_list)
+	{
+		typedef boost::promise<boost::system::error_code> promise_type;
+		promise_type promise;
 
-				return;
-			}
-		}
-		else if (!ec)
-		{
-			// The timer timed out: replacing the error code.
-			handler(server_error::hello_request_timed_out, duration);
+		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
 
-			return;
-		}
+		async_send_contact_request(target, hash_list, boost::bind(setter, &promise, _1));
 
-		handler(ec, duration);
+		return promise.get_future().get();
 	}
 
-	void server::do_cancel_all_greetings()
+	void server::async_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
 	{
-		// All do_cancel_all_greetings() calls are done in the same strand so the following is thread-safe.
-		for (ep_hello_context_map::iterator hello_context = m_ep_hello_contexts.begin(); hello_context != m_ep_hello_contexts.end(); ++hello_context)
-		{
-			hello_context->second.cancel_all_reply_wait();
-		}
+		const std::set<ep_type> normalized_targets(boost::make_transform_iterator(targets.begin(), normalize), boost::make_transform_iterator(targets.end(), normalize));
+
+		m_session_strand.post(boost::bind(&server::do_send_contact_request_to_list, this, normalized_targets, hash_list, handler));
 	}
 
-	void server::handle_hello_message_from(const hello_message& _hello_message, const ep_type& sender)
+	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list)
 	{
-		switch (_hello_message.type())
-		{
-			case MESSAGE_TYPE_HELLO_REQUEST:
-			{
-				// We need to handle the response in the proper strand to avoid race conditions.
-				m_greet_strand.post(boost::bind(&server::do_handle_hello_request, this, sender, _hello_message.unique_number()));
+		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef boost::promise<result_type> promise_type;
 
-				break;
-			}
-			case MESSAGE_TYPE_HELLO_RESPONSE:
-			{
-				// We need to handle the response in the proper strand to avoid race conditions.
-				m_greet_strand.post(boost::bind(&server::do_handle_hello_response, this, sender, _hello_message.unique_number()));
+		promise_type promise;
 
-				break;
-			}
-			default:
-			{
-				// This should never happen.
-				assert(false);
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-				break;
-			}
-		}
+		async_send_contact_request_to_list(targets, hash_list, boost::bind(setter, &promise, _1));
+
+		return promise.get_future().get();
 	}
 
-	void server::do_handle_hello_request(const ep_type& sender, uint32_t hello_unique_number)
+	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_request_to_all(const hash_list_type& hash_list)
 	{
-		// All do_handle_hello_request() calls are done in the same strand so the following is thread-safe.
-		bool can_reply = m_accept_hello_messages_default;
+		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef boost::promise<result_type> promise_type;
 
-		if (m_hello_message_received_handler)
-		{
-			can_reply = m_hello_message_received_handler(sender, can_reply);
-		}
+		promise_type promise;
 
-		if (can_reply)
-		{
-			const auto send_buffer = SharedBuffer(16);
-			const size_t size = hello_message::write_response(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-			async_send_to(
-				send_buffer,
-				size,
-				sender,
-				[](const boost::system::error_code&) {}
-			);
-		}
+		async_send_contact_request_to_all(hash_list, boost::bind(setter, &promise, _1));
+
+		return promise.get_future().get();
 	}
 
-	void server::do_handle_hello_response(const ep_type& sender, uint32_t hello_unique_number)
+	void server::async_send_contact(const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
 	{
-		// All do_handle_hello_response() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[sender];
-
-		ep_hello_context.cancel_reply_wait(hello_unique_number, true);
+		m_session_strand.post(boost::bind(&server::do_send_contact, this, normalize(target), contact_map, handler));
 	}
 
-	void server::do_set_accept_hello_messages_default(bool value, void_handler_type handler)
+	boost::system::error_code server::sync_send_contact(const ep_type& target, const contact_map_type& contact_map)
 	{
-		// All do_set_accept_hello_messages_default() calls are done in the same strand so the following is thread-safe.
-		set_accept_hello_messages_default(value);
+		typedef boost::promise<boost::system::error_code> promise_type;
+		promise_type promise;
 
-		if (handler)
-		{
-			handler();
-		}
-	}
+		void (promise_type::*setter)(const boost::system::error_code&) = &promise_type::set_value;
 
-	void server::do_set_hello_message_received_callback(hello_message_received_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_hello_message_received_callback(callback);
+		async_send_contact(target, contact_map, boost::bind(setter, &promise, _1));
 
-		if (handler)
-		{
-			handler();
-		}
+		return promise.get_future().get();
 	}
 
-	bool server::has_presentation_store_for(const ep_type& ep) const
+	void server::async_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
 	{
-		// This method should only be called from within the presentation strand.
-		presentation_store_map::const_iterator presentation_store = m_presentation_store_map.find(ep);
-
-		if (presentation_store != m_presentation_store_map.end())
-		{
-			return !(presentation_store->second.empty());
-		}
+		const std::set<ep_type> normalized_targets(boost::make_transform_iterator(targets.begin(), normalize), boost::make_transform_iterator(targets.end(), normalize));
 
-		return false;
+		m_session_strand.post(boost::bind(&server::do_send_contact_to_list, this, normalized_targets, contact_map, handler));
 	}
 
-	void server::do_introduce_to(const ep_type& target, simple_handler_type handler)
+	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map)
 	{
-		// All do_introduce_to() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
-		{
-			handler(server_error::server_offline);
+		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef boost::promise<result_type> promise_type;
 
-			return;
-		}
+		promise_type promise;
 
-		const identity_store& identity = get_identity();
-		const auto send_buffer = SharedBuffer(4096);
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-		try
-		{
-			const size_t size = presentation_message::write(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				identity.signature_certificate()
-			);
+		async_send_contact_to_list(targets, contact_map, boost::bind(setter, &promise, _1));
 
-			async_send_to(
-				send_buffer,
-				size,
-				target,
-				handler
-			);
-		}
-		catch (const boost::system::system_error& ex)
-		{
-			handler(ex.code());
-		}
+		return promise.get_future().get();
 	}
 
-	void server::do_reintroduce_to_all(multiple_endpoints_handler_type handler)
+	std::map<server::ep_type, boost::system::error_code> server::sync_send_contact_to_all(const contact_map_type& contact_map)
 	{
-		// All do_reintroduce_to_all() calls are done in the same strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+		typedef std::map<server::ep_type, boost::system::error_code> result_type;
+		typedef boost::promise<result_type> promise_type;
 
-		results_gatherer_type::set_type targets;
+		promise_type promise;
 
-		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
-		{
-			targets.insert(presentation_store->first);
-		}
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		async_send_contact_to_all(contact_map, boost::bind(setter, &promise, _1));
 
-		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
-		{
-			async_introduce_to(presentation_store->first, boost::bind(&results_gatherer_type::gather, rg, presentation_store->first, _1));
-		}
+		return promise.get_future().get();
 	}
 
-	void server::do_get_presentation(const ep_type& target, optional_presentation_store_handler_type handler)
+	void server::sync_set_data_received_callback(data_received_handler_type callback)
 	{
-		// All do_get_presentation() calls are done in the same strand so the following is thread-safe.
-		handler(get_presentation(target));
-	}
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-	void server::do_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key, void_handler_type handler)
-	{
-		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
-		set_presentation(target, signature_certificate, pre_shared_key);
+		async_set_data_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
 
-		if (handler)
-		{
-			handler();
-		}
+		return promise.get_future().wait();
 	}
 
-	void server::do_clear_presentation(const ep_type& target, void_handler_type handler)
+	void server::sync_set_contact_request_received_callback(contact_request_received_handler_type callback)
 	{
-		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
-		clear_presentation(target);
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		if (handler)
-		{
-			handler();
-		}
+		async_set_contact_request_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	void server::handle_presentation_message_from(const identity_store& identity, const presentation_message& _presentation_message, const ep_type& sender)
+	void server::sync_set_contact_received_callback(contact_received_handler_type callback)
 	{
-		const auto signature_certificate = _presentation_message.signature_certificate();
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
 
-		async_has_session_with_endpoint(sender, [this, identity, sender, signature_certificate](bool has_session) {
-			m_presentation_strand.post(
-				boost::bind(
-					&server::do_handle_presentation,
-					this,
-					identity,
-					sender,
-					has_session,
-					signature_certificate
-				)
-			);
-		});
+		async_set_contact_received_callback(callback, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
 	}
 
-	void server::do_handle_presentation(const identity_store& identity, const ep_type& sender, bool has_session, cert_type signature_certificate)
+	// Private methods
+
+	void server::do_get_identity(identity_handler_type handler)
 	{
-		// All do_handle_presentation() calls are done in the same strand so the following is thread-safe.
-		presentation_status_type presentation_status = PS_FIRST;
+		// do_set_identity() is executed within the socket strand so this is safe.
 
-		const presentation_store_map::iterator entry = m_presentation_store_map.find(sender);
+		handler(get_identity());
+	}
 
-		if (entry != m_presentation_store_map.end())
+	void server::do_set_identity(const identity_store& identity, void_handler_type handler)
+	{
+		// do_set_identity() is executed within the socket strand so this is safe.
+		set_identity(identity);
+
+		async_reintroduce_to_all(&null_multiple_endpoints_handler);
+
+		if (handler)
 		{
-			if (compare_certificates(entry->second.signature_certificate(), signature_certificate))
-			{
-				presentation_status = PS_SAME;
-			}
-			else
-			{
-				presentation_status = PS_NEW;
-			}
+			handler();
 		}
+	}
 
-		if (m_presentation_message_received_handler)
+	void server::do_rotate_identity(const identity_store& identity, const boost::posix_time::time_duration& grace_period, void_handler_type handler)
+	{
+		// do_rotate_identity() is executed within the socket strand so this is safe.
+		identity_store new_identity = identity;
+
+		new_identity.set_previous_identity(m_identity_store.signature_certificate(), m_identity_store.signature_key());
+
+		set_identity(new_identity);
+
+		// The peers that hold a session learned the previous certificate:
+		// mark them so they keep being served with it during the grace
+		// period, instead of reintroducing ourselves and resetting them.
+		m_session_strand.post(boost::bind(&server::do_mark_previous_identity_peers, this, grace_period, handler));
+	}
+
+	void server::do_mark_previous_identity_peers(const boost::posix_time::time_duration& grace_period, void_handler_type handler)
+	{
+		// do_mark_previous_identity_peers() is executed within the session strand so the sessions map is safe to read.
 		{
-			if (!m_presentation_message_received_handler(sender, signature_certificate, presentation_status, has_session))
+			boost::mutex::scoped_lock lock(m_previous_identity_peers_mutex);
+
+			m_previous_identity_peers.clear();
+
+			for (auto&& p_session : m_peer_sessions)
 			{
-				return;
+				m_previous_identity_peers.insert(p_session.first);
 			}
 		}
 
-		m_presentation_store_map[sender] = presentation_store(signature_certificate, identity.pre_shared_key());
-	}
-
-	void server::do_set_presentation_message_received_callback(presentation_message_received_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_presentation_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_presentation_message_received_callback(callback);
+		m_identity_grace_timer.expires_from_now(grace_period);
+		m_identity_grace_timer.async_wait(boost::bind(&server::do_expire_previous_identity, this, boost::asio::placeholders::error));
 
 		if (handler)
 		{
@@ -1450,1027 +1589,5620 @@ namespace fscp
 		}
 	}
 
-	cipher_suite_type server::get_first_common_supported_cipher_suite(const cipher_suite_list_type& reference, const cipher_suite_list_type& capabilities, cipher_suite_type default_value = cipher_suite_type::unsupported)
+	void server::do_expire_previous_identity(const boost::system::error_code& ec)
 	{
-		for (auto&& cs : reference)
+		if (ec == boost::asio::error::operation_aborted)
 		{
-			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
-			{
-				return cs;
-			}
+			return;
 		}
 
-		return default_value;
+		{
+			boost::mutex::scoped_lock lock(m_previous_identity_peers_mutex);
+
+			m_previous_identity_peers.clear();
+		}
+
+		m_socket_strand.post([this]() {
+			// Executed within the socket strand: the identity store is safe to modify.
+			m_identity_store.clear_previous_identity();
+			m_identity_version.fetch_add(1, std::memory_order_relaxed);
+
+			// The peers that never renewed their handshake get the new
+			// certificate now.
+			async_reintroduce_to_all(&null_multiple_endpoints_handler);
+		});
 	}
 
-	elliptic_curve_type server::get_first_common_supported_elliptic_curve(const elliptic_curve_list_type& reference, const elliptic_curve_list_type& capabilities, elliptic_curve_type default_value = elliptic_curve_type::unsupported)
+	bool server::peer_uses_previous_identity(const ep_type& peer) const
+	{
+		boost::mutex::scoped_lock lock(m_previous_identity_peers_mutex);
+
+		return (m_previous_identity_peers.find(peer) != m_previous_identity_peers.end());
+	}
 
+	void server::forget_previous_identity_peer(const ep_type& peer)
 	{
-		for (auto&& cs : reference)
-		{
-			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
-			{
-				return cs;
-			}
-		}
+		boost::mutex::scoped_lock lock(m_previous_identity_peers_mutex);
 
-		return default_value;
+		m_previous_identity_peers.erase(peer);
 	}
 
-	void server::do_request_session(const identity_store& identity, const ep_type& target, simple_handler_type handler)
+	void server::do_async_receive_from()
 	{
-		// All do_request_session() calls are done in the session strand so the following is thread-safe.
+		// do_async_receive_from() is executed within the socket strand so
+		// this is safe: the identity snapshot and its version are taken
+		// here, and the receive loop then re-arms itself with them without
+		// taking them again.
+		arm_receive_from(get_identity(), m_identity_version.load(std::memory_order_relaxed));
+	}
+
+	void server::arm_receive_from(const identity_store& identity, uint32_t identity_version)
+	{
+		// Runs within the socket strand: the socket is closed on the same
+		// strand, so initiating the wait here cannot race a concurrent
+		// close() and the is_open() check below is authoritative. The
+		// completion handlers themselves stay unwrapped: they only touch
+		// the snapshot they carry and state that is safe from any thread;
+		// anything shared is reached through its own strand.
 		if (!m_socket.is_open())
 		{
-			handler(server_error::server_offline);
-
+			// close() landed between a completion and its re-arm: a closed
+			// socket ends the loop.
 			return;
 		}
 
-		peer_session& p_session = m_peer_sessions[target];
+#ifdef LINUX
+		// Only wait for readability: the datagrams themselves are drained in
+		// batch with recvmmsg() to amortize the per-syscall cost.
+		m_socket.async_receive(
+			boost::asio::null_buffers(),
+			boost::bind(
+				&server::handle_receive_ready,
+				this,
+				identity,
+				identity_version,
+				boost::asio::placeholders::error
+			)
+		);
+#else
+		boost::shared_ptr<ep_type> sender = boost::make_shared<ep_type>();
+
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer receive_buffer = m_socket_buffers.get();
 
-		if (p_session.has_current_session())
+		m_socket.async_receive_from(
+			buffer(receive_buffer),
+			*sender,
+			boost::bind(
+				&server::handle_receive_from,
+				this,
+				identity,
+				identity_version,
+				sender,
+				receive_buffer,
+				boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred
+			)
+		);
+#endif
+	}
+
+	void server::handle_receive_from(const identity_store& identity, uint32_t identity_version, boost::shared_ptr<ep_type> sender, SharedBuffer data, const boost::system::error_code& ec, size_t bytes_received)
+	{
+		assert(sender);
+
+		if (ec != boost::asio::error::operation_aborted)
 		{
-			handler(server_error::session_already_exist);
+			// Let's read again ! The re-arm goes through the socket strand
+			// so it cannot race a concurrent close(); the identity snapshot
+			// is only retaken when it went stale.
+			if (m_identity_version.load(std::memory_order_relaxed) == identity_version)
+			{
+				m_socket_strand.post(boost::bind(&server::arm_receive_from, this, identity, identity_version));
+			}
+			else
+			{
+				async_receive_from();
+			}
 
-			return;
+			*sender = normalize(*sender);
+
+			if (!ec)
+			{
+				handle_datagram_from(identity, *sender, data, bytes_received);
+			}
+			else if (ec == boost::asio::error::connection_refused)
+			{
+				// The host refused the connection, meaning it closed its socket so we can force-terminate the session.
+				async_close_session(*sender, &null_simple_handler);
+			}
 		}
+	}
 
-		const SharedBuffer send_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
+	void server::handle_datagram_from(const identity_store& identity, const ep_type& sender, SharedBuffer data, size_t bytes_received, uint64_t rx_time_us)
+	{
+		{
+			atomic_peer_counters_type& counters = counters_for(sender);
 
-			return result;
-		}();
+			counters.packets_in.fetch_add(1, std::memory_order_relaxed);
+			counters.bytes_in.fetch_add(bytes_received, std::memory_order_relaxed);
+		}
 
 		try
 		{
-			const auto next_session_number = p_session.next_session_number();
-			const auto local_host_identifier = p_session.local_host_identifier();
-
-			m_logger(log_level::trace) << "Sending session request message to " << target << " (next_session_number: " << next_session_number << ", local_host_identifier: " << local_host_identifier << ")";
-			size_t size = 0;
+			message message(buffer_cast<const uint8_t*>(data), bytes_received);
 
-			if (!!identity.signature_key())
-			{
-				size = session_request_message::write(
-					buffer_cast<uint8_t*>(send_buffer),
-					buffer_size(send_buffer),
-					next_session_number,
-					local_host_identifier,
-					m_cipher_suites,
-					m_elliptic_curves,
-					identity.signature_key()
-				);
-			}
-			else
+			switch (message.type())
 			{
-				size = session_request_message::write(
-					buffer_cast<uint8_t*>(send_buffer),
-					buffer_size(send_buffer),
-					next_session_number,
-					local_host_identifier,
-					m_cipher_suites,
-					m_elliptic_curves,
-					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
-					buffer_size(identity.pre_shared_key())
+				case MESSAGE_TYPE_DATA_0:
+				case MESSAGE_TYPE_DATA_1:
+				case MESSAGE_TYPE_DATA_2:
+				case MESSAGE_TYPE_DATA_3:
+				case MESSAGE_TYPE_DATA_4:
+				case MESSAGE_TYPE_DATA_5:
+				case MESSAGE_TYPE_DATA_6:
+				case MESSAGE_TYPE_DATA_7:
+				case MESSAGE_TYPE_DATA_8:
+				case MESSAGE_TYPE_DATA_9:
+				case MESSAGE_TYPE_DATA_10:
+				case MESSAGE_TYPE_DATA_11:
+				case MESSAGE_TYPE_DATA_12:
+				case MESSAGE_TYPE_DATA_13:
+				case MESSAGE_TYPE_DATA_14:
+				case MESSAGE_TYPE_DATA_15:
+				case MESSAGE_TYPE_DATA_COALESCED:
+				case MESSAGE_TYPE_CONTACT_REQUEST:
+				case MESSAGE_TYPE_CONTACT:
+				case MESSAGE_TYPE_KEEP_ALIVE:
+				{
+					data_message data_message(message);
+
+					m_session_strand.post(
+						boost::bind(
+							&server::do_handle_data,
+							this,
+							identity,
+							sender,
+							data,
+							data_message
+						)
 					);
-			}
 
-			async_send_to(
-				SharedBuffer(send_buffer, [this](const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer]() {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
-				size,
-				target,
-				handler
-			);
+					break;
+				}
+				case MESSAGE_TYPE_HELLO_REQUEST:
+				case MESSAGE_TYPE_HELLO_RESPONSE:
+				{
+					hello_message hello_message(message);
+
+					handle_hello_message_from(hello_message, sender, rx_time_us);
+
+					break;
+				}
+				case MESSAGE_TYPE_PRESENTATION:
+				{
+					presentation_message presentation_message(message);
+
+					handle_presentation_message_from(identity, presentation_message, sender);
+
+					break;
+				}
+				case MESSAGE_TYPE_SESSION_REQUEST:
+				{
+					session_request_message session_request_message(message);
+
+					m_presentation_strand.post(
+						boost::bind(
+							&server::do_handle_session_request,
+							this,
+							data,
+							identity,
+							sender,
+							session_request_message
+						)
+					);
+
+					break;
+				}
+				case MESSAGE_TYPE_SESSION:
+				{
+					session_message session_message(message);
+
+					m_presentation_strand.post(
+						boost::bind(
+							&server::do_handle_session,
+							this,
+							data,
+							identity,
+							sender,
+							session_message
+						)
+					);
+
+					break;
+				}
+				case MESSAGE_TYPE_RELAY_FORWARD:
+				{
+					relay_message relay_message(message);
+
+					handle_relay_forward_from(relay_message, sender);
+
+					break;
+				}
+				case MESSAGE_TYPE_RELAY_DELIVER:
+				{
+					relay_message relay_message(message);
+
+					m_session_strand.post(
+						boost::bind(
+							&server::do_handle_relay_deliver,
+							this,
+							identity,
+							sender,
+							data,
+							relay_message
+						)
+					);
+
+					break;
+				}
+				default:
+				{
+					break;
+				}
+			}
 		}
-		catch (const boost::system::system_error& ex)
+		catch (std::runtime_error&)
 		{
-			handler(ex.code());
+			// These errors can happen in normal situations (for instance when a crypto operation fails due to invalid input).
 		}
 	}
 
-	void server::do_close_session(const ep_type& target, simple_handler_type handler)
+#ifdef LINUX
+	namespace
 	{
-		// All do_close_session() calls are done in the same strand so the following is thread-safe.
-
-		if (m_peer_sessions[target].clear())
+		server::ep_type to_endpoint(const sockaddr_storage& addr)
 		{
-			handler(server_error::success);
+			if (addr.ss_family == AF_INET6)
+			{
+				const sockaddr_in6& sin6 = reinterpret_cast<const sockaddr_in6&>(addr);
 
-			if (m_session_lost_handler)
+				boost::asio::ip::address_v6::bytes_type bytes;
+				std::memcpy(bytes.data(), &sin6.sin6_addr, bytes.size());
+
+				return server::ep_type(boost::asio::ip::address_v6(bytes, sin6.sin6_scope_id), ntohs(sin6.sin6_port));
+			}
+			else
 			{
-				m_session_lost_handler(target, session_loss_reason::manual_termination);
+				const sockaddr_in& sin = reinterpret_cast<const sockaddr_in&>(addr);
+
+				return server::ep_type(boost::asio::ip::address_v4(ntohl(sin.sin_addr.s_addr)), ntohs(sin.sin_port));
 			}
 		}
-		else
+
+		uint64_t monotonic_ms()
 		{
-			handler(server_error::no_session_for_host);
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
 		}
 	}
 
-	void server::do_handle_session_request(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message)
+	void server::handle_receive_ready(const identity_store& identity, uint32_t identity_version, const boost::system::error_code& ec)
 	{
-		// All do_handle_session_request() calls are done in the presentation strand so the following is thread-safe.
-		if (!has_presentation_store_for(sender))
+		// Runs without strand wrapping: see arm_receive_from().
+		if (ec == boost::asio::error::operation_aborted)
 		{
-			// No presentation_store for the given host.
-			// We do nothing.
-			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but no presentation is available. Ignoring.";
-
 			return;
 		}
 
-		// We make sure the signatures matches.
-		bool check_ok = false;
+		if (!ec)
+		{
+			drain_receive_socket(identity, m_socket);
+		}
 
-		if (!!m_presentation_store_map[sender].signature_certificate())
+		// Let's read again ! The re-arm goes through the socket strand so it
+		// cannot race a concurrent close(); the identity snapshot is only
+		// retaken when it went stale.
+		if (m_identity_version.load(std::memory_order_relaxed) == identity_version)
 		{
-			check_ok = _session_request_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key());
+			m_socket_strand.post(boost::bind(&server::arm_receive_from, this, identity, identity_version));
 		}
 		else
 		{
-			const auto psk = m_presentation_store_map[sender].pre_shared_key();
-			check_ok = _session_request_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
+			async_receive_from();
 		}
+	}
 
-		if (!check_ok)
+	void server::drain_receive_socket(const identity_store& identity, socket_type& socket)
+	{
+		// Everything touched here is safe from any thread: the buffer pool
+		// is lock-free and handle_datagram_from() dispatches to the proper
+		// strands, so the main receive chain and the steering workers drain
+		// their sockets concurrently.
+		//
+		// The socket is drained with several back-to-back batches before
+		// the readability watch is re-armed, in the spirit of a multishot
+		// receive: under load this removes the reactor round-trip between
+		// batches. The pass count is capped so a flooded socket cannot
+		// starve the other handlers.
+		for (size_t pass = 0; pass < RECEIVE_BATCHES_PER_WAKEUP; ++pass)
 		{
-			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with an invalid signature. Ignoring.";
+			mmsghdr msgvec[RECEIVE_BATCH_SIZE];
+			iovec iov[RECEIVE_BATCH_SIZE];
+			sockaddr_storage from[RECEIVE_BATCH_SIZE];
+			std::vector<SharedBuffer> buffers;
 
-			return;
-		}
+			std::memset(msgvec, 0, sizeof(msgvec));
 
-		// The make_shared_buffer_handler() call below is necessary so that the reference to session_request_message remains valid.
-		m_session_strand.post(
-			make_shared_buffer_handler(
-				data,
-				boost::bind(
-					&server::do_handle_verified_session_request,
-					this,
-					identity,
-					sender,
-					_session_request_message
-				)
-			)
-		);
-	}
+			buffers.reserve(RECEIVE_BATCH_SIZE);
 
-	void server::do_handle_verified_session_request(const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message)
-	{
-		// All do_handle_verified_session_request() calls are done in the session strand so the following is thread-safe.
+			// Room for the UDP GRO segment size and the kernel receive
+			// timestamps in the same ancillary buffer.
+			char cmsgbuf[RECEIVE_BATCH_SIZE][CMSG_SPACE(sizeof(int))
+#ifdef SO_TIMESTAMPING
+				+ CMSG_SPACE(3 * sizeof(timespec))
+#endif
+			];
 
-		// Get the associated session, creating one if none exists.
-		peer_session& p_session = m_peer_sessions[sender];
+			bool want_control = false;
 
-		if (!p_session.set_first_remote_host_identifier(_session_request_message.host_identifier()))
-		{
-			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but the host identifier does not match (Received: " << _session_request_message.host_identifier() << ". Expected: " << *p_session.remote_host_identifier() << "). Ignoring.";
+#ifdef UDP_GRO
+			want_control = want_control || m_gro_enabled;
+#endif
+#ifdef SO_TIMESTAMPING
+			want_control = want_control || m_kernel_timestamps_enabled;
+#endif
 
-			// The host identifier does not match.
-			return;
-		}
+			for (size_t i = 0; i < RECEIVE_BATCH_SIZE; ++i)
+			{
+				// Get either a new buffer or an old, recycled one if possible.
+				buffers.push_back(m_socket_buffers.get());
 
-		const cipher_suite_list_type cipher_suites = _session_request_message.cipher_suite_capabilities();
-		const elliptic_curve_list_type elliptic_curves = _session_request_message.elliptic_curve_capabilities();
-		const cipher_suite_type calg = get_first_common_supported_cipher_suite(m_cipher_suites, cipher_suites);
-		const elliptic_curve_type ec = get_first_common_supported_elliptic_curve(m_elliptic_curves, elliptic_curves);
+				iov[i].iov_base = buffer_cast<uint8_t*>(buffers[i]);
+				iov[i].iov_len = buffer_size(buffers[i]);
+				msgvec[i].msg_hdr.msg_name = &from[i];
+				msgvec[i].msg_hdr.msg_namelen = sizeof(from[i]);
+				msgvec[i].msg_hdr.msg_iov = &iov[i];
+				msgvec[i].msg_hdr.msg_iovlen = 1;
 
-		if ((calg == cipher_suite_type::unsupported) || (ec == elliptic_curve_type::unsupported))
-		{
-			// No suitable cipher and/or elliptic curve is available.
-			m_logger(log_level::warning) << "Received a SESSION_REQUEST from " << sender << " but can't agree on the cipher suite to use. Ignoring.";
+				if (want_control)
+				{
+					msgvec[i].msg_hdr.msg_control = cmsgbuf[i];
+					msgvec[i].msg_hdr.msg_controllen = sizeof(cmsgbuf[i]);
+				}
+			}
 
-			return;
-		}
+			const int cnt = ::recvmmsg(socket.native_handle(), msgvec, RECEIVE_BATCH_SIZE, 0, NULL);
 
-		bool can_reply = m_accept_session_request_messages_default;
+			if (cnt <= 0)
+			{
+				// Errors - including ECONNREFUSED reported by a pending ICMP
+				// error - are ignored here: we simply wait for readability again.
+				break;
+			}
 
-		if (m_session_request_message_received_handler)
-		{
-			can_reply = m_session_request_message_received_handler(sender, cipher_suites, elliptic_curves, m_accept_session_request_messages_default);
-		}
+#ifdef SO_TIMESTAMPING
+			// Kernel timestamps run on the realtime clock while the
+			// handshake stamps run on the steady clock: reading both
+			// back-to-back gives an anchor pair to translate through.
+			timespec anchor_realtime = {};
+			uint64_t anchor_monotonic_us = 0;
 
-		if (!can_reply)
-		{
-			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but not allowed to reply (`m_accept_session_request_messages_default` is " << m_accept_session_request_messages_default << ").";
-		}
-		else
-		{
-			if (!p_session.has_current_session())
+			if (m_kernel_timestamps_enabled)
 			{
-				m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". No current session exist: preparing one and sending it.";
-
-				p_session.prepare_session(_session_request_message.session_number(), calg, ec);
-				do_send_session(identity, sender, p_session.next_session_parameters());
+				::clock_gettime(CLOCK_REALTIME, &anchor_realtime);
+				anchor_monotonic_us = monotonic_us();
 			}
-			else
+#endif
+
+			for (int i = 0; i < cnt; ++i)
 			{
-				m_logger(log_level::trace) << "Current session has number " << p_session.current_session().parameters.session_number << " and " << sender << " requests session number " << _session_request_message.session_number();
+				const ep_type sender = normalize(to_endpoint(from[i]));
 
-				if (_session_request_message.session_number() > p_session.current_session().parameters.session_number)
+				uint64_t rx_time_us = 0;
+
+#ifdef SO_TIMESTAMPING
+				if (m_kernel_timestamps_enabled)
 				{
-					m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". A current session exists but has the number " << p_session.current_session().parameters.session_number << ": preparing a new session and sending it.";
+					for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msgvec[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgvec[i].msg_hdr, cmsg))
+					{
+						if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPING))
+						{
+							// ts[0] is the software timestamp. The raw
+							// hardware timestamp in ts[2] runs on the NIC
+							// clock and is not comparable without PHC
+							// synchronization, so it is left alone.
+							timespec ts;
+							std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+							if ((ts.tv_sec != 0) || (ts.tv_nsec != 0))
+							{
+								// Translating through the anchor subtracts
+								// exactly the time the datagram spent queued
+								// between the driver and this loop.
+								const int64_t behind_ns = (static_cast<int64_t>(anchor_realtime.tv_sec) - ts.tv_sec) * 1000000000LL + (anchor_realtime.tv_nsec - ts.tv_nsec);
+
+								if (behind_ns >= 0)
+								{
+									rx_time_us = anchor_monotonic_us - static_cast<uint64_t>(behind_ns / 1000);
+								}
+							}
+						}
+					}
+				}
+#endif
 
-					// A new session is requested. Sending a new message.
-					p_session.prepare_session(_session_request_message.session_number(), calg, ec);
-					do_send_session(identity, sender, p_session.next_session_parameters());
+#ifdef UDP_GRO
+				size_t gro_size = 0;
+
+				if (m_gro_enabled)
+				{
+					for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msgvec[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgvec[i].msg_hdr, cmsg))
+					{
+						if ((cmsg->cmsg_level == IPPROTO_UDP) && (cmsg->cmsg_type == UDP_GRO))
+						{
+							gro_size = static_cast<size_t>(*reinterpret_cast<const int*>(CMSG_DATA(cmsg)));
+						}
+					}
 				}
-				else
+
+				if ((gro_size > 0) && (msgvec[i].msg_len > gro_size))
 				{
-					m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". A current session exists and has the number " << p_session.current_session().parameters.session_number << ": sending the current session.";
+					// The kernel coalesced a burst of datagrams from this
+					// peer into one super-datagram (UDP GRO): split it
+					// back into the original messages.
+					const uint8_t* const base = buffer_cast<const uint8_t*>(buffers[i]);
+					size_t offset = 0;
 
-					// An old session is requested: sending the same message.
-					do_send_session(identity, sender, p_session.current_session_parameters());
+					while (offset < msgvec[i].msg_len)
+					{
+						const size_t segment_len = std::min<size_t>(gro_size, msgvec[i].msg_len - offset);
+
+						if (offset == 0)
+						{
+							// The first segment is already at the start of the receive buffer.
+							handle_datagram_from(identity, sender, buffers[i], segment_len, rx_time_us);
+						}
+						else
+						{
+							const SharedBuffer segment = m_socket_buffers.get(segment_len);
+
+							std::memcpy(buffer_cast<uint8_t*>(segment), base + offset, segment_len);
+
+							handle_datagram_from(identity, sender, segment, segment_len, rx_time_us);
+						}
+
+						offset += segment_len;
+					}
+
+					continue;
 				}
+#endif
+
+				handle_datagram_from(identity, sender, buffers[i], msgvec[i].msg_len, rx_time_us);
+			}
+
+			if (static_cast<size_t>(cnt) < RECEIVE_BATCH_SIZE)
+			{
+				// A short batch means the socket is drained.
+				break;
 			}
 		}
 	}
 
-	std::set<server::ep_type> server::get_session_endpoints() const
+#ifdef SO_REUSEPORT
+	void server::open_receive_workers(const ep_type& listen_endpoint)
 	{
-		// All get_session_endpoints() calls are done in the same strand so the following is thread-safe.
-		std::set<ep_type> result;
+		m_receive_workers.reserve(m_receive_steering_count);
 
-		for (auto&& p_session: m_peer_sessions)
+		for (size_t i = 0; i < m_receive_steering_count; ++i)
 		{
-			if (p_session.second.has_current_session())
+			const boost::shared_ptr<receive_worker_type> worker = boost::make_shared<receive_worker_type>(boost::ref(get_io_service()));
+
+			boost::system::error_code worker_ec;
+
+			worker->socket.open(listen_endpoint.protocol(), worker_ec);
+
+			if (!worker_ec && listen_endpoint.address().is_v6())
 			{
-				result.insert(p_session.first);
+				worker->socket.set_option(boost::asio::ip::v6_only(false), worker_ec);
+			}
+
+			if (!worker_ec)
+			{
+				const int reuse = 1;
+
+				if (::setsockopt(worker->socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0)
+				{
+					worker_ec = boost::system::error_code(errno, boost::system::system_category());
+				}
+			}
+
+			if (!worker_ec)
+			{
+				worker->socket.bind(listen_endpoint, worker_ec);
+			}
+
+			if (worker_ec)
+			{
+				m_logger(log_level::warning) << "Unable to open receive steering worker #" << i << ": " << worker_ec.message() << ". Continuing without it.";
+
+				continue;
+			}
+
+			worker->socket.native_non_blocking(true, worker_ec);
+
+#ifdef SO_BUSY_POLL
+			if (m_busy_poll_usec > 0)
+			{
+				const int busy_poll = static_cast<int>(m_busy_poll_usec);
+
+				::setsockopt(worker->socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll));
+			}
+#endif
+
+#ifdef UDP_GRO
+			if (m_gro_enabled)
+			{
+				const int gro = 1;
+
+				::setsockopt(worker->socket.native_handle(), IPPROTO_UDP, UDP_GRO, &gro, sizeof(gro));
+			}
+#endif
+
+#ifdef SO_TIMESTAMPING
+			if (m_kernel_timestamps_enabled)
+			{
+				enable_kernel_receive_timestamps(worker->socket.native_handle());
 			}
+#endif
+
+			m_receive_workers.push_back(worker);
+
+			async_receive_on(worker);
 		}
 
-		return result;
+		if (!m_receive_workers.empty())
+		{
+			m_logger(log_level::information) << "Receive steering enabled with " << m_receive_workers.size() << " worker socket(s).";
+		}
 	}
 
-	bool server::has_session_with_endpoint(const ep_type& host)
+	void server::close_receive_workers()
 	{
-		// All has_session_with_endpoint() calls are done in the same strand so the following is thread-safe.
-		const auto p_session = m_peer_sessions.find(host);
+		for (auto&& worker : m_receive_workers)
+		{
+			boost::system::error_code worker_ec;
 
-		if (p_session != m_peer_sessions.end())
+			worker->socket.close(worker_ec);
+		}
+
+		m_receive_workers.clear();
+	}
+
+	void server::async_receive_on(boost::shared_ptr<receive_worker_type> worker)
+	{
+		// The identity snapshot must be taken within the socket strand.
+		m_socket_strand.post([this, worker] () {
+			arm_receive_on(worker, get_identity(), m_identity_version.load(std::memory_order_relaxed));
+		});
+	}
+
+	void server::arm_receive_on(boost::shared_ptr<receive_worker_type> worker, const identity_store& identity, uint32_t identity_version)
+	{
+		// Like the main receive chain, the wait is initiated within the
+		// socket strand where the worker sockets are also closed, so the
+		// is_open() check below cannot race close_receive_workers().
+		if (!worker->socket.is_open())
 		{
-			return p_session->second.has_current_session();
+			return;
 		}
 
-		return false;
+		worker->socket.async_receive(
+			boost::asio::null_buffers(),
+			boost::bind(
+				&server::handle_worker_receive_ready,
+				this,
+				identity,
+				identity_version,
+				worker,
+				boost::asio::placeholders::error
+			)
+		);
 	}
 
-	void server::do_get_session_endpoints(endpoints_handler_type handler)
+	void server::handle_worker_receive_ready(const identity_store& identity, uint32_t identity_version, boost::shared_ptr<receive_worker_type> worker, const boost::system::error_code& ec)
 	{
-		// All do_get_session_endpoints() calls are done in the same strand so the following is thread-safe.
-		handler(get_session_endpoints());
+		// Each worker drains its own socket, so workers never contend with
+		// one another nor with the main receive chain.
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+
+		if (!ec)
+		{
+			drain_receive_socket(identity, worker->socket);
+		}
+
+		// The re-arm goes through the socket strand so it cannot race a
+		// concurrent close(); the identity snapshot is only retaken when it
+		// went stale.
+		if (m_identity_version.load(std::memory_order_relaxed) == identity_version)
+		{
+			m_socket_strand.post(boost::bind(&server::arm_receive_on, this, worker, identity, identity_version));
+		}
+		else
+		{
+			async_receive_on(worker);
+		}
 	}
+#endif
 
-	void server::do_has_session_with_endpoint(const ep_type& host, boolean_handler_type handler)
+	bool server::classify_send(const pending_send_type& send, uint8_t& channel)
 	{
-		// All do_has_session_with_endpoint() calls are done in the same strand so the following is thread-safe.
-		handler(has_session_with_endpoint(host));
+		// The message type sits in the cleartext header, so the class of a
+		// datagram is read back from the serialized form instead of being
+		// threaded through every send call site.
+		const uint8_t type = buffer_cast<const uint8_t*>(send.data)[send.offset + 1];
+
+		if ((type >= MESSAGE_TYPE_DATA_0) && (type <= MESSAGE_TYPE_DATA_15))
+		{
+			channel = static_cast<uint8_t>(type - MESSAGE_TYPE_DATA_0);
+
+			return true;
+		}
+
+		if ((type == MESSAGE_TYPE_DATA_COALESCED) || (type == MESSAGE_TYPE_RELAY_FORWARD) || (type == MESSAGE_TYPE_RELAY_DELIVER))
+		{
+			// Coalesced and relayed traffic carries bulk frames: it competes
+			// with the default data channel.
+			channel = 0;
+
+			return true;
+		}
+
+		// Everything else is control-plane traffic.
+		return false;
 	}
 
-	void server::do_set_accept_session_request_messages_default(bool value, void_handler_type handler)
+	void server::shed_send(peer_send_queue_type& peer_queue)
 	{
-		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_accept_session_request_messages_default(value);
+		// The peer cannot drain fast enough: load is shed on its queues
+		// only. Stale droppable frames (broadcasts) go first since a late
+		// delivery of those is worthless, then data frames; control-plane
+		// datagrams are only shed as a last resort.
+		for (auto&& channel_entry : peer_queue.channels)
+		{
+			std::deque<pending_send_type>& entries = channel_entry.second.entries;
 
-		if (handler)
+			for (std::deque<pending_send_type>::iterator it = entries.begin(); it != entries.end(); ++it)
+			{
+				if (it->droppable)
+				{
+					it->handler(boost::asio::error::no_buffer_space);
+					entries.erase(it);
+					--peer_queue.total;
+
+					return;
+				}
+			}
+		}
+
+		for (auto&& channel_entry : peer_queue.channels)
 		{
-			handler();
+			std::deque<pending_send_type>& entries = channel_entry.second.entries;
+
+			if (!entries.empty())
+			{
+				entries.front().handler(boost::asio::error::no_buffer_space);
+				entries.pop_front();
+				--peer_queue.total;
+
+				return;
+			}
 		}
+
+		peer_queue.control.front().handler(boost::asio::error::no_buffer_space);
+		peer_queue.control.pop_front();
+		--peer_queue.total;
 	}
 
-	void server::do_set_cipher_suites(cipher_suite_list_type cipher_suites, void_handler_type handler)
+	std::deque<server::pending_send_type>& server::select_send_queue(peer_send_queue_type& peer_queue)
 	{
-		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_cipher_suites(cipher_suites);
+		// All select_send_queue() calls are done in the socket strand so the following is thread-safe.
+		// The caller guarantees that the peer has at least one pending entry.
 
-		if (handler)
+		// Control-plane datagrams go out first: they are small, rare and
+		// latency-critical (a delayed keep-alive costs a session).
+		if (!peer_queue.control.empty())
 		{
-			handler();
+			return peer_queue.control;
+		}
+
+		// Deficit round-robin between the active data channels: a visit
+		// grants a byte quantum, so the channels share the link by byte
+		// count no matter their datagram sizes.
+		for (;;)
+		{
+			std::map<uint8_t, channel_send_queue_type>::iterator it = peer_queue.channels.lower_bound(peer_queue.next_channel);
+
+			if (it == peer_queue.channels.end())
+			{
+				it = peer_queue.channels.begin();
+			}
+
+			channel_send_queue_type& channel_queue = it->second;
+
+			if (channel_queue.entries.empty())
+			{
+				// An idle channel forfeits its deficit and leaves the round.
+				peer_queue.next_channel = static_cast<uint8_t>(it->first + 1);
+				peer_queue.channels.erase(it);
+
+				continue;
+			}
+
+			if (channel_queue.deficit < channel_queue.entries.front().size)
+			{
+				// The channel spent its deficit: it earns a fresh quantum
+				// and the turn passes on. Every full round grows the deficit
+				// so even jumbo datagrams eventually qualify.
+				channel_queue.deficit += CHANNEL_DRR_QUANTUM;
+				peer_queue.next_channel = static_cast<uint8_t>(it->first + 1);
+
+				continue;
+			}
+
+			channel_queue.deficit -= channel_queue.entries.front().size;
+
+			return channel_queue.entries;
 		}
 	}
 
-	void server::do_set_elliptic_curves(elliptic_curve_list_type elliptic_curves, void_handler_type handler)
+	void server::push_send(pending_send_type& send)
 	{
-		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_elliptic_curves(elliptic_curves);
+		// All push_send() calls are done in the socket strand so the following is thread-safe.
+		const ep_type target = send.target;
 
-		if (handler)
+		peer_send_queue_type& peer_queue = m_peer_send_queues[target];
+
+		if (peer_queue.empty())
 		{
-			handler();
+			m_send_round_robin.push_back(target);
+		}
+		else if (peer_queue.total >= PEER_SEND_QUEUE_MAX_SIZE * counters_for(target).send_weight.load(std::memory_order_relaxed))
+		{
+			// The queue cap is the peer's buffer quota: a weighted peer may
+			// pin proportionally more pooled buffers before load is shed.
+			shed_send(peer_queue);
+		}
+
+		send.enqueue_time_ms = monotonic_ms();
+
+		uint8_t channel = 0;
+
+		if (classify_send(send, channel))
+		{
+			peer_queue.channels[channel].entries.push_back(std::move(send));
+		}
+		else
+		{
+			peer_queue.control.push_back(std::move(send));
+		}
+
+		++peer_queue.total;
+
+		counters_for(target).send_queue_depth.store(peer_queue.total, std::memory_order_relaxed);
+
+		if (!m_send_flush_pending)
+		{
+			m_send_flush_pending = true;
+
+			do_flush_sends();
 		}
 	}
 
-	void server::do_set_session_request_message_received_callback(session_request_received_handler_type callback, void_handler_type handler)
+	void server::requeue_sends(std::vector<pending_send_type>& batch, size_t from)
 	{
-		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_request_message_received_callback(callback);
+		// All requeue_sends() calls are done in the socket strand so the following is thread-safe.
+		// The unsent entries go back to the front of their peer queues, in reverse order, so the per-peer ordering is preserved.
+		for (size_t i = batch.size(); i > from; --i)
+		{
+			pending_send_type& send = batch[i - 1];
+			const ep_type target = send.target;
 
-		if (handler)
+			peer_send_queue_type& peer_queue = m_peer_send_queues[target];
+
+			if (peer_queue.empty())
+			{
+				m_send_round_robin.push_front(target);
+			}
+
+			uint8_t channel = 0;
+
+			if (classify_send(send, channel))
+			{
+				peer_queue.channels[channel].entries.push_front(std::move(send));
+			}
+			else
+			{
+				peer_queue.control.push_front(std::move(send));
+			}
+
+			++peer_queue.total;
+
+			counters_for(target).send_queue_depth.store(peer_queue.total, std::memory_order_relaxed);
+		}
+	}
+
+	server::socket_type& server::send_socket_for(const ep_type& target)
+	{
+		// send_socket_for() is executed within the socket strand so this is safe.
+#ifdef SO_REUSEPORT
+		if (!m_receive_workers.empty())
+		{
+			// Every member of the SO_REUSEPORT group shares the local port,
+			// so a peer sees the same source endpoint whichever socket its
+			// datagrams leave from.
+			const size_t index = endpoint_hash()(target) % (m_receive_workers.size() + 1);
+
+			if (index > 0)
+			{
+				return m_receive_workers[index - 1]->socket;
+			}
+		}
+#endif
+
+		return m_socket;
+	}
+
+	void server::do_flush_sends()
+	{
+		// All do_flush_sends() calls are done in the socket strand so the following is thread-safe.
+		while (!m_send_round_robin.empty())
+		{
+			mmsghdr* const msgvec = m_send_msgvec;
+			iovec* const iov = m_send_iov;
+
+			std::memset(msgvec, 0, sizeof(m_send_msgvec));
+
+			// The batch is filled round-robin over the active peers, a quota
+			// at a time, so one backlogged peer cannot monopolize it and
+			// stall traffic to the others. The slots themselves are the
+			// preallocated ones of the server.
+			std::vector<pending_send_type>& batch = m_send_batch;
+			batch.clear();
+
+			while ((batch.size() < SEND_BATCH_SIZE) && !m_send_round_robin.empty())
+			{
+				const ep_type target = m_send_round_robin.front();
+				m_send_round_robin.pop_front();
+
+				peer_send_queue_type& peer_queue = m_peer_send_queues[target];
+
+				// The visit quota scales with the peer's scheduling weight,
+				// so the round-robin drains weighted peers proportionally
+				// faster without ever starving the others.
+				const size_t peer_quota = PEER_SEND_BATCH_QUOTA * counters_for(target).send_weight.load(std::memory_order_relaxed);
+
+				for (size_t quota = peer_quota; (quota > 0) && !peer_queue.empty() && (batch.size() < SEND_BATCH_SIZE); --quota)
+				{
+					// The class to serve is re-elected at every step: strict
+					// priority for the control queue, deficit round-robin
+					// between the data channels.
+					std::deque<pending_send_type>& queue = select_send_queue(peer_queue);
+
+					if ((m_send_queue_sojourn_limit_ms > 0) && (&queue != &peer_queue.control))
+					{
+						// Bounded-latency mode: data datagrams that sat in
+						// the queue past the sojourn limit only add standing
+						// delay for everything behind them. They are dropped
+						// from the head, which signals the congestion to the
+						// responsible flows sooner than a tail drop would.
+						const uint64_t now_ms = monotonic_ms();
+						bool dropped = false;
+
+						while (!queue.empty() && ((now_ms - queue.front().enqueue_time_ms) > m_send_queue_sojourn_limit_ms))
+						{
+							queue.front().handler(boost::asio::error::no_buffer_space);
+							queue.pop_front();
+							--peer_queue.total;
+							dropped = true;
+						}
+
+						if (dropped && queue.empty())
+						{
+							// The whole class expired: let the next quota
+							// step elect another one.
+							continue;
+						}
+					}
+
+#ifdef UDP_SEGMENT
+					if (m_gso_enabled && (queue.size() >= 2) && (queue[1].size == queue.front().size) && (queue.front().gso_size == 0) && (queue[1].gso_size == 0) && (queue[1].tos == queue.front().tos))
+					{
+						// A backlog of equal-size datagrams for one peer: they
+						// are coalesced into a single super-datagram that the
+						// kernel segments (UDP GSO), cutting the per-packet
+						// cost. All segments but the last must have the same
+						// size.
+						const size_t segment_size = queue.front().size;
+						const size_t max_segments = std::min(GSO_MAX_SEGMENTS, 65507 / segment_size);
+
+						size_t segment_count = 0;
+
+						while ((segment_count < queue.size()) && (segment_count < max_segments))
+						{
+							if (queue[segment_count].gso_size > 0)
+							{
+								// A requeued super-datagram must not be absorbed into another one.
+								break;
+							}
+
+							if (queue[segment_count].tos != queue.front().tos)
+							{
+								// The kernel marks every segment with the
+								// super-datagram's ToS: a differently-marked
+								// datagram closes the run instead of being
+								// remarked.
+								break;
+							}
+
+							if (queue[segment_count].size != segment_size)
+							{
+								// A smaller trailing datagram may close the run.
+								if (queue[segment_count].size < segment_size)
+								{
+									++segment_count;
+								}
+
+								break;
+							}
+
+							++segment_count;
+						}
+
+						if (segment_count >= 2)
+						{
+							const SharedBuffer coalesced = m_socket_buffers.get();
+
+							uint8_t* out = buffer_cast<uint8_t*>(coalesced);
+							size_t total_size = 0;
+							bool droppable = true;
+
+							// The segment handlers are moved into a shared
+							// vector that the combined handler captures, so
+							// coalescing never copies them.
+							const auto handlers = boost::make_shared<std::vector<simple_handler_type>>();
+							handlers->reserve(segment_count);
+
+							for (size_t i = 0; i < segment_count; ++i)
+							{
+								pending_send_type& segment = queue[i];
+
+								std::memcpy(out + total_size, buffer_cast<const uint8_t*>(segment.data) + segment.offset, segment.size);
+
+								total_size += segment.size;
+								droppable = droppable && segment.droppable;
+								handlers->push_back(std::move(segment.handler));
+							}
+
+							const uint64_t first_enqueue_time_ms = queue.front().enqueue_time_ms;
+							const uint8_t segments_tos = queue.front().tos;
+
+							queue.erase(queue.begin(), queue.begin() + segment_count);
+							peer_queue.total -= segment_count;
+
+							simple_handler_type combined_handler = [handlers] (const boost::system::error_code& handler_ec) {
+								for (auto&& handler: *handlers)
+								{
+									handler(handler_ec);
+								}
+							};
+
+							pending_send_type send(coalesced, 0, total_size, target, std::move(combined_handler), droppable, segments_tos);
+							send.gso_size = segment_size;
+							// A requeued super-datagram keeps the age of its oldest segment.
+							send.enqueue_time_ms = first_enqueue_time_ms;
+
+							batch.push_back(std::move(send));
+
+							continue;
+						}
+					}
+#endif
+
+					batch.push_back(std::move(queue.front()));
+					queue.pop_front();
+					--peer_queue.total;
+				}
+
+				counters_for(target).send_queue_depth.store(peer_queue.total, std::memory_order_relaxed);
+
+				if (peer_queue.empty())
+				{
+					m_peer_send_queues.erase(target);
+				}
+				else
+				{
+					m_send_round_robin.push_back(target);
+				}
+			}
+
+			// Each peer is affine to one member of the SO_REUSEPORT group:
+			// its datagrams always leave the same socket, so per-peer
+			// ordering is preserved while the batch spreads over the group.
+			// Without steering workers there is a single group on the main
+			// socket and the partitioning is a no-op.
+			std::vector<socket_type*>& group_sockets = m_send_group_sockets;
+			std::vector<std::vector<pending_send_type>>& groups = m_send_groups;
+
+			group_sockets.clear();
+
+			for (auto&& send: batch)
+			{
+				socket_type* const group_socket = &send_socket_for(send.target);
+
+				size_t group = 0;
+
+				while ((group < group_sockets.size()) && (group_sockets[group] != group_socket))
+				{
+					++group;
+				}
+
+				if (group == group_sockets.size())
+				{
+					group_sockets.push_back(group_socket);
+
+					if (groups.size() < group_sockets.size())
+					{
+						// A group slot created once keeps its storage for
+						// the next flushes.
+						groups.push_back(std::vector<pending_send_type>());
+						groups.back().reserve(SEND_BATCH_SIZE);
+					}
+
+					groups[group].clear();
+				}
+
+				groups[group].push_back(std::move(send));
+			}
+
+			bool send_blocked = false;
+
+			// Only the slots filled by this batch are live: the extra ones
+			// merely keep their storage around.
+			for (size_t group = 0; group < group_sockets.size(); ++group)
+			{
+				std::vector<pending_send_type>& entries = groups[group];
+				const size_t count = entries.size();
+
+				std::memset(msgvec, 0, sizeof(m_send_msgvec));
+
+				// Room for one segmentation cmsg and one ToS cmsg per message.
+				char (&cmsgbuf)[SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(int))] = m_send_cmsgbuf;
+
+				std::memset(cmsgbuf, 0, sizeof(cmsgbuf));
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					pending_send_type& send = entries[i];
+
+					iov[i].iov_base = buffer_cast<uint8_t*>(send.data) + send.offset;
+					iov[i].iov_len = send.size;
+					msgvec[i].msg_hdr.msg_name = send.target.data();
+					msgvec[i].msg_hdr.msg_namelen = send.target.size();
+					msgvec[i].msg_hdr.msg_iov = &iov[i];
+					msgvec[i].msg_hdr.msg_iovlen = 1;
+
+					const bool want_gso = (send.gso_size > 0);
+					const bool want_tos = (send.tos != 0);
+
+					if (want_gso || want_tos)
+					{
+						msgvec[i].msg_hdr.msg_control = cmsgbuf[i];
+						msgvec[i].msg_hdr.msg_controllen = sizeof(cmsgbuf[i]);
+
+						size_t controllen = 0;
+						cmsghdr* cmsg = CMSG_FIRSTHDR(&msgvec[i].msg_hdr);
+
+#ifdef UDP_SEGMENT
+						if (want_gso)
+						{
+							cmsg->cmsg_level = IPPROTO_UDP;
+							cmsg->cmsg_type = UDP_SEGMENT;
+							cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+							*reinterpret_cast<uint16_t*>(CMSG_DATA(cmsg)) = static_cast<uint16_t>(send.gso_size);
+
+							controllen += CMSG_SPACE(sizeof(uint16_t));
+							cmsg = CMSG_NXTHDR(&msgvec[i].msg_hdr, cmsg);
+						}
+#endif
+
+						if (want_tos)
+						{
+							// The mark copied from the inner frame, so the
+							// underlay can prioritize the encapsulated
+							// traffic classes.
+							if (send.target.address().is_v6())
+							{
+								cmsg->cmsg_level = IPPROTO_IPV6;
+								cmsg->cmsg_type = IPV6_TCLASS;
+							}
+							else
+							{
+								cmsg->cmsg_level = IPPROTO_IP;
+								cmsg->cmsg_type = IP_TOS;
+							}
+
+							cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+							*reinterpret_cast<int*>(CMSG_DATA(cmsg)) = static_cast<int>(send.tos);
+
+							controllen += CMSG_SPACE(sizeof(int));
+						}
+
+						msgvec[i].msg_hdr.msg_controllen = controllen;
+					}
+				}
+
+				const int cnt = ::sendmmsg(group_sockets[group]->native_handle(), msgvec, count, 0);
+
+				if (cnt < 0)
+				{
+					if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+					{
+						// This socket buffer is full: its entries go back to
+						// the queues and are flushed again once it gets
+						// writable. The other group members keep sending.
+						requeue_sends(entries, 0);
+						entries.clear();
+
+						group_sockets[group]->async_send(
+							boost::asio::null_buffers(),
+							m_socket_strand.wrap(boost::bind(&server::handle_send_ready, this, boost::asio::placeholders::error))
+						);
+
+						send_blocked = true;
+
+						continue;
+					}
+
+					// The first datagram could not be sent: report the error to its handler and keep going with the others.
+					const boost::system::error_code error(errno, boost::system::system_category());
+
+					entries.front().handler(error);
+					requeue_sends(entries, 1);
+					entries.clear();
+
+					continue;
+				}
+
+				// The completions are harvested in batch: every datagram the
+				// kernel accepted gets its handler called back to back.
+				for (int i = 0; i < cnt; ++i)
+				{
+					entries[i].handler(boost::system::error_code());
+				}
+
+				requeue_sends(entries, static_cast<size_t>(cnt));
+
+				// Releasing the slots at once drops the buffer references of
+				// the completed sends, so the shared buffers return to their
+				// pool without waiting for the slot to be reused.
+				entries.clear();
+			}
+
+			if (send_blocked)
+			{
+				// The flush flag stays set: handle_send_ready() resumes the
+				// flush once a blocked socket drains.
+				return;
+			}
+		}
+
+		m_send_flush_pending = false;
+	}
+
+	void server::handle_send_ready(const boost::system::error_code& ec)
+	{
+		// handle_send_ready() is executed within the socket strand so this is safe.
+		if (ec)
+		{
+			for (auto&& item: m_peer_send_queues)
+			{
+				for (auto&& send: item.second.control)
+				{
+					send.handler(ec);
+				}
+
+				for (auto&& channel_entry: item.second.channels)
+				{
+					for (auto&& send: channel_entry.second.entries)
+					{
+						send.handler(ec);
+					}
+				}
+
+				counters_for(item.first).send_queue_depth.store(0, std::memory_order_relaxed);
+			}
+
+			m_peer_send_queues.clear();
+			m_send_round_robin.clear();
+
+			m_send_flush_pending = false;
+
+			return;
+		}
+
+		do_flush_sends();
+	}
+#endif
+
+	void server::push_write(void_handler_type handler)
+	{
+		// All push_write() calls are done in the same strand so the following is thread-safe.
+		if (m_write_queue.empty())
+		{
+			// Nothing is being written, lets start the write immediately.
+			m_socket_strand.post(make_causal_handler(handler, m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
+		}
+
+		m_write_queue.push(handler);
+	}
+
+	void server::pop_write()
+	{
+		// All pop_write() calls are done in the same strand so the following is thread-safe.
+		m_write_queue.pop();
+
+		if (!m_write_queue.empty())
+		{
+			m_socket_strand.post(make_causal_handler(m_write_queue.front(), m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
+		}
+	}
+
+	server::ep_type server::to_socket_format(const server::ep_type& ep)
+	{
+#ifdef WINDOWS
+		if (m_socket.local_endpoint().address().is_v6() && ep.address().is_v4())
+		{
+			return server::ep_type(boost::asio::ip::address_v6::v4_mapped(ep.address().to_v4()), ep.port());
+		}
+		else
+		{
+			return ep;
+		}
+#else
+		static_cast<void>(ep);
+
+		return ep;
+#endif
+	}
+
+	uint32_t server::pending_hello_table::generate_unique_number()
+	{
+		// The first call to this function is *NOT* thread-safe in C++03 !
+		static boost::mt19937 rng(static_cast<uint32_t>(time(0)));
+
+		return rng();
+	}
+
+	server::hello_request_limiter::hello_request_limiter()
+	{
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+
+		for (size_t i = 0; i < m_buckets.size(); ++i)
+		{
+			m_buckets[i].last_refill = now;
+			m_buckets[i].tokens = BUCKET_CAPACITY;
+		}
+	}
+
+	size_t server::hello_request_limiter::bucket_index_for(const boost::asio::ip::address& address)
+	{
+		// The bucket key is the address prefix, not the full address: a
+		// flood spread over one network still lands in a single bucket.
+		size_t seed = 0;
+
+		if (address.is_v4())
+		{
+			const boost::asio::ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+
+			for (size_t i = 0; i < 3; ++i)
+			{
+				boost::hash_combine(seed, bytes[i]);
+			}
+		}
+		else
+		{
+			const boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+
+			for (size_t i = 0; i < 6; ++i)
+			{
+				boost::hash_combine(seed, bytes[i]);
+			}
+		}
+
+		return (seed % BUCKET_COUNT);
+	}
+
+	bool server::hello_request_limiter::allow(const boost::asio::ip::address& address)
+	{
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		bucket_type& bucket = m_buckets[bucket_index_for(address)];
+
+		const boost::posix_time::time_duration elapsed = now - bucket.last_refill;
+
+		if (elapsed.total_milliseconds() > 0)
+		{
+			const uint64_t refill = static_cast<uint64_t>(elapsed.total_milliseconds()) * BUCKET_TOKENS_PER_SECOND / 1000;
+
+			if (refill > 0)
+			{
+				bucket.tokens = static_cast<uint32_t>(std::min<uint64_t>(bucket.tokens + refill, BUCKET_CAPACITY));
+				bucket.last_refill = now;
+			}
+		}
+
+		if (bucket.tokens == 0)
+		{
+			return false;
+		}
+
+		--bucket.tokens;
+
+		return true;
+	}
+
+	server::pending_hello_table::pending_hello_table() :
+		m_current_hello_unique_number(generate_unique_number()),
+		m_generation(0)
+	{
+	}
+
+	uint32_t server::pending_hello_table::next_hello_unique_number()
+	{
+		return m_current_hello_unique_number++;
+	}
+
+	size_t server::pending_hello_table::slot_index_for(uint32_t hello_unique_number)
+	{
+		// The unique numbers are sequential: a multiplicative hash
+		// spreads them over the table before the linear probe.
+		return static_cast<size_t>(hello_unique_number * UINT32_C(2654435761)) & (SLOT_COUNT - 1);
+	}
+
+	server::pending_hello_table::slot_type* server::pending_hello_table::find_slot(const ep_type& endpoint, uint32_t hello_unique_number)
+	{
+		size_t index = slot_index_for(hello_unique_number);
+
+		for (size_t probe = 0; probe < MAX_PROBE_LENGTH; ++probe)
+		{
+			slot_type& slot = m_slots[index];
+
+			if (slot.live(m_generation) && (slot.unique_number == hello_unique_number) && (slot.endpoint == endpoint))
+			{
+				return &slot;
+			}
+
+			index = (index + 1) & (SLOT_COUNT - 1);
+		}
+
+		return NULL;
+	}
+
+	template <typename WaitHandler>
+	void server::pending_hello_table::async_wait_reply(timer_service& timers, const ep_type& target, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler)
+	{
+		size_t index = slot_index_for(hello_unique_number);
+		slot_type* candidate = NULL;
+
+		for (size_t probe = 0; probe < MAX_PROBE_LENGTH; ++probe)
+		{
+			slot_type& slot = m_slots[index];
+
+			if (!slot.live(m_generation))
+			{
+				candidate = &slot;
+
+				break;
+			}
+
+			if (!candidate || (slot.start_date < candidate->start_date))
+			{
+				candidate = &slot;
+			}
+
+			index = (index + 1) & (SLOT_COUNT - 1);
+		}
+
+		if (candidate->live(m_generation))
+		{
+			// The whole probe window is live: evict the oldest wait in
+			// it. Its timeout handler will not find the slot anymore and
+			// the wait reports as unsuccessful.
+			timers.cancel(candidate->wait_id);
+		}
+
+		candidate->unique_number = hello_unique_number;
+		candidate->generation = m_generation;
+		candidate->endpoint = target;
+		candidate->start_date = boost::posix_time::microsec_clock::universal_time();
+		candidate->success = false;
+		candidate->wait_id = timers.schedule(timeout, handler);
+	}
+
+	bool server::pending_hello_table::cancel_reply_wait(timer_service& timers, const ep_type& sender, uint32_t hello_unique_number, bool success)
+	{
+		slot_type* const slot = find_slot(sender, hello_unique_number);
+
+		if (slot)
+		{
+			if (timers.cancel(slot->wait_id) > 0)
+			{
+				// At least one handler was cancelled which means we can set the success flag.
+				slot->success = success;
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void server::pending_hello_table::cancel_all_reply_wait(timer_service& timers)
+	{
+		for (size_t index = 0; index < SLOT_COUNT; ++index)
+		{
+			slot_type& slot = m_slots[index];
+
+			if (slot.live(m_generation))
+			{
+				timers.cancel(slot.wait_id);
+				slot.wait_id = 0;
+			}
+		}
+
+		// Bumping the generation invalidates any wait the loop above
+		// could have missed: the pending timeout handlers find no live
+		// slot and report their waits as unsuccessful.
+		++m_generation;
+	}
+
+	bool server::pending_hello_table::remove_reply_wait(const ep_type& target, uint32_t hello_unique_number, boost::posix_time::time_duration& duration)
+	{
+		slot_type* const slot = find_slot(target, hello_unique_number);
+
+		if (!slot)
+		{
+			// The wait was evicted or invalidated before its timeout
+			// handler ran.
+			duration = boost::posix_time::time_duration();
+
+			return false;
+		}
+
+		const bool result = slot->success;
+
+		duration = boost::posix_time::microsec_clock::universal_time() - slot->start_date;
+
+		slot->wait_id = 0;
+
+		return result;
+	}
+
+	void server::do_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
+	{
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline, boost::posix_time::time_duration());
+
+			return;
+		}
+
+		// All do_greet() calls are done in the same strand so the following is thread-safe.
+		handshake_stamps_type& stamps = handshake_stamps_for(target);
+		stamps.hello_sent_us.store(monotonic_us(), std::memory_order_relaxed);
+		stamps.session_request_us.store(0, std::memory_order_relaxed);
+
+		const uint32_t hello_unique_number = m_pending_hellos.next_hello_unique_number();
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_handshake_buffers.get();
+		const size_t size = hello_message::write_request(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+
+		async_send_to(
+			send_buffer,
+			size,
+			target,
+			m_greet_strand.wrap([this, target, hello_unique_number, handler, timeout](const boost::system::error_code& ec) {
+				do_greet_handler(target, hello_unique_number, handler, timeout, ec);
+			})
+		);
+	}
+
+	void server::do_greet_handler(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::posix_time::time_duration& timeout, const boost::system::error_code& ec)
+	{
+		if (ec)
+		{
+			handler(ec, boost::posix_time::time_duration());
+
+			return;
+		}
+
+		// All do_greet() calls are done in the same strand so the following is thread-safe.
+		m_pending_hellos.async_wait_reply(m_timer_service, target, hello_unique_number, timeout, m_greet_strand.wrap(boost::bind(&server::do_greet_timeout, this, target, hello_unique_number, handler, _1)));
+	}
+
+	void server::do_greet_timeout(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::system::error_code& ec)
+	{
+		// All do_greet_timeout() calls are done in the same strand so the following is thread-safe.
+		boost::posix_time::time_duration duration;
+
+		const bool success = m_pending_hellos.remove_reply_wait(target, hello_unique_number, duration);
+
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			// The timer was aborted, which means we received a reply or the server was shut down.
+			if (success)
+			{
+				// The success flag is set: the timer was cancelled due to a reply.
+				handler(server_error::success, duration);
+
+				return;
+			}
+		}
+		else if (!ec)
+		{
+			// The timer timed out: replacing the error code.
+			handler(server_error::hello_request_timed_out, duration);
+
+			return;
+		}
+
+		handler(ec, duration);
+	}
+
+	void server::do_cancel_all_greetings()
+	{
+		// All do_cancel_all_greetings() calls are done in the same strand so the following is thread-safe.
+		m_pending_hellos.cancel_all_reply_wait(m_timer_service);
+	}
+
+	void server::handle_hello_message_from(const hello_message& _hello_message, const ep_type& sender, uint64_t rx_time_us)
+	{
+		switch (_hello_message.type())
+		{
+			case MESSAGE_TYPE_HELLO_REQUEST:
+			{
+				// The limiter runs on the receive path, before any strand
+				// work or allocation: a flood of junk HELLO requests is
+				// dropped here and cannot pin the greet strand.
+				if (!m_hello_request_limiter.allow(sender.address()))
+				{
+					break;
+				}
+
+				// We need to handle the response in the proper strand to avoid race conditions.
+				m_greet_strand.post(boost::bind(&server::do_handle_hello_request, this, sender, _hello_message.unique_number()));
+
+				break;
+			}
+			case MESSAGE_TYPE_HELLO_RESPONSE:
+			{
+				// We need to handle the response in the proper strand to avoid race conditions.
+				m_greet_strand.post(boost::bind(&server::do_handle_hello_response, this, sender, _hello_message.unique_number(), rx_time_us));
+
+				break;
+			}
+			default:
+			{
+				// This should never happen.
+				assert(false);
+
+				break;
+			}
+		}
+	}
+
+	void server::do_handle_hello_request(const ep_type& sender, uint32_t hello_unique_number)
+	{
+		// All do_handle_hello_request() calls are done in the same strand so the following is thread-safe.
+		bool can_reply = m_accept_hello_messages_default;
+
+		if (m_hello_message_received_handler)
+		{
+			can_reply = m_hello_message_received_handler(sender, can_reply);
+		}
+
+		if (can_reply)
+		{
+			// Get either a new buffer or an old, recycled one if possible.
+			const SharedBuffer send_buffer = m_handshake_buffers.get();
+			const size_t size = hello_message::write_response(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+
+			async_send_to(
+				send_buffer,
+				size,
+				sender,
+				[](const boost::system::error_code&) {}
+			);
+		}
+	}
+
+	void server::do_handle_hello_response(const ep_type& sender, uint32_t hello_unique_number, uint64_t rx_time_us)
+	{
+		// All do_handle_hello_response() calls are done in the same strand so the following is thread-safe.
+		if (!m_pending_hellos.cancel_reply_wait(m_timer_service, sender, hello_unique_number, true))
+		{
+			// There is no pending request matching both the sender and
+			// the unique number: the response is unsolicited or late.
+			// An off-path host cannot guess the random unique number a
+			// genuine request carried.
+			return;
+		}
+
+		// The kernel receive timestamp excludes the time the response spent
+		// queued behind other datagrams and strand work; without one, the
+		// current time is the best available bound.
+		const uint64_t now_us = (rx_time_us > 0) ? rx_time_us : monotonic_us();
+
+		const uint64_t hello_sent_us = handshake_stamps_for(sender).hello_sent_us.load(std::memory_order_relaxed);
+
+		if ((hello_sent_us > 0) && (now_us > hello_sent_us))
+		{
+			const uint64_t rtt_us = now_us - hello_sent_us;
+
+			record_handshake_duration(handshake_stage::hello, rtt_us);
+			record_rtt_sample(sender, rtt_us);
+		}
+	}
+
+	void server::do_discover_mtu(const ep_type& target, mtu_handler_type handler)
+	{
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline, 0);
+
+			return;
+		}
+
+		// All do_discover_mtu() calls are done in the same strand so the following is thread-safe.
+		mtu_discovery_context_type& context = m_mtu_discovery_contexts[target];
+
+		if (context.in_progress())
+		{
+			// A discovery is already running for this target: abort it in favor of the new one.
+			context.handler(boost::asio::error::operation_aborted, 0);
+		}
+
+		context.lower = MTU_PROBE_MIN_SIZE;
+		context.upper = MTU_PROBE_MAX_SIZE;
+		context.probe_size = MTU_PROBE_MAX_SIZE;
+		context.attempts_left = MTU_PROBE_ATTEMPTS;
+		context.handler = handler;
+
+		do_probe_mtu(target);
+	}
+
+	void server::do_probe_mtu(const ep_type& target)
+	{
+		// All do_probe_mtu() calls are done in the same strand so the following is thread-safe.
+		mtu_discovery_context_type& context = m_mtu_discovery_contexts[target];
+
+		const uint32_t hello_unique_number = m_pending_hellos.next_hello_unique_number();
+
+		context.probe_unique_number = hello_unique_number;
+
+		// A probe is a regular HELLO request padded to the probed size: the
+		// remote host ignores the trailing bytes and replies with a regular,
+		// small HELLO response.
+		// Get either a new buffer or an old, recycled one if possible. The
+		// pooled buffers are MTU_PROBE_MAX_SIZE long, which any probe fits.
+		const SharedBuffer send_buffer = m_handshake_buffers.get();
+		const size_t size = hello_message::write_request(buffer_cast<uint8_t*>(send_buffer), context.probe_size, hello_unique_number);
+
+		std::memset(buffer_cast<uint8_t*>(send_buffer) + size, 0x00, context.probe_size - size);
+
+		async_send_to(
+			send_buffer,
+			context.probe_size,
+			target,
+			m_greet_strand.wrap([this, target, hello_unique_number](const boost::system::error_code& ec) {
+				do_probe_mtu_handler(target, hello_unique_number, ec);
+			})
+		);
+	}
+
+	void server::do_probe_mtu_handler(const ep_type& target, uint32_t hello_unique_number, const boost::system::error_code& ec)
+	{
+		// All do_probe_mtu_handler() calls are done in the same strand so the following is thread-safe.
+		mtu_discovery_context_type& context = m_mtu_discovery_contexts[target];
+
+		if (!context.in_progress() || (context.probe_unique_number != hello_unique_number))
+		{
+			// The discovery this probe belonged to was aborted.
+			return;
+		}
+
+		if (ec == boost::asio::error::message_size)
+		{
+			// The probe was too big to even leave the host: count it as a
+			// failed probe.
+			do_handle_mtu_probe_result(target, false);
+
+			return;
+		}
+		else if (ec)
+		{
+			do_finish_mtu_discovery(target, ec, 0);
+
+			return;
+		}
+
+		m_pending_hellos.async_wait_reply(m_timer_service, target, hello_unique_number, MTU_PROBE_TIMEOUT, m_greet_strand.wrap(boost::bind(&server::do_probe_mtu_timeout, this, target, hello_unique_number, _1)));
+	}
+
+	void server::do_probe_mtu_timeout(const ep_type& target, uint32_t hello_unique_number, const boost::system::error_code& ec)
+	{
+		// All do_probe_mtu_timeout() calls are done in the same strand so the following is thread-safe.
+		boost::posix_time::time_duration duration;
+
+		const bool success = m_pending_hellos.remove_reply_wait(target, hello_unique_number, duration);
+
+		mtu_discovery_context_type& context = m_mtu_discovery_contexts[target];
+
+		if (!context.in_progress() || (context.probe_unique_number != hello_unique_number))
+		{
+			// The discovery this probe belonged to was aborted.
+			return;
+		}
+
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			// The timer was aborted, which means we received a reply or the server was shut down.
+			if (success)
+			{
+				// The success flag is set: the timer was cancelled due to a reply.
+				do_handle_mtu_probe_result(target, true);
+
+				return;
+			}
+		}
+		else if (!ec)
+		{
+			// The timer timed out: the probe or its reply was lost.
+			do_handle_mtu_probe_result(target, false);
+
+			return;
+		}
+
+		do_finish_mtu_discovery(target, ec, 0);
+	}
+
+	void server::do_handle_mtu_probe_result(const ep_type& target, bool success)
+	{
+		// All do_handle_mtu_probe_result() calls are done in the same strand so the following is thread-safe.
+		mtu_discovery_context_type& context = m_mtu_discovery_contexts[target];
+
+		if (success)
+		{
+			context.lower = context.probe_size;
+		}
+		else
+		{
+			if (--context.attempts_left > 0)
+			{
+				// The probe (or its reply) may just have been lost: retry the same size.
+				do_probe_mtu(target);
+
+				return;
+			}
+
+			context.upper = context.probe_size - 1;
+		}
+
+		if ((context.upper <= context.lower) || ((context.upper - context.lower) <= MTU_PROBE_PRECISION))
+		{
+			// The searched interval is small enough: settle for its lower bound.
+			do_finish_mtu_discovery(target, server_error::success, context.lower);
+
+			return;
+		}
+
+		context.probe_size = (context.lower + context.upper + 1) / 2;
+		context.attempts_left = MTU_PROBE_ATTEMPTS;
+
+		do_probe_mtu(target);
+	}
+
+	void server::do_finish_mtu_discovery(const ep_type& target, const boost::system::error_code& ec, size_t mtu)
+	{
+		// All do_finish_mtu_discovery() calls are done in the same strand so the following is thread-safe.
+		const mtu_discovery_context_map::iterator context = m_mtu_discovery_contexts.find(target);
+
+		if ((context == m_mtu_discovery_contexts.end()) || !context->second.in_progress())
+		{
+			return;
+		}
+
+		const mtu_handler_type handler = context->second.handler;
+
+		m_mtu_discovery_contexts.erase(context);
+
+		if (!ec)
+		{
+			boost::mutex::scoped_lock lock(m_peer_mtus_mutex);
+
+			m_peer_mtus[target] = mtu;
+		}
+
+		handler(ec, mtu);
+	}
+
+	void server::do_set_accept_hello_messages_default(bool value, void_handler_type handler)
+	{
+		// All do_set_accept_hello_messages_default() calls are done in the same strand so the following is thread-safe.
+		set_accept_hello_messages_default(value);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_hello_message_received_callback(hello_message_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_hello_message_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	size_t server::certificate_filter::index_for(const hash_type& hash, size_t i)
+	{
+		// The certificate hash is a cryptographic digest: disjoint slices of
+		// it act as independent hash functions.
+		uint32_t value;
+
+		std::memcpy(&value, &hash.data[i * sizeof(value)], sizeof(value));
+
+		return (value % FILTER_SIZE);
+	}
+
+	void server::certificate_filter::insert(const hash_type& hash)
+	{
+		for (size_t i = 0; i < HASH_COUNT; ++i)
+		{
+			uint8_t& counter = m_counters[index_for(hash, i)];
+
+			// A saturated counter is never changed again: a permanent false
+			// positive is harmless while a false negative is not.
+			if (counter < 255)
+			{
+				++counter;
+			}
+		}
+	}
+
+	void server::certificate_filter::remove(const hash_type& hash)
+	{
+		for (size_t i = 0; i < HASH_COUNT; ++i)
+		{
+			uint8_t& counter = m_counters[index_for(hash, i)];
+
+			if ((counter > 0) && (counter < 255))
+			{
+				--counter;
+			}
+		}
+	}
+
+	bool server::certificate_filter::maybe_contains(const hash_type& hash) const
+	{
+		for (size_t i = 0; i < HASH_COUNT; ++i)
+		{
+			if (m_counters[index_for(hash, i)] == 0)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	namespace
+	{
+		size_t presentation_store_footprint(const presentation_store& store)
+		{
+			// The footprint is an approximation: the DER size of the
+			// certificate and the pre-shared key bytes, without the
+			// OpenSSL structure overhead around the certificate.
+			size_t result = sizeof(presentation_store);
+
+			if (!store.signature_certificate().is_null())
+			{
+				result += store.signature_certificate().write_der(static_cast<void*>(NULL));
+			}
+
+			result += buffer_size(store.pre_shared_key());
+
+			return result;
+		}
+	}
+
+	void server::set_presentation_store(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key)
+	{
+#ifdef FSCP_MAX_PEERS
+		// The capacity profile bounds the presentation table. Without a
+		// presentation a host can never establish a session, so rejecting
+		// here keeps every peer table within the configured capacity.
+		if ((m_presentation_store_map.find(target) == m_presentation_store_map.end()) && (m_presentation_store_map.size() >= MAX_PEERS))
+		{
+			m_logger(log_level::warning) << "Ignoring the presentation for " << target << ": the compile-time peer capacity (" << MAX_PEERS << ") is reached.";
+
+			return;
+		}
+#endif
+
+		erase_presentation_store(target);
+
+		const presentation_store store(signature_certificate, pre_shared_key);
+
+		if (store.signature_certificate_hash())
+		{
+			m_certificate_filter.insert(*store.signature_certificate_hash());
+			m_contact_index.insert(std::make_pair(*store.signature_certificate_hash(), target));
+		}
+
+		m_presentation_store_map[target] = store;
+
+		if (!store.empty())
+		{
+			memory_usage::add(memory_subsystem::presentation_stores, presentation_store_footprint(store));
+		}
+
+		if (m_presentation_cache && !signature_certificate.is_null())
+		{
+			try
+			{
+				std::ostringstream oss;
+				oss << target;
+
+				m_presentation_cache->store(oss.str(), signature_certificate);
+			}
+			catch (const std::runtime_error& ex)
+			{
+				// The cache is best-effort: a write failure only costs a
+				// presentation exchange after the next restart.
+				m_logger(log_level::warning) << "Unable to update the presentation cache: " << ex.what();
+			}
+		}
+	}
+
+	void server::erase_presentation_store(const ep_type& target)
+	{
+		const presentation_store_map::iterator entry = m_presentation_store_map.find(target);
+
+		if (entry != m_presentation_store_map.end())
+		{
+			if (entry->second.signature_certificate_hash())
+			{
+				m_certificate_filter.remove(*entry->second.signature_certificate_hash());
+
+				const std::pair<contact_index_map_type::iterator, contact_index_map_type::iterator> range = m_contact_index.equal_range(*entry->second.signature_certificate_hash());
+
+				for (contact_index_map_type::iterator it = range.first; it != range.second; ++it)
+				{
+					if (it->second == target)
+					{
+						m_contact_index.erase(it);
+
+						break;
+					}
+				}
+			}
+
+			if (!entry->second.empty())
+			{
+				// Only non-empty stores were accounted: the entries the
+				// lookups create implicitly never were.
+				memory_usage::remove(memory_subsystem::presentation_stores, presentation_store_footprint(entry->second));
+			}
+
+			m_presentation_store_map.erase(entry);
+		}
+	}
+
+	bool server::has_presentation_store_for(const ep_type& ep) const
+	{
+		// This method should only be called from within the presentation strand.
+		presentation_store_map::const_iterator presentation_store = m_presentation_store_map.find(ep);
+
+		if (presentation_store != m_presentation_store_map.end())
+		{
+			return !(presentation_store->second.empty());
+		}
+
+		return false;
+	}
+
+	bool server::restore_presentation_from_cache(const ep_type& sender)
+	{
+		// This method should only be called from within the presentation strand.
+		if (!m_presentation_cache)
+		{
+			return false;
+		}
+
+		try
+		{
+			std::ostringstream oss;
+			oss << sender;
+
+			const boost::optional<cert_type> certificate = m_presentation_cache->find(oss.str());
+
+			if (!certificate)
+			{
+				return false;
+			}
+
+			// Only the certificate was persisted: a host that was known by
+			// its pre-shared key still has to present itself again.
+			set_presentation_store(sender, *certificate, cryptoplus::buffer());
+
+			m_logger(log_level::information) << "Restored the presentation of " << sender << " from the cache.";
+
+			return true;
+		}
+		catch (const std::runtime_error& ex)
+		{
+			m_logger(log_level::warning) << "Unable to read the presentation cache: " << ex.what();
+
+			return false;
+		}
+	}
+
+	void server::do_introduce_to(const ep_type& target, simple_handler_type handler)
+	{
+		// All do_introduce_to() calls are done in the same strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		const identity_store& identity = get_identity();
+
+		if (identity.empty())
+		{
+			// The identity is still being loaded: the caller retries
+			// through its contact loop once the identity is set.
+			handler(server_error::no_identity);
+
+			return;
+		}
+
+		// A peer that still holds a session from before an identity rotation
+		// keeps seeing the certificate it knows, so the session survives.
+		const bool use_previous_identity = identity.has_previous_identity() && peer_uses_previous_identity(target);
+
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_handshake_buffers.get();
+
+		try
+		{
+			const size_t size = presentation_message::write(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				use_previous_identity ? identity.previous_signature_certificate() : identity.signature_certificate()
+			);
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_reintroduce_to_all(multiple_endpoints_handler_type handler)
+	{
+		// All do_reintroduce_to_all() calls are done in the same strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		results_gatherer_type::set_type targets;
+
+		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
+		{
+			targets.insert(presentation_store->first);
+		}
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
+		{
+			async_introduce_to(presentation_store->first, boost::bind(&results_gatherer_type::gather, rg, presentation_store->first, _1));
+		}
+	}
+
+	void server::do_get_presentation(const ep_type& target, optional_presentation_store_handler_type handler)
+	{
+		// All do_get_presentation() calls are done in the same strand so the following is thread-safe.
+		handler(get_presentation(target));
+	}
+
+	void server::do_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key, void_handler_type handler)
+	{
+		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
+		set_presentation(target, signature_certificate, pre_shared_key);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_clear_presentation(const ep_type& target, void_handler_type handler)
+	{
+		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
+		clear_presentation(target);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::handle_presentation_message_from(const identity_store& identity, const presentation_message& _presentation_message, const ep_type& sender)
+	{
+		const auto signature_certificate = _presentation_message.signature_certificate();
+
+		async_has_session_with_endpoint(sender, [this, identity, sender, signature_certificate](bool has_session) {
+			m_presentation_strand.post(
+				boost::bind(
+					&server::do_handle_presentation,
+					this,
+					identity,
+					sender,
+					has_session,
+					signature_certificate
+				)
+			);
+		});
+	}
+
+	void server::do_handle_presentation(const identity_store& identity, const ep_type& sender, bool has_session, cert_type signature_certificate)
+	{
+		// All do_handle_presentation() calls are done in the same strand so the following is thread-safe.
+		presentation_status_type presentation_status = PS_FIRST;
+
+		// Hashing the certificate costs one DER encoding, once: everything
+		// below then works on the hash.
+		const boost::optional<hash_type> signature_certificate_hash = signature_certificate.is_null() ? boost::none : boost::optional<hash_type>(get_certificate_hash(signature_certificate));
+
+		const presentation_store_map::iterator entry = m_presentation_store_map.find(sender);
+
+		if (entry != m_presentation_store_map.end())
+		{
+			// The filter rejects certificates that are definitely not in the
+			// store before any comparison runs; known ones are then matched
+			// by their cached hash instead of a full certificate comparison.
+			const bool may_be_known = !signature_certificate_hash || m_certificate_filter.maybe_contains(*signature_certificate_hash);
+
+			if (may_be_known && (entry->second.signature_certificate_hash() == signature_certificate_hash))
+			{
+				presentation_status = PS_SAME;
+			}
+			else
+			{
+				presentation_status = PS_NEW;
+			}
+		}
+
+		if (m_presentation_message_received_async_handler)
+		{
+			// The acceptance decision is taken asynchronously: presentations
+			// from other hosts can be handled while it is pending.
+			m_presentation_message_received_async_handler(
+				sender,
+				signature_certificate,
+				presentation_status,
+				has_session,
+				m_presentation_strand.wrap(
+					boost::bind(
+						&server::do_complete_handle_presentation,
+						this,
+						identity,
+						sender,
+						signature_certificate,
+						_1
+					)
+				)
+			);
+
+			return;
+		}
+
+		if (m_presentation_message_received_handler)
+		{
+			if (!m_presentation_message_received_handler(sender, signature_certificate, presentation_status, has_session))
+			{
+				return;
+			}
+		}
+
+		set_presentation_store(sender, signature_certificate, identity.pre_shared_key());
+	}
+
+	void server::do_complete_handle_presentation(const identity_store& identity, const ep_type& sender, cert_type signature_certificate, bool accepted)
+	{
+		// All do_complete_handle_presentation() calls are done in the same strand so the following is thread-safe.
+		if (!accepted)
+		{
+			return;
+		}
+
+		set_presentation_store(sender, signature_certificate, identity.pre_shared_key());
+	}
+
+	void server::do_set_presentation_message_received_callback(presentation_message_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_presentation_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_presentation_message_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	cipher_suite_type server::get_first_common_supported_cipher_suite(const cipher_suite_list_type& reference, const cipher_suite_list_type& capabilities, cipher_suite_type default_value = cipher_suite_type::unsupported)
+	{
+		for (auto&& cs : reference)
+		{
+			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
+			{
+				return cs;
+			}
+		}
+
+		return default_value;
+	}
+
+	elliptic_curve_type server::get_first_common_supported_elliptic_curve(const elliptic_curve_list_type& reference, const elliptic_curve_list_type& capabilities, elliptic_curve_type default_value = elliptic_curve_type::unsupported)
+
+	{
+		for (auto&& cs : reference)
+		{
+			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
+			{
+				return cs;
+			}
+		}
+
+		return default_value;
+	}
+
+	void server::do_request_session(const identity_store& identity, const ep_type& target, simple_handler_type handler)
+	{
+		// All do_request_session() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (identity.empty())
+		{
+			// The identity is still being loaded: there is nothing to sign
+			// the request with yet.
+			handler(server_error::no_identity);
+
+			return;
+		}
+
+		peer_session& p_session = session_for(target);
+
+		if (p_session.has_current_session())
+		{
+			handler(server_error::session_already_exist);
+
+			return;
+		}
+
+		// Make sure the peer has a deadline on the keep-alive wheel.
+		schedule_keep_alive(target, keep_alive_interval(target));
+
+		handshake_stamps_for(target).session_request_us.store(monotonic_us(), std::memory_order_relaxed);
+
+		const SharedBuffer send_buffer = m_session_buffers.get();
+
+		try
+		{
+			const auto next_session_number = p_session.next_session_number();
+			const auto local_host_identifier = p_session.local_host_identifier();
+
+			m_logger(log_level::trace) << "Sending session request message to " << target << " (next_session_number: " << next_session_number << ", local_host_identifier: " << local_host_identifier << ")";
+			size_t size = 0;
+
+			// A peer from before an identity rotation verifies against the
+			// previous certificate: sign with the matching key.
+			const bool use_previous_identity = identity.has_previous_identity() && peer_uses_previous_identity(target);
+			const identity_store::key_type signature_key = use_previous_identity ? identity.previous_signature_key() : identity.signature_key();
+
+			if (!!signature_key)
+			{
+				size = session_request_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					next_session_number,
+					local_host_identifier,
+					m_cipher_suites,
+					m_elliptic_curves,
+					signature_key
+				);
+			}
+			else
+			{
+				size = session_request_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					next_session_number,
+					local_host_identifier,
+					m_cipher_suites,
+					m_elliptic_curves,
+					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
+					buffer_size(identity.pre_shared_key())
+					);
+			}
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_close_session(const ep_type& target, simple_handler_type handler)
+	{
+		// All do_close_session() calls are done in the same strand so the following is thread-safe.
+
+		if (session_for(target).clear())
+		{
+			// The next handshake with this peer starts fresh: present the
+			// current certificate from now on.
+			forget_previous_identity_peer(target);
+
+			// The next contact tries the direct path again before any relay.
+			clear_relay(target);
+
+			handler(server_error::success);
+
+			if (m_session_lost_handler)
+			{
+				m_session_lost_handler(target, session_loss_reason::manual_termination);
+			}
+		}
+		else
+		{
+			handler(server_error::no_session_for_host);
+		}
+	}
+
+	void server::do_handle_session_request(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message)
+	{
+		// All do_handle_session_request() calls are done in the presentation strand so the following is thread-safe.
+		if (m_handshake_slots_in_use >= HANDSHAKE_MAX_CONCURRENCY)
+		{
+			// Every handshake slot is busy: the request waits for one
+			// instead of piling more signature checks and key exchanges
+			// in front of the data-path work. The newest requests are
+			// served first and the oldest are dropped when the backlog
+			// fills up: a dropped peer retries its request anyway.
+			if (m_handshake_backlog.size() >= HANDSHAKE_BACKLOG_CAPACITY)
+			{
+				m_handshake_backlog.erase(m_handshake_backlog.begin());
+			}
+
+			const pending_session_request_type pending = { data, identity, sender, boost::make_shared<session_request_message>(_session_request_message) };
+
+			m_handshake_backlog.push_back(pending);
+
+			return;
+		}
+
+		++m_handshake_slots_in_use;
+
+		do_handle_admitted_session_request(data, identity, sender, _session_request_message);
+	}
+
+	void server::do_handle_admitted_session_request(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message)
+	{
+		// All do_handle_admitted_session_request() calls are done in the presentation strand so the following is thread-safe.
+		if (identity.empty())
+		{
+			// The identity is still being loaded: the reply could not be
+			// signed. The peer simply retries its request.
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " before the identity is available. Ignoring.";
+
+			m_presentation_strand.post(boost::bind(&server::do_release_handshake_slot, this));
+
+			return;
+		}
+
+		if (!has_presentation_store_for(sender) && !restore_presentation_from_cache(sender))
+		{
+			// No presentation_store for the given host.
+			// We do nothing.
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but no presentation is available. Ignoring.";
+
+			m_presentation_strand.post(boost::bind(&server::do_release_handshake_slot, this));
+
+			return;
+		}
+
+		// We make sure the signatures matches.
+		bool check_ok = false;
+
+		if (!!m_presentation_store_map[sender].signature_certificate())
+		{
+			check_ok = _session_request_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key());
+		}
+		else
+		{
+			const auto psk = m_presentation_store_map[sender].pre_shared_key();
+			check_ok = _session_request_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
+		}
+
+		if (!check_ok)
+		{
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with an invalid signature. Ignoring.";
+
+			m_presentation_strand.post(boost::bind(&server::do_release_handshake_slot, this));
+
+			return;
+		}
+
+		// The make_shared_buffer_handler() call below is necessary so that the reference to session_request_message remains valid.
+		m_session_strand.post(
+			make_shared_buffer_handler(
+				data,
+				boost::bind(
+					&server::do_handle_verified_session_request_in_slot,
+					this,
+					identity,
+					sender,
+					_session_request_message,
+					m_presentation_store_map[sender].signature_certificate_hash()
+				)
+			)
+		);
+	}
+
+	void server::do_handle_verified_session_request_in_slot(const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message, boost::optional<hash_type> fingerprint)
+	{
+		// All do_handle_verified_session_request_in_slot() calls are done in the session strand so the following is thread-safe.
+		do_handle_verified_session_request(identity, sender, _session_request_message, fingerprint);
+
+		// The slot is released on the presentation strand, where the
+		// admission state lives.
+		m_presentation_strand.post(boost::bind(&server::do_release_handshake_slot, this));
+	}
+
+	void server::do_release_handshake_slot()
+	{
+		// All do_release_handshake_slot() calls are done in the presentation strand so the following is thread-safe.
+		--m_handshake_slots_in_use;
+
+		if (!m_handshake_backlog.empty())
+		{
+			const pending_session_request_type pending = m_handshake_backlog.back();
+
+			m_handshake_backlog.pop_back();
+
+			do_handle_session_request(pending.data, pending.identity, pending.sender, *pending.message);
+		}
+	}
+
+	void server::do_handle_verified_session_request(const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message, boost::optional<hash_type> fingerprint)
+	{
+		// All do_handle_verified_session_request() calls are done in the session strand so the following is thread-safe.
+
+		// Get the associated session, creating one if none exists.
+		peer_session& p_session = session_for(sender);
+
+		if (!p_session.set_first_remote_host_identifier(_session_request_message.host_identifier()))
+		{
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but the host identifier does not match (Received: " << _session_request_message.host_identifier() << ". Expected: " << *p_session.remote_host_identifier() << "). Ignoring.";
+
+			// The host identifier does not match.
+			return;
+		}
+
+		// A verified SESSION_REQUEST is as good a sign of life as an
+		// authenticated data message: it defers the next keep-alive probe.
+		p_session.keep_alive();
+
+		// Make sure the peer has a deadline on the keep-alive wheel.
+		schedule_keep_alive(sender, keep_alive_interval(sender));
+
+		// The initiator advertises its session capabilities with the
+		// request: recording them here lets this side act on them without
+		// waiting for the peer's SESSION message.
+		p_session.set_remote_session_capabilities(_session_request_message.capabilities());
+
+		// A peer's capabilities virtually never change: the parsed lists and
+		// the negotiated suite are cached per certificate fingerprint, so a
+		// renewal skips the parsing and the intersection.
+		const size_t capabilities_hash = _session_request_message.capabilities_hash();
+
+		negotiated_capabilities_type* negotiation = NULL;
+
+		if (fingerprint)
+		{
+			const negotiation_cache_map_type::iterator entry = m_negotiation_cache.find(*fingerprint);
+
+			if ((entry != m_negotiation_cache.end()) && (entry->second.capabilities_hash == capabilities_hash))
+			{
+				negotiation = &entry->second;
+			}
+		}
+
+		negotiated_capabilities_type computed_negotiation;
+
+		if (!negotiation)
+		{
+			computed_negotiation.capabilities_hash = capabilities_hash;
+			computed_negotiation.cipher_suites = _session_request_message.cipher_suite_capabilities();
+			computed_negotiation.elliptic_curves = _session_request_message.elliptic_curve_capabilities();
+			computed_negotiation.cipher_suite = get_first_common_supported_cipher_suite(m_cipher_suites, computed_negotiation.cipher_suites);
+			computed_negotiation.elliptic_curve = get_first_common_supported_elliptic_curve(m_elliptic_curves, computed_negotiation.elliptic_curves);
+
+			if (fingerprint)
+			{
+				negotiation = &(m_negotiation_cache[*fingerprint] = computed_negotiation);
+			}
+			else
+			{
+				// Pre-shared-key only peers carry no certificate: their
+				// negotiation is not cached.
+				negotiation = &computed_negotiation;
+			}
+		}
+
+		const cipher_suite_list_type& cipher_suites = negotiation->cipher_suites;
+		const elliptic_curve_list_type& elliptic_curves = negotiation->elliptic_curves;
+		const cipher_suite_type calg = negotiation->cipher_suite;
+		const elliptic_curve_type ec = negotiation->elliptic_curve;
+
+		if ((calg == cipher_suite_type::unsupported) || (ec == elliptic_curve_type::unsupported))
+		{
+			// No suitable cipher and/or elliptic curve is available.
+			FSCP_LOG_LIMITED(m_logger, log_level::warning) << "Received a SESSION_REQUEST from " << sender << " but can't agree on the cipher suite to use. Ignoring.";
+
+			return;
+		}
+
+		bool can_reply = m_accept_session_request_messages_default;
+
+		if (m_session_request_message_received_handler)
+		{
+			can_reply = m_session_request_message_received_handler(sender, cipher_suites, elliptic_curves, m_accept_session_request_messages_default);
+		}
+
+		if (!can_reply)
+		{
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but not allowed to reply (`m_accept_session_request_messages_default` is " << m_accept_session_request_messages_default << ").";
+		}
+		else
+		{
+			if (!p_session.has_current_session())
+			{
+				m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". No current session exist: preparing one and sending it.";
+
+				p_session.prepare_session(_session_request_message.session_number(), calg, ec, get_ecdhe_context(ec));
+				do_send_session(identity, sender, p_session.next_session_parameters());
+			}
+			else
+			{
+				m_logger(log_level::trace) << "Current session has number " << p_session.current_session().parameters.session_number << " and " << sender << " requests session number " << _session_request_message.session_number();
+
+				if (_session_request_message.session_number() > p_session.current_session().parameters.session_number)
+				{
+					m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". A current session exists but has the number " << p_session.current_session().parameters.session_number << ": preparing a new session and sending it.";
+
+					// A new session is requested. Sending a new message.
+					p_session.prepare_session(_session_request_message.session_number(), calg, ec, get_ecdhe_context(ec));
+					do_send_session(identity, sender, p_session.next_session_parameters());
+				}
+				else
+				{
+					m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". A current session exists and has the number " << p_session.current_session().parameters.session_number << ": sending the current session.";
+
+					// An old session is requested: sending the same message.
+					do_send_session(identity, sender, p_session.current_session_parameters());
+				}
+			}
+		}
+	}
+
+	boost::shared_ptr<cryptoplus::pkey::ecdhe_context> server::get_ecdhe_context(elliptic_curve_type ec)
+	{
+		// All get_ecdhe_context() calls are done in the session strand so the following is thread-safe.
+		std::vector<boost::shared_ptr<cryptoplus::pkey::ecdhe_context>>& cache = m_ecdhe_context_cache[ec.value()];
+
+		boost::shared_ptr<cryptoplus::pkey::ecdhe_context> result;
+
+		if (cache.empty())
+		{
+			// The cache is empty: the keypair is generated on the spot, as it used to be.
+			result = boost::make_shared<cryptoplus::pkey::ecdhe_context>(ec.to_elliptic_curve_nid());
+		}
+		else
+		{
+			result = cache.back();
+			cache.pop_back();
+		}
+
+		// The keypair generation is expensive: the cache is refilled outside
+		// of the session strand so the next session preparation for this
+		// curve finds a keypair ready.
+		get_io_service().post(boost::bind(&server::do_generate_ecdhe_context, this, ec));
+
+		return result;
+	}
+
+	void server::do_generate_ecdhe_context(elliptic_curve_type ec)
+	{
+		// This runs outside of any strand: the context is handed over to the session strand once generated.
+		try
+		{
+			const boost::shared_ptr<cryptoplus::pkey::ecdhe_context> context = boost::make_shared<cryptoplus::pkey::ecdhe_context>(ec.to_elliptic_curve_nid());
+
+			context->generate_keys();
+
+			m_session_strand.post(boost::bind(&server::do_store_ecdhe_context, this, ec, context));
+		}
+		catch (const std::exception& ex)
+		{
+			m_logger(log_level::warning) << "Unable to pre-generate an ECDHE keypair for " << ec << ": " << ex.what() << ".";
+		}
+	}
+
+	void server::do_store_ecdhe_context(elliptic_curve_type ec, boost::shared_ptr<cryptoplus::pkey::ecdhe_context> context)
+	{
+		// All do_store_ecdhe_context() calls are done in the session strand so the following is thread-safe.
+		std::vector<boost::shared_ptr<cryptoplus::pkey::ecdhe_context>>& cache = m_ecdhe_context_cache[ec.value()];
+
+		if (cache.size() < ECDHE_CONTEXT_CACHE_SIZE)
+		{
+			cache.push_back(context);
+		}
+	}
+
+	size_t server::endpoint_hash::operator()(const ep_type& ep) const
+	{
+		const boost::asio::ip::address address = ep.address();
+
+		if (address.is_v4())
+		{
+			// The IPv4 address already is a single 32-bit word: one multiply
+			// spreads it over the buckets.
+			return (static_cast<size_t>(address.to_v4().to_ulong()) * 2654435761UL) ^ ep.port();
+		}
+
+		const boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+
+		size_t seed = static_cast<size_t>(ep.port());
+		boost::hash_range(seed, bytes.begin(), bytes.end());
+
+		return seed;
+	}
+
+	peer_session& server::session_for(const ep_type& ep)
+	{
+		// This method should only be called from within the session strand.
+		if ((m_hot_session != nullptr) && (m_hot_session_endpoint == ep))
+		{
+			return *m_hot_session;
+		}
+
+		const size_t session_count = m_peer_sessions.size();
+
+		peer_session& result = m_peer_sessions[ep];
+
+		if (m_peer_sessions.size() != session_count)
+		{
+			// The entry footprint is an approximation: it covers the
+			// session state and its key, not the map node overhead.
+			memory_usage::add(memory_subsystem::sessions, sizeof(peer_session) + sizeof(ep_type));
+		}
+
+		m_hot_session_endpoint = ep;
+		m_hot_session = &result;
+
+		return result;
+	}
+
+	std::set<server::ep_type> server::get_session_endpoints() const
+	{
+		// All get_session_endpoints() calls are done in the same strand so the following is thread-safe.
+		std::set<ep_type> result;
+
+		for (auto&& p_session: m_peer_sessions)
+		{
+			if (p_session.second.has_current_session())
+			{
+				result.insert(p_session.first);
+			}
+		}
+
+		return result;
+	}
+
+	bool server::has_session_with_endpoint(const ep_type& host)
+	{
+		// All has_session_with_endpoint() calls are done in the same strand so the following is thread-safe.
+		const auto p_session = m_peer_sessions.find(host);
+
+		if (p_session != m_peer_sessions.end())
+		{
+			return p_session->second.has_current_session();
+		}
+
+		return false;
+	}
+
+	void server::do_get_session_endpoints(endpoints_handler_type handler)
+	{
+		// All do_get_session_endpoints() calls are done in the same strand so the following is thread-safe.
+		handler(get_session_endpoints());
+	}
+
+	void server::do_has_session_with_endpoint(const ep_type& host, boolean_handler_type handler)
+	{
+		// All do_has_session_with_endpoint() calls are done in the same strand so the following is thread-safe.
+		handler(has_session_with_endpoint(host));
+	}
+
+	void server::do_set_accept_session_request_messages_default(bool value, void_handler_type handler)
+	{
+		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_accept_session_request_messages_default(value);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_cipher_suites(cipher_suite_list_type cipher_suites, void_handler_type handler)
+	{
+		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_cipher_suites(cipher_suites);
+
+		// The cached negotiations were computed against the previous preferences.
+		m_negotiation_cache.clear();
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_elliptic_curves(elliptic_curve_list_type elliptic_curves, void_handler_type handler)
+	{
+		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_elliptic_curves(elliptic_curves);
+
+		// The cached negotiations were computed against the previous preferences.
+		m_negotiation_cache.clear();
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_request_message_received_callback(session_request_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_request_message_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	namespace
+	{
+		// The session state blob layout: a cleartext magic and version, a
+		// random IV, the GCM tag, then the AES-256-GCM sealed payload. The
+		// sealing key is derived from the identity private key, so only a
+		// process holding the same identity can read the blob: it never
+		// contains usable key material in the clear.
+		const char SESSION_STATE_MAGIC[8] = { 'F', 'S', 'C', 'P', 'S', 'E', 'S', 'S' };
+		const uint8_t SESSION_STATE_VERSION = 1;
+		const size_t SESSION_STATE_IV_SIZE = 12;
+		const size_t SESSION_STATE_HEADER_SIZE = sizeof(SESSION_STATE_MAGIC) + sizeof(SESSION_STATE_VERSION) + SESSION_STATE_IV_SIZE + GCM_TAG_LENGTH;
+
+		void state_write_uint8(std::vector<uint8_t>& out, uint8_t value)
+		{
+			out.push_back(value);
+		}
+
+		void state_write_uint16(std::vector<uint8_t>& out, uint16_t value)
+		{
+			out.push_back(static_cast<uint8_t>(value >> 8));
+			out.push_back(static_cast<uint8_t>(value));
+		}
+
+		void state_write_uint32(std::vector<uint8_t>& out, uint32_t value)
+		{
+			for (int shift = 24; shift >= 0; shift -= 8)
+			{
+				out.push_back(static_cast<uint8_t>(value >> shift));
+			}
+		}
+
+		void state_write_uint64(std::vector<uint8_t>& out, uint64_t value)
+		{
+			for (int shift = 56; shift >= 0; shift -= 8)
+			{
+				out.push_back(static_cast<uint8_t>(value >> shift));
+			}
+		}
+
+		void state_write_buffer(std::vector<uint8_t>& out, const cryptoplus::buffer& buf)
+		{
+			const uint8_t* const data = cryptoplus::buffer_cast<const uint8_t*>(buf);
+			const size_t size = cryptoplus::buffer_size(buf);
+
+			state_write_uint16(out, static_cast<uint16_t>(size));
+			out.insert(out.end(), data, data + size);
+		}
+
+		void state_write_hash(std::vector<uint8_t>& out, const hash_type& hash)
+		{
+			out.insert(out.end(), hash.data.begin(), hash.data.end());
+		}
+
+		void state_write_endpoint(std::vector<uint8_t>& out, const server::ep_type& ep)
+		{
+			if (ep.address().is_v6())
+			{
+				const boost::asio::ip::address_v6::bytes_type bytes = ep.address().to_v6().to_bytes();
+
+				state_write_uint8(out, 6);
+				out.insert(out.end(), bytes.begin(), bytes.end());
+			}
+			else
+			{
+				const boost::asio::ip::address_v4::bytes_type bytes = ep.address().to_v4().to_bytes();
+
+				state_write_uint8(out, 4);
+				out.insert(out.end(), bytes.begin(), bytes.end());
+			}
+
+			state_write_uint16(out, ep.port());
+		}
+
+		/**
+		 * \brief A bounds-checked reader over a deciphered state payload.
+		 */
+		class state_reader
+		{
+			public:
+
+				state_reader(const uint8_t* data, size_t size) :
+					m_data(data),
+					m_end(data + size)
+				{}
+
+				bool empty() const
+				{
+					return m_data == m_end;
+				}
+
+				uint8_t read_uint8()
+				{
+					require(1);
+
+					return *m_data++;
+				}
+
+				uint16_t read_uint16()
+				{
+					return (static_cast<uint16_t>(read_uint8()) << 8) | read_uint8();
+				}
+
+				uint32_t read_uint32()
+				{
+					return (static_cast<uint32_t>(read_uint16()) << 16) | read_uint16();
+				}
+
+				uint64_t read_uint64()
+				{
+					return (static_cast<uint64_t>(read_uint32()) << 32) | read_uint32();
+				}
+
+				cryptoplus::buffer read_buffer()
+				{
+					const size_t size = read_uint16();
+
+					require(size);
+
+					const cryptoplus::buffer result(m_data, size);
+
+					m_data += size;
+
+					return result;
+				}
+
+				hash_type read_hash()
+				{
+					hash_type result;
+
+					require(result.data.size());
+
+					std::memcpy(result.data.data(), m_data, result.data.size());
+					m_data += result.data.size();
+
+					return result;
+				}
+
+				server::ep_type read_endpoint()
+				{
+					const uint8_t family = read_uint8();
+
+					if (family == 6)
+					{
+						boost::asio::ip::address_v6::bytes_type bytes;
+
+						require(bytes.size());
+
+						std::memcpy(bytes.data(), m_data, bytes.size());
+						m_data += bytes.size();
+
+						return server::ep_type(boost::asio::ip::address_v6(bytes), read_uint16());
+					}
+					else if (family == 4)
+					{
+						boost::asio::ip::address_v4::bytes_type bytes;
+
+						require(bytes.size());
+
+						std::memcpy(bytes.data(), m_data, bytes.size());
+						m_data += bytes.size();
+
+						return server::ep_type(boost::asio::ip::address_v4(bytes), read_uint16());
+					}
+
+					throw std::runtime_error("Unknown address family in the session state");
+				}
+
+			private:
+
+				void require(size_t count)
+				{
+					if (static_cast<size_t>(m_end - m_data) < count)
+					{
+						throw std::runtime_error("Truncated session state");
+					}
+				}
+
+				const uint8_t* m_data;
+				const uint8_t* m_end;
+		};
+
+		cryptoplus::buffer session_state_sealing_key(const identity_store& identity)
+		{
+			// Hash the DER image of the identity private key: the old and
+			// the new processes derive the same sealing key from the
+			// identity they already share, without any extra secret to
+			// hand over.
+			identity_store::key_type key = identity.signature_key();
+
+			unsigned char* der = NULL;
+			const int der_len = ::i2d_PrivateKey(key.raw(), &der);
+
+			if (der_len <= 0)
+			{
+				throw std::runtime_error("Unable to serialize the identity key");
+			}
+
+			const cryptoplus::buffer result = cryptoplus::hash::message_digest(der, static_cast<size_t>(der_len), get_default_digest_algorithm());
+
+			::OPENSSL_cleanse(der, static_cast<size_t>(der_len));
+			::OPENSSL_free(der);
+
+			return result;
+		}
+	}
+
+	void server::do_export_session_state(session_state_handler_type handler)
+	{
+		// All do_export_session_state() calls are done in the session strand so the following is thread-safe.
+		using cryptoplus::buffer_cast;
+		using cryptoplus::buffer_size;
+
+		std::vector<uint8_t> cleartext;
+		size_t count = 0;
+
+		for (auto&& p_session: m_peer_sessions)
+		{
+			peer_session::session_snapshot snapshot;
+
+			if (!p_session.second.make_snapshot(snapshot))
+			{
+				continue;
+			}
+
+			state_write_endpoint(cleartext, p_session.first);
+			state_write_hash(cleartext, snapshot.local_host_identifier);
+			state_write_hash(cleartext, snapshot.remote_host_identifier);
+			state_write_uint8(cleartext, snapshot.remote_capabilities);
+			state_write_uint32(cleartext, snapshot.session_number);
+			state_write_uint8(cleartext, snapshot.cipher_suite.value());
+			state_write_uint8(cleartext, snapshot.elliptic_curve.value());
+			state_write_uint64(cleartext, snapshot.local_sequence_number);
+			state_write_uint64(cleartext, snapshot.remote_sequence_number);
+			state_write_buffer(cleartext, snapshot.local_session_key);
+			state_write_buffer(cleartext, snapshot.remote_session_key);
+			state_write_buffer(cleartext, snapshot.local_nonce_prefix);
+			state_write_buffer(cleartext, snapshot.remote_nonce_prefix);
+			state_write_buffer(cleartext, snapshot.ratchet_secret);
+
+			++count;
+		}
+
+		if (count == 0)
+		{
+			handler(cryptoplus::buffer());
+
+			return;
+		}
+
+		const cryptoplus::buffer key = session_state_sealing_key(m_identity_store);
+		const cryptoplus::buffer iv = cryptoplus::random::get_random_bytes(SESSION_STATE_IV_SIZE);
+
+		const cryptoplus::cipher::cipher_algorithm cipher_algorithm(NID_aes_256_gcm);
+
+		cryptoplus::cipher::cipher_context cipher_context;
+
+		// First initialization - required to set GCM specific attributes
+		cipher_context.initialize(cipher_algorithm, cryptoplus::cipher::cipher_context::encrypt, NULL, 0, NULL);
+		cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(SESSION_STATE_IV_SIZE));
+
+		cipher_context.initialize(cryptoplus::cipher::cipher_algorithm(), cryptoplus::cipher::cipher_context::unchanged, buffer_cast<const void*>(key), buffer_size(key), buffer_cast<const uint8_t*>(iv));
+
+		std::vector<uint8_t> result(SESSION_STATE_HEADER_SIZE + cleartext.size() + cipher_algorithm.block_size());
+
+		uint8_t* out = &result[0];
+
+		std::memcpy(out, SESSION_STATE_MAGIC, sizeof(SESSION_STATE_MAGIC));
+		out += sizeof(SESSION_STATE_MAGIC);
+		*out++ = SESSION_STATE_VERSION;
+		std::memcpy(out, buffer_cast<const uint8_t*>(iv), SESSION_STATE_IV_SIZE);
+		out += SESSION_STATE_IV_SIZE;
+
+		uint8_t* const tag = out;
+		uint8_t* const ciphertext = tag + GCM_TAG_LENGTH;
+		const size_t max_ciphertext_len = result.size() - SESSION_STATE_HEADER_SIZE;
+
+		size_t ciphertext_len = cipher_context.update(ciphertext, max_ciphertext_len, &cleartext[0], cleartext.size());
+		ciphertext_len += cipher_context.finalize(ciphertext + ciphertext_len, max_ciphertext_len - ciphertext_len);
+
+		cipher_context.ctrl(EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag);
+
+		// The payload held the session keys in the clear.
+		::OPENSSL_cleanse(&cleartext[0], cleartext.size());
+
+		m_logger(log_level::information) << "Exported the state of " << count << " established session(s).";
+
+		handler(cryptoplus::buffer(&result[0], SESSION_STATE_HEADER_SIZE + ciphertext_len));
+	}
+
+	void server::do_import_session_state(cryptoplus::buffer state, void_handler_type handler)
+	{
+		// All do_import_session_state() calls are done in the session strand so the following is thread-safe.
+		using cryptoplus::buffer_cast;
+		using cryptoplus::buffer_size;
+
+		try
+		{
+			const uint8_t* const data = buffer_cast<const uint8_t*>(state);
+			const size_t size = buffer_size(state);
+
+			if (size < SESSION_STATE_HEADER_SIZE)
+			{
+				throw std::runtime_error("Truncated session state");
+			}
+
+			if (std::memcmp(data, SESSION_STATE_MAGIC, sizeof(SESSION_STATE_MAGIC)) != 0)
+			{
+				throw std::runtime_error("Not a session state blob");
+			}
+
+			if (data[sizeof(SESSION_STATE_MAGIC)] != SESSION_STATE_VERSION)
+			{
+				throw std::runtime_error("Unsupported session state version");
+			}
+
+			const uint8_t* const iv = data + sizeof(SESSION_STATE_MAGIC) + sizeof(SESSION_STATE_VERSION);
+			const uint8_t* const tag = iv + SESSION_STATE_IV_SIZE;
+			const uint8_t* const ciphertext = tag + GCM_TAG_LENGTH;
+			const size_t ciphertext_len = size - SESSION_STATE_HEADER_SIZE;
+
+			const cryptoplus::buffer key = session_state_sealing_key(m_identity_store);
+
+			const cryptoplus::cipher::cipher_algorithm cipher_algorithm(NID_aes_256_gcm);
+
+			cryptoplus::cipher::cipher_context cipher_context;
+
+			// First initialization - required to set GCM specific attributes
+			cipher_context.initialize(cipher_algorithm, cryptoplus::cipher::cipher_context::decrypt, NULL, 0, NULL);
+			cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(SESSION_STATE_IV_SIZE));
+			cipher_context.ctrl(EVP_CTRL_GCM_SET_TAG, GCM_TAG_LENGTH, const_cast<uint8_t*>(tag));
+
+			cipher_context.initialize(cryptoplus::cipher::cipher_algorithm(), cryptoplus::cipher::cipher_context::unchanged, buffer_cast<const void*>(key), buffer_size(key), iv);
+
+			std::vector<uint8_t> cleartext(ciphertext_len + cipher_algorithm.block_size());
+
+			size_t cleartext_len = cipher_context.update(&cleartext[0], cleartext.size(), ciphertext, ciphertext_len);
+			cleartext_len += cipher_context.finalize(&cleartext[0] + cleartext_len, cleartext.size() - cleartext_len);
+
+			state_reader reader(&cleartext[0], cleartext_len);
+
+			size_t restored = 0;
+			size_t skipped = 0;
+
+			while (!reader.empty())
+			{
+				const ep_type ep = normalize(reader.read_endpoint());
+
+				peer_session::session_snapshot snapshot;
+
+				snapshot.local_host_identifier = reader.read_hash();
+				snapshot.remote_host_identifier = reader.read_hash();
+				snapshot.remote_capabilities = reader.read_uint8();
+				snapshot.session_number = reader.read_uint32();
+				snapshot.cipher_suite = cipher_suite_type(reader.read_uint8());
+				snapshot.elliptic_curve = elliptic_curve_type(reader.read_uint8());
+				snapshot.local_sequence_number = reader.read_uint64();
+				snapshot.remote_sequence_number = reader.read_uint64();
+				snapshot.local_session_key = reader.read_buffer();
+				snapshot.remote_session_key = reader.read_buffer();
+				snapshot.local_nonce_prefix = reader.read_buffer();
+				snapshot.remote_nonce_prefix = reader.read_buffer();
+				snapshot.ratchet_secret = reader.read_buffer();
+
+				peer_session& p_session = session_for(ep);
+
+				if (p_session.restore_from_snapshot(snapshot))
+				{
+					++restored;
+
+					if (m_session_established_handler)
+					{
+						// Upper layers learn about the restored session the
+						// same way they learn about a negotiated one.
+						m_session_established_handler(ep, true, snapshot.cipher_suite, snapshot.elliptic_curve);
+					}
+				}
+				else
+				{
+					// A session was negotiated with this host in the
+					// meantime: the live keys win over the snapshot.
+					++skipped;
+				}
+			}
+
+			::OPENSSL_cleanse(&cleartext[0], cleartext.size());
+
+			m_logger(log_level::information) << "Imported " << restored << " session(s)" << (skipped > 0 ? " (some were skipped in favor of live sessions)" : "") << ".";
+		}
+		catch (const std::exception& ex)
+		{
+			m_logger(log_level::warning) << "Unable to import the session state: " << ex.what() << ".";
+		}
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_send_session(const identity_store& identity, const ep_type& target, const peer_session::session_parameters& parameters)
+	{
+		// All do_send_session() calls are done in the session strand so the following is thread-safe.
+		m_logger(log_level::trace) << "Sending session message to " << target << " (session number: " << parameters.session_number << ", cipher suite: " << parameters.cipher_suite << ", elliptic curve: " << parameters.elliptic_curve << ").";
+
+		peer_session& p_session = session_for(target);
+		const SharedBuffer send_buffer = m_session_buffers.get();
+
+
+		try
+		{
+			size_t size = 0;
+
+			// A peer from before an identity rotation verifies against the
+			// previous certificate: sign with the matching key.
+			const bool use_previous_identity = identity.has_previous_identity() && peer_uses_previous_identity(target);
+			const identity_store::key_type signature_key = use_previous_identity ? identity.previous_signature_key() : identity.signature_key();
+
+			if (!!signature_key)
+			{
+				size = session_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					parameters.session_number,
+					p_session.local_host_identifier(),
+					parameters.cipher_suite,
+					parameters.elliptic_curve,
+					buffer_cast<const void*>(parameters.public_key),
+					buffer_size(parameters.public_key),
+					signature_key
+				);
+			}
+			else
+			{
+				size = session_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					parameters.session_number,
+					p_session.local_host_identifier(),
+					parameters.cipher_suite,
+					parameters.elliptic_curve,
+					buffer_cast<const void*>(parameters.public_key),
+					buffer_size(parameters.public_key),
+					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
+					buffer_size(identity.pre_shared_key())
+				);
+			}
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				[] (const boost::system::error_code&) {}
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			m_logger(log_level::error) << "Error sending session to " << target << ": " << ex.what() << ".";
+		}
+	}
+
+	void server::do_handle_session(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_message& _session_message)
+	{
+		// All do_handle_session() calls are done in the same strand so the following is thread-safe.
+
+		if (!has_presentation_store_for(sender) && !restore_presentation_from_cache(sender))
+		{
+			// No presentation_store for the given host.
+			// We do nothing.
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but no presentation is available. Ignoring.";
+
+			return;
+		}
+
+		// We make sure the signatures matches.
+		bool check_ok = false;
+
+		if (!!m_presentation_store_map[sender].signature_certificate())
+		{
+			check_ok = _session_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key());
+		}
+		else
+		{
+			const auto psk = m_presentation_store_map[sender].pre_shared_key();
+			check_ok = _session_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
+		}
+
+		if (!check_ok)
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with an invalid signature. Ignoring.";
+
+			return;
+		}
+
+		m_session_strand.post(
+			make_shared_buffer_handler(
+				data,
+				boost::bind(
+					&server::do_handle_verified_session,
+					this,
+					identity,
+					sender,
+					_session_message
+				)
+			)
+		);
+	}
+
+	void server::do_handle_verified_session(const identity_store& identity, const ep_type& sender, const session_message& _session_message)
+	{
+		// All do_handle_verified_session() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = session_for(sender);
+
+		if (!p_session.set_first_remote_host_identifier(_session_message.host_identifier()))
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but the host identifier does not match (Received: " << _session_message.host_identifier() << ". Expected: " << *p_session.remote_host_identifier() << "). Ignoring.";
+
+			// The host identifier does not match.
+			return;
+		}
+
+		// A verified SESSION is as good a sign of life as an authenticated
+		// data message: it defers the next keep-alive probe.
+		p_session.keep_alive();
+
+		// Make sure the peer has a deadline on the keep-alive wheel.
+		schedule_keep_alive(sender, keep_alive_interval(sender));
+
+		// The advertised capabilities are remembered before any early return:
+		// they gate optional stages (like compression) once a session forms.
+		p_session.set_remote_session_capabilities(_session_message.capabilities());
+
+		const bool session_is_new = !p_session.has_current_session();
+
+		if (!session_is_new)
+		{
+			if (_session_message.session_number() == p_session.current_session().parameters.session_number)
+			{
+				// The session number matches the current session.
+				if (p_session.current_session().parameters.cipher_suite != _session_message.cipher_suite())
+				{
+					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number but its cipher suite does not match (" << p_session.current_session().parameters.cipher_suite << "): requesting a new session.";
+
+					// The parameters don't match the current session. Requesting a new one.
+					do_request_session(identity, sender, &null_simple_handler);
+				}
+				else
+				{
+					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number and cipher suite. Ignoring.";
+				}
+
+				return;
+			}
+			else if (_session_message.session_number() < p_session.current_session().parameters.session_number)
+			{
+				m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has a higher number (" << p_session.current_session().parameters.session_number << "). Ignoring.";
+
+				// This is an old session message. Ignore it.
+				return;
+			}
+		}
+
+		if (_session_message.cipher_suite() == cipher_suite_type::unsupported)
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but an unsupported cipher suite. Failing session handshake.";
+
+			if (m_session_failed_handler)
+			{
+				m_session_failed_handler(sender, session_is_new);
+			}
+
+			return;
+		}
+
+		bool can_accept = m_accept_session_messages_default;
+
+		if (m_session_message_received_handler)
+		{
+			can_accept = m_session_message_received_handler(sender, _session_message.cipher_suite(), _session_message.elliptic_curve(), can_accept);
+		}
+
+		if (!can_accept)
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but not allowed to accept (`m_accept_session_messages_default` is " << m_accept_session_messages_default << ").";
+		}
+		else
+		{
+			// A session message without a public key is a resumption: the peer
+			// wants to roll the keys forward from the shared ratchet secret.
+			const bool is_resumption = (_session_message.public_key_size() == 0);
+
+			if (is_resumption && !p_session.can_resume_session(_session_message.cipher_suite(), _session_message.elliptic_curve()))
+			{
+				m_logger(log_level::trace) << "Received a resumption SESSION from " << sender << " with session number " << _session_message.session_number() << " but no matching ratchet secret is available. Requesting a full session.";
+
+				do_request_session(identity, sender, &null_simple_handler);
+
+				return;
+			}
+
+			if (is_resumption)
+			{
+				p_session.prepare_session_resumption(_session_message.session_number(), _session_message.cipher_suite(), _session_message.elliptic_curve());
+			}
+			else if (!p_session.has_next_session())
+			{
+				m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but no session was prepared yet. Preparing a new one.";
+
+				// We received a session message but no session was prepared yet: we issue one.
+				p_session.prepare_session(_session_message.session_number(), _session_message.cipher_suite(), _session_message.elliptic_curve(), get_ecdhe_context(_session_message.elliptic_curve()));
+			}
+			else if (p_session.next_session()->is_resumption())
+			{
+				// A resumption was prepared but the peer went for a full
+				// handshake: the full handshake wins, as a resumption cannot
+				// complete without the peer's cooperation.
+				p_session.prepare_session(_session_message.session_number(), _session_message.cipher_suite(), _session_message.elliptic_curve(), get_ecdhe_context(_session_message.elliptic_curve()));
+			}
+
+			const boost::shared_ptr<peer_session::next_session_type> next_session = p_session.next_session();
+
+			if (next_session->derivation_pending)
+			{
+				m_logger(log_level::trace) << "Received a SESSION from " << sender << " while the session keys are already being computed. Ignoring.";
+
+				return;
+			}
+
+			next_session->derivation_pending = true;
+
+			// The key derivation and expansion are expensive: they run outside
+			// of the session strand so several concurrent handshakes can
+			// overlap.
+			if (next_session->is_resumption())
+			{
+				get_io_service().post(
+					boost::bind(
+						&server::do_compute_resumed_session_keys,
+						this,
+						identity,
+						sender,
+						session_is_new,
+						next_session,
+						p_session.local_host_identifier(),
+						*p_session.remote_host_identifier(),
+						p_session.ratchet_secret()
+					)
+				);
+			}
+			else
+			{
+				get_io_service().post(
+					boost::bind(
+						&server::do_compute_session_keys,
+						this,
+						identity,
+						sender,
+						session_is_new,
+						next_session,
+						p_session.local_host_identifier(),
+						*p_session.remote_host_identifier(),
+						cryptoplus::buffer(_session_message.public_key(), _session_message.public_key_size())
+					)
+				);
+			}
+		}
+	}
+
+	void server::do_compute_session_keys(const identity_store& identity, const ep_type& sender, bool session_is_new, boost::shared_ptr<peer_session::next_session_type> next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& remote_public_key)
+	{
+		// This runs outside of any strand: only the next_session instance passed as a parameter may be touched here.
+		try
+		{
+			const boost::shared_ptr<peer_session::current_session_type> _current_session = peer_session::compute_session_keys(*next_session, local_host_identifier, remote_host_identifier, remote_public_key);
+
+			m_session_strand.post(boost::bind(&server::do_install_session_keys, this, identity, sender, session_is_new, next_session, _current_session));
+		}
+		catch (const std::exception& ex)
+		{
+			m_session_strand.post(boost::bind(&server::do_handle_session_keys_failure, this, sender, session_is_new, std::string(ex.what())));
+		}
+	}
+
+	void server::do_compute_resumed_session_keys(const identity_store& identity, const ep_type& sender, bool session_is_new, boost::shared_ptr<peer_session::next_session_type> next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& ratchet_secret)
+	{
+		// This runs outside of any strand: only the next_session instance passed as a parameter may be touched here.
+		try
+		{
+			const boost::shared_ptr<peer_session::current_session_type> _current_session = peer_session::compute_resumed_session_keys(*next_session, local_host_identifier, remote_host_identifier, ratchet_secret);
+
+			m_session_strand.post(boost::bind(&server::do_install_session_keys, this, identity, sender, session_is_new, next_session, _current_session));
+		}
+		catch (const std::exception& ex)
+		{
+			m_session_strand.post(boost::bind(&server::do_handle_session_keys_failure, this, sender, session_is_new, std::string(ex.what())));
+		}
+	}
+
+	void server::do_install_session_keys(const identity_store& identity, const ep_type& sender, bool session_is_new, boost::shared_ptr<peer_session::next_session_type> next_session, boost::shared_ptr<peer_session::current_session_type> _current_session)
+	{
+		// All do_install_session_keys() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = session_for(sender);
+
+		if (!p_session.install_session_keys(next_session, _current_session))
+		{
+			m_logger(log_level::trace) << "Discarding the session keys computed for " << sender << ": another session was prepared in the meantime.";
+
+			return;
+		}
+
+		m_logger(log_level::trace) << "Session established with " << sender << ". Sending acknowledgement session message back.";
+
+		// The stamps are consumed so that a later establishment without a
+		// matching request - such as a remotely initiated renewal - records
+		// nothing.
+		handshake_stamps_type& stamps = handshake_stamps_for(sender);
+		const uint64_t establishment_us = monotonic_us();
+		const uint64_t session_request_us = stamps.session_request_us.exchange(0, std::memory_order_relaxed);
+		const uint64_t hello_sent_us = stamps.hello_sent_us.exchange(0, std::memory_order_relaxed);
+
+		if (session_request_us > 0)
+		{
+			if (session_is_new)
+			{
+				record_handshake_duration(handshake_stage::session_setup, establishment_us - session_request_us);
+
+				if (hello_sent_us > 0)
+				{
+					record_handshake_duration(handshake_stage::total_initial, establishment_us - hello_sent_us);
+				}
+			}
+			else
+			{
+				record_handshake_duration(handshake_stage::renewal, establishment_us - session_request_us);
+			}
+		}
+
+		do_send_session(identity, sender, p_session.current_session_parameters());
+
+		if (m_session_established_handler)
+		{
+			m_session_established_handler(sender, session_is_new, p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
+		}
+	}
+
+	void server::do_handle_session_keys_failure(const ep_type& sender, bool session_is_new, const std::string& error)
+	{
+		// All do_handle_session_keys_failure() calls are done in the session strand so the following is thread-safe.
+		m_logger(log_level::error) << "Exception while computing the session keys with " << sender << ": " << error << ".";
+
+		peer_session& p_session = session_for(sender);
+
+		if (p_session.has_next_session())
+		{
+			// Allow a new SESSION message to restart the computation.
+			p_session.next_session()->derivation_pending = false;
+		}
+
+		if (m_session_error_handler)
+		{
+			m_session_error_handler(sender, session_is_new, std::runtime_error(error));
+		}
+	}
+
+	void server::do_set_accept_session_messages_default(bool value, void_handler_type handler)
+	{
+		// All do_set_accept_session_messages_default() calls are done in the same strand so the following is thread-safe.
+		set_accept_session_messages_default(value);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_message_received_callback(session_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_message_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_failed_callback(session_failed_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_failed_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_failed_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_error_callback(session_error_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_error_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_error_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_established_callback(session_established_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_established_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_established_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_lost_callback(session_lost_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_lost_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_lost_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::set_peer_scheduling_weight(const ep_type& target, size_t weight)
+	{
+		if (weight < 1)
+		{
+			weight = 1;
+		}
+		else if (weight > PEER_SCHEDULING_WEIGHT_MAX)
+		{
+			weight = PEER_SCHEDULING_WEIGHT_MAX;
+		}
+
+		counters_for(target).send_weight.store(static_cast<uint32_t>(weight), std::memory_order_relaxed);
+
+		if (weight > 1)
+		{
+			m_has_prioritized_peers.store(true, std::memory_order_relaxed);
+		}
+	}
+
+	boost::asio::strand& server::data_strand_for(const ep_type& target)
+	{
+		size_t hash = static_cast<size_t>(target.port());
+
+		if (target.address().is_v4())
+		{
+			hash ^= static_cast<size_t>(target.address().to_v4().to_ulong());
+		}
+		else
+		{
+			const boost::asio::ip::address_v6::bytes_type bytes = target.address().to_v6().to_bytes();
+
+			for (size_t i = 0; i < bytes.size(); ++i)
+			{
+				hash = hash * 31 + bytes[i];
+			}
+		}
+
+		size_t base = 0;
+		size_t count = m_data_strands.size();
+
+		// Once some peer is prioritized, the strand pool is partitioned:
+		// the prioritized peers share the first half and everyone else the
+		// rest, so a bulk peer can never queue its ciphering work ahead of
+		// a prioritized peer's.
+		if ((count > 1) && m_has_prioritized_peers.load(std::memory_order_relaxed))
+		{
+			const size_t reserved = count / 2;
+
+			if (counters_for(target).send_weight.load(std::memory_order_relaxed) > 1)
+			{
+				count = reserved;
+			}
+			else
+			{
+				base = reserved;
+				count -= reserved;
+			}
+		}
+
+		return *m_data_strands[base + (hash % count)];
+	}
+
+	void server::do_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
+	{
+		// All do_send_data() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = session_for(target);
+
+		if (m_data_coalescing_enabled && (channel_number == CHANNEL_NUMBER_0) && (boost::asio::buffer_size(data) <= COALESCE_MAX_FRAME_SIZE))
+		{
+			do_coalesce_data(target, p_session, data, handler, tos);
+
+			return;
+		}
+
+		do_send_data_to_session(p_session, target, channel_number, data, handler, tos);
+	}
+
+	void server::do_send_data_in_place(const ep_type& target, channel_number_type channel_number, SharedBuffer data_buffer, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
+	{
+		// All do_send_data_in_place() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = session_for(target);
+
+		if (m_data_coalescing_enabled && (channel_number == CHANNEL_NUMBER_0) && (boost::asio::buffer_size(data) <= COALESCE_MAX_FRAME_SIZE))
+		{
+			// A small frame is copied into the coalescing buffer anyway: the
+			// in-place path has nothing left to save.
+			do_coalesce_data(target, p_session, data, handler, tos);
+
+			return;
+		}
+
+		do_send_data_to_session_in_place(p_session, target, channel_number, data_buffer, data, handler, tos);
+	}
+
+	void server::do_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler, uint8_t tos)
+	{
+		// All do_send_data_to_list() calls are done in the session strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		// The cleartext is staged once in a shared buffer: every per-target
+		// ciphering job reads from it, whatever data strand it runs on, so a
+		// broadcast does a single staging pass however many targets it has.
+		const size_t cleartext_len = boost::asio::buffer_size(data);
+		const SharedBuffer cleartext_buffer = m_session_buffers.get(cleartext_len);
+
+		std::memcpy(buffer_cast<uint8_t*>(cleartext_buffer), boost::asio::buffer_cast<const uint8_t*>(data), cleartext_len);
+
+		// Walking the target list keeps the cost proportional to the list,
+		// not to the total count of known peers.
+		for (auto&& target: targets)
+		{
+			const peer_session_map_type::iterator item = m_peer_sessions.find(target);
+
+			if (item != m_peer_sessions.end())
+			{
+				do_send_data_to_session_staged(item->second, item->first, channel_number, cleartext_buffer, cleartext_len, boost::bind(&results_gatherer_type::gather, rg, item->first, _1), tos);
+			}
+		}
+	}
+
+	void server::do_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler, uint8_t tos)
+	{
+		// All do_send_data_to_all() calls are done in the session strand so the following is thread-safe.
+		do_send_data_to_list(get_session_endpoints(), channel_number, data, handler, tos);
+	}
+
+	void server::do_send_data_to_session_in_place(peer_session& p_session, const ep_type& target, channel_number_type channel_number, SharedBuffer data_buffer, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
+	{
+		// All do_send_data_to_session_in_place() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+#ifdef USE_LZ4
+		if (p_session.compression_enabled())
+		{
+			// In-place ciphering and the compression stage are mutually
+			// exclusive: the compressed payload does not overlay the
+			// original frame, so the generic path stages it instead.
+			do_send_data_to_session(p_session, target, channel_number, data, handler, tos);
+
+			return;
+		}
+#endif
+
+		// Frames already coalescing towards the target must leave first, so
+		// frames bound to a given peer keep their ordering.
+		do_flush_coalesced(target);
+
+		uint8_t* const base = buffer_cast<uint8_t*>(data_buffer);
+		const uint8_t* const cleartext = boost::asio::buffer_cast<const uint8_t*>(data);
+		const size_t cleartext_len = boost::asio::buffer_size(data);
+		const auto cipher_algorithm = p_session.current_session().parameters.cipher_suite.to_cipher_algorithm();
+
+		// The cleartext must lie within the buffer with enough headroom for
+		// the message header and enough tailroom for the cipher block size.
+		// If not, fall back to the regular copying path.
+		if ((cleartext < base + data_message::HEADER_OVERHEAD) || (cleartext + cleartext_len + cipher_algorithm.block_size() > base + buffer_size(data_buffer)))
+		{
+			do_send_data_to_session(p_session, target, channel_number, data, handler, tos);
+
+			return;
+		}
+
+		const size_t pad_to = padded_send_length(p_session, cleartext_len);
+
+		if (pad_to > 0)
+		{
+			// The padding streams into the tail of the buffer, so the
+			// tailroom check extends to the bucket size.
+			if (cleartext + pad_to + cipher_algorithm.block_size() > base + buffer_size(data_buffer))
+			{
+				do_send_data_to_session(p_session, target, channel_number, data, handler, tos);
+
+				return;
+			}
+		}
+
+		const size_t cleartext_offset = cleartext - base;
+
+		p_session.data_sent();
+
+		// As in do_send_data_to_session(), the ciphering and the sending are
+		// deferred to the data strand associated to the target. The arity is
+		// past what boost::bind() carries, so a lambda holds the state.
+		const extended_sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<session_cipher_context> cipher_context = p_session.current_session().local_cipher_context;
+
+		data_strand_for(target).post([this, target, channel_number, sequence_number, cipher_context, data_buffer, cleartext_offset, cleartext_len, pad_to, handler, tos] () {
+			do_encrypt_and_send_data_in_place(target, channel_number, sequence_number, cipher_context, data_buffer, cleartext_offset, cleartext_len, pad_to, handler, tos);
+		});
+	}
+
+	size_t server::padded_send_length(const peer_session& p_session, size_t cleartext_len) const
+	{
+		// Once the padding capability is negotiated, every data message
+		// carries the delimiter so the receiver can strip unconditionally:
+		// the local policy only decides whether the sealed length rounds up
+		// to a size bucket or merely grows by the delimiter byte.
+		if (!p_session.padding_enabled())
+		{
+			return 0;
+		}
+
+		return m_data_padding_enabled ? data_message::padded_length(cleartext_len) : cleartext_len + 1;
+	}
+
+	void server::do_encrypt_and_send_data_in_place(const ep_type& target, channel_number_type channel_number, extended_sequence_number_type sequence_number, boost::shared_ptr<session_cipher_context> cipher_context, SharedBuffer data_buffer, size_t cleartext_offset, size_t cleartext_len, size_t pad_to, simple_handler_type handler, uint8_t tos)
+	{
+		// do_encrypt_and_send_data_in_place() calls run on the data strand associated to the target.
+		try
+		{
+			const size_t size = data_message::write_in_place(
+				buffer_cast<uint8_t*>(data_buffer),
+				buffer_size(data_buffer),
+				cleartext_offset,
+				cleartext_len,
+				channel_number,
+				sequence_number,
+				*cipher_context,
+				pad_to
+			);
+
+			data_buffer.trace_stamp(trace_stage::encrypt);
+
+			async_send_to(
+				data_buffer,
+				cleartext_offset - data_message::HEADER_OVERHEAD,
+				size,
+				target,
+				handler,
+				tos
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_send_data_to_session(peer_session& p_session, const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
+	{
+		// All do_send_data_to_session() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		p_session.data_sent();
+
+		// Frames already coalescing towards the target must leave first, so
+		// frames bound to a given peer keep their ordering.
+		do_flush_coalesced(target);
+
+#ifdef USE_LZ4
+		if (p_session.compression_enabled())
+		{
+			// The cleartext is staged through a compression scratch buffer:
+			// the first byte says whether the rest is LZ4 or raw, so small
+			// and incompressible frames only pay a copy, never an expansion.
+			const uint8_t* const cleartext = boost::asio::buffer_cast<const uint8_t*>(data);
+			const size_t cleartext_len = boost::asio::buffer_size(data);
+			const SharedBuffer staging_buffer = m_session_buffers.get(static_cast<size_t>(LZ4_compressBound(static_cast<int>(cleartext_len))) + 1);
+			uint8_t* const staging = buffer_cast<uint8_t*>(staging_buffer);
+			size_t staged_len = 0;
+
+			int compressed_len = 0;
+
+			if (cleartext_len >= COMPRESSION_THRESHOLD)
+			{
+				compressed_len = ::LZ4_compress_default(reinterpret_cast<const char*>(cleartext), reinterpret_cast<char*>(staging + 1), static_cast<int>(cleartext_len), static_cast<int>(buffer_size(staging_buffer) - 1));
+			}
+
+			if ((compressed_len > 0) && (static_cast<size_t>(compressed_len) < cleartext_len))
+			{
+				staging[0] = 0x01;
+				staged_len = static_cast<size_t>(compressed_len) + 1;
+			}
+			else
+			{
+				staging[0] = 0x00;
+				std::memcpy(staging + 1, cleartext, cleartext_len);
+				staged_len = cleartext_len + 1;
+			}
+
+			const size_t pad_to = padded_send_length(p_session, staged_len);
+
+			const SharedBuffer compressed_send_buffer = m_session_buffers.get(((pad_to > 0) ? pad_to : staged_len) + data_message::HEADER_OVERHEAD);
+
+			// The staging buffer rides along with the completion handler so
+			// it outlives the deferred ciphering. The arity is past what
+			// boost::bind() carries, so a lambda holds the state.
+			const extended_sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+			const boost::shared_ptr<session_cipher_context> cipher_context = p_session.current_session().local_cipher_context;
+			const simple_handler_type staging_handler = make_shared_buffer_handler(staging_buffer, handler);
+
+			data_strand_for(target).post([this, target, channel_number, sequence_number, cipher_context, compressed_send_buffer, staging_buffer, staged_len, pad_to, staging_handler, tos] () {
+				do_encrypt_and_send_data(target, channel_number, sequence_number, cipher_context, compressed_send_buffer, buffer(staging_buffer, staged_len), pad_to, staging_handler, tos);
+			});
+
+			return;
+		}
+#endif
+
+		const size_t pad_to = padded_send_length(p_session, boost::asio::buffer_size(data));
+
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_session_buffers.get(((pad_to > 0) ? pad_to : boost::asio::buffer_size(data)) + data_message::HEADER_OVERHEAD);
+
+		// Defer the ciphering and the sending to the data strand associated
+		// to the target: posts from the session strand are executed in order,
+		// so data messages for a given peer leave with increasing sequence
+		// numbers while different peers cipher in parallel. The arity is
+		// past what boost::bind() carries, so a lambda holds the state.
+		const extended_sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<session_cipher_context> cipher_context = p_session.current_session().local_cipher_context;
+
+		data_strand_for(target).post([this, target, channel_number, sequence_number, cipher_context, send_buffer, data, pad_to, handler, tos] () {
+			do_encrypt_and_send_data(target, channel_number, sequence_number, cipher_context, send_buffer, data, pad_to, handler, tos);
+		});
+	}
+
+	void server::do_send_data_to_session_staged(peer_session& p_session, const ep_type& target, channel_number_type channel_number, SharedBuffer cleartext_buffer, size_t cleartext_len, simple_handler_type handler, uint8_t tos)
+	{
+		// All do_send_data_to_session_staged() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+#ifdef USE_LZ4
+		if (p_session.compression_enabled())
+		{
+			// Peers with the compression stage expect the marker byte: the
+			// generic path stages the frame for them. The staging copy is
+			// made synchronously, so the shared cleartext stays untouched
+			// for the other recipients of the broadcast.
+			do_send_data_to_session(p_session, target, channel_number, buffer(cleartext_buffer, cleartext_len), handler, tos);
+
+			return;
+		}
+#endif
+
+		p_session.data_sent();
+
+		// Frames already coalescing towards the target must leave first, so
+		// frames bound to a given peer keep their ordering.
+		do_flush_coalesced(target);
+
+		const size_t pad_to = padded_send_length(p_session, cleartext_len);
+
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_session_buffers.get(((pad_to > 0) ? pad_to : cleartext_len) + data_message::HEADER_OVERHEAD);
+
+		// As in do_send_data_to_session(), the ciphering and the sending are
+		// deferred to the data strand associated to the target, so the GCM
+		// operations of a broadcast spread over the data strand pool instead
+		// of serializing on one core. The arity is past what boost::bind()
+		// carries, so a lambda holds the state.
+		const extended_sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<session_cipher_context> cipher_context = p_session.current_session().local_cipher_context;
+
+		data_strand_for(target).post([this, target, channel_number, sequence_number, cipher_context, send_buffer, cleartext_buffer, cleartext_len, pad_to, handler, tos] () {
+			do_encrypt_and_send_data_staged(target, channel_number, sequence_number, cipher_context, send_buffer, cleartext_buffer, cleartext_len, pad_to, handler, tos);
+		});
+	}
+
+	void server::do_encrypt_and_send_data_staged(const ep_type& target, channel_number_type channel_number, extended_sequence_number_type sequence_number, boost::shared_ptr<session_cipher_context> cipher_context, SharedBuffer send_buffer, SharedBuffer cleartext_buffer, size_t cleartext_len, size_t pad_to, simple_handler_type handler, uint8_t tos)
+	{
+		// do_encrypt_and_send_data_staged() calls run on the data strand associated to the target.
+		try
+		{
+			const size_t size = data_message::write(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				channel_number,
+				sequence_number,
+				*cipher_context,
+				buffer_cast<const uint8_t*>(cleartext_buffer),
+				cleartext_len,
+				pad_to
+			);
+
+			send_buffer.trace_stamp(trace_stage::encrypt);
+
+			// Broadcast frames are marked droppable: if the queue of a
+			// congested peer overflows, they are the first to be shed.
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler,
+				true,
+				tos
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_encrypt_and_send_data(const ep_type& target, channel_number_type channel_number, extended_sequence_number_type sequence_number, boost::shared_ptr<session_cipher_context> cipher_context, SharedBuffer send_buffer, boost::asio::const_buffer data, size_t pad_to, simple_handler_type handler, uint8_t tos)
+	{
+		// do_encrypt_and_send_data() calls run on the data strand associated to the target.
+		try
+		{
+			const size_t size = data_message::write(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				channel_number,
+				sequence_number,
+				*cipher_context,
+				buffer_cast<const uint8_t*>(data),
+				buffer_size(data),
+				pad_to
+			);
+
+			send_buffer.trace_stamp(trace_stage::encrypt);
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler,
+				false,
+				tos
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_coalesce_data(const ep_type& target, peer_session& p_session, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
+	{
+		// All do_coalesce_data() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		coalesce_context_type& context = m_coalesce_contexts[target];
+
+		const size_t frame_len = boost::asio::buffer_size(data);
+
+		if (!context.empty() && (context.size + sizeof(uint16_t) + frame_len > COALESCE_MAX_PAYLOAD_SIZE))
+		{
+			do_flush_coalesced(target);
+		}
+
+		if (!context.buffer)
+		{
+			// Get either a new buffer or an old, recycled one if possible.
+			context.buffer = m_session_buffers.get(COALESCE_MAX_PAYLOAD_SIZE);
+		}
+
+		// The frame is staged as a length-prefixed record.
+		uint8_t* const payload = buffer_cast<uint8_t*>(*context.buffer);
+		const uint16_t frame_len_n = htons(static_cast<uint16_t>(frame_len));
+
+		std::memcpy(payload + context.size, &frame_len_n, sizeof(frame_len_n));
+		std::memcpy(payload + context.size + sizeof(frame_len_n), boost::asio::buffer_cast<const uint8_t*>(data), frame_len);
+
+		context.size += sizeof(frame_len_n) + frame_len;
+		context.handlers.push_back(handler);
+
+		// The coalesced datagram carries the highest mark of its frames:
+		// remarking a best-effort companion upwards is preferable to losing
+		// the mark of an interactive one.
+		context.tos = std::max(context.tos, tos);
+
+		if (context.handlers.size() >= COALESCE_MAX_FRAME_COUNT)
+		{
+			do_flush_coalesced(target);
+
+			return;
+		}
+
+		if (!m_coalesce_flush_pending)
+		{
+			// The first frame of a batch arms the flush timer: whatever
+			// coalesced when it fires leaves, so no frame ever waits for
+			// companions longer than the flush delay.
+			m_coalesce_flush_pending = true;
+
+			m_coalesce_timer.expires_from_now(COALESCE_FLUSH_DELAY);
+			m_coalesce_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_flush_all_coalesced, this, boost::asio::placeholders::error)));
+		}
+	}
+
+	void server::do_flush_coalesced(const ep_type& target)
+	{
+		// All do_flush_coalesced() calls are done in the session strand so the following is thread-safe.
+		const coalesce_context_map::iterator context_it = m_coalesce_contexts.find(target);
+
+		if ((context_it == m_coalesce_contexts.end()) || context_it->second.empty())
+		{
+			return;
+		}
+
+		coalesce_context_type& context = context_it->second;
+
+		const SharedBuffer cleartext_buffer = *context.buffer;
+		const size_t cleartext_len = context.size;
+		const uint8_t tos = context.tos;
+		std::vector<simple_handler_type> handlers;
+
+		handlers.swap(context.handlers);
+		context.buffer = boost::none;
+		context.size = 0;
+		context.tos = 0;
+
+		// A single send callback fans its result out to the handler of every
+		// coalesced frame.
+		const simple_handler_type handler = [handlers] (const boost::system::error_code& ec) {
+			for (auto&& frame_handler : handlers)
+			{
+				frame_handler(ec);
+			}
+		};
+
+		peer_session& p_session = session_for(target);
+
+		if (!p_session.has_current_session())
+		{
+			// The session was lost while the frames were coalescing.
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		p_session.data_sent();
+
+		const size_t pad_to = padded_send_length(p_session, cleartext_len);
+
+		// Get either a new buffer or an old, recycled one if possible. A
+		// full batch may round up past COALESCE_MAX_PAYLOAD_SIZE, so the
+		// buffer is sized on the bucket.
+		const SharedBuffer send_buffer = m_session_buffers.get(((pad_to > COALESCE_MAX_PAYLOAD_SIZE) ? pad_to : COALESCE_MAX_PAYLOAD_SIZE) + data_message::HEADER_OVERHEAD);
+
+		// As in do_send_data_to_session(), the ciphering and the sending are
+		// deferred to the data strand associated to the target. The arity
+		// is past what boost::bind() carries, so a lambda holds the state.
+		const extended_sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<session_cipher_context> cipher_context = p_session.current_session().local_cipher_context;
+
+		data_strand_for(target).post([this, target, sequence_number, cipher_context, send_buffer, cleartext_buffer, cleartext_len, pad_to, handler, tos] () {
+			do_encrypt_and_send_data_coalesced(target, sequence_number, cipher_context, send_buffer, cleartext_buffer, cleartext_len, pad_to, handler, tos);
+		});
+	}
+
+	void server::do_flush_all_coalesced(const boost::system::error_code& ec)
+	{
+		// All do_flush_all_coalesced() calls are done in the session strand so the following is thread-safe.
+		m_coalesce_flush_pending = false;
+
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			// The timer was cancelled: the server is closing and the staged
+			// frames will never leave.
+			for (auto&& context : m_coalesce_contexts)
+			{
+				for (auto&& frame_handler : context.second.handlers)
+				{
+					frame_handler(server_error::server_offline);
+				}
+
+				context.second.handlers.clear();
+				context.second.buffer = boost::none;
+				context.second.size = 0;
+				context.second.tos = 0;
+			}
+
+			return;
+		}
+
+		for (auto&& context : m_coalesce_contexts)
+		{
+			do_flush_coalesced(context.first);
+		}
+	}
+
+	void server::do_encrypt_and_send_data_coalesced(const ep_type& target, extended_sequence_number_type sequence_number, boost::shared_ptr<session_cipher_context> cipher_context, SharedBuffer send_buffer, SharedBuffer cleartext_buffer, size_t cleartext_len, size_t pad_to, simple_handler_type handler, uint8_t tos)
+	{
+		// do_encrypt_and_send_data_coalesced() calls run on the data strand associated to the target.
+		try
+		{
+			const size_t size = data_message::write_coalesced(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				sequence_number,
+				*cipher_context,
+				buffer_cast<const uint8_t*>(cleartext_buffer),
+				cleartext_len,
+				pad_to
+			);
+
+			send_buffer.trace_stamp(trace_stage::encrypt);
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler,
+				false,
+				tos
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_send_reliable_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler, uint8_t tos)
+	{
+		// All do_send_reliable_data() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		const size_t length = boost::asio::buffer_size(data);
+
+		size_t segment_count = (length + RELIABLE_SEGMENT_SIZE - 1) / RELIABLE_SEGMENT_SIZE;
+
+		if (segment_count == 0)
+		{
+			// An empty message still takes one (empty) segment, so it gets
+			// acknowledged like any other.
+			segment_count = 1;
+		}
+
+		if (segment_count > RELIABLE_MAX_SEGMENT_COUNT)
+		{
+			handler(boost::asio::error::message_size);
+
+			return;
+		}
+
+		reliable_context_type& context = m_reliable_contexts[target];
+
+		uint16_t message_id = context.next_message_id++;
+
+		// An identifier still in flight is skipped: this only matters once
+		// the 16-bit counter wraps around a very long-lived transfer.
+		while (context.outgoing.find(message_id) != context.outgoing.end())
+		{
+			message_id = context.next_message_id++;
+		}
+
+		reliable_transfer_type& transfer = context.outgoing[message_id];
+
+		// The message is staged so the retransmissions never depend on the
+		// caller's buffer.
+		const SharedBuffer staging_buffer = m_session_buffers.get(length + 1);
+
+		if (length > 0)
+		{
+			std::memcpy(buffer_cast<uint8_t*>(staging_buffer), boost::asio::buffer_cast<const uint8_t*>(data), length);
+		}
+
+		transfer.channel_number = channel_number;
+		transfer.buffer = staging_buffer;
+		transfer.length = length;
+		transfer.segment_count = static_cast<uint16_t>(segment_count);
+		transfer.acked.assign(segment_count, false);
+		transfer.acked_count = 0;
+		transfer.attempts_left = RELIABLE_MAX_ATTEMPTS;
+		transfer.ticks_before_retransmit = RELIABLE_INITIAL_BACKOFF_TICKS;
+		transfer.backoff_ticks = RELIABLE_INITIAL_BACKOFF_TICKS;
+		transfer.handler = handler;
+		transfer.tos = tos;
+
+		for (uint16_t segment_index = 0; segment_index < transfer.segment_count; ++segment_index)
+		{
+			do_send_reliable_segment(target, transfer, message_id, segment_index);
+		}
+
+		arm_reliable_timer();
+	}
+
+	void server::do_send_reliable_segment(const ep_type& target, const reliable_transfer_type& transfer, uint16_t message_id, uint16_t segment_index)
+	{
+		// All do_send_reliable_segment() calls are done in the session strand so the following is thread-safe.
+		const size_t offset = static_cast<size_t>(segment_index) * RELIABLE_SEGMENT_SIZE;
+		const size_t payload_len = ((transfer.length - offset) < RELIABLE_SEGMENT_SIZE) ? (transfer.length - offset) : RELIABLE_SEGMENT_SIZE;
+
+		const SharedBuffer frame_buffer = m_session_buffers.get(RELIABLE_DATA_HEADER_SIZE + payload_len);
+		uint8_t* const frame = buffer_cast<uint8_t*>(frame_buffer);
+
+		const uint16_t message_id_n = htons(message_id);
+		const uint16_t segment_index_n = htons(segment_index);
+		const uint16_t segment_count_n = htons(transfer.segment_count);
+
+		frame[0] = RELIABLE_FRAME_DATA;
+		std::memcpy(frame + 1, &message_id_n, sizeof(message_id_n));
+		std::memcpy(frame + 3, &segment_index_n, sizeof(segment_index_n));
+		std::memcpy(frame + 5, &segment_count_n, sizeof(segment_count_n));
+
+		if (payload_len > 0)
+		{
+			std::memcpy(frame + RELIABLE_DATA_HEADER_SIZE, buffer_cast<const uint8_t*>(*transfer.buffer) + offset, payload_len);
+		}
+
+		// Loss is handled by the retransmission timer: the send result of
+		// an individual segment carries no information.
+		do_send_data_to_session_staged(session_for(target), target, transfer.channel_number, frame_buffer, RELIABLE_DATA_HEADER_SIZE + payload_len, [] (const boost::system::error_code&) {}, transfer.tos);
+	}
+
+	void server::do_send_reliable_sack(const ep_type& target, channel_number_type channel_number, uint16_t message_id, const reliable_reassembly_type& reassembly)
+	{
+		// All do_send_reliable_sack() calls are done in the session strand so the following is thread-safe.
+		const SharedBuffer frame_buffer = m_session_buffers.get(RELIABLE_SACK_HEADER_SIZE + RELIABLE_MAX_SACK_BLOCKS * 2 * sizeof(uint16_t));
+		uint8_t* const frame = buffer_cast<uint8_t*>(frame_buffer);
+
+		const uint16_t message_id_n = htons(message_id);
+
+		frame[0] = RELIABLE_FRAME_SACK;
+		std::memcpy(frame + 1, &message_id_n, sizeof(message_id_n));
+
+		// The blocks cover the received segment ranges, earliest first. A
+		// reassembly too fragmented to fit the block budget just gets its
+		// tail acknowledged on a later round.
+		uint8_t block_count = 0;
+		size_t frame_len = RELIABLE_SACK_HEADER_SIZE;
+		uint16_t segment_index = 0;
+
+		while ((segment_index < reassembly.segment_count) && (block_count < RELIABLE_MAX_SACK_BLOCKS))
+		{
+			if (!reassembly.received[segment_index])
+			{
+				++segment_index;
+
+				continue;
+			}
+
+			const uint16_t block_start = segment_index;
+
+			while ((segment_index < reassembly.segment_count) && reassembly.received[segment_index])
+			{
+				++segment_index;
+			}
+
+			const uint16_t block_start_n = htons(block_start);
+			const uint16_t block_end_n = htons(static_cast<uint16_t>(segment_index - 1));
+
+			std::memcpy(frame + frame_len, &block_start_n, sizeof(block_start_n));
+			std::memcpy(frame + frame_len + sizeof(block_start_n), &block_end_n, sizeof(block_end_n));
+
+			frame_len += 2 * sizeof(uint16_t);
+			++block_count;
+		}
+
+		frame[RELIABLE_SACK_HEADER_SIZE - 1] = block_count;
+
+		do_send_data_to_session_staged(session_for(target), target, channel_number, frame_buffer, frame_len, [] (const boost::system::error_code&) {}, 0);
+	}
+
+	void server::do_handle_reliable_frame(const ep_type& sender, channel_number_type channel_number, boost::asio::const_buffer data)
+	{
+		// All do_handle_reliable_frame() calls are done in the same strand as do_handle_data_message() so the following is thread-safe.
+		const uint8_t* const frame = boost::asio::buffer_cast<const uint8_t*>(data);
+		const size_t frame_len = boost::asio::buffer_size(data);
+
+		if (frame_len < 1)
+		{
+			return;
+		}
+
+		if (frame[0] == RELIABLE_FRAME_DATA)
+		{
+			if (frame_len < RELIABLE_DATA_HEADER_SIZE)
+			{
+				return;
+			}
+
+			uint16_t message_id_n;
+			uint16_t segment_index_n;
+			uint16_t segment_count_n;
+
+			std::memcpy(&message_id_n, frame + 1, sizeof(message_id_n));
+			std::memcpy(&segment_index_n, frame + 3, sizeof(segment_index_n));
+			std::memcpy(&segment_count_n, frame + 5, sizeof(segment_count_n));
+
+			const uint16_t message_id = ntohs(message_id_n);
+			const uint16_t segment_index = ntohs(segment_index_n);
+			const uint16_t segment_count = ntohs(segment_count_n);
+
+			const size_t payload_len = frame_len - RELIABLE_DATA_HEADER_SIZE;
+
+			// Every segment but the last must be full, so the reassembly
+			// offsets are unambiguous.
+			if ((segment_count == 0) || (segment_count > RELIABLE_MAX_SEGMENT_COUNT) || (segment_index >= segment_count) || (payload_len > RELIABLE_SEGMENT_SIZE) || ((segment_index + 1 < segment_count) && (payload_len != RELIABLE_SEGMENT_SIZE)))
+			{
+				FSCP_LOG_LIMITED(m_logger, log_level::warning) << "Discarding a malformed reliable segment from " << sender << ".";
+
+				return;
+			}
+
+			reliable_context_type& context = m_reliable_contexts[sender];
+			reliable_reassembly_type& reassembly = context.incoming[message_id];
+
+			reassembly.ticks_to_live = RELIABLE_REASSEMBLY_TTL_TICKS;
+
+			if (reassembly.delivered)
+			{
+				// A late retransmission of a delivered message: only the
+				// acknowledgment is repeated.
+				do_send_reliable_sack(sender, channel_number, message_id, reassembly);
+
+				arm_reliable_timer();
+
+				return;
+			}
+
+			if (!reassembly.buffer)
+			{
+				reassembly.buffer = m_session_buffers.get(static_cast<size_t>(segment_count) * RELIABLE_SEGMENT_SIZE + 1);
+				reassembly.segment_count = segment_count;
+				reassembly.received.assign(segment_count, false);
+			}
+			else if (reassembly.segment_count != segment_count)
+			{
+				FSCP_LOG_LIMITED(m_logger, log_level::warning) << "Discarding a reliable segment from " << sender << " that contradicts its message.";
+
+				return;
+			}
+
+			if (!reassembly.received[segment_index])
+			{
+				std::memcpy(buffer_cast<uint8_t*>(*reassembly.buffer) + static_cast<size_t>(segment_index) * RELIABLE_SEGMENT_SIZE, frame + RELIABLE_DATA_HEADER_SIZE, payload_len);
+
+				reassembly.received[segment_index] = true;
+				++reassembly.received_count;
+
+				if (segment_index + 1 == segment_count)
+				{
+					reassembly.has_last = true;
+					reassembly.length = static_cast<size_t>(segment_index) * RELIABLE_SEGMENT_SIZE + payload_len;
+				}
+			}
+
+			if (reassembly.has_last && (reassembly.received_count == reassembly.segment_count))
+			{
+				reassembly.delivered = true;
+
+				frame_recorder::record(trace_point::server_receive, frame_verdict::forwarded, frame_recorder::to_peer_id(sender), reassembly.length);
+
+				if (m_data_received_handler)
+				{
+					m_data_received_handler(sender, channel_number, *reassembly.buffer, boost::asio::buffer(buffer_cast<const uint8_t*>(*reassembly.buffer), reassembly.length));
+				}
+			}
+
+			do_send_reliable_sack(sender, channel_number, message_id, reassembly);
+
+			arm_reliable_timer();
+		}
+		else if (frame[0] == RELIABLE_FRAME_SACK)
+		{
+			if (frame_len < RELIABLE_SACK_HEADER_SIZE)
+			{
+				return;
+			}
+
+			uint16_t message_id_n;
+
+			std::memcpy(&message_id_n, frame + 1, sizeof(message_id_n));
+
+			const uint16_t message_id = ntohs(message_id_n);
+			const uint8_t block_count = frame[RELIABLE_SACK_HEADER_SIZE - 1];
+
+			if (frame_len < RELIABLE_SACK_HEADER_SIZE + static_cast<size_t>(block_count) * 2 * sizeof(uint16_t))
+			{
+				return;
+			}
+
+			const reliable_context_map::iterator context_it = m_reliable_contexts.find(sender);
+
+			if (context_it == m_reliable_contexts.end())
+			{
+				return;
+			}
+
+			const std::map<uint16_t, reliable_transfer_type>::iterator transfer_it = context_it->second.outgoing.find(message_id);
+
+			if (transfer_it == context_it->second.outgoing.end())
+			{
+				// The transfer completed or gave up already.
+				return;
+			}
+
+			reliable_transfer_type& transfer = transfer_it->second;
+
+			for (size_t block = 0; block < block_count; ++block)
+			{
+				uint16_t block_start_n;
+				uint16_t block_end_n;
+
+				std::memcpy(&block_start_n, frame + RELIABLE_SACK_HEADER_SIZE + block * 2 * sizeof(uint16_t), sizeof(block_start_n));
+				std::memcpy(&block_end_n, frame + RELIABLE_SACK_HEADER_SIZE + block * 2 * sizeof(uint16_t) + sizeof(block_start_n), sizeof(block_end_n));
+
+				const uint16_t block_start = ntohs(block_start_n);
+				const uint16_t block_end = ntohs(block_end_n);
+
+				for (uint16_t segment_index = block_start; (segment_index <= block_end) && (segment_index < transfer.segment_count); ++segment_index)
+				{
+					if (!transfer.acked[segment_index])
+					{
+						transfer.acked[segment_index] = true;
+						++transfer.acked_count;
+					}
+				}
+			}
+
+			if (transfer.acked_count == transfer.segment_count)
+			{
+				const simple_handler_type handler = transfer.handler;
+
+				context_it->second.outgoing.erase(transfer_it);
+
+				handler(boost::system::error_code());
+			}
+		}
+	}
+
+	void server::do_check_reliable_transfers(const boost::system::error_code& ec)
+	{
+		// All do_check_reliable_transfers() calls are done in the session strand so the following is thread-safe.
+		m_reliable_timer_pending = false;
+
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			// The timer was cancelled: the server is closing and the
+			// pending transfers will never complete.
+			for (auto&& context : m_reliable_contexts)
+			{
+				for (auto&& transfer : context.second.outgoing)
+				{
+					transfer.second.handler(server_error::server_offline);
+				}
+			}
+
+			m_reliable_contexts.clear();
+
+			return;
+		}
+
+		for (reliable_context_map::iterator context_it = m_reliable_contexts.begin(); context_it != m_reliable_contexts.end(); )
+		{
+			reliable_context_type& context = context_it->second;
+
+			for (std::map<uint16_t, reliable_transfer_type>::iterator transfer_it = context.outgoing.begin(); transfer_it != context.outgoing.end(); )
+			{
+				reliable_transfer_type& transfer = transfer_it->second;
+
+				if (--transfer.ticks_before_retransmit > 0)
+				{
+					++transfer_it;
+
+					continue;
+				}
+
+				if (transfer.attempts_left == 0)
+				{
+					const simple_handler_type handler = transfer.handler;
+
+					context.outgoing.erase(transfer_it++);
+
+					handler(server_error::reliable_send_timed_out);
+
+					continue;
+				}
+
+				--transfer.attempts_left;
+
+				// Only the unacknowledged segments are retransmitted, with
+				// an exponential backoff between the rounds.
+				for (uint16_t segment_index = 0; segment_index < transfer.segment_count; ++segment_index)
+				{
+					if (!transfer.acked[segment_index])
+					{
+						do_send_reliable_segment(context_it->first, transfer, transfer_it->first, segment_index);
+					}
+				}
+
+				transfer.backoff_ticks = ((transfer.backoff_ticks * 2) > RELIABLE_MAX_BACKOFF_TICKS) ? RELIABLE_MAX_BACKOFF_TICKS : (transfer.backoff_ticks * 2);
+				transfer.ticks_before_retransmit = transfer.backoff_ticks;
+
+				++transfer_it;
+			}
+
+			for (std::map<uint16_t, reliable_reassembly_type>::iterator reassembly_it = context.incoming.begin(); reassembly_it != context.incoming.end(); )
+			{
+				if (--reassembly_it->second.ticks_to_live == 0)
+				{
+					context.incoming.erase(reassembly_it++);
+				}
+				else
+				{
+					++reassembly_it;
+				}
+			}
+
+			if (context.empty())
+			{
+				m_reliable_contexts.erase(context_it++);
+			}
+			else
+			{
+				++context_it;
+			}
+		}
+
+		if (!m_reliable_contexts.empty())
+		{
+			arm_reliable_timer();
+		}
+	}
+
+	void server::arm_reliable_timer()
+	{
+		// All arm_reliable_timer() calls are done in the session strand so the following is thread-safe.
+		if (m_reliable_timer_pending)
+		{
+			return;
+		}
+
+		m_reliable_timer_pending = true;
+
+		m_reliable_timer.expires_from_now(RELIABLE_TICK_PERIOD);
+		m_reliable_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_reliable_transfers, this, boost::asio::placeholders::error)));
+	}
+
+	void server::do_send_contact_request(const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
+	{
+		// All do_send_contact_request() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = session_for(target);
+
+		do_send_contact_request_to_session(p_session, target, hash_list, handler);
+	}
+
+	void server::do_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_request_to_list() calls are done in the same strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		for (auto&& item: m_peer_sessions)
+		{
+			if (targets.count(item.first) > 0)
+			{
+				do_send_contact_request_to_session(item.second, item.first, hash_list, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+			}
+		}
+	}
+
+	void server::do_send_contact_request_to_all(const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_request_to_all() calls are done in the same strand so the following is thread-safe.
+		do_send_contact_request_to_list(get_session_endpoints(), hash_list, handler);
+	}
+
+	void server::do_send_contact_request_to_session(peer_session& p_session, const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
+	{
+		// All do_send_contact_request_to_session() calls are done in the same strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_session_buffers.get();
+
+		try
+		{
+			const size_t size = data_message::write_contact_request(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				p_session.increment_local_sequence_number(),
+				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
+				hash_list,
+				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
+				buffer_size(p_session.current_session().local_session_key),
+				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
+				buffer_size(p_session.current_session().local_nonce_prefix)
+			);
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_send_contact(const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
+	{
+		// All do_send_contact() calls are done in the same strand so the following is thread-safe.
+		peer_session& p_session = session_for(target);
+
+		do_send_contact_to_session(p_session, target, contact_map, handler);
+	}
+
+	void server::do_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_to_list() calls are done in the same strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		for (auto&& item: m_peer_sessions)
+		{
+			if (targets.count(item.first) > 0)
+			{
+				do_send_contact_to_session(item.second, item.first, contact_map, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+			}
+		}
+	}
+
+	void server::do_send_contact_to_all(const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_to_all() calls are done in the same strand so the following is thread-safe.
+		do_send_contact_to_list(get_session_endpoints(), contact_map, handler);
+	}
+
+	void server::do_send_contact_list(const ep_type& target, const contact_list_type& contact_list, simple_handler_type handler)
+	{
+		// All do_send_contact_list() calls are done in the same strand so the following is thread-safe.
+		peer_session& p_session = session_for(target);
+
+		do_send_contact_to_session(p_session, target, contact_list, handler);
+	}
+
+	void server::do_send_contact_to_session(peer_session& p_session, const ep_type& target, const contact_list_type& contact_list, simple_handler_type handler)
+	{
+		// All do_send_contact_to_session() calls are done in the same strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_session_buffers.get();
+
+		try
+		{
+			const size_t size = data_message::write_contact(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				p_session.increment_local_sequence_number(),
+				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
+				contact_list,
+				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
+				buffer_size(p_session.current_session().local_session_key),
+				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
+				buffer_size(p_session.current_session().local_nonce_prefix)
+			);
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler
+			);
+		}
+		catch (const boost::system::system_error& ex)
 		{
-			handler();
+			handler(ex.code());
 		}
 	}
 
-	void server::do_send_session(const identity_store& identity, const ep_type& target, const peer_session::session_parameters& parameters)
+	void server::do_send_contact_to_session(peer_session& p_session, const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
 	{
-		// All do_send_session() calls are done in the session strand so the following is thread-safe.
-		m_logger(log_level::trace) << "Sending session message to " << target << " (session number: " << parameters.session_number << ", cipher suite: " << parameters.cipher_suite << ", elliptic curve: " << parameters.elliptic_curve << ").";
+		// All do_send_contact_to_session() calls are done in the same strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
 
-		peer_session& p_session = m_peer_sessions[target];
-		const SharedBuffer send_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
+			return;
+		}
 
-			return result;
-		}();
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
 
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_session_buffers.get();
 
 		try
 		{
-			size_t size = 0;
-
-			if (!!identity.signature_key())
-			{
-				size = session_message::write(
-					buffer_cast<uint8_t*>(send_buffer),
-					buffer_size(send_buffer),
-					parameters.session_number,
-					p_session.local_host_identifier(),
-					parameters.cipher_suite,
-					parameters.elliptic_curve,
-					buffer_cast<const void*>(parameters.public_key),
-					buffer_size(parameters.public_key),
-					identity.signature_key()
-				);
-			}
-			else
-			{
-				size = session_message::write(
-					buffer_cast<uint8_t*>(send_buffer),
-					buffer_size(send_buffer),
-					parameters.session_number,
-					p_session.local_host_identifier(),
-					parameters.cipher_suite,
-					parameters.elliptic_curve,
-					buffer_cast<const void*>(parameters.public_key),
-					buffer_size(parameters.public_key),
-					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
-					buffer_size(identity.pre_shared_key())
-				);
-			}
+			const size_t size = data_message::write_contact(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				p_session.increment_local_sequence_number(),
+				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
+				contact_map,
+				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
+				buffer_size(p_session.current_session().local_session_key),
+				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
+				buffer_size(p_session.current_session().local_nonce_prefix)
+			);
 
 			async_send_to(
-				SharedBuffer(send_buffer, [this](const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer]() {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
+				send_buffer,
 				size,
 				target,
-				[] (const boost::system::error_code&) {}
+				handler
 			);
 		}
 		catch (const boost::system::system_error& ex)
 		{
-			m_logger(log_level::error) << "Error sending session to " << target << ": " << ex.what() << ".";
+			handler(ex.code());
 		}
 	}
 
-	void server::do_handle_session(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_message& _session_message)
+	void server::do_handle_data(const identity_store& identity, const ep_type& sender, SharedBuffer data, const data_message& _data_message)
 	{
-		// All do_handle_session() calls are done in the same strand so the following is thread-safe.
+		// All do_handle_data() calls are done in the same strand so the following is thread-safe.
+		peer_session& p_session = session_for(sender);
 
-		if (!has_presentation_store_for(sender))
+		if (!p_session.has_current_session())
 		{
-			// No presentation_store for the given host.
-			// We do nothing.
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but no presentation is available. Ignoring.";
+			FSCP_LOG(m_logger, log_level::trace) << "Received a data message from " << sender << " but no session exists. Ignoring.";
 
 			return;
 		}
 
-		// We make sure the signatures matches.
-		bool check_ok = false;
-
-		if (!!m_presentation_store_map[sender].signature_certificate())
-		{
-			check_ok = _session_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key());
-		}
-		else
-		{
-			const auto psk = m_presentation_store_map[sender].pre_shared_key();
-			check_ok = _session_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
-		}
-
-		if (!check_ok)
-		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with an invalid signature. Ignoring.";
-
-			return;
-		}
+		// Only the low 32 bits of the sequence number travel on the wire: the
+		// high bits are inferred from the replay window top, IPsec ESN style.
+		const extended_sequence_number_type sequence_number = p_session.reconstruct_sequence_number(_data_message.sequence_number());
 
-		m_session_strand.post(
-			make_shared_buffer_handler(
-				data,
-				boost::bind(
-					&server::do_handle_verified_session,
-					this,
-					identity,
-					sender,
-					_session_message
-				)
-			)
-		);
-	}
+		decryption_epoch epoch = { p_session.current_session().parameters.session_number, p_session.current_session().remote_cipher_context, sequence_number };
+		decryption_epoch fallback_epoch = { 0, boost::shared_ptr<session_cipher_context>(), 0 };
 
-	void server::do_handle_verified_session(const identity_store& identity, const ep_type& sender, const session_message& _session_message)
-	{
-		// All do_handle_verified_session() calls are done in the session strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[sender];
+		// After a renewal, data messages ciphered with the previous epoch
+		// keys may still be in flight: during the grace period they are
+		// tried against the previous session instead of being dropped.
+		const auto previous_session = p_session.previous_session();
 
-		if (!p_session.set_first_remote_host_identifier(_session_message.host_identifier()))
+		if (previous_session)
 		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but the host identifier does not match (Received: " << _session_message.host_identifier() << ". Expected: " << *p_session.remote_host_identifier() << "). Ignoring.";
+			const extended_sequence_number_type previous_sequence_number = peer_session::reconstruct_sequence_number(*previous_session, _data_message.sequence_number());
 
-			// The host identifier does not match.
-			return;
+			if (peer_session::is_acceptable_sequence_number(*previous_session, previous_sequence_number))
+			{
+				fallback_epoch.session_number = previous_session->parameters.session_number;
+				fallback_epoch.cipher_context = previous_session->remote_cipher_context;
+				fallback_epoch.sequence_number = previous_sequence_number;
+			}
 		}
 
-		const bool session_is_new = !p_session.has_current_session();
-
-		if (!session_is_new)
+		if (!p_session.is_acceptable_sequence_number(sequence_number))
 		{
-			if (_session_message.session_number() == p_session.current_session().parameters.session_number)
+			if (!fallback_epoch.cipher_context)
 			{
-				// The session number matches the current session.
-				if (p_session.current_session().parameters.cipher_suite != _session_message.cipher_suite())
-				{
-					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number but its cipher suite does not match (" << p_session.current_session().parameters.cipher_suite << "): requesting a new session.";
+				// The message is a duplicate or fell out of the replay window: we ignore it.
+				FSCP_LOG(m_logger, log_level::trace) << "Received a data message from " << sender << " but its sequence number was rejected by the replay window (received: " << sequence_number << ", window top: " << p_session.current_session().remote_sequence_number << "). Ignoring.";
 
-					// The parameters don't match the current session. Requesting a new one.
-					do_request_session(identity, sender, &null_simple_handler);
-				}
-				else
-				{
-					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number and cipher suite. Ignoring.";
-				}
+				counters_for(sender).replay_drops.fetch_add(1, std::memory_order_relaxed);
 
 				return;
 			}
-			else if (_session_message.session_number() < p_session.current_session().parameters.session_number)
-			{
-				m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has a higher number (" << p_session.current_session().parameters.session_number << "). Ignoring.";
 
-				// This is an old session message. Ignore it.
-				return;
-			}
+			// Only the previous epoch can accept the message.
+			epoch = fallback_epoch;
+			fallback_epoch.cipher_context.reset();
 		}
 
-		if (_session_message.cipher_suite() == cipher_suite_type::unsupported)
-		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but an unsupported cipher suite. Failing session handshake.";
+		// The decipher pipeline depth is bounded per peer: when the data
+		// strand falls behind a fast sender, the overflow is dropped here,
+		// while the datagram is still cheap, rather than queued into an
+		// unbounded decipher backlog. Only this strand increments the
+		// gauge, so the load-then-add below does not race.
+		atomic_peer_counters_type& counters = counters_for(sender);
 
-			if (m_session_failed_handler)
-			{
-				m_session_failed_handler(sender, session_is_new);
-			}
+		if (counters.decrypt_inflight.load(std::memory_order_relaxed) >= MAX_INFLIGHT_DECRYPTS)
+		{
+			counters.decrypt_backlog_drops.fetch_add(1, std::memory_order_relaxed);
 
 			return;
 		}
 
-		bool can_accept = m_accept_session_messages_default;
+		counters.decrypt_inflight.fetch_add(1, std::memory_order_relaxed);
 
-		if (m_session_message_received_handler)
-		{
-			can_accept = m_session_message_received_handler(sender, _session_message.cipher_suite(), _session_message.elliptic_curve(), can_accept);
-		}
+		// Defer the deciphering to the data strand associated to the sender,
+		// so messages from different peers are deciphered in parallel.
+		data_strand_for(sender).post(
+			boost::bind(
+				&server::do_decrypt_data,
+				this,
+				identity,
+				sender,
+				epoch,
+				fallback_epoch,
+				data,
+				_data_message
+			)
+		);
+	}
 
-		if (!can_accept)
-		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but not allowed to accept (`m_accept_session_messages_default` is " << m_accept_session_messages_default << ").";
-		}
-		else
-		{
-			bool session_completed = true;
+	void server::do_decrypt_data(const identity_store& identity, const ep_type& sender, decryption_epoch epoch, decryption_epoch fallback_epoch, SharedBuffer data, const data_message& _data_message)
+	{
+		// do_decrypt_data() calls run on the data strand associated to the
+		// sender: messages from a given peer are deciphered in order, but
+		// different peers do not serialize behind one another.
 
-			try
-			{
-				if (!p_session.complete_session(_session_message.public_key(), _session_message.public_key_size()))
-				{
-					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but no session was prepared yet. Preparing a new one.";
+		// data is only there to keep the buffer the data message is mapped onto alive.
+		static_cast<void>(data);
 
-					// We received a session message but no session was prepared yet: we issue one and retry.
-					p_session.prepare_session(_session_message.session_number(), _session_message.cipher_suite(), _session_message.elliptic_curve());
+		// Get either a new buffer or an old, recycled one if possible. The
+		// cleartext is never longer than the ciphered message it comes from.
+		const SharedBuffer cleartext_buffer = m_session_buffers.get(_data_message.size());
 
-					if (!p_session.complete_session(_session_message.public_key(), _session_message.public_key_size()))
-					{
-						// Unable to complete the session.
-						m_logger(log_level::warning) << "Unable to compute the session keys with " << sender << ".";
+		// The message is first tried against the current epoch keys; if that
+		// fails and the previous epoch is still within its grace period, it
+		// is tried again against the previous keys before being dropped.
+		const decryption_epoch* const epochs[2] = { &epoch, fallback_epoch.cipher_context ? &fallback_epoch : NULL };
 
-						return;
-					}
-				}
-			}
-			catch (const std::exception& ex)
+		for (size_t i = 0; (i < 2) && epochs[i]; ++i)
+		{
+			try
 			{
-				session_completed = false;
+				const size_t cleartext_len = _data_message.get_cleartext(
+					buffer_cast<uint8_t*>(cleartext_buffer),
+					buffer_size(cleartext_buffer),
+					*epochs[i]->cipher_context,
+					epochs[i]->sequence_number
+				);
+
+				m_session_strand.post(
+					boost::bind(
+						&server::do_commit_data,
+						this,
+						identity,
+						sender,
+						epochs[i]->session_number,
+						epochs[i]->sequence_number,
+						_data_message.type(),
+						cleartext_buffer,
+						cleartext_len
+					)
+				);
 
-				m_logger(log_level::error) << "Exception while computing the session keys with " << sender << ": " << ex.what() << ".";
+				counters_for(sender).decrypt_inflight.fetch_sub(1, std::memory_order_relaxed);
 
-				if (m_session_error_handler)
-				{
-					m_session_error_handler(sender, session_is_new, ex);
-				}
+				return;
 			}
-
-			if (session_completed)
+			catch (const boost::system::system_error& ex)
 			{
-				m_logger(log_level::trace) << "Session established with " << sender << ". Sending acknowledgement session message back.";
+				if ((i + 1 >= 2) || !epochs[i + 1])
+				{
+					// This can happen if a message is decoded after a session rekeying.
+					FSCP_LOG_LIMITED(m_logger, log_level::error) << "Error deciphering data message from " << sender << ": " << ex.what();
 
-				do_send_session(identity, sender, p_session.current_session_parameters());
+					counters_for(sender).crypto_failures.fetch_add(1, std::memory_order_relaxed);
 
-				if (m_session_established_handler)
-				{
-					m_session_established_handler(sender, session_is_new, p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
+					frame_recorder::record(trace_point::server_receive, frame_verdict::decipher_failed, frame_recorder::to_peer_id(sender), _data_message.size());
 				}
 			}
 		}
+
+		counters_for(sender).decrypt_inflight.fetch_sub(1, std::memory_order_relaxed);
 	}
 
-	void server::do_set_accept_session_messages_default(bool value, void_handler_type handler)
+	void server::do_commit_data(const identity_store& identity, const ep_type& sender, session_number_type session_number, extended_sequence_number_type sequence_number, message_type type, SharedBuffer cleartext_buffer, size_t cleartext_len)
 	{
-		// All do_set_accept_session_messages_default() calls are done in the same strand so the following is thread-safe.
-		set_accept_session_messages_default(value);
+		// All do_commit_data() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = session_for(sender);
 
-		if (handler)
+		if (p_session.padding_enabled() && ((type == MESSAGE_TYPE_DATA_COALESCED) || ((type >= MESSAGE_TYPE_DATA_0) && (type <= MESSAGE_TYPE_DATA_15))))
 		{
-			handler();
-		}
-	}
+			// The padding capability was negotiated, so every data message
+			// from this peer ends with the delimiter, padded or not.
+			try
+			{
+				cleartext_len = data_message::unpadded_length(buffer_cast<const uint8_t*>(cleartext_buffer), cleartext_len);
+			}
+			catch (const std::runtime_error&)
+			{
+				FSCP_LOG_LIMITED(m_logger, log_level::warning) << "Dropping a data message from " << sender << " with malformed padding.";
 
-	void server::do_set_session_message_received_callback(session_received_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_session_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_message_received_callback(callback);
+				return;
+			}
+		}
 
-		if (handler)
+		if (!p_session.has_current_session() || (p_session.current_session().parameters.session_number != session_number))
 		{
-			handler();
-		}
-	}
+			// The message does not belong to the current session: it is
+			// still delivered if it belongs to the previous one and the
+			// grace period has not elapsed, but it never triggers a renewal.
+			const auto previous_session = p_session.previous_session();
 
-	void server::do_set_session_failed_callback(session_failed_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_session_failed_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_failed_callback(callback);
+			if (!previous_session || (previous_session->parameters.session_number != session_number))
+			{
+				// The session was lost or renewed while the message was being deciphered: the message belongs to an unknown session so we discard it.
+				frame_recorder::record(trace_point::server_receive, frame_verdict::unknown_session, frame_recorder::to_peer_id(sender), cleartext_len);
 
-		if (handler)
-		{
-			handler();
-		}
-	}
+				return;
+			}
 
-	void server::do_set_session_error_callback(session_error_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_session_error_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_error_callback(callback);
+			if (!peer_session::register_remote_sequence_number(*previous_session, sequence_number))
+			{
+				// A duplicate was deciphered concurrently, or the message fell out of the replay window meanwhile: only fresh messages are delivered.
+				counters_for(sender).replay_drops.fetch_add(1, std::memory_order_relaxed);
 
-		if (handler)
-		{
-			handler();
-		}
-	}
+				frame_recorder::record(trace_point::server_receive, frame_verdict::replayed, frame_recorder::to_peer_id(sender), cleartext_len);
 
-	void server::do_set_session_established_callback(session_established_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_session_established_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_established_callback(callback);
+				return;
+			}
 
-		if (handler)
-		{
-			handler();
-		}
-	}
+			p_session.keep_alive();
 
-	void server::do_set_session_lost_callback(session_lost_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_session_lost_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_lost_callback(callback);
+			if (type == MESSAGE_TYPE_KEEP_ALIVE)
+			{
+				return;
+			}
 
-		if (handler)
-		{
-			handler();
+			do_handle_data_message(
+				sender,
+				type,
+				cleartext_buffer,
+				buffer(cleartext_buffer, cleartext_len)
+			);
+
+			return;
 		}
-	}
 
-	void server::do_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
-	{
-		// All do_send_data() calls are done in the session strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[target];
+		if (!p_session.register_remote_sequence_number(sequence_number))
+		{
+			// A duplicate was deciphered concurrently, or the message fell out of the replay window meanwhile: only fresh messages are delivered.
+			counters_for(sender).replay_drops.fetch_add(1, std::memory_order_relaxed);
 
-		do_send_data_to_session(p_session, target, channel_number, data, handler);
-	}
+			frame_recorder::record(trace_point::server_receive, frame_verdict::replayed, frame_recorder::to_peer_id(sender), cleartext_len);
 
-	void server::do_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_data_to_list() calls are done in the session strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+			return;
+		}
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		p_session.keep_alive();
 
-		for (auto&& item: m_peer_sessions)
+		if (p_session.current_session().needs_renewal() && !p_session.has_next_session())
 		{
-			if (targets.count(item.first) > 0)
+			// Make-before-break: the next epoch is prepared ahead of the
+			// key-usage bound, while the current keys are still usable, so
+			// the switch does not interrupt traffic.
+			// do_send_clear_session() and do_commit_data() are to be invoked through the same strand, so this is fine.
+			handshake_stamps_for(sender).session_request_us.store(monotonic_us(), std::memory_order_relaxed);
+
+			if (p_session.can_resume_session(p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve))
 			{
-				do_send_data_to_session(item.second, item.first, channel_number, data, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+				// A ratchet secret is available: the keys are rolled forward
+				// from it, which spares the full re-handshake.
+				p_session.prepare_session_resumption(p_session.next_session_number(), p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
+			}
+			else
+			{
+				p_session.prepare_session(p_session.next_session_number(), p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve, get_ecdhe_context(p_session.current_session().parameters.elliptic_curve));
 			}
-		}
-	}
 
-	void server::do_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_data_to_all() calls are done in the session strand so the following is thread-safe.
-		do_send_data_to_list(get_session_endpoints(), channel_number, data, handler);
-	}
+			do_send_session(identity, sender, p_session.next_session_parameters());
+		}
 
-	void server::do_send_data_to_session(peer_session& p_session, const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
-	{
-		// All do_send_data_to_session() calls are done in the session strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		if (type == MESSAGE_TYPE_KEEP_ALIVE)
 		{
-			handler(server_error::server_offline);
+			if (m_reorder_hold_ms != 0)
+			{
+				// Keep-alives consume a sequence number: the reordering
+				// queue must account for them or it would hold the next
+				// messages back for a gap that never fills. They match no
+				// delivery branch, so routing them through is harmless.
+				deliver_or_hold_data(sender, session_number, sequence_number, type, cleartext_buffer, cleartext_len);
+			}
 
+			// If the message is a keep alive then nothing else is to be done and we avoid posting an empty call into the data strand.
 			return;
 		}
 
-		if (!p_session.has_current_session())
+		if (m_reorder_hold_ms != 0)
 		{
-			handler(server_error::no_session_for_host);
+			deliver_or_hold_data(sender, session_number, sequence_number, type, cleartext_buffer, cleartext_len);
 
 			return;
 		}
 
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer send_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
+		// This call is fast so we handle the message right away.
+		do_handle_data_message(
+			sender,
+			type,
+			cleartext_buffer,
+			buffer(cleartext_buffer, cleartext_len)
+		);
+	}
 
-			return result;
-		}();
+	void server::do_handle_data_message(const ep_type& sender, message_type type, SharedBuffer buffer, boost::asio::const_buffer data)
+	{
+		// All do_handle_data_message() calls are done in the same strand as do_handle_data() so the following is thread-safe.
+		// This call should remain *FAST*. That ims, it should only discard the message or trigger some deferred handling by another task.
 
-		try
+		if (is_data_message_type(type))
 		{
-			const size_t size = data_message::write(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				channel_number,
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				buffer_cast<const uint8_t*>(data),
-				buffer_size(data),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			// This is safe only because type is a DATA message type.
+			const channel_number_type channel_number = to_channel_number(type);
 
-			async_send_to(
-				SharedBuffer(send_buffer, [this](const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer]() {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
-				size,
-				target,
-				handler
-			);
-		}
-		catch (const boost::system::system_error& ex)
-		{
-			handler(ex.code());
-		}
-	}
+#ifdef USE_LZ4
+			if (session_for(sender).compression_enabled())
+			{
+				// The compression stage was negotiated: the first payload
+				// byte says whether the rest is LZ4 or raw.
+				const uint8_t* const payload = buffer_cast<const uint8_t*>(data);
+				const size_t payload_len = buffer_size(data);
 
-	void server::do_send_contact_request(const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
-	{
-		// All do_send_contact_request() calls are done in the session strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[target];
+				if (payload_len < 1)
+				{
+					frame_recorder::record(trace_point::server_receive, frame_verdict::corrupt_frame, frame_recorder::to_peer_id(sender), payload_len);
 
-		do_send_contact_request_to_session(p_session, target, hash_list, handler);
-	}
+					return;
+				}
 
-	void server::do_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_contact_request_to_list() calls are done in the same strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+				if (payload[0] == 0x00)
+				{
+					data = boost::asio::buffer(payload + 1, payload_len - 1);
+				}
+				else
+				{
+					const SharedBuffer decompressed_buffer = m_session_buffers.get();
+					const int decompressed_len = ::LZ4_decompress_safe(reinterpret_cast<const char*>(payload + 1), reinterpret_cast<char*>(buffer_cast<uint8_t*>(decompressed_buffer)), static_cast<int>(payload_len - 1), static_cast<int>(buffer_size(decompressed_buffer)));
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+					if (decompressed_len < 0)
+					{
+						FSCP_LOG_LIMITED(m_logger, log_level::warning) << "Discarding a corrupt compressed data message from " << sender << ".";
 
-		for (auto&& item: m_peer_sessions)
-		{
-			if (targets.count(item.first) > 0)
+						frame_recorder::record(trace_point::server_receive, frame_verdict::corrupt_frame, frame_recorder::to_peer_id(sender), payload_len);
+
+						return;
+					}
+
+					buffer = decompressed_buffer;
+					data = boost::asio::buffer(buffer_cast<const uint8_t*>(decompressed_buffer), static_cast<size_t>(decompressed_len));
+				}
+			}
+#endif
+
+			if ((m_reliable_channels & (1 << channel_number)) != 0)
 			{
-				do_send_contact_request_to_session(item.second, item.first, hash_list, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+				// The channel carries the reliable sub-channel framing: the
+				// frame feeds the reassembly machinery and only complete
+				// messages reach the data handler.
+				do_handle_reliable_frame(sender, channel_number, data);
+
+				return;
 			}
-		}
-	}
 
-	void server::do_send_contact_request_to_all(const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_contact_request_to_all() calls are done in the same strand so the following is thread-safe.
-		do_send_contact_request_to_list(get_session_endpoints(), hash_list, handler);
-	}
+			frame_recorder::record(trace_point::server_receive, frame_verdict::forwarded, frame_recorder::to_peer_id(sender), buffer_size(data));
 
-	void server::do_send_contact_request_to_session(peer_session& p_session, const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
-	{
-		// All do_send_contact_request_to_session() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
+			if (m_data_received_handler)
+			{
+				m_data_received_handler(sender, channel_number, buffer, data);
+			}
+		}
+		else if (type == MESSAGE_TYPE_DATA_COALESCED)
 		{
-			handler(server_error::server_offline);
+			if (m_data_received_handler)
+			{
+				// The payload is a sequence of length-prefixed frames, all
+				// bound to the first channel.
+				const uint8_t* ptr = buffer_cast<const uint8_t*>(data);
+				size_t remaining = buffer_size(data);
 
-			return;
-		}
+				while (remaining > sizeof(uint16_t))
+				{
+					uint16_t frame_len_n;
 
-		if (!p_session.has_current_session())
-		{
-			handler(server_error::no_session_for_host);
+					std::memcpy(&frame_len_n, ptr, sizeof(frame_len_n));
 
-			return;
-		}
+					const size_t frame_len = ntohs(frame_len_n);
 
-		const auto send_buffer = SharedBuffer(65536);
+					ptr += sizeof(frame_len_n);
+					remaining -= sizeof(frame_len_n);
 
-		try
+					if ((frame_len == 0) || (frame_len > remaining))
+					{
+						// The message is malformed: the remaining bytes are discarded.
+						break;
+					}
+
+					frame_recorder::record(trace_point::server_receive, frame_verdict::forwarded, frame_recorder::to_peer_id(sender), frame_len);
+
+					m_data_received_handler(sender, CHANNEL_NUMBER_0, buffer, boost::asio::buffer(ptr, frame_len));
+
+					ptr += frame_len;
+					remaining -= frame_len;
+				}
+			}
+		}
+		else if (type == MESSAGE_TYPE_CONTACT_REQUEST)
 		{
-			const size_t size = data_message::write_contact_request(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				hash_list,
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			const hash_list_type hash_list = data_message::parse_hash_list(buffer_cast<const uint8_t*>(data), buffer_size(data));
 
-			async_send_to(
-				send_buffer,
-				size,
-				target,
-				handler
+			m_presentation_strand.post(
+				boost::bind(
+					&server::do_handle_contact_request,
+					this,
+					sender,
+					hash_list
+				)
 			);
 		}
-		catch (const boost::system::system_error& ex)
+		else if (type == MESSAGE_TYPE_CONTACT)
 		{
-			handler(ex.code());
+			// The cleartext buffer travels to the contact strand as-is and
+			// the contacts are iterated in place there: no contact map is
+			// ever allocated for the continuous gossip traffic.
+			m_contact_strand.post(
+				boost::bind(
+					&server::do_handle_contact,
+					this,
+					sender,
+					buffer,
+					data
+				)
+			);
 		}
 	}
 
-	void server::do_send_contact(const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
+	void server::deliver_or_hold_data(const ep_type& sender, session_number_type session_number, extended_sequence_number_type sequence_number, message_type type, SharedBuffer cleartext_buffer, size_t cleartext_len)
 	{
-		// All do_send_contact() calls are done in the same strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[target];
-
-		do_send_contact_to_session(p_session, target, contact_map, handler);
-	}
+		// All deliver_or_hold_data() calls are done in the session strand so the following is thread-safe.
+		reorder_queue_type& queue = m_reorder_queues[sender];
 
-	void server::do_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_contact_to_list() calls are done in the same strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+		if (queue.session_number != session_number)
+		{
+			// The session changed so the sequence numbering restarted: the
+			// held messages are flushed and the expectation resynchronized.
+			flush_reorder_queue(sender, queue);
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+			queue.session_number = session_number;
+			queue.next_sequence_number = sequence_number;
+		}
 
-		for (auto&& item: m_peer_sessions)
+		if (sequence_number == queue.next_sequence_number)
 		{
-			if (targets.count(item.first) > 0)
+			do_handle_data_message(sender, type, cleartext_buffer, buffer(cleartext_buffer, cleartext_len));
+
+			queue.next_sequence_number = sequence_number + 1;
+
+			// The message may have been the only thing holding the next
+			// ones back.
+			while (!queue.held.empty() && (queue.held.begin()->first == queue.next_sequence_number))
 			{
-				do_send_contact_to_session(item.second, item.first, contact_map, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
-			}
-		}
-	}
+				const held_data_type& held = queue.held.begin()->second;
 
-	void server::do_send_contact_to_all(const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_contact_to_all() calls are done in the same strand so the following is thread-safe.
-		do_send_contact_to_list(get_session_endpoints(), contact_map, handler);
-	}
+				do_handle_data_message(sender, held.type, held.buffer, buffer(held.buffer, held.len));
 
-	void server::do_send_contact_to_session(peer_session& p_session, const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
-	{
-		// All do_send_contact_to_session() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
-		{
-			handler(server_error::server_offline);
+				queue.next_sequence_number = queue.held.begin()->first + 1;
+				queue.held.erase(queue.held.begin());
+			}
 
 			return;
 		}
 
-		if (!p_session.has_current_session())
+		if (sequence_number < queue.next_sequence_number)
 		{
-			handler(server_error::no_session_for_host);
-
-			return;
-		}
+			// The message was presumed lost and its slot skipped: it is
+			// delivered late rather than never, and how far behind it
+			// arrived is the reorder depth to absorb from now on.
+			const size_t depth = static_cast<size_t>(queue.next_sequence_number - sequence_number);
 
-		const auto send_buffer = SharedBuffer(65536);
+			if (depth > queue.window)
+			{
+				queue.window = (depth < REORDER_BUFFER_MAX_SIZE) ? depth : REORDER_BUFFER_MAX_SIZE;
+			}
 
-		try
-		{
-			const size_t size = data_message::write_contact(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				contact_map,
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			do_handle_data_message(sender, type, cleartext_buffer, buffer(cleartext_buffer, cleartext_len));
 
-			async_send_to(
-				send_buffer,
-				size,
-				target,
-				handler
-			);
-		}
-		catch (const boost::system::system_error& ex)
-		{
-			handler(ex.code());
+			return;
 		}
-	}
 
-	void server::do_handle_data(const identity_store& identity, const ep_type& sender, const data_message& _data_message)
-	{
-		// All do_handle_data() calls are done in the same strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[sender];
+		const size_t gap = static_cast<size_t>(sequence_number - queue.next_sequence_number);
 
-		if (!p_session.has_current_session())
+		if ((gap > queue.window) || (queue.held.size() >= REORDER_BUFFER_MAX_SIZE))
 		{
-			m_logger(log_level::trace) << "Received a data message from " << sender << " but no session exists. Ignoring.";
+			// The gap is deeper than the observed reorder depth: this looks
+			// like a real loss, so nothing is held back for it.
+			flush_reorder_queue(sender, queue);
 
-			return;
-		}
+			do_handle_data_message(sender, type, cleartext_buffer, buffer(cleartext_buffer, cleartext_len));
 
-		if (_data_message.sequence_number() <= p_session.current_session().remote_sequence_number)
-		{
-			// The message is outdated: we ignore it.
-			m_logger(log_level::trace) << "Received a data message from " << sender << " but its sequence number is outdated (received: " << _data_message.sequence_number() << ", expecting: " << p_session.current_session().remote_sequence_number << "). Ignoring.";
+			queue.next_sequence_number = sequence_number + 1;
 
 			return;
 		}
 
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer cleartext_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
-
-			return result;
-		}();
-
-		try
-		{
-			const size_t cleartext_len = _data_message.get_cleartext(
-				buffer_cast<uint8_t*>(cleartext_buffer),
-				buffer_size(cleartext_buffer),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				buffer_cast<const uint8_t*>(p_session.current_session().remote_session_key),
-				buffer_size(p_session.current_session().remote_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().remote_nonce_prefix),
-				buffer_size(p_session.current_session().remote_nonce_prefix)
-			);
-
-			p_session.set_remote_sequence_number(_data_message.sequence_number());
-			p_session.keep_alive();
-
-			if (p_session.current_session().is_old())
-			{
-				// do_send_clear_session() and do_handle_data() are to be invoked through the same strand, so this is fine.
-				p_session.prepare_session(p_session.next_session_number(), p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
-				do_send_session(identity, sender, p_session.next_session_parameters());
-			}
+		const held_data_type held = {
+			type,
+			cleartext_buffer,
+			cleartext_len,
+			boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(m_reorder_hold_ms)
+		};
 
-			const message_type type = _data_message.type();
+		queue.held.insert(std::make_pair(sequence_number, held));
 
-			if (type == MESSAGE_TYPE_KEEP_ALIVE)
-			{
-				// If the message is a keep alive then nothing is to be done and we avoid posting an empty call into the data strand.
-				return;
-			}
+		schedule_reorder_flush();
+	}
 
-			// This call is fast so we hold on to the data_message a bit longer.
-			do_handle_data_message(
-				sender,
-				type,
-				SharedBuffer(cleartext_buffer, [this] (const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer] () {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
-				buffer(cleartext_buffer, cleartext_len)
-			);
-		}
-		catch (const boost::system::system_error& ex)
+	void server::flush_reorder_queue(const ep_type& sender, reorder_queue_type& queue)
+	{
+		// All flush_reorder_queue() calls are done in the session strand so the following is thread-safe.
+		for (auto&& held_pair : queue.held)
 		{
-			// This can happen if a message is decoded after a session rekeying.
-			m_logger(log_level::error) << "Error deciphering data message from " << sender << ": " << ex.what();
+			do_handle_data_message(sender, held_pair.second.type, held_pair.second.buffer, buffer(held_pair.second.buffer, held_pair.second.len));
+
+			queue.next_sequence_number = held_pair.first + 1;
 		}
+
+		queue.held.clear();
 	}
 
-	void server::do_handle_data_message(const ep_type& sender, message_type type, SharedBuffer buffer, boost::asio::const_buffer data)
+	void server::schedule_reorder_flush()
 	{
-		// All do_handle_data_message() calls are done in the same strand as do_handle_data() so the following is thread-safe.
-		// This call should remain *FAST*. That ims, it should only discard the message or trigger some deferred handling by another task.
+		// All schedule_reorder_flush() calls are done in the session strand so the following is thread-safe.
+		boost::posix_time::ptime earliest = boost::posix_time::pos_infin;
 
-		if (is_data_message_type(type))
+		for (auto&& queue_pair : m_reorder_queues)
 		{
-			// This is safe only because type is a DATA message type.
-			const channel_number_type channel_number = to_channel_number(type);
-
-			if (m_data_received_handler)
+			// Nothing behind the head of a queue can be delivered before
+			// the head gap is decided, so the head deadline is the only
+			// actionable one.
+			if (!queue_pair.second.held.empty() && (queue_pair.second.held.begin()->second.deadline < earliest))
 			{
-				m_data_received_handler(sender, channel_number, buffer, data);
+				earliest = queue_pair.second.held.begin()->second.deadline;
 			}
 		}
-		else if (type == MESSAGE_TYPE_CONTACT_REQUEST)
+
+		if (earliest.is_special())
 		{
-			const hash_list_type hash_list = data_message::parse_hash_list(buffer_cast<const uint8_t*>(data), buffer_size(data));
+			return;
+		}
 
-			m_presentation_strand.post(
+		if (m_reorder_flush_at <= earliest)
+		{
+			// An earlier flush is already scheduled.
+			return;
+		}
+
+		m_reorder_flush_at = earliest;
+		m_reorder_timer.expires_at(earliest);
+		m_reorder_timer.async_wait(
+			m_session_strand.wrap(
 				boost::bind(
-					&server::do_handle_contact_request,
+					&server::do_flush_expired_reorder_data,
 					this,
-					sender,
-					hash_list
+					boost::asio::placeholders::error
 				)
-			);
+			)
+		);
+	}
+
+	void server::do_flush_expired_reorder_data(const boost::system::error_code& ec)
+	{
+		// All do_flush_expired_reorder_data() calls are done in the session strand so the following is thread-safe.
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			// The timer was rescheduled for an earlier deadline.
+			return;
 		}
-		else if (type == MESSAGE_TYPE_CONTACT)
+
+		m_reorder_flush_at = boost::posix_time::pos_infin;
+
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+		for (auto&& queue_pair : m_reorder_queues)
 		{
-			const contact_map_type contact_map = data_message::parse_contact_map(buffer_cast<const uint8_t*>(data), buffer_size(data));
+			reorder_queue_type& queue = queue_pair.second;
 
-			m_contact_strand.post(
-				boost::bind(
-					&server::do_handle_contact,
-					this,
-					sender,
-					contact_map
-				)
-			);
+			while (!queue.held.empty() && (queue.held.begin()->second.deadline <= now))
+			{
+				// The missing message did not show up within the hold: it
+				// is declared lost and the head of the queue goes through.
+				// The reorder window shrinks so a persistent loss pattern
+				// stops paying the hold latency.
+				const held_data_type& held = queue.held.begin()->second;
+
+				do_handle_data_message(queue_pair.first, held.type, held.buffer, buffer(held.buffer, held.len));
+
+				queue.next_sequence_number = queue.held.begin()->first + 1;
+				queue.held.erase(queue.held.begin());
+
+				queue.window = std::max<size_t>(1, queue.window / 2);
+
+				// The expired head may have been the only thing holding
+				// the next messages back.
+				while (!queue.held.empty() && (queue.held.begin()->first == queue.next_sequence_number))
+				{
+					const held_data_type& next_held = queue.held.begin()->second;
+
+					do_handle_data_message(queue_pair.first, next_held.type, next_held.buffer, buffer(next_held.buffer, next_held.len));
+
+					queue.next_sequence_number = queue.held.begin()->first + 1;
+					queue.held.erase(queue.held.begin());
+				}
+			}
 		}
+
+		schedule_reorder_flush();
 	}
 
 	void server::do_handle_contact_request(const ep_type& sender, const std::set<hash_type>& hash_list)
 	{
 		// All do_handle_contact_request() calls are done in the same strand so the following is thread-safe.
-		contact_map_type contact_map;
+		contact_list_type contacts;
+		contacts.reserve(hash_list.size());
 
 		for (std::set<hash_type>::iterator hash_it = hash_list.begin(); hash_it != hash_list.end(); ++hash_it)
 		{
-			for (presentation_store_map::const_iterator it = m_presentation_store_map.begin(); it != m_presentation_store_map.end(); ++it)
+			// The contact index only references hosts that presented a
+			// certificate: contact requests do not work for PSK
+			// authenticated hosts.
+			const std::pair<contact_index_map_type::const_iterator, contact_index_map_type::const_iterator> range = m_contact_index.equal_range(*hash_it);
+
+			for (contact_index_map_type::const_iterator it = range.first; it != range.second; ++it)
 			{
-				// Contact requests do not work for PSK authenticated hosts.
-				if (!it->second.signature_certificate())
+				const presentation_store_map::const_iterator presentation = m_presentation_store_map.find(it->second);
+
+				if (presentation == m_presentation_store_map.end())
 				{
 					continue;
 				}
 
-				const boost::optional<hash_type> hash = it->second.signature_certificate_hash();
-
-				if (hash && (*hash == *hash_it))
+				if (!m_contact_request_message_received_handler || m_contact_request_message_received_handler(sender, presentation->second.signature_certificate(), *hash_it, it->second))
 				{
-					if (!m_contact_request_message_received_handler || m_contact_request_message_received_handler(sender, it->second.signature_certificate(), *hash, it->first))
-					{
-						contact_map[*hash_it] = it->first;
-					}
+					contacts.push_back(std::make_pair(*hash_it, it->second));
 				}
 			}
 		}
 
-		// Our contact map contains some answers: we send those.
-		if (!contact_map.empty())
+		// Our contact list contains some answers: we send those.
+		if (!contacts.empty())
 		{
-			async_send_contact(sender, contact_map, &null_simple_handler);
+			m_session_strand.post(boost::bind(&server::do_send_contact_list, this, sender, contacts, &null_simple_handler));
 		}
 	}
 
-	void server::do_handle_contact(const ep_type& sender, const contact_map_type& contact_map)
+	void server::do_handle_contact(const ep_type& sender, SharedBuffer cleartext_buffer, boost::asio::const_buffer data)
 	{
 		// All do_handle_contact() calls are done in the same strand so the following is thread-safe.
 
+		// The shared buffer only keeps the cleartext alive while the view
+		// iterates it.
+		static_cast<void>(cleartext_buffer);
+
 		if (m_contact_message_received_handler)
 		{
-			for (contact_map_type::const_iterator contact_it = contact_map.begin(); contact_it != contact_map.end(); ++contact_it)
+			data_message::contact_map_view view(buffer_cast<const uint8_t*>(data), buffer_size(data));
+
+			hash_type hash;
+			ep_type answer;
+
+			try
+			{
+				while (view.next(hash, answer))
+				{
+					m_contact_message_received_handler(sender, hash, answer);
+				}
+			}
+			catch (const std::runtime_error&)
 			{
-				m_contact_message_received_handler(sender, contact_it->first, contact_it->second);
+				// A malformed record poisons the rest of the message; the
+				// contacts read before it keep their effect.
+				m_logger(log_level::warning) << "Ignoring a malformed CONTACT message from " << sender << ".";
 			}
 		}
 	}
@@ -2508,31 +7240,173 @@ namespace fscp
 		}
 	}
 
+	void server::schedule_keep_alive(const ep_type& target, const boost::posix_time::time_duration& delay)
+	{
+		// All schedule_keep_alive() calls are done in the session strand so the following is thread-safe.
+		if (m_keep_alive_scheduled.count(target) > 0)
+		{
+			// The endpoint already has a pending deadline on the wheel.
+			return;
+		}
+
+		// The delay is rounded up to full slots and clamped to the wheel span.
+		size_t slots = static_cast<size_t>((delay.total_milliseconds() + KEEP_ALIVE_WHEEL_GRANULARITY.total_milliseconds() - 1) / KEEP_ALIVE_WHEEL_GRANULARITY.total_milliseconds());
+
+		if (slots < 1)
+		{
+			slots = 1;
+		}
+		else if (slots > KEEP_ALIVE_WHEEL_SIZE - 1)
+		{
+			slots = KEEP_ALIVE_WHEEL_SIZE - 1;
+		}
+
+		m_keep_alive_wheel[(m_keep_alive_wheel_cursor + slots) % KEEP_ALIVE_WHEEL_SIZE].insert(target);
+		m_keep_alive_scheduled.insert(target);
+	}
+
 	void server::do_check_keep_alive(const boost::system::error_code& ec)
 	{
 		// All do_check_keep_alive() calls are done in the same strand so the following is thread-safe.
 		if (ec != boost::asio::error::operation_aborted)
 		{
-			for (auto&& p_session: m_peer_sessions)
+			m_keep_alive_wheel_cursor = (m_keep_alive_wheel_cursor + 1) % KEEP_ALIVE_WHEEL_SIZE;
+
+			std::set<ep_type> due;
+			due.swap(m_keep_alive_wheel[m_keep_alive_wheel_cursor]);
+
+			const boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+
+			for (auto&& target: due)
 			{
-				if (p_session.second.has_timed_out(SESSION_TIMEOUT))
+				m_keep_alive_scheduled.erase(target);
+
+				peer_session& p_session = session_for(target);
+				keep_alive_state_type& keep_alive_state = m_keep_alive_states[target];
+
+				// The timeout follows the stretched interval: a peer probed
+				// at a long interval must not be declared dead by the
+				// default deadline.
+				if (p_session.has_timed_out(keep_alive_state.interval * 3))
 				{
-					if (p_session.second.clear())
+					if (p_session.clear())
 					{
+						// The next handshake with this peer starts fresh:
+						// present the current certificate from now on.
+						forget_previous_identity_peer(target);
+
+						// The next contact tries the direct path again
+						// before any relay.
+						clear_relay(target);
+
 						if (m_session_lost_handler)
 						{
-							m_session_lost_handler(p_session.first, session_loss_reason::timeout);
+							m_session_lost_handler(target, session_loss_reason::timeout);
 						}
 					}
+
+					record_keep_alive_failure(target);
+
+					schedule_keep_alive(target, keep_alive_state.interval);
 				}
 				else
 				{
-					do_send_keep_alive(p_session.first, &null_simple_handler);
+					// Data messages carry no acknowledgment to sample a
+					// round-trip from, so a HELLO ping rides the keep-alive
+					// schedule - whether or not the keep-alive itself is
+					// elided below - and keeps the peer's RTT estimate
+					// fresh.
+					async_greet(target, &null_duration_handler, keep_alive_state.interval);
+
+					const boost::posix_time::time_duration since_last_sign_of_life = now - p_session.last_sign_of_life();
+					const boost::posix_time::time_duration since_last_data_sent = now - p_session.last_data_sent();
+
+					if (since_last_sign_of_life < keep_alive_state.interval)
+					{
+						// The session saw traffic recently: the keep-alive is redundant so we back off until the deadline it implies.
+						schedule_keep_alive(target, keep_alive_state.interval - since_last_sign_of_life);
+					}
+					else if (since_last_data_sent < keep_alive_state.interval)
+					{
+						// We sent data to the peer recently: the data message
+						// already refreshed the NAT mapping and proved our
+						// liveness, so the standalone keep-alive and its
+						// sealing work are redundant on this busy link.
+						schedule_keep_alive(target, keep_alive_state.interval - since_last_data_sent);
+					}
+					else
+					{
+						do_send_keep_alive(target, &null_simple_handler);
+
+						// A full interval elapsed with the session alive:
+						// the NAT mapping survived the current interval.
+						record_keep_alive_survival(target);
+
+						schedule_keep_alive(target, keep_alive_state.interval);
+					}
 				}
 			}
 
-			m_keep_alive_timer.expires_from_now(SESSION_KEEP_ALIVE_PERIOD);
-			m_keep_alive_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
+			m_keep_alive_timer_id = m_timer_service.schedule(KEEP_ALIVE_WHEEL_GRANULARITY, m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
+		}
+	}
+
+	void server::record_keep_alive_survival(const ep_type& target)
+	{
+		// All record_keep_alive_survival() calls are done in the session strand so the following is thread-safe.
+		keep_alive_state_type& state = m_keep_alive_states[target];
+
+		if (++state.successes < SESSION_KEEP_ALIVE_PROBE_SUCCESSES)
+		{
+			return;
+		}
+
+		state.successes = 0;
+		state.longest_good = state.interval;
+
+		if (state.shortest_bad.is_not_a_date_time())
+		{
+			// No failure was seen yet: the interval doubles until one is,
+			// or until the cap.
+			state.interval = std::min(state.interval * 2, SESSION_KEEP_ALIVE_MAX_PERIOD);
+		}
+		else if ((state.shortest_bad - state.longest_good) > KEEP_ALIVE_WHEEL_GRANULARITY)
+		{
+			// A known-bad bound exists: binary-search the gap.
+			state.interval = state.longest_good + (state.shortest_bad - state.longest_good) / 2;
+		}
+	}
+
+	void server::record_keep_alive_failure(const ep_type& target)
+	{
+		// All record_keep_alive_failure() calls are done in the session strand so the following is thread-safe.
+		keep_alive_state_type& state = m_keep_alive_states[target];
+
+		state.successes = 0;
+
+		if (state.interval <= SESSION_KEEP_ALIVE_PERIOD)
+		{
+			// The default interval failed too: this is a dead peer, not a
+			// NAT timeout, and nothing is to be learned from it.
+			return;
+		}
+
+		// The stretched interval outlived the NAT mapping: it becomes the
+		// known-bad bound and the search resumes halfway down.
+		state.shortest_bad = state.interval;
+
+		if (state.shortest_bad <= state.longest_good)
+		{
+			// The previously known-good bound no longer holds (the NAT
+			// changed): the search restarts from the default interval.
+			state.longest_good = SESSION_KEEP_ALIVE_PERIOD;
+		}
+
+		state.interval = state.longest_good + (state.shortest_bad - state.longest_good) / 2;
+
+		if (state.interval < SESSION_KEEP_ALIVE_PERIOD)
+		{
+			state.interval = SESSION_KEEP_ALIVE_PERIOD;
 		}
 	}
 
@@ -2546,7 +7420,7 @@ namespace fscp
 			return;
 		}
 
-		peer_session& p_session = m_peer_sessions[target];
+		peer_session& p_session = session_for(target);
 
 		if (!p_session.has_current_session())
 		{
@@ -2555,7 +7429,8 @@ namespace fscp
 			return;
 		}
 
-		const auto send_buffer = SharedBuffer(1024);
+		// Get either a new buffer or an old, recycled one if possible.
+		const SharedBuffer send_buffer = m_handshake_buffers.get();
 
 		try
 		{
@@ -2584,6 +7459,222 @@ namespace fscp
 		}
 	}
 
+	server::atomic_peer_counters_type& server::counters_for(const ep_type& target)
+	{
+		boost::mutex::scoped_lock lock(m_peer_counters_mutex);
+
+		boost::shared_ptr<atomic_peer_counters_type>& counters = m_peer_counters[target];
+
+		if (!counters)
+		{
+			counters = boost::make_shared<atomic_peer_counters_type>();
+		}
+
+		return *counters;
+	}
+
+	server::peer_counters_type server::make_counters_snapshot(const atomic_peer_counters_type& counters)
+	{
+		peer_counters_type snapshot;
+
+		snapshot.packets_in = counters.packets_in.load(std::memory_order_relaxed);
+		snapshot.bytes_in = counters.bytes_in.load(std::memory_order_relaxed);
+		snapshot.packets_out = counters.packets_out.load(std::memory_order_relaxed);
+		snapshot.bytes_out = counters.bytes_out.load(std::memory_order_relaxed);
+		snapshot.crypto_failures = counters.crypto_failures.load(std::memory_order_relaxed);
+		snapshot.replay_drops = counters.replay_drops.load(std::memory_order_relaxed);
+		snapshot.decrypt_backlog_drops = counters.decrypt_backlog_drops.load(std::memory_order_relaxed);
+		snapshot.send_queue_depth = counters.send_queue_depth.load(std::memory_order_relaxed);
+
+		return snapshot;
+	}
+
+	server::peer_counters_type server::get_peer_counters(const ep_type& target) const
+	{
+		boost::shared_ptr<atomic_peer_counters_type> counters;
+
+		{
+			boost::mutex::scoped_lock lock(m_peer_counters_mutex);
+
+			const auto it = m_peer_counters.find(target);
+
+			if (it != m_peer_counters.end())
+			{
+				counters = it->second;
+			}
+		}
+
+		if (!counters)
+		{
+			return peer_counters_type();
+		}
+
+		return make_counters_snapshot(*counters);
+	}
+
+	std::map<server::ep_type, server::peer_counters_type> server::get_all_peer_counters() const
+	{
+		std::map<ep_type, boost::shared_ptr<atomic_peer_counters_type>> peer_counters;
+
+		{
+			boost::mutex::scoped_lock lock(m_peer_counters_mutex);
+
+			peer_counters = m_peer_counters;
+		}
+
+		std::map<ep_type, peer_counters_type> result;
+
+		for (auto&& pair : peer_counters)
+		{
+			result[pair.first] = make_counters_snapshot(*pair.second);
+		}
+
+		return result;
+	}
+
+	server::handshake_stamps_type& server::handshake_stamps_for(const ep_type& target)
+	{
+		boost::mutex::scoped_lock lock(m_handshake_stamps_mutex);
+
+		boost::shared_ptr<handshake_stamps_type>& stamps = m_handshake_stamps[target];
+
+		if (!stamps)
+		{
+			stamps = boost::make_shared<handshake_stamps_type>();
+		}
+
+		return *stamps;
+	}
+
+	server::rtt_state_type& server::rtt_state_for(const ep_type& target)
+	{
+		boost::mutex::scoped_lock lock(m_rtt_states_mutex);
+
+		boost::shared_ptr<rtt_state_type>& state = m_rtt_states[target];
+
+		if (!state)
+		{
+			state = boost::make_shared<rtt_state_type>();
+		}
+
+		return *state;
+	}
+
+	void server::record_rtt_sample(const ep_type& target, uint64_t sample_us)
+	{
+		// All record_rtt_sample() calls are done in the greet strand so the following is thread-safe.
+		rtt_state_type& state = rtt_state_for(target);
+
+		if (state.sample_count.load(std::memory_order_relaxed) == 0)
+		{
+			state.smoothed_rtt_us.store(sample_us, std::memory_order_relaxed);
+			state.rtt_variance_us.store(sample_us / 2, std::memory_order_relaxed);
+		}
+		else
+		{
+			// RFC 6298 smoothing: the estimate follows the path while a
+			// single delayed reply cannot drag it far.
+			const uint64_t srtt = state.smoothed_rtt_us.load(std::memory_order_relaxed);
+			const uint64_t rttvar = state.rtt_variance_us.load(std::memory_order_relaxed);
+			const uint64_t deviation = (sample_us > srtt) ? (sample_us - srtt) : (srtt - sample_us);
+
+			state.rtt_variance_us.store((3 * rttvar + deviation) / 4, std::memory_order_relaxed);
+			state.smoothed_rtt_us.store((7 * srtt + sample_us) / 8, std::memory_order_relaxed);
+		}
+
+		state.sample_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	boost::optional<server::peer_rtt_type> server::get_peer_rtt(const ep_type& target) const
+	{
+		boost::shared_ptr<rtt_state_type> state;
+
+		{
+			boost::mutex::scoped_lock lock(m_rtt_states_mutex);
+
+			const auto it = m_rtt_states.find(target);
+
+			if (it == m_rtt_states.end())
+			{
+				return boost::none;
+			}
+
+			state = it->second;
+		}
+
+		if (state->sample_count.load(std::memory_order_relaxed) == 0)
+		{
+			return boost::none;
+		}
+
+		peer_rtt_type result;
+		result.smoothed_rtt_us = state->smoothed_rtt_us.load(std::memory_order_relaxed);
+		result.rtt_variance_us = state->rtt_variance_us.load(std::memory_order_relaxed);
+		result.sample_count = state->sample_count.load(std::memory_order_relaxed);
+
+		return result;
+	}
+
+	void server::record_handshake_duration(handshake_stage stage, uint64_t duration_us)
+	{
+		size_t bucket = 0;
+
+		while ((duration_us >>= 1) && (bucket < HANDSHAKE_BUCKET_COUNT - 1))
+		{
+			++bucket;
+		}
+
+		m_handshake_histograms[static_cast<size_t>(stage) * HANDSHAKE_BUCKET_COUNT + bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::map<std::string, server::handshake_histogram_type> server::get_handshake_histograms() const
+	{
+		static const char* const stage_names[HANDSHAKE_STAGE_COUNT] = {
+			"hello",
+			"session_setup",
+			"total_initial",
+			"renewal",
+		};
+
+		std::map<std::string, handshake_histogram_type> result;
+
+		for (size_t stage = 0; stage < HANDSHAKE_STAGE_COUNT; ++stage)
+		{
+			handshake_histogram_type& histogram = result[stage_names[stage]];
+
+			for (size_t bucket = 0; bucket < HANDSHAKE_BUCKET_COUNT; ++bucket)
+			{
+				histogram[bucket] = m_handshake_histograms[stage * HANDSHAKE_BUCKET_COUNT + bucket].load(std::memory_order_relaxed);
+			}
+		}
+
+		return result;
+	}
+
+	void server::set_strand_profiling(bool enabled)
+	{
+		m_strand_profilers.socket.set_enabled(enabled);
+		m_strand_profilers.write_queue.set_enabled(enabled);
+		m_strand_profilers.greet.set_enabled(enabled);
+		m_strand_profilers.presentation.set_enabled(enabled);
+		m_strand_profilers.session.set_enabled(enabled);
+		m_strand_profilers.contact.set_enabled(enabled);
+	}
+
+	std::map<std::string, strand_profiler::snapshot_type> server::get_strand_profiles() const
+	{
+		std::map<std::string, strand_profiler::snapshot_type> result;
+
+		result["socket"] = m_strand_profilers.socket.snapshot();
+		result["write_queue"] = m_strand_profilers.write_queue.snapshot();
+		result["greet"] = m_strand_profilers.greet.snapshot();
+		result["presentation"] = m_strand_profilers.presentation.snapshot();
+		result["session"] = m_strand_profilers.session.snapshot();
+		result["contact"] = m_strand_profilers.contact.snapshot();
+
+		return result;
+	}
+
 	std::ostream& operator<<(std::ostream& os, server::session_loss_reason value)
 	{
 		switch (value)
@@ -86,6 +86,14 @@ namespace fscp
 			{
 				return "No session is available for the specified host";
 			}
+			case server_error::no_identity:
+			{
+				return "The identity is not available yet";
+			}
+			case server_error::reliable_send_timed_out:
+			{
+				return "The reliable send was not acknowledged in time";
+			}
 			default:
 			{
 				return "Unknown FSCP error";
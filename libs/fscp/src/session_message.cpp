@@ -45,6 +45,7 @@
 #include "session_message.hpp"
 
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 
 #include <cryptoplus/hash/message_digest_context.hpp>
@@ -113,17 +114,16 @@ namespace fscp
 	session_message::session_message(const message& _message) :
 		message(_message)
 	{
-		if (length() < MIN_BODY_LENGTH)
+		// The fixed part is validated with a single bound against the layout
+		// size, which makes public_key_size() safe to read; one more bound
+		// then covers both variable parts, since the signature size can only
+		// be read once the public key is known to fit.
+		if (length() < body_layout::SIZE)
 		{
 			throw std::runtime_error("buf_len");
 		}
 
-		if (length() < MIN_BODY_LENGTH + public_key_size())
-		{
-			throw std::runtime_error("buf_len");
-		}
-
-		if (length() < MIN_BODY_LENGTH + public_key_size() + header_signature_size())
+		if ((length() < header_size() + sizeof(uint16_t)) || (length() < header_size() + sizeof(uint16_t) + header_signature_size()))
 		{
 			throw std::runtime_error("buf_len");
 		}
@@ -151,10 +151,13 @@ namespace fscp
 		cryptoplus::hash::hmac_context hmctx;
 		hmctx.initialize(pre_shared_key, pre_shared_key_len, &mdalg);
 		hmctx.update(payload(), header_size());
-		const auto verified_signature = hmctx.finalize();
-		const cryptoplus::buffer signature(header_signature(), header_signature_size());
 
-		return (signature == verified_signature);
+		// The expected HMAC goes on the stack: verifying a handshake makes
+		// no heap allocation.
+		uint8_t verified_signature[EVP_MAX_MD_SIZE];
+		const size_t verified_signature_size = hmctx.finalize(verified_signature, sizeof(verified_signature));
+
+		return ((header_signature_size() == verified_signature_size) && (std::memcmp(header_signature(), verified_signature, verified_signature_size) == 0));
 	}
 
 	size_t session_message::write_unsigned(uint8_t* payload, size_t payload_len, session_number_type _session_number, const host_identifier_type& _host_identifier, cipher_suite_type cs, elliptic_curve_type ec, const void* pub_key, size_t pub_key_len)
@@ -169,14 +172,14 @@ namespace fscp
 			throw std::runtime_error("payload_len");
 		}
 
-		buffer_tools::set<session_number_type>(payload, 0, htonl(_session_number));
-		std::copy(_host_identifier.data.begin(), _host_identifier.data.end(), payload + sizeof(_session_number));
-		buffer_tools::set<uint8_t>(payload, sizeof(session_number_type) + host_identifier_type::data_type::static_size, cs.value());
-		buffer_tools::set<uint8_t>(payload, sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t), ec.value());
-		buffer_tools::set<uint8_t>(payload, sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 2, 0x00);
-		buffer_tools::set<uint8_t>(payload, sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 3, 0x00);
-		buffer_tools::set<uint16_t>(payload, sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 4, htons(static_cast<uint16_t>(pub_key_len)));
-		std::memcpy(static_cast<uint8_t*>(payload)+sizeof(session_number_type) + host_identifier_type::data_type::static_size + sizeof(uint8_t) * 4 + sizeof(uint16_t), pub_key, pub_key_len);
+		buffer_tools::set<session_number_type>(payload, body_layout::field<FIELD_SESSION_NUMBER>::OFFSET, htonl(_session_number));
+		std::copy(_host_identifier.data.begin(), _host_identifier.data.end(), payload + body_layout::field<FIELD_HOST_IDENTIFIER>::OFFSET);
+		buffer_tools::set<uint8_t>(payload, body_layout::field<FIELD_CIPHER_SUITE>::OFFSET, cs.value());
+		buffer_tools::set<uint8_t>(payload, body_layout::field<FIELD_ELLIPTIC_CURVE>::OFFSET, ec.value());
+		buffer_tools::set<uint8_t>(payload, body_layout::field<FIELD_CAPABILITIES>::OFFSET, local_session_capabilities());
+		buffer_tools::set<uint8_t>(payload, body_layout::field<FIELD_RESERVED>::OFFSET, 0x00);
+		buffer_tools::set<uint16_t>(payload, body_layout::field<FIELD_PUBLIC_KEY_LENGTH>::OFFSET, htons(static_cast<uint16_t>(pub_key_len)));
+		std::memcpy(payload + body_layout::SIZE, pub_key, pub_key_len);
 
 		return unsigned_payload_size;
 	}
@@ -45,6 +45,7 @@
 #include "session_request_message.hpp"
 
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 
 #include <cryptoplus/hash/message_digest_context.hpp>
@@ -85,7 +86,12 @@ namespace fscp
 		mdctx.digest_sign_finalize(payload + unsigned_payload_size + sizeof(uint16_t), signature_size);
 		buffer_tools::set<uint16_t>(payload, unsigned_payload_size, htons(static_cast<uint16_t>(signature_size)));
 
-		return message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, MESSAGE_TYPE_SESSION_REQUEST, signed_payload_size) + signed_payload_size;
+		// The extension block goes after the signature: hosts from before
+		// the extensions validate the body with lower bounds only, so they
+		// ignore the trailing bytes.
+		const size_t extended_payload_size = signed_payload_size + write_extensions(payload + signed_payload_size, buf_len - HEADER_LENGTH - signed_payload_size);
+
+		return message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, MESSAGE_TYPE_SESSION_REQUEST, extended_payload_size) + extended_payload_size;
 	}
 
 	size_t session_request_message::write(void* buf, size_t buf_len, session_number_type _session_number, const host_identifier_type& _host_identifier, const cipher_suite_list_type& cs_cap, const elliptic_curve_list_type& ec_cap, const void* pre_shared_key, size_t pre_shared_key_len)
@@ -97,7 +103,7 @@ namespace fscp
 		uint8_t* const payload = static_cast<uint8_t*>(buf) + HEADER_LENGTH;
 		const size_t unsigned_payload_size = write_unsigned(payload, buf_len - HEADER_LENGTH, _session_number, _host_identifier, cs_cap, ec_cap);
 
-		if (buf_len < HEADER_LENGTH + unsigned_payload_size + mdalg.result_size())
+		if (buf_len < HEADER_LENGTH + unsigned_payload_size + sizeof(uint16_t) + mdalg.result_size())
 		{
 			throw std::runtime_error("buf_len");
 		}
@@ -110,7 +116,11 @@ namespace fscp
 
 		const size_t signed_payload_size = unsigned_payload_size + sizeof(uint16_t) + mdalg.result_size();
 
-		return message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, MESSAGE_TYPE_SESSION_REQUEST, signed_payload_size) + signed_payload_size;
+		// See the signed variant above for why the extension block goes
+		// after the signature.
+		const size_t extended_payload_size = signed_payload_size + write_extensions(payload + signed_payload_size, buf_len - HEADER_LENGTH - signed_payload_size);
+
+		return message::write(buf, buf_len, CURRENT_PROTOCOL_VERSION, MESSAGE_TYPE_SESSION_REQUEST, extended_payload_size) + extended_payload_size;
 	}
 
 	session_request_message::session_request_message(const message& _message) :
@@ -185,10 +195,13 @@ namespace fscp
 		cryptoplus::hash::hmac_context hmctx;
 		hmctx.initialize(pre_shared_key, pre_shared_key_len, &mdalg);
 		hmctx.update(payload(), header_size());
-		const auto verified_signature = hmctx.finalize();
-		const cryptoplus::buffer signature(header_signature(), header_signature_size());
 
-		return (signature == verified_signature);
+		// The expected HMAC goes on the stack: verifying a handshake makes
+		// no heap allocation.
+		uint8_t verified_signature[EVP_MAX_MD_SIZE];
+		const size_t verified_signature_size = hmctx.finalize(verified_signature, sizeof(verified_signature));
+
+		return ((header_signature_size() == verified_signature_size) && (std::memcmp(header_signature(), verified_signature, verified_signature_size) == 0));
 	}
 
 	size_t session_request_message::write_unsigned(uint8_t* payload, size_t payload_len, session_number_type _session_number, const host_identifier_type& _host_identifier, const cipher_suite_list_type& cs_cap, const elliptic_curve_list_type& ec_cap)
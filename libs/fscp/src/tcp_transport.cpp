@@ -0,0 +1,474 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file tcp_transport.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A TCP fallback transport for the FSCP message layer.
+ */
+
+#include "tcp_transport.hpp"
+
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
+
+#include <deque>
+
+namespace fscp
+{
+	namespace
+	{
+		tcp_transport::tcp_ep_type to_tcp(const tcp_transport::ep_type& ep)
+		{
+			return tcp_transport::tcp_ep_type(ep.address(), ep.port());
+		}
+
+		tcp_transport::ep_type from_tcp(const tcp_transport::tcp_ep_type& ep)
+		{
+			return tcp_transport::ep_type(ep.address(), ep.port());
+		}
+	}
+
+	/**
+	 * \brief A single TCP connection, with its framing state.
+	 *
+	 * Every message is prefixed by its 16-bit big-endian length. Writes go
+	 * through a per-connection queue drained one frame at a time: the count
+	 * of queued bytes is bounded and droppable frames are shed when the
+	 * connection cannot drain fast enough, so one slow TCP peer does not
+	 * consume unbounded buffers.
+	 */
+	struct tcp_transport::connection : public boost::enable_shared_from_this<tcp_transport::connection>
+	{
+		struct pending_write_type
+		{
+			pending_write_type(SharedBuffer _data, size_t _offset, size_t _size, simple_handler_type _handler) :
+				data(_data),
+				offset(_offset),
+				size(_size),
+				handler(_handler)
+			{
+				header[0] = static_cast<uint8_t>((size >> 8) & 0xFF);
+				header[1] = static_cast<uint8_t>(size & 0xFF);
+			}
+
+			SharedBuffer data;
+			size_t offset;
+			size_t size;
+			simple_handler_type handler;
+			boost::array<uint8_t, 2> header;
+		};
+
+		connection(tcp_transport& transport, boost::asio::io_service& io_service) :
+			m_transport(transport),
+			m_socket(io_service),
+			m_strand(io_service),
+			m_pending_write_size(0),
+			m_closed(false)
+		{
+		}
+
+		void start(const ep_type& key)
+		{
+			m_key = key;
+
+			m_socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+			async_read_header();
+		}
+
+		void async_send(SharedBuffer data, size_t offset, size_t size, simple_handler_type handler, bool droppable)
+		{
+			m_strand.post(boost::bind(&connection::do_send, shared_from_this(), data, offset, size, handler, droppable));
+		}
+
+		void async_close()
+		{
+			m_strand.post(boost::bind(&connection::do_close, shared_from_this()));
+		}
+
+		void do_send(SharedBuffer data, size_t offset, size_t size, simple_handler_type handler, bool droppable)
+		{
+			// All do_send() calls are done in the same strand so the following is thread-safe.
+			if (m_closed)
+			{
+				handler(boost::asio::error::not_connected);
+
+				return;
+			}
+
+			if (droppable && (m_pending_write_size + size > MAX_PENDING_WRITE_SIZE))
+			{
+				// The peer cannot drain fast enough: load is shed on this
+				// connection only, and a late delivery of a droppable frame
+				// is worthless anyway.
+				handler(boost::asio::error::no_buffer_space);
+
+				return;
+			}
+
+			m_write_queue.push_back(pending_write_type(data, offset, size, handler));
+			m_pending_write_size += size;
+
+			if (m_write_queue.size() == 1)
+			{
+				do_write();
+			}
+		}
+
+		void do_write()
+		{
+			// All do_write() calls are done in the same strand so the following is thread-safe.
+			pending_write_type& entry = m_write_queue.front();
+
+			boost::array<boost::asio::const_buffer, 2> buffers = {{
+				boost::asio::buffer(entry.header),
+				boost::asio::buffer(buffer(entry.data) + entry.offset, entry.size)
+			}};
+
+			boost::asio::async_write(
+				m_socket,
+				buffers,
+				m_strand.wrap(boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error))
+			);
+		}
+
+		void handle_write(const boost::system::error_code& ec)
+		{
+			const pending_write_type entry = m_write_queue.front();
+
+			m_write_queue.pop_front();
+			m_pending_write_size -= entry.size;
+
+			entry.handler(ec);
+
+			if (ec)
+			{
+				do_close();
+			}
+			else if (!m_write_queue.empty())
+			{
+				do_write();
+			}
+		}
+
+		void async_read_header()
+		{
+			boost::asio::async_read(
+				m_socket,
+				boost::asio::buffer(m_header),
+				m_strand.wrap(boost::bind(&connection::handle_read_header, shared_from_this(), boost::asio::placeholders::error))
+			);
+		}
+
+		void handle_read_header(const boost::system::error_code& ec)
+		{
+			if (ec)
+			{
+				do_close();
+
+				return;
+			}
+
+			const size_t size = (static_cast<size_t>(m_header[0]) << 8) | static_cast<size_t>(m_header[1]);
+
+			if (size == 0)
+			{
+				// An empty frame carries nothing for the message layer.
+				async_read_header();
+
+				return;
+			}
+
+			// Get either a new buffer or an old, recycled one if possible.
+			const SharedBuffer receive_buffer = m_transport.m_receive_buffers.get();
+
+			boost::asio::async_read(
+				m_socket,
+				buffer(receive_buffer, size),
+				m_strand.wrap(boost::bind(&connection::handle_read_body, shared_from_this(), receive_buffer, size, boost::asio::placeholders::error))
+			);
+		}
+
+		void handle_read_body(SharedBuffer data, size_t size, const boost::system::error_code& ec)
+		{
+			if (ec)
+			{
+				do_close();
+
+				return;
+			}
+
+			if (m_transport.m_message_received_handler)
+			{
+				m_transport.m_message_received_handler(m_key, data, size);
+			}
+
+			async_read_header();
+		}
+
+		void do_close()
+		{
+			// All do_close() calls are done in the same strand so the following is thread-safe.
+			if (m_closed)
+			{
+				return;
+			}
+
+			m_closed = true;
+
+			boost::system::error_code ec;
+			m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+			m_socket.close(ec);
+
+			while (!m_write_queue.empty())
+			{
+				m_write_queue.front().handler(boost::asio::error::not_connected);
+				m_write_queue.pop_front();
+			}
+
+			m_pending_write_size = 0;
+
+			m_transport.handle_connection_lost(m_key, shared_from_this());
+		}
+
+		tcp_transport& m_transport;
+		boost::asio::ip::tcp::socket m_socket;
+		boost::asio::io_service::strand m_strand;
+		ep_type m_key;
+		boost::array<uint8_t, 2> m_header;
+		std::deque<pending_write_type> m_write_queue;
+		size_t m_pending_write_size;
+		bool m_closed;
+	};
+
+	tcp_transport::tcp_transport(boost::asio::io_service& io_service, fscp::logger& _logger) :
+		m_io_service(io_service),
+		m_logger(_logger),
+		m_acceptor(io_service),
+		m_receive_buffers(MAX_FRAME_SIZE + 1)
+	{
+	}
+
+	void tcp_transport::open(const ep_type& listen_endpoint)
+	{
+		const tcp_ep_type tcp_listen_endpoint = to_tcp(listen_endpoint);
+
+		m_acceptor.open(tcp_listen_endpoint.protocol());
+		m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+		m_acceptor.bind(tcp_listen_endpoint);
+		m_acceptor.listen();
+
+		async_accept();
+	}
+
+	void tcp_transport::close()
+	{
+		boost::system::error_code ec;
+		m_acceptor.close(ec);
+
+		std::map<ep_type, boost::shared_ptr<connection> > connections;
+
+		{
+			boost::mutex::scoped_lock lock(m_connections_mutex);
+
+			connections.swap(m_connections);
+		}
+
+		for (std::map<ep_type, boost::shared_ptr<connection> >::iterator it = connections.begin(); it != connections.end(); ++it)
+		{
+			it->second->async_close();
+		}
+	}
+
+	bool tcp_transport::has_connection(const ep_type& target) const
+	{
+		boost::mutex::scoped_lock lock(m_connections_mutex);
+
+		return (m_connections.find(target) != m_connections.end());
+	}
+
+	void tcp_transport::async_connect(const ep_type& target, simple_handler_type handler)
+	{
+		if (has_connection(target))
+		{
+			handler(boost::system::error_code());
+
+			return;
+		}
+
+		const boost::shared_ptr<connection> conn = boost::make_shared<connection>(boost::ref(*this), boost::ref(m_io_service));
+
+		conn->m_socket.async_connect(
+			to_tcp(target),
+			[this, conn, target, handler] (const boost::system::error_code& ec)
+			{
+				if (ec)
+				{
+					m_logger(log_level::debug) << "TCP connection to " << target << " failed: " << ec.message();
+
+					handler(ec);
+
+					return;
+				}
+
+				m_logger(log_level::information) << "TCP connection established with " << target << ".";
+
+				register_connection(target, conn);
+
+				conn->start(target);
+
+				handler(ec);
+			}
+		);
+	}
+
+	void tcp_transport::async_send(const ep_type& target, SharedBuffer data, size_t offset, size_t size, simple_handler_type handler, bool droppable)
+	{
+		const boost::shared_ptr<connection> conn = connection_for(target);
+
+		if (!conn)
+		{
+			handler(boost::asio::error::not_connected);
+
+			return;
+		}
+
+		conn->async_send(data, offset, size, handler, droppable);
+	}
+
+	void tcp_transport::async_accept()
+	{
+		const boost::shared_ptr<connection> conn = boost::make_shared<connection>(boost::ref(*this), boost::ref(m_io_service));
+
+		m_acceptor.async_accept(
+			conn->m_socket,
+			[this, conn] (const boost::system::error_code& ec)
+			{
+				if (ec)
+				{
+					// The acceptor was closed: the accept loop ends here.
+					return;
+				}
+
+				async_accept();
+
+				boost::system::error_code remote_ec;
+				const tcp_ep_type remote_endpoint = conn->m_socket.remote_endpoint(remote_ec);
+
+				if (remote_ec)
+				{
+					return;
+				}
+
+				const ep_type key = from_tcp(remote_endpoint);
+
+				m_logger(log_level::information) << "TCP connection accepted from " << key << ".";
+
+				register_connection(key, conn);
+
+				conn->start(key);
+			}
+		);
+	}
+
+	boost::shared_ptr<tcp_transport::connection> tcp_transport::connection_for(const ep_type& target) const
+	{
+		boost::mutex::scoped_lock lock(m_connections_mutex);
+
+		const std::map<ep_type, boost::shared_ptr<connection> >::const_iterator it = m_connections.find(target);
+
+		return (it != m_connections.end()) ? it->second : boost::shared_ptr<connection>();
+	}
+
+	void tcp_transport::register_connection(const ep_type& target, boost::shared_ptr<connection> conn)
+	{
+		boost::shared_ptr<connection> previous;
+
+		{
+			boost::mutex::scoped_lock lock(m_connections_mutex);
+
+			std::map<ep_type, boost::shared_ptr<connection> >::iterator it = m_connections.find(target);
+
+			if (it != m_connections.end())
+			{
+				previous = it->second;
+				it->second = conn;
+			}
+			else
+			{
+				m_connections[target] = conn;
+			}
+		}
+
+		if (previous)
+		{
+			previous->async_close();
+		}
+	}
+
+	void tcp_transport::handle_connection_lost(const ep_type& target, boost::shared_ptr<connection> conn)
+	{
+		bool was_registered = false;
+
+		{
+			boost::mutex::scoped_lock lock(m_connections_mutex);
+
+			std::map<ep_type, boost::shared_ptr<connection> >::iterator it = m_connections.find(target);
+
+			if ((it != m_connections.end()) && (it->second == conn))
+			{
+				m_connections.erase(it);
+
+				was_registered = true;
+			}
+		}
+
+		if (was_registered)
+		{
+			m_logger(log_level::information) << "TCP connection with " << target << " was lost.";
+
+			if (m_connection_lost_handler)
+			{
+				m_connection_lost_handler(target);
+			}
+		}
+	}
+}
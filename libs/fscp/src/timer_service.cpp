@@ -0,0 +1,218 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file timer_service.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A coalescing timer service.
+ */
+
+#include "timer_service.hpp"
+
+#include <boost/bind.hpp>
+
+namespace fscp
+{
+	timer_service::timer_service(boost::asio::io_service& io_service, const boost::posix_time::time_duration& granularity) :
+		m_io_service(io_service),
+		m_granularity(granularity),
+		m_epoch(boost::posix_time::microsec_clock::universal_time()),
+		m_timer(io_service),
+		m_armed(false),
+		m_armed_deadline(boost::posix_time::pos_infin),
+		m_next_id(0)
+	{
+	}
+
+	timer_service::timer_id timer_service::schedule(const boost::posix_time::time_duration& timeout, timer_handler_type handler)
+	{
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+		// Round the deadline up to the granularity, never down: a
+		// timeout may fire late by at most one granularity but never
+		// early.
+		const long granularity_ms = static_cast<long>(m_granularity.total_milliseconds());
+		const long deadline_ms = static_cast<long>(((now + timeout) - m_epoch).total_milliseconds());
+		const long bucket_ms = ((deadline_ms + granularity_ms - 1) / granularity_ms) * granularity_ms;
+
+		const boost::posix_time::ptime deadline = m_epoch + boost::posix_time::milliseconds(bucket_ms);
+
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		const timer_id id = ++m_next_id;
+
+		const pending_type pending = { id, handler };
+
+		m_buckets[deadline].push_back(pending);
+		m_deadlines[id] = deadline;
+
+		if (!m_armed || (deadline < m_armed_deadline))
+		{
+			arm_locked(deadline);
+		}
+
+		return id;
+	}
+
+	size_t timer_service::cancel(timer_id id)
+	{
+		timer_handler_type handler;
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			const deadline_map_type::iterator deadline = m_deadlines.find(id);
+
+			if (deadline == m_deadlines.end())
+			{
+				return 0;
+			}
+
+			std::vector<pending_type>& bucket = m_buckets[deadline->second];
+
+			for (std::vector<pending_type>::iterator pending = bucket.begin(); pending != bucket.end(); ++pending)
+			{
+				if (pending->id == id)
+				{
+					handler = pending->handler;
+					bucket.erase(pending);
+
+					break;
+				}
+			}
+
+			if (bucket.empty())
+			{
+				// The OS timer is not reprogrammed: a tick on an empty
+				// bucket finds nothing due and rearms on the next one.
+				m_buckets.erase(deadline->second);
+			}
+
+			m_deadlines.erase(deadline);
+		}
+
+		m_io_service.post(boost::bind(handler, boost::asio::error::operation_aborted));
+
+		return 1;
+	}
+
+	void timer_service::cancel_all()
+	{
+		std::vector<timer_handler_type> handlers;
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			for (bucket_map_type::iterator bucket = m_buckets.begin(); bucket != m_buckets.end(); ++bucket)
+			{
+				for (std::vector<pending_type>::iterator pending = bucket->second.begin(); pending != bucket->second.end(); ++pending)
+				{
+					handlers.push_back(pending->handler);
+				}
+			}
+
+			m_buckets.clear();
+			m_deadlines.clear();
+		}
+
+		for (std::vector<timer_handler_type>::iterator handler = handlers.begin(); handler != handlers.end(); ++handler)
+		{
+			m_io_service.post(boost::bind(*handler, boost::asio::error::operation_aborted));
+		}
+	}
+
+	void timer_service::arm_locked(const boost::posix_time::ptime& deadline)
+	{
+		m_armed_deadline = deadline;
+
+		if ((m_timer.expires_at(deadline) > 0) || !m_armed)
+		{
+			// Either no wait was outstanding or the outstanding wait was
+			// cancelled by the reprogramming: a new wait is needed. If a
+			// wait was outstanding but too late to cancel, its tick is
+			// already queued and rearms from the buckets itself.
+			m_timer.async_wait(boost::bind(&timer_service::handle_tick, this, boost::asio::placeholders::error));
+			m_armed = true;
+		}
+	}
+
+	void timer_service::handle_tick(const boost::system::error_code& ec)
+	{
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			// The wait was reprogrammed to an earlier deadline and a new
+			// wait is already outstanding.
+			return;
+		}
+
+		std::vector<pending_type> due;
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			m_armed = false;
+
+			const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+			while (!m_buckets.empty() && (m_buckets.begin()->first <= now))
+			{
+				std::vector<pending_type>& bucket = m_buckets.begin()->second;
+
+				for (std::vector<pending_type>::iterator pending = bucket.begin(); pending != bucket.end(); ++pending)
+				{
+					m_deadlines.erase(pending->id);
+					due.push_back(*pending);
+				}
+
+				m_buckets.erase(m_buckets.begin());
+			}
+
+			if (!m_buckets.empty())
+			{
+				arm_locked(m_buckets.begin()->first);
+			}
+		}
+
+		// The handlers run outside the lock: they may schedule or cancel
+		// other timeouts.
+		for (std::vector<pending_type>::iterator pending = due.begin(); pending != due.end(); ++pending)
+		{
+			pending->handler(boost::system::error_code());
+		}
+	}
+}
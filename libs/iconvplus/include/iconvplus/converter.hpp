@@ -51,6 +51,7 @@
 #include <boost/system/system_error.hpp>
 
 #include <iostream>
+#include <string>
 #include <vector>
 #include <cassert>
 
@@ -175,6 +176,28 @@ namespace iconvplus
 			 */
 			void convert(input_stream_type& is, output_stream_type& os, size_t* non_reversible_conversions = NULL);
 
+			/**
+			 * \brief Proceed to the conversion of a whole string.
+			 * \param in The input string.
+			 * \param out The output string. It is cleared first, even on error.
+			 * \param ec The error code, if an error occurs.
+			 * \param non_reversible_conversions If not NULL, *non_reversible_conversions will be updated to indicate the count of non-reversible conversions performed during the call.
+			 * \return true on success. On error, ec is updated to indicate the error.
+			 *
+			 * The conversion goes through the converter's reusable internal buffer: apart from the growth of out, no allocation is performed. Keep the converter instance alive to convert repeatedly, e.g. one log line per call.
+			 */
+			bool convert(const std::basic_string<input_char_type>& in, std::basic_string<output_char_type>& out, boost::system::error_code& ec, size_t* non_reversible_conversions = NULL);
+
+			/**
+			 * \brief Proceed to the conversion of a whole string.
+			 * \param in The input string.
+			 * \param out The output string. It is cleared first, even on error.
+			 * \param non_reversible_conversions If not NULL, *non_reversible_conversions will be updated to indicate the count of non-reversible conversions performed during the call.
+			 *
+			 * On error, a boost::system::system_error is thrown.
+			 */
+			void convert(const std::basic_string<input_char_type>& in, std::basic_string<output_char_type>& out, size_t* non_reversible_conversions = NULL);
+
 		private:
 
 			const iconv_instance* m_iconv_instance;
@@ -209,6 +232,17 @@ namespace iconvplus
 			throw boost::system::system_error(ec);
 		}
 	}
+
+	template <typename InputCharType, typename OutputCharType>
+	inline void converter<InputCharType, OutputCharType>::convert(const std::basic_string<input_char_type>& in, std::basic_string<output_char_type>& out, size_t* non_reversible_conversions)
+	{
+		boost::system::error_code ec;
+
+		if (!convert(in, out, ec, non_reversible_conversions))
+		{
+			throw boost::system::system_error(ec);
+		}
+	}
 }
 
 #endif /* ICONVPLUS_CONVERTER_HPP */
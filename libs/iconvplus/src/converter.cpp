@@ -124,6 +124,59 @@ namespace iconvplus
 		return true;
 	}
 
+	template <typename InputCharType, typename OutputCharType>
+	bool converter<InputCharType, OutputCharType>::convert(const std::basic_string<input_char_type>& in, std::basic_string<output_char_type>& out, boost::system::error_code& ec, size_t* non_reversible_conversions)
+	{
+		assert(m_output_buffer.size() > 0);
+
+		size_t counter = 0;
+
+		if (!non_reversible_conversions) non_reversible_conversions = &counter;
+
+		out.clear();
+
+		m_iconv_instance->reset();
+
+		const char* inbuf = reinterpret_cast<const char*>(in.data());
+		size_t itmp_size = in.size() * sizeof(input_char_type);
+		size_t otmp_size = m_output_buffer.size() * sizeof(output_char_type);
+		char* outbuf = reinterpret_cast<char*>(&m_output_buffer[0]);
+
+		if (!m_iconv_instance->write_initial_state(&outbuf, &otmp_size, ec))
+		{
+			return false;
+		}
+		else
+		{
+			out.append(&m_output_buffer[0], m_output_buffer.size() - otmp_size / sizeof(output_char_type));
+		}
+
+		while (itmp_size > 0)
+		{
+			otmp_size = m_output_buffer.size() * sizeof(output_char_type);
+			outbuf = reinterpret_cast<char*>(&m_output_buffer[0]);
+
+			const size_t result = m_iconv_instance->convert(&inbuf, &itmp_size, &outbuf, &otmp_size, ec);
+
+			out.append(&m_output_buffer[0], m_output_buffer.size() - otmp_size / sizeof(output_char_type));
+
+			if (result == iconv_instance::ERROR_VALUE)
+			{
+				// The input is complete, so an incomplete multi-byte sequence (EINVAL) is a genuine error here. E2BIG simply calls for another pass, unless no progress was made at all.
+				if ((ec.value() != E2BIG) || (otmp_size >= m_output_buffer.size() * sizeof(output_char_type)))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				*non_reversible_conversions += result;
+			}
+		}
+
+		return true;
+	}
+
 	template class converter<char, char>;
 	template class converter<char, wchar_t>;
 	template class converter<wchar_t, char>;
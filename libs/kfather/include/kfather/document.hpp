@@ -0,0 +1,315 @@
+/*
+ * libkfather - C++ JSON parser/producer library.
+ * Copyright (C) 2010-2012 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libkfather.
+ *
+ * libkfather is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libkfather is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * If you intend to use libkfather in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file document.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An arena-backed JSON document class.
+ */
+
+#ifndef KFATHER_DOCUMENT_HPP
+#define KFATHER_DOCUMENT_HPP
+
+#include <map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "parser.hpp"
+#include "value.hpp"
+
+namespace kfather
+{
+	/**
+	 * \brief An arena-backed JSON document class.
+	 *
+	 * A document owns every node, string and key of the value tree it parses:
+	 * the nodes live in a bump allocator and the object keys are interned, so
+	 * a big document costs a handful of large allocations instead of one
+	 * small allocation per node. Repeated keys - the common case in lists of
+	 * records - are stored only once.
+	 *
+	 * The tree is read through lightweight node handles, which mirror the
+	 * accessors of value_type. The handles remain valid as long as the
+	 * document instance exists and clear() is not called.
+	 *
+	 * A document instance is not thread-safe.
+	 */
+	class document : public boost::noncopyable
+	{
+		private:
+
+			struct member_impl;
+
+			struct node_impl
+			{
+				enum kind_type
+				{
+					kind_null,
+					kind_boolean,
+					kind_number,
+					kind_string,
+					kind_array,
+					kind_object
+				};
+
+				kind_type kind;
+
+				union
+				{
+					boolean_type boolean;
+					number_type number;
+
+					struct
+					{
+						const char* data;
+						size_t size;
+					} string;
+
+					struct
+					{
+						const node_impl* items;
+						size_t size;
+					} array;
+
+					struct
+					{
+						const member_impl* items;
+						size_t size;
+					} object;
+				};
+			};
+
+			struct member_impl
+			{
+				const char* key;
+				size_t key_size;
+				node_impl value;
+			};
+
+		public:
+
+			/**
+			 * \brief A lightweight handle over a node of the document.
+			 *
+			 * A node never owns anything: copying one is copying a pointer.
+			 * The accessors follow the Javascript conversion rules of
+			 * value_cast() for scalars.
+			 */
+			class node
+			{
+				public:
+
+					/**
+					 * \brief Create a null node.
+					 */
+					node() : m_impl(NULL) {}
+
+					/**
+					 * \brief Check whether the node is null.
+					 * \return true if the node is a null value.
+					 */
+					bool is_null() const;
+
+					/**
+					 * \brief Check whether the node is a boolean.
+					 * \return true if the node is a boolean value.
+					 */
+					bool is_boolean() const;
+
+					/**
+					 * \brief Check whether the node is a number.
+					 * \return true if the node is a number value.
+					 */
+					bool is_number() const;
+
+					/**
+					 * \brief Check whether the node is a string.
+					 * \return true if the node is a string value.
+					 */
+					bool is_string() const;
+
+					/**
+					 * \brief Check whether the node is an array.
+					 * \return true if the node is an array.
+					 */
+					bool is_array() const;
+
+					/**
+					 * \brief Check whether the node is an object.
+					 * \return true if the node is an object.
+					 */
+					bool is_object() const;
+
+					/**
+					 * \brief Get the node as a boolean.
+					 * \return The boolean value, following the Javascript truthiness rules.
+					 */
+					boolean_type as_boolean() const;
+
+					/**
+					 * \brief Get the node as a number.
+					 * \return The number value, or 0 for non-numbers.
+					 */
+					number_type as_number() const;
+
+					/**
+					 * \brief Get the node as a string.
+					 * \return The string value. Non-strings convert like value_cast<string_type>() does.
+					 */
+					string_type as_string() const;
+
+					/**
+					 * \brief Get the count of items of an array or an object.
+					 * \return The count of items, or 0 if the node is neither an array nor an object.
+					 */
+					size_t size() const;
+
+					/**
+					 * \brief Get an item of an array.
+					 * \param index The index. Must be lower than size() or the behavior is undefined.
+					 * \return The item.
+					 */
+					node at(size_t index) const;
+
+					/**
+					 * \brief Get the key of an object member.
+					 * \param index The index. Must be lower than size() or the behavior is undefined. The node must be an object.
+					 * \return The key.
+					 */
+					string_type key_at(size_t index) const;
+
+					/**
+					 * \brief Get a value of an object.
+					 * \param key The key.
+					 * \return The value, or a null node if the key does not exist or if the node is not an object.
+					 */
+					node get(const string_type& key) const;
+
+				private:
+
+					explicit node(const node_impl* impl) : m_impl(impl) {}
+
+					const node_impl* m_impl;
+
+					friend class document;
+			};
+
+			/**
+			 * \brief Create an empty document.
+			 */
+			document();
+
+			/**
+			 * \brief Feed a chunk of JSON input to the document.
+			 * \param buf The chunk. Cannot be null. The chunk may start or end anywhere in the input.
+			 * \param buflen The length of buf.
+			 * \return true as long as the input remains a valid JSON document prefix, false otherwise.
+			 * \see stream_parser::feed
+			 */
+			bool feed(const char* buf, size_t buflen);
+
+			/**
+			 * \brief Feed a chunk of JSON input to the document.
+			 * \param chunk The chunk.
+			 * \return true as long as the input remains a valid JSON document prefix, false otherwise.
+			 */
+			bool feed(const std::string& chunk);
+
+			/**
+			 * \brief Signal the end of the input.
+			 * \return true if the input formed exactly one complete JSON document, false otherwise.
+			 */
+			bool finish();
+
+			/**
+			 * \brief Parse a complete JSON input.
+			 * \param buf The input. Cannot be null.
+			 * \param buflen The length of buf.
+			 * \return true if the parsing succeeds, false otherwise.
+			 *
+			 * Any previous content of the document is cleared first.
+			 */
+			bool parse(const char* buf, size_t buflen);
+
+			/**
+			 * \brief Parse a complete JSON input.
+			 * \param str The input.
+			 * \return true if the parsing succeeds, false otherwise.
+			 */
+			bool parse(const std::string& str);
+
+			/**
+			 * \brief Get the root node of the document.
+			 * \return The root node, or a null node if no parsing succeeded.
+			 */
+			node root() const;
+
+			/**
+			 * \brief Clear the document and release every node it owns.
+			 */
+			void clear();
+
+		private:
+
+			static const size_t ARENA_BLOCK_SIZE;
+
+			struct build_node
+			{
+				const char* key;
+				size_t key_size;
+				node_impl value;
+			};
+
+			static bool member_less(const member_impl& lhs, const member_impl& rhs);
+
+			void* arena_allocate(size_t size);
+			const char* arena_store(const string_type& str);
+			void intern_key(const string_type& key, const char*& key_ptr, size_t& key_size);
+			void push_value(const node_impl& value);
+			void handle_object_start();
+			void handle_key(const string_type& key);
+			void handle_object_end();
+			void handle_array_start();
+			void handle_array_end();
+			void handle_string(const string_type& str);
+			void handle_number(const number_type& number);
+			void handle_boolean(const boolean_type& boolean);
+			void handle_null();
+
+			stream_parser m_parser;
+			std::vector<std::vector<char> > m_arena;
+			size_t m_arena_used;
+			std::map<string_type, const char*> m_interned_keys;
+			std::vector<build_node> m_build_stack;
+			std::vector<size_t> m_build_marks;
+			const char* m_pending_key;
+			size_t m_pending_key_size;
+			node_impl m_root;
+			bool m_has_root;
+	};
+}
+
+#endif /* KFATHER_DOCUMENT_HPP */
@@ -35,6 +35,8 @@
 #include <iostream>
 #include <sstream>
 
+#include <boost/function.hpp>
+
 #include "value.hpp"
 
 namespace kfather
@@ -235,6 +237,37 @@ namespace kfather
 	 * \brief A pretty-print formatter class.
 	 */
 	typedef generic_formatter<pretty_print_formatter_visitor> pretty_print_formatter;
+
+	/**
+	 * \brief A compact formatter that writes to a sink, chunk by chunk.
+	 *
+	 * The output matches compact_formatter exactly, but instead of building
+	 * the whole document in memory, the formatter fills a fixed-size internal
+	 * buffer and hands full chunks to a caller-provided sink. Serializing a
+	 * document thus costs a constant amount of memory, no matter its size.
+	 *
+	 * Numbers are formatted into a preallocated scratch buffer instead of
+	 * going through an output stream.
+	 */
+	class compact_sink_formatter
+	{
+		public:
+
+			/**
+			 * \brief The sink type.
+			 *
+			 * The sink is called with consecutive chunks of the serialized
+			 * document, in order. Chunks do not split at token boundaries.
+			 */
+			typedef boost::function<void (const char* data, size_t data_len)> sink_type;
+
+			/**
+			 * \brief Format the specified value to the specified sink.
+			 * \param sink The sink to write the serialized value to.
+			 * \param value The value to format.
+			 */
+			void format(const sink_type& sink, const value_type& value) const;
+	};
 }
 
 #endif /* KFATHER_FORMATTER_HPP */
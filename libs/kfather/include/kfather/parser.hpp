@@ -33,6 +33,7 @@
 #define KFATHER_PARSER_HPP
 
 #include <iostream>
+#include <vector>
 
 #include <boost/function.hpp>
 
@@ -147,6 +148,7 @@ namespace kfather
 					context();
 					void clear();
 					void push_char(char c);
+					void push_chars(const char* first, const char* last);
 					void push_codepoint(uint16_t cp);
 					const std::string& str();
 					bool get_number(number_type&);
@@ -160,6 +162,16 @@ namespace kfather
 					string_type m_str;
 			};
 
+			/**
+			 * \brief Get the parsing context of the calling thread.
+			 * \return A cleared context, ready for a new document.
+			 *
+			 * The context owns an iconv descriptor and scratch strings:
+			 * reusing it across calls keeps their allocations out of the
+			 * steady-state parsing path.
+			 */
+			static context& thread_context();
+
 			template <typename IteratorType>
 			bool parse_value(context& ctx, value_type& value, IteratorType& ch, IteratorType end);
 			template <typename IteratorType>
@@ -168,6 +180,19 @@ namespace kfather
 			bool parse_array(context& ctx, array_type& value, IteratorType& ch, IteratorType end);
 			template <typename IteratorType>
 			bool parse_string(context& ctx, string_type& value, IteratorType& ch, IteratorType end);
+
+			/**
+			 * \brief The contiguous-buffer overload of parse_string().
+			 *
+			 * Scans for quotes, escapes and control bytes a block at a time
+			 * and copies the clean runs in bulk, instead of advancing
+			 * character by character. This overload also enforces the
+			 * documented requirement that the input be UTF-8 encoded.
+			 */
+			bool parse_string(context& ctx, string_type& value, const char*& ch, const char* end);
+
+			template <typename IteratorType>
+			bool parse_string_escape(context& ctx, IteratorType& ch, IteratorType end);
 			template <typename IteratorType>
 			bool parse_number(context& ctx, number_type& value, IteratorType& ch, IteratorType end);
 			template <typename IteratorType>
@@ -180,6 +205,225 @@ namespace kfather
 			bool check_chars(context& ctx, const char* str, IteratorType& ch, IteratorType end);
 			template <typename IteratorType>
 			void skip_whitespace(context& ctx, IteratorType& ch, IteratorType end);
+
+			friend class stream_parser;
+	};
+
+	/**
+	 * \brief An incremental, SAX-style JSON parser class.
+	 *
+	 * A stream_parser consumes its input chunk by chunk, as the chunks become
+	 * available, and reports the structure of the document through callbacks
+	 * instead of building a value tree. Only the scalar being parsed is held
+	 * in memory, which makes the class suitable for very large documents.
+	 *
+	 * Unlike parser, a stream_parser instance carries the state of the
+	 * document being parsed: use one instance per document and do not share it
+	 * between threads.
+	 */
+	class stream_parser
+	{
+		public:
+
+			/**
+			 * \brief The callback type for events that carry no value.
+			 */
+			typedef boost::function<void ()> event_callback_type;
+
+			/**
+			 * \brief The callback type for events that carry a string.
+			 */
+			typedef boost::function<void (const string_type&)> string_callback_type;
+
+			/**
+			 * \brief The callback type for events that carry a number.
+			 */
+			typedef boost::function<void (const number_type&)> number_callback_type;
+
+			/**
+			 * \brief The callback type for events that carry a boolean.
+			 */
+			typedef boost::function<void (const boolean_type&)> boolean_callback_type;
+
+			/**
+			 * \brief Create a new stream_parser.
+			 */
+			stream_parser();
+
+			/**
+			 * \brief Set the callback for the start of an object.
+			 * \param callback The callback.
+			 */
+			void set_object_start_callback(event_callback_type callback)
+			{
+				m_object_start_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for an object key.
+			 * \param callback The callback.
+			 */
+			void set_key_callback(string_callback_type callback)
+			{
+				m_key_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for the end of an object.
+			 * \param callback The callback.
+			 */
+			void set_object_end_callback(event_callback_type callback)
+			{
+				m_object_end_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for the start of an array.
+			 * \param callback The callback.
+			 */
+			void set_array_start_callback(event_callback_type callback)
+			{
+				m_array_start_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for the end of an array.
+			 * \param callback The callback.
+			 */
+			void set_array_end_callback(event_callback_type callback)
+			{
+				m_array_end_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for a string value.
+			 * \param callback The callback.
+			 */
+			void set_string_callback(string_callback_type callback)
+			{
+				m_string_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for a number value.
+			 * \param callback The callback.
+			 */
+			void set_number_callback(number_callback_type callback)
+			{
+				m_number_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for a boolean value.
+			 * \param callback The callback.
+			 */
+			void set_boolean_callback(boolean_callback_type callback)
+			{
+				m_boolean_callback = callback;
+			}
+
+			/**
+			 * \brief Set the callback for a null value.
+			 * \param callback The callback.
+			 */
+			void set_null_callback(event_callback_type callback)
+			{
+				m_null_callback = callback;
+			}
+
+			/**
+			 * \brief Feed a chunk of JSON input to the parser.
+			 * \param buf The chunk. Cannot be null. The chunk may start or end anywhere in the document, including in the middle of a token. The input must be UTF-8 encoded.
+			 * \param buflen The length of buf.
+			 * \return true as long as the input remains a valid JSON document prefix, false otherwise.
+			 *
+			 * Once feed() returned false, every subsequent call returns false as well, until reset() is called.
+			 */
+			bool feed(const char* buf, size_t buflen);
+
+			/**
+			 * \brief Feed a chunk of JSON input to the parser.
+			 * \param chunk The chunk. The chunk may start or end anywhere in the document, including in the middle of a token. The input must be UTF-8 encoded.
+			 * \return true as long as the input remains a valid JSON document prefix, false otherwise.
+			 */
+			bool feed(const std::string& chunk);
+
+			/**
+			 * \brief Signal the end of the input.
+			 * \return true if the input formed exactly one complete JSON document, false otherwise.
+			 */
+			bool finish();
+
+			/**
+			 * \brief Reset the parser so it can parse a new document.
+			 *
+			 * The callbacks are left unchanged.
+			 */
+			void reset();
+
+		private:
+
+			enum state_type
+			{
+				state_expect_value,
+				state_expect_key_or_close,
+				state_expect_key,
+				state_expect_colon,
+				state_expect_value_or_close,
+				state_expect_comma_or_close,
+				state_done,
+				state_error
+			};
+
+			enum token_type
+			{
+				token_none,
+				token_string,
+				token_string_escape,
+				token_string_unicode,
+				token_number,
+				token_literal
+			};
+
+			enum literal_type
+			{
+				literal_true,
+				literal_false,
+				literal_null
+			};
+
+			enum frame_type
+			{
+				frame_object,
+				frame_array
+			};
+
+			bool process(char c);
+			bool begin_value(char c);
+			bool end_value();
+			bool end_number();
+			bool close_object();
+			bool close_array();
+			bool fail();
+
+			parser::context m_context;
+			state_type m_state;
+			token_type m_token;
+			std::vector<frame_type> m_stack;
+			bool m_string_is_key;
+			const char* m_literal;
+			literal_type m_literal_value;
+			int m_unicode_digits;
+			uint16_t m_codepoint;
+			event_callback_type m_object_start_callback;
+			string_callback_type m_key_callback;
+			event_callback_type m_object_end_callback;
+			event_callback_type m_array_start_callback;
+			event_callback_type m_array_end_callback;
+			string_callback_type m_string_callback;
+			number_callback_type m_number_callback;
+			boolean_callback_type m_boolean_callback;
+			event_callback_type m_null_callback;
 	};
 }
 
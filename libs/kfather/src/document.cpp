@@ -0,0 +1,555 @@
+/*
+ * libkfather - C++ JSON parser/producer library.
+ * Copyright (C) 2010-2012 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libkfather.
+ *
+ * libkfather is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libkfather is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * If you intend to use libkfather in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file document.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An arena-backed JSON document class.
+ */
+
+#include "document.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace kfather
+{
+	namespace
+	{
+		bool member_key_less(const char* a, size_t a_size, const char* b, size_t b_size)
+		{
+			const int cmp = std::memcmp(a, b, std::min(a_size, b_size));
+
+			if (cmp != 0)
+			{
+				return (cmp < 0);
+			}
+
+			return (a_size < b_size);
+		}
+	}
+
+	bool document::node::is_null() const
+	{
+		return (!m_impl || (m_impl->kind == node_impl::kind_null));
+	}
+
+	bool document::node::is_boolean() const
+	{
+		return (m_impl && (m_impl->kind == node_impl::kind_boolean));
+	}
+
+	bool document::node::is_number() const
+	{
+		return (m_impl && (m_impl->kind == node_impl::kind_number));
+	}
+
+	bool document::node::is_string() const
+	{
+		return (m_impl && (m_impl->kind == node_impl::kind_string));
+	}
+
+	bool document::node::is_array() const
+	{
+		return (m_impl && (m_impl->kind == node_impl::kind_array));
+	}
+
+	bool document::node::is_object() const
+	{
+		return (m_impl && (m_impl->kind == node_impl::kind_object));
+	}
+
+	boolean_type document::node::as_boolean() const
+	{
+		if (!m_impl)
+		{
+			return false;
+		}
+
+		switch (m_impl->kind)
+		{
+			case node_impl::kind_boolean:
+				return m_impl->boolean;
+
+			case node_impl::kind_number:
+				return (m_impl->number != 0);
+
+			case node_impl::kind_string:
+				return (m_impl->string.size > 0);
+
+			case node_impl::kind_array:
+			case node_impl::kind_object:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	number_type document::node::as_number() const
+	{
+		if (!m_impl)
+		{
+			return 0;
+		}
+
+		switch (m_impl->kind)
+		{
+			case node_impl::kind_boolean:
+				return m_impl->boolean ? 1 : 0;
+
+			case node_impl::kind_number:
+				return m_impl->number;
+
+			case node_impl::kind_string:
+				try
+				{
+					return boost::lexical_cast<number_type>(as_string());
+				}
+				catch (boost::bad_lexical_cast&)
+				{
+					return std::numeric_limits<number_type>::quiet_NaN();
+				}
+
+			case node_impl::kind_object:
+				return std::numeric_limits<number_type>::quiet_NaN();
+
+			default:
+				return 0;
+		}
+	}
+
+	string_type document::node::as_string() const
+	{
+		if (!m_impl)
+		{
+			return "null";
+		}
+
+		switch (m_impl->kind)
+		{
+			case node_impl::kind_boolean:
+				return m_impl->boolean ? "true" : "false";
+
+			case node_impl::kind_number:
+			{
+				std::ostringstream oss;
+
+				oss << m_impl->number;
+
+				return oss.str();
+			}
+
+			case node_impl::kind_string:
+				return string_type(m_impl->string.data, m_impl->string.size);
+
+			case node_impl::kind_array:
+				return "";
+
+			case node_impl::kind_object:
+				return "[object Object]";
+
+			default:
+				return "null";
+		}
+	}
+
+	size_t document::node::size() const
+	{
+		if (is_array())
+		{
+			return m_impl->array.size;
+		}
+
+		if (is_object())
+		{
+			return m_impl->object.size;
+		}
+
+		return 0;
+	}
+
+	document::node document::node::at(size_t index) const
+	{
+		if (is_object())
+		{
+			return node(&m_impl->object.items[index].value);
+		}
+
+		return node(&m_impl->array.items[index]);
+	}
+
+	string_type document::node::key_at(size_t index) const
+	{
+		const member_impl& member = m_impl->object.items[index];
+
+		return string_type(member.key, member.key_size);
+	}
+
+	document::node document::node::get(const string_type& key) const
+	{
+		if (!is_object())
+		{
+			return node();
+		}
+
+		// The members were sorted by key when the object was closed.
+		size_t low = 0;
+		size_t high = m_impl->object.size;
+
+		while (low < high)
+		{
+			const size_t middle = low + (high - low) / 2;
+			const member_impl& member = m_impl->object.items[middle];
+
+			if (member_key_less(member.key, member.key_size, key.data(), key.size()))
+			{
+				low = middle + 1;
+			}
+			else if (member_key_less(key.data(), key.size(), member.key, member.key_size))
+			{
+				high = middle;
+			}
+			else
+			{
+				return node(&member.value);
+			}
+		}
+
+		return node();
+	}
+
+	const size_t document::ARENA_BLOCK_SIZE = 256 * 1024;
+
+	bool document::member_less(const member_impl& lhs, const member_impl& rhs)
+	{
+		return member_key_less(lhs.key, lhs.key_size, rhs.key, rhs.key_size);
+	}
+
+	document::document() :
+		m_arena_used(0),
+		m_pending_key(NULL),
+		m_pending_key_size(0),
+		m_has_root(false)
+	{
+		m_root.kind = node_impl::kind_null;
+
+		m_parser.set_object_start_callback(boost::bind(&document::handle_object_start, this));
+		m_parser.set_key_callback(boost::bind(&document::handle_key, this, _1));
+		m_parser.set_object_end_callback(boost::bind(&document::handle_object_end, this));
+		m_parser.set_array_start_callback(boost::bind(&document::handle_array_start, this));
+		m_parser.set_array_end_callback(boost::bind(&document::handle_array_end, this));
+		m_parser.set_string_callback(boost::bind(&document::handle_string, this, _1));
+		m_parser.set_number_callback(boost::bind(&document::handle_number, this, _1));
+		m_parser.set_boolean_callback(boost::bind(&document::handle_boolean, this, _1));
+		m_parser.set_null_callback(boost::bind(&document::handle_null, this));
+	}
+
+	bool document::feed(const char* buf, size_t buflen)
+	{
+		return m_parser.feed(buf, buflen);
+	}
+
+	bool document::feed(const std::string& chunk)
+	{
+		return m_parser.feed(chunk);
+	}
+
+	bool document::finish()
+	{
+		if (!m_parser.finish())
+		{
+			return false;
+		}
+
+		return m_has_root;
+	}
+
+	bool document::parse(const char* buf, size_t buflen)
+	{
+		clear();
+
+		if (!feed(buf, buflen))
+		{
+			return false;
+		}
+
+		return finish();
+	}
+
+	bool document::parse(const std::string& str)
+	{
+		return parse(str.c_str(), str.size());
+	}
+
+	document::node document::root() const
+	{
+		if (!m_has_root)
+		{
+			return node();
+		}
+
+		return node(&m_root);
+	}
+
+	void document::clear()
+	{
+		m_parser.reset();
+		m_arena.clear();
+		m_arena_used = 0;
+		m_interned_keys.clear();
+		m_build_stack.clear();
+		m_build_marks.clear();
+		m_pending_key = NULL;
+		m_pending_key_size = 0;
+		m_root.kind = node_impl::kind_null;
+		m_has_root = false;
+	}
+
+	void* document::arena_allocate(size_t size)
+	{
+		// Keeping every allocation pointer-aligned costs a few bytes per
+		// string but lets node arrays share the same blocks.
+		const size_t alignment = sizeof(void*);
+
+		m_arena_used = (m_arena_used + alignment - 1) & ~(alignment - 1);
+
+		if (m_arena.empty() || (m_arena_used + size > m_arena.back().size()))
+		{
+			m_arena.push_back(std::vector<char>(std::max(size, ARENA_BLOCK_SIZE)));
+			m_arena_used = 0;
+		}
+
+		void* const result = &m_arena.back()[m_arena_used];
+
+		m_arena_used += size;
+
+		return result;
+	}
+
+	const char* document::arena_store(const string_type& str)
+	{
+		char* const result = static_cast<char*>(arena_allocate(str.size()));
+
+		std::memcpy(result, str.data(), str.size());
+
+		return result;
+	}
+
+	void document::intern_key(const string_type& key, const char*& key_ptr, size_t& key_size)
+	{
+		const std::map<string_type, const char*>::const_iterator it = m_interned_keys.find(key);
+
+		if (it != m_interned_keys.end())
+		{
+			key_ptr = it->second;
+		}
+		else
+		{
+			key_ptr = arena_store(key);
+			m_interned_keys[key] = key_ptr;
+		}
+
+		key_size = key.size();
+	}
+
+	void document::push_value(const node_impl& value)
+	{
+		if (m_build_marks.empty())
+		{
+			m_root = value;
+			m_has_root = true;
+		}
+		else
+		{
+			build_node bn;
+			bn.key = m_pending_key;
+			bn.key_size = m_pending_key_size;
+			bn.value = value;
+
+			m_build_stack.push_back(bn);
+		}
+
+		m_pending_key = NULL;
+		m_pending_key_size = 0;
+	}
+
+	void document::handle_object_start()
+	{
+		build_node bn;
+		bn.key = m_pending_key;
+		bn.key_size = m_pending_key_size;
+		bn.value.kind = node_impl::kind_object;
+		bn.value.object.items = NULL;
+		bn.value.object.size = 0;
+
+		m_pending_key = NULL;
+		m_pending_key_size = 0;
+
+		m_build_stack.push_back(bn);
+		m_build_marks.push_back(m_build_stack.size() - 1);
+	}
+
+	void document::handle_key(const string_type& key)
+	{
+		intern_key(key, m_pending_key, m_pending_key_size);
+	}
+
+	void document::handle_object_end()
+	{
+		const size_t mark = m_build_marks.back();
+		m_build_marks.pop_back();
+
+		const size_t count = m_build_stack.size() - mark - 1;
+		member_impl* items = NULL;
+
+		if (count > 0)
+		{
+			items = static_cast<member_impl*>(arena_allocate(count * sizeof(member_impl)));
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				const build_node& bn = m_build_stack[mark + 1 + i];
+
+				items[i].key = bn.key;
+				items[i].key_size = bn.key_size;
+				items[i].value = bn.value;
+			}
+
+			// Sorting here makes get() logarithmic. Interned keys make most
+			// comparisons a pointer comparison away from equality, but the
+			// order must hold across distinct pointers too.
+			std::sort(items, items + count, member_less);
+		}
+
+		m_build_stack[mark].value.object.items = items;
+		m_build_stack[mark].value.object.size = count;
+
+		const build_node top = m_build_stack[mark];
+		m_build_stack.resize(mark);
+
+		if (m_build_marks.empty())
+		{
+			m_root = top.value;
+			m_has_root = true;
+		}
+		else
+		{
+			m_build_stack.push_back(top);
+		}
+	}
+
+	void document::handle_array_start()
+	{
+		build_node bn;
+		bn.key = m_pending_key;
+		bn.key_size = m_pending_key_size;
+		bn.value.kind = node_impl::kind_array;
+		bn.value.array.items = NULL;
+		bn.value.array.size = 0;
+
+		m_pending_key = NULL;
+		m_pending_key_size = 0;
+
+		m_build_stack.push_back(bn);
+		m_build_marks.push_back(m_build_stack.size() - 1);
+	}
+
+	void document::handle_array_end()
+	{
+		const size_t mark = m_build_marks.back();
+		m_build_marks.pop_back();
+
+		const size_t count = m_build_stack.size() - mark - 1;
+		node_impl* items = NULL;
+
+		if (count > 0)
+		{
+			items = static_cast<node_impl*>(arena_allocate(count * sizeof(node_impl)));
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				items[i] = m_build_stack[mark + 1 + i].value;
+			}
+		}
+
+		m_build_stack[mark].value.array.items = items;
+		m_build_stack[mark].value.array.size = count;
+
+		const build_node top = m_build_stack[mark];
+		m_build_stack.resize(mark);
+
+		if (m_build_marks.empty())
+		{
+			m_root = top.value;
+			m_has_root = true;
+		}
+		else
+		{
+			m_build_stack.push_back(top);
+		}
+	}
+
+	void document::handle_string(const string_type& str)
+	{
+		node_impl value;
+		value.kind = node_impl::kind_string;
+		value.string.data = arena_store(str);
+		value.string.size = str.size();
+
+		push_value(value);
+	}
+
+	void document::handle_number(const number_type& number)
+	{
+		node_impl value;
+		value.kind = node_impl::kind_number;
+		value.number = number;
+
+		push_value(value);
+	}
+
+	void document::handle_boolean(const boolean_type& boolean)
+	{
+		node_impl value;
+		value.kind = node_impl::kind_boolean;
+		value.boolean = boolean;
+
+		push_value(value);
+	}
+
+	void document::handle_null()
+	{
+		node_impl value;
+		value.kind = node_impl::kind_null;
+
+		push_value(value);
+	}
+}
@@ -33,10 +33,201 @@
 
 #include "parser.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
 #include <boost/bind.hpp>
 
 namespace kfather
 {
+	namespace
+	{
+		class sink_writer_visitor : public boost::static_visitor<void>
+		{
+			public:
+
+				sink_writer_visitor(const compact_sink_formatter::sink_type& sink) :
+					m_sink(sink),
+					m_used(0)
+				{
+				}
+
+				void flush()
+				{
+					if (m_used > 0)
+					{
+						m_sink(m_buffer, m_used);
+
+						m_used = 0;
+					}
+				}
+
+				void operator()(const null_type&)
+				{
+					write("null", 4);
+				}
+
+				void operator()(const boolean_type& bt)
+				{
+					if (bt)
+					{
+						write("true", 4);
+					}
+					else
+					{
+						write("false", 5);
+					}
+				}
+
+				void operator()(const number_type& nb)
+				{
+					// The scratch buffer is preallocated and %g matches the
+					// default output stream formatting of compact_formatter.
+					char scratch[32];
+
+					const int length = std::snprintf(scratch, sizeof(scratch), "%g", nb);
+
+					write(scratch, static_cast<size_t>(length));
+				}
+
+				void operator()(const string_type& str)
+				{
+					write('"');
+
+					for (string_type::const_iterator it = str.begin(); it != str.end(); ++it)
+					{
+						switch (*it)
+						{
+							case '"':
+								write("\\\"", 2);
+								break;
+
+							case '\\':
+								write("\\\\", 2);
+								break;
+
+							case '/':
+								write("\\/", 2);
+								break;
+
+							case '\b':
+								write("\\b", 2);
+								break;
+
+							case '\n':
+								write("\\n", 2);
+								break;
+
+							case '\f':
+								write("\\f", 2);
+								break;
+
+							case '\r':
+								write("\\r", 2);
+								break;
+
+							case '\t':
+								write("\\t", 2);
+								break;
+
+							default:
+								write(*it);
+						}
+					}
+
+					write('"');
+				}
+
+				void operator()(const array_type& ar)
+				{
+					write('[');
+
+					if (!ar.items.empty())
+					{
+						boost::apply_visitor(*this, ar.items.front());
+
+						for (array_type::items_type::const_iterator it = ar.items.begin() + 1; it != ar.items.end(); ++it)
+						{
+							write(',');
+
+							boost::apply_visitor(*this, *it);
+						}
+					}
+
+					write(']');
+				}
+
+				void operator()(const object_type& obj)
+				{
+					write('{');
+
+					if (!obj.items.empty())
+					{
+						object_type::items_type::const_iterator it = obj.items.begin();
+
+						(*this)(it->first);
+
+						write(':');
+
+						boost::apply_visitor(*this, it->second);
+
+						++it;
+
+						for (; it != obj.items.end(); ++it)
+						{
+							write(',');
+
+							(*this)(it->first);
+
+							write(':');
+
+							boost::apply_visitor(*this, it->second);
+						}
+					}
+
+					write('}');
+				}
+
+			private:
+
+				static const size_t CHUNK_SIZE = 8192;
+
+				void write(char c)
+				{
+					if (m_used == CHUNK_SIZE)
+					{
+						flush();
+					}
+
+					m_buffer[m_used++] = c;
+				}
+
+				void write(const char* data, size_t data_len)
+				{
+					while (data_len > 0)
+					{
+						if (m_used == CHUNK_SIZE)
+						{
+							flush();
+						}
+
+						const size_t count = std::min(data_len, CHUNK_SIZE - m_used);
+
+						std::memcpy(m_buffer + m_used, data, count);
+
+						m_used += count;
+						data += count;
+						data_len -= count;
+					}
+				}
+
+				compact_sink_formatter::sink_type m_sink;
+				char m_buffer[CHUNK_SIZE];
+				size_t m_used;
+		};
+	}
+
 	std::ostream& base_formatter_visitor::operator()(const null_type&) const
 	{
 		return os() << "null";
@@ -277,4 +468,13 @@ namespace kfather
 
 		return os();
 	}
+
+	void compact_sink_formatter::format(const sink_type& sink, const value_type& value) const
+	{
+		sink_writer_visitor visitor(sink);
+
+		boost::apply_visitor(visitor, value);
+
+		visitor.flush();
+	}
 }
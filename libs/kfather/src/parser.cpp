@@ -33,10 +33,17 @@
 
 #include <string>
 #include <sstream>
+#include <cstdlib>
 #include <cctype>
 #include <cassert>
 #include <streambuf>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 namespace kfather
 {
 	namespace
@@ -65,6 +72,165 @@ namespace kfather
 
 			return digit_map[static_cast<uint8_t>(c)];
 		}
+
+		/**
+		 * \brief Find the first byte of [ch, end) that a string parser must
+		 * look at: a quote, a backslash, a control byte or the lead of a
+		 * multi-byte UTF-8 sequence.
+		 *
+		 * Everything before the returned pointer can be copied to the output
+		 * verbatim. The scan goes sixteen bytes at a time when the platform
+		 * allows it.
+		 */
+		const char* find_string_special(const char* ch, const char* end)
+		{
+#if defined(__SSE2__)
+			// Signed comparison against 0x20 also catches the bytes at 0x80
+			// and above, which need UTF-8 validation.
+			const __m128i quote = _mm_set1_epi8('"');
+			const __m128i backslash = _mm_set1_epi8('\\');
+			const __m128i space = _mm_set1_epi8(0x20);
+
+			while (end - ch >= 16)
+			{
+				const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ch));
+
+				__m128i special = _mm_cmpeq_epi8(chunk, quote);
+				special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, backslash));
+				special = _mm_or_si128(special, _mm_cmplt_epi8(chunk, space));
+
+				const int mask = _mm_movemask_epi8(special);
+
+				if (mask != 0)
+				{
+					return ch + __builtin_ctz(mask);
+				}
+
+				ch += 16;
+			}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+			const uint8x16_t quote = vdupq_n_u8('"');
+			const uint8x16_t backslash = vdupq_n_u8('\\');
+			const uint8x16_t space = vdupq_n_u8(0x20);
+			const uint8x16_t high = vdupq_n_u8(0x80);
+
+			while (end - ch >= 16)
+			{
+				const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(ch));
+
+				uint8x16_t special = vceqq_u8(chunk, quote);
+				special = vorrq_u8(special, vceqq_u8(chunk, backslash));
+				special = vorrq_u8(special, vcltq_u8(chunk, space));
+				special = vorrq_u8(special, vcgeq_u8(chunk, high));
+
+				uint8_t lanes[16];
+				vst1q_u8(lanes, special);
+
+				for (size_t i = 0; i < 16; ++i)
+				{
+					if (lanes[i] != 0)
+					{
+						return ch + i;
+					}
+				}
+
+				ch += 16;
+			}
+#endif
+
+			for (; ch != end; ++ch)
+			{
+				const uint8_t c = static_cast<uint8_t>(*ch);
+
+				if ((c == '"') || (c == '\\') || (c < 0x20) || (c >= 0x80))
+				{
+					break;
+				}
+			}
+
+			return ch;
+		}
+
+		/**
+		 * \brief Check that ch points to a well-formed multi-byte UTF-8
+		 * sequence and advance it past the sequence.
+		 * \return false for truncated or invalid sequences, including
+		 * overlong encodings and surrogate codepoints.
+		 */
+		bool check_utf8_sequence(const char*& ch, const char* end)
+		{
+			const uint8_t lead = static_cast<uint8_t>(*ch);
+
+			size_t length;
+			uint8_t second_min = 0x80;
+			uint8_t second_max = 0xbf;
+
+			if ((lead >= 0xc2) && (lead <= 0xdf))
+			{
+				length = 2;
+			}
+			else if ((lead >= 0xe0) && (lead <= 0xef))
+			{
+				length = 3;
+
+				if (lead == 0xe0)
+				{
+					// Reject overlong encodings.
+					second_min = 0xa0;
+				}
+				else if (lead == 0xed)
+				{
+					// Reject UTF-16 surrogate codepoints.
+					second_max = 0x9f;
+				}
+			}
+			else if ((lead >= 0xf0) && (lead <= 0xf4))
+			{
+				length = 4;
+
+				if (lead == 0xf0)
+				{
+					// Reject overlong encodings.
+					second_min = 0x90;
+				}
+				else if (lead == 0xf4)
+				{
+					// Reject codepoints above U+10FFFF.
+					second_max = 0x8f;
+				}
+			}
+			else
+			{
+				// A stray continuation byte or an invalid lead byte.
+				return false;
+			}
+
+			if (static_cast<size_t>(end - ch) < length)
+			{
+				return false;
+			}
+
+			const uint8_t second = static_cast<uint8_t>(ch[1]);
+
+			if ((second < second_min) || (second > second_max))
+			{
+				return false;
+			}
+
+			for (size_t i = 2; i < length; ++i)
+			{
+				const uint8_t continuation = static_cast<uint8_t>(ch[i]);
+
+				if ((continuation < 0x80) || (continuation > 0xbf))
+				{
+					return false;
+				}
+			}
+
+			ch += length;
+
+			return true;
+		}
 	}
 
 	bool parser::parse(value_type& value, const char* buf, size_t buflen, const char** error_token)
@@ -74,7 +240,7 @@ namespace kfather
 		const char* const end = buf + buflen;
 		const char* ch = buf;
 
-		context ctx;
+		context& ctx = thread_context();
 
 		skip_whitespace(ctx, ch, end);
 
@@ -141,7 +307,7 @@ namespace kfather
 	{
 		IteratorType it = begin;
 
-		context ctx;
+		context& ctx = thread_context();
 
 		skip_whitespace(ctx, it, end);
 
@@ -412,99 +578,179 @@ namespace kfather
 						// An escape character was provided.
 						++ch;
 
-						if (ch == end)
+						if (!parse_string_escape(ctx, ch, end))
 						{
 							return false;
 						}
 
-						switch (*ch)
-						{
-							case '"':
-								ctx.push_char('"');
-								++ch;
-								break;
+						break;
+					}
 
-							case '\\':
-								ctx.push_char('\\');
-								++ch;
-								break;
+				default:
+					{
+						ctx.push_char(*ch);
 
-							case '/':
-								ctx.push_char('/');
-								++ch;
-								break;
+						++ch;
+					}
+			}
+		}
 
-							case 'b':
-								ctx.push_char('\b');
-								++ch;
-								break;
+		return false;
+	}
 
-							case 'n':
-								ctx.push_char('\n');
-								++ch;
-								break;
+	bool parser::parse_string(context& ctx, string_type& value, const char*& ch, const char* end)
+	{
+		ctx.clear();
 
-							case 'f':
-								ctx.push_char('\f');
-								++ch;
-								break;
+		if (!check_char(ctx, '"', ch, end))
+		{
+			return false;
+		}
 
-							case 'r':
-								ctx.push_char('\r');
-								++ch;
-								break;
+		while (ch != end)
+		{
+			// Plain ASCII runs - the bulk of any real document - are
+			// located in one block scan and copied in one append.
+			const char* const run_end = find_string_special(ch, end);
 
-							case 't':
-								ctx.push_char('\t');
-								++ch;
-								break;
+			if (run_end != ch)
+			{
+				ctx.push_chars(ch, run_end);
 
-							case 'u':
-								{
-									++ch;
+				ch = run_end;
 
-									uint16_t codepoint = 0x0000;
+				if (ch == end)
+				{
+					break;
+				}
+			}
 
-									for (size_t i = 0; i < 4; ++i)
-									{
-										if (ch == end)
-										{
-											return false;
-										}
+			const uint8_t c = static_cast<uint8_t>(*ch);
 
-										if (!std::isxdigit(*ch))
-										{
-											return false;
-										}
+			if (c == '"')
+			{
+				// The string ends.
+				++ch;
 
-										codepoint *= 16;
-										codepoint += xdigit_to_int(*ch);
+				value = ctx.str();
 
-										++ch;
-									}
+				return true;
+			}
+			else if (c == '\\')
+			{
+				// An escape character was provided.
+				++ch;
 
-									ctx.push_codepoint(codepoint);
+				if (!parse_string_escape(ctx, ch, end))
+				{
+					return false;
+				}
+			}
+			else if (c < 0x20)
+			{
+				return false;
+			}
+			else
+			{
+				// A multi-byte UTF-8 sequence.
+				const char* const sequence = ch;
 
-									break;
-								}
+				if (!check_utf8_sequence(ch, end))
+				{
+					return false;
+				}
 
-							default:
-								return false;
-						}
+				ctx.push_chars(sequence, ch);
+			}
+		}
 
-						break;
-					}
+		return false;
+	}
 
-				default:
+	template <typename IteratorType>
+	bool parser::parse_string_escape(context& ctx, IteratorType& ch, IteratorType end)
+	{
+		if (ch == end)
+		{
+			return false;
+		}
+
+		switch (*ch)
+		{
+			case '"':
+				ctx.push_char('"');
+				++ch;
+				break;
+
+			case '\\':
+				ctx.push_char('\\');
+				++ch;
+				break;
+
+			case '/':
+				ctx.push_char('/');
+				++ch;
+				break;
+
+			case 'b':
+				ctx.push_char('\b');
+				++ch;
+				break;
+
+			case 'n':
+				ctx.push_char('\n');
+				++ch;
+				break;
+
+			case 'f':
+				ctx.push_char('\f');
+				++ch;
+				break;
+
+			case 'r':
+				ctx.push_char('\r');
+				++ch;
+				break;
+
+			case 't':
+				ctx.push_char('\t');
+				++ch;
+				break;
+
+			case 'u':
+				{
+					++ch;
+
+					uint16_t codepoint = 0x0000;
+
+					for (size_t i = 0; i < 4; ++i)
 					{
-						ctx.push_char(*ch);
+						if (ch == end)
+						{
+							return false;
+						}
+
+						if (!std::isxdigit(*ch))
+						{
+							return false;
+						}
+
+						codepoint *= 16;
+						codepoint += xdigit_to_int(*ch);
 
 						++ch;
 					}
-			}
+
+					ctx.push_codepoint(codepoint);
+
+					break;
+				}
+
+			default:
+				return false;
 		}
 
-		return false;
+		return true;
 	}
 
 	template <typename IteratorType>
@@ -685,6 +931,18 @@ namespace kfather
 		for (; (ch != end) && std::isspace(*ch); ++ch) {}
 	}
 
+	parser::context& parser::thread_context()
+	{
+		// Each thread keeps its own context: the iconv descriptor survives
+		// across documents and the scratch strings keep their capacity, so
+		// a busy thread parses without allocating.
+		static thread_local context ctx;
+
+		ctx.clear();
+
+		return ctx;
+	}
+
 	parser::context::context() :
 		m_iconv("utf-8", "utf-16be")
 	{
@@ -703,6 +961,13 @@ namespace kfather
 		m_str.push_back(c);
 	}
 
+	void parser::context::push_chars(const char* first, const char* last)
+	{
+		end_codepoints();
+
+		m_str.append(first, last);
+	}
+
 	void parser::context::push_codepoint(uint16_t cp)
 	{
 		m_utf16.push_back(static_cast<char>(cp / 256));
@@ -718,13 +983,19 @@ namespace kfather
 
 	bool parser::context::get_number(number_type& value)
 	{
-		std::istringstream iss(m_str);
+		// The number grammar was validated by parse_number() already, so
+		// strtod() can take over: unlike an istringstream, it allocates
+		// nothing.
+		const char* const first = m_str.c_str();
+		char* last = NULL;
 
-		m_str.clear();
+		value = std::strtod(first, &last);
+
+		const bool result = (last == first + m_str.size());
 
-		iss >> value;
+		m_str.clear();
 
-		return !iss.fail();
+		return result;
 	}
 
 	void parser::context::end_codepoints()
@@ -743,4 +1014,437 @@ namespace kfather
 			m_utf16.clear();
 		}
 	}
+
+	stream_parser::stream_parser()
+	{
+		reset();
+	}
+
+	bool stream_parser::feed(const char* buf, size_t buflen)
+	{
+		assert(buf);
+
+		for (const char* ch = buf; ch != buf + buflen; ++ch)
+		{
+			if (!process(*ch))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool stream_parser::feed(const std::string& chunk)
+	{
+		return feed(chunk.c_str(), chunk.size());
+	}
+
+	bool stream_parser::finish()
+	{
+		if (m_state == state_error)
+		{
+			return false;
+		}
+
+		// A number at the top level only ends with the input.
+		if (m_token == token_number)
+		{
+			if (!end_number())
+			{
+				return false;
+			}
+		}
+		else if (m_token != token_none)
+		{
+			return !fail();
+		}
+
+		return (m_state == state_done);
+	}
+
+	void stream_parser::reset()
+	{
+		m_context.clear();
+		m_state = state_expect_value;
+		m_token = token_none;
+		m_stack.clear();
+		m_string_is_key = false;
+		m_literal = NULL;
+		m_literal_value = literal_null;
+		m_unicode_digits = 0;
+		m_codepoint = 0;
+	}
+
+	bool stream_parser::process(char c)
+	{
+		switch (m_token)
+		{
+			case token_string:
+				{
+					if (c == '"')
+					{
+						m_token = token_none;
+
+						const string_type str = m_context.str();
+
+						m_context.clear();
+
+						if (m_string_is_key)
+						{
+							if (m_key_callback)
+							{
+								m_key_callback(str);
+							}
+
+							m_state = state_expect_colon;
+
+							return true;
+						}
+
+						if (m_string_callback)
+						{
+							m_string_callback(str);
+						}
+
+						return end_value();
+					}
+
+					if (c == '\\')
+					{
+						m_token = token_string_escape;
+
+						return true;
+					}
+
+					m_context.push_char(c);
+
+					return true;
+				}
+
+			case token_string_escape:
+				{
+					switch (c)
+					{
+						case '"': m_context.push_char('"'); break;
+						case '\\': m_context.push_char('\\'); break;
+						case '/': m_context.push_char('/'); break;
+						case 'b': m_context.push_char('\b'); break;
+						case 'f': m_context.push_char('\f'); break;
+						case 'n': m_context.push_char('\n'); break;
+						case 'r': m_context.push_char('\r'); break;
+						case 't': m_context.push_char('\t'); break;
+						case 'u':
+							{
+								m_token = token_string_unicode;
+								m_unicode_digits = 0;
+								m_codepoint = 0;
+
+								return true;
+							}
+						default:
+							return fail();
+					}
+
+					m_token = token_string;
+
+					return true;
+				}
+
+			case token_string_unicode:
+				{
+					if (!std::isxdigit(c))
+					{
+						return fail();
+					}
+
+					m_codepoint = static_cast<uint16_t>(m_codepoint * 16 + xdigit_to_int(c));
+
+					if (++m_unicode_digits == 4)
+					{
+						m_context.push_codepoint(m_codepoint);
+
+						m_token = token_string;
+					}
+
+					return true;
+				}
+
+			case token_number:
+				{
+					if (std::isdigit(c) || (c == '+') || (c == '-') || (c == '.') || (c == 'e') || (c == 'E'))
+					{
+						m_context.push_char(c);
+
+						return true;
+					}
+
+					// The character ends the number: emit it, then process the character normally below.
+					if (!end_number())
+					{
+						return false;
+					}
+
+					break;
+				}
+
+			case token_literal:
+				{
+					if (*m_literal != c)
+					{
+						return fail();
+					}
+
+					if (*++m_literal == '\0')
+					{
+						m_token = token_none;
+
+						switch (m_literal_value)
+						{
+							case literal_true:
+								if (m_boolean_callback) { m_boolean_callback(true); }
+								break;
+							case literal_false:
+								if (m_boolean_callback) { m_boolean_callback(false); }
+								break;
+							case literal_null:
+								if (m_null_callback) { m_null_callback(); }
+								break;
+						}
+
+						return end_value();
+					}
+
+					return true;
+				}
+
+			case token_none:
+				break;
+		}
+
+		if (std::isspace(c))
+		{
+			return true;
+		}
+
+		switch (m_state)
+		{
+			case state_expect_value_or_close:
+				{
+					if (c == ']')
+					{
+						return close_array();
+					}
+
+					return begin_value(c);
+				}
+
+			case state_expect_value:
+				return begin_value(c);
+
+			case state_expect_key_or_close:
+				{
+					if (c == '}')
+					{
+						return close_object();
+					}
+				}
+				// Intentional fall-through.
+
+			case state_expect_key:
+				{
+					if (c == '"')
+					{
+						m_token = token_string;
+						m_string_is_key = true;
+						m_context.clear();
+
+						return true;
+					}
+
+					return fail();
+				}
+
+			case state_expect_colon:
+				{
+					if (c == ':')
+					{
+						m_state = state_expect_value;
+
+						return true;
+					}
+
+					return fail();
+				}
+
+			case state_expect_comma_or_close:
+				{
+					if (c == ',')
+					{
+						m_state = (m_stack.back() == frame_object) ? state_expect_key : state_expect_value;
+
+						return true;
+					}
+
+					if ((c == '}') && (m_stack.back() == frame_object))
+					{
+						return close_object();
+					}
+
+					if ((c == ']') && (m_stack.back() == frame_array))
+					{
+						return close_array();
+					}
+
+					return fail();
+				}
+
+			case state_done:
+			case state_error:
+				return fail();
+		}
+
+		return fail();
+	}
+
+	bool stream_parser::begin_value(char c)
+	{
+		switch (c)
+		{
+			case '{':
+				{
+					m_stack.push_back(frame_object);
+
+					if (m_object_start_callback)
+					{
+						m_object_start_callback();
+					}
+
+					m_state = state_expect_key_or_close;
+
+					return true;
+				}
+
+			case '[':
+				{
+					m_stack.push_back(frame_array);
+
+					if (m_array_start_callback)
+					{
+						m_array_start_callback();
+					}
+
+					m_state = state_expect_value_or_close;
+
+					return true;
+				}
+
+			case '"':
+				{
+					m_token = token_string;
+					m_string_is_key = false;
+					m_context.clear();
+
+					return true;
+				}
+
+			case 't':
+				{
+					m_token = token_literal;
+					m_literal = "rue";
+					m_literal_value = literal_true;
+
+					return true;
+				}
+
+			case 'f':
+				{
+					m_token = token_literal;
+					m_literal = "alse";
+					m_literal_value = literal_false;
+
+					return true;
+				}
+
+			case 'n':
+				{
+					m_token = token_literal;
+					m_literal = "ull";
+					m_literal_value = literal_null;
+
+					return true;
+				}
+
+			default:
+				{
+					if (std::isdigit(c) || (c == '-'))
+					{
+						m_token = token_number;
+						m_context.clear();
+						m_context.push_char(c);
+
+						return true;
+					}
+
+					return fail();
+				}
+		}
+	}
+
+	bool stream_parser::end_value()
+	{
+		m_state = m_stack.empty() ? state_done : state_expect_comma_or_close;
+
+		return true;
+	}
+
+	bool stream_parser::end_number()
+	{
+		number_type value;
+
+		if (!m_context.get_number(value))
+		{
+			return fail();
+		}
+
+		m_token = token_none;
+
+		if (m_number_callback)
+		{
+			m_number_callback(value);
+		}
+
+		return end_value();
+	}
+
+	bool stream_parser::close_object()
+	{
+		m_stack.pop_back();
+
+		if (m_object_end_callback)
+		{
+			m_object_end_callback();
+		}
+
+		return end_value();
+	}
+
+	bool stream_parser::close_array()
+	{
+		m_stack.pop_back();
+
+		if (m_array_end_callback)
+		{
+			m_array_end_callback();
+		}
+
+		return end_value();
+	}
+
+	bool stream_parser::fail()
+	{
+		m_state = state_error;
+
+		return false;
+	}
 }
@@ -100,11 +100,33 @@ namespace miniupnpcplus
        * \param external_port the external port wanted.
        * \param lan_port the local port.
        * \param description a description.
+       *
+       * The mapping is requested with a finite lease so a crashed process
+       * does not leave a stale mapping behind forever; the owner is
+       * expected to call refresh_port_mappings() ahead of expiry.
        */
       void register_port_mapping(enum transport_protocol protocol,
           const std::string& external_port, const std::string& lan_port,
           const std::string& description);
 
+      /**
+       * \brief Renews the lease of every registered mapping.
+       *
+       * Re-adding a mapping with the same parameters extends its lease.
+       */
+      void refresh_port_mappings();
+
+      /**
+       * \brief Re-runs gateway discovery and re-registers the existing
+       * mappings on the selected gateway.
+       * \param timeout UPnP discovery timeout in milliseconds.
+       *
+       * Every gateway of the LAN answers the same discovery window and a
+       * valid connected IGD is selected among them: a gateway that stopped
+       * answering fails over to another one, mappings included.
+       */
+      void rediscover(int timeout);
+
       /**
        * \brief Unregisters a port mapping from UPnP IGD.
        * \param protocol protocol (TCP or UDP).
@@ -126,6 +148,18 @@ namespace miniupnpcplus
       std::string get_lan_ip() const;
 
     private:
+      /**
+       * \brief Discovers the gateways and selects a valid connected IGD.
+       * \param timeout UPnP discovery timeout in milliseconds.
+       */
+      void discover(int timeout);
+
+      /**
+       * \brief Adds (or renews) a port mapping on the selected IGD.
+       * \param mapping the mapping.
+       */
+      void add_port_mapping(const struct upnp_mapping& mapping);
+
       /**
        * \brief Underlying miniupnpc library pointer.
        */
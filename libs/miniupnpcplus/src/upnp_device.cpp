@@ -4,6 +4,8 @@
  * \brief A UPnP device class.
  */
 
+#include <cstring>
+
 #include <boost/system/system_error.hpp>
 
 #include <miniupnpc/upnpcommands.h>
@@ -11,10 +13,23 @@
 #include "upnp_device.hpp"
 #include "error.hpp"
 
+namespace
+{
+  // lease duration (in seconds) requested for the mappings; refreshed by
+  // refresh_port_mappings() before it expires
+  const char UPNP_LEASE_DURATION[] = "3600";
+}
+
 namespace miniupnpcplus
 {
   upnp_device::upnp_device(int timeout)
     : m_upnp(nullptr, freeUPNPDevlist)
+  {
+    std::memset(&m_upnp_urls, 0x00, sizeof(m_upnp_urls));
+    discover(timeout);
+  }
+
+  void upnp_device::discover(int timeout)
   {
     int error = 0;
     char lan[256];
@@ -32,6 +47,8 @@ namespace miniupnpcplus
       throw boost::system::system_error(ec);
     }
 
+    // every gateway of the LAN answers the discovery and a valid connected
+    // IGD is selected among them
     int status = UPNP_GetValidIGD(m_upnp.get(), &m_upnp_urls, &m_upnp_data,
         lan, sizeof(lan));
 
@@ -39,6 +56,7 @@ namespace miniupnpcplus
     {
       // no IGD gateway on LAN
       FreeUPNPUrls(&m_upnp_urls);
+      std::memset(&m_upnp_urls, 0x00, sizeof(m_upnp_urls));
       boost::system::error_code ec = boost::system::error_code(-1,
           miniupnpcplus::miniupnpcplus_category());
       throw boost::system::system_error(ec);
@@ -53,6 +71,7 @@ namespace miniupnpcplus
     {
       // problem retrieving WAN IP address
       FreeUPNPUrls(&m_upnp_urls);
+      std::memset(&m_upnp_urls, 0x00, sizeof(m_upnp_urls));
 
       boost::system::error_code ec = boost::system::error_code(error,
           miniupnpcplus::miniupnpcplus_category());
@@ -62,6 +81,20 @@ namespace miniupnpcplus
     m_wan_address = std::string(wan);
   }
 
+  void upnp_device::rediscover(int timeout)
+  {
+    FreeUPNPUrls(&m_upnp_urls);
+    std::memset(&m_upnp_urls, 0x00, sizeof(m_upnp_urls));
+
+    discover(timeout);
+
+    // re-register the mappings on the newly selected gateway
+    for(auto& mapping : m_mappings)
+    {
+      add_port_mapping(mapping);
+    }
+  }
+
   upnp_device::~upnp_device()
   {
     // unregister all mappings, do not use unregister_port_mapping here
@@ -81,26 +114,41 @@ namespace miniupnpcplus
       const std::string& external_port, const std::string& lan_port,
       const std::string& description)
   {
-    // last parameters ("0" means the lease will be as long as possible
+    struct upnp_mapping mapping;
+    mapping.description = description;
+    mapping.protocol = protocol;
+    mapping.external_port = external_port;
+    mapping.lan_port = lan_port;
+
+    add_port_mapping(mapping);
+
+    m_mappings.push_back(mapping);
+  }
+
+  void upnp_device::refresh_port_mappings()
+  {
+    // re-adding a mapping with the same parameters extends its lease
+    for(auto& mapping : m_mappings)
+    {
+      add_port_mapping(mapping);
+    }
+  }
+
+  void upnp_device::add_port_mapping(const struct upnp_mapping& mapping)
+  {
     int error = UPNP_AddPortMapping(m_upnp_urls.controlURL,
-        m_upnp_data.first.servicetype, external_port.c_str(), lan_port.c_str(),
-        m_lan_address.c_str(), description.c_str(),
-        (protocol == TCP ? "TCP" : "UDP"), nullptr, "0");
+        m_upnp_data.first.servicetype, mapping.external_port.c_str(),
+        mapping.lan_port.c_str(), m_lan_address.c_str(),
+        mapping.description.c_str(),
+        (mapping.protocol == TCP ? "TCP" : "UDP"), nullptr,
+        UPNP_LEASE_DURATION);
 
     if(error)
     {
       boost::system::error_code ec = boost::system::error_code(error,
           miniupnpcplus::miniupnpcplus_category());
       throw boost::system::system_error(ec);
-      struct upnp_mapping mapping;
     }
-
-    struct upnp_mapping mapping;
-    mapping.description = description;
-    mapping.protocol = protocol;
-    mapping.external_port = external_port;
-    mapping.lan_port = lan_port;
-    m_mappings.push_back(mapping);
   }
 
   void upnp_device::unregister_port_mapping(enum transport_protocol protocol,
@@ -71,7 +71,8 @@ namespace mongooseplus
 		http_400_bad_request = 400,
 		http_401_unauthorized = 401,
 		http_405_method_not_allowed = 405,
-		http_406_not_acceptable = 406
+		http_406_not_acceptable = 406,
+		http_413_request_entity_too_large = 413
 	};
 
 	/**
@@ -52,6 +52,8 @@
 #include <set>
 #include <regex>
 #include <type_traits>
+#include <unordered_map>
+#include <functional>
 
 #include <boost/optional.hpp>
 #include <boost/asio.hpp>
@@ -187,7 +189,9 @@ namespace mongooseplus
 	{
 		public:
 
-			session_handler_type()
+			session_handler_type() :
+				m_wheel_reference(boost::posix_time::second_clock::universal_time()),
+				m_wheel_cursor(0)
 			{
 				generate_session_id();
 			}
@@ -198,7 +202,7 @@ namespace mongooseplus
 				const std::string session_id = generate_session_id();
 				boost::shared_ptr<SessionType> session = boost::make_shared<SessionType>(session_id, std::forward<Types>(values)...);
 
-				m_sessions[session_id] = session;
+				insert_session(session);
 
 				return session;
 			}
@@ -209,10 +213,39 @@ namespace mongooseplus
 
 		private:
 
+			/**
+			 * \brief The count of hash shards the sessions are spread over.
+			 */
+			static const size_t SHARD_COUNT = 16;
+
+			/**
+			 * \brief The count of one-second slots in the expiry timing wheel.
+			 */
+			static const size_t WHEEL_SLOT_COUNT = 512;
+
+			typedef std::unordered_map<std::string, boost::shared_ptr<generic_session>> session_map_type;
+
 			std::string generate_session_id() const;
+			void insert_session(const boost::shared_ptr<generic_session>& session);
+			void schedule_expiry(const generic_session& session);
+
+			session_map_type& shard_for(const std::string& session_id)
+			{
+				return m_session_shards[std::hash<std::string>()(session_id) % SHARD_COUNT];
+			}
+
+			const session_map_type& shard_for(const std::string& session_id) const
+			{
+				return m_session_shards[std::hash<std::string>()(session_id) % SHARD_COUNT];
+			}
 
 			mutable std::string m_last_session_id;
-			std::map<std::string, boost::shared_ptr<generic_session>> m_sessions;
+			session_map_type m_session_shards[SHARD_COUNT];
+
+			// Expiry is driven by a timing wheel: each slot holds the identifiers of the sessions due that second, so cleanup only visits the slots whose deadline passed instead of scanning the whole store. Refreshed sessions are lazily re-filed when their slot fires.
+			std::vector<std::string> m_wheel[WHEEL_SLOT_COUNT];
+			boost::posix_time::ptime m_wheel_reference;
+			size_t m_wheel_cursor;
 	};
 
 	/**
@@ -240,13 +273,48 @@ namespace mongooseplus
 			web_server();
 			virtual ~web_server();
 
-			void run(int poll_period = 1000);
+			/**
+			 * \brief Run the web server until stop() is called.
+			 * \param poll_period The maximum time, in milliseconds, to wait
+			 * for socket activity before polling again. A non-positive value
+			 * means waiting indefinitely: requests are still dispatched the
+			 * moment they arrive, but an idle server never wakes up.
+			 */
+			void run(int poll_period = 0);
 			void stop();
 
+			/**
+			 * \brief Wake up the poll loop from another thread.
+			 *
+			 * Useful when a response is completed asynchronously: the poll loop re-examines its connections immediately instead of waiting for socket activity or for the poll period to elapse.
+			 */
+			void wake();
+
+			/**
+			 * \brief Set the maximum accepted request body size, in bytes.
+			 * \param max_content_size The limit. Zero, the default, means no limit.
+			 *
+			 * Bodies that exceed the limit are discarded as they arrive instead of accumulating in memory, and requests that carry them are answered with HTTP 413.
+			 */
+			void set_max_content_size(size_t max_content_size)
+			{
+				m_max_content_size = max_content_size;
+			}
+
+			/**
+			 * \brief Get the maximum accepted request body size, in bytes.
+			 * \return The limit. Zero means no limit.
+			 */
+			size_t max_content_size() const
+			{
+				return m_max_content_size;
+			}
+
 		private:
 			struct underlying_server_type;
 			std::unique_ptr<underlying_server_type> m_server;
 			std::atomic<bool> m_is_running;
+			size_t m_max_content_size;
 
 		protected:
 			session_handler_type& session_handler()
@@ -291,6 +359,15 @@ namespace mongooseplus
 				return request_result::ignored;
 			}
 
+			/**
+			 * \brief Handle incoming body data.
+			 * \param req The request.
+			 * \return The count of received bytes to discard.
+			 *
+			 * The default implementation discards whatever exceeds max_content_size(), so oversized bodies never accumulate in memory.
+			 */
+			virtual int handle_recv(request& req);
+
 			virtual boost::shared_ptr<generic_session> handle_session_required(const request&)
 			{
 				return boost::shared_ptr<generic_session>();
@@ -343,6 +420,15 @@ namespace mongooseplus
 			std::string content_type() const;
 			const char* content() const;
 			size_t content_size() const;
+
+			/**
+			 * \brief Iterate over the request body in chunks, without copying it.
+			 * \param callback Called once per chunk. Return false to stop the iteration early.
+			 * \param chunk_size The maximum size of a chunk, in bytes.
+			 * \return true if the whole body was visited, false if the callback stopped the iteration.
+			 */
+			bool for_each_content_chunk(const std::function<bool(const char*, size_t)>& callback, size_t chunk_size = 65536) const;
+
 			kfather::value_type json() const;
 			boost::asio::ip::address local_ip() const;
 			uint16_t local_port() const;
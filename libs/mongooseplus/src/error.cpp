@@ -87,6 +87,10 @@ namespace mongooseplus
 			{
 				return "HTTP 406 NOT ACCEPTABLE";
 			}
+			case mongooseplus_error::http_413_request_entity_too_large:
+			{
+				return "HTTP 413 REQUEST ENTITY TOO LARGE";
+			}
 			default:
 			{
 				return "Unknown mongooseplus error";
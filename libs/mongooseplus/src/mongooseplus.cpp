@@ -47,6 +47,8 @@
 
 #include "mongoose.h"
 
+#include <algorithm>
+
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/date_time/time_facet.hpp>
@@ -59,6 +61,7 @@
 #include <kfather/formatter.hpp>
 
 #include <cassert>
+#include <limits>
 
 namespace mongooseplus
 {
@@ -159,19 +162,80 @@ namespace mongooseplus
 		return items;
 	}
 
+	void session_handler_type::insert_session(const boost::shared_ptr<generic_session>& session)
+	{
+		shard_for(session->session_id())[session->session_id()] = session;
+
+		schedule_expiry(*session);
+	}
+
+	void session_handler_type::schedule_expiry(const generic_session& session)
+	{
+		const boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+
+		// Sessions due past the wheel horizon land on the farthest slot and get re-filed when it fires.
+		long delta = (session.expiration_date() - now).total_seconds();
+
+		if (delta < 1)
+		{
+			delta = 1;
+		}
+		else if (delta > static_cast<long>(WHEEL_SLOT_COUNT - 1))
+		{
+			delta = static_cast<long>(WHEEL_SLOT_COUNT - 1);
+		}
+
+		m_wheel[(m_wheel_cursor + static_cast<size_t>(delta)) % WHEEL_SLOT_COUNT].push_back(session.session_id());
+	}
+
 	void session_handler_type::clear_expired()
 	{
 		const boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
 
-		for (auto&& session_it = m_sessions.begin(); session_it != m_sessions.end();)
+		long steps = (now - m_wheel_reference).total_seconds();
+
+		if (steps <= 0)
 		{
-			if (session_it->second->has_expired(now))
-			{
-				session_it = m_sessions.erase(session_it);
-			}
-			else
+			return;
+		}
+
+		if (steps >= static_cast<long>(WHEEL_SLOT_COUNT))
+		{
+			// The wheel was idle for more than a full revolution: one pass over every slot catches up.
+			steps = static_cast<long>(WHEEL_SLOT_COUNT);
+			m_wheel_reference = now;
+		}
+		else
+		{
+			m_wheel_reference += boost::posix_time::seconds(steps);
+		}
+
+		for (long step = 0; step < steps; ++step)
+		{
+			m_wheel_cursor = (m_wheel_cursor + 1) % WHEEL_SLOT_COUNT;
+
+			std::vector<std::string> due_sessions;
+			due_sessions.swap(m_wheel[m_wheel_cursor]);
+
+			for (auto&& session_id : due_sessions)
 			{
-				++session_it;
+				session_map_type& shard = shard_for(session_id);
+				const auto session_it = shard.find(session_id);
+
+				if (session_it == shard.end())
+				{
+					continue;
+				}
+
+				if (session_it->second->has_expired(now))
+				{
+					shard.erase(session_it);
+				}
+				else
+				{
+					// The session was refreshed or is due past the wheel horizon: file it again under its current expiration date.
+					schedule_expiry(*session_it->second);
+				}
 			}
 		}
 	}
@@ -186,11 +250,6 @@ namespace mongooseplus
 
 	web_server::~web_server() {}
 
-	void web_server::stop()
-	{
-		m_is_running = false;
-	}
-
 	struct web_server::underlying_server_type
 	{
 		static int event_handler(struct mg_connection* connp, enum mg_event ev)
@@ -199,6 +258,14 @@ namespace mongooseplus
 
 			web_server& ws = *static_cast<web_server*>(connp->server_param);
 
+			if (ev == MG_RECV)
+			{
+				// MG_RECV expects a count of received bytes to discard, not a request_result.
+				request req(ws, connp);
+
+				return ws.handle_recv(req);
+			}
+
 			const auto result = event_handler_simple(ws, connp, ev);
 
 			switch (result)
@@ -256,9 +323,10 @@ namespace mongooseplus
 
 			if (session_id)
 			{
-				const auto session_it = m_sessions.find(*session_id);
+				const session_map_type& shard = shard_for(*session_id);
+				const auto session_it = shard.find(*session_id);
 
-				if (session_it != m_sessions.end())
+				if (session_it != shard.end())
 				{
 					return session_it->second;
 				}
@@ -270,19 +338,48 @@ namespace mongooseplus
 
 	web_server::web_server() :
 		m_server(new underlying_server_type(this)),
-		m_is_running(false)
+		m_is_running(false),
+		m_max_content_size(0)
 	{}
 
+	int web_server::handle_recv(request& req)
+	{
+		if ((m_max_content_size > 0) && (req.content_size() > m_max_content_size))
+		{
+			// The surplus is discarded as it arrives, so an oversized body never accumulates in memory.
+			return static_cast<int>(req.content_size() - m_max_content_size);
+		}
+
+		return 0;
+	}
+
 	void web_server::run(int poll_period)
 	{
 		m_is_running = true;
 
 		while (m_is_running)
 		{
-			mg_poll_server(m_server->server.get(), poll_period);
+			// The underlying wait returns as soon as a socket becomes ready,
+			// so the period only bounds how long an idle server sleeps.
+			// stop() breaks the wait through the server's control socket,
+			// which makes an indefinite period safe.
+			mg_poll_server(m_server->server.get(), (poll_period > 0) ? poll_period : std::numeric_limits<int>::max());
 		}
 	}
 
+	void web_server::stop()
+	{
+		m_is_running = false;
+
+		// Break the possibly indefinite wait of run() right away.
+		mg_wakeup_server(m_server->server.get());
+	}
+
+	void web_server::wake()
+	{
+		mg_wakeup_server(m_server->server.get());
+	}
+
 	void web_server::set_option(const std::string& name, const std::string& value)
 	{
 		const char* result = ::mg_set_option(m_server->server.get(), name.c_str(), value.c_str());
@@ -432,6 +529,24 @@ namespace mongooseplus
 		return m_connection->content_len;
 	}
 
+	bool request::for_each_content_chunk(const std::function<bool(const char*, size_t)>& callback, size_t chunk_size) const
+	{
+		assert(chunk_size > 0);
+
+		const char* const data = content();
+		const size_t size = content_size();
+
+		for (size_t offset = 0; offset < size; offset += chunk_size)
+		{
+			if (!callback(data + offset, std::min(chunk_size, size - offset)))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
 	kfather::value_type request::json() const
 	{
 		if (content_type() != "application/json")
@@ -548,7 +663,10 @@ namespace mongooseplus
 	void request::send_json(const kfather::value_type& _json)
 	{
 		send_header("content-type", "application/json");
-		send_data(kfather::compact_formatter().format(_json));
+
+		// Serializing straight into the connection avoids holding a full
+		// copy of the document next to the value tree.
+		kfather::compact_sink_formatter().format([this](const char* data, size_t data_len){ send_data(data, data_len); }, _json);
 	}
 
 	void request::write(const void* buf, size_t buf_len)
@@ -657,6 +775,13 @@ namespace mongooseplus
 	{
 		try
 		{
+			const size_t max_size = max_content_size();
+
+			if ((max_size > 0) && (req.content_size() > max_size))
+			{
+				throw http_error(mongooseplus_error::http_413_request_entity_too_large);
+			}
+
 			const route_type* const route = get_route(req);
 
 			if (route)
@@ -46,8 +46,12 @@
 
 #include <boost/asio.hpp>
 #include <boost/optional.hpp>
+#include <boost/function.hpp>
 
 #include <string>
+#include <vector>
+#include <map>
+#include <array>
 
 #include "protocol.hpp"
 
@@ -126,6 +130,33 @@ namespace netlinkplus
 		unsigned int metric;
 	};
 
+	/**
+	 * \brief The kernel statistics of an interface.
+	 */
+	struct interface_stats_entry
+	{
+		interface_stats_entry() :
+			rx_packets{},
+			tx_packets{},
+			rx_bytes{},
+			tx_bytes{},
+			rx_errors{},
+			tx_errors{},
+			rx_dropped{},
+			tx_dropped{}
+		{
+		}
+
+		uint64_t rx_packets;
+		uint64_t tx_packets;
+		uint64_t rx_bytes;
+		uint64_t tx_bytes;
+		uint64_t rx_errors;
+		uint64_t tx_errors;
+		uint64_t rx_dropped;
+		uint64_t tx_dropped;
+	};
+
 	/**
 	 * \brief A interface address entry.
 	 */
@@ -143,6 +174,35 @@ namespace netlinkplus
 		boost::optional<std::string> label;
 	};
 
+	/**
+	 * \brief A route operation, for use in batches.
+	 */
+	struct route_operation
+	{
+		/**
+		 * \brief The operation type.
+		 */
+		enum class operation_type
+		{
+			add,
+			remove
+		};
+
+		route_operation() :
+			operation(operation_type::add),
+			destination_length{}
+		{
+		}
+
+		operation_type operation;
+		interface_entry interface;
+		boost::asio::ip::address destination;
+		unsigned int destination_length;
+		boost::optional<boost::asio::ip::address> gateway;
+	};
+
+	class route_request_type;
+
 	/**
 	 * \brief Manage routes.
 	 */
@@ -150,6 +210,16 @@ namespace netlinkplus
 	{
 		public:
 
+			/**
+			 * \brief The handler type for asynchronous route operations.
+			 */
+			typedef boost::function<void (const boost::system::error_code&)> route_handler_type;
+
+			/**
+			 * \brief The handler type for asynchronous batched route operations.
+			 */
+			typedef boost::function<void (const std::vector<boost::system::error_code>&)> routes_handler_type;
+
 			/**
 			 * \brief Create a route manager.
 			 */
@@ -161,7 +231,14 @@ namespace netlinkplus
 			 * \return The route entry, if any.
 			 */
 			route_entry get_route_for(const boost::asio::ip::address& host);
-			
+
+			/**
+			 * \brief Get the kernel statistics of the specified interface.
+			 * \param interface The interface.
+			 * \return The statistics.
+			 */
+			interface_stats_entry get_interface_stats(const interface_entry& interface);
+
 			/**
 			 * \brief Add a route entry.
 			 * \param interface The interface.
@@ -180,6 +257,40 @@ namespace netlinkplus
 			 */
 			void remove_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway = boost::optional<boost::asio::ip::address>());
 
+			/**
+			 * \brief Apply several route operations, batching them into as few netlink exchanges as possible.
+			 * \param operations The operations to apply.
+			 * \return One error code per operation, in order. A default-constructed error code indicates success.
+			 */
+			std::vector<boost::system::error_code> set_routes(const std::vector<route_operation>& operations);
+
+			/**
+			 * \brief Add a route entry asynchronously.
+			 * \param interface The interface.
+			 * \param destination The destination.
+			 * \param destination_length The destination length.
+			 * \param gateway The gateway.
+			 * \param handler The handler that will get called when the kernel acknowledges the request.
+			 */
+			void async_add_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway, route_handler_type handler);
+
+			/**
+			 * \brief Remove a route entry asynchronously.
+			 * \param interface The interface.
+			 * \param destination The destination.
+			 * \param destination_length The destination length.
+			 * \param gateway The gateway.
+			 * \param handler The handler that will get called when the kernel acknowledges the request.
+			 */
+			void async_remove_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway, route_handler_type handler);
+
+			/**
+			 * \brief Apply several route operations asynchronously, without ever blocking the calling thread.
+			 * \param operations The operations to apply.
+			 * \param handler The handler that will get called with one error code per operation, in order, once the kernel acknowledged them all.
+			 */
+			void async_set_routes(const std::vector<route_operation>& operations, routes_handler_type handler);
+
 			/**
 			 * \brief Add an interface address.
 			 * \param interface The interface to set the address on.
@@ -216,9 +327,22 @@ namespace netlinkplus
 
 		private:
 
+			route_request_type make_route_request(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway);
 			void generic_route(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway);
 			void generic_interface_address(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& address, size_t prefix_length, const boost::asio::ip::address& remote_address);
 
+			void do_async_generic_route(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway, route_handler_type handler);
+			void do_start_receive();
+			void do_complete_request(uint32_t sequence, const boost::system::error_code& ec);
+
 			netlink_route_protocol::socket m_socket;
+
+			// The asynchronous operations get their own socket so their acknowledgments never get mixed up with the synchronous request/response exchanges above. All the state below is only accessed from within m_strand.
+			netlink_route_protocol::socket m_async_socket;
+			boost::asio::io_service::strand m_strand;
+			uint32_t m_sequence;
+			std::map<uint32_t, route_handler_type> m_pending_handlers;
+			bool m_receiving;
+			std::array<char, 16384> m_receive_buffer;
 	};
 }
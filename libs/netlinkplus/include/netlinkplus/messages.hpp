@@ -488,6 +488,37 @@ namespace netlinkplus
 	{
 	};
 
+	template <size_t DataSize>
+	class interface_message_type : public generic_message_type< ::ifinfomsg, DataSize>, public attribute_message<interface_message_type<DataSize>>
+	{
+		public:
+			explicit interface_message_type(uint16_t type = 0, uint16_t flags = 0) :
+				generic_message_type< ::ifinfomsg, DataSize>(type, flags)
+			{
+				this->subheader().ifi_family = AF_UNSPEC;
+			}
+
+			void set_interface(unsigned int interface)
+			{
+				this->subheader().ifi_index = static_cast<int>(interface);
+			}
+	};
+
+	class interface_request_type : public interface_message_type<1024>
+	{
+		public:
+			explicit interface_request_type(uint16_t type = 0, uint16_t flags = 0) :
+				interface_message_type<1024>(type, flags)
+			{
+			}
+	};
+
+	// Link responses carry many attributes (statistics, addresses, driver
+	// details, ...) so they get a larger buffer than the other responses.
+	class interface_response_type : public interface_message_type<8192>
+	{
+	};
+
 	class error_message_type : public generic_message_type< ::nlmsgerr, 1024>
 	{
 		public:
@@ -496,4 +527,101 @@ namespace netlinkplus
 			{
 			}
 	};
+
+	/**
+	 * \brief A view over a buffer that may contain several consecutive netlink messages.
+	 *
+	 * The kernel batches messages (notably acknowledgments and NLM_F_MULTI parts) into a single datagram: this allows iterating over each of them.
+	 */
+	class message_sequence
+	{
+		public:
+
+			class const_iterator : public std::iterator<std::forward_iterator_tag, const ::nlmsghdr>
+			{
+				public:
+
+					const_iterator& operator++()
+					{
+						if (NLMSG_OK(m_ptr, m_ptr_len))
+						{
+							m_ptr = NLMSG_NEXT(m_ptr, m_ptr_len);
+						}
+
+						if (!NLMSG_OK(m_ptr, m_ptr_len))
+						{
+							*this = const_iterator();
+						}
+
+						return *this;
+					}
+
+					const_iterator operator++(int)
+					{
+						const_iterator tmp(*this);
+						operator++();
+						return tmp;
+					}
+
+					bool operator==(const const_iterator& rhs) const
+					{
+						return (rhs.m_ptr == m_ptr);
+					}
+
+					bool operator!=(const const_iterator& rhs) const
+					{
+						return (rhs.m_ptr != m_ptr);
+					}
+
+					const_iterator::reference operator*()
+					{
+						return *m_ptr;
+					}
+
+				protected:
+
+					explicit const_iterator() :
+						m_ptr(nullptr), m_ptr_len()
+					{
+					}
+
+					explicit const_iterator(const_iterator::pointer ptr, size_t ptr_len) :
+						m_ptr(ptr),
+						m_ptr_len(static_cast<int>(ptr_len))
+					{
+						if (!NLMSG_OK(m_ptr, m_ptr_len))
+						{
+							*this = const_iterator();
+						}
+					}
+
+				private:
+
+					const_iterator::pointer m_ptr;
+					int m_ptr_len;
+
+					friend class message_sequence;
+			};
+
+			explicit message_sequence(const void* buf, size_t buf_len) :
+				m_buf(buf),
+				m_buf_len(buf_len)
+			{
+			}
+
+			const_iterator begin() const
+			{
+				return const_iterator(static_cast<const ::nlmsghdr*>(m_buf), m_buf_len);
+			}
+
+			const_iterator end() const
+			{
+				return const_iterator();
+			}
+
+		private:
+
+			const void* m_buf;
+			size_t m_buf_len;
+	};
 }
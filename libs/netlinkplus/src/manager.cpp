@@ -48,6 +48,12 @@
 
 #include <net/if.h>
 #include <errno.h>
+#include <string.h>
+
+#include <array>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 
 namespace netlinkplus
 {
@@ -188,10 +194,16 @@ namespace netlinkplus
 	}
 
 	manager::manager(boost::asio::io_service& io_service) :
-		m_socket(io_service, netlink_route_protocol::endpoint())
+		m_socket(io_service, netlink_route_protocol::endpoint()),
+		m_async_socket(io_service, netlink_route_protocol::endpoint()),
+		m_strand(io_service),
+		m_sequence(0),
+		m_receiving(false)
 	{
 		m_socket.set_option(boost::asio::socket_base::send_buffer_size(32768));
 		m_socket.set_option(boost::asio::socket_base::receive_buffer_size(32768));
+		m_async_socket.set_option(boost::asio::socket_base::send_buffer_size(32768));
+		m_async_socket.set_option(boost::asio::socket_base::receive_buffer_size(32768));
 	}
 
 	route_entry manager::get_route_for(const boost::asio::ip::address& host)
@@ -234,6 +246,86 @@ namespace netlinkplus
 		return result;
 	}
 
+	interface_stats_entry manager::get_interface_stats(const interface_entry& interface)
+	{
+		interface_request_type request(RTM_GETLINK, NLM_F_REQUEST);
+		interface_response_type response;
+		request.set_interface(interface.index());
+
+		m_socket.send(boost::asio::buffer(request.data(), request.size()));
+		const size_t cnt = m_socket.receive(boost::asio::buffer(response.data(), response.max_size()));
+
+		if (!response.is_valid(cnt))
+		{
+			throw boost::system::system_error(make_error_code(netlinkplus_error::invalid_response));
+		}
+
+		if (response.header().nlmsg_type != RTM_NEWLINK)
+		{
+			throw boost::system::system_error(make_error_code(netlinkplus_error::unexpected_response_type));
+		}
+
+		interface_stats_entry result;
+		bool has_stats64 = false;
+
+		const auto attributes = response.attributes();
+
+		for (auto&& attribute : attributes)
+		{
+			switch (attribute.rta_type)
+			{
+#ifdef IFLA_STATS64
+				case IFLA_STATS64:
+					{
+						if (RTA_PAYLOAD(&attribute) >= sizeof(::rtnl_link_stats64))
+						{
+							::rtnl_link_stats64 stats;
+							::memcpy(&stats, RTA_DATA(&attribute), sizeof(stats));
+
+							result.rx_packets = stats.rx_packets;
+							result.tx_packets = stats.tx_packets;
+							result.rx_bytes = stats.rx_bytes;
+							result.tx_bytes = stats.tx_bytes;
+							result.rx_errors = stats.rx_errors;
+							result.tx_errors = stats.tx_errors;
+							result.rx_dropped = stats.rx_dropped;
+							result.tx_dropped = stats.tx_dropped;
+
+							has_stats64 = true;
+						}
+
+						break;
+					}
+#endif
+				case IFLA_STATS:
+					{
+						// The 32-bit counters only matter when the kernel
+						// does not provide the 64-bit ones.
+						if (!has_stats64 && (RTA_PAYLOAD(&attribute) >= sizeof(::rtnl_link_stats)))
+						{
+							::rtnl_link_stats stats;
+							::memcpy(&stats, RTA_DATA(&attribute), sizeof(stats));
+
+							result.rx_packets = stats.rx_packets;
+							result.tx_packets = stats.tx_packets;
+							result.rx_bytes = stats.rx_bytes;
+							result.tx_bytes = stats.tx_bytes;
+							result.rx_errors = stats.rx_errors;
+							result.tx_errors = stats.tx_errors;
+							result.rx_dropped = stats.rx_dropped;
+							result.tx_dropped = stats.tx_dropped;
+						}
+
+						break;
+					}
+				default:
+					break;
+			}
+		}
+
+		return result;
+	}
+
 	void manager::add_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway)
 	{
 		generic_route(RTM_NEWROUTE, interface, destination, destination_length, gateway);
@@ -264,11 +356,139 @@ namespace netlinkplus
 		generic_interface_address(RTM_DELADDR, interface, address, prefix_length, remote_address);
 	}
 
-	void manager::generic_route(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway)
+	std::vector<boost::system::error_code> manager::set_routes(const std::vector<route_operation>& operations)
 	{
-		using boost::asio::buffer_size;
-		using boost::asio::buffer_cast;
+		// The size beyond which the pending requests get sent, so that a batch never exceeds the socket buffers.
+		static const size_t BATCH_BUFFER_SIZE = 8192;
+
+		std::vector<boost::system::error_code> results(operations.size());
+
+		std::vector<char> send_buffer;
+		send_buffer.reserve(BATCH_BUFFER_SIZE);
+
+		size_t pending_count = 0;
+
+		const auto flush = [this, &send_buffer, &results, &pending_count]() {
+			if (pending_count == 0)
+			{
+				return;
+			}
+
+			m_socket.send(boost::asio::buffer(send_buffer));
+
+			std::array<char, 16384> response_buffer;
+
+			// The acknowledgments may come batched into datagrams, several messages each.
+			for (size_t acknowledged = 0; acknowledged < pending_count; )
+			{
+				const size_t cnt = m_socket.receive(boost::asio::buffer(response_buffer));
+
+				for (auto&& header : message_sequence(response_buffer.data(), cnt))
+				{
+					if (header.nlmsg_type != NLMSG_ERROR)
+					{
+						throw boost::system::system_error(make_error_code(netlinkplus_error::unexpected_response_type));
+					}
+
+					if (header.nlmsg_seq >= results.size())
+					{
+						throw boost::system::system_error(make_error_code(netlinkplus_error::invalid_response));
+					}
+
+					const ::nlmsgerr* const error = static_cast<const ::nlmsgerr*>(NLMSG_DATA(&header));
+
+					if (error->error != 0)
+					{
+						results[header.nlmsg_seq] = boost::system::error_code(-error->error, boost::system::system_category());
+					}
 
+					++acknowledged;
+				}
+			}
+
+			send_buffer.clear();
+			pending_count = 0;
+		};
+
+		for (size_t i = 0; i < operations.size(); ++i)
+		{
+			const route_operation& operation = operations[i];
+			const uint16_t type = (operation.operation == route_operation::operation_type::add) ? RTM_NEWROUTE : RTM_DELROUTE;
+
+			route_request_type request = make_route_request(type, operation.interface, operation.destination, operation.destination_length, operation.gateway);
+
+			// The sequence number matches the acknowledgments back to their operations.
+			request.header().nlmsg_seq = static_cast<uint32_t>(i);
+
+			if (send_buffer.size() + request.size() > BATCH_BUFFER_SIZE)
+			{
+				flush();
+			}
+
+			const char* const request_data = static_cast<const char*>(request.data());
+			send_buffer.insert(send_buffer.end(), request_data, request_data + request.size());
+			++pending_count;
+		}
+
+		flush();
+
+		return results;
+	}
+
+	void manager::async_add_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway, route_handler_type handler)
+	{
+		m_strand.post(boost::bind(&manager::do_async_generic_route, this, static_cast<uint16_t>(RTM_NEWROUTE), interface, destination, destination_length, gateway, handler));
+	}
+
+	void manager::async_remove_route(const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway, route_handler_type handler)
+	{
+		m_strand.post(boost::bind(&manager::do_async_generic_route, this, static_cast<uint16_t>(RTM_DELROUTE), interface, destination, destination_length, gateway, handler));
+	}
+
+	void manager::async_set_routes(const std::vector<route_operation>& operations, routes_handler_type handler)
+	{
+		if (operations.empty())
+		{
+			m_strand.post([handler]() {
+				handler(std::vector<boost::system::error_code>());
+			});
+
+			return;
+		}
+
+		struct context_type
+		{
+			std::vector<boost::system::error_code> results;
+			size_t remaining;
+			routes_handler_type handler;
+		};
+
+		const auto context = boost::make_shared<context_type>();
+		context->results.resize(operations.size());
+		context->remaining = operations.size();
+		context->handler = handler;
+
+		for (size_t i = 0; i < operations.size(); ++i)
+		{
+			const route_operation& operation = operations[i];
+			const uint16_t type = (operation.operation == route_operation::operation_type::add) ? RTM_NEWROUTE : RTM_DELROUTE;
+
+			// Every completion runs within m_strand, so the counter needs no synchronization.
+			const route_handler_type operation_handler = [context, i](const boost::system::error_code& ec) {
+				context->results[i] = ec;
+
+				if (--context->remaining == 0)
+				{
+					context->handler(context->results);
+				}
+			};
+
+			m_strand.post(boost::bind(&manager::do_async_generic_route, this, type, operation.interface, operation.destination, operation.destination_length, operation.gateway, operation_handler));
+		}
+	}
+
+	route_request_type manager::make_route_request(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway)
+	{
 		int flags = NLM_F_REQUEST | NLM_F_ACK;
 
 		if (type == RTM_NEWROUTE)
@@ -277,7 +497,6 @@ namespace netlinkplus
 		}
 
 		route_request_type request(type, flags);
-		error_message_type response;
 
 		request.subheader().rtm_table = RT_TABLE_MAIN;
 		request.subheader().rtm_scope = RT_SCOPE_UNIVERSE;
@@ -292,6 +511,17 @@ namespace netlinkplus
 			request.set_gateway(*gateway);
 		}
 
+		return request;
+	}
+
+	void manager::generic_route(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway)
+	{
+		using boost::asio::buffer_size;
+		using boost::asio::buffer_cast;
+
+		route_request_type request = make_route_request(type, interface, destination, destination_length, gateway);
+		error_message_type response;
+
 		m_socket.send(boost::asio::buffer(request.data(), request.size()));
 		const size_t cnt = m_socket.receive(boost::asio::buffer(response.data(), response.max_size()));
 
@@ -311,6 +541,87 @@ namespace netlinkplus
 		}
 	}
 
+	void manager::do_async_generic_route(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& destination, unsigned int destination_length, boost::optional<boost::asio::ip::address> gateway, route_handler_type handler)
+	{
+		// Executed within m_strand.
+		const auto request = boost::make_shared<route_request_type>(make_route_request(type, interface, destination, destination_length, gateway));
+		const uint32_t sequence = m_sequence++;
+
+		request->header().nlmsg_seq = sequence;
+
+		m_pending_handlers[sequence] = handler;
+
+		m_async_socket.async_send(
+			boost::asio::buffer(request->data(), request->size()),
+			m_strand.wrap([this, request, sequence](const boost::system::error_code& ec, size_t) {
+				if (ec)
+				{
+					do_complete_request(sequence, ec);
+				}
+			})
+		);
+
+		do_start_receive();
+	}
+
+	void manager::do_start_receive()
+	{
+		// Executed within m_strand.
+		if (m_receiving || m_pending_handlers.empty())
+		{
+			return;
+		}
+
+		m_receiving = true;
+
+		m_async_socket.async_receive(
+			boost::asio::buffer(m_receive_buffer),
+			m_strand.wrap([this](const boost::system::error_code& ec, size_t cnt) {
+				m_receiving = false;
+
+				if (ec)
+				{
+					// Nothing more will come out of the socket: complete every pending request.
+					while (!m_pending_handlers.empty())
+					{
+						do_complete_request(m_pending_handlers.begin()->first, ec);
+					}
+
+					return;
+				}
+
+				for (auto&& header : message_sequence(m_receive_buffer.data(), cnt))
+				{
+					if (header.nlmsg_type != NLMSG_ERROR)
+					{
+						continue;
+					}
+
+					const ::nlmsgerr* const error = static_cast<const ::nlmsgerr*>(NLMSG_DATA(&header));
+
+					do_complete_request(header.nlmsg_seq, (error->error != 0) ? boost::system::error_code(-error->error, boost::system::system_category()) : boost::system::error_code());
+				}
+
+				do_start_receive();
+			})
+		);
+	}
+
+	void manager::do_complete_request(uint32_t sequence, const boost::system::error_code& ec)
+	{
+		// Executed within m_strand.
+		const auto pending_handler = m_pending_handlers.find(sequence);
+
+		if (pending_handler != m_pending_handlers.end())
+		{
+			const route_handler_type handler = pending_handler->second;
+
+			m_pending_handlers.erase(pending_handler);
+
+			handler(ec);
+		}
+	}
+
 	void manager::generic_interface_address(uint16_t type, const interface_entry& interface, const boost::asio::ip::address& address, size_t prefix_length, const boost::asio::ip::address& remote_address)
 	{
 		using boost::asio::buffer_size;
@@ -0,0 +1,472 @@
+/**
+ * \file bench.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A microbenchmark suite for the switch and router forwarding decision paths.
+ */
+
+#include <freelan/switch.hpp>
+#include <freelan/router.hpp>
+#include <freelan/configuration.hpp>
+#include <freelan/port_index.hpp>
+
+#include <asiotap/types/ip_route.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace
+{
+	/**
+	 * \brief The minimum measured duration for a benchmark to be reported.
+	 *
+	 * The iteration count is scaled up until a run takes at least this long,
+	 * so short operations are still timed over a meaningful interval.
+	 */
+	const boost::posix_time::time_duration MIN_RUN_DURATION = boost::posix_time::milliseconds(500);
+
+	/**
+	 * \brief The count of ports the frames are spread over.
+	 */
+	const size_t PORT_COUNT = 16;
+
+	/**
+	 * \brief The MAC table and route table sizes to benchmark.
+	 */
+	const size_t TABLE_SIZES[] = { 100, 1000, 10000, 100000 };
+
+#ifdef LINUX
+	/**
+	 * \brief A hardware cache-miss counter, backed by perf events.
+	 *
+	 * Opening the counter can fail (no permission, no PMU in the current
+	 * container, ...): the counter then stays silently disabled and the
+	 * benchmarks only report latencies.
+	 */
+	class cache_miss_counter
+	{
+		public:
+
+			cache_miss_counter() :
+				m_fd(-1)
+			{
+				perf_event_attr attr;
+
+				std::memset(&attr, 0, sizeof(attr));
+
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.size = sizeof(attr);
+				attr.config = PERF_COUNT_HW_CACHE_MISSES;
+				attr.disabled = 1;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+
+				m_fd = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+			}
+
+			~cache_miss_counter()
+			{
+				if (m_fd >= 0)
+				{
+					::close(m_fd);
+				}
+			}
+
+			bool valid() const
+			{
+				return (m_fd >= 0);
+			}
+
+			void start()
+			{
+				if (m_fd >= 0)
+				{
+					::ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+					::ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+				}
+			}
+
+			uint64_t stop()
+			{
+				uint64_t result = 0;
+
+				if (m_fd >= 0)
+				{
+					::ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+					if (::read(m_fd, &result, sizeof(result)) != static_cast<ssize_t>(sizeof(result)))
+					{
+						result = 0;
+					}
+				}
+
+				return result;
+			}
+
+		private:
+
+			cache_miss_counter(const cache_miss_counter&);
+			cache_miss_counter& operator=(const cache_miss_counter&);
+
+			int m_fd;
+	};
+#else
+	/**
+	 * \brief A no-op counter, for platforms without perf events.
+	 */
+	class cache_miss_counter
+	{
+		public:
+
+			bool valid() const
+			{
+				return false;
+			}
+
+			void start() {}
+
+			uint64_t stop()
+			{
+				return 0;
+			}
+	};
+#endif
+
+	typedef boost::function<void (size_t)> benchmark_function_type;
+
+	struct benchmark_type
+	{
+		std::string name;
+		benchmark_function_type function;
+	};
+
+	std::vector<benchmark_type>& benchmarks()
+	{
+		static std::vector<benchmark_type> result;
+
+		return result;
+	}
+
+	void register_benchmark(const std::string& name, benchmark_function_type function)
+	{
+		const benchmark_type benchmark = { name, function };
+
+		benchmarks().push_back(benchmark);
+	}
+
+	void run_benchmark(const benchmark_type& benchmark)
+	{
+		using boost::posix_time::microsec_clock;
+
+		size_t iterations = 16;
+		boost::posix_time::time_duration elapsed;
+		cache_miss_counter cache_misses;
+		uint64_t cache_miss_count = 0;
+
+		// Scale the iteration count until the run lasts long enough for the
+		// clock resolution not to matter.
+		for (;;)
+		{
+			cache_misses.start();
+
+			const boost::posix_time::ptime start = microsec_clock::universal_time();
+
+			benchmark.function(iterations);
+
+			elapsed = microsec_clock::universal_time() - start;
+
+			cache_miss_count = cache_misses.stop();
+
+			if (elapsed >= MIN_RUN_DURATION)
+			{
+				break;
+			}
+
+			iterations *= 4;
+		}
+
+		const double nanoseconds_per_iteration = static_cast<double>(elapsed.total_microseconds()) * 1000.0 / static_cast<double>(iterations);
+
+		std::cout << std::left << std::setw(56) << benchmark.name;
+		std::cout << std::right << std::setw(12) << std::fixed << std::setprecision(0) << nanoseconds_per_iteration << " ns/frame";
+		std::cout << std::setw(12) << iterations << " frames";
+
+		if (cache_misses.valid())
+		{
+			const double cache_misses_per_iteration = static_cast<double>(cache_miss_count) / static_cast<double>(iterations);
+
+			std::cout << std::setw(12) << std::setprecision(2) << cache_misses_per_iteration << " misses/frame";
+		}
+
+		std::cout << std::endl;
+	}
+
+	/**
+	 * \brief Get the port index associated to a given port number.
+	 *
+	 * The benchmarks use endpoint port indexes, as a host would for its
+	 * peers: one index per synthetic peer.
+	 */
+	freelan::port_index_type port_index(size_t i)
+	{
+		return freelan::make_port_index(fscp::server::ep_type(boost::asio::ip::address_v4(0x0a000000 + static_cast<uint32_t>(i)), 12000));
+	}
+
+	/**
+	 * \brief Get the MAC address associated to a given host number.
+	 *
+	 * The addresses are locally administered unicast addresses.
+	 */
+	freelan::switch_::ethernet_address_type mac_address(size_t i)
+	{
+		return freelan::switch_::ethernet_address_type(UINT64_C(0x020000000000) | static_cast<uint64_t>(i));
+	}
+
+	/**
+	 * \brief Write a MAC address into a raw ethernet frame.
+	 */
+	void write_mac_address(uint8_t* buf, const freelan::switch_::ethernet_address_type& address)
+	{
+		const freelan::switch_::ethernet_address_type::data_type data = address.data();
+
+		std::copy(data.begin(), data.end(), buf);
+	}
+
+	/**
+	 * \brief Walk the host numbers in a non-sequential order.
+	 *
+	 * Consecutive frames rarely concern consecutive hosts: striding through
+	 * the table with a multiplicative hash keeps the access pattern honest
+	 * with respect to the caches.
+	 */
+	size_t next_host(size_t current, size_t count)
+	{
+		return (current * 2654435761UL + 1) % count;
+	}
+
+	void discard_multi_write_result(const freelan::switch_::multi_write_result_type&)
+	{
+	}
+
+	void discard_write_result(boost::system::error_code)
+	{
+	}
+
+	/**
+	 * \brief A port write function that completes at once.
+	 *
+	 * The benchmarks measure the forwarding decision, not the transport: the
+	 * ports succeed synchronously and cost as little as possible.
+	 */
+	void null_port_write(boost::asio::const_buffer, boost::function<void (boost::system::error_code)> handler)
+	{
+		handler(boost::system::error_code());
+	}
+
+	void register_switch_benchmarks(size_t table_size)
+	{
+		const std::string suffix = "/" + boost::lexical_cast<std::string>(table_size) + "-entries";
+
+		// The switch outlives the benchmark functions that share it, so it
+		// is kept alive by the closures.
+		freelan::switch_configuration configuration;
+		configuration.routing_method = freelan::switch_configuration::RM_SWITCH;
+
+		const boost::shared_ptr<freelan::switch_> switch_ = boost::make_shared<freelan::switch_>(configuration, table_size);
+
+		for (size_t i = 0; i < PORT_COUNT; ++i)
+		{
+			switch_->register_port(port_index(i), freelan::switch_::port_type(&null_port_write, static_cast<freelan::switch_::port_group_type>(i)));
+		}
+
+		// Learn one MAC address per host by replaying a frame from each
+		// host's port, as the real traffic would.
+		for (size_t i = 0; i < table_size; ++i)
+		{
+			freelan::switch_::ethernet_frame_context_type context;
+			context.sender = mac_address(i);
+			context.target = freelan::switch_::ethernet_address_type::broadcast();
+
+			switch_->async_write(port_index(i % PORT_COUNT), boost::asio::const_buffer(), context, &discard_multi_write_result);
+		}
+
+		register_benchmark(
+			"switch_::async_write/unicast-hit" + suffix,
+			[switch_, table_size] (size_t iterations) {
+				// A full frame, so the parse of the ethernet header is
+				// included in the measure, as it is on the real data path.
+				uint8_t frame[64] = {};
+				frame[12] = 0x08;
+
+				size_t host = 1;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					write_mac_address(frame, mac_address(host));
+					write_mac_address(frame + 6, mac_address(next_host(host, table_size)));
+
+					switch_->async_write(port_index(host % PORT_COUNT), boost::asio::buffer(frame), boost::none, &discard_multi_write_result);
+
+					host = next_host(host, table_size);
+				}
+			}
+		);
+
+		register_benchmark(
+			"switch_::async_write/unicast-miss-flood" + suffix,
+			[switch_, table_size] (size_t iterations) {
+				uint8_t frame[64] = {};
+				frame[12] = 0x08;
+
+				// An address above the learned range: never in the table.
+				write_mac_address(frame, freelan::switch_::ethernet_address_type(UINT64_C(0x020100000000)));
+
+				size_t host = 1;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					write_mac_address(frame + 6, mac_address(host));
+
+					switch_->async_write(port_index(host % PORT_COUNT), boost::asio::buffer(frame), boost::none, &discard_multi_write_result);
+
+					host = next_host(host, table_size);
+				}
+			}
+		);
+
+		register_benchmark(
+			"switch_::async_write/broadcast" + suffix,
+			[switch_, table_size] (size_t iterations) {
+				uint8_t frame[64] = {};
+				frame[12] = 0x08;
+
+				write_mac_address(frame, freelan::switch_::ethernet_address_type::broadcast());
+
+				size_t host = 1;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					write_mac_address(frame + 6, mac_address(host));
+
+					switch_->async_write(port_index(host % PORT_COUNT), boost::asio::buffer(frame), boost::none, &discard_multi_write_result);
+
+					host = next_host(host, table_size);
+				}
+			}
+		);
+	}
+
+	/**
+	 * \brief Get the network address of a given /24 route.
+	 */
+	boost::asio::ip::address route_network(size_t i)
+	{
+		return boost::asio::ip::address(boost::asio::ip::address_v4((UINT32_C(10) << 24) | (static_cast<uint32_t>(i) << 8)));
+	}
+
+	void register_router_benchmarks(size_t route_count)
+	{
+		const std::string suffix = "/" + boost::lexical_cast<std::string>(route_count) + "-routes";
+
+		freelan::router_configuration configuration;
+		configuration.client_routing_enabled = true;
+
+		const boost::shared_ptr<freelan::router> router = boost::make_shared<freelan::router>(configuration);
+
+		// Spread the /24 routes evenly over the ports, as if each peer
+		// advertised its share of the address space.
+		for (size_t i = 0; i < PORT_COUNT; ++i)
+		{
+			freelan::router::port_type port(&null_port_write, static_cast<freelan::router::port_group_type>(i));
+
+			asiotap::ip_route_set routes;
+
+			for (size_t j = i; j < route_count; j += PORT_COUNT)
+			{
+				routes.insert(asiotap::to_ip_route(route_network(j), 24));
+			}
+
+			port.set_local_routes(routes);
+
+			router->register_port(port_index(i), port);
+		}
+
+		// The destination is handed over pre-parsed, as the core does when
+		// the frame went through the OSI filters already.
+		register_benchmark(
+			"router::async_write/lpm-hit" + suffix,
+			[router, route_count] (size_t iterations) {
+				size_t host = 1;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					const boost::optional<boost::asio::ip::address> destination = boost::asio::ip::address(boost::asio::ip::address_v4((UINT32_C(10) << 24) | (static_cast<uint32_t>(host) << 8) | 1));
+
+					router->async_write(port_index(host % PORT_COUNT), boost::asio::const_buffer(), destination, &discard_write_result);
+
+					host = next_host(host, route_count);
+				}
+			}
+		);
+
+		register_benchmark(
+			"router::async_write/lpm-miss" + suffix,
+			[router, route_count] (size_t iterations) {
+				// An address outside every advertised route.
+				const boost::optional<boost::asio::ip::address> destination = boost::asio::ip::address(boost::asio::ip::address_v4(UINT32_C(0xC0A80001)));
+
+				size_t host = 1;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					router->async_write(port_index(host % PORT_COUNT), boost::asio::const_buffer(), destination, &discard_write_result);
+
+					host = next_host(host, route_count);
+				}
+			}
+		);
+	}
+}
+
+int main()
+{
+	try
+	{
+		for (size_t i = 0; i < sizeof(TABLE_SIZES) / sizeof(TABLE_SIZES[0]); ++i)
+		{
+			register_switch_benchmarks(TABLE_SIZES[i]);
+		}
+
+		for (size_t i = 0; i < sizeof(TABLE_SIZES) / sizeof(TABLE_SIZES[0]); ++i)
+		{
+			register_router_benchmarks(TABLE_SIZES[i]);
+		}
+
+		for (std::vector<benchmark_type>::const_iterator it = benchmarks().begin(); it != benchmarks().end(); ++it)
+		{
+			run_benchmark(*it);
+		}
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Exception caught: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
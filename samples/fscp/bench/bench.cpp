@@ -0,0 +1,271 @@
+/**
+ * \file bench.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A microbenchmark suite for the FSCP message serialization and crypto primitives.
+ */
+
+#include <fscp/fscp.hpp>
+#include <fscp/constants.hpp>
+#include <fscp/data_message.hpp>
+#include <fscp/hello_message.hpp>
+#include <fscp/peer_session.hpp>
+
+#include <cryptoplus/cryptoplus.hpp>
+#include <cryptoplus/error/error_strings.hpp>
+#include <cryptoplus/random/random.hpp>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	/**
+	 * \brief The typical size of a tunneled Ethernet frame, in bytes.
+	 */
+	const size_t CLEARTEXT_SIZE = 1446;
+
+	/**
+	 * \brief The minimum measured duration for a benchmark to be reported.
+	 *
+	 * The iteration count is scaled up until a run takes at least this long,
+	 * so short operations are still timed over a meaningful interval.
+	 */
+	const boost::posix_time::time_duration MIN_RUN_DURATION = boost::posix_time::milliseconds(500);
+
+	typedef boost::function<void (size_t)> benchmark_function_type;
+
+	struct benchmark_type
+	{
+		std::string name;
+		benchmark_function_type function;
+
+		// The count of payload bytes processed per iteration. When non-zero,
+		// a throughput figure is reported along with the latency.
+		size_t bytes_per_iteration;
+	};
+
+	std::vector<benchmark_type>& benchmarks()
+	{
+		static std::vector<benchmark_type> result;
+
+		return result;
+	}
+
+	void register_benchmark(const std::string& name, benchmark_function_type function, size_t bytes_per_iteration = 0)
+	{
+		const benchmark_type benchmark = { name, function, bytes_per_iteration };
+
+		benchmarks().push_back(benchmark);
+	}
+
+	void run_benchmark(const benchmark_type& benchmark)
+	{
+		using boost::posix_time::microsec_clock;
+
+		size_t iterations = 16;
+		boost::posix_time::time_duration elapsed;
+
+		// Scale the iteration count until the run lasts long enough for the
+		// clock resolution not to matter.
+		for (;;)
+		{
+			const boost::posix_time::ptime start = microsec_clock::universal_time();
+
+			benchmark.function(iterations);
+
+			elapsed = microsec_clock::universal_time() - start;
+
+			if (elapsed >= MIN_RUN_DURATION)
+			{
+				break;
+			}
+
+			iterations *= 4;
+		}
+
+		const double nanoseconds_per_iteration = static_cast<double>(elapsed.total_microseconds()) * 1000.0 / static_cast<double>(iterations);
+
+		std::cout << std::left << std::setw(56) << benchmark.name;
+		std::cout << std::right << std::setw(12) << std::fixed << std::setprecision(0) << nanoseconds_per_iteration << " ns/op";
+		std::cout << std::setw(12) << iterations << " iterations";
+
+		if (benchmark.bytes_per_iteration > 0)
+		{
+			const double megabytes_per_second = static_cast<double>(benchmark.bytes_per_iteration) * 1000.0 / nanoseconds_per_iteration;
+
+			std::cout << std::setw(12) << std::setprecision(1) << megabytes_per_second << " MB/s";
+		}
+
+		std::cout << std::endl;
+	}
+
+	cryptoplus::buffer random_buffer(size_t size)
+	{
+		cryptoplus::buffer result(size);
+
+		cryptoplus::random::get_random_bytes(cryptoplus::buffer_cast<uint8_t*>(result), size);
+
+		return result;
+	}
+
+	void register_data_message_benchmarks(fscp::cipher_suite_type cipher_suite)
+	{
+		const cryptoplus::cipher::cipher_algorithm cipher_algorithm = cipher_suite.to_cipher_algorithm();
+		const cryptoplus::buffer key = random_buffer(cipher_algorithm.key_length());
+		const cryptoplus::buffer nonce_prefix = random_buffer(fscp::DEFAULT_NONCE_PREFIX_SIZE);
+		const cryptoplus::buffer cleartext = random_buffer(CLEARTEXT_SIZE);
+
+		register_benchmark(
+			"data_message::write/" + cipher_suite.to_string(),
+			[cipher_algorithm, key, nonce_prefix, cleartext] (size_t iterations) {
+				fscp::session_cipher_context cipher_context(cipher_algorithm, cryptoplus::cipher::cipher_context::encrypt, key, nonce_prefix);
+				std::vector<uint8_t> buf(65536);
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					fscp::data_message::write(
+						&buf[0],
+						buf.size(),
+						fscp::CHANNEL_NUMBER_0,
+						static_cast<fscp::sequence_number_type>(i + 1),
+						cipher_context,
+						cryptoplus::buffer_cast<const uint8_t*>(cleartext),
+						cryptoplus::buffer_size(cleartext)
+					);
+				}
+			},
+			CLEARTEXT_SIZE
+		);
+
+		register_benchmark(
+			"data_message::get_cleartext/" + cipher_suite.to_string(),
+			[cipher_algorithm, key, nonce_prefix, cleartext] (size_t iterations) {
+				fscp::session_cipher_context write_context(cipher_algorithm, cryptoplus::cipher::cipher_context::encrypt, key, nonce_prefix);
+				fscp::session_cipher_context read_context(cipher_algorithm, cryptoplus::cipher::cipher_context::decrypt, key, nonce_prefix);
+				std::vector<uint8_t> buf(65536);
+				std::vector<uint8_t> out(65536);
+
+				const size_t size = fscp::data_message::write(
+					&buf[0],
+					buf.size(),
+					fscp::CHANNEL_NUMBER_0,
+					1,
+					write_context,
+					cryptoplus::buffer_cast<const uint8_t*>(cleartext),
+					cryptoplus::buffer_size(cleartext)
+				);
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					const fscp::message message(&buf[0], size);
+					const fscp::data_message data_message(message);
+
+					data_message.get_cleartext(&out[0], out.size(), read_context, data_message.sequence_number());
+				}
+			},
+			CLEARTEXT_SIZE
+		);
+	}
+
+	void register_hello_message_benchmarks()
+	{
+		register_benchmark(
+			"hello_message::parse",
+			[] (size_t iterations) {
+				std::vector<uint8_t> buf(64);
+
+				const size_t size = fscp::hello_message::write_request(&buf[0], buf.size(), 0x12345678);
+
+				uint32_t checksum = 0;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					const fscp::message message(&buf[0], size);
+					const fscp::hello_message hello_message(message);
+
+					checksum += hello_message.unique_number();
+				}
+
+				// Keep the parsed value alive so the loop is not optimized out.
+				if (checksum == 1)
+				{
+					std::cout << "";
+				}
+			}
+		);
+	}
+
+	void register_key_derivation_benchmarks(fscp::cipher_suite_type cipher_suite, fscp::elliptic_curve_type elliptic_curve)
+	{
+		register_benchmark(
+			"peer_session::compute_session_keys/" + cipher_suite.to_string() + "/" + elliptic_curve.to_string(),
+			[cipher_suite, elliptic_curve] (size_t iterations) {
+				const auto local_context = boost::make_shared<cryptoplus::pkey::ecdhe_context>(elliptic_curve.to_elliptic_curve_nid());
+				cryptoplus::pkey::ecdhe_context remote_context(elliptic_curve.to_elliptic_curve_nid());
+
+				const cryptoplus::buffer remote_public_key = remote_context.get_public_key();
+
+				fscp::host_identifier_type local_host_identifier;
+				fscp::host_identifier_type remote_host_identifier;
+
+				cryptoplus::random::get_random_bytes(local_host_identifier.data.data(), local_host_identifier.data.size());
+				cryptoplus::random::get_random_bytes(remote_host_identifier.data.data(), remote_host_identifier.data.size());
+
+				fscp::peer_session::next_session_type next_session(1, cipher_suite, elliptic_curve, local_context);
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					fscp::peer_session::compute_session_keys(next_session, local_host_identifier, remote_host_identifier, remote_public_key);
+				}
+			}
+		);
+	}
+}
+
+int main()
+{
+	cryptoplus::crypto_initializer crypto_initializer;
+	cryptoplus::algorithms_initializer algorithms_initializer;
+	cryptoplus::error::error_strings_initializer error_strings_initializer;
+
+	const fscp::cipher_suite_list_type cipher_suites = fscp::get_default_cipher_suites();
+	const fscp::elliptic_curve_list_type elliptic_curves = fscp::get_default_elliptic_curves();
+
+	for (auto&& cipher_suite : cipher_suites)
+	{
+		register_data_message_benchmarks(cipher_suite);
+	}
+
+	register_hello_message_benchmarks();
+
+	for (auto&& cipher_suite : cipher_suites)
+	{
+		for (auto&& elliptic_curve : elliptic_curves)
+		{
+			register_key_derivation_benchmarks(cipher_suite, elliptic_curve);
+		}
+	}
+
+	try
+	{
+		for (auto&& benchmark : benchmarks())
+		{
+			run_benchmark(benchmark);
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
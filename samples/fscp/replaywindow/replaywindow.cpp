@@ -0,0 +1,145 @@
+/**
+ * \file replaywindow.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A self-checking exerciser for the peer_session replay protection window.
+ *
+ * The checks cover the regular cases - in-order delivery, reordering
+ * within the window, duplicates, numbers that fell out of the window -
+ * and the word-boundary regression: advancing the top of the window
+ * across a bitmap word boundary must not clear the word that still
+ * holds the bits of the oldest in-window sequence numbers, otherwise
+ * already-delivered messages become replayable.
+ *
+ * The program prints one line per check and exits with a non-zero
+ * status if any of them failed.
+ */
+
+#include <fscp/constants.hpp>
+#include <fscp/peer_session.hpp>
+
+#include <cryptoplus/buffer.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace
+{
+	typedef fscp::peer_session::current_session_type session_type;
+	typedef fscp::extended_sequence_number_type sequence_type;
+
+	const size_t WINDOW_SIZE = session_type::REPLAY_WINDOW_SIZE;
+
+	unsigned int failure_count = 0;
+
+	/**
+	 * \brief Build a session whose replay window starts empty.
+	 *
+	 * The session parameters are never used by the replay window logic, so
+	 * placeholder values are good enough here.
+	 */
+	session_type make_session()
+	{
+		return session_type(fscp::peer_session::session_parameters(1, fscp::cipher_suite_type(), fscp::elliptic_curve_type(), cryptoplus::buffer()));
+	}
+
+	void check(bool condition, const std::string& description)
+	{
+		if (condition)
+		{
+			std::cout << "[PASS] " << description << std::endl;
+		}
+		else
+		{
+			std::cout << "[FAIL] " << description << std::endl;
+
+			++failure_count;
+		}
+	}
+
+	bool accept(session_type& session, sequence_type sequence_number)
+	{
+		return fscp::peer_session::register_remote_sequence_number(session, sequence_number);
+	}
+
+	void check_basic_cases()
+	{
+		session_type session = make_session();
+
+		check(!accept(session, 0), "sequence number zero is always rejected");
+		check(accept(session, 1), "a fresh sequence number is accepted");
+		check(!accept(session, 1), "an immediate duplicate is rejected");
+		check(accept(session, 5), "a number ahead of the top is accepted");
+		check(accept(session, 3), "a reordered number within the window is accepted");
+		check(!accept(session, 3), "a reordered duplicate is rejected");
+	}
+
+	void check_window_edges()
+	{
+		session_type session = make_session();
+
+		check(accept(session, 2000), "the top can jump forward by more than one");
+		check(accept(session, 2000 - (WINDOW_SIZE - 1)), "the oldest in-window number is still accepted");
+		check(!accept(session, 2000 - (WINDOW_SIZE - 1)), "the oldest in-window number is rejected when replayed");
+		check(!accept(session, 2000 - WINDOW_SIZE), "a number just past the window is rejected");
+	}
+
+	void check_word_boundary_replay()
+	{
+		session_type session = make_session();
+
+		bool all_accepted = true;
+
+		for (sequence_type sequence_number = 1; sequence_number < 64; ++sequence_number)
+		{
+			all_accepted = accept(session, sequence_number) && all_accepted;
+		}
+
+		check(all_accepted, "an in-order burst filling the first bitmap word is accepted");
+
+		// Advancing the top to WINDOW_SIZE walks the clearing loop across
+		// every other word of the bitmap. The first word still covers
+		// sequence numbers 1 to 63, which remain within the window, so
+		// their bits must survive the advance.
+		check(accept(session, WINDOW_SIZE), "advancing the top across a word boundary is accepted");
+
+		bool all_rejected = true;
+
+		for (sequence_type sequence_number = 1; sequence_number < 64; ++sequence_number)
+		{
+			all_rejected = !accept(session, sequence_number) && all_rejected;
+		}
+
+		check(all_rejected, "no delivered number is replayable after the word-boundary advance");
+	}
+
+	void check_far_jump()
+	{
+		session_type session = make_session();
+
+		check(accept(session, 10), "a number is accepted before a far jump");
+		check(accept(session, 1000000), "a jump past the whole bitmap is accepted");
+		check(!accept(session, 10), "a pre-jump number is rejected as too old");
+		check(accept(session, 1000000 - 10), "a fresh in-window number is accepted after the jump");
+		check(!accept(session, 1000000 - 10), "a post-jump duplicate is rejected");
+	}
+}
+
+int main()
+{
+	check_basic_cases();
+	check_window_edges();
+	check_word_boundary_replay();
+	check_far_jump();
+
+	if (failure_count > 0)
+	{
+		std::cout << failure_count << " check(s) failed." << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "All checks passed." << std::endl;
+
+	return EXIT_SUCCESS;
+}
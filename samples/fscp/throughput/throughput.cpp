@@ -0,0 +1,390 @@
+/**
+ * \file throughput.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An end-to-end throughput benchmark that drives fscp servers over loopback.
+ *
+ * The benchmark runs one sink server and a configurable count of peer
+ * servers in the same process, all bound to the loopback interface. Every
+ * peer establishes a session with the sink and keeps a window of data
+ * packets in flight for the duration of the run. Each packet carries its
+ * send timestamp, so the sink can derive one-way latencies along with the
+ * packet and byte rates.
+ *
+ * Usage: throughput [packet_size] [peer_count] [duration_seconds] [cipher_suite]
+ */
+
+#include <fscp/fscp.hpp>
+#include <fscp/server.hpp>
+#include <fscp/constants.hpp>
+
+#include <cryptoplus/cryptoplus.hpp>
+#include <cryptoplus/error/error_strings.hpp>
+#include <cryptoplus/x509/certificate.hpp>
+#include <cryptoplus/x509/extension.hpp>
+#include <cryptoplus/pkey/rsa_key.hpp>
+#include <cryptoplus/pkey/pkey.hpp>
+#include <cryptoplus/asn1/utctime.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef WINDOWS
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+	/**
+	 * \brief The count of data packets each peer keeps in flight.
+	 */
+	const size_t WINDOW_SIZE = 32;
+
+	/**
+	 * \brief The maximum count of latency samples kept.
+	 */
+	const size_t MAX_LATENCY_SAMPLES = 4 * 1024 * 1024;
+
+	/**
+	 * \brief The first UDP port used. The sink binds it, the peers the next ones.
+	 */
+	const uint16_t BASE_PORT = 12000;
+
+	uint64_t now_nanoseconds()
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	std::atomic<bool> running(true);
+
+	std::atomic<uint64_t> received_packets(0);
+	std::atomic<uint64_t> received_bytes(0);
+
+	std::vector<uint64_t> latency_samples;
+	std::atomic<size_t> latency_sample_count(0);
+
+	std::atomic<bool> measurement_started(false);
+	uint64_t measurement_start_ns = 0;
+	uint64_t measurement_end_ns = 0;
+
+#ifndef WINDOWS
+	rusage measurement_start_rusage;
+	rusage measurement_end_rusage;
+
+	uint64_t rusage_cpu_nanoseconds(const rusage& usage)
+	{
+		const uint64_t user = static_cast<uint64_t>(usage.ru_utime.tv_sec) * 1000000000ULL + static_cast<uint64_t>(usage.ru_utime.tv_usec) * 1000ULL;
+		const uint64_t system = static_cast<uint64_t>(usage.ru_stime.tv_sec) * 1000000000ULL + static_cast<uint64_t>(usage.ru_stime.tv_usec) * 1000ULL;
+
+		return user + system;
+	}
+#endif
+
+	/**
+	 * \brief A benchmark peer: a server and its in-flight packet buffers.
+	 */
+	struct peer_type
+	{
+		boost::shared_ptr<fscp::server> server;
+		std::vector<std::vector<uint8_t> > slots;
+	};
+
+	cryptoplus::x509::certificate generate_self_signed_certificate(const cryptoplus::pkey::pkey& private_key, const std::string& common_name)
+	{
+		cryptoplus::x509::certificate certificate = cryptoplus::x509::certificate::create();
+
+		certificate.set_version(2);
+		certificate.subject().push_back("CN", MBSTRING_ASC, common_name.c_str());
+		certificate.set_issuer(certificate.subject());
+		certificate.set_serial_number(cryptoplus::asn1::integer::from_long(1));
+		certificate.push_back(cryptoplus::x509::extension::from_nconf_nid(NID_basic_constraints, "critical,CA:TRUE"));
+
+		const cryptoplus::asn1::utctime not_before = cryptoplus::asn1::utctime::from_ptime(boost::posix_time::second_clock::universal_time() - boost::gregorian::days(1));
+		const cryptoplus::asn1::utctime not_after = cryptoplus::asn1::utctime::from_ptime(boost::posix_time::second_clock::universal_time() + boost::gregorian::days(1));
+
+		certificate.set_not_before(not_before);
+		certificate.set_not_after(not_after);
+
+		certificate.set_public_key(private_key);
+		certificate.sign(private_key, cryptoplus::hash::message_digest_algorithm(NID_sha1));
+
+		return certificate;
+	}
+
+	fscp::identity_store generate_identity(const std::string& common_name)
+	{
+		// 1024-bit keys keep the start-up time reasonable: the key size only
+		// affects the handshake, which is outside the measured window.
+		const cryptoplus::pkey::pkey private_key = cryptoplus::pkey::pkey::from_rsa_key(cryptoplus::pkey::rsa_key::generate_private_key(1024, 17));
+		const cryptoplus::x509::certificate certificate = generate_self_signed_certificate(private_key, common_name);
+
+		return fscp::identity_store(certificate, private_key);
+	}
+
+	void discard_result(const boost::system::error_code&)
+	{
+	}
+
+	void send_packet(fscp::server& server, const fscp::server::ep_type& target, std::vector<uint8_t>* slot);
+
+	void on_packet_sent(fscp::server& server, fscp::server::ep_type target, std::vector<uint8_t>* slot, const boost::system::error_code& ec)
+	{
+		if (!ec && running)
+		{
+			send_packet(server, target, slot);
+		}
+	}
+
+	void send_packet(fscp::server& server, const fscp::server::ep_type& target, std::vector<uint8_t>* slot)
+	{
+		const uint64_t timestamp = now_nanoseconds();
+
+		std::memcpy(&(*slot)[0], &timestamp, sizeof(timestamp));
+
+		server.async_send_data(target, fscp::CHANNEL_NUMBER_0, boost::asio::buffer(*slot), boost::bind(&on_packet_sent, boost::ref(server), target, slot, _1));
+	}
+
+	bool on_hello(fscp::server& server, const fscp::server::ep_type& sender, bool default_accept)
+	{
+		server.async_introduce_to(sender, &discard_result);
+
+		return default_accept;
+	}
+
+	void on_hello_response(fscp::server& server, const fscp::server::ep_type& sender, const boost::system::error_code& ec, const boost::posix_time::time_duration&)
+	{
+		if (ec)
+		{
+			std::cerr << "No HELLO response from " << sender << ": " << ec.message() << std::endl;
+		}
+		else
+		{
+			server.async_introduce_to(sender, &discard_result);
+		}
+	}
+
+	bool on_peer_presentation(fscp::server& server, const fscp::server::ep_type& sender, fscp::server::cert_type, fscp::server::presentation_status_type)
+	{
+		server.async_request_session(sender, &discard_result);
+
+		return true;
+	}
+
+	void on_peer_session_established(peer_type* peer, const fscp::server::ep_type& host, bool is_new, const fscp::cipher_suite_type&, const fscp::elliptic_curve_type&)
+	{
+		if (is_new)
+		{
+			for (size_t i = 0; i < peer->slots.size(); ++i)
+			{
+				send_packet(*peer->server, host, &peer->slots[i]);
+			}
+		}
+	}
+
+	void on_sink_data(const fscp::server::ep_type&, fscp::channel_number_type, fscp::SharedBuffer, boost::asio::const_buffer data)
+	{
+		if (!running)
+		{
+			return;
+		}
+
+		// The measured window starts when the first packet lands, so the
+		// handshake cost does not dilute the rates.
+		if (!measurement_started.exchange(true))
+		{
+			measurement_start_ns = now_nanoseconds();
+
+#ifndef WINDOWS
+			::getrusage(RUSAGE_SELF, &measurement_start_rusage);
+#endif
+		}
+
+		received_packets.fetch_add(1, std::memory_order_relaxed);
+		received_bytes.fetch_add(boost::asio::buffer_size(data), std::memory_order_relaxed);
+
+		if (boost::asio::buffer_size(data) >= sizeof(uint64_t))
+		{
+			uint64_t timestamp;
+
+			std::memcpy(&timestamp, boost::asio::buffer_cast<const uint8_t*>(data), sizeof(timestamp));
+
+			const size_t index = latency_sample_count.fetch_add(1, std::memory_order_relaxed);
+
+			if (index < latency_samples.size())
+			{
+				latency_samples[index] = now_nanoseconds() - timestamp;
+			}
+		}
+	}
+
+	uint64_t percentile(std::vector<uint64_t>& samples, double fraction)
+	{
+		const size_t index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1));
+
+		std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+
+		return samples[index];
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	cryptoplus::crypto_initializer crypto_initializer;
+	cryptoplus::algorithms_initializer algorithms_initializer;
+	cryptoplus::error::error_strings_initializer error_strings_initializer;
+
+	try
+	{
+		const size_t packet_size = (argc > 1) ? boost::lexical_cast<size_t>(argv[1]) : 1446;
+		const size_t peer_count = (argc > 2) ? boost::lexical_cast<size_t>(argv[2]) : 1;
+		const unsigned int duration_seconds = (argc > 3) ? boost::lexical_cast<unsigned int>(argv[3]) : 10;
+
+		fscp::cipher_suite_list_type cipher_suites = fscp::get_default_cipher_suites();
+
+		if (argc > 4)
+		{
+			cipher_suites.assign(1, fscp::cipher_suite_type::from_string(argv[4]));
+		}
+
+		if (packet_size < sizeof(uint64_t))
+		{
+			std::cerr << "The packet size must be at least " << sizeof(uint64_t) << " byte(s)." << std::endl;
+
+			return EXIT_FAILURE;
+		}
+
+		std::cout << "Packet size: " << packet_size << " byte(s)" << std::endl;
+		std::cout << "Peer count: " << peer_count << std::endl;
+		std::cout << "Duration: " << duration_seconds << " second(s)" << std::endl;
+		std::cout << "Cipher suite: " << cipher_suites.front() << std::endl;
+
+		latency_samples.resize(MAX_LATENCY_SAMPLES);
+
+		boost::asio::io_service _io_service;
+		fscp::logger _logger;
+
+		const boost::asio::ip::address loopback = boost::asio::ip::address_v4::loopback();
+
+		fscp::server sink_server(_io_service, _logger, generate_identity("sink"));
+
+		sink_server.set_cipher_suites(cipher_suites);
+		sink_server.set_hello_message_received_callback(boost::bind(&on_hello, boost::ref(sink_server), _1, _2));
+		sink_server.set_data_received_callback(&on_sink_data);
+		sink_server.open(fscp::server::ep_type(loopback, BASE_PORT));
+
+		const fscp::server::ep_type sink_endpoint(loopback, BASE_PORT);
+
+		std::vector<boost::shared_ptr<peer_type> > peers;
+
+		for (size_t i = 0; i < peer_count; ++i)
+		{
+			const boost::shared_ptr<peer_type> peer = boost::make_shared<peer_type>();
+
+			peer->server = boost::make_shared<fscp::server>(boost::ref(_io_service), boost::ref(_logger), generate_identity("peer-" + boost::lexical_cast<std::string>(i)));
+			peer->slots.resize(WINDOW_SIZE, std::vector<uint8_t>(packet_size));
+
+			peer->server->set_cipher_suites(cipher_suites);
+			peer->server->set_hello_message_received_callback(boost::bind(&on_hello, boost::ref(*peer->server), _1, _2));
+			peer->server->set_presentation_message_received_callback(boost::bind(&on_peer_presentation, boost::ref(*peer->server), _1, _2, _3));
+			peer->server->set_session_established_callback(boost::bind(&on_peer_session_established, peer.get(), _1, _2, _3, _4));
+			peer->server->open(fscp::server::ep_type(loopback, static_cast<uint16_t>(BASE_PORT + 1 + i)));
+
+			const fscp::server::ep_type peer_endpoint(loopback, static_cast<uint16_t>(BASE_PORT + 1 + i));
+
+			peer->server->set_presentation(sink_endpoint, sink_server.get_identity().signature_certificate(), cryptoplus::buffer());
+			sink_server.set_presentation(peer_endpoint, peer->server->get_identity().signature_certificate(), cryptoplus::buffer());
+
+			peers.push_back(peer);
+		}
+
+		for (size_t i = 0; i < peers.size(); ++i)
+		{
+			peers[i]->server->async_greet(sink_endpoint, boost::bind(&on_hello_response, boost::ref(*peers[i]->server), sink_endpoint, _1, _2));
+		}
+
+		boost::asio::deadline_timer stop_timer(_io_service, boost::posix_time::seconds(duration_seconds));
+
+		stop_timer.async_wait([&] (const boost::system::error_code&) {
+			measurement_end_ns = now_nanoseconds();
+
+#ifndef WINDOWS
+			::getrusage(RUSAGE_SELF, &measurement_end_rusage);
+#endif
+
+			running = false;
+
+			sink_server.close();
+
+			for (size_t i = 0; i < peers.size(); ++i)
+			{
+				peers[i]->server->close();
+			}
+		});
+
+		boost::thread_group threads;
+
+		const unsigned int thread_count = std::max<unsigned int>(boost::thread::hardware_concurrency(), 2);
+
+		for (unsigned int i = 0; i < thread_count; ++i)
+		{
+			threads.create_thread(boost::bind(static_cast<std::size_t (boost::asio::io_service::*)()>(&boost::asio::io_service::run), &_io_service));
+		}
+
+		threads.join_all();
+
+		const uint64_t packets = received_packets.load();
+		const uint64_t bytes = received_bytes.load();
+
+		if (!measurement_started || (packets == 0) || (measurement_end_ns <= measurement_start_ns))
+		{
+			std::cerr << "No data was received: nothing to report." << std::endl;
+
+			return EXIT_FAILURE;
+		}
+
+		const double elapsed_seconds = static_cast<double>(measurement_end_ns - measurement_start_ns) / 1e9;
+		const double pps = static_cast<double>(packets) / elapsed_seconds;
+		const double gbps = static_cast<double>(bytes) * 8.0 / elapsed_seconds / 1e9;
+
+		std::cout << std::endl;
+		std::cout << "Packets received: " << packets << " in " << std::fixed << std::setprecision(2) << elapsed_seconds << " second(s)" << std::endl;
+		std::cout << "Rate: " << std::setprecision(0) << pps << " pps, " << std::setprecision(3) << gbps << " Gbps (payload)" << std::endl;
+
+		std::vector<uint64_t> samples(latency_samples.begin(), latency_samples.begin() + std::min(latency_sample_count.load(), latency_samples.size()));
+
+		if (!samples.empty())
+		{
+			const uint64_t p50 = percentile(samples, 0.50);
+			const uint64_t p99 = percentile(samples, 0.99);
+
+			std::cout << "Latency: p50 " << std::setprecision(1) << static_cast<double>(p50) / 1000.0 << " us, p99 " << static_cast<double>(p99) / 1000.0 << " us (one-way, " << samples.size() << " samples)" << std::endl;
+		}
+
+#ifndef WINDOWS
+		const uint64_t cpu_ns = rusage_cpu_nanoseconds(measurement_end_rusage) - rusage_cpu_nanoseconds(measurement_start_rusage);
+
+		std::cout << "CPU: " << std::setprecision(0) << static_cast<double>(cpu_ns) / static_cast<double>(packets) << " ns/packet (user+system, all threads)" << std::endl;
+#endif
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Exception caught: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,384 @@
+/**
+ * \file bench.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A parse and serialize benchmark suite for kfather, run on the JSON documents freelan actually exchanges.
+ */
+
+#include <kfather/parser.hpp>
+#include <kfather/document.hpp>
+#include <kfather/formatter.hpp>
+#include <kfather/value.hpp>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	/**
+	 * \brief The count of heap allocations since startup.
+	 *
+	 * The counter is maintained by the replaced global operator new below.
+	 * The benchmarks run single-threaded, so a plain integer is enough.
+	 */
+	size_t allocation_count = 0;
+}
+
+void* operator new(std::size_t size)
+{
+	++allocation_count;
+
+	void* const result = std::malloc(size);
+
+	if (!result)
+	{
+		throw std::bad_alloc();
+	}
+
+	return result;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+namespace
+{
+	/**
+	 * \brief The minimum measured duration for a benchmark to be reported.
+	 *
+	 * The iteration count is scaled up until a run takes at least this long,
+	 * so fast parses are still timed over a meaningful interval.
+	 */
+	const boost::posix_time::time_duration MIN_RUN_DURATION = boost::posix_time::milliseconds(500);
+
+	typedef boost::function<void (size_t)> benchmark_function_type;
+
+	struct benchmark_type
+	{
+		std::string name;
+		benchmark_function_type function;
+		size_t bytes_per_iteration;
+	};
+
+	std::vector<benchmark_type>& benchmarks()
+	{
+		static std::vector<benchmark_type> result;
+
+		return result;
+	}
+
+	void register_benchmark(const std::string& name, size_t bytes_per_iteration, benchmark_function_type function)
+	{
+		const benchmark_type benchmark = { name, function, bytes_per_iteration };
+
+		benchmarks().push_back(benchmark);
+	}
+
+	void run_benchmark(const benchmark_type& benchmark)
+	{
+		using boost::posix_time::microsec_clock;
+
+		size_t iterations = 4;
+		boost::posix_time::time_duration elapsed;
+		size_t allocations = 0;
+
+		// Scale the iteration count until the run lasts long enough for the
+		// clock resolution not to matter.
+		for (;;)
+		{
+			const size_t allocations_before = allocation_count;
+			const boost::posix_time::ptime start = microsec_clock::universal_time();
+
+			benchmark.function(iterations);
+
+			elapsed = microsec_clock::universal_time() - start;
+			allocations = allocation_count - allocations_before;
+
+			if (elapsed >= MIN_RUN_DURATION)
+			{
+				break;
+			}
+
+			iterations *= 4;
+		}
+
+		const double seconds = static_cast<double>(elapsed.total_microseconds()) / 1000000.0;
+		const double megabytes_per_second = static_cast<double>(benchmark.bytes_per_iteration) * static_cast<double>(iterations) / seconds / (1024.0 * 1024.0);
+		const double allocations_per_iteration = static_cast<double>(allocations) / static_cast<double>(iterations);
+
+		std::cout << std::left << std::setw(56) << benchmark.name;
+		std::cout << std::right << std::setw(10) << std::fixed << std::setprecision(1) << megabytes_per_second << " MB/s";
+		std::cout << std::setw(12) << std::setprecision(1) << allocations_per_iteration << " allocs/op";
+		std::cout << std::setw(10) << benchmark.bytes_per_iteration << " bytes";
+		std::cout << std::endl;
+	}
+
+	/**
+	 * \brief Get a base64-looking blob of the specified size.
+	 *
+	 * The content does not need to decode: only its length and character
+	 * class matter to the parser.
+	 */
+	std::string base64_blob(size_t size, size_t seed)
+	{
+		static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		std::string result;
+		result.reserve(size);
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			seed = seed * 2654435761UL + 1;
+			result.push_back(alphabet[seed % 64]);
+		}
+
+		return result;
+	}
+
+	/**
+	 * \brief Build an authority contacts list, as the web server answers it.
+	 *
+	 * The document maps one base64 certificate hash per member to its list of
+	 * endpoints - the shape of the /request_contacts/ responses.
+	 */
+	std::string make_contacts_list(size_t member_count)
+	{
+		std::ostringstream oss;
+
+		oss << "{\"contacts\":{";
+
+		for (size_t i = 0; i < member_count; ++i)
+		{
+			if (i > 0)
+			{
+				oss << ",";
+			}
+
+			oss << "\"" << base64_blob(43, i) << "=\":[";
+			oss << "\"" << (10 + i % 200) << "." << (i / 200 % 256) << "." << (i % 256) << "." << (1 + i % 254) << ":12000\",";
+			oss << "\"[fe80::" << std::hex << (0x1000 + i) << std::dec << "]:12000\"";
+			oss << "]";
+		}
+
+		oss << "}}";
+
+		return oss.str();
+	}
+
+	/**
+	 * \brief Build a certificate request body, as the web client sends it.
+	 *
+	 * Nearly all the bytes sit in one large base64 string: this measures the
+	 * string scanning paths rather than the structural ones.
+	 */
+	std::string make_certificate_request()
+	{
+		std::ostringstream oss;
+
+		oss << "{\"certificate_request\":\"" << base64_blob(1536, 42) << "\",";
+		oss << "\"username\":\"alice\"}";
+
+		return oss.str();
+	}
+
+	/**
+	 * \brief Build a statistics snapshot, as /get_statistics/ answers it.
+	 *
+	 * The document is dominated by small numbers under repeated keys - one
+	 * counters object per peer.
+	 */
+	std::string make_statistics_snapshot(size_t peer_count)
+	{
+		std::ostringstream oss;
+
+		oss << "{\"peers\":{";
+
+		for (size_t i = 0; i < peer_count; ++i)
+		{
+			if (i > 0)
+			{
+				oss << ",";
+			}
+
+			oss << "\"" << (10 + i % 200) << ".0." << (i % 256) << "." << (1 + i % 254) << ":12000\":{";
+			oss << "\"packets_in\":" << (100000 + i * 17) << ",";
+			oss << "\"bytes_in\":" << (140000000 + i * 1021) << ",";
+			oss << "\"packets_out\":" << (90000 + i * 13) << ",";
+			oss << "\"bytes_out\":" << (120000000 + i * 977) << ",";
+			oss << "\"crypto_failures\":0,";
+			oss << "\"replay_drops\":" << (i % 3) << ",";
+			oss << "\"decrypt_backlog_drops\":0,";
+			oss << "\"send_queue_depth\":" << (i % 7);
+			oss << "}";
+		}
+
+		oss << "},";
+		oss << "\"ethernet_address_map_size\":" << (peer_count * 3) << ",";
+		oss << "\"switch_unknown_unicast_floods\":1289,";
+		oss << "\"switch_suppressed_floods\":451,";
+		oss << "\"switch_gossip_learned\":" << (peer_count * 2) << ",";
+		oss << "\"socket_buffer_pool_idle\":24,";
+		oss << "\"session_buffer_pool_idle\":12,";
+		oss << "\"tap_adapter_buffer_pool_idle\":8";
+		oss << "}";
+
+		return oss.str();
+	}
+
+	/**
+	 * \brief Register every benchmark for a given document.
+	 *
+	 * The document string outlives the benchmark functions that share it, so
+	 * it is captured by value in the closures.
+	 */
+	void register_document_benchmarks(const std::string& name, const std::string& doc)
+	{
+		register_benchmark(
+			name + "/dom-parse",
+			doc.size(),
+			[doc] (size_t iterations) {
+				kfather::parser parser;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					kfather::value_type value;
+
+					parser.parse(value, doc);
+				}
+			}
+		);
+
+		register_benchmark(
+			name + "/sax-parse",
+			doc.size(),
+			[doc] (size_t iterations) {
+				kfather::stream_parser parser;
+
+				// The callbacks keep a checksum alive so the event
+				// dispatching is not optimized away.
+				size_t checksum = 0;
+
+				parser.set_key_callback([&checksum] (const kfather::string_type& key) { checksum += key.size(); });
+				parser.set_string_callback([&checksum] (const kfather::string_type& str) { checksum += str.size(); });
+				parser.set_number_callback([&checksum] (const kfather::number_type& number) { checksum += static_cast<size_t>(number); });
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					parser.feed(doc);
+					parser.finish();
+					parser.reset();
+				}
+
+				if (checksum == 0)
+				{
+					std::cout << "";
+				}
+			}
+		);
+
+		register_benchmark(
+			name + "/arena-parse",
+			doc.size(),
+			[doc] (size_t iterations) {
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					kfather::document document;
+
+					document.parse(doc);
+				}
+			}
+		);
+
+		// The serialization benchmarks parse once, outside the measured
+		// region, and format the same tree every iteration.
+		kfather::parser parser;
+		kfather::value_type value;
+
+		if (!parser.parse(value, doc))
+		{
+			std::cerr << "Unable to parse the generated " << name << " document." << std::endl;
+
+			return;
+		}
+
+		register_benchmark(
+			name + "/dom-serialize",
+			doc.size(),
+			[value] (size_t iterations) {
+				const kfather::compact_formatter formatter;
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					const std::string result = formatter.format(value);
+
+					if (result.empty())
+					{
+						std::cout << "";
+					}
+				}
+			}
+		);
+
+		register_benchmark(
+			name + "/sink-serialize",
+			doc.size(),
+			[value] (size_t iterations) {
+				const kfather::compact_sink_formatter formatter;
+				size_t total = 0;
+
+				const kfather::compact_sink_formatter::sink_type sink = [&total] (const char*, size_t data_len) {
+					total += data_len;
+				};
+
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					formatter.format(sink, value);
+				}
+
+				if (total == 0)
+				{
+					std::cout << "";
+				}
+			}
+		);
+	}
+}
+
+int main()
+{
+	std::cout << "kfather benchmark suite" << std::endl;
+	std::cout << std::endl;
+
+	register_document_benchmarks("contacts-list-50", make_contacts_list(50));
+	register_document_benchmarks("contacts-list-1000", make_contacts_list(1000));
+	register_document_benchmarks("certificate-request", make_certificate_request());
+	register_document_benchmarks("statistics-50-peers", make_statistics_snapshot(50));
+	register_document_benchmarks("statistics-1000-peers", make_statistics_snapshot(1000));
+
+	for (auto&& benchmark : benchmarks())
+	{
+		run_benchmark(benchmark);
+	}
+
+	return EXIT_SUCCESS;
+}